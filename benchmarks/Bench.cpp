@@ -0,0 +1,571 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Tooling/Tooling.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/InitializePasses.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "rellic/AST/CondBasedRefine.h"
+#include "rellic/AST/DeadStmtElim.h"
+#include "rellic/AST/DebugInfoCollector.h"
+#include "rellic/AST/DecompilationContext.h"
+#include "rellic/AST/ExprCombine.h"
+#include "rellic/AST/GenerateAST.h"
+#include "rellic/AST/LocalDeclRenamer.h"
+#include "rellic/AST/LoopRefine.h"
+#include "rellic/AST/MaterializeConds.h"
+#include "rellic/AST/NestedCondProp.h"
+#include "rellic/AST/NestedScopeCombine.h"
+#include "rellic/AST/Prover.h"
+#include "rellic/AST/ReachBasedRefine.h"
+#include "rellic/AST/StructFieldRenamer.h"
+#include "rellic/AST/StructGenerator.h"
+#include "rellic/AST/SubprogramGenerator.h"
+#include "rellic/AST/Util.h"
+#include "rellic/AST/Z3CondSimplify.h"
+#include "rellic/BC/Synthetic.h"
+#include "rellic/BC/Util.h"
+#include "rellic/Decompiler.h"
+
+DEFINE_string(samples, RELLIC_BENCH_SAMPLES,
+              "Comma-separated directories whose .bc and .ll files are "
+              "benchmarked.");
+DEFINE_string(headergen_samples, RELLIC_BENCH_HEADERGEN_SAMPLES,
+              "Comma-separated directories whose .bc and .ll files with "
+              "debug info are benchmarked by the HeaderGen benchmarks.");
+DEFINE_uint32(max_size, 256,
+              "Largest size of the synthetic functions decompiled by the "
+              "Scaling benchmarks.");
+
+namespace {
+
+// A module to benchmark. Synthetic modules are generated at each of their
+// sizes, which are the arguments of their benchmarks.
+struct Sample {
+  std::string name;
+  std::function<std::unique_ptr<llvm::Module>(llvm::LLVMContext&, int64_t)>
+      create;
+  std::vector<int64_t> sizes;
+};
+
+// A sample ready to be decompiled, as rellic::Decompile would prepare it
+struct LoadedSample {
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module;
+  rellic::DebugInfoCollector dic;
+};
+
+static std::unique_ptr<LoadedSample> Load(const benchmark::State& state,
+                                          const Sample& sample) {
+  auto loaded{std::make_unique<LoadedSample>()};
+  auto size{sample.sizes.empty() ? 0 : state.range(0)};
+  loaded->module = sample.create(loaded->llvm_ctx, size);
+  CHECK(loaded->module) << "Cannot load " << sample.name;
+  rellic::PreprocessOptions options;
+  options.remove_phi_nodes = true;
+  rellic::PreprocessModule(*loaded->module, options);
+  loaded->dic.visit(*loaded->module);
+  return loaded;
+}
+
+// An empty translation unit for `triple`
+static std::unique_ptr<clang::ASTUnit> CreateASTUnit(
+    const std::string& triple) {
+  std::vector<std::string> args{"-Wno-pointer-to-int-cast",
+                                "-Wno-pointer-sign", "-target", triple};
+  return clang::tooling::buildASTFromCodeWithArgs("", args, "out.c");
+}
+
+// A translation unit for a loaded sample, optionally with its initial AST
+struct Decompilation {
+  std::unique_ptr<clang::ASTUnit> ast_unit;
+  std::unique_ptr<rellic::DecompilationContext> dec_ctx;
+
+  Decompilation(LoadedSample& sample, bool generate) {
+    ast_unit = CreateASTUnit(sample.module->getTargetTriple());
+    dec_ctx = std::make_unique<rellic::DecompilationContext>(*ast_unit);
+    if (generate) {
+      rellic::GenerateAST::run(*sample.module, *dec_ctx);
+    }
+  }
+};
+
+using PassFactory = std::function<std::unique_ptr<rellic::ASTPass>(
+    rellic::DecompilationContext&, LoadedSample&)>;
+
+template <typename T>
+static PassFactory Create() {
+  return [](rellic::DecompilationContext& dec_ctx, LoadedSample&) {
+    return std::make_unique<T>(dec_ctx);
+  };
+}
+
+static const std::pair<const char*, PassFactory> passes[]{
+    {"cbr", Create<rellic::CondBasedRefine>()},
+    {"dse", Create<rellic::DeadStmtElim>()},
+    {"ec", Create<rellic::ExprCombine>()},
+    {"lr", Create<rellic::LoopRefine>()},
+    {"mc", Create<rellic::MaterializeConds>()},
+    {"ncp", Create<rellic::NestedCondProp>()},
+    {"nsc", Create<rellic::NestedScopeCombine>()},
+    {"rbr", Create<rellic::ReachBasedRefine>()},
+    {"zcs", Create<rellic::Z3CondSimplify>()},
+    {"ldr",
+     [](rellic::DecompilationContext& dec_ctx, LoadedSample& sample) {
+       return std::make_unique<rellic::LocalDeclRenamer>(
+           dec_ctx, sample.dic.GetIRToNameMap());
+     }},
+    {"sfr",
+     [](rellic::DecompilationContext& dec_ctx, LoadedSample& sample) {
+       return std::make_unique<rellic::StructFieldRenamer>(
+           dec_ctx, sample.dic.GetIRTypeToDITypeMap());
+     }},
+};
+
+// Reaching conditions of the initial AST of `dec_ctx`, without duplicates
+static std::vector<z3::expr> GetConds(rellic::DecompilationContext& dec_ctx) {
+  std::unordered_set<unsigned> seen;
+  std::vector<z3::expr> conds;
+  for (auto& [stmt, idx] : dec_ctx.conds) {
+    if (seen.insert(idx).second) {
+      conds.push_back(dec_ctx.z3_exprs[idx]);
+    }
+  }
+  return conds;
+}
+
+static void BM_GenerateAST(benchmark::State& state, const Sample& sample) {
+  auto loaded{Load(state, sample)};
+  std::optional<Decompilation> decomp;
+  for (auto _ : state) {
+    // The previous translation unit is freed outside of the measurement
+    state.PauseTiming();
+    decomp.reset();
+    decomp.emplace(*loaded, false);
+    state.ResumeTiming();
+    rellic::GenerateAST::run(*loaded->module, *decomp->dec_ctx);
+  }
+}
+
+// Runs a pass once on the initial AST, which is rebuilt before each run
+static void BM_Pass(benchmark::State& state, const Sample& sample,
+                    const PassFactory& create) {
+  auto loaded{Load(state, sample)};
+  std::optional<Decompilation> decomp;
+  size_t num_changes{0};
+  for (auto _ : state) {
+    state.PauseTiming();
+    decomp.reset();
+    decomp.emplace(*loaded, true);
+    auto pass{create(*decomp->dec_ctx, *loaded)};
+    state.ResumeTiming();
+    num_changes += pass->Run();
+  }
+  state.counters["changed"] = benchmark::Counter(
+      num_changes, benchmark::Counter::kAvgIterations);
+}
+
+// Decides or simplifies every reaching condition of the initial AST
+template <typename Query>
+static void BM_Conds(benchmark::State& state, const Sample& sample,
+                     Query query) {
+  auto loaded{Load(state, sample)};
+  Decompilation decomp(*loaded, true);
+  auto conds{GetConds(*decomp.dec_ctx)};
+  if (conds.empty()) {
+    state.SkipWithError("No reaching conditions.");
+    return;
+  }
+  for (auto _ : state) {
+    query(state, *decomp.dec_ctx, conds);
+  }
+  state.counters["conds"] = conds.size();
+}
+
+static void ProveConds(benchmark::State&, rellic::DecompilationContext&,
+                       const std::vector<z3::expr>& conds) {
+  for (auto& cond : conds) {
+    auto result{rellic::Prove(cond)};
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+static void HeavySimplifyConds(benchmark::State&,
+                               rellic::DecompilationContext&,
+                               const std::vector<z3::expr>& conds) {
+  for (auto& cond : conds) {
+    auto result{rellic::HeavySimplify(cond)};
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+// The prover memoizes its results, so a new one is used for every iteration
+static void ProverProveConds(benchmark::State& state,
+                             rellic::DecompilationContext& dec_ctx,
+                             const std::vector<z3::expr>& conds) {
+  state.PauseTiming();
+  rellic::Prover prover(dec_ctx.z3_ctx);
+  state.ResumeTiming();
+  for (auto& cond : conds) {
+    auto result{prover.Prove(cond)};
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+static void ProverSimplifyConds(benchmark::State& state,
+                                rellic::DecompilationContext& dec_ctx,
+                                const std::vector<z3::expr>& conds) {
+  state.PauseTiming();
+  rellic::Prover prover(dec_ctx.z3_ctx);
+  state.ResumeTiming();
+  for (auto& cond : conds) {
+    auto result{prover.Simplify(cond)};
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+// Decompiles a synthetic function of each size in turn, from loading to the
+// end of refinement, so that the complexity of the whole pipeline in the size
+// of the shape can be fitted
+static void BM_Scaling(benchmark::State& state, rellic::SyntheticShape shape) {
+  auto size{static_cast<unsigned>(state.range(0))};
+  for (auto _ : state) {
+    state.PauseTiming();
+    llvm::LLVMContext llvm_ctx;
+    auto module{rellic::CreateSyntheticModule(llvm_ctx, shape, size)};
+    rellic::DecompilationOptions options;
+    options.remove_phi_nodes = true;
+    state.ResumeTiming();
+    auto result{rellic::Decompile(std::move(module), std::move(options))};
+    state.PauseTiming();
+    if (!result.Succeeded()) {
+      state.SkipWithError(result.TakeError().message.c_str());
+      break;
+    }
+    // The translation unit is freed outside of the measurement
+    result.TakeValue();
+    state.ResumeTiming();
+  }
+  state.SetComplexityN(state.range(0));
+}
+
+// A sample as rellic-headergen loads it, without preprocessing, along with the
+// types and subprograms collected from its debug info
+struct DebugInfoSample {
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module;
+  std::optional<rellic::DebugInfoCollector> dic;
+  std::vector<llvm::DIType*> types;
+};
+
+static std::unique_ptr<DebugInfoSample> LoadDebugInfo(
+    const benchmark::State& state, const Sample& sample, bool collect) {
+  auto loaded{std::make_unique<DebugInfoSample>()};
+  auto size{sample.sizes.empty() ? 0 : state.range(0)};
+  loaded->module = sample.create(loaded->llvm_ctx, size);
+  CHECK(loaded->module) << "Cannot load " << sample.name;
+  if (collect) {
+    loaded->dic.emplace();
+    loaded->dic->visit(*loaded->module);
+    auto& types{loaded->dic->GetTypes()};
+    loaded->types.assign(types.begin(), types.end());
+  }
+  return loaded;
+}
+
+// Declarations generated from debug info, destroyed in reverse order
+struct HeaderGeneration {
+  std::unique_ptr<clang::ASTUnit> ast_unit;
+  std::optional<rellic::StructGenerator> strctgen;
+
+  HeaderGeneration(DebugInfoSample& sample)
+      : ast_unit(CreateASTUnit(sample.module->getTargetTriple())) {
+    strctgen.emplace(*ast_unit);
+  }
+};
+
+// Memory that is still allocated at the end of each phase of a benchmark,
+// reported as the average over its iterations. It is measured while the timer
+// is paused.
+class PhaseMemory {
+  benchmark::State& state;
+  size_t start{0};
+  double total{0};
+
+ public:
+  PhaseMemory(benchmark::State& state) : state(state) {}
+
+  // Both are called with the timer paused
+  void Start() { start = llvm::sys::Process::GetMallocUsage(); }
+  void Stop() {
+    auto usage{llvm::sys::Process::GetMallocUsage()};
+    total += usage > start ? usage - start : 0;
+  }
+
+  ~PhaseMemory() {
+    state.counters["bytes"] =
+        benchmark::Counter(total, benchmark::Counter::kAvgIterations,
+                           benchmark::Counter::kIs1024);
+  }
+};
+
+// Collects the debug info of the module, as the first step of headergen
+static void BM_CollectDebugInfo(benchmark::State& state,
+                                const Sample& sample) {
+  auto loaded{LoadDebugInfo(state, sample, false)};
+  std::optional<rellic::DebugInfoCollector> dic;
+  PhaseMemory memory(state);
+  for (auto _ : state) {
+    state.PauseTiming();
+    dic.reset();
+    memory.Start();
+    dic.emplace();
+    state.ResumeTiming();
+    dic->visit(*loaded->module);
+    state.PauseTiming();
+    memory.Stop();
+    state.ResumeTiming();
+  }
+  if (dic) {
+    state.counters["types"] = dic->GetTypes().size();
+    state.counters["subprograms"] = dic->GetSubprograms().size();
+  }
+}
+
+// Generates the declarations of all the collected types in a new translation
+// unit, which is where the type graph is walked and deduplicated
+static void BM_GenerateDecls(benchmark::State& state, const Sample& sample) {
+  auto loaded{LoadDebugInfo(state, sample, true)};
+  if (loaded->types.empty()) {
+    state.SkipWithError("No debug info types.");
+    return;
+  }
+  std::optional<HeaderGeneration> gen;
+  PhaseMemory memory(state);
+  for (auto _ : state) {
+    state.PauseTiming();
+    gen.reset();
+    gen.emplace(*loaded);
+    memory.Start();
+    state.ResumeTiming();
+    gen->strctgen->GenerateDecls(loaded->types.begin(), loaded->types.end());
+    state.PauseTiming();
+    memory.Stop();
+    state.ResumeTiming();
+  }
+  state.counters["types"] = loaded->types.size();
+}
+
+// Generates the prototypes of the collected subprograms, once the
+// declarations of the types are in place
+static void BM_GenerateSubprograms(benchmark::State& state,
+                                   const Sample& sample) {
+  auto loaded{LoadDebugInfo(state, sample, true)};
+  auto& subprograms{loaded->dic->GetSubprograms()};
+  if (subprograms.empty()) {
+    state.SkipWithError("No subprograms.");
+    return;
+  }
+  std::optional<HeaderGeneration> gen;
+  PhaseMemory memory(state);
+  for (auto _ : state) {
+    state.PauseTiming();
+    gen.reset();
+    gen.emplace(*loaded);
+    gen->strctgen->GenerateDecls(loaded->types.begin(), loaded->types.end());
+    memory.Start();
+    state.ResumeTiming();
+    rellic::SubprogramGenerator subgen(*gen->ast_unit, *gen->strctgen);
+    for (auto subprogram : subprograms) {
+      subgen.VisitSubprogram(subprogram);
+    }
+    state.PauseTiming();
+    memory.Stop();
+    state.ResumeTiming();
+  }
+  state.counters["subprograms"] = subprograms.size();
+}
+
+static std::vector<Sample> GetSyntheticSamples() {
+  std::vector<Sample> samples;
+  for (auto shape : rellic::GetSyntheticShapes()) {
+    samples.push_back({std::string("synthetic/") +
+                           rellic::GetSyntheticShapeName(shape),
+                       [shape](llvm::LLVMContext& ctx, int64_t size) {
+                         return rellic::CreateSyntheticModule(
+                             ctx, shape, static_cast<unsigned>(size));
+                       },
+                       {8, 32, 128}});
+  }
+  return samples;
+}
+
+static std::vector<Sample> GetSyntheticTypeSamples() {
+  std::vector<Sample> samples;
+  for (auto graph : rellic::GetSyntheticTypeGraphs()) {
+    samples.push_back({std::string("synthetic/") +
+                           rellic::GetSyntheticTypeGraphName(graph),
+                       [graph](llvm::LLVMContext& ctx, int64_t size) {
+                         return rellic::CreateSyntheticTypeModule(
+                             ctx, graph, static_cast<unsigned>(size));
+                       },
+                       {64, 512, 4096}});
+  }
+  return samples;
+}
+
+// Finds the .bc and .ll files of the comma-separated directories `paths`
+static std::vector<Sample> FindSamples(llvm::StringRef paths) {
+  std::vector<Sample> samples;
+  llvm::SmallVector<llvm::StringRef, 4> dirs;
+  paths.split(dirs, ',', -1, false);
+  for (auto dir : dirs) {
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(dir, ec), end; it != end && !ec;
+         it.increment(ec)) {
+      auto ext{llvm::sys::path::extension(it->path())};
+      if (ext != ".bc" && ext != ".ll") {
+        continue;
+      }
+      auto path{it->path()};
+      samples.push_back({llvm::sys::path::filename(path).str(),
+                         [path](llvm::LLVMContext& ctx, int64_t) {
+                           return std::unique_ptr<llvm::Module>(
+                               rellic::LoadModuleFromFile(&ctx, path, true));
+                         },
+                         {}});
+    }
+    if (ec) {
+      LOG(WARNING) << "Cannot list " << dir.str() << ": " << ec.message();
+    }
+  }
+  std::sort(samples.begin(), samples.end(),
+            [](const Sample& a, const Sample& b) { return a.name < b.name; });
+  return samples;
+}
+
+// Registers `fn` as the benchmark `name` of `sample`, at each of its sizes
+template <typename Fn>
+static void RegisterSampleBenchmark(const std::string& name,
+                                    const Sample& sample, Fn fn) {
+  auto bench{benchmark::RegisterBenchmark(
+      (name + "/" + sample.name).c_str(),
+      [fn, &sample](benchmark::State& state) { fn(state, sample); })};
+  bench->Unit(benchmark::kMillisecond);
+  for (auto size : sample.sizes) {
+    bench->Arg(size);
+  }
+}
+
+static void RegisterBenchmarks(const std::vector<Sample>& samples) {
+  for (auto& sample : samples) {
+    auto Register{[&sample](const std::string& name, auto fn) {
+      RegisterSampleBenchmark(name, sample, fn);
+    }};
+
+    Register("GenerateAST", BM_GenerateAST);
+    for (auto& [name, create] : passes) {
+      auto& factory{create};
+      Register(std::string("Pass/") + name,
+               [&factory](benchmark::State& state, const Sample& sample) {
+                 BM_Pass(state, sample, factory);
+               });
+    }
+    for (auto& [name, query] :
+         {std::make_pair("Prove", ProveConds),
+          std::make_pair("HeavySimplify", HeavySimplifyConds),
+          std::make_pair("Prover.Prove", ProverProveConds),
+          std::make_pair("Prover.Simplify", ProverSimplifyConds)}) {
+      auto fn{query};
+      Register(name, [fn](benchmark::State& state, const Sample& sample) {
+        BM_Conds(state, sample, fn);
+      });
+    }
+  }
+}
+
+// Measures each phase of rellic-headergen on its own
+static void RegisterHeaderGenBenchmarks(const std::vector<Sample>& samples) {
+  for (auto& sample : samples) {
+    RegisterSampleBenchmark("HeaderGen/Collect", sample, BM_CollectDebugInfo);
+    RegisterSampleBenchmark("HeaderGen/GenerateDecls", sample,
+                            BM_GenerateDecls);
+    RegisterSampleBenchmark("HeaderGen/Subprograms", sample,
+                            BM_GenerateSubprograms);
+  }
+}
+
+// Sweeps each synthetic shape over powers of two, reporting the fitted
+// complexity after the runs of each shape
+static void RegisterScalingBenchmarks() {
+  for (auto shape : rellic::GetSyntheticShapes()) {
+    auto bench{benchmark::RegisterBenchmark(
+        (std::string("Scaling/") + rellic::GetSyntheticShapeName(shape))
+            .c_str(),
+        [shape](benchmark::State& state) { BM_Scaling(state, shape); })};
+    bench->Unit(benchmark::kMillisecond)
+        ->RangeMultiplier(2)
+        ->Range(8, std::max<int64_t>(8, FLAGS_max_size))
+        ->Complexity();
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  // Flags of Google Benchmark are removed from the command line before
+  // gflags parses the rest
+  benchmark::Initialize(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  // Passes log every run, which would be measured as well
+  if (google::GetCommandLineFlagInfoOrDie("minloglevel").is_default) {
+    FLAGS_minloglevel = google::GLOG_WARNING;
+  }
+
+  auto& pr{*llvm::PassRegistry::getPassRegistry()};
+  initializeCore(pr);
+  initializeAnalysis(pr);
+
+  // Samples are kept alive until the benchmarks are done
+  static auto samples{FindSamples(FLAGS_samples)};
+  for (auto& sample : GetSyntheticSamples()) {
+    samples.push_back(std::move(sample));
+  }
+  static auto headergen_samples{FindSamples(FLAGS_headergen_samples)};
+  for (auto& sample : GetSyntheticTypeSamples()) {
+    headergen_samples.push_back(std::move(sample));
+  }
+  RegisterBenchmarks(samples);
+  RegisterHeaderGenBenchmarks(headergen_samples);
+  RegisterScalingBenchmarks();
+  benchmark::RunSpecifiedBenchmarks();
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+  return EXIT_SUCCESS;
+}
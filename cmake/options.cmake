@@ -10,3 +10,8 @@
 # test options
 option(RELLIC_ENABLE_TESTING "Enable Test Builds" ON)
 option(RELLIC_ENABLE_INSTALL "Set to true to enable the install target" ON)
+set(RELLIC_PERF_BASELINE "" CACHE FILEPATH "Baseline recorded by scripts/roundtrip.py --perf-record to test for performance regressions against")
+set(RELLIC_PERF_TOLERANCE "20" CACHE STRING "Slowdown or memory growth over the baseline that fails a test, in percent")
+option(RELLIC_ENABLE_BENCHMARKS "Build the benchmark suite, which requires Google Benchmark" OFF)
+option(RELLIC_ENABLE_FUZZING "Build the performance fuzzer, which requires clang's libFuzzer" OFF)
+option(RELLIC_ENABLE_PYTHON "Build the Python bindings, which require pybind11" OFF)
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "rellic/BC/Synthetic.h"
+#include "rellic/Decompiler.h"
+
+// Looks for inputs whose decompilation costs more than linearly in the size of
+// their IR. The bytes of each input are decoded by `rellic::CreateFuzzedModule`
+// and the module is decompiled under a budget. An input whose decompilation
+// takes longer or uses more memory than a per-instruction allowance, or whose
+// refinement is cut short by the budget, is reported as a crash, so that
+// libFuzzer saves it and can minimize it with `-minimize_crash=1`.
+//
+// The allowances are read from the environment:
+//
+//   RELLIC_FUZZ_MS_PER_INST:    milliseconds per instruction (default 2)
+//   RELLIC_FUZZ_BASE_MS:        milliseconds for any module (default 500)
+//   RELLIC_FUZZ_KB_PER_INST:    kilobytes per instruction (default 256)
+//   RELLIC_FUZZ_BASE_MB:        megabytes for any module (default 64)
+//   RELLIC_FUZZ_TIMEOUT_MS:     time budget of `Decompile` (default 10000)
+//   RELLIC_FUZZ_MEMORY_MB:      memory budget of `Decompile` (default 2048)
+
+namespace {
+struct Allowance {
+  uint64_t ms_per_inst{2};
+  uint64_t base_ms{500};
+  uint64_t kb_per_inst{256};
+  uint64_t base_mb{64};
+  uint64_t timeout_ms{10000};
+  uint64_t memory_mb{2048};
+};
+
+static Allowance allowance;
+
+static void ReadVariable(const char* name, uint64_t& value) {
+  if (auto str = std::getenv(name)) {
+    value = std::strtoull(str, nullptr, 10);
+  }
+}
+
+static void Report(const std::string& problem, const llvm::Module& module,
+                   size_t num_insts) {
+  llvm::errs() << "==== Superlinear input: " << problem << " for " << num_insts
+               << " instructions\n";
+  module.print(llvm::errs(), nullptr);
+  llvm::errs().flush();
+  std::abort();
+}
+}  // namespace
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv) {
+  google::InitGoogleLogging((*argv)[0]);
+  // Decompiling fuzzed modules warns about every definition that is dropped
+  FLAGS_minloglevel = google::GLOG_ERROR;
+  ReadVariable("RELLIC_FUZZ_MS_PER_INST", allowance.ms_per_inst);
+  ReadVariable("RELLIC_FUZZ_BASE_MS", allowance.base_ms);
+  ReadVariable("RELLIC_FUZZ_KB_PER_INST", allowance.kb_per_inst);
+  ReadVariable("RELLIC_FUZZ_BASE_MB", allowance.base_mb);
+  ReadVariable("RELLIC_FUZZ_TIMEOUT_MS", allowance.timeout_ms);
+  ReadVariable("RELLIC_FUZZ_MEMORY_MB", allowance.memory_mb);
+  return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  llvm::LLVMContext llvm_ctx;
+  auto module{rellic::CreateFuzzedModule(llvm_ctx, {data, size})};
+  size_t num_insts{0};
+  for (auto& func : *module) {
+    num_insts += std::distance(llvm::inst_begin(func), llvm::inst_end(func));
+  }
+  // Kept to print the input once it has been found to be superlinear
+  auto original{llvm::CloneModule(*module)};
+
+  rellic::DecompilationOptions options;
+  options.module_timeout = std::chrono::milliseconds(allowance.timeout_ms);
+  options.memory_limit = allowance.memory_mb << 20;
+  options.keep_module = false;
+  auto start{std::chrono::steady_clock::now()};
+  auto result{rellic::Decompile(std::move(module), std::move(options))};
+  auto elapsed{std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()};
+  if (!result.Succeeded()) {
+    // Errors are not what this target looks for
+    return 0;
+  }
+
+  auto value{result.TakeValue()};
+  for (auto& stage : value.statistics.stages) {
+    if (stage.truncated) {
+      Report("stage " + stage.name + " ran out of budget", *original,
+             num_insts);
+    }
+  }
+  auto max_ms{allowance.base_ms + allowance.ms_per_inst * num_insts};
+  if (static_cast<uint64_t>(elapsed) > max_ms) {
+    Report("took " + std::to_string(elapsed) + "ms", *original, num_insts);
+  }
+  auto memory{value.statistics.peak_memory.Total()};
+  auto max_memory{(allowance.base_mb << 20) +
+                  (allowance.kb_per_inst << 10) * num_insts};
+  if (memory > max_memory) {
+    Report("used " + std::to_string(memory >> 20) + "MiB", *original,
+           num_insts);
+  }
+  return 0;
+}
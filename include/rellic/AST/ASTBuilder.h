@@ -10,8 +10,11 @@
 
 #include <clang/Basic/Builtins.h>
 #include <clang/Frontend/ASTUnit.h>
+#include <llvm/ADT/ArrayRef.h>
 
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 
 namespace clang {
 class Sema;
@@ -24,9 +27,18 @@ class ASTBuilder {
   clang::ASTUnit &unit;
   clang::ASTContext &ctx;
   clang::Sema &sema;
+  // Build every expression through Sema, with its semantic checks, instead of
+  // creating the common ones directly
+  bool validate;
+  // Number of AST nodes created so far. Helpers that combine other helpers do
+  // not count the nodes twice.
+  uint64_t num_nodes{0};
+  // Declarations created by `CreateBuiltinCall`, one per builtin
+  std::unordered_map<unsigned, clang::FunctionDecl *> builtin_decls;
 
  public:
-  ASTBuilder(clang::ASTUnit &unit);
+  ASTBuilder(clang::ASTUnit &unit, bool validate = false);
+  uint64_t GetNumNodes() const { return num_nodes; }
   // Type helpers
   clang::QualType GetLeastIntTypeForBitWidth(unsigned size, unsigned sign);
   clang::QualType GetLeastRealTypeForBitWidth(unsigned size);
@@ -293,7 +305,7 @@ class ASTBuilder {
   clang::CompoundLiteralExpr *CreateCompoundLit(clang::QualType type,
                                                 clang::Expr *expr);
   // Compound statement
-  clang::CompoundStmt *CreateCompoundStmt(std::vector<clang::Stmt *> &stmts);
+  clang::CompoundStmt *CreateCompoundStmt(llvm::ArrayRef<clang::Stmt *> stmts);
   // If statement
   clang::IfStmt *CreateIf(clang::Expr *cond, clang::Stmt *then_val,
                           clang::Stmt *else_val = nullptr);
@@ -303,6 +315,8 @@ class ASTBuilder {
   clang::DoStmt *CreateDo(clang::Expr *cond, clang::Stmt *body);
   // Break
   clang::BreakStmt *CreateBreak();
+  // Continue
+  clang::ContinueStmt *CreateContinue();
   // Return
   clang::ReturnStmt *CreateReturn(clang::Expr *retval = nullptr);
   // Typedef declaration
@@ -321,6 +335,19 @@ class ASTBuilder {
   clang::SwitchStmt *CreateSwitchStmt(clang::Expr *cond);
   clang::CaseStmt *CreateCaseStmt(clang::Expr *cond);
   clang::DefaultStmt *CreateDefaultStmt(clang::Stmt *body);
+  // Label declaration
+  clang::LabelDecl *CreateLabelDecl(clang::DeclContext *decl_ctx,
+                                    clang::IdentifierInfo *id);
+
+  clang::LabelDecl *CreateLabelDecl(clang::DeclContext *decl_ctx,
+                                    std::string name) {
+    return CreateLabelDecl(decl_ctx, CreateIdentifier(name));
+  }
+  // Labeled statement
+  clang::LabelStmt *CreateLabelStmt(clang::LabelDecl *label,
+                                    clang::Stmt *sub_stmt);
+  // Goto
+  clang::GotoStmt *CreateGoto(clang::LabelDecl *label);
 };
 
 }  // namespace rellic
\ No newline at end of file
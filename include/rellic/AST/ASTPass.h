@@ -9,22 +9,95 @@
 #pragma once
 #include <clang/AST/ASTContext.h>
 #include <clang/Frontend/ASTUnit.h>
+#include <glog/logging.h>
 #include <rellic/AST/ASTBuilder.h>
 #include <rellic/AST/Util.h>
+#include <rellic/EventLog.h>
+#include <rellic/Trace.h>
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 namespace rellic {
 
+struct ASTPassStatistics {
+  // Number of times the pass has been executed
+  unsigned num_runs{0};
+  // Number of executions that reported a change
+  unsigned num_changes{0};
+  // Total wall time spent executing the pass
+  std::chrono::nanoseconds elapsed{0};
+  // Number of definitions whose refinement was stopped because they came back
+  // to a state they had already been in
+  unsigned num_cycles{0};
+  // Growth of the memory allocated by the ASTContext, of the number of nodes
+  // created through the ASTBuilder and of the number of Z3 expressions of
+  // conditions during the runs of the pass. The AST only grows, while the
+  // expressions may be compacted by a run.
+  uint64_t ast_bytes{0};
+  uint64_t ast_nodes{0};
+  int64_t z3_exprs{0};
+};
+
+// Records the growth of the AST and of the conditions of a decompilation
+// context between its construction and `Record`, see `ASTPassStatistics`
+class AllocationScope {
+  DecompilationContext& dec_ctx;
+  uint64_t ast_bytes;
+  uint64_t ast_nodes;
+  int64_t z3_exprs;
+
+ public:
+  AllocationScope(DecompilationContext& dec_ctx)
+      : dec_ctx(dec_ctx),
+        ast_bytes(dec_ctx.ast_ctx.getASTAllocatedMemory()),
+        ast_nodes(dec_ctx.ast.GetNumNodes()),
+        z3_exprs(dec_ctx.z3_exprs.size()) {}
+
+  void Record(ASTPassStatistics& stats) const {
+    stats.ast_bytes += dec_ctx.ast_ctx.getASTAllocatedMemory() - ast_bytes;
+    stats.ast_nodes += dec_ctx.ast.GetNumNodes() - ast_nodes;
+    stats.z3_exprs += int64_t(dec_ctx.z3_exprs.size()) - z3_exprs;
+  }
+};
+
 class ASTPass {
   std::atomic_bool stop{false};
+  ASTPassStatistics stats;
+
+  bool DoRun() {
+    changed = false;
+    llvm::TimeTraceScope trace(GetName());
+    Prover::CallSite site(dec_ctx.prover, GetName());
+    AllocationScope allocations(dec_ctx);
+    auto start{std::chrono::steady_clock::now()};
+    RunImpl();
+    auto elapsed{std::chrono::steady_clock::now() - start};
+    stats.elapsed += elapsed;
+    allocations.Record(stats);
+    ++stats.num_runs;
+    if (changed) {
+      ++stats.num_changes;
+    }
+    RELLIC_EVENT(dec_ctx.events, EventLevel::Debug, GetName())
+        << (changed ? "changed" : "unchanged") << " in "
+        << std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+               .count()
+        << "us";
+    return changed;
+  }
 
  protected:
   DecompilationContext& dec_ctx;
 
   bool changed{false};
 
+  void RecordCycle() { ++stats.num_cycles; }
+
   virtual void RunImpl() = 0;
   virtual void StopImpl() {}
 
@@ -32,28 +105,28 @@ class ASTPass {
   ASTPass(DecompilationContext& dec_ctx)
       : dec_ctx(dec_ctx) {}
   virtual ~ASTPass() = default;
+  // Makes the pass return as soon as possible, from any thread. Visitors check
+  // for it between nodes, and the Z3 calls of the prover, including those
+  // running on worker threads, are interrupted until the next run, see
+  // `SolverInterrupt`.
   void Stop() {
     stop = true;
+    dec_ctx.prover.Interrupt();
     StopImpl();
   }
 
   bool Run() {
-    changed = false;
     stop = false;
-    RunImpl();
-    return changed;
+    dec_ctx.prover.ResetInterrupt();
+    return DoRun();
   }
 
   unsigned Fixpoint() {
     unsigned iter_count{0};
     changed = false;
-    auto DoIter = [this]() {
-      changed = false;
-      RunImpl();
-      return changed;
-    };
     stop = false;
-    while (DoIter()) {
+    dec_ctx.prover.ResetInterrupt();
+    while (DoRun()) {
       ++iter_count;
     }
 
@@ -61,10 +134,42 @@ class ASTPass {
   }
 
   bool Stopped() { return stop; }
+
+  // Short identifier of the pass, used when reporting statistics
+  virtual const char* GetName() const = 0;
+  const ASTPassStatistics& GetStatistics() const { return stats; }
 };
 
 class CompositeASTPass : public ASTPass {
   std::vector<std::unique_ptr<ASTPass>> passes;
+  bool skip_converged{false};
+  // Hashes of the states each definition has been left in by the runs since
+  // converged definitions started being skipped, and the run that produced
+  // them. The state before the first run is not recorded, so cycles through it
+  // are only noticed one period later, but unchanged definitions are never
+  // hashed.
+  std::unordered_map<clang::FunctionDecl*,
+                     std::unordered_map<unsigned, unsigned>>
+      states;
+  unsigned num_iterations{0};
+
+  // Returns true if `fdecl` is back to a state it was already in
+  bool RecordState(clang::FunctionDecl* fdecl) {
+    auto hash{GetFunctionHash(dec_ctx, fdecl)};
+    auto [it, inserted] = states[fdecl].emplace(hash, num_iterations);
+    if (inserted) {
+      return false;
+    }
+    LOG(WARNING) << "Refinement of " << fdecl->getNameAsString()
+                 << " cycles with a period of "
+                 << num_iterations - it->second << " iterations, stopping";
+    RELLIC_EVENT(dec_ctx.events, EventLevel::Warning, GetName())
+        << "Refinement of " << fdecl->getNameAsString()
+        << " cycles with a period of " << num_iterations - it->second
+        << " iterations";
+    RecordCycle();
+    return true;
+  }
 
  protected:
   void StopImpl() override {
@@ -74,17 +179,57 @@ class CompositeASTPass : public ASTPass {
   }
 
   void RunImpl() override {
+    if (skip_converged) {
+      ++num_iterations;
+      dec_ctx.track_function_changes = true;
+      dec_ctx.changed_functions.clear();
+    }
+
     for (auto& pass : passes) {
       if (Stopped()) {
         break;
       }
       changed |= pass->Run();
     }
+
+    if (skip_converged) {
+      // Definitions that were not changed by any of the passes have reached a
+      // fixpoint and will not be changed by further runs either. Neither will
+      // the ones that came back to an earlier state, as passes would only
+      // keep going around the same cycle.
+      if (!Stopped()) {
+        dec_ctx.dirty_functions = std::move(dec_ctx.changed_functions);
+        dec_ctx.changed_functions.clear();
+        for (auto it{dec_ctx.dirty_functions->begin()};
+             it != dec_ctx.dirty_functions->end();) {
+          if (RecordState(*it)) {
+            it = dec_ctx.dirty_functions->erase(it);
+          } else {
+            ++it;
+          }
+        }
+      }
+      dec_ctx.track_function_changes = false;
+    }
   }
 
  public:
   CompositeASTPass(DecompilationContext& dec_ctx)
       : ASTPass(dec_ctx) {}
+  const char* GetName() const override { return "composite"; }
+
+  // Makes subsequent runs only visit the function definitions that were
+  // changed by the previous run, and stops visiting the ones that come back
+  // to a state they were already in. All definitions are visited again once
+  // this is turned off.
+  void SkipConvergedFunctions(bool skip) {
+    skip_converged = skip;
+    dec_ctx.dirty_functions.reset();
+    // Passes outside of the fixpoint do not record their changes
+    dec_ctx.function_features.clear();
+    states.clear();
+    num_iterations = 0;
+  }
   std::vector<std::unique_ptr<ASTPass>>& GetPasses() { return passes; }
 };
 }  // namespace rellic
\ No newline at end of file
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/PrettyPrinter.h>
+#include <clang/AST/Stmt.h>
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/ModuleSlotTracker.h>
+#include <llvm/IR/Value.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace rellic {
+
+// A position in the output of a `CPrinter`. Lines and columns start at 1.
+struct CPrinterLocation {
+  uint64_t offset;
+  unsigned line;
+  unsigned column;
+};
+
+struct CPrinterOptions {
+  // Emit a `#line` directive before the statements and functions whose IR has
+  // a debug location, using `stmt_provenance` and `decl_provenance`
+  bool line_directives = false;
+  // Emit a comment naming the IR value each statement was generated from
+  bool provenance_comments = false;
+  std::function<const llvm::Value*(const clang::Stmt*)> stmt_provenance;
+  std::function<const llvm::Value*(const clang::Decl*)> decl_provenance;
+  // Called with the range of the output of each statement, expression and
+  // declaration as soon as it has been printed, from its first character to
+  // right after its last one. Parameters are not reported, and nodes printed
+  // by Clang are reported as a whole, without their children.
+  std::function<void(const clang::Stmt*, CPrinterLocation, CPrinterLocation)>
+      on_stmt_range;
+  std::function<void(const clang::Decl*, CPrinterLocation, CPrinterLocation)>
+      on_decl_range;
+  // Integer literals for which this returns true are printed in hexadecimal,
+  // like `ConvertIntegerLiteralsToHex` rewrites them
+  std::function<bool(const llvm::APInt&)> hex_literals;
+  // Output is accumulated until it reaches this many bytes before being
+  // written to the stream
+  size_t buffer_size = 1 << 20;
+};
+
+/*
+ * Prints C code the same way as `clang::Decl::print` and
+ * `clang::Stmt::printPretty` with the default printing policy of the AST,
+ * without their per-node overhead. The declarations, statements and
+ * expressions produced by rellic are printed directly, and every other kind of
+ * node is handed over to Clang's printer.
+ *
+ * Type names are only computed once per type, and the output is written to the
+ * stream in large chunks, so the stream should not be written to by anything
+ * else until the printer has been flushed.
+ */
+class CPrinter {
+  llvm::raw_ostream& os;
+  clang::ASTContext& ast_ctx;
+  clang::PrintingPolicy policy;
+  CPrinterOptions options;
+  std::string buffer;
+  llvm::raw_string_ostream buffer_os;
+  // Current indentation, shared by declarations and statements like Clang's
+  // printers pass it between each other
+  int level{0};
+
+  // How a type is spelled on its own, and around a declarator when it can be
+  // split around one
+  struct TypeStrings {
+    std::string unnamed;
+    std::string prefix;
+    std::string suffix;
+    bool splittable;
+  };
+  llvm::DenseMap<void*, TypeStrings> type_strings;
+
+  std::unique_ptr<llvm::ModuleSlotTracker> slots;
+  const llvm::Module* slots_module{nullptr};
+  const llvm::Function* slots_function{nullptr};
+  std::string line_file;
+  unsigned line{0};
+
+  // Position of the start of `buffer` in the output, and of the newlines that
+  // have been counted so far, for `on_stmt_range` and `on_decl_range`
+  uint64_t flushed{0};
+  size_t scanned{0};
+  unsigned output_line{1};
+  uint64_t line_start{0};
+  // Set while a function declarator is built outside of the buffer
+  bool in_declarator{false};
+
+  void Write(llvm::StringRef str) { buffer.append(str.data(), str.size()); }
+  void Write(char c) { buffer.push_back(c); }
+  void WriteNewline() {
+    if (policy.IncludeNewlines) {
+      buffer.push_back('\n');
+    }
+  }
+  void Indent(int delta = 0);
+  void MaybeFlush();
+
+  bool TracksStmts() const { return options.on_stmt_range && !in_declarator; }
+  bool TracksDecls() const { return options.on_decl_range && !in_declarator; }
+  // Location of `buffer[index]`, which must not precede the locations that
+  // have already been computed
+  CPrinterLocation GetLocation(size_t index);
+  CPrinterLocation GetLocation() { return GetLocation(buffer.size()); }
+  // Location of the end of the buffer, before its trailing newlines
+  CPrinterLocation GetEndLocation();
+  // Location at which text written after `columns` spaces of indentation will
+  // start
+  CPrinterLocation GetIndentedLocation(int columns);
+
+  const TypeStrings& GetTypeStrings(clang::QualType type);
+  void PrintType(clang::QualType type);
+  void PrintType(clang::QualType type, llvm::StringRef declarator);
+
+  void PrintLineDirective(llvm::StringRef file, unsigned line_number);
+  void PrintAnnotations(const llvm::Value* value);
+  void PrintDeclAnnotations(clang::Decl* decl);
+
+  void PrintDeclContext(clang::DeclContext* decl_ctx, bool indent);
+  void PrintDecls(clang::DeclContext::decl_iterator begin,
+                  clang::DeclContext::decl_iterator end);
+  void PrintAttributes(clang::Decl* decl);
+  void VisitDecl(clang::Decl* decl);
+  void VisitFunctionDecl(clang::FunctionDecl* decl);
+  void VisitVarDecl(clang::VarDecl* decl);
+  void VisitRecordDecl(clang::RecordDecl* decl);
+  void VisitFieldDecl(clang::FieldDecl* decl);
+  void VisitEnumDecl(clang::EnumDecl* decl);
+  void VisitEnumConstantDecl(clang::EnumConstantDecl* decl);
+  void VisitTypedefDecl(clang::TypedefDecl* decl);
+  void FallbackDecl(clang::Decl* decl);
+
+  // Prints `stmt` as a statement nested `sub_indent` levels deeper
+  void PrintSubStmt(clang::Stmt* stmt, int sub_indent);
+  void PrintSubStmt(clang::Stmt* stmt) {
+    PrintSubStmt(stmt, policy.Indentation);
+  }
+  void PrintRawCompoundStmt(clang::CompoundStmt* stmt);
+  void PrintRawIfStmt(clang::IfStmt* stmt);
+  void PrintRawDeclStmt(clang::DeclStmt* stmt);
+  void PrintControlledStmt(clang::Stmt* stmt);
+  void VisitStmt(clang::Stmt* stmt);
+  void PrintExpr(clang::Expr* expr);
+  void PrintRawExpr(clang::Expr* expr);
+  void VisitIntegerLiteral(clang::IntegerLiteral* lit);
+  void VisitUnaryOperator(clang::UnaryOperator* op);
+  void VisitMemberExpr(clang::MemberExpr* expr);
+  void FallbackStmt(clang::Stmt* stmt);
+
+ public:
+  CPrinter(llvm::raw_ostream& os, clang::ASTContext& ast_ctx,
+           CPrinterOptions options = {});
+  ~CPrinter();
+
+  CPrinter(const CPrinter&) = delete;
+  CPrinter& operator=(const CPrinter&) = delete;
+
+  // Prints the whole translation unit, like `TranslationUnitDecl::print`
+  void PrintTranslationUnit();
+  // Prints the top-level declarations in [begin, end), like
+  // `PrintTranslationUnit` prints all of them
+  void PrintTopLevelDecls(clang::DeclContext::decl_iterator begin,
+                          clang::DeclContext::decl_iterator end);
+  // Prints `decl` like `Decl::print` with the given indentation
+  void PrintDecl(clang::Decl* decl, unsigned indentation = 0);
+  // Prints `decl`, a top-level function or variable, as a declaration that
+  // other translation units can refer to: functions without their body, and
+  // variables as `extern` without their initializer. Ends with ";\n".
+  void PrintExternalDecl(clang::DeclaratorDecl* decl);
+  // Prints `stmt` like `Stmt::printPretty` with the given indentation
+  void PrintStmt(clang::Stmt* stmt, unsigned indentation);
+  // Writes the pending output to the stream
+  void Flush();
+};
+
+// Prints the translation unit of `ast_ctx` like
+// `CPrinter::PrintTranslationUnit`, on `num_threads` threads. Each function
+// definition is printed into a buffer of its own, as are the declarations
+// between them, and the buffers are written to `os` in declaration order.
+// Range callbacks are called on the calling thread, once everything has been
+// printed. The other callbacks of `options` are called from the printing
+// threads, so they must be thread-safe. Printing only reads the AST, which
+// must not be modified meanwhile.
+void PrintTranslationUnit(llvm::raw_ostream& os, clang::ASTContext& ast_ctx,
+                          CPrinterOptions options, unsigned num_threads);
+
+}  // namespace rellic
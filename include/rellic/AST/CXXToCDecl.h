@@ -13,6 +13,7 @@
 #include <glog/logging.h>
 
 #include <unordered_map>
+#include <unordered_set>
 
 #include "rellic/AST/ASTBuilder.h"
 
@@ -30,6 +31,11 @@ class CXXToCDeclVisitor : public clang::RecursiveASTVisitor<CXXToCDeclVisitor> {
   ASTBuilder ast;
 
   std::unordered_map<clang::Decl *, clang::Decl *> c_decls;
+  // Results of `GetAsCType`, by opaque pointer of the C++ type. Types are
+  // keyed as written rather than canonically, so that typedefs are kept.
+  std::unordered_map<void *, clang::QualType> c_types;
+  // Class template specializations that have been traversed
+  std::unordered_set<clang::Decl *> traversed_specs;
 
   clang::QualType GetAsCType(clang::QualType type);
 
@@ -44,9 +50,12 @@ class CXXToCDeclVisitor : public clang::RecursiveASTVisitor<CXXToCDeclVisitor> {
   }
 
   bool TraverseClassTemplateDecl(clang::ClassTemplateDecl *decl) {
-    // Only process class template specializations
+    // Only process class template specializations. Every redeclaration of a
+    // template lists all of them, so each is only traversed once.
     for (auto spec : decl->specializations()) {
-      TraverseDecl(spec);
+      if (traversed_specs.insert(spec->getCanonicalDecl()).second) {
+        TraverseDecl(spec);
+      }
     }
     return true;
   }
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/PrettyPrinter.h>
+#include <clang/AST/Stmt.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <string>
+#include <vector>
+
+namespace rellic {
+
+// A statement replaced by a refinement pass
+struct StmtChange {
+  // Definition the statement belongs to, or nullptr at global scope
+  clang::FunctionDecl *function;
+  // Statement whose child was replaced, or nullptr if the body of `function`
+  // was replaced
+  clang::Stmt *parent;
+  // Where `parent` holds the child that was replaced
+  clang::Stmt **slot;
+  clang::Stmt *before;
+  clang::Stmt *after;
+};
+
+// The text of a statement before and after a set of changes, with the lines
+// that did not change trimmed to a few lines of context
+struct ChangeHunk {
+  clang::FunctionDecl *function;
+  // Statement that was printed, or nullptr if the whole definition of
+  // `function` was
+  clang::Stmt *root;
+  std::vector<std::string> leading;
+  std::vector<std::string> removed;
+  std::vector<std::string> added;
+  std::vector<std::string> trailing;
+};
+
+/*
+ * Records the statements that TransformVisitor passes replace while
+ * `DecompilationContext::change_log` points to the log, so that the changes
+ * made by a sequence of passes can be inspected and printed without printing
+ * the whole translation unit twice.
+ *
+ * Replacements are recorded with the slot of their parent that was
+ * overwritten, so that they can be undone and redone in order to print the
+ * statements as they were before the changes. Changes that passes make in
+ * place, without replacing a statement, are only recorded as the definition
+ * they were made in, and only when no replacement was made in the same run.
+ */
+class ChangeLog {
+  std::vector<StmtChange> changes;
+  std::vector<clang::FunctionDecl *> changed_in_place;
+
+ public:
+  // Records that `after` is about to replace the statement held in `slot`
+  void RecordReplacement(clang::FunctionDecl *function, clang::Stmt *parent,
+                         clang::Stmt *&slot, clang::Stmt *after);
+  // Records that `after` is about to replace the body of `function`
+  void RecordBody(clang::FunctionDecl *function, clang::Stmt *after);
+  void RecordInPlace(clang::FunctionDecl *function);
+
+  const std::vector<StmtChange> &GetChanges() const { return changes; }
+  const std::vector<clang::FunctionDecl *> &GetChangedInPlace() const {
+    return changed_in_place;
+  }
+  bool Empty() const { return changes.empty() && changed_in_place.empty(); }
+  void Clear();
+
+  // Puts back the replaced statements, from the last change to the first
+  void Undo();
+  // Makes the replacements again, from the first change to the last
+  void Redo();
+
+  // Prints the outermost statements affected by the changes before and after
+  // them. Changes nested in a statement that was itself replaced, or that is
+  // part of another hunk, are shown as part of the enclosing hunk. Costs a
+  // function of the size of the statements that were replaced and of their
+  // parents, but not of the rest of the translation unit.
+  std::vector<ChangeHunk> GetHunks(const clang::PrintingPolicy &policy,
+                                   unsigned context = 3);
+
+  // Prints the hunks in the style of a unified diff, followed by the
+  // definitions that were changed in place
+  void Print(llvm::raw_ostream &os, const clang::PrintingPolicy &policy,
+             unsigned context = 3);
+};
+
+}  // namespace rellic
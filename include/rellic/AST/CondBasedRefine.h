@@ -40,6 +40,10 @@ class CondBasedRefine : public TransformVisitor<CondBasedRefine> {
  public:
   CondBasedRefine(DecompilationContext &dec_ctx);
 
+  const char *GetName() const override { return "cbr"; }
+  bool AppliesTo(
+      const DecompilationContext::FunctionFeatures &features) const override;
+
   bool VisitCompoundStmt(clang::CompoundStmt *compound);
 };
 
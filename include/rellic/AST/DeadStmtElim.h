@@ -24,6 +24,8 @@ class DeadStmtElim : public TransformVisitor<DeadStmtElim> {
  public:
   DeadStmtElim(DecompilationContext &dec_ctx);
 
+  const char *GetName() const override { return "dse"; }
+
   bool VisitIfStmt(clang::IfStmt *ifstmt);
   bool VisitCompoundStmt(clang::CompoundStmt *compound);
 };
@@ -8,8 +8,9 @@
 
 #pragma once
 
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/IR/DebugInfoMetadata.h>
-#include <llvm/IR/InstVisitor.h>
+#include <llvm/IR/Module.h>
 
 #include <memory>
 #include <unordered_map>
@@ -26,7 +27,7 @@ using IRFuncToDITypeMap =
     std::unordered_map<llvm::Function *, llvm::DISubroutineType *>;
 using IRArgToDITypeMap = std::unordered_map<llvm::Argument *, llvm::DIType *>;
 
-class DebugInfoCollector : public llvm::InstVisitor<DebugInfoCollector> {
+class DebugInfoCollector {
  private:
   IRToNameMap names;
   IRToScopeMap scopes;
@@ -36,6 +37,27 @@ class DebugInfoCollector : public llvm::InstVisitor<DebugInfoCollector> {
   IRArgToDITypeMap args;
   std::unordered_set<llvm::DIType *> type_set;
   std::vector<llvm::DISubprogram *> subprograms;
+  // Pairs already walked by `WalkType`, which walking again would not change
+  llvm::DenseSet<std::pair<llvm::Type *, llvm::DIType *>> walked;
+
+  // Debug information of a single function, in the order in which it is
+  // merged into the maps
+  struct FunctionInfo {
+    struct Entry {
+      llvm::Value *value;
+      llvm::DILocalScope *scope;
+      // Only set for the addresses of `llvm.dbg.declare` intrinsics
+      llvm::DILocalVariable *var;
+    };
+
+    llvm::DISubprogram *subprogram{nullptr};
+    std::vector<Entry> entries;
+    std::vector<std::pair<llvm::Type *, llvm::DIType *>> walks;
+  };
+
+  // Only reads `func`, so that functions can be collected concurrently
+  static void Collect(llvm::Function &func, FunctionInfo &info);
+  void Merge(llvm::Function &func, FunctionInfo &info);
 
   void WalkType(llvm::Type *type, llvm::DIType *ditype);
 
@@ -49,10 +71,12 @@ class DebugInfoCollector : public llvm::InstVisitor<DebugInfoCollector> {
   std::unordered_set<llvm::DIType *> &GetTypes() { return type_set; }
   std::vector<llvm::DISubprogram *> &GetSubprograms() { return subprograms; }
 
-  void visitDbgDeclareInst(llvm::DbgDeclareInst &inst);
-  void visitInstruction(llvm::Instruction &inst);
-
-  void visitFunction(llvm::Function &func);
+  // Collects the debug information of every function of `module`. Functions
+  // are read by up to `num_threads` threads, and their information is merged
+  // in module order, so that the result does not depend on the number of
+  // threads.
+  void visit(llvm::Module &module, unsigned num_threads = 1);
+  void visit(llvm::Function &func);
 };
 
 }  // namespace rellic
\ No newline at end of file
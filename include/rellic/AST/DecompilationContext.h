@@ -10,33 +10,288 @@
 
 #include <clang/AST/ASTContext.h>
 #include <clang/Frontend/ASTUnit.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Analysis/LoopInfo.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Value.h>
 #include <z3++.h>
 
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "rellic/AST/ASTBuilder.h"
+#include "rellic/AST/Prover.h"
+#include "rellic/AST/QueryLog.h"
 #include "rellic/AST/TypeProvider.h"
+#include "rellic/EventLog.h"
 
 namespace rellic {
 
-struct DecompilationContext {
-  using StmtToIRMap = std::unordered_map<clang::Stmt *, llvm::Value *>;
-  using ExprToUseMap = std::unordered_map<clang::Expr *, llvm::Use *>;
-  using IRToTypeDeclMap = std::unordered_map<llvm::Type *, clang::TypeDecl *>;
-  using IRToValDeclMap = std::unordered_map<llvm::Value *, clang::ValueDecl *>;
-  using IRToStmtMap = std::unordered_map<llvm::Value *, clang::Stmt *>;
-  using ArgToTempMap = std::unordered_map<llvm::Argument *, clang::VarDecl *>;
-  using BlockToUsesMap =
-      std::unordered_map<llvm::BasicBlock *, std::vector<llvm::Use *>>;
-  using Z3CondMap = std::unordered_map<clang::Stmt *, unsigned>;
+class ChangeLog;
+class UndoJournal;
+
+// Approximate number of bytes used by a decompilation
+struct MemoryUsage {
+  // Nodes allocated by the ASTContext, plus its own side tables
+  size_t ast{0};
+  // Allocated by Z3. This is shared by all the contexts of the process.
+  size_t z3{0};
+  // Side tables of the DecompilationContext
+  size_t tables{0};
+
+  size_t Total() const { return ast + z3 + tables; }
+};
+
+// How GenerateAST structures the control flow of function definitions
+enum class StructuringEngine {
+  // Every block is gated by its reaching condition, which refinement turns
+  // into nested conditionals and loops
+  ReachingConditions,
+  // Regions made of if-then, if-then-else, loop and switch patterns on the
+  // dominator and post-dominator trees are structured directly, without
+  // computing reaching conditions. The other regions fall back on them.
+  Patterns,
+};
+
+// Size of the control flow graph of a function
+struct FunctionSize {
+  unsigned blocks{0};
+  unsigned edges{0};
+  // Deepest nesting of natural loops
+  unsigned loop_depth{0};
+  // Largest number of cases of a single switch
+  unsigned switch_cases{0};
+  // Estimate of the size of the reaching conditions of the blocks: the number
+  // of paths from the entry to each block without back edges, each capped at
+  // `max_paths`, summed over the blocks. It is not used as a limit.
+  uint64_t cond_terms{0};
+
+  static constexpr uint64_t max_paths{1 << 16};
+
+  // Whether any measure is over the corresponding nonzero one of `limits`
+  bool Exceeds(const FunctionSize &limits) const {
+    return (limits.blocks && blocks > limits.blocks) ||
+           (limits.edges && edges > limits.edges) ||
+           (limits.loop_depth && loop_depth > limits.loop_depth) ||
+           (limits.switch_cases && switch_cases > limits.switch_cases);
+  }
+
+  // Estimate of the time it takes to decompile the function, in arbitrary
+  // units. It is only meant to rank functions against each other.
+  uint64_t Cost() const {
+    return uint64_t{blocks} + edges + switch_cases +
+           cond_terms * (loop_depth + 1);
+  }
+};
+
+// Measures `func`, whose loops are `loops`. This only walks the control flow
+// graph once, so it is cheap enough to do before structuring.
+FunctionSize MeasureFunction(llvm::Function &func,
+                             const llvm::LoopInfo &loops);
+// Same as above, computing the loops of `func`
+FunctionSize MeasureFunction(llvm::Function &func);
+
+// The size of a function definition and how long GenerateAST took to
+// structure it, so that the estimated cost can be checked against it
+struct FunctionMetrics {
+  std::string name;
+  FunctionSize size;
+  std::chrono::nanoseconds elapsed{0};
+  // Growth of the memory allocated by the ASTContext and by Z3 while the
+  // function was structured. Z3 allocations are counted process-wide, so they
+  // include those of the functions structured concurrently.
+  size_t memory{0};
+  // Whether its reaching conditions ran out of `goto_timeout`
+  bool timed_out{false};
+  // The slowest queries made to structure it, slowest first, see
+  // `DecompilationContext::forensic_queries`
+  std::vector<QueryLog::Query> slowest_queries;
+};
+
+// How often an inference rule is tried and how often it applies, see
+// `InferenceRuleSet`. A rule is attempted on every statement its condition can
+// match. Of the rules whose condition matches a statement, only the first one
+// fires, i.e. substitutes it.
+struct RuleStatistics {
+  size_t num_attempts{0};
+  size_t num_matches{0};
+  size_t num_fires{0};
+  // Time spent matching the condition of the rule, only measured when
+  // `DecompilationContext::rule_timing` is set, and creating its substitutions
+  std::chrono::nanoseconds match_elapsed{0};
+  std::chrono::nanoseconds fire_elapsed{0};
+
+  void Add(const RuleStatistics &other) {
+    num_attempts += other.num_attempts;
+    num_matches += other.num_matches;
+    num_fires += other.num_fires;
+    match_elapsed += other.match_elapsed;
+    fire_elapsed += other.fire_elapsed;
+  }
+};
+
+using RuleStatisticsMap = std::map<std::string, RuleStatistics, std::less<>>;
+
+// Conditions of the control flow graph of the function GenerateAST is
+// structuring. Blocks are numbered densely in layout order, so that the
+// conditions of their terminators can be kept in flat tables indexed by block
+// number. Entries are indices into `DecompilationContext::z3_exprs`, or `none`.
+struct CFGConds {
+  static constexpr unsigned none = std::numeric_limits<unsigned>::max();
+
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> block_ids;
+  // Conditions of a conditional branch being taken and not being taken
+  std::vector<std::array<unsigned, 2>> br_edges;
+  // Numerical variable of a switch, and conditions of each of its cases
+  // followed by the default case. The cases of the switch of a block start at
+  // `sw_offsets[block]`.
+  std::vector<unsigned> sw_vars;
+  std::vector<unsigned> sw_offsets;
+  std::vector<unsigned> sw_edges;
+  // Conditions of the edges between two blocks
+  llvm::DenseMap<std::pair<unsigned, unsigned>, unsigned> edges;
+  std::vector<unsigned> reaching_conds;
+  // Reaching conditions of the entries of structuring units within their
+  // enclosing unit, see `DecompilationContext::region_unit_size`. Within
+  // their own unit, they are reached under `true`.
+  std::vector<unsigned> entry_conds;
+
+  // Numbers the blocks of `func` and empties the tables
+  void Reset(llvm::Function &func);
+  void Clear();
+  unsigned GetBlockId(llvm::BasicBlock *block) const;
+  size_t GetMemoryUsage() const;
+};
+
+// Z3 contexts that decompilations give back once they are done with them, so
+// that later decompilations of a `Decompiler` session can reuse them instead
+// of setting up contexts of their own. Z3 cannot reset a context, so reused
+// contexts keep the declarations of the previous jobs; the variables of
+// conditions are named by `Z3VarIds` so that they never collide with them.
+class Z3ContextPool {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<z3::context>> contexts;
+
+ public:
+  // Returns a pooled context, or a new one if there are none
+  std::unique_ptr<z3::context> Take();
+  void Give(std::unique_ptr<z3::context> ctx);
+};
+
+// A Z3 context taken from a pool, or created for its owner alone if there is
+// no pool, which is given back when the lease is destroyed
+class Z3ContextLease {
+  std::shared_ptr<Z3ContextPool> pool;
+  std::unique_ptr<z3::context> ctx;
+
+ public:
+  Z3ContextLease(std::shared_ptr<Z3ContextPool> pool);
+  ~Z3ContextLease();
+  Z3ContextLease(const Z3ContextLease &) = delete;
+  Z3ContextLease &operator=(const Z3ContextLease &) = delete;
+
+  z3::context &Get() { return *ctx; }
+  const std::shared_ptr<Z3ContextPool> &GetPool() const { return pool; }
+  // Destroys the context with the lease instead of giving it back, e.g.
+  // because its calls have been interrupted
+  void Discard() { pool = nullptr; }
+};
+
+// Numeric ids of the branches and switches that conditions have variables
+// for. The variables are named after their ids rather than after the address
+// of their instructions, as an address may be reused by the instruction of a
+// later job on the same context. The ids are shared by the contexts of a
+// decompilation, so that translating a variable between them keeps its name.
+class Z3VarIds {
+  std::mutex mutex;
+  llvm::DenseMap<llvm::Value *, unsigned> ids;
+
+ public:
+  unsigned Get(llvm::Value *value);
+};
 
-  using BBEdge = std::pair<llvm::BasicBlock *, llvm::BasicBlock *>;
+// Z3 expressions of conditions, with the prover that decides them and the
+// conditions of the control flow graph being structured. The decompilation
+// context holds the conditions of the AST, while GenerateAST can compute the
+// reaching conditions of functions in contexts of their own on worker threads,
+// as Z3 contexts are not thread-safe.
+struct Z3Conditions {
   using BrEdge = std::pair<llvm::BranchInst *, bool>;
-  using SwEdge = std::pair<llvm::SwitchInst *, llvm::ConstantInt *>;
 
-  DecompilationContext(clang::ASTUnit &ast_unit);
+  // Conditions computed on behalf of another context, e.g. by a worker
+  // thread, must share its variable ids
+  Z3Conditions(std::shared_ptr<Z3ContextPool> z3_pool = nullptr,
+               std::shared_ptr<Z3VarIds> z3_var_ids = nullptr);
+  ~Z3Conditions();
+
+  // The lease is destroyed last, as every other member refers to its context
+  Z3ContextLease z3_lease;
+  z3::context &z3_ctx{z3_lease.Get()};
+  std::shared_ptr<Z3VarIds> z3_var_ids;
+  z3::expr_vector z3_exprs{z3_ctx};
+  // Index of each expression of `z3_exprs`, by expression id
+  std::unordered_map<unsigned, unsigned> z3_expr_indices;
+  Prover prover{z3_ctx};
+
+  // Branches and switches of the variables of conditions, by expression id.
+  // The variables are kept alive by `z3_vars`, so that their ids are never
+  // reused.
+  std::unordered_map<unsigned, BrEdge> z3_br_edges_inv;
+  std::unordered_map<unsigned, llvm::SwitchInst *> z3_sw_vars_inv;
+  z3::expr_vector z3_vars{z3_ctx};
+  // Definitions of the variables that stand for reaching conditions, see
+  // `DecompilationContext::reach_var_size`, as indices into `z3_exprs`, by
+  // expression id. The variables are also kept alive by `z3_vars`.
+  std::unordered_map<unsigned, unsigned> z3_reach_defs;
+
+  CFGConds cfg_conds;
+
+  // Inserts the canonical form of an expression into z3_exprs and returns its
+  // index. Expressions are never inserted twice, so that equal canonical
+  // conditions have equal indices. Entries of z3_exprs must not be modified in
+  // place, as they may be shared; store the index of a new expression instead.
+  unsigned InsertZExpr(const z3::expr &e);
+
+  // Translates the expressions, variables and control flow conditions of
+  // `from` into this context, replacing `cfg_conds`, and adds up the
+  // statistics of its prover. `from` must not be in use by another thread.
+  void Import(Z3Conditions &from);
+  // Like `Import`, but only fills in the control flow conditions that are
+  // missing from `cfg_conds`, which must number the blocks of the same
+  // function as those of `from`
+  void Merge(Z3Conditions &from);
+};
+
+struct DecompilationContext : Z3Conditions {
+  // The side tables are open-addressing maps, which store their entries
+  // inline. Inserting into one of them invalidates references to its entries,
+  // so values must be read before inserting, e.g. `map[a] = map.lookup(b)`
+  // rather than `map[a] = map[b]`.
+  using StmtToIRMap = llvm::DenseMap<clang::Stmt *, llvm::Value *>;
+  using ExprToUseMap = llvm::DenseMap<clang::Expr *, llvm::Use *>;
+  using IRToTypeDeclMap = llvm::DenseMap<llvm::Type *, clang::TypeDecl *>;
+  using IRToValDeclMap = llvm::DenseMap<llvm::Value *, clang::ValueDecl *>;
+  using IRToStmtMap = llvm::DenseMap<llvm::Value *, clang::Stmt *>;
+  using ArgToTempMap = llvm::DenseMap<llvm::Argument *, clang::VarDecl *>;
+  using BlockToUsesMap =
+      llvm::DenseMap<llvm::BasicBlock *, std::vector<llvm::Use *>>;
+  using Z3CondMap = llvm::DenseMap<clang::Stmt *, unsigned>;
+  using FunctionSet = std::unordered_set<clang::FunctionDecl *>;
+
+  DecompilationContext(clang::ASTUnit &ast_unit,
+                       std::shared_ptr<Z3ContextPool> z3_pool = nullptr);
 
   clang::ASTUnit &ast_unit;
   clang::ASTContext &ast_ctx;
@@ -50,33 +305,272 @@ struct DecompilationContext {
   IRToValDeclMap value_decls;
   ArgToTempMap temp_decls;
   BlockToUsesMap outgoing_uses;
-  z3::context z3_ctx;
-  z3::expr_vector z3_exprs{z3_ctx};
   Z3CondMap conds;
 
   clang::Expr *marker_expr;
 
-  std::unordered_map<unsigned, BrEdge> z3_br_edges_inv;
+  // Number of variable and function declarations in each declaration context,
+  // up to the last declaration counted by `GetNumDecls`. Declarations are
+  // appended to their context, so counting resumes from there. Code that
+  // removes a declaration from a context must erase its entry.
+  struct DeclCounts {
+    clang::Decl *last = nullptr;
+    size_t vars = 0;
+    size_t functions = 0;
+  };
+  llvm::DenseMap<clang::DeclContext *, DeclCounts> decl_counts;
 
-  // Pairs do not have a std::hash specialization so we can't use unordered maps
-  // here. If this turns out to be a performance issue, investigate adding hash
-  // specializations for these specifically
-  std::map<BrEdge, unsigned> z3_br_edges;
+  // C types of LLVM types, as computed by `GetQualType`
+  llvm::DenseMap<llvm::Type *, clang::QualType> qual_types;
 
-  std::unordered_map<llvm::SwitchInst *, unsigned> z3_sw_vars;
-  std::unordered_map<unsigned, llvm::SwitchInst *> z3_sw_vars_inv;
-  std::map<SwEdge, unsigned> z3_sw_edges;
+  // Whether global variables have an initializer that is emitted as a string
+  // literal, as computed by `IsGVarAString`
+  llvm::DenseMap<llvm::GlobalVariable *, bool> string_globals;
+
+  // Function definitions for which GenerateAST only creates a prototype
+  std::unordered_set<llvm::Function *> prototype_only;
+
+  // Function definitions that could not be decompiled, with the reason. They
+  // are also in `prototype_only`, see `DropDefinition`.
+  std::unordered_map<llvm::Function *, std::string> function_errors;
+
+  // Whether expressions may have side effects, as computed by
+  // `HasSideEffects`. TransformVisitor drops the entries of statements whose
+  // subtree it changes; code that modifies expressions in place in other ways
+  // must erase their entries itself.
+  std::unordered_map<clang::Stmt *, bool> side_effects;
+
+  // Loops that no rule of LoopRefine applies to. Rules only look at the
+  // subtree of a loop, so TransformVisitor drops the loops whose subtree it
+  // changes, like it does for `side_effects`.
+  std::unordered_set<clang::Stmt *> settled_loops;
+
+  // What `IsValidZExpr` and `IsUnsatZExpr` have found out about each entry of
+  // `z3_exprs`, as a combination of `ZExprFact` bits. Entries are never
+  // modified in place, so facts only go away when the table is compacted.
+  enum ZExprFact : uint8_t {
+    ValidKnown = 1,
+    Valid = 2,
+    UnsatKnown = 4,
+    Unsat = 8,
+  };
+  std::vector<uint8_t> z3_expr_facts;
+
+  // Number of entries of `conds` erased by `ReleaseDefinition` since
+  // `z3_exprs` was last compacted
+  size_t released_conds = 0;
+
+  // Function definitions whose size exceeds `large_function_limits`.
+  // GenerateAST fills this in and simplifies their reaching conditions with
+  // Z3's rewriter only, instead of the full simplification tactic.
+  FunctionSize large_function_limits;
+  std::unordered_set<llvm::Function *> large_functions;
+
+  // Function definitions whose blocks form a single chain of unconditional
+  // branches from the entry to a return. GenerateAST emits their blocks in
+  // order, which leaves nothing for the fixpoint stages of refinement to do,
+  // so they are not run on them.
+  std::unordered_set<llvm::Function *> straight_line_functions;
+
+  // Metrics of the function definitions GenerateAST has structured, in the
+  // order it structured them
+  std::vector<FunctionMetrics> function_metrics;
+  // Number of the slowest queries kept in the metrics of each function. Zero
+  // keeps none, which spares printing the formulas of the queries.
+  unsigned forensic_queries = 0;
+
+  // Statistics of the inference rules of the refinement passes, by name
+  RuleStatisticsMap rule_stats;
+  // Whether the condition of each inference rule is matched on its own, so
+  // that the time it takes can be measured, instead of all the rules that can
+  // match a statement being matched in a single traversal
+  bool rule_timing = false;
+
+  // Budgets past which GenerateAST gives up on reaching conditions and
+  // structures control flow with labels and gotos. Regions in which a reaching
+  // condition has more than `goto_cond_size` nodes fall back on their own,
+  // while functions whose reaching conditions take longer than `goto_timeout`
+  // to compute fall back as a whole. Zero means unbounded.
+  unsigned goto_cond_size = 0;
+  std::chrono::milliseconds goto_timeout{0};
+
+  // Conditions of branches and switches whose expression would inline more
+  // than this many instructions are assigned to a variable, which reaching
+  // conditions refer to instead. Zero means always inline them.
+  unsigned cond_var_size = 16;
+
+  // Whether IRToASTVisitor merges the variables of PHI nodes that flow into
+  // each other and do not interfere
+  bool coalesce_phi_nodes = false;
+
+  // Global arrays of integers or floats whose initializer takes at least this
+  // many bytes are declared as aligned arrays of `unsigned char` initialized
+  // by a single string literal of their bytes, in target order, instead of
+  // one literal per element. Zero means never.
+  uint64_t blob_initializer_size = 0;
+
+  // Reaching conditions of region entries with more than this many nodes are
+  // replaced by a fresh variable, whose definition is kept in `z3_reach_defs`,
+  // so that the conditions of the blocks they dominate stay small. Blocks that
+  // are part of a cycle of the control flow graph are never abstracted, so
+  // definitions cannot refer to themselves. Variables are only expanded when
+  // conditions are materialized, so proofs that depend on their definitions
+  // fail. Zero means never.
+  unsigned reach_var_size = 0;
 
-  std::map<BBEdge, unsigned> z3_edges;
-  std::unordered_map<llvm::BasicBlock *, unsigned> reaching_conds;
+  // Regions of at least this many blocks are structured as units of their
+  // own: the reaching conditions of their blocks are relative to the entry of
+  // the unit rather than to the entry of the function, and the unit as a whole
+  // is gated by the condition of its entry within the enclosing unit. This
+  // bounds the size of conditions by the size of units instead of functions,
+  // such as interpreter loops with thousands of blocks. Regions that share
+  // their entry with an enclosing unit are part of it. Zero means never.
+  unsigned region_unit_size = 0;
+
+  StructuringEngine structuring = StructuringEngine::ReachingConditions;
+
+  // Number of threads Z3CondSimplify may use
+  unsigned simplify_threads = 1;
+  // Number of threads refinement passes may use to decide their proofs ahead
+  // of traversing the AST, see `PrefetchProofs`
+  unsigned prove_threads = 1;
+  // Number of threads GenerateAST may use to compute the reaching conditions
+  // of functions ahead of structuring them
+  unsigned generate_threads = 1;
+  // Number of threads GenerateAST may use to compute the reaching conditions
+  // of the structuring units of a function, see `region_unit_size`
+  unsigned unit_threads = 1;
 
   size_t num_literal_structs = 0;
   size_t num_declared_structs = 0;
 
-  // Inserts an expression into z3_exprs and returns its index
-  unsigned InsertZExpr(const z3::expr &e);
+  // When `track_function_changes` is set, refinement passes visit function
+  // definitions one at a time and record the ones they modify in
+  // `changed_functions`. If `dirty_functions` is set, only the definitions it
+  // contains are visited, as all others have converged or are final.
+  bool track_function_changes = false;
+  std::optional<FunctionSet> dirty_functions;
+  FunctionSet changed_functions;
+
+  // Statements of a function definition that refinement passes look for, so
+  // that they can skip the definitions they have nothing to do in
+  struct FunctionFeatures {
+    unsigned num_ifs = 0;
+    unsigned num_whiles = 0;
+    // Compound statements that are directly part of another one
+    unsigned num_nested_compounds = 0;
+    // Longest run of consecutive `if` statements in a compound statement, and
+    // of consecutive ones without an `else` branch
+    unsigned max_if_run = 0;
+    unsigned max_plain_if_run = 0;
+  };
+  // Features of the definitions, as computed by `GetFunctionFeatures`. They
+  // are only kept while function changes are tracked, and dropped by
+  // `RecordFunctionChange`.
+  std::unordered_map<clang::FunctionDecl *, FunctionFeatures>
+      function_features;
+
+  // Where TransformVisitor passes record the statements they replace, if set
+  ChangeLog *change_log = nullptr;
+  // Where refinement passes record their changes so that they can be undone,
+  // if set
+  UndoJournal *journal = nullptr;
+  // Where the events of the decompilation are recorded, if set
+  std::shared_ptr<EventLog> events;
+
+  // Whether refinement passes should visit the definition `fdecl`
+  bool IsDirty(clang::FunctionDecl *fdecl) const {
+    return !dirty_functions || dirty_functions->count(fdecl);
+  }
+
+  // Records that a pass has changed the definition `fdecl` while function
+  // changes are tracked
+  void RecordFunctionChange(clang::FunctionDecl *fdecl) {
+    changed_functions.insert(fdecl);
+    function_features.erase(fdecl);
+  }
+
+  // Gets the features of the definition `fdecl`, counting them if they are
+  // not known. Returns null unless function changes are tracked, as changes
+  // would otherwise go unnoticed.
+  const FunctionFeatures *GetFunctionFeatures(clang::FunctionDecl *fdecl);
+
+  // Gives up on decompiling `func` because of `error`. The definition that was
+  // generated for it, if any, is removed from the translation unit, so that
+  // only its prototype remains.
+  void DropDefinition(llvm::Function &func, std::string error);
+
+  // Removes the definition of `func` from the translation unit once it is
+  // final and no longer needed, so that only its prototype remains, and erases
+  // the entries of the side tables that refer to its body or to the values of
+  // `func`. The conditions it used are freed by compacting `z3_exprs` once
+  // they make up half of it, so this must only be called between passes.
+  void ReleaseDefinition(llvm::Function &func);
+
+  // Sets the condition of `stmt` to the entry `idx` of `z3_exprs`, recording
+  // the previous one in `journal`
+  void SetCond(clang::Stmt *stmt, unsigned idx);
+  // Entry of `z3_exprs` that is the condition of `stmt`. Unlike `conds[stmt]`,
+  // this does not add an entry for statements that have no condition.
+  unsigned GetCond(clang::Stmt *stmt) const { return conds.lookup(stmt); }
+
+  // Cached version of clang::Expr::HasSideEffects
+  bool HasSideEffects(clang::Expr *expr);
+
+  // Whether the entry `idx` of `z3_exprs` is always true, or always false.
+  // Constants are recognized without the prover, and the answers of the
+  // prover are remembered per index.
+  bool IsValidZExpr(unsigned idx);
+  bool IsUnsatZExpr(unsigned idx);
+
+  // Calls `collect` on every statement of the function definitions that
+  // refinement passes visit, and decides the validity of the queries it adds
+  // on `prove_threads` threads with `Prover::ProveAll`. A pass that then asks
+  // for the same proofs while traversing the AST gets them from the cache of
+  // `prover`. Does nothing unless there is more than one thread.
+  // Definitions for which `visit` returns false are skipped.
+  void PrefetchProofs(
+      const std::function<void(clang::Stmt *, std::vector<z3::expr> &)>
+          &collect,
+      const std::function<bool(clang::FunctionDecl *)> &visit = nullptr);
+
+  // Drops the expressions of `z3_exprs` that are no longer referred to by
+  // `conds` or `cfg_conds`, and renumbers the remaining ones. Entries of
+  // `conds` whose statements are no longer part of a function body are removed
+  // first. Indices held outside of these tables are invalidated, so this must
+  // only be called between passes.
+  void CompactZExprs();
+
+  // Drops the entries of `stmt_provenance` and `use_provenance` whose
+  // statements are no longer part of a function body or global initializer.
+  // Replaced statements keep their entries until then.
+  void PruneProvenance();
+
+  // Frees the Z3 expressions of conditions, along with the tables that refer
+  // to them and the caches of refinement passes, once no refinement pass will
+  // run anymore. Statistics of the prover are kept.
+  void ReleaseSolverState();
+
+  // Estimates the memory used by this context. The ASTContext arena only ever
+  // grows, so this never decreases by much.
+  MemoryUsage GetMemoryUsage() const;
 
   clang::QualType GetQualType(llvm::Type *type);
+
+  // Number of declarations of kind `T`, either `clang::VarDecl` or
+  // `clang::FunctionDecl`, in `decl_ctx`. Same as the `GetNumDecls` of
+  // rellic/AST/Util.h, but only counts the declarations added since the last
+  // call, so that naming declarations after their number is not quadratic.
+  template <typename T>
+  size_t GetNumDecls(clang::DeclContext *decl_ctx) {
+    static_assert(std::is_same_v<T, clang::VarDecl> ||
+                  std::is_same_v<T, clang::FunctionDecl>);
+    auto counts{CountDecls(decl_ctx)};
+    return std::is_same_v<T, clang::VarDecl> ? counts.vars : counts.functions;
+  }
+
+  // Brings the entry of `decl_ctx` in `decl_counts` up to date
+  DeclCounts CountDecls(clang::DeclContext *decl_ctx);
 };
 
 }  // namespace rellic
\ No newline at end of file
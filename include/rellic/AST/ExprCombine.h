@@ -8,6 +8,9 @@
 
 #pragma once
 
+#include <unordered_set>
+
+#include "rellic/AST/InferenceRule.h"
 #include "rellic/AST/TransformVisitor.h"
 
 namespace rellic {
@@ -15,20 +18,42 @@ namespace rellic {
 /*
  * This pass performs a number of different trasnformations on expressions,
  * like turning *&a into a, or !(a == b) into a != b
+ *
+ * Expressions are rewritten bottom-up in a single traversal: once the rules
+ * stop applying to a node it is in normal form, and when a rule replaces a
+ * node, only the nodes the rule created are rewritten again before the rules
+ * are tried on the replacement.
  */
 class ExprCombine : public TransformVisitor<ExprCombine> {
+  // Cast rules that apply before constant folding
+  InferenceRuleSet pre_rules;
+  InferenceRuleSet rules;
+  // Expressions no rule applies to anymore
+  std::unordered_set<clang::Stmt *> normalized;
+
+  clang::Stmt *CombineCast(clang::CStyleCastExpr *cast);
+  // Returns the result of applying the first matching rule to `stmt`, or
+  // `stmt` itself
+  clang::Stmt *Combine(clang::Stmt *stmt);
+  // Applies the rules to `stmt` until none matches
+  clang::Stmt *Normalize(clang::Stmt *stmt);
+
  protected:
   void RunImpl() override;
 
  public:
+  // Initializers of global variables are simplified as well
+  static constexpr TraversalPolicy traversal{/*types=*/false,
+                                              /*records=*/false,
+                                              /*globals=*/true};
+
   ExprCombine(DecompilationContext &dec_ctx);
 
-  bool VisitCStyleCastExpr(clang::CStyleCastExpr *cast);
-  bool VisitUnaryOperator(clang::UnaryOperator *op);
-  bool VisitBinaryOperator(clang::BinaryOperator *op);
-  bool VisitArraySubscriptExpr(clang::ArraySubscriptExpr *expr);
-  bool VisitMemberExpr(clang::MemberExpr *expr);
-  bool VisitParenExpr(clang::ParenExpr *paren);
+  const char *GetName() const override { return "ec"; }
+
+  void BeginTraversal() override;
+
+  bool VisitExpr(clang::Expr *expr);
 };
 
 }  // namespace rellic
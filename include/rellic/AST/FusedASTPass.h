@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rellic/AST/ASTPass.h"
+#include "rellic/AST/TransformVisitor.h"
+
+namespace rellic {
+
+/*
+ * Runs several transform passes in a single post-order traversal, instead of
+ * one traversal each. Once the children of a node have been replaced, every
+ * pass visits the node in turn, each of them seeing the replacement chosen by
+ * the previous ones.
+ *
+ * Only passes whose visit callbacks look at nothing but a node and its
+ * children can be fused: the result then differs from running the passes one
+ * after another only in the order in which rewrites are found. Passes that
+ * delete statements, like DeadStmtElim, should come before the ones that
+ * visit compound statements, so that those never see the deleted children.
+ */
+class FusedASTPass : public ASTPass {
+  std::string name;
+  std::vector<std::pair<std::unique_ptr<ASTPass>, NodeVisitor *>> passes;
+  ChangedSubtrees changed_subtrees;
+
+  clang::Stmt *Visit(clang::Stmt *stmt);
+  void VisitDecl(clang::Decl *decl);
+
+ protected:
+  void RunImpl() override;
+
+ public:
+  FusedASTPass(DecompilationContext &dec_ctx) : ASTPass(dec_ctx) {}
+
+  // `visitor` must be `pass` itself
+  void AddPass(std::unique_ptr<ASTPass> pass, NodeVisitor *visitor) {
+    if (!name.empty()) {
+      name += '+';
+    }
+    name += pass->GetName();
+    passes.emplace_back(std::move(pass), visitor);
+  }
+
+  template <typename TPass>
+  void AddPass(std::unique_ptr<TPass> pass) {
+    NodeVisitor *visitor{pass.get()};
+    AddPass(std::unique_ptr<ASTPass>(std::move(pass)), visitor);
+  }
+
+  const char *GetName() const override { return name.c_str(); }
+};
+
+}  // namespace rellic
@@ -8,13 +8,18 @@
 
 #pragma once
 
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/Analysis/RegionInfo.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/PassManager.h>
 #include <z3++.h>
 
+#include <chrono>
 #include <limits>
 #include <map>
+#include <set>
 #include <unordered_set>
 
 #include "rellic/AST/ASTBuilder.h"
@@ -27,22 +32,107 @@ class GenerateAST : public llvm::AnalysisInfoMixin<GenerateAST> {
   friend llvm::AnalysisInfoMixin<GenerateAST>;
   static llvm::AnalysisKey Key;
 
-  constexpr static unsigned poison_idx = std::numeric_limits<unsigned>::max();
+  constexpr static unsigned poison_idx = CFGConds::none;
   z3::expr ToExpr(unsigned idx);
 
   rellic::IRToASTVisitor ast_gen;
   DecompilationContext &dec_ctx;
   ASTBuilder &ast;
-  bool reaching_conds_changed{true};
+  // Where reaching conditions are computed: `dec_ctx`, or the context of a
+  // worker thread while the function is not being structured yet
+  Z3Conditions *cond_ctx;
   std::unordered_map<llvm::BasicBlock *, clang::IfStmt *> block_stmts;
   std::unordered_map<llvm::Region *, clang::CompoundStmt *> region_stmts;
 
   llvm::DominatorTree *domtree;
+  llvm::PostDominatorTree *postdomtree;
   llvm::RegionInfo *regions;
   llvm::LoopInfo *loops;
 
   std::vector<llvm::BasicBlock *> rpo_walk;
 
+  // Blocks of the current function, by their number in `dec_ctx.cfg_conds`,
+  // with the innermost region of each block and the regions that each block is
+  // the entry of, along with their parent. Region membership is looked up in
+  // these tables rather than by walking the region tree.
+  std::vector<llvm::BasicBlock *> blocks;
+  std::vector<llvm::Region *> block_regions;
+  using RegionEdge = std::pair<llvm::Region *, llvm::Region *>;
+  std::vector<llvm::SmallVector<RegionEdge, 1>> entry_regions;
+  void NumberRegions(llvm::Function &func);
+  unsigned GetBlockId(llvm::BasicBlock *block) const {
+    return cond_ctx->cfg_conds.GetBlockId(block);
+  }
+  // Whether `block` belongs to `region` and not to one of its subregions
+  bool IsRegionBlock(llvm::Region *region, llvm::BasicBlock *block) const {
+    return block_regions[GetBlockId(block)] == region;
+  }
+  // The subregion of `region` whose entry is `block`, if any
+  llvm::Region *GetSubregion(llvm::Region *region,
+                             llvm::BasicBlock *block) const;
+
+  // Structuring units of the current function, see
+  // `DecompilationContext::region_unit_size`, with the unit of each region and
+  // the innermost unit of each block. Unit 0 is the whole function.
+  struct Unit {
+    llvm::Region *region;
+    unsigned parent;
+    // Number of the entry block
+    unsigned entry;
+  };
+  std::vector<Unit> units;
+  llvm::DenseMap<llvm::Region *, unsigned> region_units;
+  std::vector<unsigned> block_units;
+  void NumberUnits();
+  // Whether the block numbered `id` is the entry of a unit other than the
+  // whole function
+  bool IsUnitEntry(unsigned id) const {
+    auto unit{block_units[id]};
+    return unit && units[unit].entry == id;
+  }
+  // The unit within which the reaching condition of the block numbered `id` is
+  // computed, which is the enclosing one for the entry of a unit
+  unsigned GetOwnerUnit(unsigned id) const {
+    auto unit{block_units[id]};
+    return IsUnitEntry(id) ? units[unit].parent : unit;
+  }
+  // Reaching condition of `block` relative to the entry of `unit`, which must
+  // contain it
+  z3::expr GetCondInUnit(unsigned unit, llvm::BasicBlock *block);
+  // Reaching condition that gates `block` in `region`. The entry of a unit is
+  // gated by its condition in the enclosing unit outside of the unit.
+  unsigned GetRegionCond(llvm::Region *region, llvm::BasicBlock *block);
+
+  // Size of the current function, and whether it is large, see
+  // `DecompilationContext::large_functions`
+  FunctionSize func_size;
+  bool is_large{false};
+  // Blocks that are part of a cycle of the current function, and the index of
+  // the variable that stands for the reaching condition of each block, if
+  // any, see `DecompilationContext::reach_var_size`
+  llvm::BitVector cyclic_blocks;
+  std::vector<unsigned> reach_vars;
+  // The immediate dominator of each block that has the same reaching
+  // condition, by block number, or `CFGConds::none`. A block that
+  // post-dominates its dominator is reached exactly when the dominator is,
+  // like the join of a diamond, unless a cycle can be entered between them.
+  // Such blocks take the condition of their dominator without going through
+  // the prover.
+  std::vector<unsigned> reach_sources;
+  void FindReachSources();
+  // Whether the reaching condition `cond` of `block` should be replaced by a
+  // variable
+  bool ShouldAbstract(llvm::BasicBlock *block, const z3::expr &cond);
+  z3::expr SimplifyCond(const z3::expr &cond);
+
+  // Labels of the blocks that are targets of gotos, and the blocks whose label
+  // has already been placed in the AST
+  std::unordered_map<llvm::BasicBlock *, clang::LabelDecl *> labels;
+  std::unordered_set<llvm::BasicBlock *> placed_labels;
+  unsigned num_labels{0};
+  clang::LabelDecl *CreateLabel(llvm::Function *func);
+  clang::LabelDecl *GetOrCreateLabel(llvm::BasicBlock *block);
+
   // GetOrCreateEdgeForBranch(branch, true) will return the index of an
   // expression that is true when branch is taken.
   // Viceversa, GetOrCreateEdgeForBranch(branch, false) is an expression that
@@ -52,29 +142,149 @@ class GenerateAST : public llvm::AnalysisInfoMixin<GenerateAST> {
   // Returns the index of an expression containing a numerical variable that
   // represents the condition of a switch.
   unsigned GetOrCreateVarForSwitch(llvm::SwitchInst *inst);
-  // Returns the index of an expression that is true when a particular case of a
-  // switch is taken. If c is nullptr, the expression for the default case will
-  // be returned.
-  unsigned GetOrCreateEdgeForSwitch(llvm::SwitchInst *inst,
-                                    llvm::ConstantInt *c);
+  // Returns the index of an expression that is true when a switch goes to the
+  // successor of its case with index `case_idx`, which is a range of values of
+  // its variable. If `case_idx` is `llvm::SwitchInst::DefaultPseudoIndex`, the
+  // expression for the default case will be returned.
+  unsigned GetOrCreateEdgeForSwitch(llvm::SwitchInst *inst, unsigned case_idx);
 
   unsigned GetOrCreateEdgeCond(llvm::BasicBlock *from, llvm::BasicBlock *to);
   unsigned GetReachingCond(llvm::BasicBlock *block);
-  void CreateReachingCond(llvm::BasicBlock *block);
+  // Updates the reaching condition of `block` from those of its predecessors,
+  // returning whether it changed
+  bool CreateReachingCond(llvm::BasicBlock *block);
 
   std::vector<clang::Stmt *> CreateBasicBlockStmts(llvm::BasicBlock *block);
   std::vector<clang::Stmt *> CreateRegionStmts(llvm::Region *region);
 
-  using BBSet = std::unordered_set<llvm::BasicBlock *>;
+  // Sets of blocks of the current function, indexed by block number
+  using BlockSet = llvm::BitVector;
 
-  void RefineLoopSuccessors(llvm::Loop *loop, BBSet &members,
-                            BBSet &successors);
+  void RefineLoopSuccessors(llvm::Loop *loop, BlockSet &members,
+                            BlockSet &successors);
 
   clang::CompoundStmt *StructureAcyclicRegion(llvm::Region *region);
   clang::CompoundStmt *StructureCyclicRegion(llvm::Region *region);
   clang::CompoundStmt *StructureSwitchRegion(llvm::Region *region);
+  // Whether the reaching condition of a block of `region` has more nodes than
+  // `DecompilationContext::goto_cond_size`
+  bool ExceedsCondSize(llvm::Region *region);
+  // Structures `region` as a sequence of labeled blocks that end in gotos,
+  // without using reaching conditions. Subregions are kept as they are,
+  // unless `flatten` is set, in which case every block of the region is
+  // labeled on its own.
+  clang::CompoundStmt *StructureGotoRegion(llvm::Region *region, bool flatten);
   clang::CompoundStmt *StructureRegion(llvm::Region *region);
 
+  // Structuring with patterns, see `StructuringEngine::Patterns`. A region
+  // matches if following its control flow from the entry places every block
+  // once: branches become conditionals that join at the immediate
+  // post-dominator, natural loops with a single exit block become `while (1)`
+  // loops left through `break` and restarted through `continue`, and
+  // switches become switches whose cases join at the same block.
+  //
+  // The loops and switches the statements being created are nested in,
+  // innermost last. Switch frames have no loop, and `exit` is their join.
+  struct PatternFrame {
+    llvm::Loop *loop;
+    llvm::BasicBlock *exit;
+  };
+  enum class PatternJump { None, Continue, Break, Invalid };
+  // The region being matched, its blocks that have been placed, and the
+  // conditions of the statements created for it, which are only recorded once
+  // the whole region matches
+  llvm::Region *pattern_region{nullptr};
+  BlockSet pattern_blocks;
+  std::vector<PatternFrame> pattern_frames;
+  std::vector<std::pair<clang::Stmt *, unsigned>> pattern_conds;
+  // Regions of the current function that do not match
+  std::unordered_set<llvm::Region *> unmatched_regions;
+  // The jump that control flow going to `block` takes, if any
+  PatternJump GetPatternJump(llvm::BasicBlock *block) const;
+  // The block at which the paths from `block` join within the innermost loop,
+  // or null if they only leave it through jumps and returns
+  llvm::BasicBlock *GetPatternJoin(llvm::BasicBlock *block) const;
+  // Appends the statements of the control flow from `block` up to `stop` to
+  // `stmts`, returning false if it does not match
+  bool StructurePatternSeq(llvm::BasicBlock *block, llvm::BasicBlock *stop,
+                           std::vector<clang::Stmt *> &stmts);
+  // Appends the statements of `block` and of its terminator to `stmts`, and
+  // sets `next` to the block where control flow goes on, or to null if it
+  // does not
+  bool StructurePatternBlock(llvm::BasicBlock *block,
+                             std::vector<clang::Stmt *> &stmts,
+                             llvm::BasicBlock *&next);
+  bool StructurePatternBranch(llvm::BranchInst *br,
+                              std::vector<clang::Stmt *> &stmts,
+                              llvm::BasicBlock *&next);
+  bool StructurePatternSwitch(llvm::SwitchInst *sw,
+                              std::vector<clang::Stmt *> &stmts,
+                              llvm::BasicBlock *&next);
+  bool StructurePatternLoop(llvm::BasicBlock *header,
+                            std::vector<clang::Stmt *> &stmts,
+                            llvm::BasicBlock *&next);
+  // Structures `region` with patterns, or returns null if it does not match
+  clang::CompoundStmt *StructurePatternRegion(llvm::Region *region);
+  // Structures the regions of the current function that match patterns,
+  // innermost first, returning whether all of them did. Reaching conditions
+  // are only needed if some did not.
+  bool StructurePatterns();
+
+  // Structuring a function is split in three steps. The first two only read
+  // the IR and `cond_ctx`, so they can be done on a worker thread with a
+  // context of its own, while the last one builds the AST and must be done
+  // with `cond_ctx` set to `dec_ctx`. Structuring with patterns builds the
+  // AST, so it is done before the second step, on the structuring thread.
+  //
+  // Computes the analyses of `func` and numbers its blocks and regions
+  void PrepareFunction(llvm::Function &func,
+                       llvm::FunctionAnalysisManager &FAM);
+  // Computes the reaching conditions of the blocks, returning false if it
+  // timed out, see `DecompilationContext::goto_timeout`
+  bool CreateReachingConds(llvm::Function &func);
+  // Updates the reaching conditions of the blocks at the positions of
+  // `worklist` in `rpo_walk`, and of the blocks whose conditions depend on
+  // them, until none of them changes. Only the blocks whose condition is
+  // computed within `unit` are visited, unless it is `CFGConds::none`.
+  // Returns false if the time since `start` exceeds the timeout.
+  bool SolveReachingConds(std::set<unsigned> &worklist,
+                          const std::vector<unsigned> &rpo_index,
+                          std::chrono::steady_clock::time_point start,
+                          unsigned unit);
+  // Computes the reaching conditions of the units of the function on up to
+  // `DecompilationContext::unit_threads` threads, each in a context of its
+  // own, and merges them into `cond_ctx`
+  bool CreateUnitReachingConds(llvm::Function &func,
+                               const std::vector<unsigned> &rpo_index,
+                               std::chrono::steady_clock::time_point start);
+  // Structures the regions and creates the definition of `func`
+  void StructureFunction(llvm::Function &func, bool timed_out);
+  // Creates the definition of `func`, whose body holds the declarations of
+  // its local variables followed by `stmts`
+  void CreateDefinition(llvm::Function &func,
+                        const std::vector<clang::Stmt *> &stmts);
+
+  // Functions whose entry block reaches a return through unconditional
+  // branches only are emitted as their blocks in order, without computing any
+  // analysis or reaching condition, see
+  // `DecompilationContext::straight_line_functions`. Returns whether `func` is
+  // such a function, filling `chain` with its blocks.
+  static bool GetStraightLineBlocks(llvm::Function &func,
+                                    std::vector<llvm::BasicBlock *> &chain);
+  void StructureStraightLine(llvm::Function &func,
+                             const std::vector<llvm::BasicBlock *> &chain);
+
+  // Computes the reaching conditions of up to
+  // `DecompilationContext::generate_threads` functions at once on worker
+  // threads, importing them into `dec_ctx` to structure each function in
+  // module order
+  static void RunParallel(llvm::Module &M, DecompilationContext &dec_ctx);
+
+  // A generator for the reaching conditions of the current function of
+  // `parent` in `cond_ctx`, e.g. on another thread. It shares the analyses and
+  // tables of `parent`, but none of its Z3 expressions.
+  GenerateAST(const GenerateAST &parent, Z3Conditions *cond_ctx);
+
  public:
   using Result = llvm::PreservedAnalyses;
   GenerateAST(DecompilationContext &dec_ctx);
@@ -20,7 +20,9 @@
 #include <rellic/AST/Util.h>
 
 #include <memory>
+#include <optional>
 #include <unordered_map>
+#include <utility>
 
 #include "rellic/AST/ASTBuilder.h"
 
@@ -30,13 +32,24 @@ class IRToASTVisitor {
   DecompilationContext &dec_ctx;
   ASTBuilder &ast;
 
+  // Conversions of conditions and of their atoms, by Z3 expression id. The
+  // converted expressions are never inserted in the AST, only clones of them,
+  // and the Z3 expressions are kept alive so that their ids are not reused.
+  std::unordered_map<unsigned, std::pair<z3::expr, clang::Expr *>>
+      converted_exprs;
+
   void VisitArgument(llvm::Argument &arg);
+  clang::Expr *ConvertExprImpl(z3::expr expr);
+  // Returns the variable of a switch that `expr` depends on, if any
+  std::optional<z3::expr> FindSwitchVar(z3::expr expr);
+  clang::Expr *ConvertSwitchCond(z3::expr expr, z3::expr var);
 
  public:
   IRToASTVisitor(DecompilationContext &dec_ctx);
 
   clang::Expr *CreateOperandExpr(llvm::Use &val);
   clang::Expr *CreateConstantExpr(llvm::Constant *constant);
+  // Converts a condition into a new Clang expression
   clang::Expr *ConvertExpr(z3::expr expr);
 
   void VisitGlobalVar(llvm::GlobalVariable &var);
@@ -11,6 +11,11 @@
 #include <clang/ASTMatchers/ASTMatchFinder.h>
 #include <clang/ASTMatchers/ASTMatchers.h>
 
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "rellic/AST/IRToASTVisitor.h"
 
 namespace clang {
@@ -30,6 +35,9 @@ class InferenceRule : public clang::ast_matchers::MatchFinder::MatchCallback {
 
   operator bool() { return match; }
 
+  // Prepares the rule for matching a new statement
+  virtual void Reset() { match = nullptr; }
+
   const clang::ast_matchers::StatementMatcher &GetCondition() const {
     return cond;
   }
@@ -38,8 +46,34 @@ class InferenceRule : public clang::ast_matchers::MatchFinder::MatchCallback {
                                                clang::Stmt *stmt) = 0;
 };
 
-clang::Stmt *ApplyFirstMatchingRule(
-    DecompilationContext &dec_ctx, clang::Stmt *stmt,
-    std::vector<std::unique_ptr<InferenceRule>> &rules);
+// An ordered list of rules, indexed by the classes of statements their
+// conditions can match. Only the rules that can match a statement are tried
+// on it, and the matchers for each class are only set up once. How often each
+// rule is tried and fires is counted in `DecompilationContext::rule_stats`,
+// under the name it was added with.
+class InferenceRuleSet {
+  struct Candidates {
+    std::vector<InferenceRule *> rules;
+    std::vector<RuleStatistics *> stats;
+    clang::ast_matchers::MatchFinder finder;
+    // A finder for each rule, see `DecompilationContext::rule_timing`
+    std::vector<std::unique_ptr<clang::ast_matchers::MatchFinder>> finders;
+  };
+
+  std::vector<std::unique_ptr<InferenceRule>> rules;
+  std::vector<std::string> names;
+  std::unordered_map<clang::Stmt::StmtClass, std::unique_ptr<Candidates>>
+      index;
+
+  Candidates &GetCandidates(DecompilationContext &dec_ctx, clang::Stmt *stmt);
+
+ public:
+  void AddRule(std::string name, std::unique_ptr<InferenceRule> rule);
+
+  // Returns the substitution created by the first rule, in order of addition,
+  // that matches `stmt`, or `stmt` itself if none does
+  clang::Stmt *ApplyFirstMatchingRule(DecompilationContext &dec_ctx,
+                                      clang::Stmt *stmt);
+};
 
 }  // namespace rellic
\ No newline at end of file
@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <llvm/ADT/StringMap.h>
+
 #include <unordered_map>
 #include <unordered_set>
 
@@ -23,20 +25,34 @@ class LocalDeclRenamer : public TransformVisitor<LocalDeclRenamer> {
  private:
   ValDeclToIRMap decls;
 
-  // Stores currently visible names, with scope awareness
-  std::vector<std::unordered_set<std::string>> seen_names;
+  // Number of visible declarations of each name. The names declared in each
+  // scope are kept in `declared_names`, starting at the positions recorded in
+  // `scopes`, so that they can be hidden again when the scope ends.
+  llvm::StringMap<unsigned> visible_names;
+  std::vector<llvm::StringMapEntry<unsigned> *> declared_names;
+  std::vector<size_t> scopes;
 
   std::unordered_set<clang::VarDecl *> renamed_decls;
   IRToNameMap &names;
 
-  bool IsNameVisible(const std::string &name);
+  bool IsNameVisible(llvm::StringRef name);
+  void DeclareName(llvm::StringRef name);
+  void PushScope();
+  void PopScope();
 
  protected:
   void RunImpl() override;
 
  public:
+  // Global variables declare names that locals must not hide
+  static constexpr TraversalPolicy traversal{/*types=*/false,
+                                              /*records=*/false,
+                                              /*globals=*/true};
+
   LocalDeclRenamer(DecompilationContext &dec_ctx, IRToNameMap &names);
 
+  const char *GetName() const override { return "ldr"; }
+
   bool shouldTraversePostOrder() override;
   bool VisitVarDecl(clang::VarDecl *decl);
   bool TraverseFunctionDecl(clang::FunctionDecl *decl);
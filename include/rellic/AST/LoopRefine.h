@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include "rellic/AST/InferenceRule.h"
 #include "rellic/AST/TransformVisitor.h"
 
 namespace rellic {
@@ -30,12 +31,18 @@ namespace rellic {
  *   }
  */
 class LoopRefine : public TransformVisitor<LoopRefine> {
+  InferenceRuleSet rules;
+
  protected:
   void RunImpl() override;
 
  public:
   LoopRefine(DecompilationContext &dec_ctx);
 
+  const char *GetName() const override { return "lr"; }
+  bool AppliesTo(
+      const DecompilationContext::FunctionFeatures &features) const override;
+
   bool VisitWhileStmt(clang::WhileStmt *loop);
 };
 
@@ -29,6 +29,8 @@ class MaterializeConds : public TransformVisitor<MaterializeConds> {
  public:
   MaterializeConds(DecompilationContext &dec_ctx);
 
+  const char *GetName() const override { return "mc"; }
+
   bool VisitIfStmt(clang::IfStmt *stmt);
   bool VisitWhileStmt(clang::WhileStmt *loop);
   bool VisitDoStmt(clang::DoStmt *loop);
@@ -55,6 +55,8 @@ class NestedCondProp : public ASTPass {
 
  public:
   NestedCondProp(DecompilationContext& dec_ctx);
+
+  const char* GetName() const override { return "ncp"; }
 };
 
 }  // namespace rellic
@@ -37,6 +37,10 @@ class NestedScopeCombine : public TransformVisitor<NestedScopeCombine> {
  public:
   NestedScopeCombine(DecompilationContext &dec_ctx);
 
+  const char *GetName() const override { return "nsc"; }
+  bool AppliesTo(
+      const DecompilationContext::FunctionFeatures &features) const override;
+
   bool VisitIfStmt(clang::IfStmt *ifstmt);
   bool VisitWhileStmt(clang::WhileStmt *stmt);
   bool VisitCompoundStmt(clang::CompoundStmt *compound);
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <z3++.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace rellic {
+
+class QueryLog;
+
+// How conditions are decided before resorting to a full Z3 query
+enum class ConditionEngine {
+  // Every query goes to Z3
+  Z3,
+  // Conditions that are boolean combinations of few atoms are evaluated on
+  // their truth tables
+  TruthTable,
+};
+
+// Operations on conditions made from one call site, see `Prover::CallSite`.
+// Latencies are counted in powers of two of microseconds: bucket 0 holds the
+// operations that took less than 1us, bucket `i` those that took less than
+// 2^i us, and the last one all the others. The size of the formulas is only
+// counted for operations that reached Z3, as numbers of distinct subterms and
+// of distinct uninterpreted constants.
+struct QueryStatistics {
+  static constexpr unsigned num_buckets = 24;
+
+  size_t num_queries{0};
+  size_t num_z3{0};
+  std::chrono::nanoseconds elapsed{0};
+  std::array<size_t, num_buckets> latency{};
+  size_t num_nodes{0};
+  size_t max_nodes{0};
+  size_t num_vars{0};
+
+  void Record(std::chrono::nanoseconds elapsed);
+  // Counts the size of `formula`, which has been handed over to Z3
+  void RecordFormula(const z3::expr& formula);
+  void Add(const QueryStatistics& other);
+};
+
+// What a call site does with conditions. Proofs and simplifications go through
+// `Prover`, rewrites are calls to `z3::expr::simplify` and orderings are the
+// canonicalizations of `InsertZExpr`.
+enum class QueryKind { Proof, Simplification, Rewrite, Ordering, Count };
+
+struct SiteStatistics {
+  std::array<QueryStatistics, static_cast<size_t>(QueryKind::Count)> queries;
+
+  QueryStatistics& operator[](QueryKind kind) {
+    return queries[static_cast<size_t>(kind)];
+  }
+  const QueryStatistics& operator[](QueryKind kind) const {
+    return queries[static_cast<size_t>(kind)];
+  }
+  void Add(const SiteStatistics& other);
+};
+
+// Name of `kind` in statistics reports
+const char* GetQueryKindName(QueryKind kind);
+
+struct ProverStatistics {
+  size_t num_proofs{0};
+  size_t num_simplifications{0};
+  // Queries that were answered from the memoized results
+  size_t num_cached{0};
+  // Queries that were decided syntactically without calling Z3
+  size_t num_syntactic{0};
+  // Queries that were decided by truth tables without calling Z3
+  size_t num_truth_tables{0};
+  // Queries that ran out of their time or resource limit
+  size_t num_limit_hits{0};
+  // Queries that were cancelled by `SolverInterrupt::Interrupt`
+  size_t num_interrupted{0};
+  // By call site
+  std::map<std::string, SiteStatistics, std::less<>> sites;
+
+  void Add(const ProverStatistics& other);
+};
+
+/*
+ * Cancels the Z3 calls of a group of provers from any thread, e.g. when the
+ * refinement pass that makes them is stopped. Provers register the context of
+ * each Z3 call while it runs, so an interrupt reaches the worker contexts of
+ * `Prover::ProveAll` and `Z3CondSimplify` as well as the main one.
+ *
+ * Once interrupted, and until `Reset`, Z3 calls that were running return early
+ * and no new ones are started. Queries are then answered like those that run
+ * out of their limit: proofs fail and simplifications and rewrites return
+ * their input unchanged. Such answers are not memoized, so the same queries
+ * are decided in full after `Reset`. Z3 may keep failing the calls made in a
+ * context it has interrupted, which are then answered the same way.
+ */
+class SolverInterrupt {
+  std::mutex mutex;
+  std::unordered_map<z3::context*, unsigned> running;
+  std::unordered_set<z3::context*> interrupted_contexts;
+  std::atomic_bool interrupted{false};
+
+ public:
+  // Marks a Z3 call on `ctx` as running for its lifetime
+  class Call {
+    SolverInterrupt& interrupt;
+    z3::context& ctx;
+
+   public:
+    Call(SolverInterrupt& interrupt, z3::context& ctx);
+    ~Call();
+  };
+
+  void Interrupt();
+  void Reset() { interrupted = false; }
+  bool IsInterrupted() const { return interrupted; }
+  // Whether a Z3 error in `ctx` may come from the interrupt
+  bool Explains(z3::context& ctx);
+};
+
+/*
+ * Decides the validity of conditions and simplifies them. Validity is checked
+ * with a single incremental solver, which is kept across queries instead of
+ * being rebuilt for each of them. Results are memoized by Z3 expression id:
+ * the queried expression is kept alive with its result, so that its id cannot
+ * be reused.
+ *
+ * Each query can be given a time and resource limit, though simplifications
+ * only honor the former. A proof that runs out of its limit conservatively
+ * fails, and a simplification that does falls back to `z3::expr::simplify`,
+ * so results stay correct, if less precise.
+ *
+ * With the truth table engine, the atoms of a condition (anything that is not
+ * a boolean connective) are treated as independent variables. Conditions over
+ * at most `max_truth_table_atoms` atoms are then evaluated on their truth
+ * table, using a single 64-bit word for up to 6 atoms. A condition that holds
+ * for every assignment of its atoms is valid. If it does not, it is only known
+ * to be invalid when all of its atoms are distinct boolean variables, since
+ * atoms like switch case equalities constrain each other; otherwise Z3 has
+ * the last word.
+ *
+ * Regardless of the engine, proofs first go through a syntactic layer that
+ * decides constants, literals and equivalences between conditions that are
+ * identical or negations of each other, up to double negation. It also
+ * refutes the equivalence of a condition that cannot be constant, such as a
+ * literal, with another condition over disjoint variables.
+ *
+ * Queries that reach Z3 can be recorded in a `QueryLog`, labelled with the
+ * innermost `CallSite` alive when they are made, and cancelled through the
+ * `SolverInterrupt` of the prover, which the provers it copies its settings to
+ * share.
+ *
+ * Independent proofs can also be decided ahead of time by `ProveAll`, which
+ * splits them into chunks that worker threads prove in their own Z3 context
+ * and solver, like Z3CondSimplify does for simplifications. The results are
+ * memoized like those of `Prove`, so the queries a pass then makes are
+ * answered from the cache.
+ */
+class Prover {
+ public:
+  using ProofMap = std::unordered_map<unsigned, std::pair<z3::expr, bool>>;
+  using SimplificationMap =
+      std::unordered_map<unsigned, std::pair<z3::expr, z3::expr>>;
+
+ private:
+  z3::context& ctx;
+  z3::solver solver;
+  unsigned timeout{0};
+  unsigned rlimit{0};
+  ConditionEngine engine{ConditionEngine::Z3};
+  ProofMap proofs;
+  SimplificationMap simplifications;
+  ProverStatistics stats;
+  std::shared_ptr<QueryLog> query_log;
+  std::shared_ptr<SolverInterrupt> interrupt{
+      std::make_shared<SolverInterrupt>()};
+  const char* site{"unknown"};
+  // Statistics of the last call site looked up by `GetSite`
+  const char* stats_site{nullptr};
+  SiteStatistics* site_stats{nullptr};
+
+  void LogQuery(const char* kind, const z3::expr& formula,
+                std::string result, std::chrono::microseconds elapsed);
+  SiteStatistics& GetSite();
+
+ public:
+  // Names the call site of the queries made during its lifetime
+  class CallSite {
+    Prover& prover;
+    const char* previous;
+
+   public:
+    CallSite(Prover& prover, const char* site)
+        : prover(prover), previous(prover.site) {
+      prover.site = site;
+    }
+    ~CallSite() { prover.site = previous; }
+  };
+
+  // Decides disjointness and completeness of a growing disjunction of
+  // conditions. Each condition is asserted once into an incremental solver
+  // that is kept across queries, together with a fresh variable standing for
+  // the disjunction so far, so that each query only costs one check.
+  class Disjunction {
+    Prover& prover;
+    z3::solver solver;
+    z3::expr any;
+    size_t num_conds{0};
+
+    bool IsUnsat(const z3::expr& query);
+
+   public:
+    Disjunction(Prover& prover);
+
+    void Add(const z3::expr& cond);
+    void Clear();
+
+    // Whether `cond` can never hold together with the conditions added so far
+    bool IsDisjoint(const z3::expr& cond);
+    // Whether one of the conditions added so far always holds
+    bool IsComplete();
+  };
+
+  Prover(z3::context& ctx);
+
+  // The tactic used by `Simplify`
+  static z3::tactic GetSimplificationTactic(z3::context& ctx);
+
+  // Sets the limits of every following query. `timeout` is in milliseconds,
+  // `rlimit` in Z3 resource units. Zero means unbounded.
+  void SetLimits(unsigned timeout, unsigned rlimit);
+  void SetEngine(ConditionEngine engine) { this->engine = engine; }
+  void SetQueryLog(std::shared_ptr<QueryLog> log) { query_log = log; }
+  const std::shared_ptr<QueryLog>& GetQueryLog() const { return query_log; }
+  // Uses the same limits, engine, query log and interrupt as `other`
+  void CopySettings(const Prover& other);
+
+  // Cancels the running and following Z3 calls of this prover and of those
+  // that share its interrupt, until `ResetInterrupt`. Can be called from any
+  // thread.
+  void Interrupt() { interrupt->Interrupt(); }
+  void ResetInterrupt() { interrupt->Reset(); }
+  bool IsInterrupted() const { return interrupt->IsInterrupted(); }
+  SolverInterrupt& GetInterrupt() { return *interrupt; }
+
+  static constexpr unsigned max_truth_table_atoms = 12;
+
+  // Returns true if `expr` has been proven to always hold
+  bool Prove(const z3::expr& expr);
+  // Decides the validity of each of `exprs` on up to `num_threads` threads
+  // and memoizes the results. Expressions that are already memoized or that
+  // are decided syntactically are left to `Prove`. Worker threads count their
+  // queries as usual, and each query answered from their results counts as a
+  // cached one.
+  void ProveAll(const std::vector<z3::expr>& exprs, unsigned num_threads);
+
+  // Simplifies `expr` using `simplify`, `aig` and `ctx-solver-simplify`
+  z3::expr Simplify(const z3::expr& expr);
+  // Simplifies `expr` with Z3's rewriter only, like `z3::expr::simplify`
+  z3::expr Rewrite(const z3::expr& expr);
+
+  // Statistics of the operations of `kind` made from the current call site,
+  // for the operations on conditions that do not go through the prover
+  QueryStatistics& GetQueries(QueryKind kind) { return GetSite()[kind]; }
+
+  const ProofMap& GetProofs() const { return proofs; }
+  const SimplificationMap& GetSimplifications() const {
+    return simplifications;
+  }
+  const ProverStatistics& GetStatistics() const { return stats; }
+  // Forgets the proofs and simplifications made so far, and the assertions of
+  // the solver, so that their expressions can be freed. Statistics are kept.
+  void ClearCaches();
+  // Counts the queries of another prover, e.g. one used on a worker thread, as
+  // if they had been made by this one
+  void AddStatistics(const ProverStatistics& other);
+};
+
+}  // namespace rellic
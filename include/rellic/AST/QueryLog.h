@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rellic/Result.h"
+
+namespace rellic {
+
+/*
+ * A log of the queries that reach Z3, which can be replayed by
+ * rellic-z3bench. Each line of the log is a JSON object holding the call site
+ * of the query, its kind, the queried formula as an SMT-LIB2 benchmark, its
+ * result and how long Z3 took to answer it.
+ *
+ * `check` queries are satisfiability checks of their formula, whose result is
+ * `sat`, `unsat` or `unknown`. `simplify` queries apply
+ * `Prover::GetSimplificationTactic` to their formula, and their result is the
+ * simplified formula. A single log can be shared by several provers, even
+ * across threads.
+ *
+ * A log can also keep its slowest queries in memory instead of writing them,
+ * e.g. for the captures of `DecompilationOptions::forensics_directory`, and
+ * forward every query to another log.
+ */
+class QueryLog {
+ public:
+  struct Query {
+    std::string site;
+    std::string kind;
+    std::string smt2;
+    std::string result;
+    std::chrono::microseconds elapsed{0};
+  };
+
+ private:
+  std::mutex mutex;
+  std::unique_ptr<llvm::raw_fd_ostream> os;
+  size_t capacity{0};
+  // Min-heap of the slowest queries recorded so far
+  std::vector<Query> slowest;
+  std::shared_ptr<QueryLog> next;
+
+ public:
+  QueryLog(std::unique_ptr<llvm::raw_fd_ostream> os);
+  // Keeps the `capacity` slowest queries, and forwards every query to `next`
+  // if it is set
+  QueryLog(size_t capacity, std::shared_ptr<QueryLog> next);
+
+  static Result<std::unique_ptr<QueryLog>, std::string> Create(
+      llvm::StringRef path);
+  static Result<std::vector<Query>, std::string> Read(llvm::StringRef path);
+
+  // Whether a query that took `elapsed` would be recorded, so that callers
+  // can skip printing the formulas of those that would not
+  bool IsRecorded(std::chrono::microseconds elapsed);
+  void Record(const Query& query);
+
+  // The slowest queries recorded so far, slowest first
+  std::vector<Query> GetSlowest();
+};
+
+}  // namespace rellic
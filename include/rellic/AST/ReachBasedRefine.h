@@ -43,6 +43,10 @@ class ReachBasedRefine : public TransformVisitor<ReachBasedRefine> {
  public:
   ReachBasedRefine(DecompilationContext &dec_ctx);
 
+  const char *GetName() const override { return "rbr"; }
+  bool AppliesTo(
+      const DecompilationContext::FunctionFeatures &features) const override;
+
   bool VisitCompoundStmt(clang::CompoundStmt *compound);
 };
 
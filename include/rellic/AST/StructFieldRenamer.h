@@ -9,6 +9,7 @@
 #pragma once
 
 #include <unordered_map>
+#include <unordered_set>
 
 #include "rellic/AST/DebugInfoCollector.h"
 #include "rellic/AST/IRToASTVisitor.h"
@@ -24,6 +25,7 @@ class StructFieldRenamer
  private:
   TypeDeclToIRMap decls;
   IRTypeToDITypeMap &types;
+  std::unordered_set<clang::RecordDecl *> renamed_decls;
 
  protected:
   void RunImpl() override;
@@ -31,6 +33,8 @@ class StructFieldRenamer
  public:
   StructFieldRenamer(DecompilationContext &dec_ctx, IRTypeToDITypeMap &types);
 
+  const char *GetName() const override { return "sfr"; }
+
   bool VisitRecordDecl(clang::RecordDecl *decl);
 };
 
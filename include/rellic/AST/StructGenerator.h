@@ -9,17 +9,21 @@
 #pragma once
 
 #include <clang/AST/Decl.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/IR/DebugInfoMetadata.h>
 
 #include <cstdint>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 #include "rellic/AST/ASTBuilder.h"
 
 namespace rellic {
-struct OffsetDIDerivedType;
+struct OffsetDIDerivedType {
+  uint64_t offset;
+  llvm::DIDerivedType* type;
+};
 
 class StructGenerator {
   clang::ASTContext& ast_ctx;
@@ -29,24 +33,53 @@ class StructGenerator {
   std::unordered_map<llvm::DICompositeType*, clang::QualType> enum_types{};
   std::unordered_map<llvm::DIDerivedType*, clang::TypedefNameDecl*>
       typedef_decls{};
-  std::unordered_set<std::string> visible_structs;
-  std::unordered_set<std::string> visible_unions;
-  std::unordered_set<std::string> visible_enums;
-  std::unordered_set<std::string> visible_tdefs;
-  std::unordered_set<std::string> visible_values;
+  // Named records that are identical to one that was seen before, like the
+  // copies of a type emitted by every compilation unit that uses it, are
+  // replaced by the first one, which gets the only RecordDecl
+  std::unordered_map<std::string, llvm::DICompositeType*> odr_records{};
+  std::unordered_map<llvm::DICompositeType*, llvm::DICompositeType*>
+      odr_types{};
+  llvm::DICompositeType* GetODRType(llvm::DICompositeType* t);
+  // Members of composites, including inherited ones, sorted by offset
+  std::unordered_map<llvm::DICompositeType*, std::vector<OffsetDIDerivedType>>
+      composite_fields{};
+  // Names that have been given out, each with the next suffix to try when it
+  // is requested again
+  using NameTable = llvm::StringMap<unsigned>;
+  NameTable visible_structs;
+  NameTable visible_unions;
+  NameTable visible_enums;
+  NameTable visible_tdefs;
+  NameTable visible_values;
+
+  // A field that is not a record, and the fields that lead to it from the
+  // outermost record. Offsets and sizes are in bits.
+  struct FieldPath {
+    uint64_t offset;
+    uint64_t size;
+    std::vector<clang::FieldDecl*> fields;
+  };
+  // Fields of records, with nested records expanded, sorted by offset and size
+  std::unordered_map<clang::RecordDecl*, std::vector<FieldPath>> field_tables;
+  const std::vector<FieldPath>& GetFieldTable(clang::RecordDecl* decl);
+  void FlattenFields(clang::RecordDecl* decl, uint64_t offset,
+                     std::vector<clang::FieldDecl*>& prefix,
+                     std::vector<FieldPath>& table);
 
   using DeclToDbgInfo =
       std::unordered_map<clang::FieldDecl*, OffsetDIDerivedType>;
   void VisitFields(clang::RecordDecl* decl, llvm::DICompositeType* s,
                    DeclToDbgInfo& map, bool isUnion);
 
-  std::string GetUniqueName(const std::string& name,
-                            std::unordered_set<std::string>& names);
+  std::string GetUniqueName(const std::string& name, NameTable& names);
   clang::RecordDecl* GetRecordDecl(llvm::DICompositeType* t);
   clang::QualType GetEnumDecl(llvm::DICompositeType* t);
 
+  const std::vector<OffsetDIDerivedType>& GetFields(
+      llvm::DICompositeType* composite);
+
   void DefineNonPackedStruct(clang::RecordDecl* decl,
-                             std::vector<OffsetDIDerivedType>& fields);
+                             const std::vector<OffsetDIDerivedType>& fields);
   uint64_t GetLayoutSize(const clang::ASTRecordLayout& layout);
 
   clang::QualType BuildArray(llvm::DICompositeType* a);
@@ -60,8 +93,10 @@ class StructGenerator {
   void DefineStruct(llvm::DICompositeType* s);
   void DefineUnion(llvm::DICompositeType* s);
 
+  // Adds the composites `t` depends on to `list`, each after the ones its
+  // members depend on
   void VisitType(llvm::DIType* t, std::vector<llvm::DICompositeType*>& list,
-                 std::unordered_set<llvm::DIType*>& visited);
+                 llvm::DenseSet<llvm::DIType*>& visited);
 
  public:
   StructGenerator(clang::ASTUnit& ast_unit);
@@ -70,9 +105,8 @@ class StructGenerator {
 
   template <typename It>
   void GenerateDecls(It begin, It end) {
-    std::unordered_set<std::string> visible_types;
     std::vector<llvm::DICompositeType*> sorted_types{};
-    std::unordered_set<llvm::DIType*> visited_types{};
+    llvm::DenseSet<llvm::DIType*> visited_types{};
     for (auto i{begin}; i != end; ++i) {
       VisitType(*i, sorted_types, visited_types);
     }
@@ -11,19 +11,101 @@
 #include <clang/AST/RecursiveASTVisitor.h>
 
 #include <unordered_map>
+#include <unordered_set>
 
 #include "rellic/AST/ASTPass.h"
+#include "rellic/AST/ChangeLog.h"
+#include "rellic/AST/UndoJournal.h"
 #include "rellic/AST/Util.h"
 
 namespace rellic {
 
 using StmtSubMap = std::unordered_map<clang::Stmt *, clang::Stmt *>;
 
+// Parts of the translation unit a pass traverses besides the statements of
+// function bodies, which are traversed directly rather than through the types
+// of their declarations. Passes of `TransformVisitor` declare theirs as a
+// `static constexpr TraversalPolicy traversal` member, and traverse nothing
+// else by default.
+struct TraversalPolicy {
+  // Types written in declarations and expressions, including the parameter
+  // declarations of prototypes
+  bool types{false};
+  // Record and enum declarations, with their fields and enumerators
+  bool records{false};
+  // File-scope variables, with their initializers
+  bool globals{false};
+};
+
+// Runs the visit callbacks of a pass on one node at a time, so that several
+// passes can share a single traversal (see FusedASTPass)
+class NodeVisitor {
+ public:
+  virtual ~NodeVisitor() = default;
+
+  // Prepares the pass for a new traversal
+  virtual void BeginTraversal() = 0;
+
+  // Returns whether the pass changed the AST in place since the traversal
+  // began. Replacements returned by `VisitNode` are not included.
+  virtual bool EndTraversal() = 0;
+
+  // Runs the visit callbacks of the pass on `stmt`, whose children have
+  // already been visited and replaced, and returns the statement `stmt`
+  // should be replaced with
+  virtual clang::Stmt *VisitNode(clang::Stmt *stmt) = 0;
+
+  // Returns false if the pass cannot change a definition with `features`, so
+  // that it does not have to be traversed
+  virtual bool AppliesTo(
+      const DecompilationContext::FunctionFeatures &features) const {
+    return true;
+  }
+
+  // Parts of the translation unit the pass visits besides function bodies
+  virtual TraversalPolicy GetTraversalPolicy() const { return {}; }
+};
+
+// Tracks the statements whose subtree is changed in place during a post-order
+// traversal, and drops the cached analyses of those statements
+class ChangedSubtrees {
+  std::unordered_set<clang::Stmt *> stmts;
+
+ public:
+  void Clear() { stmts.clear(); }
+
+  // Called once the children of `stmt` have been visited. `replaced` tells
+  // whether any of them has been replaced.
+  void Update(DecompilationContext &dec_ctx, clang::Stmt *stmt,
+              bool replaced) {
+    if (!replaced && !stmts.empty()) {
+      for (auto child : stmt->children()) {
+        if (stmts.count(child)) {
+          replaced = true;
+          break;
+        }
+      }
+    }
+
+    if (replaced) {
+      stmts.insert(stmt);
+      dec_ctx.side_effects.erase(stmt);
+      dec_ctx.settled_loops.erase(stmt);
+    }
+  }
+};
+
 template <typename Derived>
 class TransformVisitor : public ASTPass,
-                         public clang::RecursiveASTVisitor<Derived> {
+                         public clang::RecursiveASTVisitor<Derived>,
+                         public NodeVisitor {
+  using Base = clang::RecursiveASTVisitor<Derived>;
+
  protected:
   StmtSubMap substitutions;
+  ChangedSubtrees changed_subtrees;
+  // Definition being traversed by `TraverseDirtyFunctions`, if any
+  clang::FunctionDecl *current_function{nullptr};
 
   void CopyProvenance(clang::Stmt *from, clang::Stmt *to) {
     ::rellic::CopyProvenance(from, to, dec_ctx.stmt_provenance);
@@ -38,6 +120,13 @@ class TransformVisitor : public ASTPass,
     for (auto c_it = stmt->child_begin(); c_it != stmt->child_end(); ++c_it) {
       auto s_it = repl_map.find(*c_it);
       if (s_it != repl_map.end()) {
+        if (dec_ctx.change_log) {
+          dec_ctx.change_log->RecordReplacement(current_function, stmt, *c_it,
+                                                s_it->second);
+        }
+        if (dec_ctx.journal) {
+          dec_ctx.journal->RecordSlot(*c_it);
+        }
         *c_it = s_it->second;
         CopyProvenance(s_it->first, s_it->second);
         if (clang::isa<clang::Expr>(s_it->first) &&
@@ -52,18 +141,149 @@ class TransformVisitor : public ASTPass,
     return change;
   }
 
-  void RunImpl() override { substitutions.clear(); }
+  void RunImpl() override {
+    substitutions.clear();
+    changed_subtrees.Clear();
+  }
+
+  // Whether the pass may change `fdecl`, judging from its features if they
+  // are known
+  bool MayChange(clang::FunctionDecl *fdecl) {
+    auto features{dec_ctx.GetFunctionFeatures(fdecl)};
+    return !features || AppliesTo(*features);
+  }
+
+  // Traverses the whole translation unit, skipping the function definitions
+  // that are not dirty. While function changes are being tracked only the
+  // dirty definitions are traversed, one at a time. Definitions are also
+  // traversed one at a time while changes are logged, so that the changes
+  // can be attributed to them.
+  void TraverseDirtyFunctions() {
+    auto &derived{*static_cast<Derived *>(this)};
+    auto tudecl{dec_ctx.ast_ctx.getTranslationUnitDecl()};
+    auto log{dec_ctx.change_log};
+    if (!dec_ctx.track_function_changes && !dec_ctx.dirty_functions &&
+        !log) {
+      derived.TraverseDecl(tudecl);
+      return;
+    }
+
+    for (auto decl : tudecl->decls()) {
+      auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+      if (!fdecl || !fdecl->doesThisDeclarationHaveABody()) {
+        if (!dec_ctx.track_function_changes) {
+          derived.TraverseDecl(decl);
+        }
+        continue;
+      }
+
+      if (!dec_ctx.IsDirty(fdecl) || !MayChange(fdecl)) {
+        continue;
+      }
+
+      auto old_changed{changed};
+      auto num_changes{log ? log->GetChanges().size() : 0};
+      changed = false;
+      current_function = fdecl;
+      derived.TraverseDecl(fdecl);
+      current_function = nullptr;
+      if (changed && dec_ctx.track_function_changes) {
+        dec_ctx.RecordFunctionChange(fdecl);
+      }
+      if (changed && log && log->GetChanges().size() == num_changes) {
+        log->RecordInPlace(fdecl);
+      }
+      changed |= old_changed;
+
+      if (Stopped()) {
+        break;
+      }
+    }
+  }
 
  public:
+  static constexpr TraversalPolicy traversal{};
+
   TransformVisitor(DecompilationContext &dec_ctx) : ASTPass(dec_ctx) {}
 
+  TraversalPolicy GetTraversalPolicy() const override {
+    return Derived::traversal;
+  }
+
+  void BeginTraversal() override {
+    substitutions.clear();
+    changed_subtrees.Clear();
+    changed = false;
+  }
+
+  bool EndTraversal() override { return changed; }
+
+  clang::Stmt *VisitNode(clang::Stmt *stmt) override {
+    auto &derived{*static_cast<Derived *>(this)};
+    switch (stmt->getStmtClass()) {
+      default:
+        break;
+#define ABSTRACT_STMT(STMT)
+#define STMT(CLASS, PARENT)                                    \
+  case clang::Stmt::CLASS##Class:                              \
+    derived.WalkUpFrom##CLASS(clang::cast<clang::CLASS>(stmt)); \
+    break;
+#include <clang/AST/StmtNodes.inc>
+    }
+
+    auto it{substitutions.find(stmt)};
+    return it == substitutions.end() ? stmt : it->second;
+  }
+
   virtual bool shouldTraversePostOrder() { return true; }
 
+  bool TraverseTypeLoc(clang::TypeLoc loc) {
+    return !Derived::traversal.types || Base::TraverseTypeLoc(loc);
+  }
+
+  bool TraverseRecordDecl(clang::RecordDecl *decl) {
+    return !Derived::traversal.records || Base::TraverseRecordDecl(decl);
+  }
+
+  bool TraverseEnumDecl(clang::EnumDecl *decl) {
+    return !Derived::traversal.records || Base::TraverseEnumDecl(decl);
+  }
+
+  bool TraverseVarDecl(clang::VarDecl *decl) {
+    return (!Derived::traversal.globals && decl->isFileVarDecl()) ||
+           Base::TraverseVarDecl(decl);
+  }
+
+  // Goes straight to the body of `fdecl` unless types are traversed, as only
+  // its type holds the declarations of its parameters
+  bool TraverseFunctionDecl(clang::FunctionDecl *fdecl) {
+    if (Derived::traversal.types) {
+      return Base::TraverseFunctionDecl(fdecl);
+    }
+
+    auto &derived{*static_cast<Derived *>(this)};
+    auto post_order{derived.shouldTraversePostOrder()};
+    if (!post_order && !derived.WalkUpFromFunctionDecl(fdecl)) {
+      return false;
+    }
+    if (fdecl->doesThisDeclarationHaveABody() &&
+        !derived.TraverseStmt(fdecl->getBody())) {
+      return false;
+    }
+    return !post_order || derived.WalkUpFromFunctionDecl(fdecl);
+  }
+
   bool VisitFunctionDecl(clang::FunctionDecl *fdecl) {
     // DLOG(INFO) << "VisitFunctionDecl";
     if (auto body = fdecl->getBody()) {
       auto iter = substitutions.find(body);
       if (iter != substitutions.end()) {
+        if (dec_ctx.change_log) {
+          dec_ctx.change_log->RecordBody(fdecl, iter->second);
+        }
+        if (dec_ctx.journal) {
+          dec_ctx.journal->RecordBody(fdecl);
+        }
         fdecl->setBody(iter->second);
         changed = true;
       }
@@ -73,7 +293,9 @@ class TransformVisitor : public ASTPass,
 
   bool VisitStmt(clang::Stmt *stmt) {
     // DLOG(INFO) << "VisitStmt";
-    changed |= ReplaceChildren(stmt, substitutions);
+    auto replaced{ReplaceChildren(stmt, substitutions)};
+    changed |= replaced;
+    changed_subtrees.Update(dec_ctx, stmt, replaced);
     return !Stopped();
   }
 };
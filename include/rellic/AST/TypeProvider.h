@@ -7,9 +7,11 @@
  */
 
 #pragma once
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Module.h>
 
 #include "rellic/AST/ASTBuilder.h"
 
@@ -24,6 +26,12 @@ class TypeProvider {
   TypeProvider(DecompilationContext& dec_ctx);
   virtual ~TypeProvider();
 
+  // Called once with the module being decompiled, before any of the queries
+  // below, so that providers backed by an external database can look up the
+  // types of all of its functions and globals in a single request and answer
+  // the queries from memory. Sharded decompilations call it once per shard.
+  virtual void Prefetch(llvm::Module& module);
+
   // Returns the return type of a function if available.
   // A null return value is assumed to mean that no info is available.
   virtual clang::QualType GetFunctionReturnType(llvm::Function& func);
@@ -35,24 +43,38 @@ class TypeProvider {
   // Returns the type of a global variable if available.
   // A null return value is assumed to mean that no info is available.
   virtual clang::QualType GetGlobalVarType(llvm::GlobalVariable& gvar);
+
+  // Whether the results of this provider only depend on the value they are
+  // queried for, so that they can be computed once per value.
+  // Providers are assumed not to be cacheable unless they override this.
+  virtual bool IsCacheable();
 };
 
 class TypeProviderCombiner : public TypeProvider {
  private:
   std::vector<std::unique_ptr<TypeProvider>> providers;
 
+  // Results of the queries, kept only as long as all providers are cacheable
+  bool cacheable{true};
+  llvm::DenseMap<llvm::Function*, clang::QualType> return_types;
+  llvm::DenseMap<llvm::Argument*, clang::QualType> arg_types;
+  llvm::DenseMap<llvm::GlobalVariable*, clang::QualType> gvar_types;
+
  public:
   TypeProviderCombiner(DecompilationContext& dec_ctx);
   template <typename T, typename... TArgs>
   void AddProvider(TArgs&&... args) {
-    providers.push_back(
-        std::make_unique<T>(dec_ctx, std::forward<TArgs>(args)...));
+    AddProvider(std::make_unique<T>(dec_ctx, std::forward<TArgs>(args)...));
   }
 
   void AddProvider(std::unique_ptr<TypeProvider> provider);
 
+  void Prefetch(llvm::Module& module) override;
   clang::QualType GetFunctionReturnType(llvm::Function& func) override;
   clang::QualType GetArgumentType(llvm::Argument& arg) override;
   clang::QualType GetGlobalVarType(llvm::GlobalVariable& gvar) override;
+  bool IsCacheable() override;
+
+  size_t GetCacheSize() const;
 };
 }  // namespace rellic
\ No newline at end of file
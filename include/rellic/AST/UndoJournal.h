@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/Stmt.h>
+
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace rellic {
+
+struct DecompilationContext;
+
+/*
+ * Records the changes that refinement passes make to the AST and to the
+ * conditions of statements while `DecompilationContext::journal` points to
+ * the journal, so that the AST can be rolled back to a named snapshot and
+ * moved between snapshots taken along different sequences of passes.
+ *
+ * Nodes are never freed by the ASTContext, so a change is recorded as the
+ * location it overwrote and the value it held, and undoing or redoing it swaps
+ * them. Moving between two snapshots costs time proportional to the changes
+ * made since the state they have in common, not to the size of the AST.
+ * Changes are only recorded once a snapshot has been taken.
+ *
+ * The journal does not survive `DecompilationContext::CompactZExprs` and
+ * `DecompilationContext::PruneProvenance`, which drop entries that snapshots
+ * may still refer to, nor changes made outside of refinement passes, such as
+ * renaming declarations.
+ */
+class UndoJournal {
+  // What a change overwrote: a child of a statement, the body of a function,
+  // the initializer of a variable or the condition of a statement
+  struct Entry {
+    enum Kind { Slot, Body, Init, Cond };
+    Kind kind;
+    clang::Stmt **slot;
+    clang::Decl *decl;
+    clang::Stmt *stmt;
+    std::optional<unsigned> cond;
+  };
+  using Branch = std::vector<Entry>;
+
+  // A state of the AST, reached by undoing the changes of the journal that
+  // follow `position` and then redoing `branch`
+  struct Snapshot {
+    size_t position;
+    Branch branch;
+  };
+
+  DecompilationContext &dec_ctx;
+  std::vector<Entry> entries;
+  std::map<std::string, Snapshot> snapshots;
+
+  bool Recording() const { return !snapshots.empty(); }
+  // Undoes or redoes `entry`, which is left holding the value it replaced
+  void Swap(Entry &entry);
+  // Undoes the changes that follow `position` and returns them, ready to be
+  // redone in order
+  Branch Rollback(size_t position);
+  void Redo(Branch branch);
+
+ public:
+  UndoJournal(DecompilationContext &dec_ctx);
+
+  // Records that the statement held in `slot` is about to be replaced
+  void RecordSlot(clang::Stmt *&slot);
+  // Records that children of `stmt`, which is part of the AST, are about to
+  // be changed through its setters
+  void RecordChildren(clang::Stmt *stmt);
+  void RecordBody(clang::FunctionDecl *fdecl);
+  void RecordInit(clang::VarDecl *var);
+  // Records that the entry of `stmt` in `DecompilationContext::conds` is
+  // about to change
+  void RecordCond(clang::Stmt *stmt);
+
+  // Names the current state of the AST, replacing any snapshot of that name
+  void Take(const std::string &name);
+  // Brings the AST back to the snapshot `name` and returns true, or returns
+  // false if there is no such snapshot. The current state is lost unless it
+  // has a snapshot of its own.
+  bool Restore(const std::string &name);
+  std::vector<std::string> GetSnapshots() const;
+  // Number of changes the journal holds, including those that snapshots keep
+  // to be redone
+  size_t GetNumChanges() const;
+};
+
+}  // namespace rellic
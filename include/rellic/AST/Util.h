@@ -13,23 +13,49 @@
 namespace rellic {
 
 unsigned GetHash(clang::ASTContext &ctx, clang::Stmt *stmt);
+// Structural hash of the body of the definition `fdecl`, including the
+// reaching conditions of its statements that have not been materialized yet.
+// Bodies with the same shape and conditions have equal hashes.
+unsigned GetFunctionHash(DecompilationContext &dec_ctx,
+                         clang::FunctionDecl *fdecl);
 bool IsEquivalent(clang::Expr *a, clang::Expr *b);
-template <typename TFrom, typename TIn>
-bool Replace(TFrom *from, clang::Expr *to, TIn **in) {
-  auto from_expr{clang::cast<clang::Expr>(from)};
+
+// Structural hashes of expressions that agree with `IsEquivalent`: equivalent
+// expressions always have equal hashes. The hash of every subexpression is
+// cached, so expressions must not be modified while the cache is in use.
+class ExprHashCache {
+  std::unordered_map<clang::Stmt *, unsigned> hashes;
+
+ public:
+  unsigned Get(clang::Expr *expr);
+};
+
+namespace detail {
+template <typename TIn>
+bool Replace(clang::Expr *from, unsigned from_hash, clang::Expr *to, TIn **in,
+             ExprHashCache &hashes) {
   auto in_expr{clang::cast<clang::Expr>(*in)};
-  if (IsEquivalent(in_expr, from_expr)) {
+  // Only subexpressions with the same hash can be equivalent to `from`
+  if (hashes.Get(in_expr) == from_hash && IsEquivalent(in_expr, from)) {
     *in = to;
     return true;
   } else {
     bool changed{false};
     for (auto child{(*in)->child_begin()}; child != (*in)->child_end();
          ++child) {
-      changed |= Replace(from_expr, to, &*child);
+      changed |= Replace(from, from_hash, to, &*child, hashes);
     }
     return changed;
   }
 }
+}  // namespace detail
+
+template <typename TFrom, typename TIn>
+bool Replace(TFrom *from, clang::Expr *to, TIn **in) {
+  auto from_expr{clang::cast<clang::Expr>(from)};
+  ExprHashCache hashes;
+  return detail::Replace(from_expr, hashes.Get(from_expr), to, in, hashes);
+}
 
 template <typename T>
 size_t GetNumDecls(clang::DeclContext *decl_ctx) {
@@ -44,13 +70,25 @@ size_t GetNumDecls(clang::DeclContext *decl_ctx) {
 
 template <typename TKey1, typename TKey2, typename TKey3, typename TValue>
 void CopyProvenance(TKey1 *from, TKey2 *to,
-                    std::unordered_map<TKey3 *, TValue *> &map) {
-  map[to] = map[from];
+                    llvm::DenseMap<TKey3 *, TValue *> &map) {
+  map[to] = map.lookup(from);
 }
 
 clang::Expr *Clone(clang::ASTUnit &unit, clang::Expr *stmt,
                    DecompilationContext::ExprToUseMap &provenance);
 
+// Gives the definition `to` a copy of the body of the definition `from`, which
+// must have the same type. References to `from` and its parameters are
+// redirected to `to` and its parameters, and references to a declaration in
+// `decls` to the declaration it maps to. The other local variables and labels
+// of `from` are replaced by new ones in `to`. Unlike `Clone`, every expression
+// keeps its exact type. Each statement of `from` and its copy are added to
+// `clones`.
+void CloneBody(clang::ASTUnit &unit, clang::FunctionDecl *from,
+               clang::FunctionDecl *to,
+               std::unordered_map<clang::Decl *, clang::Decl *> &decls,
+               std::unordered_map<clang::Stmt *, clang::Stmt *> &clones);
+
 std::string ClangThingToString(const clang::Stmt *stmt);
 
 z3::goal ApplyTactic(const z3::tactic &tactic, z3::expr expr);
@@ -60,7 +98,19 @@ bool Prove(z3::expr expr);
 z3::expr HeavySimplify(z3::expr expr);
 z3::expr_vector Clone(z3::expr_vector &vec);
 
-// Tries to keep each subformula sorted by its id so that they don't get
-// shuffled around by simplification
+// Returns the canonical form of a condition: nested conjunctions and
+// disjunctions are flattened and their arguments are deduplicated and sorted
+// by id, while constants and double negations are folded away. As Z3
+// hash-conses its expressions, conditions that only differ in these respects
+// end up with the same id.
 z3::expr OrderById(z3::expr expr);
+
+// Returns the cases of `inst` in the order of the values of the numerical
+// variable that stands for its condition in reaching conditions. Cases that go
+// to the same successor are consecutive, in the order of their first
+// occurrence, so that the condition of going to a successor is a single range
+// of values whatever the number of cases. Values outside of the cases stand
+// for the default case.
+std::vector<llvm::SwitchInst::CaseHandle> GetSwitchCases(
+    llvm::SwitchInst *inst);
 }  // namespace rellic
\ No newline at end of file
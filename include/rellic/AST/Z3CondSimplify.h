@@ -17,14 +17,25 @@ namespace rellic {
 /*
  * This pass simplifies conditions using Z3 by trying to remove terms that are
  * trivially true or false
+ *
+ * Conditions are independent of each other, so with more than one
+ * `simplify_threads` they are split into several chunks per thread, each of
+ * which is translated into its own `z3::context`. Threads take the next chunk
+ * as soon as they are done with one, so expensive conditions do not leave the
+ * other threads idle.
  */
 class Z3CondSimplify : public ASTPass {
  private:
+  // Simplifies `exprs` in place
+  void Simplify(z3::expr_vector& exprs);
+
  protected:
   void RunImpl() override;
 
  public:
   Z3CondSimplify(DecompilationContext& dec_ctx);
+
+  const char* GetName() const override { return "zcs"; }
 };
 
 }  // namespace rellic
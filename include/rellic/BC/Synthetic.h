@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <memory>
+
+namespace llvm {
+class Function;
+class LLVMContext;
+class Module;
+}  // namespace llvm
+
+namespace rellic {
+
+// Control flow and expression shapes whose cost grows faster than their size
+// in some part of the decompiler. Every shape is a function of two `i32`
+// arguments returning `i32`, whose size is given by a single parameter.
+enum class SyntheticShape {
+  // `size` conditionals one after the other, each guarding a statement
+  SequentialIfs,
+  // `size` counted loops, each nested in the previous one
+  NestedLoops,
+  // A switch with `size` cases and a default
+  WideSwitch,
+  // `size` if-else diamonds one after the other
+  DiamondChain,
+  // `size` cycles with two entries each, one after the other
+  Irreducible,
+  // A value and a branch condition made of `size` operations, each using the
+  // previous two, so that their trees are exponentially larger than their DAGs
+  ExprDag,
+};
+
+llvm::ArrayRef<SyntheticShape> GetSyntheticShapes();
+const char *GetSyntheticShapeName(SyntheticShape shape);
+llvm::Optional<SyntheticShape> ParseSyntheticShape(llvm::StringRef name);
+
+// Appends a definition named `name` with the given shape to `module`. The
+// definition only uses allocas, loads and stores for its state, so it has no
+// phi nodes.
+llvm::Function *CreateSyntheticFunction(llvm::Module &module,
+                                        SyntheticShape shape, unsigned size,
+                                        llvm::StringRef name);
+
+// Creates a module for the default target with `num_functions` definitions of
+// the given shape, named after the shape.
+std::unique_ptr<llvm::Module> CreateSyntheticModule(llvm::LLVMContext &ctx,
+                                                    SyntheticShape shape,
+                                                    unsigned size,
+                                                    unsigned num_functions = 1);
+
+// Decodes arbitrary bytes into a module for the default target with a single
+// definition `fuzzed` of two `i32` arguments returning `i32`. The bytes choose
+// the number of blocks, the terminator of each block, its successors and the
+// structure of its branch condition, so that a fuzzer mutating them explores
+// control flow rather than parsing errors. Every input decodes into a
+// well-formed module, whose blocks may be unreachable and whose cycles may have
+// several entries or no exit. Empty inputs decode into a single block.
+std::unique_ptr<llvm::Module> CreateFuzzedModule(llvm::LLVMContext &ctx,
+                                                 llvm::ArrayRef<uint8_t> data);
+
+// Graphs of debug info types that stress DebugInfoCollector and the generation
+// of declarations from debug info, whose size is given by a single parameter
+enum class SyntheticTypeGraph {
+  // `size` structs, each with a field of the previous one
+  DeepNesting,
+  // A struct with `size` fields, each of a struct of its own
+  WideStruct,
+  // `size` structs, each with a pointer to itself and one to the next, the
+  // last one pointing back to the first
+  PointerCycle,
+  // `size` distinct copies of the same struct, as left by linking modules
+  // that include the same header
+  Duplicates,
+};
+
+llvm::ArrayRef<SyntheticTypeGraph> GetSyntheticTypeGraphs();
+const char *GetSyntheticTypeGraphName(SyntheticTypeGraph graph);
+
+// Creates a module for the default target whose debug info types form the
+// given graph. Each root of the graph is pointed to by the parameter of a
+// definition of its own, so that DebugInfoCollector finds both the types and
+// the subprograms.
+std::unique_ptr<llvm::Module> CreateSyntheticTypeModule(
+    llvm::LLVMContext &ctx, SyntheticTypeGraph graph, unsigned size);
+
+}  // namespace rellic
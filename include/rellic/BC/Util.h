@@ -8,7 +8,10 @@
 
 #pragma once
 
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/Optional.h>
 #include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Support/MemoryBufferRef.h>
 
 #include <string>
 
@@ -19,6 +22,7 @@ class Value;
 class LLVMContext;
 class GlobalObject;
 class DIType;
+class MemoryBufferRef;
 }  // namespace llvm
 
 namespace rellic {
@@ -37,6 +41,25 @@ llvm::Module *LoadModuleFromFile(llvm::LLVMContext *context,
 llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
                                    std::string file_data,
                                    bool allow_failure = false);
+// Parses the bitcode or textual IR in `buffer` in place, without copying it.
+// The module does not refer to `buffer` once it has been loaded.
+llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
+                                   llvm::MemoryBufferRef buffer,
+                                   bool allow_failure = false);
+
+// Loads a bitcode file without reading the bodies of its functions, which are
+// materialized on demand. The file is mapped into memory rather than read when
+// possible. `Decompile` only materializes the functions it needs. Textual IR
+// files are loaded in full, like `LoadModuleFromFile` does.
+llvm::Module *LoadLazyModuleFromFile(llvm::LLVMContext *context,
+                                     std::string file_name,
+                                     bool allow_failure = false);
+
+// Loads the bitcode in `buffer` lazily, like `LoadLazyModuleFromFile`. The
+// module refers to `buffer`, which must outlive it.
+llvm::Module *LoadLazyModuleFromMemory(llvm::LLVMContext *context,
+                                       llvm::MemoryBufferRef buffer,
+                                       bool allow_failure = false);
 
 // Check if an intrinsic ID is an annotation
 bool IsAnnotationIntrinsic(llvm::Intrinsic::ID id);
@@ -50,6 +73,11 @@ void CloneMetadataInto(
 
 void CopyMetadataTo(llvm::Value *src, llvm::Value *dst);
 
+// Returns the address stored in the `pc` metadata of an instruction or
+// function. Functions without their own `pc` metadata use the address of their
+// first instruction.
+llvm::Optional<llvm::APInt> GetPCMetadata(llvm::Value *value);
+
 void RemovePHINodes(llvm::Module &module);
 
 void LowerSwitches(llvm::Module &module);
@@ -67,4 +95,29 @@ void RemoveInsertValues(llvm::Module &module);
 // Converts by value array arguments and wraps them into a struct, so that
 // semantics are preserved in C
 void ConvertArrayArguments(llvm::Module &module);
+
+struct PreprocessOptions {
+  bool remove_phi_nodes = false;
+  bool lower_switches = false;
+  // Cleanup passes run before anything else, which only ever remove or merge
+  // instructions and blocks, preserving the semantics of the module:
+  //
+  //   0: none
+  //   1: instruction simplification, constant branch folding and removal of
+  //      unreachable blocks, common subexpression elimination and dead code
+  //      elimination
+  //   2: also redundant load and dead store elimination, through MemorySSA
+  //
+  // Switches are kept as they are, rather than turned into lookup tables or
+  // comparisons, and no code is hoisted, sunk or speculated.
+  unsigned pre_opt = 0;
+  // Number of threads used to find the instructions to rewrite
+  unsigned num_threads = 1;
+};
+
+// Prepares a module for decompilation. Has the same effect as running the
+// cleanup passes of `pre_opt`, `RemovePHINodes` and `LowerSwitches` (if
+// enabled), `ConvertArrayArguments` and `RemoveInsertValues` one after the
+// other, but visits each function definition once after the cleanup.
+void PreprocessModule(llvm::Module &module, const PreprocessOptions &options);
 }  // namespace rellic
\ No newline at end of file
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Module.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace rellic {
+
+struct DecompilationContext;
+class DebugInfoCollector;
+
+/* A persistent store of decompiled function definitions, addressed by the
+ * content of their IR. Entries are plain C files inside `directory`, written
+ * atomically, so the same cache can be shared by concurrent processes.
+ *
+ * A cache can also be kept in memory, e.g. to share the definitions of the
+ * modules of one batch, in which case its entries live as long as the cache or
+ * any copy of it. */
+class DecompilationCache {
+  struct MemoryStore;
+
+  std::string directory;
+  std::shared_ptr<MemoryStore> memory;
+
+  std::string GetPath(const std::string& key) const;
+
+ public:
+  using KeyMap = std::unordered_map<llvm::Function*, std::string>;
+
+  // Creates an empty cache that is kept in memory
+  DecompilationCache();
+  DecompilationCache(std::string directory);
+
+  // Computes the keys of the function definitions in `module` that GenerateAST
+  // will structure, i.e. that are not in `dec_ctx.prototype_only`. A key covers
+  // everything the decompiled definition depends on: its instructions, the
+  // debug information they refer to, the C names of the struct types they use
+  // and `salt`. The struct types must already be declared in `dec_ctx`.
+  static KeyMap GetKeys(llvm::Module& module, DecompilationContext& dec_ctx,
+                        DebugInfoCollector& dic, llvm::StringRef salt);
+
+  std::optional<std::string> Load(const std::string& key) const;
+  void Store(const std::string& key, llvm::StringRef code) const;
+};
+
+}  // namespace rellic
@@ -9,17 +9,34 @@
 #pragma once
 
 #include <clang/Frontend/ASTUnit.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/Module.h>
 
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "Result.h"
+#include "rellic/AST/ASTPass.h"
+#include "rellic/AST/QueryLog.h"
 #include "rellic/AST/TypeProvider.h"
+#include "rellic/EventLog.h"
 
 namespace rellic {
 
+class DecompilationCache;
+class Z3ContextPool;
+
 /* This additional level of indirection is needed to alleviate the users from
  * the burden of having to instantiate custom TypeProviders before the actual
  * DecompilationContext has been created */
@@ -37,17 +54,361 @@ class SimpleTypeProviderFactory final : public TypeProviderFactory {
   }
 };
 
+struct DecompilationProgress {
+  // Stage that is being run: "prepare", "generate", then the stages of the
+  // refinement pipeline, and "done" once the result is ready. With multiple
+  // threads, this is the stage last reached by any shard.
+  std::string stage;
+  // Number of iterations of the stage done so far, if it is a fixpoint
+  unsigned iteration{0};
+};
+
+/* Lets other threads cancel a decompilation and poll its progress, see
+ * `DecompilationOptions::token`. Cancelling stops the refinement pass that is
+ * running along with its Z3 queries, and GenerateAST's queries, after which
+ * the decompilation fails with a `DecompilationError`. Definitions that have
+ * already been streamed stay streamed. A cancelled token stays cancelled. */
+class DecompilationToken {
+  mutable std::mutex mutex;
+  bool cancelled{false};
+  unsigned next_callback{0};
+  std::unordered_map<unsigned, std::function<void()>> callbacks;
+  DecompilationProgress progress;
+
+ public:
+  void Cancel();
+  bool IsCancelled() const;
+  DecompilationProgress GetProgress() const;
+
+  // Calls `callback` once the token is cancelled, right away if it already
+  // is. Callbacks are called with the token locked, so they must not call
+  // back into it. Returns the id to pass to `Unsubscribe`, which waits for
+  // the callback to return if it is running.
+  unsigned Subscribe(std::function<void()> callback);
+  void Unsubscribe(unsigned id);
+
+  void SetProgress(std::string stage, unsigned iteration = 0);
+};
+
 struct DecompilationOptions {
   using TypeProviderFactoryPtr = std::unique_ptr<TypeProviderFactory>;
 
   bool lower_switches = false;
   bool remove_phi_nodes = false;
+  // Level of the LLVM cleanup passes run on the module before it is
+  // preprocessed, see `PreprocessOptions::pre_opt`. Lifted bitcode is often
+  // full of dead code and redundant loads and branches, which every later
+  // stage would otherwise have to go through. 0 disables them.
+  unsigned pre_opt = 0;
+  // Whether PHI nodes that flow into each other share a single variable when
+  // their live ranges do not overlap, instead of each of them getting its own
+  // variable and copies. Has no effect together with `remove_phi_nodes`,
+  // which demotes every PHI node to memory.
+  bool coalesce_phi_nodes = false;
+  // Whether `DecompilationResult` should carry the provenance of the generated
+  // AST nodes. Only enable this when the maps are actually consulted.
+  bool provenance_maps = false;
+  // Whether the final AST is copied into a fresh translation unit before being
+  // returned, so that the nodes discarded by refinement are freed. This takes
+  // extra time but lowers the memory held by `DecompilationResult`.
+  bool compact_ast = false;
+  // Whether `DecompilationResult::module` is kept. Callers that only need the
+  // C code can drop it, which frees the IR and its debug information as soon
+  // as the AST is complete. `provenance_maps` and `Redecompile` need it. The
+  // Z3 state of the decompilation is always freed once refinement is done.
+  bool keep_module = true;
+
+  // Names or `pc` metadata addresses of the functions to decompile. When not
+  // empty, only the bodies of these functions are structured and refined, and
+  // every other function is only declared. Addresses are parsed like C integer
+  // literals. If `include_callees` is set, the functions they transitively
+  // call are decompiled as well. Modules loaded with `LoadLazyModuleFromFile`
+  // only have the bodies of these functions materialized, unless some are
+  // given by address or several threads are used.
+  std::unordered_set<std::string> functions;
+  bool include_callees = false;
+
+  // Splits the definitions of the module into `num_shards` shards, of which
+  // only shard `shard_index` is decompiled, so that a module can be spread
+  // over several processes or machines. Definitions are dealt to the shards in
+  // module order, and those of the other shards are only declared. Their
+  // prototypes are left out of `on_declarations`, which is therefore the same
+  // for every shard of a module, as is the naming of its struct types.
+  unsigned shard_index = 0;
+  unsigned num_shards = 1;
+
+  // Whether definitions whose IR is structurally identical, as decided by
+  // LLVM's `FunctionComparator`, are decompiled only once. The first
+  // definition of each class is decompiled, and the others get a copy of its
+  // body that refers to their own parameters. Definitions with debug
+  // information are always decompiled on their own. Type providers should not
+  // tell identical definitions apart in this mode.
+  bool deduplicate_functions = false;
+
+  // Number of threads used to decompile function definitions. When greater
+  // than one, definitions are split into shards which are decompiled in
+  // separate contexts and then merged into a single translation unit, in
+  // module order. Type provider factories must be thread-safe in this mode.
+  unsigned num_threads = 1;
+
+  // Number of threads used by Z3CondSimplify to simplify conditions, within
+  // each of the contexts above
+  unsigned simplify_threads = 1;
+  // Number of threads used by dse, nsc and cbr to decide the proofs of an
+  // iteration before applying their rewrites, within each of the contexts
+  // above
+  unsigned prove_threads = 1;
+  // Number of threads used by GenerateAST to compute the control flow analyses
+  // and reaching conditions of functions ahead of structuring them, within
+  // each of the contexts above. The results are the same up to the form of the
+  // conditions.
+  unsigned generate_threads = 1;
+  // Number of threads used by GenerateAST to compute the reaching conditions
+  // of the structuring units of each function, see `region_unit_size`. Units
+  // that do not contain each other are computed at the same time.
+  unsigned unit_threads = 1;
+
+  // The refinement passes to run, either as the name of a preset or as a
+  // description of the form
+  //
+  //   [name:]passes;[name:]fix(passes);...
+  //
+  // Stages are separated by semicolons and run in order. `fix(...)` stages are
+  // iterated until they reach a fixpoint, the others are run once. `passes` is
+  // a comma-separated list of pass names, where `fuse(a,b,...)` runs several
+  // node-local passes in a single traversal. The presets are `full`, the
+  // default, and `fast`, which skips the Z3 simplification of conditions and
+  // reachability-based refinement. Conditions are only turned into C
+  // expressions by the `mc` pass, so every pipeline should run it last. The
+  // renaming passes `ldr` and `sfr` cannot be part of a fixpoint.
+  std::string pipeline;
+
+  // Function definitions whose control flow graph exceeds any of these
+  // nonzero limits are decompiled with less effort: their reaching conditions
+  // are simplified with Z3's rewriter only, and they are refined with
+  // `large_function_pipeline` instead of `pipeline`. The stages of
+  // `pipeline` that precede its first fixpoint are still run on them.
+  FunctionSize large_function_limits;
+  std::string large_function_pipeline = "fast";
+
+  // See `DecompilationContext::blob_initializer_size`. This keeps the AST and
+  // output of modules with large data tables small, at the cost of the types
+  // that type providers give to those globals.
+  uint64_t blob_initializer_size = 0;
+  // See `DecompilationContext::cond_var_size`
+  unsigned cond_var_size = 16;
+  // See `DecompilationContext::reach_var_size`
+  unsigned reach_var_size = 0;
+  // See `DecompilationContext::region_unit_size`
+  unsigned region_unit_size = 0;
+  // How control flow is structured, see `StructuringEngine`. `Patterns` is
+  // much faster on the reducible control flow of compiled code, and falls back
+  // on reaching conditions for the regions it cannot match.
+  StructuringEngine structuring = StructuringEngine::ReachingConditions;
+
+  // Budgets for structuring control flow with reaching conditions, see
+  // `DecompilationContext::goto_cond_size` and `goto_timeout`. Regions that
+  // exceed them are expressed with labels and gotos instead. Zero means
+  // unbounded.
+  unsigned goto_cond_size = 0;
+  std::chrono::milliseconds goto_timeout{0};
+
+  // Budgets for the refinement fixpoints. Zero means unbounded. Once a budget
+  // runs out the remaining refinement is skipped, so output is still produced
+  // but is less refined. Refinement passes operate on whole translation units,
+  // so the per-function time budget is pooled over all the function
+  // definitions being refined.
+  unsigned max_fixpoint_iterations = 0;
+  std::chrono::milliseconds module_timeout{0};
+  std::chrono::milliseconds function_timeout{0};
+  // Memory budget for each decompilation context, in bytes, as estimated by
+  // `DecompilationContext::GetMemoryUsage`. It is checked between fixpoint
+  // iterations, so it is a soft limit.
+  size_t memory_limit = 0;
+  // Limits of each Z3 query, in milliseconds and Z3 resource units. Zero
+  // means unbounded. Queries that run out of their limit are answered
+  // conservatively, see `Prover`.
+  unsigned z3_timeout = 0;
+  unsigned z3_rlimit = 0;
+  // Whether small conditions are decided on their truth tables instead of
+  // with Z3 queries
+  ConditionEngine condition_engine = ConditionEngine::Z3;
+  // Whether the time each inference rule takes to match is measured, see
+  // `DecompilationContext::rule_timing`. This makes rule matching slower.
+  bool rule_timing = false;
+
+  // When either callback is set, decompiled code is streamed while it is being
+  // produced. All top-level declarations other than function definitions are
+  // passed to `on_declarations` first, then each definition is passed to
+  // `on_definition`, in module order. Definitions are refined one at a time so
+  // that each can be emitted as soon as it is final; with multiple threads
+  // they are emitted once all shards have been merged.
+  std::function<void(llvm::StringRef code)> on_declarations;
+  std::function<void(const llvm::Function& func, llvm::StringRef code)>
+      on_definition;
+
+  bool IsStreaming() const { return on_declarations || on_definition; }
+
+  // Whether the body of each definition is released once it has been
+  // streamed, along with the entries of the side tables and the conditions
+  // that refer to it, so that only its prototype is left in the resulting AST.
+  // Nodes are allocated in the `ASTContext` arena, which only frees them with
+  // the translation unit, so this bounds the tables and the Z3 state rather
+  // than the arena. Definitions that others are copied from by
+  // `deduplicate_functions` are kept.
+  bool release_streamed_definitions = false;
+
+  // If set, streamed integer literals of at least this value are printed in
+  // hexadecimal, the way rellic-dec2hex would rewrite them
+  std::optional<uint64_t> hex_literals_from;
+
+  // Directory of a persistent cache of decompiled function definitions. It is
+  // only used when streaming, as cached definitions are emitted as C code
+  // without being decompiled again, and are therefore missing from the
+  // resulting AST. Definitions whose refinement was cut short by a budget are
+  // not cached. Cache keys do not cover `additional_providers`, so a separate
+  // directory should be used for each set of type providers.
+  std::string cache_directory;
+  // If set, this cache is used instead of `cache_directory`, under the same
+  // conditions. An in-memory cache shares definitions between decompilations
+  // without touching the disk, see `DecompileMany`.
+  std::shared_ptr<DecompilationCache> definition_cache;
+
+  // Path of a checkpoint to write once GenerateAST has structured the module,
+  // and of a checkpoint to resume from instead of structuring it, see
+  // `WriteCheckpoint`. A checkpoint must be resumed with the module it was
+  // written for and the same options, except for those that only affect
+  // refinement and output, e.g. `pipeline` and the budgets. Checkpoints are
+  // only supported by single-threaded, unsharded decompilations without a
+  // cache, and not by `Redecompile`.
+  std::string checkpoint_out;
+  std::string resume_from;
+
+  // If set, every query that reaches Z3 is recorded in this log
+  std::shared_ptr<QueryLog> query_log;
+  // If set, a standalone capture of every function definition whose
+  // structuring and refinement took longer than `forensics_time`, whose
+  // structuring grew memory by more than `forensics_memory` bytes, or which was
+  // cut short by `goto_timeout` or, when streaming, by a refinement budget, is
+  // written to this directory, see `WriteForensics`. Zero thresholds are not
+  // checked. Each capture holds the `forensics_queries` slowest Z3 queries of
+  // the function. Refinement is only measured per function when streaming
+  // with a single thread, as it otherwise runs on whole translation units.
+  std::string forensics_directory;
+  std::chrono::milliseconds forensics_time{0};
+  size_t forensics_memory = 0;
+  unsigned forensics_queries = 16;
+  // If set, the events of the decompilation, e.g. the runs of the refinement
+  // passes, are recorded in this log
+  std::shared_ptr<EventLog> event_log;
+  // If set, the decompilation can be cancelled and followed through this
+  // token. A token should only be used by one decompilation.
+  std::shared_ptr<DecompilationToken> token;
 
   // Additional type providers to be used during code generation.
-  // Providers added later will have higher priority.
+  // Providers added later will have higher priority. Type queries are only
+  // memoized if every provider is cacheable, see `TypeProvider::IsCacheable`.
   std::vector<TypeProviderFactoryPtr> additional_providers;
 };
 
+struct PassStatistics {
+  struct Pass {
+    std::string name;
+    ASTPassStatistics stats;
+  };
+
+  // A stage is one of the composite passes run by `Decompile`, most of which
+  // are iterated until they reach a fixpoint
+  struct Stage {
+    std::string name;
+    unsigned num_iterations{0};
+    // Whether the stage was cut short by an iteration, time or memory budget
+    bool truncated{false};
+    ASTPassStatistics stats;
+    std::vector<Pass> passes;
+  };
+
+  std::vector<Stage> stages;
+  // Highest memory usage observed between passes. When decompiling with
+  // multiple threads, this is the highest usage of any shard.
+  MemoryUsage peak_memory;
+  ProverStatistics prover;
+  // By name of inference rule
+  RuleStatisticsMap rules;
+  // Size of each function definition and time GenerateAST took to structure
+  // it, in the order they were structured, shard by shard
+  std::vector<FunctionMetrics> functions;
+};
+
+/* A read-only view of one of the provenance tables of a decompilation. The
+ * table is moved out of the decompilation context rather than copied, and the
+ * inverse mapping is only built the first time it is queried. Entries may
+ * refer to AST nodes that have been replaced by later refinements. */
+template <typename TKey, typename TValue>
+class ProvenanceMap {
+ public:
+  using Map = llvm::DenseMap<TKey*, TValue*>;
+  using InverseMap = llvm::DenseMap<const TValue*, const TKey*>;
+
+ private:
+  struct Tables {
+    Map map;
+    std::once_flag inverse_flag;
+    InverseMap inverse;
+  };
+  std::unique_ptr<Tables> tables;
+
+ public:
+  ProvenanceMap() = default;
+  explicit ProvenanceMap(Map map) : tables(std::make_unique<Tables>()) {
+    tables->map = std::move(map);
+  }
+
+  // Whether provenance was requested for the decompilation
+  bool IsAvailable() const { return !!tables; }
+
+  const Map& Forward() const {
+    static const Map empty;
+    return tables ? tables->map : empty;
+  }
+
+  const InverseMap& Inverse() const {
+    static const InverseMap empty;
+    if (!tables) {
+      return empty;
+    }
+    std::call_once(tables->inverse_flag, [this]() {
+      for (auto [key, value] : tables->map) {
+        if (value) {
+          tables->inverse[value] = key;
+        }
+      }
+    });
+    return tables->inverse;
+  }
+
+  // Returns nullptr if `key` has no known provenance
+  const TValue* Lookup(const TKey* key) const {
+    auto& map{Forward()};
+    auto it{map.find(const_cast<TKey*>(key))};
+    return it == map.end() ? nullptr : it->second;
+  }
+
+  const TKey* InverseLookup(const TValue* value) const {
+    auto& inverse{Inverse()};
+    auto it{inverse.find(value)};
+    return it == inverse.end() ? nullptr : it->second;
+  }
+};
+
+// A function definition that could not be decompiled
+struct FunctionError {
+  // Null when `DecompilationOptions::keep_module` is not set
+  const llvm::Function* function;
+  std::string name;
+  std::string message;
+};
+
 struct DecompilationResult {
   using StmtToIRMap =
       std::unordered_map<const clang::Stmt*, const llvm::Value*>;
@@ -66,14 +427,17 @@ struct DecompilationResult {
 
   std::unique_ptr<llvm::Module> module;
   std::unique_ptr<clang::ASTUnit> ast;
-  StmtToIRMap stmt_provenance_map;
-  IRToStmtMap value_to_stmt_map;
-  DeclToIRMap decl_provenance_map;
-  IRToDeclMap value_to_decl_map;
-  TypeDeclToIRMap type_provenance_map;
-  IRToTypeDeclMap type_to_decl_map;
-  ExprToUseMap expr_use_map;
-  UseToExprMap use_expr_map;
+  // Only available when `DecompilationOptions::provenance_maps` is set
+  ProvenanceMap<clang::Stmt, llvm::Value> stmt_provenance;
+  ProvenanceMap<llvm::Value, clang::ValueDecl> value_decls;
+  ProvenanceMap<llvm::Type, clang::TypeDecl> type_decls;
+  ProvenanceMap<clang::Expr, llvm::Use> use_provenance;
+  // When decompiling with multiple threads, the statistics of all shards are
+  // added together
+  PassStatistics statistics;
+  // Definitions that could not be decompiled, in module order. They are only
+  // declared in `ast`, while the rest of the module is decompiled as usual.
+  std::vector<FunctionError> function_errors;
 };
 
 struct DecompilationError {
@@ -82,6 +446,115 @@ struct DecompilationError {
   std::string message;
 };
 
+// Decompiles `module`. Calls on modules of different `llvm::LLVMContext`s may
+// run concurrently. Failures are reported as a `DecompilationError` rather
+// than by terminating the process, unless they are confined to single function
+// definitions, which are then listed in `DecompilationResult::function_errors`.
+// Logging goes through glog, which the caller is responsible for initializing.
 Result<DecompilationResult, DecompilationError> Decompile(
     std::unique_ptr<llvm::Module> module, DecompilationOptions options = {});
+
+// Decompiles `previous.module` again after the functions in `changed` have
+// been edited, e.g. to patch their bodies or retype them. Only the changed
+// definitions, and those that use a changed function, go through GenerateAST
+// and refinement again, while all other definitions are imported from
+// `previous.ast`. Edits to global variables or types are not tracked, so the
+// definitions that use them must also be in `changed`.
+//
+// `previous` must have been decompiled with `provenance_maps`, which are
+// always computed for the result.
+Result<DecompilationResult, DecompilationError> Redecompile(
+    DecompilationResult previous,
+    const std::unordered_set<const llvm::Function*>& changed,
+    DecompilationOptions options = {});
+
+// Runs a task, e.g. by queueing it on a thread pool
+using DecompilationExecutor = std::function<void(std::function<void()> task)>;
+
+/* A decompilation started by `DecompileAsync` */
+class DecompilationJob {
+  std::shared_ptr<DecompilationToken> token;
+  std::future<Result<DecompilationResult, DecompilationError>> result;
+
+ public:
+  DecompilationJob(
+      std::shared_ptr<DecompilationToken> token,
+      std::future<Result<DecompilationResult, DecompilationError>> result)
+      : token(std::move(token)), result(std::move(result)) {}
+
+  // Whether `Get` would return without blocking
+  bool IsReady() const {
+    return result.wait_for(std::chrono::seconds(0)) ==
+           std::future_status::ready;
+  }
+  void Wait() const { result.wait(); }
+  // Waits for the result and returns it. Can only be called once.
+  Result<DecompilationResult, DecompilationError> Get() {
+    return result.get();
+  }
+
+  void Cancel() { token->Cancel(); }
+  DecompilationProgress GetProgress() const { return token->GetProgress(); }
+  const std::shared_ptr<DecompilationToken>& GetToken() const { return token; }
+};
+
+// Decompiles each of `modules` with `options`, on up to `num_threads` threads
+// including the calling one, and returns one result per module, in the same
+// order. Modules of the same `llvm::LLVMContext` are decompiled one after the
+// other. When streaming without a cache, the batch shares an in-memory
+// `definition_cache`, so that a definition found in several modules is only
+// decompiled once, unless the modules that have it run at the same time.
+//
+// `options.token`, if set, cancels the whole batch, and its progress is that
+// of whichever module last reported it. The callbacks of `options` and the
+// factories of `additional_providers` are called from every thread of the
+// batch, and must be thread-safe.
+std::vector<Result<DecompilationResult, DecompilationError>> DecompileMany(
+    std::vector<std::unique_ptr<llvm::Module>> modules,
+    DecompilationOptions options = {}, unsigned num_threads = 1);
+
+// Same as `Decompile`, but runs on `executor` and returns right away. The
+// job uses `options.token` if set, or a new token otherwise. Without an
+// executor, the job runs on a thread of its own. Jobs that the executor drops
+// without running them fail with `std::future_error` once their result is
+// requested.
+DecompilationJob DecompileAsync(std::unique_ptr<llvm::Module> module,
+                                DecompilationOptions options = {},
+                                DecompilationExecutor executor = nullptr);
+
+/* A decompilation session that can be reused across `Decompile` calls. Setting
+ * up the Clang frontend for a new translation unit is a significant part of
+ * the cost of decompiling small modules, so the session keeps a number of
+ * empty translation units ready for each target triple it has seen, and
+ * prepares replacements in the background as they are handed out. Likewise,
+ * the Z3 contexts of finished decompilations are pooled and reused by the
+ * next ones.
+ *
+ * Sessions can be shared by multiple threads. */
+class Decompiler {
+  unsigned num_prepared_units;
+  std::mutex prepared_units_mutex;
+  std::unordered_map<std::string,
+                     std::deque<std::future<std::unique_ptr<clang::ASTUnit>>>>
+      prepared_units;
+  std::shared_ptr<Z3ContextPool> z3_pool;
+
+  std::unique_ptr<clang::ASTUnit> TakeASTUnit(const std::string& triple);
+
+ public:
+  Decompiler(unsigned num_prepared_units = 1);
+  ~Decompiler();
+
+  Result<DecompilationResult, DecompilationError> Decompile(
+      std::unique_ptr<llvm::Module> module, DecompilationOptions options = {});
+  // The session must outlive the job
+  DecompilationJob DecompileAsync(std::unique_ptr<llvm::Module> module,
+                                  DecompilationOptions options = {},
+                                  DecompilationExecutor executor = nullptr);
+  // Same as `rellic::DecompileMany`, with the translation units and Z3
+  // contexts of the session
+  std::vector<Result<DecompilationResult, DecompilationError>> DecompileMany(
+      std::vector<std::unique_ptr<llvm::Module>> modules,
+      DecompilationOptions options = {}, unsigned num_threads = 1);
+};
 }  // namespace rellic
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "rellic/Result.h"
+
+namespace rellic {
+
+enum class EventLevel { Debug, Info, Warning };
+
+// Name of `level` in event logs
+const char* GetEventLevelName(EventLevel level);
+std::optional<EventLevel> ParseEventLevel(llvm::StringRef name);
+
+/*
+ * A log of the events of decompilations, e.g. the runs of the refinement
+ * passes and the hits of the decompilation cache. Events below the level of
+ * the log are dropped before their message is even formatted, see
+ * `RELLIC_EVENT`, so a log that is missing or filters everything out costs a
+ * branch per event. The other events are buffered and handed over to the sink
+ * in batches. They also show up in the time trace of their thread, if any. A
+ * single log can be shared by several decompilations, even across threads.
+ */
+class EventLog {
+ public:
+  struct Event {
+    EventLevel level;
+    std::string name;
+    std::string message;
+    // Since the creation of the log
+    std::chrono::microseconds time{0};
+  };
+  using Sink = std::function<void(const std::vector<Event>& events)>;
+
+ private:
+  EventLevel level;
+  size_t batch_size;
+  std::chrono::steady_clock::time_point start;
+  Sink sink;
+  std::mutex mutex;
+  std::vector<Event> pending;
+  // Serializes the calls to the sink, which are made without holding `mutex`
+  std::mutex sink_mutex;
+
+ public:
+  EventLog(Sink sink, EventLevel level = EventLevel::Info,
+           size_t batch_size = 256);
+  ~EventLog();
+
+  EventLog(const EventLog&) = delete;
+  EventLog& operator=(const EventLog&) = delete;
+
+  // Writes each event to `path` as a line of JSON
+  static Result<std::unique_ptr<EventLog>, std::string> Create(
+      llvm::StringRef path, EventLevel level = EventLevel::Info);
+
+  bool IsEnabled(EventLevel event_level) const {
+    return event_level >= level;
+  }
+
+  void Record(EventLevel event_level, llvm::StringRef name,
+              std::string message);
+  // Hands the pending events over to the sink
+  void Flush();
+};
+
+// Formats the message of an event and records it when destroyed
+class EventMessage {
+  EventLog& log;
+  EventLevel level;
+  llvm::StringRef name;
+  std::string message;
+  llvm::raw_string_ostream os;
+
+ public:
+  EventMessage(EventLog& log, EventLevel level, llvm::StringRef name)
+      : log(log), level(level), name(name), os(message) {}
+  ~EventMessage();
+
+  llvm::raw_ostream& stream() { return os; }
+};
+
+}  // namespace rellic
+
+// Streams the message of an event named `name` to `log`, a pointer to an
+// `EventLog` that may be null. The message is only formatted if `log` records
+// events of `level`:
+//
+//   RELLIC_EVENT(dec_ctx.events, rellic::EventLevel::Info, "cache")
+//       << "Found " << num_hits << " definitions";
+#define RELLIC_EVENT(log, level, name)                                   \
+  for (bool rellic_event_once{(log) && (log)->IsEnabled(level)};         \
+       rellic_event_once; rellic_event_once = false)                     \
+  rellic::EventMessage(*(log), (level), (name)).stream()
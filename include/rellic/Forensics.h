@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "rellic/AST/QueryLog.h"
+#include "rellic/Decompiler.h"
+
+namespace rellic {
+
+// How the refinement of a function definition went, when definitions are
+// refined one at a time
+struct RefinementMetrics {
+  std::chrono::nanoseconds elapsed{0};
+  // Whether it was cut short by a budget
+  bool truncated{false};
+  // The slowest queries it made, slowest first
+  std::vector<QueryLog::Query> slowest_queries;
+};
+
+using RefinementMetricsMap =
+    std::unordered_map<const llvm::Function*, RefinementMetrics>;
+
+// A copy of `module` in which only `func` is defined, along with declarations
+// of the functions and global variables it refers to
+std::unique_ptr<llvm::Module> ExtractFunction(const llvm::Module& module,
+                                              const llvm::Function& func);
+
+/* Writes a forensic capture of each function definition of `module` that
+ * took longer than `options.forensics_time`, grew memory by more than
+ * `options.forensics_memory` or was cut short by a budget, according to the
+ * metrics of `stats` and `refinements`, to `options.forensics_directory`:
+ *
+ *   NAME.bc:            the function on its own, see `ExtractFunction`, which
+ *                       reproduces its decompilation without the rest of the
+ *                       module
+ *   NAME.json:          why it was captured, its metrics and the statistics of
+ *                       the stages of the decompilation
+ *   NAME.queries.jsonl: its slowest Z3 queries, as a `QueryLog` that can be
+ *                       replayed by rellic-z3bench
+ *
+ * Captures are diagnostics, so files that cannot be written are only warned
+ * about. Returns the number of captures written. */
+unsigned WriteForensics(const llvm::Module& module,
+                        const PassStatistics& stats,
+                        const RefinementMetricsMap& refinements,
+                        const DecompilationOptions& options);
+
+}  // namespace rellic
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/Stmt.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rellic/AST/DecompilationContext.h"
+#include "rellic/Decompiler.h"
+#include "rellic/Result.h"
+
+namespace rellic {
+
+/* Numbers the values of a module in a fixed order, so that they can be referred
+ * to from outside of the process: global variables, functions, aliases and
+ * ifuncs in module order, followed by the arguments, basic blocks and
+ * instructions of each function definition, each block coming before its
+ * instructions. Constants other than globals are not numbered. */
+class ValueNumbering {
+  std::vector<const llvm::Value*> values;
+  llvm::DenseMap<const llvm::Value*, uint32_t> ids;
+
+  void Add(const llvm::Value* value);
+
+ public:
+  static constexpr uint32_t None{UINT32_MAX};
+
+  explicit ValueNumbering(const llvm::Module& module);
+
+  // Returns `None` if `value` is not numbered
+  uint32_t GetId(const llvm::Value* value) const;
+  // Returns nullptr if `id` is out of range
+  const llvm::Value* GetValue(uint32_t id) const;
+  uint32_t GetNumValues() const { return values.size(); }
+};
+
+// Lists the statements of the body of a function definition, or of the
+// initializer of a file-scope variable, in the order in which they are
+// numbered by a provenance table: a preorder traversal of their children.
+std::vector<clang::Stmt*> GetNumberedStmts(clang::Decl* decl);
+
+/* The provenance of a serialized AST, as written by `SerializeAST`. The table
+ * is a flat file of little-endian 32-bit integers, meant to be memory-mapped:
+ *
+ *   a header holding the magic number, the version of the format and the
+ *   number of values of the module, declaration records and statement records
+ *
+ *   declaration records: the id of a declaration in the AST file and the id
+ *   of its IR value in the `ValueNumbering` of the module, sorted by
+ *   declaration
+ *
+ *   statement records: the id of the declaration that owns a statement, the
+ *   index of the statement in `GetNumberedStmts` of that declaration and the
+ *   id of its IR value, sorted by declaration and index
+ *
+ * Declaration ids are those of Clang's AST reader, so declarations can be
+ * deserialized one at a time with `clang::ExternalASTSource::GetExternalDecl`
+ * after loading the AST file with `clang::ASTUnit::LoadFromASTFile`. */
+class ProvenanceTable {
+ public:
+  using Word = llvm::support::ulittle32_t;
+
+  struct Header {
+    Word magic;
+    Word version;
+    Word num_values;
+    Word num_decls;
+    Word num_stmts;
+  };
+
+  struct DeclRecord {
+    Word decl;
+    Word value;
+  };
+
+  struct StmtRecord {
+    Word decl;
+    Word stmt;
+    Word value;
+  };
+
+  static constexpr uint32_t Magic{0x56525052};  // "RPRV"
+  static constexpr uint32_t Version{1};
+
+ private:
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  uint32_t num_values{0};
+  llvm::ArrayRef<DeclRecord> decls;
+  llvm::ArrayRef<StmtRecord> stmts;
+
+ public:
+  // An empty table
+  ProvenanceTable() = default;
+
+  // Takes `buffer` over after checking that it holds a well-formed table
+  static Result<ProvenanceTable, std::string> Load(
+      std::unique_ptr<llvm::MemoryBuffer> buffer);
+  // Maps the file at `path` into memory and loads it
+  static Result<ProvenanceTable, std::string> Open(llvm::StringRef path);
+
+  // Number of values of the numbering the table refers to, to check that it
+  // is used with the right module
+  uint32_t GetNumValues() const { return num_values; }
+  llvm::ArrayRef<DeclRecord> GetDecls() const { return decls; }
+  llvm::ArrayRef<StmtRecord> GetStmts() const { return stmts; }
+  // The statement records owned by `decl`
+  llvm::ArrayRef<StmtRecord> GetStmts(uint32_t decl) const;
+
+  // Returns `ValueNumbering::None` if there is no record
+  uint32_t LookupDecl(uint32_t decl) const;
+  uint32_t LookupStmt(uint32_t decl, uint32_t stmt) const;
+};
+
+struct SerializationStatistics {
+  size_t num_decls{0};
+  size_t num_stmts{0};
+};
+
+// Writes the AST of `result` to `ast_os` as a Clang precompiled AST file, and
+// its provenance to `table_os` as a `ProvenanceTable`. The table refers to the
+// `ValueNumbering` of `result.module`, which may differ from the module that
+// was decompiled, so consumers should keep `result.module` along with the AST.
+// `result` must have been decompiled with `provenance_maps`.
+Result<SerializationStatistics, std::string> SerializeAST(
+    const DecompilationResult& result, llvm::raw_ostream& ast_os,
+    llvm::raw_ostream& table_os);
+
+/* Writes a checkpoint of `dec_ctx`, which decompiles `module`, so that
+ * refinement can be resumed from it in another process by `ReadCheckpoint`:
+ * the AST to `path` as a Clang precompiled AST file, and the side tables of
+ * the context to `path + ".json"`.
+ *
+ * Side tables refer to declarations and statements like a `ProvenanceTable`
+ * does, to values by their `ValueNumbering` and to struct types by their index
+ * in `llvm::TypeFinder`. Conditions and the variables they refer to are
+ * written as the assertions of an SMT-LIB benchmark. Caches, such as the facts
+ * of the prover or the C types of IR types, are not written. Throws
+ * `Exception` if a condition cannot be written. */
+void WriteCheckpoint(DecompilationContext& dec_ctx, llvm::Module& module,
+                     const std::string& path);
+
+// Restores the checkpoint at `path` into `dec_ctx`, which must have been
+// created on an empty translation unit. `module` must be in the state the
+// checkpoint was written from, e.g. preprocessed the same way. Throws
+// `Exception` if the checkpoint cannot be read, or does not match `module`.
+void ReadCheckpoint(DecompilationContext& dec_ctx, llvm::Module& module,
+                    const std::string& path);
+
+}  // namespace rellic
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/Support/TimeProfiler.h>
+
+namespace rellic {
+
+/* Spans of the decompilation are recorded with LLVM's time trace profiler,
+ * through `llvm::TimeTraceScope`, and written in the Chrome Trace Event format
+ * by `llvm::timeTraceProfilerWrite`. Spans are only recorded on threads that
+ * have a profiler, which costs a thread-local load when they do not.
+ *
+ * The profiler is per thread, so threads started by rellic create one when the
+ * thread that started them has one, and hand their spans over to the process
+ * when they end. Create a `TraceThread` at the start of every such thread with
+ * the result of `IsTracing` on the parent thread. */
+inline bool IsTracing() { return llvm::timeTraceProfilerEnabled(); }
+
+class TraceThread {
+  bool enabled;
+
+ public:
+  TraceThread(bool enabled) : enabled(enabled) {
+    if (enabled) {
+      llvm::timeTraceProfilerInitialize(/*TimeTraceGranularity=*/0, "rellic");
+    }
+  }
+  ~TraceThread() {
+    if (enabled) {
+      llvm::timeTraceProfilerFinishThread();
+    }
+  }
+
+  TraceThread(const TraceThread &) = delete;
+  TraceThread &operator=(const TraceThread &) = delete;
+};
+
+}  // namespace rellic
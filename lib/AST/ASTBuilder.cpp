@@ -18,6 +18,8 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <optional>
+
 #include "rellic/AST/Util.h"
 #include "rellic/Exception.h"
 
@@ -85,10 +87,292 @@ static unsigned GetOperatorPrecedence(clang::Expr *op) {
   return 0U;
 }
 
+
+// The functions below create expressions directly, the same way Sema does
+// when it has no implicit conversion to add other than lvalue-to-rvalue ones
+// and nothing to diagnose. They return null when Sema is needed.
+
+// Type of `expr` after the lvalue-to-rvalue conversion Sema applies to
+// operands, or a null type when the operand would decay or be converted in
+// some other way
+static clang::QualType GetRValueType(clang::Expr *expr) {
+  auto type{expr->getType()};
+  if (expr->refersToBitField()) {
+    return {};
+  }
+  if (!expr->isGLValue()) {
+    return type.hasQualifiers() ? clang::QualType() : type;
+  }
+  if (type->isArrayType() || type->isFunctionType() || type->isAtomicType() ||
+      type->isVoidType()) {
+    return {};
+  }
+  return type.getUnqualifiedType();
+}
+
+static clang::Expr *ToRValue(clang::ASTContext &ctx, clang::Expr *expr) {
+  if (!expr->isGLValue()) {
+    return expr;
+  }
+  return clang::ImplicitCastExpr::Create(
+      ctx, expr->getType().getUnqualifiedType(), clang::CK_LValueToRValue,
+      expr, /*BasePath=*/nullptr, clang::VK_PRValue,
+      clang::FPOptionsOverride());
+}
+
+// Whether the integer promotions leave the type of an rvalue alone.
+// Floating point operands may be promoted depending on the evaluation method,
+// so they are left to Sema.
+static bool IsPromotedInteger(clang::ASTContext &ctx, clang::QualType type) {
+  if (type.isNull()) {
+    return false;
+  }
+  auto builtin{type->getAs<clang::BuiltinType>()};
+  return builtin && builtin->isInteger() && !ctx.isPromotableIntegerType(type);
+}
+
+static bool IsPromotedScalar(clang::ASTContext &ctx, clang::QualType type) {
+  return IsPromotedInteger(ctx, type) ||
+         (!type.isNull() && type->isPointerType());
+}
+
+static bool IsCastScalar(clang::QualType type) {
+  if (type.isNull()) {
+    return false;
+  }
+  if (type->isPointerType() || type->isIntegerType()) {
+    return true;
+  }
+  auto builtin{type->getAs<clang::BuiltinType>()};
+  if (!builtin) {
+    return false;
+  }
+  switch (builtin->getKind()) {
+    case clang::BuiltinType::Float:
+    case clang::BuiltinType::Double:
+    case clang::BuiltinType::LongDouble:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Same as `Sema::PrepareScalarCast` for the types accepted by `IsCastScalar`.
+// Casts between pointers and floating point values are errors.
+static std::optional<clang::CastKind> GetScalarCastKind(clang::ASTContext &ctx,
+                                                        clang::Expr *expr,
+                                                        clang::QualType src,
+                                                        clang::QualType type) {
+  if (ctx.hasSameUnqualifiedType(src, type)) {
+    return clang::CK_NoOp;
+  }
+
+  if (src->isPointerType()) {
+    if (type->isPointerType()) {
+      return src->getPointeeType().getAddressSpace() ==
+                     type->getPointeeType().getAddressSpace()
+                 ? clang::CK_BitCast
+                 : clang::CK_AddressSpaceConversion;
+    }
+    if (type->isBooleanType()) {
+      return clang::CK_PointerToBoolean;
+    }
+    if (type->isIntegerType()) {
+      return clang::CK_PointerToIntegral;
+    }
+    return std::nullopt;
+  }
+
+  if (src->isIntegerType()) {
+    if (type->isPointerType()) {
+      return expr->isNullPointerConstant(
+                 ctx, clang::Expr::NPC_ValueDependentIsNull)
+                 ? clang::CK_NullToPointer
+                 : clang::CK_IntegralToPointer;
+    }
+    if (type->isBooleanType()) {
+      return clang::CK_IntegralToBoolean;
+    }
+    return type->isIntegerType() ? clang::CK_IntegralCast
+                                 : clang::CK_IntegralToFloating;
+  }
+
+  if (type->isPointerType()) {
+    return std::nullopt;
+  }
+  if (type->isBooleanType()) {
+    return clang::CK_FloatingToBoolean;
+  }
+  return type->isIntegerType() ? clang::CK_FloatingToIntegral
+                               : clang::CK_FloatingCast;
+}
+
+static clang::CStyleCastExpr *TryCreateCStyleCast(clang::ASTContext &ctx,
+                                                  clang::QualType type,
+                                                  clang::Expr *expr) {
+  auto src{GetRValueType(expr)};
+  if (type.hasQualifiers() || !IsCastScalar(type) || !IsCastScalar(src)) {
+    return nullptr;
+  }
+  auto kind{GetScalarCastKind(ctx, expr, src, type)};
+  if (!kind) {
+    return nullptr;
+  }
+  return clang::CStyleCastExpr::Create(
+      ctx, type, clang::VK_PRValue, *kind, ToRValue(ctx, expr),
+      /*BasePath=*/nullptr, clang::FPOptionsOverride(),
+      ctx.getTrivialTypeSourceInfo(type), clang::SourceLocation(),
+      clang::SourceLocation());
+}
+
+static clang::UnaryOperator *TryCreateUnaryOp(clang::ASTContext &ctx,
+                                              clang::UnaryOperatorKind opc,
+                                              clang::Expr *expr) {
+  clang::QualType type;
+  auto vk{clang::VK_PRValue};
+  switch (opc) {
+    case clang::UO_AddrOf: {
+      // Only objects that can have their address taken without a diagnostic
+      auto op{expr->IgnoreParens()};
+      if (!expr->isLValue() || expr->refersToBitField() ||
+          expr->getType()->isFunctionType()) {
+        return nullptr;
+      }
+      if (auto ref = clang::dyn_cast<clang::DeclRefExpr>(op)) {
+        auto var{clang::dyn_cast<clang::VarDecl>(ref->getDecl())};
+        if (!var || var->getStorageClass() == clang::SC_Register) {
+          return nullptr;
+        }
+      } else if (auto uo = clang::dyn_cast<clang::UnaryOperator>(op)) {
+        if (uo->getOpcode() != clang::UO_Deref) {
+          return nullptr;
+        }
+      } else if (!clang::isa<clang::MemberExpr>(op) &&
+                 !clang::isa<clang::ArraySubscriptExpr>(op)) {
+        return nullptr;
+      }
+      type = ctx.getPointerType(expr->getType());
+    } break;
+    case clang::UO_Deref: {
+      auto ptr_type{GetRValueType(expr)};
+      if (ptr_type.isNull() || !ptr_type->isPointerType()) {
+        return nullptr;
+      }
+      type = ptr_type->getPointeeType();
+      // `void` and function lvalues do not exist in C
+      if (type->isVoidType() || type->isFunctionType()) {
+        return nullptr;
+      }
+      expr = ToRValue(ctx, expr);
+      vk = clang::VK_LValue;
+    } break;
+    case clang::UO_LNot:
+      if (!IsPromotedScalar(ctx, GetRValueType(expr))) {
+        return nullptr;
+      }
+      expr = ToRValue(ctx, expr);
+      type = ctx.IntTy;
+      break;
+    case clang::UO_Not:
+    case clang::UO_Minus:
+      type = GetRValueType(expr);
+      if (!IsPromotedInteger(ctx, type)) {
+        return nullptr;
+      }
+      expr = ToRValue(ctx, expr);
+      break;
+    default:
+      return nullptr;
+  }
+  return clang::UnaryOperator::Create(
+      ctx, expr, opc, type, vk, clang::OK_Ordinary, clang::SourceLocation(),
+      /*CanOverflow=*/opc == clang::UO_Minus, clang::FPOptionsOverride());
+}
+
+static clang::BinaryOperator *TryCreateBinaryOp(clang::ASTContext &ctx,
+                                                clang::BinaryOperatorKind opc,
+                                                clang::Expr *lhs,
+                                                clang::Expr *rhs) {
+  auto lhs_type{GetRValueType(lhs)};
+  auto rhs_type{GetRValueType(rhs)};
+  if (rhs_type.isNull()) {
+    return nullptr;
+  }
+
+  clang::QualType type;
+  switch (opc) {
+    case clang::BO_Assign:
+      // Sema would convert the right hand side to the type of the left one
+      lhs_type = lhs->getType();
+      if (lhs->refersToBitField() || lhs_type.hasQualifiers() ||
+          !IsCastScalar(lhs_type) ||
+          lhs->isModifiableLvalue(ctx) != clang::Expr::MLV_Valid ||
+          ctx.getCanonicalType(lhs_type) != ctx.getCanonicalType(rhs_type)) {
+        return nullptr;
+      }
+      return clang::BinaryOperator::Create(
+          ctx, lhs, ToRValue(ctx, rhs), opc, lhs_type, clang::VK_PRValue,
+          clang::OK_Ordinary, clang::SourceLocation(),
+          clang::FPOptionsOverride());
+    case clang::BO_LAnd:
+    case clang::BO_LOr:
+      // Each operand is only promoted
+      if (!IsPromotedScalar(ctx, lhs_type) ||
+          !IsPromotedScalar(ctx, rhs_type)) {
+        return nullptr;
+      }
+      type = ctx.IntTy;
+      break;
+    case clang::BO_Shl:
+    case clang::BO_Shr:
+      if (!IsPromotedInteger(ctx, lhs_type) ||
+          !IsPromotedInteger(ctx, rhs_type)) {
+        return nullptr;
+      }
+      type = lhs_type;
+      break;
+    case clang::BO_LT:
+    case clang::BO_GT:
+    case clang::BO_LE:
+    case clang::BO_GE:
+    case clang::BO_EQ:
+    case clang::BO_NE:
+      // Pointers of the same type are compared without conversions too
+      if (lhs_type != rhs_type || !IsPromotedScalar(ctx, lhs_type)) {
+        return nullptr;
+      }
+      type = ctx.IntTy;
+      break;
+    case clang::BO_Mul:
+    case clang::BO_Div:
+    case clang::BO_Rem:
+    case clang::BO_Add:
+    case clang::BO_Sub:
+    case clang::BO_And:
+    case clang::BO_Xor:
+    case clang::BO_Or:
+      // No usual arithmetic conversion is needed
+      if (lhs_type != rhs_type || !IsPromotedInteger(ctx, lhs_type)) {
+        return nullptr;
+      }
+      type = lhs_type;
+      break;
+    default:
+      return nullptr;
+  }
+  return clang::BinaryOperator::Create(
+      ctx, ToRValue(ctx, lhs), ToRValue(ctx, rhs), opc, type,
+      clang::VK_PRValue, clang::OK_Ordinary, clang::SourceLocation(),
+      clang::FPOptionsOverride());
+}
+
 }  // namespace
 
-ASTBuilder::ASTBuilder(clang::ASTUnit &unit)
-    : unit(unit), ctx(unit.getASTContext()), sema(unit.getSema()) {}
+ASTBuilder::ASTBuilder(clang::ASTUnit &unit, bool validate)
+    : unit(unit),
+      ctx(unit.getASTContext()),
+      sema(unit.getSema()),
+      validate(validate) {}
 
 clang::QualType ASTBuilder::GetLeastIntTypeForBitWidth(unsigned size,
                                                        unsigned sign) {
@@ -134,6 +418,7 @@ clang::QualType ASTBuilder::GetLeastRealTypeForBitWidth(unsigned size) {
 }
 
 clang::IntegerLiteral *ASTBuilder::CreateIntLit(llvm::APSInt val) {
+  ++num_nodes;
   auto sign{val.isSigned()};
   auto value_size{val.getBitWidth()};
   // Infer integer type wide enough to accommodate the value,
@@ -155,7 +440,7 @@ clang::IntegerLiteral *ASTBuilder::CreateIntLit(llvm::APSInt val) {
   // Clang does this check in the `clang::IntegerLiteral::Create`, but
   // we've had the calls with mismatched bit widths succeed before so
   // just in case we have ours here too.
-  CHECK_EQ(val.getBitWidth(), ctx.getIntWidth(type));
+  CHECK_THROW(val.getBitWidth() == ctx.getIntWidth(type));
   return clang::IntegerLiteral::Create(ctx, val, type, clang::SourceLocation());
 }
 
@@ -174,19 +459,22 @@ clang::Expr *ASTBuilder::CreateAdjustedIntLit(llvm::APSInt val) {
 }
 
 clang::CharacterLiteral *ASTBuilder::CreateCharLit(llvm::APInt val) {
-  CHECK(val.getBitWidth() == 8U);
+  ++num_nodes;
+  CHECK_THROW(val.getBitWidth() == 8U);
   return new (ctx) clang::CharacterLiteral(
       val.getLimitedValue(), clang::CharacterLiteral::CharacterKind::Ascii,
       ctx.IntTy, clang::SourceLocation());
 }
 
 clang::CharacterLiteral *ASTBuilder::CreateCharLit(unsigned val) {
+  ++num_nodes;
   return new (ctx) clang::CharacterLiteral(
       val, clang::CharacterLiteral::CharacterKind::Ascii, ctx.IntTy,
       clang::SourceLocation());
 }
 
 clang::StringLiteral *ASTBuilder::CreateStrLit(std::string val) {
+  ++num_nodes;
   auto type{ctx.getStringLiteralArrayType(ctx.CharTy, val.size())};
   return clang::StringLiteral::Create(
       ctx, val, clang::StringLiteral::StringKind::Ordinary,
@@ -209,6 +497,7 @@ clang::Expr *ASTBuilder::CreateFPLit(llvm::APFloat val) {
       return inf;
     }
   }
+  ++num_nodes;
   return clang::FloatingLiteral::Create(ctx, val, /*isexact=*/true, type,
                                         clang::SourceLocation());
 }
@@ -244,6 +533,7 @@ clang::VarDecl *ASTBuilder::CreateVarDecl(clang::DeclContext *decl_ctx,
                                           clang::QualType type,
                                           clang::IdentifierInfo *id,
                                           clang::StorageClass storage_class) {
+  ++num_nodes;
   return clang::VarDecl::Create(
       ctx, decl_ctx, clang::SourceLocation(), clang::SourceLocation(), id, type,
       ctx.getTrivialTypeSourceInfo(type), storage_class);
@@ -252,6 +542,7 @@ clang::VarDecl *ASTBuilder::CreateVarDecl(clang::DeclContext *decl_ctx,
 clang::FunctionDecl *ASTBuilder::CreateFunctionDecl(
     clang::DeclContext *decl_ctx, clang::QualType type,
     clang::IdentifierInfo *id) {
+  ++num_nodes;
   return clang::FunctionDecl::Create(
       ctx, decl_ctx, clang::SourceLocation(), clang::SourceLocation(),
       clang::DeclarationName(id), type, ctx.getTrivialTypeSourceInfo(type),
@@ -261,6 +552,7 @@ clang::FunctionDecl *ASTBuilder::CreateFunctionDecl(
 clang::ParmVarDecl *ASTBuilder::CreateParamDecl(clang::DeclContext *decl_ctx,
                                                 clang::QualType type,
                                                 clang::IdentifierInfo *id) {
+  ++num_nodes;
   return sema.CheckParameter(
       decl_ctx, clang::SourceLocation(), clang::SourceLocation(), id, type,
       ctx.getTrivialTypeSourceInfo(type), clang::SC_None);
@@ -269,6 +561,7 @@ clang::ParmVarDecl *ASTBuilder::CreateParamDecl(clang::DeclContext *decl_ctx,
 clang::RecordDecl *ASTBuilder::CreateStructDecl(clang::DeclContext *decl_ctx,
                                                 clang::IdentifierInfo *id,
                                                 clang::RecordDecl *prev_decl) {
+  ++num_nodes;
   return clang::RecordDecl::Create(ctx, clang::TagTypeKind::TTK_Struct,
                                    decl_ctx, clang::SourceLocation(),
                                    clang::SourceLocation(), id, prev_decl);
@@ -277,6 +570,7 @@ clang::RecordDecl *ASTBuilder::CreateStructDecl(clang::DeclContext *decl_ctx,
 clang::RecordDecl *ASTBuilder::CreateUnionDecl(clang::DeclContext *decl_ctx,
                                                clang::IdentifierInfo *id,
                                                clang::RecordDecl *prev_decl) {
+  ++num_nodes;
   return clang::RecordDecl::Create(ctx, clang::TagTypeKind::TTK_Union, decl_ctx,
                                    clang::SourceLocation(),
                                    clang::SourceLocation(), id, prev_decl);
@@ -285,6 +579,7 @@ clang::RecordDecl *ASTBuilder::CreateUnionDecl(clang::DeclContext *decl_ctx,
 clang::EnumDecl *ASTBuilder::CreateEnumDecl(clang::DeclContext *decl_ctx,
                                             clang::IdentifierInfo *id,
                                             clang::EnumDecl *prev_decl) {
+  ++num_nodes;
   return clang::EnumDecl::Create(ctx, decl_ctx, clang::SourceLocation(),
                                  clang::SourceLocation(), id, prev_decl, false,
                                  false, false);
@@ -293,6 +588,7 @@ clang::EnumDecl *ASTBuilder::CreateEnumDecl(clang::DeclContext *decl_ctx,
 clang::FieldDecl *ASTBuilder::CreateFieldDecl(clang::RecordDecl *record,
                                               clang::QualType type,
                                               clang::IdentifierInfo *id) {
+  ++num_nodes;
   return sema.CheckFieldDecl(
       clang::DeclarationName(id), type, ctx.getTrivialTypeSourceInfo(type),
       record, clang::SourceLocation(), /*Mutable=*/false, /*BitWidth=*/nullptr,
@@ -305,6 +601,7 @@ clang::FieldDecl *ASTBuilder::CreateFieldDecl(clang::RecordDecl *record,
                                               clang::QualType type,
                                               clang::IdentifierInfo *id,
                                               unsigned bitwidth) {
+  ++num_nodes;
   auto bw{clang::IntegerLiteral::Create(ctx, llvm::APInt(32, bitwidth),
                                         ctx.IntTy, clang::SourceLocation())};
   return sema.CheckFieldDecl(clang::DeclarationName(id), type,
@@ -318,114 +615,148 @@ clang::FieldDecl *ASTBuilder::CreateFieldDecl(clang::RecordDecl *record,
 clang::EnumConstantDecl *ASTBuilder::CreateEnumConstantDecl(
     clang::EnumDecl *e, clang::IdentifierInfo *id, clang::Expr *expr,
     clang::EnumConstantDecl *previousConstant) {
+  ++num_nodes;
   return sema.CheckEnumConstant(e, previousConstant, clang::SourceLocation(),
                                 id, expr);
 }
 
 clang::DeclStmt *ASTBuilder::CreateDeclStmt(clang::Decl *decl) {
+  ++num_nodes;
   return new (ctx)
       clang::DeclStmt(clang::DeclGroupRef(decl), clang::SourceLocation(),
                       clang::SourceLocation());
 }
 
 clang::DeclRefExpr *ASTBuilder::CreateDeclRef(clang::ValueDecl *val) {
-  CHECK(val) << "Should not be null in CreateDeclRef.";
+  ++num_nodes;
+  CHECK_THROW(val) << "Should not be null in CreateDeclRef.";
+  // References to variables are lvalues of their type, and mark them as used
+  auto var{clang::dyn_cast<clang::VarDecl>(val)};
+  if (!validate && var && !var->getType()->isVoidType()) {
+    var->setReferenced();
+    var->markUsed(ctx);
+    return clang::DeclRefExpr::Create(
+        ctx, clang::NestedNameSpecifierLoc(), clang::SourceLocation(), var,
+        /*RefersToEnclosingVariableOrCapture=*/false, clang::SourceLocation(),
+        var->getType().getNonReferenceType(), clang::VK_LValue);
+  }
   clang::DeclarationNameInfo dni(val->getDeclName(), clang::SourceLocation());
   clang::CXXScopeSpec ss;
   auto er{sema.BuildDeclarationNameExpr(ss, dni, val)};
-  CHECK(er.isUsable());
+  CHECK_THROW(er.isUsable());
   return er.getAs<clang::DeclRefExpr>();
 }
 
 clang::ParenExpr *ASTBuilder::CreateParen(clang::Expr *expr) {
+  ++num_nodes;
   return new (ctx)
       clang::ParenExpr(clang::SourceLocation(), clang::SourceLocation(), expr);
 }
 
 clang::CStyleCastExpr *ASTBuilder::CreateCStyleCast(clang::QualType type,
                                                     clang::Expr *expr) {
-  CHECK(expr) << "Should not be null in CreateCStyleCast.";
+  ++num_nodes;
+  CHECK_THROW(expr) << "Should not be null in CreateCStyleCast.";
   if (CExprPrecedence::UnaryOp < GetOperatorPrecedence(expr)) {
     expr = CreateParen(expr);
   }
+  if (!validate) {
+    if (auto cast = TryCreateCStyleCast(ctx, type, expr)) {
+      return cast;
+    }
+  }
   auto er{sema.BuildCStyleCastExpr(clang::SourceLocation(),
                                    ctx.getTrivialTypeSourceInfo(type),
                                    clang::SourceLocation(), expr)};
-  CHECK(er.isUsable());
+  CHECK_THROW(er.isUsable());
   return er.getAs<clang::CStyleCastExpr>();
 }
 
 clang::UnaryOperator *ASTBuilder::CreateUnaryOp(clang::UnaryOperatorKind opc,
                                                 clang::Expr *expr) {
-  CHECK(expr) << "Should not be null in CreateUnaryOp.";
+  ++num_nodes;
+  CHECK_THROW(expr) << "Should not be null in CreateUnaryOp.";
   if (GetOperatorPrecedence(opc) < GetOperatorPrecedence(expr)) {
     expr = CreateParen(expr);
   }
+  if (!validate) {
+    if (auto op = TryCreateUnaryOp(ctx, opc, expr)) {
+      return op;
+    }
+  }
   auto er{sema.CreateBuiltinUnaryOp(clang::SourceLocation(), opc, expr)};
-  CHECK(er.isUsable());
+  CHECK_THROW(er.isUsable());
   return er.getAs<clang::UnaryOperator>();
 }
 
 clang::BinaryOperator *ASTBuilder::CreateBinaryOp(clang::BinaryOperatorKind opc,
                                                   clang::Expr *lhs,
                                                   clang::Expr *rhs) {
-  CHECK(lhs && rhs) << "Should not be null in CreateBinaryOp.";
+  ++num_nodes;
+  CHECK_THROW(lhs && rhs) << "Should not be null in CreateBinaryOp.";
   if (GetOperatorPrecedence(opc) < GetOperatorPrecedence(lhs)) {
     lhs = CreateParen(lhs);
   }
   if (GetOperatorPrecedence(opc) < GetOperatorPrecedence(rhs)) {
     rhs = CreateParen(rhs);
   }
+  if (!validate) {
+    if (auto op = TryCreateBinaryOp(ctx, opc, lhs, rhs)) {
+      return op;
+    }
+  }
   auto er{sema.CreateBuiltinBinOp(clang::SourceLocation(), opc, lhs, rhs)};
-  CHECK(er.isUsable());
+  CHECK_THROW(er.isUsable());
   return er.getAs<clang::BinaryOperator>();
 }
 
 clang::ConditionalOperator *ASTBuilder::CreateConditional(clang::Expr *cond,
                                                           clang::Expr *lhs,
                                                           clang::Expr *rhs) {
+  ++num_nodes;
   auto er{sema.ActOnConditionalOp(clang::SourceLocation(),
                                   clang::SourceLocation(), cond, lhs, rhs)};
-  CHECK(er.isUsable());
+  CHECK_THROW(er.isUsable());
   return er.getAs<clang::ConditionalOperator>();
 }
 
 clang::ArraySubscriptExpr *ASTBuilder::CreateArraySub(clang::Expr *base,
                                                       clang::Expr *idx) {
-  CHECK(base && idx) << "Should not be null in CreateArraySub.";
+  ++num_nodes;
+  CHECK_THROW(base && idx) << "Should not be null in CreateArraySub.";
   if (CExprPrecedence::SpecialOp < GetOperatorPrecedence(base)) {
     base = CreateParen(base);
   }
   auto er{sema.CreateBuiltinArraySubscriptExpr(base, clang::SourceLocation(),
                                                idx, clang::SourceLocation())};
-  CHECK(er.isUsable());
+  CHECK_THROW(er.isUsable());
   return er.getAs<clang::ArraySubscriptExpr>();
 }
 
 clang::CallExpr *ASTBuilder::CreateCall(clang::Expr *callee,
                                         std::vector<clang::Expr *> &args) {
-  CHECK(callee) << "Should not be null in CreateCall.";
+  ++num_nodes;
+  CHECK_THROW(callee) << "Should not be null in CreateCall.";
   if (CExprPrecedence::SpecialOp < GetOperatorPrecedence(callee)) {
     callee = CreateParen(callee);
   }
   auto er{sema.BuildCallExpr(/*Scope=*/nullptr, callee, clang::SourceLocation(),
                              args, clang::SourceLocation())};
-  CHECK(er.isUsable());
+  CHECK_THROW(er.isUsable());
   return er.getAs<clang::CallExpr>();
 }
 
 clang::Expr *ASTBuilder::CreateBuiltinCall(clang::Builtin::ID builtin,
                                            std::vector<clang::Expr *> &args) {
-  auto name{ctx.BuiltinInfo.getName(builtin)};
-  clang::SourceLocation loc;
-  clang::LookupResult R(sema, &ctx.Idents.get(name), loc,
-                        clang::Sema::LookupOrdinaryName);
-  clang::Sema::LookupNameKind NameKind = R.getLookupKind();
-  auto II{R.getLookupName().getAsIdentifierInfo()};
-  clang::ASTContext::GetBuiltinTypeError error;
-  auto ty{ctx.GetBuiltinType(builtin, error)};
-  CHECK(!error);
-  auto decl{sema.CreateBuiltin(II, ty, builtin, loc)};
+  auto &decl{builtin_decls[builtin]};
+  if (!decl) {
+    auto name{ctx.BuiltinInfo.getName(builtin)};
+    clang::SourceLocation loc;
+    clang::ASTContext::GetBuiltinTypeError error;
+    auto ty{ctx.GetBuiltinType(builtin, error)};
+    CHECK_THROW(!error);
+    decl = sema.CreateBuiltin(&ctx.Idents.get(name), ty, builtin, loc);
+  }
 
   return CreateCall(decl, args);
 }
@@ -433,28 +764,58 @@ clang::Expr *ASTBuilder::CreateBuiltinCall(clang::Builtin::ID builtin,
 clang::MemberExpr *ASTBuilder::CreateFieldAcc(clang::Expr *base,
                                               clang::FieldDecl *field,
                                               bool is_arrow) {
-  CHECK(base && field) << "Should not be null in CreateFieldAcc.";
-  CHECK(!is_arrow || base->getType()->isPointerType())
+  ++num_nodes;
+  CHECK_THROW(base && field) << "Should not be null in CreateFieldAcc.";
+  CHECK_THROW(!is_arrow || base->getType()->isPointerType())
       << "Base operand in arrow operator must be a pointer!";
-  clang::CXXScopeSpec ss;
   auto dap{clang::DeclAccessPair::make(field, field->getAccess())};
+  if (!validate) {
+    // Same as `Sema::BuildFieldReferenceExpr`, which leaves the base alone
+    auto base_type{base->getType()};
+    if (is_arrow) {
+      base_type = base_type->getPointeeType();
+    }
+    auto type{field->getType()};
+    auto quals{base_type.getQualifiers() +
+               ctx.getCanonicalType(type).getQualifiers()};
+    if (quals != ctx.getCanonicalType(type).getQualifiers()) {
+      type = ctx.getQualifiedType(type, quals);
+    }
+    auto vk{clang::VK_LValue};
+    if (!is_arrow) {
+      vk = base->getObjectKind() == clang::OK_Ordinary ? base->getValueKind()
+                                                       : clang::VK_PRValue;
+    }
+    auto ok{vk != clang::VK_PRValue && field->isBitField()
+                ? clang::OK_BitField
+                : clang::OK_Ordinary};
+    field->setReferenced();
+    return clang::MemberExpr::Create(
+        ctx, base, is_arrow, clang::SourceLocation(),
+        clang::NestedNameSpecifierLoc(), clang::SourceLocation(), field, dap,
+        clang::DeclarationNameInfo(), /*TemplateArgs=*/nullptr, type, vk, ok,
+        clang::NOUR_None);
+  }
+  clang::CXXScopeSpec ss;
   auto er{sema.BuildFieldReferenceExpr(base, is_arrow, clang::SourceLocation(),
                                        ss, field, dap,
                                        clang::DeclarationNameInfo())};
-  CHECK(er.isUsable());
+  CHECK_THROW(er.isUsable());
   return er.getAs<clang::MemberExpr>();
 }
 
 clang::InitListExpr *ASTBuilder::CreateInitList(
     std::vector<clang::Expr *> &exprs) {
+  ++num_nodes;
   auto er{sema.ActOnInitList(clang::SourceLocation(), exprs,
                              clang::SourceLocation())};
-  CHECK(er.isUsable());
+  CHECK_THROW(er.isUsable());
   return er.getAs<clang::InitListExpr>();
 }
 
 clang::CompoundStmt *ASTBuilder::CreateCompoundStmt(
-    std::vector<clang::Stmt *> &stmts) {
+    llvm::ArrayRef<clang::Stmt *> stmts) {
+  ++num_nodes;
   // sema.ActOnStartOfCompoundStmt(/*isStmtExpr=*/false);
   // auto sr{sema.ActOnCompoundStmt(clang::SourceLocation(),
   //                                clang::SourceLocation(), stmts,
@@ -469,19 +830,21 @@ clang::CompoundStmt *ASTBuilder::CreateCompoundStmt(
 
 clang::CompoundLiteralExpr *ASTBuilder::CreateCompoundLit(clang::QualType type,
                                                           clang::Expr *expr) {
+  ++num_nodes;
   auto er{sema.BuildCompoundLiteralExpr(clang::SourceLocation(),
                                         ctx.getTrivialTypeSourceInfo(type),
                                         clang::SourceLocation(), expr)};
-  CHECK(er.isUsable());
+  CHECK_THROW(er.isUsable());
   return er.getAs<clang::CompoundLiteralExpr>();
 }
 
 clang::IfStmt *ASTBuilder::CreateIf(clang::Expr *cond, clang::Stmt *then_val,
                                     clang::Stmt *else_val) {
-  CHECK(cond && then_val) << "Should not be null in CreateIf.";
+  ++num_nodes;
+  CHECK_THROW(cond && then_val) << "Should not be null in CreateIf.";
   auto cr{sema.ActOnCondition(/*Scope=*/nullptr, clang::SourceLocation(), cond,
                               clang::Sema::ConditionKind::Boolean)};
-  CHECK(!cr.isInvalid());
+  CHECK_THROW(!cr.isInvalid());
   auto if_stmt{clang::IfStmt::CreateEmpty(ctx, true, false, false)};
   if_stmt->setCond(cr.get().second);
   if_stmt->setThen(then_val);
@@ -492,42 +855,51 @@ clang::IfStmt *ASTBuilder::CreateIf(clang::Expr *cond, clang::Stmt *then_val,
 
 clang::WhileStmt *ASTBuilder::CreateWhile(clang::Expr *cond,
                                           clang::Stmt *body) {
+  ++num_nodes;
   // auto sr{sema.ActOnWhileStmt(clang::SourceLocation(),
   // clang::SourceLocation(),
   //                             cond, clang::SourceLocation(), body)};
   // CHECK(sr.isUsable());
   // return sr.getAs<clang::WhileStmt>();
-  CHECK(cond != nullptr) << "Should not be null in CreateWhile.";
+  CHECK_THROW(cond != nullptr) << "Should not be null in CreateWhile.";
   auto cer{sema.CheckBooleanCondition(clang::SourceLocation(), cond)};
-  CHECK(!cer.isInvalid());
+  CHECK_THROW(!cer.isInvalid());
   return clang::WhileStmt::Create(
       ctx, nullptr, cond, body, clang::SourceLocation(),
       clang::SourceLocation(), clang::SourceLocation());
 }
 
 clang::DoStmt *ASTBuilder::CreateDo(clang::Expr *cond, clang::Stmt *body) {
+  ++num_nodes;
   // auto sr{sema.ActOnDoStmt(clang::SourceLocation(), body,
   //                          clang::SourceLocation(),
   //                          clang::SourceLocation(), cond,
   //                          clang::SourceLocation())};
   // CHECK(sr.isUsable());
   // return sr.getAs<clang::DoStmt>();
-  CHECK(cond != nullptr) << "Should not be null in CreateDo.";
+  CHECK_THROW(cond != nullptr) << "Should not be null in CreateDo.";
   auto cer{sema.CheckBooleanCondition(clang::SourceLocation(), cond)};
-  CHECK(!cer.isInvalid());
+  CHECK_THROW(!cer.isInvalid());
   cer = sema.ActOnFinishFullExpr(cer.get(), clang::SourceLocation(),
                                  /*DiscardedValue=*/false);
-  CHECK(!cer.isInvalid());
+  CHECK_THROW(!cer.isInvalid());
   return new (ctx)
       clang::DoStmt(body, cond, clang::SourceLocation(),
                     clang::SourceLocation(), clang::SourceLocation());
 }
 
 clang::BreakStmt *ASTBuilder::CreateBreak() {
+  ++num_nodes;
   return new (ctx) clang::BreakStmt(clang::SourceLocation());
 }
 
+clang::ContinueStmt *ASTBuilder::CreateContinue() {
+  ++num_nodes;
+  return new (ctx) clang::ContinueStmt(clang::SourceLocation());
+}
+
 clang::ReturnStmt *ASTBuilder::CreateReturn(clang::Expr *retval) {
+  ++num_nodes;
   // auto sr{sema.BuildReturnStmt(clang::SourceLocation(), retval)};
   // CHECK(sr.isUsable());
   // return sr.getAs<clang::ReturnStmt>();
@@ -538,32 +910,61 @@ clang::ReturnStmt *ASTBuilder::CreateReturn(clang::Expr *retval) {
 clang::TypedefDecl *ASTBuilder::CreateTypedefDecl(clang::DeclContext *decl_ctx,
                                                   clang::IdentifierInfo *id,
                                                   clang::QualType type) {
+  ++num_nodes;
   return clang::TypedefDecl::Create(ctx, decl_ctx, clang::SourceLocation(),
                                     clang::SourceLocation(), id,
                                     ctx.getTrivialTypeSourceInfo(type));
 }
 
 clang::NullStmt *ASTBuilder::CreateNullStmt() {
+  ++num_nodes;
   return new (ctx) clang::NullStmt(clang::SourceLocation());
 }
 
 clang::SwitchStmt *ASTBuilder::CreateSwitchStmt(clang::Expr *cond) {
+  ++num_nodes;
   auto cc{sema.CheckSwitchCondition(clang::SourceLocation(), cond)};
-  CHECK(!cc.isInvalid());
+  CHECK_THROW(!cc.isInvalid());
   return clang::SwitchStmt::Create(ctx, nullptr, nullptr, cc.get(),
                                    clang::SourceLocation(),
                                    clang::SourceLocation());
 }
 
 clang::CaseStmt *ASTBuilder::CreateCaseStmt(clang::Expr *cond) {
+  ++num_nodes;
   return clang::CaseStmt::Create(ctx, cond, nullptr, clang::SourceLocation(),
                                  clang::SourceLocation(),
                                  clang::SourceLocation());
 }
 
 clang::DefaultStmt *ASTBuilder::CreateDefaultStmt(clang::Stmt *body) {
+  ++num_nodes;
   return new (ctx) clang::DefaultStmt(clang::SourceLocation(),
                                       clang::SourceLocation(), body);
 }
 
+clang::LabelDecl *ASTBuilder::CreateLabelDecl(clang::DeclContext *decl_ctx,
+                                              clang::IdentifierInfo *id) {
+  ++num_nodes;
+  return clang::LabelDecl::Create(ctx, decl_ctx, clang::SourceLocation(), id);
+}
+
+clang::LabelStmt *ASTBuilder::CreateLabelStmt(clang::LabelDecl *label,
+                                              clang::Stmt *sub_stmt) {
+  ++num_nodes;
+  CHECK_THROW(label != nullptr) << "Should not be null in CreateLabelStmt.";
+  CHECK_THROW(sub_stmt != nullptr) << "Should not be null in CreateLabelStmt.";
+  auto stmt{new (ctx)
+                clang::LabelStmt(clang::SourceLocation(), label, sub_stmt)};
+  label->setStmt(stmt);
+  return stmt;
+}
+
+clang::GotoStmt *ASTBuilder::CreateGoto(clang::LabelDecl *label) {
+  ++num_nodes;
+  CHECK_THROW(label != nullptr) << "Should not be null in CreateGoto.";
+  return new (ctx) clang::GotoStmt(label, clang::SourceLocation(),
+                                   clang::SourceLocation());
+}
+
 }  // namespace rellic
@@ -0,0 +1,1359 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/CPrinter.h"
+
+#include <clang/AST/Attr.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/Expr.h>
+#include <clang/AST/ExprCXX.h>
+#include <clang/AST/Stmt.h>
+#include <clang/AST/Type.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Module.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <thread>
+#include <vector>
+
+namespace rellic {
+
+// Stands for the declarator when splitting a type around it. Clang writes the
+// declarator verbatim, so it can be found in the printed type.
+static constexpr llvm::StringLiteral declarator_marker{"\x7f@rellic@\x7f"};
+
+CPrinter::CPrinter(llvm::raw_ostream& os, clang::ASTContext& ast_ctx,
+                   CPrinterOptions options)
+    : os(os),
+      ast_ctx(ast_ctx),
+      policy(ast_ctx.getPrintingPolicy()),
+      options(std::move(options)),
+      buffer_os(buffer) {}
+
+CPrinter::~CPrinter() { Flush(); }
+
+void CPrinter::Flush() {
+  if (options.on_stmt_range || options.on_decl_range) {
+    GetLocation();
+    flushed += buffer.size();
+    scanned = 0;
+  }
+  os.write(buffer.data(), buffer.size());
+  buffer.clear();
+}
+
+void CPrinter::MaybeFlush() {
+  if (buffer.size() >= options.buffer_size) {
+    Flush();
+  }
+}
+
+void CPrinter::Indent(int delta) {
+  auto num_levels{level + delta};
+  if (num_levels > 0) {
+    buffer.append(num_levels * 2, ' ');
+  }
+}
+
+CPrinterLocation CPrinter::GetLocation(size_t index) {
+  llvm::StringRef text{buffer.data() + scanned, index - scanned};
+  auto newlines{text.count('\n')};
+  if (newlines) {
+    output_line += newlines;
+    line_start = flushed + scanned + text.rfind('\n') + 1;
+  }
+  scanned = index;
+  auto offset{flushed + index};
+  return {offset, output_line, static_cast<unsigned>(offset - line_start + 1)};
+}
+
+CPrinterLocation CPrinter::GetEndLocation() {
+  auto end{buffer.size()};
+  while (end > scanned && buffer[end - 1] == '\n') {
+    --end;
+  }
+  return GetLocation(end);
+}
+
+CPrinterLocation CPrinter::GetIndentedLocation(int columns) {
+  auto loc{GetLocation()};
+  if (columns > 0) {
+    loc.offset += columns;
+    loc.column += columns;
+  }
+  return loc;
+}
+
+void CPrinter::PrintTranslationUnit() {
+  level = 0;
+  VisitDecl(ast_ctx.getTranslationUnitDecl());
+}
+
+void CPrinter::PrintTopLevelDecls(clang::DeclContext::decl_iterator begin,
+                                  clang::DeclContext::decl_iterator end) {
+  level = 0;
+  if (!policy.TerseOutput) {
+    PrintDecls(begin, end);
+  }
+}
+
+void CPrinter::PrintDecl(clang::Decl* decl, unsigned indentation) {
+  level = indentation;
+  VisitDecl(decl);
+}
+
+void CPrinter::PrintExternalDecl(clang::DeclaratorDecl* decl) {
+  level = 0;
+  auto saved{policy};
+  policy.TerseOutput = true;
+  policy.SuppressInitializers = true;
+  auto var{clang::dyn_cast<clang::VarDecl>(decl)};
+  if (var && var->getStorageClass() == clang::SC_None) {
+    Write("extern ");
+  }
+  VisitDecl(decl);
+  Write(";\n");
+  policy = saved;
+}
+
+void CPrinter::PrintStmt(clang::Stmt* stmt, unsigned indentation) {
+  level = indentation;
+  if (auto expr = clang::dyn_cast<clang::Expr>(stmt)) {
+    PrintExpr(expr);
+  } else {
+    VisitStmt(stmt);
+  }
+}
+
+//
+// Types
+//
+
+const CPrinter::TypeStrings& CPrinter::GetTypeStrings(clang::QualType type) {
+  auto [it, inserted]{type_strings.try_emplace(type.getAsOpaquePtr())};
+  auto& strings{it->second};
+  if (inserted) {
+    llvm::raw_string_ostream unnamed(strings.unnamed);
+    type.print(unnamed, policy);
+    unnamed.flush();
+
+    std::string named;
+    llvm::raw_string_ostream named_os(named);
+    type.print(named_os, policy, declarator_marker);
+    named_os.flush();
+    auto pos{named.find(declarator_marker.data())};
+    strings.splittable =
+        pos != std::string::npos &&
+        named.find(declarator_marker.data(), pos + 1) == std::string::npos;
+    if (strings.splittable) {
+      strings.prefix = named.substr(0, pos);
+      strings.suffix = named.substr(pos + declarator_marker.size());
+    }
+  }
+  return strings;
+}
+
+void CPrinter::PrintType(clang::QualType type) {
+  Write(GetTypeStrings(type).unnamed);
+}
+
+void CPrinter::PrintType(clang::QualType type, llvm::StringRef declarator) {
+  auto& strings{GetTypeStrings(type)};
+  if (declarator.empty()) {
+    Write(strings.unnamed);
+  } else if (strings.splittable) {
+    Write(strings.prefix);
+    Write(declarator);
+    Write(strings.suffix);
+  } else {
+    type.print(buffer_os, policy, declarator);
+  }
+}
+
+//
+// Annotations
+//
+
+void CPrinter::PrintLineDirective(llvm::StringRef file, unsigned line_number) {
+  if (!line_number || (line_number == line && file == line_file)) {
+    return;
+  }
+  line = line_number;
+  line_file = file.str();
+
+  char digits[16];
+  auto res{std::to_chars(digits, digits + sizeof(digits), line_number)};
+  Write("#line ");
+  Write(llvm::StringRef(digits, res.ptr - digits));
+  Write(" \"");
+  for (auto c : file) {
+    if (c == '\\' || c == '"') {
+      Write('\\');
+    }
+    Write(c);
+  }
+  Write("\"\n");
+}
+
+// Prints the annotations of a statement generated from `value`
+void CPrinter::PrintAnnotations(const llvm::Value* value) {
+  if (!value) {
+    return;
+  }
+
+  auto inst{llvm::dyn_cast<llvm::Instruction>(value)};
+  if (options.line_directives && inst) {
+    if (auto& loc{inst->getDebugLoc()}) {
+      PrintLineDirective(loc->getFilename(), loc.getLine());
+    }
+  }
+
+  if (!options.provenance_comments) {
+    return;
+  }
+
+  // Unnamed values are numbered by a slot tracker, which numbers each
+  // function once rather than every time one of its values is printed
+  const llvm::Function* func{nullptr};
+  if (inst) {
+    func = inst->getFunction();
+  } else if (auto arg = llvm::dyn_cast<llvm::Argument>(value)) {
+    func = arg->getParent();
+  }
+  std::string operand;
+  llvm::raw_string_ostream operand_os(operand);
+  if (func) {
+    auto module{func->getParent()};
+    if (module != slots_module) {
+      slots = std::make_unique<llvm::ModuleSlotTracker>(
+          module, /*ShouldInitializeAllMetadata=*/false);
+      slots_module = module;
+      slots_function = nullptr;
+    }
+    if (func != slots_function) {
+      slots->incorporateFunction(*func);
+      slots_function = func;
+    }
+    value->printAsOperand(operand_os, /*PrintType=*/false, *slots);
+  } else {
+    value->printAsOperand(operand_os, /*PrintType=*/false);
+  }
+  if (inst) {
+    operand_os << " = " << inst->getOpcodeName();
+  }
+  operand_os.flush();
+
+  Indent();
+  Write("/* ");
+  llvm::StringRef text{operand};
+  // Quoted IR names may contain the end of a comment
+  for (auto end{text.find("*/")}; end != llvm::StringRef::npos;
+       end = text.find("*/")) {
+    Write(text.take_front(end + 1));
+    Write(' ');
+    text = text.drop_front(end + 1);
+  }
+  Write(text);
+  Write(" */\n");
+}
+
+void CPrinter::PrintDeclAnnotations(clang::Decl* decl) {
+  if (!options.line_directives || !options.decl_provenance) {
+    return;
+  }
+  auto func{llvm::dyn_cast_or_null<llvm::Function>(
+      options.decl_provenance(decl))};
+  if (!func) {
+    return;
+  }
+  if (auto subprogram = func->getSubprogram()) {
+    PrintLineDirective(subprogram->getFilename(), subprogram->getLine());
+  }
+}
+
+//
+// Declarations
+//
+
+static clang::QualType GetBaseType(clang::QualType type) {
+  auto base{type};
+  while (!base->isSpecifierType()) {
+    if (auto ptr = base->getAs<clang::PointerType>()) {
+      base = ptr->getPointeeType();
+    } else if (auto block = base->getAs<clang::BlockPointerType>()) {
+      base = block->getPointeeType();
+    } else if (auto arr = clang::dyn_cast<clang::ArrayType>(base)) {
+      base = arr->getElementType();
+    } else if (auto func = base->getAs<clang::FunctionType>()) {
+      base = func->getReturnType();
+    } else if (auto vec = base->getAs<clang::VectorType>()) {
+      base = vec->getElementType();
+    } else if (auto ref = base->getAs<clang::ReferenceType>()) {
+      base = ref->getPointeeType();
+    } else if (auto autotype = base->getAs<clang::AutoType>()) {
+      base = autotype->getDeducedType();
+    } else if (auto paren = base->getAs<clang::ParenType>()) {
+      base = paren->desugar();
+    } else {
+      break;
+    }
+  }
+  return base;
+}
+
+static clang::QualType GetDeclType(clang::Decl* decl) {
+  if (auto tdef = clang::dyn_cast<clang::TypedefNameDecl>(decl)) {
+    return tdef->getUnderlyingType();
+  }
+  if (auto vdecl = clang::dyn_cast<clang::ValueDecl>(decl)) {
+    return vdecl->getType();
+  }
+  return clang::QualType();
+}
+
+void CPrinter::FallbackDecl(clang::Decl* decl) {
+  decl->print(buffer_os, policy, level);
+}
+
+void CPrinter::PrintDeclContext(clang::DeclContext* decl_ctx, bool indent) {
+  if (policy.TerseOutput) {
+    return;
+  }
+
+  if (indent) {
+    level += policy.Indentation;
+  }
+  PrintDecls(decl_ctx->decls_begin(), decl_ctx->decls_end());
+  if (indent) {
+    level -= policy.Indentation;
+  }
+}
+
+void CPrinter::PrintDecls(clang::DeclContext::decl_iterator begin,
+                          clang::DeclContext::decl_iterator end) {
+  // Tag declarations that are not free-standing are printed along with the
+  // declarations that use them, like Clang does
+  llvm::SmallVector<clang::Decl*, 2> group;
+  auto PrintGroup{[this, &group]() {
+    auto tracks{TracksDecls()};
+    CPrinterLocation begin{};
+    if (tracks) {
+      begin = GetIndentedLocation(level * 2);
+    }
+    Indent();
+    if (group.size() == 1) {
+      VisitDecl(group[0]);
+    } else {
+      clang::Decl::printGroup(group.data(), group.size(), buffer_os, policy,
+                              level);
+    }
+    Write(";\n");
+    if (tracks) {
+      auto end{GetEndLocation()};
+      for (auto decl : group) {
+        options.on_decl_range(decl, begin, end);
+      }
+    }
+    group.clear();
+  }};
+
+  for (auto it{begin}; it != end; ++it) {
+    auto decl{*it};
+    if (decl->isImplicit()) {
+      continue;
+    }
+
+    auto type{GetDeclType(decl)};
+    if (!group.empty() && !type.isNull()) {
+      auto base{GetBaseType(type)};
+      auto elaborated{
+          base.isNull() ? nullptr
+                        : clang::dyn_cast<clang::ElaboratedType>(base)};
+      if (elaborated && elaborated->getOwnedTagDecl() == group[0]) {
+        group.push_back(decl);
+        continue;
+      }
+    }
+
+    if (!group.empty()) {
+      PrintGroup();
+    }
+
+    auto tag{clang::dyn_cast<clang::TagDecl>(decl)};
+    if (tag && !tag->isFreeStanding()) {
+      group.push_back(decl);
+      continue;
+    }
+
+    MaybeFlush();
+    PrintDeclAnnotations(decl);
+    auto tracks{TracksDecls()};
+    CPrinterLocation begin{};
+    if (tracks) {
+      begin = GetIndentedLocation(level * 2);
+    }
+    Indent();
+    VisitDecl(decl);
+
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    if (fdecl) {
+      if (!fdecl->isThisDeclarationADefinition()) {
+        Write(';');
+      }
+    } else if (clang::isa<clang::EnumConstantDecl>(decl)) {
+      if (std::next(it) != end) {
+        Write(',');
+      }
+    } else {
+      Write(';');
+    }
+
+    // Bodies already end with a newline
+    if (!fdecl || !fdecl->doesThisDeclarationHaveABody()) {
+      Write('\n');
+    }
+    if (tracks) {
+      options.on_decl_range(decl, begin, GetEndLocation());
+    }
+  }
+
+  if (!group.empty()) {
+    PrintGroup();
+  }
+}
+
+void CPrinter::PrintAttributes(clang::Decl* decl) {
+  if (policy.PolishForDeclaration || !decl->hasAttrs()) {
+    return;
+  }
+
+  for (auto attr : decl->getAttrs()) {
+    if (attr->isInherited() || attr->isImplicit()) {
+      continue;
+    }
+    switch (attr->getKind()) {
+#define ATTR(X)
+#define PRAGMA_SPELLING_ATTR(X) case clang::attr::X:
+#include <clang/Basic/AttrList.inc>
+      break;
+      default:
+        attr->printPretty(buffer_os, policy);
+        break;
+    }
+  }
+}
+
+void CPrinter::VisitDecl(clang::Decl* decl) {
+  switch (decl->getKind()) {
+    case clang::Decl::TranslationUnit:
+      PrintDeclContext(clang::cast<clang::TranslationUnitDecl>(decl),
+                       /*indent=*/false);
+      break;
+    case clang::Decl::Function:
+      VisitFunctionDecl(clang::cast<clang::FunctionDecl>(decl));
+      break;
+    case clang::Decl::Var:
+    case clang::Decl::ParmVar:
+      VisitVarDecl(clang::cast<clang::VarDecl>(decl));
+      break;
+    case clang::Decl::Record:
+      VisitRecordDecl(clang::cast<clang::RecordDecl>(decl));
+      break;
+    case clang::Decl::Field:
+      VisitFieldDecl(clang::cast<clang::FieldDecl>(decl));
+      break;
+    case clang::Decl::Enum:
+      VisitEnumDecl(clang::cast<clang::EnumDecl>(decl));
+      break;
+    case clang::Decl::EnumConstant:
+      VisitEnumConstantDecl(clang::cast<clang::EnumConstantDecl>(decl));
+      break;
+    case clang::Decl::Typedef:
+      VisitTypedefDecl(clang::cast<clang::TypedefDecl>(decl));
+      break;
+    case clang::Decl::Label:
+      Write(clang::cast<clang::LabelDecl>(decl)->getName());
+      Write(':');
+      break;
+    default:
+      FallbackDecl(decl);
+      break;
+  }
+}
+
+// Whether `decl` only uses what can be written in C without attributes, which
+// is how rellic declares functions
+static bool IsPlainFunction(clang::FunctionDecl* decl,
+                            const clang::PrintingPolicy& policy) {
+  if (decl->hasAttrs() || decl->getDescribedFunctionTemplate() ||
+      decl->isFunctionTemplateSpecialization() ||
+      decl->getNumTemplateParameterLists() || decl->isModulePrivate() ||
+      decl->isConstexprSpecified() || decl->isConsteval() ||
+      decl->getQualifier() || policy.FullyQualifiedName ||
+      !decl->getDeclName().isIdentifier() || decl->isPure() ||
+      decl->isDeletedAsWritten() || decl->isExplicitlyDefaulted() ||
+      decl->getTrailingRequiresClause()) {
+    return false;
+  }
+  // K&R definitions list their parameters after the declarator
+  if (decl->doesThisDeclarationHaveABody() && !decl->hasPrototype() &&
+      decl->getNumParams()) {
+    return false;
+  }
+  if (auto proto = decl->getType()->getAs<clang::FunctionProtoType>()) {
+    if (proto->getMethodQuals().hasQualifiers() ||
+        proto->getRefQualifier() != clang::RQ_None ||
+        proto->hasExceptionSpec() || proto->hasTrailingReturn()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void CPrinter::VisitFunctionDecl(clang::FunctionDecl* decl) {
+  if (!IsPlainFunction(decl, policy)) {
+    FallbackDecl(decl);
+    return;
+  }
+
+  if (!policy.SuppressSpecifiers) {
+    switch (decl->getStorageClass()) {
+      case clang::SC_Extern:
+        Write("extern ");
+        break;
+      case clang::SC_Static:
+        Write("static ");
+        break;
+      case clang::SC_PrivateExtern:
+        Write("__private_extern__ ");
+        break;
+      default:
+        break;
+    }
+    if (decl->isInlineSpecified()) {
+      Write("inline ");
+    }
+  }
+
+  // The declarator is built on its own so that it can be placed inside of the
+  // return type, which may have to surround it
+  std::string saved;
+  std::swap(buffer, saved);
+  in_declarator = true;
+  auto type{decl->getType()};
+  unsigned num_parens{0};
+  while (auto paren = clang::dyn_cast<clang::ParenType>(type)) {
+    ++num_parens;
+    type = paren->getInnerType();
+  }
+  buffer.append(num_parens, '(');
+  Write(decl->getName());
+  buffer.append(num_parens, ')');
+
+  auto func_type{type->getAs<clang::FunctionType>()};
+  if (func_type) {
+    auto proto{decl->hasWrittenPrototype()
+                   ? clang::dyn_cast<clang::FunctionProtoType>(func_type)
+                   : nullptr};
+    Write('(');
+    if (proto) {
+      for (unsigned i{0}, e{decl->getNumParams()}; i != e; ++i) {
+        if (i) {
+          Write(", ");
+        }
+        VisitDecl(decl->getParamDecl(i));
+      }
+      if (proto->isVariadic()) {
+        if (decl->getNumParams()) {
+          Write(", ");
+        }
+        Write("...");
+      } else if (!decl->getNumParams() && !ast_ctx.getLangOpts().CPlusPlus) {
+        Write("void");
+      }
+    }
+    Write(')');
+  }
+  std::string declarator;
+  std::swap(buffer, declarator);
+  std::swap(buffer, saved);
+  in_declarator = false;
+
+  PrintType(func_type ? func_type->getReturnType() : type, declarator);
+
+  if (decl->doesThisDeclarationHaveABody() && !policy.TerseOutput) {
+    Write(' ');
+    if (auto body = decl->getBody()) {
+      VisitStmt(body);
+    }
+  }
+}
+
+void CPrinter::VisitVarDecl(clang::VarDecl* decl) {
+  auto init{decl->getInit()};
+  if (decl->hasAttrs() || decl->isModulePrivate() || decl->isConstexpr() ||
+      decl->isCXXForRangeDecl() ||
+      (init && decl->getInitStyle() != clang::VarDecl::CInit)) {
+    FallbackDecl(decl);
+    return;
+  }
+
+  auto tsi{decl->getTypeSourceInfo()};
+  auto type{tsi ? tsi->getType()
+                : ast_ctx.getUnqualifiedObjCPointerType(decl->getType())};
+
+  if (!policy.SuppressSpecifiers) {
+    auto storage{decl->getStorageClass()};
+    if (storage != clang::SC_None) {
+      Write(clang::VarDecl::getStorageClassSpecifierString(storage));
+      Write(' ');
+    }
+    switch (decl->getTSCSpec()) {
+      case clang::TSCS_unspecified:
+        break;
+      case clang::TSCS___thread:
+        Write("__thread ");
+        break;
+      case clang::TSCS__Thread_local:
+        Write("_Thread_local ");
+        break;
+      case clang::TSCS_thread_local:
+        Write("thread_local ");
+        break;
+    }
+  }
+
+  PrintType(type, decl->getName());
+  if (init && !policy.SuppressInitializers) {
+    Write(" = ");
+    PrintExpr(init);
+  }
+}
+
+void CPrinter::VisitRecordDecl(clang::RecordDecl* decl) {
+  if (!policy.SuppressSpecifiers && decl->isModulePrivate()) {
+    FallbackDecl(decl);
+    return;
+  }
+
+  Write(decl->getKindName());
+  PrintAttributes(decl);
+  if (auto id = decl->getIdentifier()) {
+    Write(' ');
+    Write(id->getName());
+  }
+  if (decl->isCompleteDefinition()) {
+    Write(" {\n");
+    PrintDeclContext(decl, /*indent=*/true);
+    Indent();
+    Write('}');
+  }
+}
+
+void CPrinter::VisitFieldDecl(clang::FieldDecl* decl) {
+  if (decl->isMutable() || decl->isModulePrivate() ||
+      decl->getInClassInitializer()) {
+    FallbackDecl(decl);
+    return;
+  }
+
+  PrintType(ast_ctx.getUnqualifiedObjCPointerType(decl->getType()),
+            decl->getName());
+  if (decl->isBitField()) {
+    Write(" : ");
+    PrintExpr(decl->getBitWidth());
+  }
+  PrintAttributes(decl);
+}
+
+void CPrinter::VisitEnumDecl(clang::EnumDecl* decl) {
+  if (decl->isScoped() ||
+      (!policy.SuppressSpecifiers && decl->isModulePrivate())) {
+    FallbackDecl(decl);
+    return;
+  }
+
+  Write("enum");
+  PrintAttributes(decl);
+  if (auto id = decl->getIdentifier()) {
+    Write(' ');
+    Write(id->getName());
+  }
+  if (decl->isFixed()) {
+    Write(" : ");
+    PrintType(decl->getIntegerType());
+  }
+  if (decl->isCompleteDefinition()) {
+    Write(" {\n");
+    PrintDeclContext(decl, /*indent=*/true);
+    Indent();
+    Write('}');
+  }
+}
+
+void CPrinter::VisitEnumConstantDecl(clang::EnumConstantDecl* decl) {
+  Write(decl->getName());
+  PrintAttributes(decl);
+  if (auto init = decl->getInitExpr()) {
+    Write(" = ");
+    PrintExpr(init);
+  }
+}
+
+void CPrinter::VisitTypedefDecl(clang::TypedefDecl* decl) {
+  if (decl->isModulePrivate()) {
+    FallbackDecl(decl);
+    return;
+  }
+
+  if (!policy.SuppressSpecifiers) {
+    Write("typedef ");
+  }
+  PrintType(decl->getTypeSourceInfo()->getType(), decl->getName());
+  PrintAttributes(decl);
+}
+
+//
+// Statements
+//
+
+void CPrinter::FallbackStmt(clang::Stmt* stmt) {
+  stmt->printPretty(buffer_os, nullptr, policy, level, "\n", &ast_ctx);
+}
+
+void CPrinter::PrintSubStmt(clang::Stmt* stmt, int sub_indent) {
+  level += sub_indent;
+  MaybeFlush();
+  if (stmt && options.stmt_provenance &&
+      (options.line_directives || options.provenance_comments)) {
+    PrintAnnotations(options.stmt_provenance(stmt));
+  }
+  if (auto expr = clang::dyn_cast_or_null<clang::Expr>(stmt)) {
+    Indent();
+    PrintExpr(expr);
+    Write(";\n");
+  } else if (stmt) {
+    if (!TracksStmts()) {
+      VisitStmt(stmt);
+    } else {
+      // Labels are printed one level to the left of the statements
+      auto label{clang::isa<clang::SwitchCase>(stmt) ||
+                 clang::isa<clang::LabelStmt>(stmt)};
+      auto begin{GetIndentedLocation((level - (label ? 1 : 0)) * 2)};
+      VisitStmt(stmt);
+      options.on_stmt_range(stmt, begin, GetEndLocation());
+    }
+  } else {
+    Indent();
+    Write("<<<NULL STATEMENT>>>\n");
+  }
+  level -= sub_indent;
+}
+
+void CPrinter::PrintRawCompoundStmt(clang::CompoundStmt* stmt) {
+  Write("{\n");
+  for (auto child : stmt->body()) {
+    PrintSubStmt(child);
+  }
+  Indent();
+  Write('}');
+}
+
+void CPrinter::PrintRawDeclStmt(clang::DeclStmt* stmt) {
+  if (stmt->isSingleDecl()) {
+    auto decl{stmt->getSingleDecl()};
+    if (!TracksDecls()) {
+      VisitDecl(decl);
+      return;
+    }
+    auto begin{GetLocation()};
+    VisitDecl(decl);
+    options.on_decl_range(decl, begin, GetLocation());
+    return;
+  }
+  llvm::SmallVector<clang::Decl*, 2> decls(stmt->decls());
+  clang::Decl::printGroup(decls.data(), decls.size(), buffer_os, policy,
+                          level);
+}
+
+// Whether `stmt` and the `else if` chain that follows it are written like C
+static bool IsPlainIf(clang::IfStmt* stmt) {
+  for (; stmt; stmt = clang::dyn_cast_or_null<clang::IfStmt>(stmt->getElse())) {
+    if (stmt->isConsteval() || stmt->getInit()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void CPrinter::PrintRawIfStmt(clang::IfStmt* stmt) {
+  Write("if (");
+  if (auto decl = stmt->getConditionVariableDeclStmt()) {
+    PrintRawDeclStmt(decl);
+  } else {
+    PrintExpr(stmt->getCond());
+  }
+  Write(')');
+
+  auto else_stmt{stmt->getElse()};
+  if (auto then = clang::dyn_cast<clang::CompoundStmt>(stmt->getThen())) {
+    Write(' ');
+    PrintRawCompoundStmt(then);
+    Write(else_stmt ? ' ' : '\n');
+  } else {
+    Write('\n');
+    PrintSubStmt(stmt->getThen());
+    if (else_stmt) {
+      Indent();
+    }
+  }
+
+  if (!else_stmt) {
+    return;
+  }
+  Write("else");
+  if (auto compound = clang::dyn_cast<clang::CompoundStmt>(else_stmt)) {
+    Write(' ');
+    PrintRawCompoundStmt(compound);
+    Write('\n');
+  } else if (auto else_if = clang::dyn_cast<clang::IfStmt>(else_stmt)) {
+    Write(' ');
+    PrintRawIfStmt(else_if);
+  } else {
+    Write('\n');
+    PrintSubStmt(else_stmt);
+  }
+}
+
+void CPrinter::PrintControlledStmt(clang::Stmt* stmt) {
+  if (auto compound = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
+    Write(' ');
+    PrintRawCompoundStmt(compound);
+    Write('\n');
+  } else {
+    Write('\n');
+    PrintSubStmt(stmt);
+  }
+}
+
+void CPrinter::VisitStmt(clang::Stmt* stmt) {
+  switch (stmt->getStmtClass()) {
+    case clang::Stmt::CompoundStmtClass: {
+      Indent();
+      PrintRawCompoundStmt(clang::cast<clang::CompoundStmt>(stmt));
+      Write('\n');
+    } break;
+    case clang::Stmt::IfStmtClass: {
+      auto if_stmt{clang::cast<clang::IfStmt>(stmt)};
+      if (!IsPlainIf(if_stmt)) {
+        FallbackStmt(stmt);
+        break;
+      }
+      Indent();
+      PrintRawIfStmt(if_stmt);
+    } break;
+    case clang::Stmt::WhileStmtClass: {
+      auto while_stmt{clang::cast<clang::WhileStmt>(stmt)};
+      Indent();
+      Write("while (");
+      if (auto decl = while_stmt->getConditionVariableDeclStmt()) {
+        PrintRawDeclStmt(decl);
+      } else {
+        PrintExpr(while_stmt->getCond());
+      }
+      Write(")\n");
+      PrintSubStmt(while_stmt->getBody());
+    } break;
+    case clang::Stmt::DoStmtClass: {
+      auto do_stmt{clang::cast<clang::DoStmt>(stmt)};
+      Indent();
+      Write("do ");
+      auto body{do_stmt->getBody()};
+      if (auto compound = clang::dyn_cast<clang::CompoundStmt>(body)) {
+        PrintRawCompoundStmt(compound);
+        Write(' ');
+      } else {
+        Write('\n');
+        PrintSubStmt(body);
+        Indent();
+      }
+      Write("while (");
+      PrintExpr(do_stmt->getCond());
+      Write(");\n");
+    } break;
+    case clang::Stmt::SwitchStmtClass: {
+      auto switch_stmt{clang::cast<clang::SwitchStmt>(stmt)};
+      if (switch_stmt->getInit()) {
+        FallbackStmt(stmt);
+        break;
+      }
+      Indent();
+      Write("switch (");
+      if (auto decl = switch_stmt->getConditionVariableDeclStmt()) {
+        PrintRawDeclStmt(decl);
+      } else {
+        PrintExpr(switch_stmt->getCond());
+      }
+      Write(')');
+      PrintControlledStmt(switch_stmt->getBody());
+    } break;
+    case clang::Stmt::CaseStmtClass: {
+      auto case_stmt{clang::cast<clang::CaseStmt>(stmt)};
+      Indent(-1);
+      Write("case ");
+      PrintExpr(case_stmt->getLHS());
+      if (auto rhs = case_stmt->getRHS()) {
+        Write(" ... ");
+        PrintExpr(rhs);
+      }
+      Write(":\n");
+      PrintSubStmt(case_stmt->getSubStmt(), 0);
+    } break;
+    case clang::Stmt::DefaultStmtClass:
+      Indent(-1);
+      Write("default:\n");
+      PrintSubStmt(clang::cast<clang::DefaultStmt>(stmt)->getSubStmt(), 0);
+      break;
+    case clang::Stmt::LabelStmtClass: {
+      auto label{clang::cast<clang::LabelStmt>(stmt)};
+      Indent(-1);
+      Write(label->getName());
+      Write(":\n");
+      PrintSubStmt(label->getSubStmt(), 0);
+    } break;
+    case clang::Stmt::GotoStmtClass:
+      Indent();
+      Write("goto ");
+      Write(clang::cast<clang::GotoStmt>(stmt)->getLabel()->getName());
+      Write(';');
+      WriteNewline();
+      break;
+    case clang::Stmt::ContinueStmtClass:
+      Indent();
+      Write("continue;");
+      WriteNewline();
+      break;
+    case clang::Stmt::BreakStmtClass:
+      Indent();
+      Write("break;");
+      WriteNewline();
+      break;
+    case clang::Stmt::ReturnStmtClass: {
+      Indent();
+      Write("return");
+      if (auto value = clang::cast<clang::ReturnStmt>(stmt)->getRetValue()) {
+        Write(' ');
+        PrintExpr(value);
+      }
+      Write(';');
+      WriteNewline();
+    } break;
+    case clang::Stmt::NullStmtClass:
+      Indent();
+      Write(";\n");
+      break;
+    case clang::Stmt::DeclStmtClass:
+      Indent();
+      PrintRawDeclStmt(clang::cast<clang::DeclStmt>(stmt));
+      Write(";\n");
+      break;
+    default:
+      FallbackStmt(stmt);
+      break;
+  }
+}
+
+//
+// Expressions
+//
+
+void CPrinter::VisitIntegerLiteral(clang::IntegerLiteral* lit) {
+  auto type{lit->getType()->getAs<clang::BuiltinType>()};
+  if (policy.ConstantsAsWritten || !type) {
+    FallbackStmt(lit);
+    return;
+  }
+
+  llvm::StringRef suffix;
+  switch (type->getKind()) {
+    case clang::BuiltinType::Int:
+    case clang::BuiltinType::Int128:
+    case clang::BuiltinType::UInt128:
+    case clang::BuiltinType::WChar_S:
+    case clang::BuiltinType::WChar_U:
+      break;
+    case clang::BuiltinType::UInt:
+      suffix = "U";
+      break;
+    case clang::BuiltinType::Long:
+      suffix = "L";
+      break;
+    case clang::BuiltinType::ULong:
+      suffix = "UL";
+      break;
+    case clang::BuiltinType::LongLong:
+      suffix = "LL";
+      break;
+    case clang::BuiltinType::ULongLong:
+      suffix = "ULL";
+      break;
+    default:
+      FallbackStmt(lit);
+      return;
+  }
+
+  auto& value{lit->getValue()};
+  auto is_signed{type->isSignedInteger()};
+  if (options.hex_literals && options.hex_literals(value)) {
+    llvm::SmallString<40> digits;
+    value.toString(digits, 16, is_signed, /*formatAsCLiteral=*/true);
+    Write(digits);
+  } else if (value.getBitWidth() <= 64) {
+    char digits[24];
+    auto res{is_signed ? std::to_chars(digits, digits + sizeof(digits),
+                                       value.getSExtValue())
+                       : std::to_chars(digits, digits + sizeof(digits),
+                                       value.getZExtValue())};
+    Write(llvm::StringRef(digits, res.ptr - digits));
+  } else {
+    llvm::SmallString<40> digits;
+    value.toString(digits, 10, is_signed);
+    Write(digits);
+  }
+  Write(suffix);
+}
+
+void CPrinter::VisitUnaryOperator(clang::UnaryOperator* op) {
+  auto opcode{op->getOpcode()};
+  if (!op->isPostfix()) {
+    Write(clang::UnaryOperator::getOpcodeStr(opcode));
+    // Keeps identifier operators and repeated signs apart from their operand
+    switch (opcode) {
+      case clang::UO_Real:
+      case clang::UO_Imag:
+      case clang::UO_Extension:
+        Write(' ');
+        break;
+      case clang::UO_Plus:
+      case clang::UO_Minus:
+        if (clang::isa<clang::UnaryOperator>(op->getSubExpr())) {
+          Write(' ');
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  PrintExpr(op->getSubExpr());
+  if (op->isPostfix()) {
+    Write(clang::UnaryOperator::getOpcodeStr(opcode));
+  }
+}
+
+void CPrinter::VisitMemberExpr(clang::MemberExpr* expr) {
+  auto id{expr->getMemberNameInfo().getName().getAsIdentifierInfo()};
+  if (!id || expr->getQualifier() || expr->hasTemplateKeyword() ||
+      expr->hasExplicitTemplateArgs() ||
+      clang::isa<clang::CXXThisExpr>(expr->getBase())) {
+    FallbackStmt(expr);
+    return;
+  }
+
+  PrintExpr(expr->getBase());
+  // Members of anonymous records are accessed as if they were members of the
+  // enclosing record
+  auto parent{clang::dyn_cast<clang::MemberExpr>(expr->getBase())};
+  auto parent_field{
+      parent ? clang::dyn_cast<clang::FieldDecl>(parent->getMemberDecl())
+             : nullptr};
+  if (!parent_field || !parent_field->isAnonymousStructOrUnion()) {
+    Write(expr->isArrow() ? "->" : ".");
+  }
+  auto field{clang::dyn_cast<clang::FieldDecl>(expr->getMemberDecl())};
+  if (field && field->isAnonymousStructOrUnion()) {
+    return;
+  }
+  Write(id->getName());
+}
+
+void CPrinter::PrintExpr(clang::Expr* expr) {
+  if (!expr || !TracksStmts()) {
+    PrintRawExpr(expr);
+    return;
+  }
+  auto begin{GetLocation()};
+  PrintRawExpr(expr);
+  options.on_stmt_range(expr, begin, GetLocation());
+}
+
+void CPrinter::PrintRawExpr(clang::Expr* expr) {
+  if (!expr) {
+    Write("<null expr>");
+    return;
+  }
+
+  switch (expr->getStmtClass()) {
+    case clang::Stmt::IntegerLiteralClass:
+      VisitIntegerLiteral(clang::cast<clang::IntegerLiteral>(expr));
+      break;
+    case clang::Stmt::StringLiteralClass:
+      clang::cast<clang::StringLiteral>(expr)->outputString(buffer_os);
+      break;
+    case clang::Stmt::DeclRefExprClass: {
+      auto ref{clang::cast<clang::DeclRefExpr>(expr)};
+      auto id{ref->getNameInfo().getName().getAsIdentifierInfo()};
+      // Other kinds of declarations, like captured OpenMP expressions, are
+      // not referred to by name
+      auto kind{ref->getDecl()->getKind()};
+      auto is_named{kind == clang::Decl::Var || kind == clang::Decl::ParmVar ||
+                    kind == clang::Decl::Function ||
+                    kind == clang::Decl::EnumConstant};
+      if (!id || !is_named || ref->getQualifier() ||
+          ref->hasTemplateKeyword() || ref->hasExplicitTemplateArgs() ||
+          policy.CleanUglifiedParameters) {
+        FallbackStmt(expr);
+        break;
+      }
+      Write(id->getName());
+    } break;
+    case clang::Stmt::ParenExprClass:
+      Write('(');
+      PrintExpr(clang::cast<clang::ParenExpr>(expr)->getSubExpr());
+      Write(')');
+      break;
+    case clang::Stmt::CStyleCastExprClass: {
+      auto cast{clang::cast<clang::CStyleCastExpr>(expr)};
+      Write('(');
+      PrintType(cast->getTypeAsWritten());
+      Write(')');
+      PrintExpr(cast->getSubExpr());
+    } break;
+    case clang::Stmt::ImplicitCastExprClass:
+      PrintExpr(clang::cast<clang::ImplicitCastExpr>(expr)->getSubExpr());
+      break;
+    case clang::Stmt::UnaryOperatorClass:
+      VisitUnaryOperator(clang::cast<clang::UnaryOperator>(expr));
+      break;
+    case clang::Stmt::BinaryOperatorClass:
+    case clang::Stmt::CompoundAssignOperatorClass: {
+      auto op{clang::cast<clang::BinaryOperator>(expr)};
+      PrintExpr(op->getLHS());
+      Write(' ');
+      Write(clang::BinaryOperator::getOpcodeStr(op->getOpcode()));
+      Write(' ');
+      PrintExpr(op->getRHS());
+    } break;
+    case clang::Stmt::ConditionalOperatorClass: {
+      auto op{clang::cast<clang::ConditionalOperator>(expr)};
+      PrintExpr(op->getCond());
+      Write(" ? ");
+      PrintExpr(op->getLHS());
+      Write(" : ");
+      PrintExpr(op->getRHS());
+    } break;
+    case clang::Stmt::ArraySubscriptExprClass: {
+      auto sub{clang::cast<clang::ArraySubscriptExpr>(expr)};
+      PrintExpr(sub->getLHS());
+      Write('[');
+      PrintExpr(sub->getRHS());
+      Write(']');
+    } break;
+    case clang::Stmt::CallExprClass: {
+      auto call{clang::cast<clang::CallExpr>(expr)};
+      PrintExpr(call->getCallee());
+      Write('(');
+      for (unsigned i{0}, e{call->getNumArgs()}; i != e; ++i) {
+        auto arg{call->getArg(i)};
+        if (clang::isa<clang::CXXDefaultArgExpr>(arg)) {
+          break;
+        }
+        if (i) {
+          Write(", ");
+        }
+        PrintExpr(arg);
+      }
+      Write(')');
+    } break;
+    case clang::Stmt::MemberExprClass:
+      VisitMemberExpr(clang::cast<clang::MemberExpr>(expr));
+      break;
+    case clang::Stmt::InitListExprClass: {
+      auto list{clang::cast<clang::InitListExpr>(expr)};
+      if (auto syntactic = list->getSyntacticForm()) {
+        PrintExpr(syntactic);
+        break;
+      }
+      Write('{');
+      for (unsigned i{0}, e{list->getNumInits()}; i != e; ++i) {
+        if (i) {
+          Write(", ");
+        }
+        if (auto init = list->getInit(i)) {
+          PrintExpr(init);
+        } else {
+          Write("{}");
+        }
+      }
+      Write('}');
+    } break;
+    case clang::Stmt::CompoundLiteralExprClass: {
+      auto lit{clang::cast<clang::CompoundLiteralExpr>(expr)};
+      Write('(');
+      PrintType(lit->getType());
+      Write(')');
+      PrintExpr(lit->getInitializer());
+    } break;
+    default:
+      FallbackStmt(expr);
+      break;
+  }
+}
+
+// Output of a slice of the top-level declarations, with the ranges of its
+// nodes relative to its own start, in the order they were reported
+struct PrintedChunk {
+  struct Range {
+    const clang::Stmt* stmt;
+    const clang::Decl* decl;
+    CPrinterLocation begin;
+    CPrinterLocation end;
+  };
+
+  std::string code;
+  std::vector<Range> ranges;
+};
+
+static unsigned CountLines(const std::string& code) {
+  return static_cast<unsigned>(std::count(code.begin(), code.end(), '\n'));
+}
+
+void PrintTranslationUnit(llvm::raw_ostream& os, clang::ASTContext& ast_ctx,
+                          CPrinterOptions options, unsigned num_threads) {
+  // Declarations are grouped with the tag declarations that precede them when
+  // those are not free-standing, so definitions that follow one are not split
+  // off from it
+  auto tudecl{ast_ctx.getTranslationUnitDecl()};
+  std::vector<clang::DeclContext::decl_iterator> bounds{tudecl->decls_begin()};
+  clang::Decl* prev{nullptr};
+  for (auto it{tudecl->decls_begin()}, end{tudecl->decls_end()}; it != end;
+       ++it) {
+    auto decl{*it};
+    if (decl->isImplicit()) {
+      continue;
+    }
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    auto prev_tag{clang::dyn_cast_or_null<clang::TagDecl>(prev)};
+    if (fdecl && fdecl->doesThisDeclarationHaveABody() &&
+        (!prev_tag || prev_tag->isFreeStanding())) {
+      if (bounds.back() != it) {
+        bounds.push_back(it);
+      }
+      bounds.push_back(std::next(it));
+    }
+    prev = decl;
+  }
+  if (bounds.back() != tudecl->decls_end()) {
+    bounds.push_back(tudecl->decls_end());
+  }
+
+  auto num_chunks{bounds.size() - 1};
+  num_threads = std::min<size_t>(num_threads, num_chunks);
+  if (num_threads <= 1) {
+    CPrinter printer(os, ast_ctx, std::move(options));
+    printer.PrintTranslationUnit();
+    return;
+  }
+
+  auto tracks{options.on_stmt_range || options.on_decl_range};
+  std::vector<PrintedChunk> chunks(num_chunks);
+  std::atomic_size_t next_chunk{0};
+  auto Print{[&]() {
+    // Each thread prints its chunks one after the other with the same
+    // printer, so that type names are computed once per thread. The ranges
+    // it reports are rebased on the start of the current chunk, which is
+    // always at the start of a line.
+    PrintedChunk* chunk{nullptr};
+    uint64_t chunk_offset{0};
+    unsigned chunk_lines{0};
+    auto Rebase{[&](CPrinterLocation loc) {
+      loc.offset -= chunk_offset;
+      loc.line -= chunk_lines;
+      return loc;
+    }};
+
+    auto thread_options{options};
+    if (options.on_stmt_range) {
+      thread_options.on_stmt_range = [&](const clang::Stmt* stmt,
+                                         CPrinterLocation begin,
+                                         CPrinterLocation end) {
+        chunk->ranges.push_back({stmt, nullptr, Rebase(begin), Rebase(end)});
+      };
+    }
+    if (options.on_decl_range) {
+      thread_options.on_decl_range = [&](const clang::Decl* decl,
+                                         CPrinterLocation begin,
+                                         CPrinterLocation end) {
+        chunk->ranges.push_back({nullptr, decl, Rebase(begin), Rebase(end)});
+      };
+    }
+
+    std::string code;
+    llvm::raw_string_ostream code_os(code);
+    CPrinter printer(code_os, ast_ctx, std::move(thread_options));
+    for (auto idx{next_chunk++}; idx < num_chunks; idx = next_chunk++) {
+      chunk = &chunks[idx];
+      printer.PrintTopLevelDecls(bounds[idx], bounds[idx + 1]);
+      printer.Flush();
+      chunk->code = std::move(code);
+      code.clear();
+      if (tracks) {
+        chunk_offset += chunk->code.size();
+        chunk_lines += CountLines(chunk->code);
+      }
+    }
+  }};
+
+  std::vector<std::thread> workers;
+  for (unsigned i{0}; i < num_threads; ++i) {
+    workers.emplace_back(Print);
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  uint64_t offset{0};
+  unsigned lines{0};
+  auto Shift{[&](CPrinterLocation loc) {
+    loc.offset += offset;
+    loc.line += lines;
+    return loc;
+  }};
+  for (auto& chunk : chunks) {
+    for (auto& range : chunk.ranges) {
+      if (range.stmt) {
+        options.on_stmt_range(range.stmt, Shift(range.begin), Shift(range.end));
+      } else {
+        options.on_decl_range(range.decl, Shift(range.begin), Shift(range.end));
+      }
+    }
+    os.write(chunk.code.data(), chunk.code.size());
+    if (tracks) {
+      offset += chunk.code.size();
+      lines += CountLines(chunk.code);
+    }
+    chunk = PrintedChunk{};
+  }
+}
+
+}  // namespace rellic
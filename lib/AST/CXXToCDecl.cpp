@@ -46,6 +46,11 @@ CXXToCDeclVisitor::CXXToCDeclVisitor(clang::ASTUnit &unit)
       ast(unit) {}
 
 clang::QualType CXXToCDeclVisitor::GetAsCType(clang::QualType type) {
+  auto cached = c_types.find(type.getAsOpaquePtr());
+  if (cached != c_types.end()) {
+    return cached->second;
+  }
+
   const clang::Type *result;
   if (auto ptr = type->getAs<clang::PointerType>()) {
     // Get a C pointer equivalent
@@ -69,7 +74,9 @@ clang::QualType CXXToCDeclVisitor::GetAsCType(clang::QualType type) {
   } else {
     result = type.getTypePtr();
   }
-  return clang::QualType(result, type.getQualifiers().getAsOpaqueValue());
+  clang::QualType c_type(result, type.getQualifiers().getAsOpaqueValue());
+  c_types[type.getAsOpaquePtr()] = c_type;
+  return c_type;
 }
 
 bool CXXToCDeclVisitor::VisitFunctionDecl(clang::FunctionDecl *cxx_func) {
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/ChangeLog.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace rellic {
+
+using StmtSet = std::unordered_set<clang::Stmt *>;
+
+// Adds the statements below `stmt`, excluding `stmt` itself, to `stmts`
+static void CollectDescendants(clang::Stmt *stmt, StmtSet &stmts) {
+  std::vector<clang::Stmt *> work_list{stmt};
+  while (!work_list.empty()) {
+    auto current{work_list.back()};
+    work_list.pop_back();
+    for (auto child : current->children()) {
+      if (child && stmts.insert(child).second) {
+        work_list.push_back(child);
+      }
+    }
+  }
+}
+
+static std::vector<std::string> PrintLines(
+    clang::FunctionDecl *function, clang::Stmt *root,
+    const clang::PrintingPolicy &policy) {
+  std::string s;
+  llvm::raw_string_ostream os(s);
+  if (root) {
+    root->printPretty(os, nullptr, policy);
+  } else {
+    function->print(os, policy);
+  }
+
+  llvm::SmallVector<llvm::StringRef, 16> lines;
+  llvm::StringRef(os.str()).rtrim('\n').split(lines, '\n');
+  return {lines.begin(), lines.end()};
+}
+
+static std::string GetName(clang::FunctionDecl *function) {
+  return function ? function->getNameAsString() : "<global>";
+}
+
+void ChangeLog::RecordReplacement(clang::FunctionDecl *function,
+                                  clang::Stmt *parent, clang::Stmt *&slot,
+                                  clang::Stmt *after) {
+  changes.push_back({function, parent, &slot, slot, after});
+}
+
+void ChangeLog::RecordBody(clang::FunctionDecl *function, clang::Stmt *after) {
+  changes.push_back({function, nullptr, nullptr, function->getBody(), after});
+}
+
+void ChangeLog::RecordInPlace(clang::FunctionDecl *function) {
+  changed_in_place.push_back(function);
+}
+
+void ChangeLog::Clear() {
+  changes.clear();
+  changed_in_place.clear();
+}
+
+void ChangeLog::Undo() {
+  for (auto it{changes.rbegin()}; it != changes.rend(); ++it) {
+    if (it->slot) {
+      *it->slot = it->before;
+    } else {
+      it->function->setBody(it->before);
+    }
+  }
+}
+
+void ChangeLog::Redo() {
+  for (auto &change : changes) {
+    if (change.slot) {
+      *change.slot = change.after;
+    } else {
+      change.function->setBody(change.after);
+    }
+  }
+}
+
+std::vector<ChangeHunk> ChangeLog::GetHunks(
+    const clang::PrintingPolicy &policy, unsigned context) {
+  // Statements that are no longer where they were, because they are part of
+  // a statement that was replaced
+  StmtSet replaced;
+  for (auto &change : changes) {
+    if (change.before && replaced.insert(change.before).second) {
+      CollectDescendants(change.before, replaced);
+    }
+  }
+
+  // Definitions whose body was replaced are shown whole
+  std::unordered_set<clang::FunctionDecl *> whole;
+  for (auto &change : changes) {
+    if (!change.parent) {
+      whole.insert(change.function);
+    }
+  }
+
+  std::vector<ChangeHunk> hunks;
+  StmtSet roots;
+  std::unordered_set<clang::FunctionDecl *> whole_done;
+  for (auto &change : changes) {
+    if (!change.parent) {
+      if (whole_done.insert(change.function).second) {
+        hunks.push_back({change.function, nullptr});
+      }
+    } else if (!whole.count(change.function) &&
+               !replaced.count(change.parent) &&
+               roots.insert(change.parent).second) {
+      hunks.push_back({change.function, change.parent});
+    }
+  }
+
+  // Hunks nested in other hunks are shown as part of those
+  StmtSet nested;
+  for (auto &hunk : hunks) {
+    if (hunk.root) {
+      CollectDescendants(hunk.root, nested);
+    }
+  }
+  hunks.erase(std::remove_if(hunks.begin(), hunks.end(),
+                             [&nested](const ChangeHunk &hunk) {
+                               return hunk.root && nested.count(hunk.root);
+                             }),
+              hunks.end());
+
+  std::vector<std::vector<std::string>> before;
+  Undo();
+  for (auto &hunk : hunks) {
+    before.push_back(PrintLines(hunk.function, hunk.root, policy));
+  }
+  Redo();
+
+  std::vector<ChangeHunk> result;
+  for (size_t i{0}; i < hunks.size(); ++i) {
+    auto &old_lines{before[i]};
+    auto new_lines{PrintLines(hunks[i].function, hunks[i].root, policy)};
+    size_t prefix{0};
+    while (prefix < old_lines.size() && prefix < new_lines.size() &&
+           old_lines[prefix] == new_lines[prefix]) {
+      ++prefix;
+    }
+    size_t suffix{0};
+    while (suffix < old_lines.size() - prefix &&
+           suffix < new_lines.size() - prefix &&
+           old_lines[old_lines.size() - suffix - 1] ==
+               new_lines[new_lines.size() - suffix - 1]) {
+      ++suffix;
+    }
+    if (prefix == old_lines.size() && prefix == new_lines.size()) {
+      // Replaced by an identical statement
+      continue;
+    }
+
+    auto &hunk{hunks[i]};
+    auto old_end{old_lines.size() - suffix};
+    auto new_end{new_lines.size() - suffix};
+    auto leading{std::min<size_t>(prefix, context)};
+    auto trailing{std::min<size_t>(suffix, context)};
+    hunk.leading.assign(old_lines.begin() + prefix - leading,
+                        old_lines.begin() + prefix);
+    hunk.removed.assign(old_lines.begin() + prefix,
+                        old_lines.begin() + old_end);
+    hunk.added.assign(new_lines.begin() + prefix, new_lines.begin() + new_end);
+    hunk.trailing.assign(new_lines.begin() + new_end,
+                         new_lines.begin() + new_end + trailing);
+    result.push_back(std::move(hunk));
+  }
+  return result;
+}
+
+void ChangeLog::Print(llvm::raw_ostream &os,
+                      const clang::PrintingPolicy &policy, unsigned context) {
+  auto hunks{GetHunks(policy, context)};
+  std::unordered_set<clang::FunctionDecl *> shown;
+  for (auto &hunk : hunks) {
+    shown.insert(hunk.function);
+    os << "@@ " << GetName(hunk.function) << " @@\n";
+    for (auto &line : hunk.leading) {
+      os << ' ' << line << '\n';
+    }
+    for (auto &line : hunk.removed) {
+      os << '-' << line << '\n';
+    }
+    for (auto &line : hunk.added) {
+      os << '+' << line << '\n';
+    }
+    for (auto &line : hunk.trailing) {
+      os << ' ' << line << '\n';
+    }
+  }
+
+  for (auto function : changed_in_place) {
+    if (shown.insert(function).second) {
+      os << "@@ " << GetName(function) << " @@ changed in place\n";
+    }
+  }
+}
+
+}  // namespace rellic
@@ -10,6 +10,7 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
 
 #include <iterator>
 
@@ -19,30 +20,76 @@ CondBasedRefine::CondBasedRefine(DecompilationContext &dec_ctx)
     : TransformVisitor<CondBasedRefine>(dec_ctx) {}
 
 bool CondBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
-  std::vector<clang::Stmt *> body{compound->body_begin(), compound->body_end()};
+  llvm::SmallVector<clang::Stmt *, 16> new_body;
   bool did_something{false};
 
-  for (size_t i{0}; i + 1 < body.size() && !did_something; ++i) {
-    auto if_a{clang::dyn_cast<clang::IfStmt>(body[i])};
-    auto if_b{clang::dyn_cast<clang::IfStmt>(body[i + 1])};
+  // A run of consecutive `if` statements whose conditions are all equal or
+  // opposite to the one of the first. The branches of the whole run are
+  // collected first, so that only one statement is created per run.
+  clang::IfStmt *run_if{nullptr};
+  size_t run_length{0};
+  llvm::SmallVector<clang::Stmt *, 8> run_then;
+  llvm::SmallVector<clang::Stmt *, 8> run_else;
+
+  auto FlushRun = [&]() {
+    if (!run_if) {
+      return;
+    }
+
+    if (run_length == 1) {
+      // Nothing was merged into the first `if`
+      new_body.push_back(run_if);
+    } else {
+      auto new_if{dec_ctx.ast.CreateIf(
+          dec_ctx.marker_expr, dec_ctx.ast.CreateCompoundStmt(run_then))};
+      if (!run_else.empty()) {
+        new_if->setElse(dec_ctx.ast.CreateCompoundStmt(run_else));
+      }
+      dec_ctx.SetCond(new_if, dec_ctx.conds.lookup(run_if));
+      new_body.push_back(new_if);
+      did_something = true;
+    }
+
+    run_if = nullptr;
+    run_length = 0;
+    run_then.clear();
+    run_else.clear();
+  };
+
+  auto StartRun = [&](clang::IfStmt *if_stmt) {
+    run_if = if_stmt;
+    run_length = 1;
+    run_then.push_back(if_stmt->getThen());
+    if (auto else_stmt = if_stmt->getElse()) {
+      run_else.push_back(else_stmt);
+    }
+  };
+
+  for (auto stmt : compound->body()) {
+    auto if_b{clang::dyn_cast<clang::IfStmt>(stmt)};
 
     // We need two `if` statements to combine
-    if (!if_a || !if_b) {
+    if (!if_b) {
+      FlushRun();
+      new_body.push_back(stmt);
       continue;
     }
 
-    auto cond_a{dec_ctx.z3_exprs[dec_ctx.conds[if_a]]};
-    auto cond_b{dec_ctx.z3_exprs[dec_ctx.conds[if_b]]};
+    if (!run_if) {
+      StartRun(if_b);
+      continue;
+    }
 
-    auto then_a{if_a->getThen()};
-    auto then_b{if_b->getThen()};
+    auto cond_a_idx{dec_ctx.GetCond(run_if)};
+    auto cond_b_idx{dec_ctx.GetCond(if_b)};
+    auto cond_a{dec_ctx.z3_exprs[cond_a_idx]};
+    auto cond_b{dec_ctx.z3_exprs[cond_b_idx]};
 
-    auto else_a{if_a->getElse()};
+    auto then_b{if_b->getThen()};
     auto else_b{if_b->getElse()};
 
-    std::vector<clang::Stmt *> new_then_body{then_a};
-    clang::IfStmt *new_if{nullptr};
-    if (Prove(cond_a == cond_b)) {
+    // Conditions are canonical, so equal ones share their index
+    if (cond_a_idx == cond_b_idx || dec_ctx.prover.Prove(cond_a == cond_b)) {
       // We found two consecutive `if` statements with identical conditions, so
       // we can merge their `then` and `else` branches
       //
@@ -50,29 +97,11 @@ bool CondBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
       // if(a) { X2; } else { Y2; }
       // becomes
       // if(a) { X1; X2; } else { Y1; Y2; }
-      new_then_body.push_back(then_b);
-      auto new_then{dec_ctx.ast.CreateCompoundStmt(new_then_body)};
-
-      new_if = dec_ctx.ast.CreateIf(dec_ctx.marker_expr, new_then);
-
-      if (else_a || else_b) {
-        // At least one of the two `if` statements has an `else` branch
-        std::vector<clang::Stmt *> new_else_body{};
-
-        if (else_a) {
-          new_else_body.push_back(else_a);
-        }
-
-        if (else_b) {
-          new_else_body.push_back(else_b);
-        }
-
-        auto new_else{dec_ctx.ast.CreateCompoundStmt(new_else_body)};
-        new_if->setElse(new_else);
+      run_then.push_back(then_b);
+      if (else_b) {
+        run_else.push_back(else_b);
       }
-
-      did_something = true;
-    } else if (Prove(cond_a == !cond_b)) {
+    } else if (dec_ctx.prover.Prove(cond_a == !cond_b)) {
       // We found two consecutive `if` statements with opposite conditions, so
       // we can append the else branch of the second to the then branch of the
       // first, and viceversa
@@ -82,41 +111,59 @@ bool CondBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
       // becomes
       // if(a) { X1; Y2; } else { Y1; X2; }
       if (else_b) {
-        new_then_body.push_back(else_b);
+        run_then.push_back(else_b);
       }
-
-      auto new_then{dec_ctx.ast.CreateCompoundStmt(new_then_body)};
-
-      std::vector<clang::Stmt *> new_else_body{};
-      if (else_a) {
-        new_else_body.push_back(else_a);
-      }
-      new_else_body.push_back(then_b);
-
-      new_if = dec_ctx.ast.CreateIf(dec_ctx.marker_expr, new_then);
-
-      auto new_else{dec_ctx.ast.CreateCompoundStmt(new_else_body)};
-      new_if->setElse(new_else);
-
-      did_something = true;
-    }
-
-    if (did_something) {
-      dec_ctx.conds[new_if] = dec_ctx.conds[if_a];
-      body[i] = new_if;
-      body.erase(std::next(body.begin(), i + 1));
+      run_else.push_back(then_b);
+    } else {
+      FlushRun();
+      StartRun(if_b);
+      continue;
     }
+    ++run_length;
   }
+  FlushRun();
+
   if (did_something) {
-    substitutions[compound] = dec_ctx.ast.CreateCompoundStmt(body);
+    substitutions[compound] = dec_ctx.ast.CreateCompoundStmt(new_body);
   }
   return !Stopped();
 }
 
+// Runs of a single `if` are left as they are
+bool CondBasedRefine::AppliesTo(
+    const DecompilationContext::FunctionFeatures &features) const {
+  return features.max_if_run >= 2;
+}
+
 void CondBasedRefine::RunImpl() {
-  LOG(INFO) << "Condition-based refinement";
   TransformVisitor<CondBasedRefine>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  // Runs are only known while traversing, so the conditions of consecutive
+  // `if` statements are compared instead, which are the queries made for the
+  // `if` statements that start a run
+  dec_ctx.PrefetchProofs(
+      [this](clang::Stmt *stmt, std::vector<z3::expr> &queries) {
+        auto compound{clang::dyn_cast<clang::CompoundStmt>(stmt)};
+        if (!compound) {
+          return;
+        }
+        clang::IfStmt *prev{nullptr};
+        for (auto child : compound->body()) {
+          auto ifstmt{clang::dyn_cast<clang::IfStmt>(child)};
+          if (prev && ifstmt) {
+            auto idx_a{dec_ctx.conds.lookup(prev)};
+            auto idx_b{dec_ctx.conds.lookup(ifstmt)};
+            if (idx_a != idx_b) {
+              auto cond_a{dec_ctx.z3_exprs[idx_a]};
+              auto cond_b{dec_ctx.z3_exprs[idx_b]};
+              queries.push_back(cond_a == cond_b);
+              queries.push_back(cond_a == !cond_b);
+            }
+          }
+          prev = ifstmt;
+        }
+      },
+      [this](clang::FunctionDecl *fdecl) { return MayChange(fdecl); });
+  TraverseDirtyFunctions();
 }
 
 }  // namespace rellic
\ No newline at end of file
@@ -19,7 +19,8 @@ bool DeadStmtElim::VisitIfStmt(clang::IfStmt *ifstmt) {
   // DLOG(INFO) << "VisitIfStmt";
   bool can_delete = false;
   if (ifstmt->getCond() == dec_ctx.marker_expr) {
-    can_delete = Prove(!dec_ctx.z3_exprs[dec_ctx.conds[ifstmt]]);
+    can_delete =
+        dec_ctx.prover.Prove(!dec_ctx.z3_exprs[dec_ctx.GetCond(ifstmt)]);
   }
 
   auto compound = clang::dyn_cast<clang::CompoundStmt>(ifstmt->getThen());
@@ -40,24 +41,31 @@ bool DeadStmtElim::VisitCompoundStmt(clang::CompoundStmt *compound) {
     }
     // Add only necessary statements
     if (auto expr = clang::dyn_cast<clang::Expr>(stmt)) {
-      if (expr->HasSideEffects(dec_ctx.ast_ctx)) {
+      if (dec_ctx.HasSideEffects(expr)) {
         new_body.push_back(stmt);
       }
     } else if (!clang::dyn_cast<clang::NullStmt>(stmt)) {
       new_body.push_back(stmt);
     }
   }
-  // Create the a new compound
-  if (changed || new_body.size() < compound->size()) {
+  // Create the a new compound. Replaced children have already been updated
+  // in place, so a new one is only needed if some statements were dropped.
+  if (new_body.size() < compound->size()) {
     substitutions[compound] = dec_ctx.ast.CreateCompoundStmt(new_body);
   }
   return !Stopped();
 }
 
 void DeadStmtElim::RunImpl() {
-  LOG(INFO) << "Eliminating dead statements";
   TransformVisitor<DeadStmtElim>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  dec_ctx.PrefetchProofs([this](clang::Stmt *stmt,
+                                std::vector<z3::expr> &queries) {
+    auto ifstmt{clang::dyn_cast<clang::IfStmt>(stmt)};
+    if (ifstmt && ifstmt->getCond() == dec_ctx.marker_expr) {
+      queries.push_back(!dec_ctx.z3_exprs[dec_ctx.GetCond(ifstmt)]);
+    }
+  });
+  TraverseDirtyFunctions();
 }
 
 }  // namespace rellic
@@ -14,38 +14,120 @@
 #include <llvm/BinaryFormat/Dwarf.h>
 #include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/IntrinsicInst.h>
 #include <llvm/Support/Casting.h>
 #include <rellic/BC/Util.h>
+#include <rellic/Trace.h>
 
 #include <algorithm>
+#include <atomic>
 #include <iterator>
+#include <thread>
 #include <utility>
 
 namespace rellic {
 
-void DebugInfoCollector::visitDbgDeclareInst(llvm::DbgDeclareInst& inst) {
-  auto var{inst.getVariable()};
-  auto loc{inst.getAddress()};
+void DebugInfoCollector::Collect(llvm::Function& func, FunctionInfo& info) {
+  info.subprogram = func.getSubprogram();
+  if (info.subprogram) {
+    info.walks.push_back({func.getFunctionType(), info.subprogram->getType()});
+  }
 
-  names[loc] = var->getName().str();
-  scopes[loc] = var->getScope();
-  valtypes[loc] = var->getType();
+  for (auto& inst : llvm::instructions(func)) {
+    if (auto decl = llvm::dyn_cast<llvm::DbgDeclareInst>(&inst)) {
+      auto var{decl->getVariable()};
+      auto loc{decl->getAddress()};
+      info.entries.push_back({loc, var->getScope(), var});
 
-  if (auto alloca = llvm::dyn_cast<llvm::AllocaInst>(loc)) {
-    WalkType(alloca->getAllocatedType(), var->getType());
-  } else {
-    WalkType(loc->getType(), var->getType());
+      if (auto alloca = llvm::dyn_cast<llvm::AllocaInst>(loc)) {
+        info.walks.push_back({alloca->getAllocatedType(), var->getType()});
+      } else {
+        info.walks.push_back({loc->getType(), var->getType()});
+      }
+    } else if (auto loc{inst.getDebugLoc().get()}) {
+      info.entries.push_back({&inst, loc->getScope(), nullptr});
+    }
   }
 }
 
-void DebugInfoCollector::visitInstruction(llvm::Instruction& inst) {
-  if (auto loc{inst.getDebugLoc().get()}) {
-    scopes[&inst] = loc->getScope();
+void DebugInfoCollector::Merge(llvm::Function& func, FunctionInfo& info) {
+  if (auto subprogram = info.subprogram) {
+    subprograms.push_back(subprogram);
+
+    auto ditype{subprogram->getType()};
+    auto type_array{ditype->getTypeArray()};
+    if (func.arg_size() + func.isVarArg() + 1 == type_array.size()) {
+      funcs[&func] = ditype;
+      size_t i{1};
+      for (auto& arg : func.args()) {
+        auto argtype{type_array[i++]};
+        args[&arg] = argtype;
+      }
+    } else {
+      // Debug metadata is not compatible with bitcode, bail out
+      // TODO(frabert): Find a way to reconcile differences
+    }
+  }
+
+  for (auto& entry : info.entries) {
+    scopes[entry.value] = entry.scope;
+    if (entry.var) {
+      names[entry.value] = entry.var->getName().str();
+      valtypes[entry.value] = entry.var->getType();
+    }
+  }
+
+  for (auto [type, ditype] : info.walks) {
+    WalkType(type, ditype);
+  }
+}
+
+void DebugInfoCollector::visit(llvm::Function& func) {
+  FunctionInfo info;
+  Collect(func, info);
+  Merge(func, info);
+}
+
+void DebugInfoCollector::visit(llvm::Module& module, unsigned num_threads) {
+  std::vector<llvm::Function*> worklist;
+  for (auto& func : module) {
+    worklist.push_back(&func);
+  }
+
+  num_threads = std::min<size_t>(num_threads, worklist.size());
+  if (num_threads <= 1) {
+    for (auto func : worklist) {
+      visit(*func);
+    }
+    return;
+  }
+
+  std::vector<FunctionInfo> infos(worklist.size());
+  std::atomic_size_t next_func{0};
+  std::vector<std::thread> workers;
+  auto tracing{IsTracing()};
+  for (unsigned i{0}; i < num_threads; ++i) {
+    workers.emplace_back([&, tracing]() {
+      TraceThread trace_thread(tracing);
+      llvm::TimeTraceScope trace("CollectDebugInfo");
+      for (auto idx{next_func++}; idx < worklist.size(); idx = next_func++) {
+        Collect(*worklist[idx], infos[idx]);
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  for (size_t i{0}; i < worklist.size(); ++i) {
+    Merge(*worklist[i], infos[i]);
   }
 }
 
 void DebugInfoCollector::WalkType(llvm::Type* type, llvm::DIType* ditype) {
-  if (!ditype || types.find(type) != types.end()) {
+  if (!ditype || types.find(type) != types.end() ||
+      !walked.insert({type, ditype}).second) {
     return;
   }
   type_set.insert(ditype);
@@ -197,27 +279,4 @@ void DebugInfoCollector::WalkType(llvm::Type* type, llvm::DIType* ditype) {
   }
 }
 
-void DebugInfoCollector::visitFunction(llvm::Function& func) {
-  auto subprogram{func.getSubprogram()};
-  if (!subprogram) {
-    return;
-  }
-  subprograms.push_back(subprogram);
-
-  auto ditype{subprogram->getType()};
-  auto type_array{ditype->getTypeArray()};
-  if (func.arg_size() + func.isVarArg() + 1 == type_array.size()) {
-    funcs[&func] = ditype;
-    size_t i{1};
-    for (auto& arg : func.args()) {
-      auto argtype{type_array[i++]};
-      args[&arg] = argtype;
-    }
-  } else {
-    // Debug metadata is not compatible with bitcode, bail out
-    // TODO(frabert): Find a way to reconcile differences
-  }
-  WalkType(func.getFunctionType(), ditype);
-}
-
 }  // namespace rellic
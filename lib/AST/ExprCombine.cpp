@@ -14,6 +14,7 @@
 
 #include "rellic/AST/InferenceRule.h"
 #include "rellic/AST/Util.h"
+#include "rellic/Exception.h"
 
 namespace rellic {
 
@@ -42,8 +43,9 @@ class ArraySubscriptAddrOfRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto sub = clang::cast<clang::ArraySubscriptExpr>(stmt);
-    CHECK(sub == match) << "Substituted ArraySubscriptExpr is not the matched "
-                           "ArraySubscriptExpr!";
+    CHECK_THROW(sub == match)
+        << "Substituted ArraySubscriptExpr is not the matched "
+           "ArraySubscriptExpr!";
     auto paren = clang::cast<clang::ParenExpr>(sub->getBase());
     auto addr_of = clang::cast<clang::UnaryOperator>(paren->getSubExpr());
     CopyProvenance(addr_of, addr_of->getSubExpr(), dec_ctx.use_provenance);
@@ -67,7 +69,7 @@ class AddrOfArraySubscriptRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto addr_of = clang::cast<clang::UnaryOperator>(stmt);
-    CHECK(addr_of == match)
+    CHECK_THROW(addr_of == match)
         << "Substituted UnaryOperator is not the matched UnaryOperator!";
     auto subexpr = addr_of->getSubExpr()->IgnoreParenImpCasts();
     auto sub = clang::cast<clang::ArraySubscriptExpr>(subexpr);
@@ -91,7 +93,7 @@ class DerefAddrOfRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto deref = clang::cast<clang::UnaryOperator>(stmt);
-    CHECK(deref == match)
+    CHECK_THROW(deref == match)
         << "Substituted UnaryOperator is not the matched UnaryOperator!";
     auto subexpr = deref->getSubExpr()->IgnoreParenImpCasts();
     auto addr_of = clang::cast<clang::UnaryOperator>(subexpr);
@@ -119,7 +121,7 @@ class DerefAddrOfConditionalRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto deref = clang::cast<clang::UnaryOperator>(stmt);
-    CHECK(deref == match)
+    CHECK_THROW(deref == match)
         << "Substituted UnaryOperator is not the matched UnaryOperator!";
 
     if (deref->getValueKind() == clang::ExprValueKind::VK_LValue) {
@@ -159,7 +161,7 @@ class NegComparisonRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto op = clang::cast<clang::UnaryOperator>(stmt);
-    CHECK(op == match)
+    CHECK_THROW(op == match)
         << "Substituted UnaryOperator is not the matched UnaryOperator!";
     auto subexpr = op->getSubExpr()->IgnoreParenImpCasts();
     auto binop = clang::cast<clang::BinaryOperator>(subexpr);
@@ -186,7 +188,7 @@ class ParenDeclRefExprStripRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto paren = clang::cast<clang::ParenExpr>(stmt);
-    CHECK(paren == match)
+    CHECK_THROW(paren == match)
         << "Substituted ParenExpr is not the matched ParenExpr!";
     return paren->getSubExpr();
   }
@@ -205,7 +207,7 @@ class DoubleParenStripRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto paren = clang::cast<clang::ParenExpr>(stmt);
-    CHECK(paren == match)
+    CHECK_THROW(paren == match)
         << "Substituted ParenExpr is not the matched ParenExpr!";
     return paren->getSubExpr();
   }
@@ -230,12 +232,12 @@ class MemberExprAddrOfRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto arrow{clang::cast<clang::MemberExpr>(stmt)};
-    CHECK(arrow == match)
+    CHECK_THROW(arrow == match)
         << "Substituted MemberExpr is not the matched MemberExpr!";
     auto base{arrow->getBase()->IgnoreParenImpCasts()};
     auto addr_of{clang::cast<clang::UnaryOperator>(base)};
     auto field{clang::dyn_cast<clang::FieldDecl>(arrow->getMemberDecl())};
-    CHECK(field != nullptr)
+    CHECK_THROW(field != nullptr)
         << "Substituted MemberExpr is not a structure field access!";
     CopyProvenance(addr_of, addr_of->getSubExpr(), dec_ctx.use_provenance);
     return dec_ctx.ast.CreateDot(addr_of->getSubExpr(), field);
@@ -262,12 +264,12 @@ class MemberExprArraySubRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto dot{clang::cast<clang::MemberExpr>(stmt)};
-    CHECK(dot == match)
+    CHECK_THROW(dot == match)
         << "Substituted MemberExpr is not the matched MemberExpr!";
     auto base{dot->getBase()->IgnoreParenImpCasts()};
     auto sub{clang::cast<clang::ArraySubscriptExpr>(base)};
     auto field{clang::dyn_cast<clang::FieldDecl>(dot->getMemberDecl())};
-    CHECK(field != nullptr)
+    CHECK_THROW(field != nullptr)
         << "Substituted MemberExpr is not a structure field access!";
     CopyProvenance(sub, sub->getBase(), dec_ctx.use_provenance);
     return dec_ctx.ast.CreateArrow(sub->getBase(), field);
@@ -293,7 +295,7 @@ class AssignCastedExprRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto assign{clang::cast<clang::BinaryOperator>(stmt)};
-    CHECK(assign == match)
+    CHECK_THROW(assign == match)
         << "Substituted BinaryOperator is not the matched BinaryOperator!";
 
     auto lhs{assign->getLHS()};
@@ -328,7 +330,7 @@ class UnsignedToSignedCStyleCastRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto cast{clang::cast<clang::CStyleCastExpr>(stmt)};
-    CHECK(cast == match)
+    CHECK_THROW(cast == match)
         << "Substituted CStyleCastExpr is not the matched CStyleCastExpr!";
 
     auto subcast{clang::cast<clang::CStyleCastExpr>(
@@ -361,7 +363,7 @@ class TripleCStyleCastElimRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto cast{clang::cast<clang::CStyleCastExpr>(stmt)};
-    CHECK(cast == match)
+    CHECK_THROW(cast == match)
         << "Substituted CStyleCastExpr is not the matched CStyleCastExpr!";
 
     auto &ctx{dec_ctx.ast_ctx};
@@ -399,7 +401,7 @@ class VoidToTypePtrCastElimRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto cast{clang::cast<clang::CStyleCastExpr>(stmt)};
-    CHECK(cast == match)
+    CHECK_THROW(cast == match)
         << "Substituted CStyleCastExpr is not the matched CStyleCastExpr!";
 
     auto subcast{clang::cast<clang::CStyleCastExpr>(
@@ -431,7 +433,7 @@ class CStyleZeroToPtrCastElimRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto cast{clang::cast<clang::CStyleCastExpr>(stmt)};
-    CHECK(cast == match)
+    CHECK_THROW(cast == match)
         << "Substituted CStyleCastExpr is not the matched CStyleCastExpr!";
 
     return cast->getSubExpr()->IgnoreParenImpCasts();
@@ -452,7 +454,7 @@ class CStyleConstElimRule : public InferenceRule {
   clang::Stmt *GetOrCreateSubstitution(DecompilationContext &dec_ctx,
                                        clang::Stmt *stmt) override {
     auto cast{clang::cast<clang::CStyleCastExpr>(stmt)};
-    CHECK(cast == match)
+    CHECK_THROW(cast == match)
         << "Substituted CStyleCastExpr is not the matched CStyleCastExpr!";
 
     auto int_lit{clang::cast<clang::IntegerLiteral>(
@@ -468,37 +470,63 @@ class CStyleConstElimRule : public InferenceRule {
 }  // namespace
 
 ExprCombine::ExprCombine(DecompilationContext &dec_ctx)
-    : TransformVisitor<ExprCombine>(dec_ctx) {}
+    : TransformVisitor<ExprCombine>(dec_ctx) {
+  pre_rules.AddRule("VoidToTypePtrCastElimRule",
+                    std::make_unique<VoidToTypePtrCastElimRule>());
+
+  rules.AddRule("UnsignedToSignedCStyleCastRule",
+                std::make_unique<UnsignedToSignedCStyleCastRule>());
+  rules.AddRule("TripleCStyleCastElimRule",
+                std::make_unique<TripleCStyleCastElimRule>());
+  rules.AddRule("CStyleConstElimRule", std::make_unique<CStyleConstElimRule>());
+
+  rules.AddRule("NegComparisonRule", std::make_unique<NegComparisonRule>());
+  rules.AddRule("DerefAddrOfRule", std::make_unique<DerefAddrOfRule>());
+  rules.AddRule("DerefAddrOfConditionalRule",
+                std::make_unique<DerefAddrOfConditionalRule>());
+  rules.AddRule("AddrOfArraySubscriptRule",
+                std::make_unique<AddrOfArraySubscriptRule>());
+
+  rules.AddRule("AssignCastedExprRule",
+                std::make_unique<AssignCastedExprRule>());
+
+  rules.AddRule("ArraySubscriptAddrOfRule",
+                std::make_unique<ArraySubscriptAddrOfRule>());
+
+  rules.AddRule("MemberExprAddrOfRule",
+                std::make_unique<MemberExprAddrOfRule>());
+  rules.AddRule("MemberExprArraySubRule",
+                std::make_unique<MemberExprArraySubRule>());
+
+  rules.AddRule("ParenDeclRefExprStripRule",
+                std::make_unique<ParenDeclRefExprStripRule>());
+  rules.AddRule("DoubleParenStripRule",
+                std::make_unique<DoubleParenStripRule>());
+}
 
-bool ExprCombine::VisitCStyleCastExpr(clang::CStyleCastExpr *cast) {
+clang::Stmt *ExprCombine::CombineCast(clang::CStyleCastExpr *cast) {
   // TODO(frabert): Re-enable nullptr casts simplification
 
   if (cast->getCastKind() == clang::CastKind::CK_NoOp) {
-    substitutions[cast] = cast->getSubExpr();
-    return true;
+    return cast->getSubExpr();
   }
 
-  std::vector<std::unique_ptr<InferenceRule>> pre_rules;
-
-  pre_rules.emplace_back(new VoidToTypePtrCastElimRule);
-
-  auto pre_sub{ApplyFirstMatchingRule(dec_ctx, cast, pre_rules)};
+  auto pre_sub{pre_rules.ApplyFirstMatchingRule(dec_ctx, cast)};
   if (pre_sub != cast) {
-    substitutions[cast] = pre_sub;
-    return true;
+    return pre_sub;
   }
 
   clang::Expr::EvalResult result;
   if (cast->EvaluateAsRValue(result, dec_ctx.ast_ctx)) {
     if (result.HasSideEffects || result.HasUndefinedBehavior) {
-      return true;
+      return cast;
     }
 
     switch (result.Val.getKind()) {
       case clang::APValue::ValueKind::Int: {
         auto sub{dec_ctx.ast.CreateAdjustedIntLit(result.Val.getInt())};
         if (GetHash(dec_ctx.ast_ctx, cast) != GetHash(dec_ctx.ast_ctx, sub)) {
-          substitutions[cast] = sub;
+          return sub;
         }
       } break;
 
@@ -506,103 +534,63 @@ bool ExprCombine::VisitCStyleCastExpr(clang::CStyleCastExpr *cast) {
         break;
     }
 
-    return true;
-  }
-
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new UnsignedToSignedCStyleCastRule);
-  rules.emplace_back(new TripleCStyleCastElimRule);
-  rules.emplace_back(new CStyleConstElimRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, cast, rules)};
-  if (sub != cast) {
-    substitutions[cast] = sub;
+    return cast;
   }
 
-  return true;
+  return rules.ApplyFirstMatchingRule(dec_ctx, cast);
 }
 
-bool ExprCombine::VisitUnaryOperator(clang::UnaryOperator *op) {
-  // DLOG(INFO) << "VisitUnaryOperator: "
-  //            << op->getOpcodeStr(op->getOpcode()).str();
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new NegComparisonRule);
-  rules.emplace_back(new DerefAddrOfRule);
-  rules.emplace_back(new DerefAddrOfConditionalRule);
-  rules.emplace_back(new AddrOfArraySubscriptRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, op, rules)};
-  if (sub != op) {
-    substitutions[op] = sub;
+clang::Stmt *ExprCombine::Combine(clang::Stmt *stmt) {
+  if (auto cast = clang::dyn_cast<clang::CStyleCastExpr>(stmt)) {
+    return CombineCast(cast);
   }
-
-  return true;
-}
-
-bool ExprCombine::VisitBinaryOperator(clang::BinaryOperator *op) {
-  // DLOG(INFO) << "VisitBinaryOperator: " << op->getOpcodeStr().str();
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new AssignCastedExprRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, op, rules)};
-  if (sub != op) {
-    substitutions[op] = sub;
+  if (clang::isa<clang::UnaryOperator>(stmt) ||
+      clang::isa<clang::BinaryOperator>(stmt) ||
+      clang::isa<clang::ArraySubscriptExpr>(stmt) ||
+      clang::isa<clang::MemberExpr>(stmt) ||
+      clang::isa<clang::ParenExpr>(stmt)) {
+    return rules.ApplyFirstMatchingRule(dec_ctx, stmt);
   }
-
-  return true;
+  return stmt;
 }
 
-bool ExprCombine::VisitArraySubscriptExpr(clang::ArraySubscriptExpr *expr) {
-  // DLOG(INFO) << "VisitArraySubscriptExpr";
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new ArraySubscriptAddrOfRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, expr, rules)};
-  if (sub != expr) {
-    substitutions[expr] = sub;
+clang::Stmt *ExprCombine::Normalize(clang::Stmt *stmt) {
+  while (!normalized.count(stmt)) {
+    auto sub{Combine(stmt)};
+    if (sub == stmt) {
+      break;
+    }
+    // The parts of the old expression that the rule reused are already
+    // normalized, and only the nodes it created need to be rewritten before
+    // the rules are tried again
+    stmt = sub;
+    for (auto it{stmt->child_begin()}; it != stmt->child_end(); ++it) {
+      if (*it && !normalized.count(*it)) {
+        *it = Normalize(*it);
+      }
+    }
   }
-
-  return true;
+  normalized.insert(stmt);
+  return stmt;
 }
 
-bool ExprCombine::VisitMemberExpr(clang::MemberExpr *expr) {
-  // DLOG(INFO) << "VisitMemberExpr";
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new MemberExprAddrOfRule);
-  rules.emplace_back(new MemberExprArraySubRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, expr, rules)};
+bool ExprCombine::VisitExpr(clang::Expr *expr) {
+  auto sub{Normalize(expr)};
   if (sub != expr) {
     substitutions[expr] = sub;
   }
-
   return true;
 }
 
-bool ExprCombine::VisitParenExpr(clang::ParenExpr *expr) {
-  // DLOG(INFO) << "VisitParenExpr";
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new ParenDeclRefExprStripRule);
-  rules.emplace_back(new DoubleParenStripRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, expr, rules)};
-  if (sub != expr) {
-    substitutions[expr] = sub;
-  }
-
-  return true;
+void ExprCombine::BeginTraversal() {
+  TransformVisitor<ExprCombine>::BeginTraversal();
+  normalized.clear();
 }
 
 void ExprCombine::RunImpl() {
-  LOG(INFO) << "Rule-based statement simplification";
   TransformVisitor<ExprCombine>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  normalized.clear();
+  TraverseDirtyFunctions();
 }
 
 }  // namespace rellic
\ No newline at end of file
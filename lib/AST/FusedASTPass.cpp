@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/FusedASTPass.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+namespace rellic {
+
+clang::Stmt *FusedASTPass::Visit(clang::Stmt *stmt) {
+  bool replaced{false};
+  for (auto &child : stmt->children()) {
+    if (!child) {
+      continue;
+    }
+
+    auto new_child{Visit(child)};
+    if (new_child != child) {
+      CopyProvenance(child, new_child, dec_ctx.stmt_provenance);
+      auto from_expr{clang::dyn_cast<clang::Expr>(child)};
+      auto to_expr{clang::dyn_cast_or_null<clang::Expr>(new_child)};
+      if (from_expr && to_expr) {
+        CopyProvenance(from_expr, to_expr, dec_ctx.use_provenance);
+      }
+      if (dec_ctx.journal) {
+        dec_ctx.journal->RecordSlot(child);
+      }
+      child = new_child;
+      replaced = true;
+      changed = true;
+    }
+  }
+  changed_subtrees.Update(dec_ctx, stmt, replaced);
+
+  for (auto &[pass, visitor] : passes) {
+    if (!stmt || Stopped()) {
+      break;
+    }
+    Prover::CallSite site(dec_ctx.prover, pass->GetName());
+    stmt = visitor->VisitNode(stmt);
+  }
+  return stmt;
+}
+
+void FusedASTPass::VisitDecl(clang::Decl *decl) {
+  auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+  if (fdecl && !fdecl->doesThisDeclarationHaveABody()) {
+    return;
+  }
+  if (!fdecl &&
+      std::none_of(passes.begin(), passes.end(), [](auto &pass) {
+        return pass.second->GetTraversalPolicy().globals;
+      })) {
+    return;
+  }
+
+  // Definitions are skipped if none of the passes applies to them. Otherwise
+  // all of them visit the definition, as the rewrites of some may give the
+  // others something to do.
+  auto features{fdecl ? dec_ctx.GetFunctionFeatures(fdecl) : nullptr};
+  if (features &&
+      std::none_of(passes.begin(), passes.end(), [features](auto &pass) {
+        return pass.second->AppliesTo(*features);
+      })) {
+    return;
+  }
+
+  for (auto &[pass, visitor] : passes) {
+    visitor->BeginTraversal();
+  }
+  if (fdecl) {
+    auto body{fdecl->getBody()};
+    auto new_body{Visit(body)};
+    if (new_body != body) {
+      if (dec_ctx.journal) {
+        dec_ctx.journal->RecordBody(fdecl);
+      }
+      fdecl->setBody(new_body);
+      changed = true;
+    }
+  } else if (auto var = clang::dyn_cast<clang::VarDecl>(decl)) {
+    if (auto init = var->getInit()) {
+      auto new_init{Visit(init)};
+      if (new_init != init) {
+        if (dec_ctx.journal) {
+          dec_ctx.journal->RecordInit(var);
+        }
+        var->setInit(clang::cast<clang::Expr>(new_init));
+        changed = true;
+      }
+    }
+  }
+
+  for (auto &[pass, visitor] : passes) {
+    changed |= visitor->EndTraversal();
+  }
+}
+
+void FusedASTPass::RunImpl() {
+  changed_subtrees.Clear();
+  // Mirrors TransformVisitor::TraverseDirtyFunctions
+  auto tudecl{dec_ctx.ast_ctx.getTranslationUnitDecl()};
+  for (auto decl : tudecl->decls()) {
+    if (Stopped()) {
+      break;
+    }
+
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    if (!fdecl || !fdecl->doesThisDeclarationHaveABody()) {
+      if (!dec_ctx.track_function_changes) {
+        VisitDecl(decl);
+      }
+      continue;
+    }
+
+    if (!dec_ctx.IsDirty(fdecl)) {
+      continue;
+    }
+
+    auto old_changed{changed};
+    changed = false;
+    VisitDecl(fdecl);
+    if (changed && dec_ctx.track_function_changes) {
+      dec_ctx.RecordFunctionChange(fdecl);
+    }
+    changed |= old_changed;
+  }
+}
+
+}  // namespace rellic
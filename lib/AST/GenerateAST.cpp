@@ -13,8 +13,10 @@
 #include <glog/logging.h>
 #include <llvm/ADT/DepthFirstIterator.h>
 #include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/SCCIterator.h>
 #include <llvm/Analysis/CFG.h>
 #include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/PostDominators.h>
 #include <llvm/Analysis/RegionInfo.h>
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Module.h>
@@ -23,12 +25,23 @@
 #include <llvm/Support/raw_ostream.h>
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "rellic/AST/ASTBuilder.h"
 #include "rellic/AST/Util.h"
 #include "rellic/BC/Util.h"
 #include "rellic/Exception.h"
+#include "rellic/Trace.h"
 
 namespace rellic {
 
@@ -75,19 +88,6 @@ using StmtVec = std::vector<clang::Stmt *>;
 //   }
 // }
 
-static bool IsRegionBlock(llvm::Region *region, llvm::BasicBlock *block) {
-  return region->getRegionInfo()->getRegionFor(block) == region;
-}
-
-static bool IsSubregionEntry(llvm::Region *region, llvm::BasicBlock *block) {
-  for (auto &subregion : *region) {
-    if (subregion->getEntry() == block) {
-      return true;
-    }
-  }
-  return false;
-}
-
 // static bool IsSubregionExit(llvm::Region *region, llvm::BasicBlock *block) {
 //   for (auto &subregion : *region) {
 //     if (subregion->getExit() == block) {
@@ -97,15 +97,6 @@ static bool IsSubregionEntry(llvm::Region *region, llvm::BasicBlock *block) {
 //   return false;
 // }
 
-static llvm::Region *GetSubregion(llvm::Region *region,
-                                  llvm::BasicBlock *block) {
-  if (!region->contains(block)) {
-    return nullptr;
-  } else {
-    return region->getSubRegionNode(block);
-  }
-}
-
 std::string GetRegionNameStr(llvm::Region *region) {
   std::string exit_name;
   std::string entry_name;
@@ -128,100 +119,184 @@ std::string GetRegionNameStr(llvm::Region *region) {
   return entry_name + " => " + exit_name;
 }
 
+// Counts the distinct nodes of `expr`, stopping as soon as there are more than
+// `limit`
+static unsigned GetCondSize(const z3::expr &expr, unsigned limit) {
+  std::unordered_set<unsigned> visited;
+  std::vector<z3::expr> worklist{expr};
+  while (!worklist.empty() && visited.size() <= limit) {
+    auto node{worklist.back()};
+    worklist.pop_back();
+    if (!visited.insert(node.id()).second || !node.is_app()) {
+      continue;
+    }
+    for (unsigned i{0}; i < node.num_args(); ++i) {
+      worklist.push_back(node.arg(i));
+    }
+  }
+  return visited.size();
+}
+
+// See `FunctionMetrics::memory`
+static size_t GetAllocatedMemory(DecompilationContext &dec_ctx) {
+  return dec_ctx.ast_ctx.getASTAllocatedMemory() +
+         Z3_get_estimated_alloc_size();
+}
+
+static size_t GetMemoryGrowth(DecompilationContext &dec_ctx, size_t start) {
+  auto memory{GetAllocatedMemory(dec_ctx)};
+  return memory > start ? memory - start : 0;
+}
+
+// Keeps the slowest queries of `prover` during its lifetime, along with
+// recording them in its query log, see `DecompilationContext::forensic_queries`
+class SlowQueryScope {
+  Prover &prover;
+  std::shared_ptr<QueryLog> previous;
+
+ public:
+  std::shared_ptr<QueryLog> log;
+
+  SlowQueryScope(Prover &prover, unsigned capacity)
+      : prover(prover), previous(prover.GetQueryLog()) {
+    if (capacity) {
+      log = std::make_shared<QueryLog>(capacity, previous);
+      prover.SetQueryLog(log);
+    }
+  }
+  ~SlowQueryScope() { prover.SetQueryLog(previous); }
+
+  SlowQueryScope(const SlowQueryScope &) = delete;
+  SlowQueryScope &operator=(const SlowQueryScope &) = delete;
+};
+
 }  // namespace
 
-static std::string GetName(llvm::Value *v) {
-  std::string s{"h"};
-  llvm::raw_string_ostream os(s);
-  os.write_hex((unsigned long long)v);
-  return s;
+// Variables are named after the ids of their instructions, which are shared
+// by every context of the decompilation, see `Z3VarIds`
+static z3::symbol GetName(Z3Conditions &conds, llvm::Value *v) {
+  return conds.z3_ctx.int_symbol(conds.z3_var_ids->Get(v));
 }
 
 z3::expr GenerateAST::ToExpr(unsigned idx) {
   if (idx == poison_idx) {
-    return dec_ctx.z3_ctx.bool_val(false);
+    return cond_ctx->z3_ctx.bool_val(false);
   }
-  return dec_ctx.z3_exprs[idx];
+  return cond_ctx->z3_exprs[idx];
 }
 
 unsigned GenerateAST::GetOrCreateEdgeForBranch(llvm::BranchInst *inst,
                                                bool cond) {
-  if (dec_ctx.z3_br_edges.find({inst, cond}) != dec_ctx.z3_br_edges.end()) {
-    return dec_ctx.z3_br_edges[{inst, cond}];
+  auto &cfg{cond_ctx->cfg_conds};
+  auto &idx{cfg.br_edges[cfg.GetBlockId(inst->getParent())][cond]};
+  if (idx != CFGConds::none) {
+    return idx;
   }
 
   if (auto constant = llvm::dyn_cast<llvm::ConstantInt>(inst->getCondition())) {
     // This is a conditional branch with a constant condition, so just emit
     // whether the condition matches the wanted value
-    auto edge{dec_ctx.z3_ctx.bool_val(constant->isOne() == cond)};
-    dec_ctx.z3_br_edges[{inst, cond}] = dec_ctx.InsertZExpr(edge);
-    dec_ctx.z3_br_edges_inv[edge.id()] = {inst, true};
+    auto edge{cond_ctx->z3_ctx.bool_val(constant->isOne() == cond)};
+    idx = cond_ctx->InsertZExpr(edge);
   } else if (cond) {
     // This is a conditional branch, so the expression that is true when the
     // branch is going to be taken is just a new variable.
-    auto name{GetName(inst)};
-    auto edge{dec_ctx.z3_ctx.bool_const(name.c_str())};
-    dec_ctx.z3_br_edges[{inst, cond}] = dec_ctx.InsertZExpr(edge);
-    dec_ctx.z3_br_edges_inv[edge.id()] = {inst, true};
+    auto &z3_ctx{cond_ctx->z3_ctx};
+    auto edge{z3_ctx.constant(GetName(*cond_ctx, inst), z3_ctx.bool_sort())};
+    idx = cond_ctx->InsertZExpr(edge);
+    cond_ctx->z3_br_edges_inv[edge.id()] = {inst, true};
+    cond_ctx->z3_vars.push_back(edge);
   } else {
     // Like the previous case, but in this case we want to know the expression
     // that will be true when the branch is not going to be taken
     auto edge{!(ToExpr(GetOrCreateEdgeForBranch(inst, true)))};
-    dec_ctx.z3_br_edges[{inst, cond}] = dec_ctx.InsertZExpr(edge);
+    idx = cond_ctx->InsertZExpr(edge);
   }
 
-  return dec_ctx.z3_br_edges[{inst, cond}];
+  return idx;
 }
 
 unsigned GenerateAST::GetOrCreateVarForSwitch(llvm::SwitchInst *inst) {
   // To aide simplification, switch instructions actually produce numerical
-  // variables instead of boolean ones, but are always compared against a
-  // constant value.
-  if (dec_ctx.z3_sw_vars.find(inst) != dec_ctx.z3_sw_vars.end()) {
-    return dec_ctx.z3_sw_vars[inst];
+  // variables instead of boolean ones, whose values stand for the cases of the
+  // switch, see `GetSwitchCases`. They are only ever compared against constant
+  // values.
+  auto &cfg{cond_ctx->cfg_conds};
+  auto &idx{cfg.sw_vars[cfg.GetBlockId(inst->getParent())]};
+  if (idx != CFGConds::none) {
+    return idx;
   }
 
-  auto name{GetName(inst)};
-  auto var{dec_ctx.z3_ctx.int_const(name.c_str())};
-  dec_ctx.z3_sw_vars[inst] = dec_ctx.InsertZExpr(var);
-  dec_ctx.z3_sw_vars_inv[var.id()] = inst;
-  return dec_ctx.z3_sw_vars[inst];
+  auto &z3_ctx{cond_ctx->z3_ctx};
+  auto var{z3_ctx.constant(GetName(*cond_ctx, inst), z3_ctx.int_sort())};
+  idx = cond_ctx->InsertZExpr(var);
+  cond_ctx->z3_sw_vars_inv[var.id()] = inst;
+  cond_ctx->z3_vars.push_back(var);
+  return idx;
 }
 
 unsigned GenerateAST::GetOrCreateEdgeForSwitch(llvm::SwitchInst *inst,
-                                               llvm::ConstantInt *c) {
-  if (dec_ctx.z3_sw_edges.find({inst, c}) != dec_ctx.z3_sw_edges.end()) {
-    return dec_ctx.z3_sw_edges[{inst, c}];
+                                               unsigned case_idx) {
+  auto &cfg{cond_ctx->cfg_conds};
+  auto offset{cfg.sw_offsets[cfg.GetBlockId(inst->getParent())]};
+  auto is_default{case_idx == llvm::SwitchInst::DefaultPseudoIndex};
+  auto slot{offset + (is_default ? inst->getNumCases() : case_idx)};
+  if (cfg.sw_edges[slot] != CFGConds::none) {
+    return cfg.sw_edges[slot];
   }
 
-  unsigned idx;
-  if (c) {
-    auto sw_case{inst->findCaseValue(c)};
-    auto var{ToExpr(GetOrCreateVarForSwitch(inst))};
-    auto expr{var == dec_ctx.z3_ctx.int_val(sw_case->getCaseIndex())};
+  auto &z3_ctx{cond_ctx->z3_ctx};
+  auto var{ToExpr(GetOrCreateVarForSwitch(inst))};
+  if (is_default) {
+    // Any value that does not stand for a case stands for the default case, so
+    // its condition has the same size however many cases there are
+    auto num_cases{inst->getNumCases()};
+    auto expr{num_cases ? var < 0 || var >= z3_ctx.int_val(num_cases)
+                        : z3_ctx.bool_val(true)};
+    cfg.sw_edges[slot] = cond_ctx->InsertZExpr(expr);
+    return cfg.sw_edges[slot];
+  }
 
-    idx = dec_ctx.InsertZExpr(expr);
-  } else {
-    // Default case
-    z3::expr_vector vec{dec_ctx.z3_ctx};
-    for (auto sw_case : inst->cases()) {
-      vec.push_back(
-          !ToExpr(GetOrCreateEdgeForSwitch(inst, sw_case.getCaseValue())));
-    }
-    idx = dec_ctx.InsertZExpr(z3::mk_and(vec));
+  // The cases that go to the same successor are a single range of values, and
+  // they all share its condition
+  auto cases{GetSwitchCases(inst)};
+  auto succ{llvm::SwitchInst::CaseHandle(inst, case_idx).getCaseSuccessor()};
+  unsigned first{0};
+  while (cases[first].getCaseSuccessor() != succ) {
+    ++first;
+  }
+  auto last{first};
+  while (last + 1 < cases.size() &&
+         cases[last + 1].getCaseSuccessor() == succ) {
+    ++last;
+  }
+  auto expr{first == last ? var == z3_ctx.int_val(first)
+                          : var >= z3_ctx.int_val(first) &&
+                                var <= z3_ctx.int_val(last)};
+  auto idx{cond_ctx->InsertZExpr(expr)};
+  for (auto i{first}; i <= last; ++i) {
+    cfg.sw_edges[offset + cases[i].getCaseIndex()] = idx;
   }
-  dec_ctx.z3_sw_edges[{inst, c}] = idx;
   return idx;
 }
 
+z3::expr GenerateAST::SimplifyCond(const z3::expr &cond) {
+  return is_large ? cond_ctx->prover.Rewrite(cond)
+                  : cond_ctx->prover.Simplify(cond);
+}
+
 unsigned GenerateAST::GetOrCreateEdgeCond(llvm::BasicBlock *from,
                                           llvm::BasicBlock *to) {
-  if (dec_ctx.z3_edges.find({from, to}) != dec_ctx.z3_edges.end()) {
-    return dec_ctx.z3_edges[{from, to}];
+  auto &cfg{cond_ctx->cfg_conds};
+  std::pair<unsigned, unsigned> edge{cfg.GetBlockId(from), cfg.GetBlockId(to)};
+  auto it{cfg.edges.find(edge)};
+  if (it != cfg.edges.end()) {
+    return it->second;
   }
 
+  Prover::CallSite site(cond_ctx->prover, "GenerateAST::GetOrCreateEdgeCond");
   // Construct the edge condition for CFG edge `(from, to)`
-  auto result{dec_ctx.z3_ctx.bool_val(true)};
+  auto result{cond_ctx->z3_ctx.bool_val(true)};
   auto term = from->getTerminator();
   switch (term->getOpcode()) {
     // Conditional branches
@@ -235,18 +310,20 @@ unsigned GenerateAST::GetOrCreateEdgeCond(llvm::BasicBlock *from,
     // Switches
     case llvm::Instruction::Switch: {
       auto sw{llvm::cast<llvm::SwitchInst>(term)};
+      z3::expr_vector or_vec{cond_ctx->z3_ctx};
       if (to == sw->getDefaultDest()) {
-        result = ToExpr(GetOrCreateEdgeForSwitch(sw, nullptr));
-      } else {
-        z3::expr_vector or_vec{dec_ctx.z3_ctx};
-        for (auto sw_case : sw->cases()) {
-          if (sw_case.getCaseSuccessor() == to) {
-            or_vec.push_back(
-                ToExpr(GetOrCreateEdgeForSwitch(sw, sw_case.getCaseValue())));
-          }
+        or_vec.push_back(ToExpr(GetOrCreateEdgeForSwitch(
+            sw, llvm::SwitchInst::DefaultPseudoIndex)));
+      }
+      // All the cases that go to `to` share the same condition
+      for (auto sw_case : sw->cases()) {
+        if (sw_case.getCaseSuccessor() == to) {
+          or_vec.push_back(
+              ToExpr(GetOrCreateEdgeForSwitch(sw, sw_case.getCaseIndex())));
+          break;
         }
-        result = HeavySimplify(z3::mk_or(or_vec));
       }
+      result = or_vec.size() == 1 ? or_vec[0] : SimplifyCond(z3::mk_or(or_vec));
     } break;
     // Returns
     case llvm::Instruction::Ret:
@@ -267,48 +344,119 @@ unsigned GenerateAST::GetOrCreateEdgeCond(llvm::BasicBlock *from,
       break;
   }
 
-  dec_ctx.z3_edges[{from, to}] = dec_ctx.InsertZExpr(result.simplify());
-  return dec_ctx.z3_edges[{from, to}];
+  auto idx{cond_ctx->InsertZExpr(cond_ctx->prover.Rewrite(result))};
+  cfg.edges[edge] = idx;
+  return idx;
 }
 
 unsigned GenerateAST::GetReachingCond(llvm::BasicBlock *block) {
-  if (dec_ctx.reaching_conds.find(block) == dec_ctx.reaching_conds.end()) {
-    return poison_idx;
+  // Missing conditions are `CFGConds::none`, which is also the poison index
+  auto &cfg{cond_ctx->cfg_conds};
+  return cfg.reaching_conds[cfg.GetBlockId(block)];
+}
+
+z3::expr GenerateAST::GetCondInUnit(unsigned unit, llvm::BasicBlock *block) {
+  auto &cfg{cond_ctx->cfg_conds};
+  auto cond{ToExpr(GetReachingCond(block))};
+  // Units are single-entry, so reaching a block of a nested unit means
+  // reaching its entry first
+  for (auto u{block_units[GetBlockId(block)]}; u && u != unit;
+       u = units[u].parent) {
+    cond = ToExpr(cfg.entry_conds[units[u].entry]) && cond;
   }
+  return cond;
+}
 
-  return dec_ctx.reaching_conds[block];
+unsigned GenerateAST::GetRegionCond(llvm::Region *region,
+                                    llvm::BasicBlock *block) {
+  auto id{GetBlockId(block)};
+  if (IsUnitEntry(id) && region_units.lookup(region) != block_units[id]) {
+    return cond_ctx->cfg_conds.entry_conds[id];
+  }
+  return GetReachingCond(block);
 }
 
-void GenerateAST::CreateReachingCond(llvm::BasicBlock *block) {
-  auto old_cond_idx{GetReachingCond(block)};
+bool GenerateAST::CreateReachingCond(llvm::BasicBlock *block) {
+  Prover::CallSite site(cond_ctx->prover, "GenerateAST::CreateReachingCond");
+  auto &cfg{cond_ctx->cfg_conds};
+  auto id{cfg.GetBlockId(block)};
+  // The condition of the entry of a unit is computed within the enclosing
+  // unit, as the entry is always reached within its own
+  auto unit{block_units[id]};
+  auto is_entry{IsUnitEntry(id)};
+  if (is_entry) {
+    unit = units[unit].parent;
+  }
+  auto &reaching_cond{is_entry ? cfg.entry_conds[id] : cfg.reaching_conds[id]};
+  auto old_cond_idx{reaching_cond};
+  auto source{reach_sources[id]};
+  if (source != CFGConds::none) {
+    auto cond_idx{cfg.reaching_conds[source]};
+    if (cond_idx == old_cond_idx) {
+      return false;
+    }
+    reaching_cond = cond_idx;
+    return true;
+  }
+
   auto old_cond{ToExpr(old_cond_idx)};
   if (block->hasNPredecessorsOrMore(1)) {
     // Gather reaching conditions from predecessors of the block
-    z3::expr_vector conds{dec_ctx.z3_ctx};
+    z3::expr_vector conds{cond_ctx->z3_ctx};
     for (auto pred : llvm::predecessors(block)) {
-      auto pred_cond{ToExpr(GetReachingCond(pred))};
+      auto pred_cond{GetCondInUnit(unit, pred)};
       auto edge_cond{ToExpr(GetOrCreateEdgeCond(pred, block))};
       // Construct reaching condition from `pred` to `block` as
       // `reach_cond[pred] && edge_cond(pred, block)` or one of
       // the two if the other one is missing.
-      auto conj_cond{HeavySimplify(pred_cond && edge_cond)};
+      auto conj_cond{SimplifyCond(pred_cond && edge_cond)};
       // Append `conj_cond` to reaching conditions of other
       // predecessors via an `||`. Use `conj_cond` if there
       // is no `cond` yet.
       conds.push_back(conj_cond);
     }
 
-    auto cond{HeavySimplify(z3::mk_or(conds))};
-    if (old_cond_idx == poison_idx || !Prove(old_cond == cond)) {
-      dec_ctx.reaching_conds[block] = dec_ctx.InsertZExpr(cond);
-      reaching_conds_changed = true;
+    auto cond{SimplifyCond(z3::mk_or(conds))};
+    auto &var_idx{reach_vars[id]};
+    if (var_idx != CFGConds::none) {
+      // The conditions of other blocks refer to the variable rather than to
+      // its definition, so they do not change along with it
+      auto &def_idx{cond_ctx->z3_reach_defs.at(old_cond.id())};
+      if (!cond_ctx->prover.Prove(ToExpr(def_idx) == cond)) {
+        def_idx = cond_ctx->InsertZExpr(cond);
+      }
+      return false;
+    }
+
+    if (old_cond_idx == poison_idx ||
+        !cond_ctx->prover.Prove(old_cond == cond)) {
+      if (ShouldAbstract(block, cond)) {
+        // Variables are named after their block, as the conditions of units
+        // computed in different contexts are merged into one
+        auto name{"reach_" + std::to_string(cond_ctx->z3_var_ids->Get(block))};
+        auto var{cond_ctx->z3_ctx.bool_const(name.c_str())};
+        var_idx = cond_ctx->InsertZExpr(var);
+        cond_ctx->z3_vars.push_back(var);
+        cond_ctx->z3_reach_defs[var.id()] = cond_ctx->InsertZExpr(cond);
+        reaching_cond = var_idx;
+      } else {
+        reaching_cond = cond_ctx->InsertZExpr(cond);
+      }
+      return true;
     }
-  } else if (dec_ctx.reaching_conds.find(block) ==
-             dec_ctx.reaching_conds.end()) {
-    dec_ctx.reaching_conds[block] =
-        dec_ctx.InsertZExpr(dec_ctx.z3_ctx.bool_val(true));
-    reaching_conds_changed = true;
+  } else if (old_cond_idx == poison_idx) {
+    reaching_cond = cond_ctx->InsertZExpr(cond_ctx->z3_ctx.bool_val(true));
+    return true;
   }
+  return false;
+}
+
+bool GenerateAST::ShouldAbstract(llvm::BasicBlock *block,
+                                 const z3::expr &cond) {
+  auto limit{dec_ctx.reach_var_size};
+  auto id{GetBlockId(block)};
+  return limit && !cyclic_blocks.test(id) && !entry_regions[id].empty() &&
+         !IsUnitEntry(id) && GetCondSize(cond, limit) > limit;
 }
 
 StmtVec GenerateAST::CreateBasicBlockStmts(llvm::BasicBlock *block) {
@@ -332,14 +480,14 @@ StmtVec GenerateAST::CreateRegionStmts(llvm::Region *region) {
     clang::CompoundStmt *compound = nullptr;
     StmtVec epi_body;
     if (subregion) {
-      CHECK(compound = region_stmts[subregion]);
+      CHECK_THROW((compound = region_stmts[subregion]));
     } else {
       // Create a compound, wrapping the block
       auto block_body = CreateBasicBlockStmts(block);
       compound = ast.CreateCompoundStmt(block_body);
     }
     // Gate the compound behind a reaching condition
-    auto z_expr{GetReachingCond(block)};
+    auto z_expr{GetRegionCond(region, block)};
     block_stmts[block] = ast.CreateIf(dec_ctx.marker_expr, compound);
     dec_ctx.conds[block_stmts[block]] =
         dec_ctx.InsertZExpr(dec_ctx.z3_exprs[z_expr]);
@@ -349,26 +497,164 @@ StmtVec GenerateAST::CreateRegionStmts(llvm::Region *region) {
   return result;
 }
 
-void GenerateAST::RefineLoopSuccessors(llvm::Loop *loop, BBSet &members,
-                                       BBSet &successors) {
+void GenerateAST::NumberRegions(llvm::Function &func) {
+  blocks.clear();
+  block_regions.clear();
+  for (auto &block : func) {
+    CHECK_THROW(GetBlockId(&block) == blocks.size());
+    blocks.push_back(&block);
+    block_regions.push_back(regions->getRegionFor(&block));
+  }
+  entry_regions.assign(blocks.size(), {});
+  std::function<void(llvm::Region *)> AddSubregions;
+  AddSubregions = [&](llvm::Region *region) {
+    for (auto &subregion : *region) {
+      entry_regions[GetBlockId(subregion->getEntry())].push_back(
+          {region, &*subregion});
+      AddSubregions(&*subregion);
+    }
+  };
+  AddSubregions(regions->getTopLevelRegion());
+
+  cyclic_blocks.clear();
+  cyclic_blocks.resize(blocks.size());
+  reach_vars.assign(blocks.size(), CFGConds::none);
+  for (auto scc{llvm::scc_begin(&func)}; !scc.isAtEnd(); ++scc) {
+    if (scc.hasCycle()) {
+      for (auto block : *scc) {
+        cyclic_blocks.set(GetBlockId(block));
+      }
+    }
+  }
+  NumberUnits();
+}
+
+void GenerateAST::NumberUnits() {
+  auto top{regions->getTopLevelRegion()};
+  auto top_entry{GetBlockId(top->getEntry())};
+  units.assign(1, {top, 0, top_entry});
+  region_units.clear();
+  region_units[top] = 0;
+  block_units.assign(blocks.size(), 0);
+  auto limit{dec_ctx.region_unit_size};
+  if (!limit || blocks.size() <= limit) {
+    return;
+  }
+
+  // Number of blocks of each region, including those of its subregions
+  llvm::DenseMap<llvm::Region *, unsigned> sizes;
+  for (auto region : block_regions) {
+    ++sizes[region];
+  }
+  std::function<unsigned(llvm::Region *)> Measure;
+  Measure = [&](llvm::Region *region) {
+    unsigned size{sizes.lookup(region)};
+    for (auto &subregion : *region) {
+      size += Measure(&*subregion);
+    }
+    sizes[region] = size;
+    return size;
+  };
+  Measure(top);
+
+  // Regions become units from the outside in, so that of the regions that
+  // share an entry only the outermost one does
+  llvm::BitVector entries(blocks.size());
+  entries.set(top_entry);
+  std::function<void(llvm::Region *, unsigned)> AddUnits;
+  AddUnits = [&](llvm::Region *region, unsigned unit) {
+    for (auto &child : *region) {
+      auto subregion{&*child};
+      auto entry{GetBlockId(subregion->getEntry())};
+      auto sub_unit{unit};
+      if (sizes.lookup(subregion) >= limit && !entries.test(entry)) {
+        entries.set(entry);
+        sub_unit = units.size();
+        units.push_back({subregion, unit, entry});
+      }
+      region_units[subregion] = sub_unit;
+      AddUnits(subregion, sub_unit);
+    }
+  };
+  AddUnits(top, 0);
+  for (unsigned id{0}; id < blocks.size(); ++id) {
+    block_units[id] = region_units.lookup(block_regions[id]);
+  }
+}
+
+void GenerateAST::FindReachSources() {
+  // A path from a block to another one that it reaches, but that does not
+  // reach it back, only goes through blocks that come between the two in
+  // reverse post-order. If none of those blocks is part of a cycle, every path
+  // from the dominator to the block is acyclic, and since the edge conditions
+  // of every terminator add up to `true`, the paths add up to the condition of
+  // the dominator.
+  reach_sources.assign(blocks.size(), CFGConds::none);
+  std::vector<unsigned> rpo_index(blocks.size(), CFGConds::none);
+  // Number of cyclic blocks before each position of the walk
+  std::vector<unsigned> num_cyclic(rpo_walk.size() + 1, 0);
+  for (unsigned i{0}; i < rpo_walk.size(); ++i) {
+    auto id{GetBlockId(rpo_walk[i])};
+    rpo_index[id] = i;
+    num_cyclic[i + 1] = num_cyclic[i] + cyclic_blocks.test(id);
+  }
+  for (unsigned i{0}; i < rpo_walk.size(); ++i) {
+    auto block{rpo_walk[i]};
+    auto idom{domtree->getNode(block)->getIDom()};
+    if (!idom) {
+      continue;
+    }
+    auto dom{idom->getBlock()};
+    auto dom_id{GetBlockId(dom)};
+    // Conditions are only shared within a unit
+    auto id{GetBlockId(block)};
+    if (IsUnitEntry(id) || block_units[id] != block_units[dom_id]) {
+      continue;
+    }
+    if (num_cyclic[i + 1] == num_cyclic[rpo_index[dom_id]] &&
+        postdomtree->dominates(block, dom)) {
+      reach_sources[id] = dom_id;
+    }
+  }
+}
+
+llvm::Region *GenerateAST::GetSubregion(llvm::Region *region,
+                                        llvm::BasicBlock *block) const {
+  for (auto [parent, subregion] : entry_regions[GetBlockId(block)]) {
+    if (parent == region) {
+      return subregion;
+    }
+  }
+  return nullptr;
+}
+
+void GenerateAST::RefineLoopSuccessors(llvm::Loop *loop, BlockSet &members,
+                                       BlockSet &successors) {
   // Initialize loop members
-  members.insert(loop->block_begin(), loop->block_end());
+  members.resize(blocks.size());
+  for (auto block : loop->blocks()) {
+    members.set(GetBlockId(block));
+  }
   // Initialize loop successors
+  successors.resize(blocks.size());
   llvm::SmallVector<llvm::BasicBlock *, 1> exits;
   loop->getExitBlocks(exits);
-  successors.insert(exits.begin(), exits.end());
+  for (auto block : exits) {
+    successors.set(GetBlockId(block));
+  }
   auto header = loop->getHeader();
   auto region = regions->getRegionFor(header);
   auto exit = region->getExit();
   // Loop membership test
-  auto IsLoopMember = [&members](llvm::BasicBlock *block) {
-    return members.count(block) > 0;
+  auto IsLoopMember = [this, &members](llvm::BasicBlock *block) {
+    return members.test(GetBlockId(block));
   };
   // Refinement
   auto new_blocks = successors;
-  while (successors.size() > 1 && !new_blocks.empty()) {
-    new_blocks.clear();
-    for (auto block : BBSet(successors)) {
+  while (successors.count() > 1 && new_blocks.any()) {
+    new_blocks.reset();
+    for (auto id : BlockSet(successors).set_bits()) {
+      auto block{blocks[id]};
       if (block == exit) {
         // Don't remove this block from the list of successors if it is the
         // direct exit of the region
@@ -379,21 +665,21 @@ void GenerateAST::RefineLoopSuccessors(llvm::Loop *loop, BBSet &members,
       if (std::all_of(llvm::pred_begin(block), llvm::pred_end(block),
                       IsLoopMember)) {
         // Add `block` as a loop member
-        members.insert(block);
+        members.set(id);
         // Remove it as a loop successor
-        successors.erase(block);
+        successors.reset(id);
         // Add a successor of `block` to the set of discovered blocks if
         // if it is a region member, if it is NOT a loop member and if
         // the loop header dominates it.
         for (auto succ : llvm::successors(block)) {
           if (IsRegionBlock(region, succ) && !IsLoopMember(succ) &&
               domtree->dominates(header, succ)) {
-            new_blocks.insert(succ);
+            new_blocks.set(GetBlockId(succ));
           }
         }
       }
     }
-    successors.insert(new_blocks.begin(), new_blocks.end());
+    successors |= new_blocks;
   }
 }
 
@@ -416,13 +702,13 @@ clang::CompoundStmt *GenerateAST::StructureCyclicRegion(llvm::Region *region) {
     return ast.CreateCompoundStmt(region_body);
   }
   // Refine loop members and successors without invalidating LoopInfo
-  BBSet members, successors;
+  BlockSet members, successors;
   RefineLoopSuccessors(loop, members, successors);
   // Construct the initial loop body
   StmtVec loop_body;
   for (auto block : rpo_walk) {
-    if (members.count(block)) {
-      if (IsRegionBlock(region, block) || IsSubregionEntry(region, block)) {
+    if (members.test(GetBlockId(block))) {
+      if (IsRegionBlock(region, block) || GetSubregion(region, block)) {
         auto stmt = block_stmts[block];
         auto it = std::find(region_body.begin(), region_body.end(), stmt);
         region_body.erase(it);
@@ -432,9 +718,10 @@ clang::CompoundStmt *GenerateAST::StructureCyclicRegion(llvm::Region *region) {
   }
   // Get loop exit edges
   std::vector<BBEdge> exits;
-  for (auto succ : successors) {
+  for (auto id : successors.set_bits()) {
+    auto succ{blocks[id]};
     for (auto pred : llvm::predecessors(succ)) {
-      if (members.count(pred)) {
+      if (members.test(GetBlockId(pred))) {
         exits.push_back({pred, succ});
       }
     }
@@ -445,15 +732,16 @@ clang::CompoundStmt *GenerateAST::StructureCyclicRegion(llvm::Region *region) {
     auto to = edge.second;
     // Find the statement corresponding to the exiting block
     auto it = std::find(loop_body.begin(), loop_body.end(), block_stmts[from]);
-    CHECK(it != loop_body.end());
+    CHECK_THROW(it != loop_body.end());
     // Create a loop exiting `break` statement
     StmtVec break_stmt({ast.CreateBreak()});
     auto exit_stmt =
         ast.CreateIf(dec_ctx.marker_expr, ast.CreateCompoundStmt(break_stmt));
     // Create edge condition
-    dec_ctx.conds[exit_stmt] = dec_ctx.InsertZExpr(
-        (ToExpr(GetReachingCond(from)) && ToExpr(GetOrCreateEdgeCond(from, to)))
-            .simplify());
+    auto exit_cond{ToExpr(GetRegionCond(region, from)) &&
+                   ToExpr(GetOrCreateEdgeCond(from, to))};
+    dec_ctx.conds[exit_stmt] =
+        dec_ctx.InsertZExpr(dec_ctx.prover.Rewrite(exit_cond));
     // Insert it after the exiting block statement
     loop_body.insert(std::next(it), exit_stmt);
   }
@@ -512,8 +800,131 @@ clang::CompoundStmt *GenerateAST::StructureSwitchRegion(llvm::Region *region) {
   return ast.CreateCompoundStmt(body);
 }
 
+clang::LabelDecl *GenerateAST::CreateLabel(llvm::Function *func) {
+  auto fdecl{clang::cast<clang::FunctionDecl>(dec_ctx.value_decls[func])};
+  return ast.CreateLabelDecl(fdecl, "label_" + std::to_string(num_labels++));
+}
+
+clang::LabelDecl *GenerateAST::GetOrCreateLabel(llvm::BasicBlock *block) {
+  auto &label{labels[block]};
+  if (!label) {
+    label = CreateLabel(block->getParent());
+  }
+  return label;
+}
+
+bool GenerateAST::ExceedsCondSize(llvm::Region *region) {
+  if (!dec_ctx.goto_cond_size) {
+    return false;
+  }
+
+  for (auto block : rpo_walk) {
+    if (!GetSubregion(region, block) && !IsRegionBlock(region, block)) {
+      continue;
+    }
+    auto cond{ToExpr(GetRegionCond(region, block))};
+    if (GetCondSize(cond, dec_ctx.goto_cond_size) > dec_ctx.goto_cond_size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+clang::CompoundStmt *GenerateAST::StructureGotoRegion(llvm::Region *region,
+                                                      bool flatten) {
+  DLOG(INFO) << "Region " << GetRegionNameStr(region)
+             << " is structured with gotos";
+  std::vector<llvm::BasicBlock *> elems;
+  for (auto block : rpo_walk) {
+    if (flatten ? region->contains(block)
+                : GetSubregion(region, block) || IsRegionBlock(region, block)) {
+      elems.push_back(block);
+    }
+  }
+  // Control flow that leaves the region jumps to its end
+  auto func{region->getEntry()->getParent()};
+  clang::LabelDecl *exit_label{nullptr};
+  auto GetTarget = [&](llvm::BasicBlock *block) {
+    if (block != region->getExit()) {
+      return GetOrCreateLabel(block);
+    }
+    if (!exit_label) {
+      exit_label = CreateLabel(func);
+    }
+    return exit_label;
+  };
+  // Statements of each element, without labels. Whether an element needs a
+  // label is only known once all jumps have been created.
+  std::vector<StmtVec> elem_stmts(elems.size());
+  for (size_t i{0}; i < elems.size(); ++i) {
+    auto block{elems[i]};
+    auto &stmts{elem_stmts[i]};
+    // Jumps to the next element are left implicit
+    auto next{i + 1 < elems.size() ? elems[i + 1] : region->getExit()};
+    auto AddGoto = [&](llvm::BasicBlock *target) {
+      if (target != next) {
+        stmts.push_back(ast.CreateGoto(GetTarget(target)));
+      }
+    };
+
+    auto subregion{flatten ? nullptr : GetSubregion(region, block)};
+    if (subregion) {
+      CHECK_THROW(region_stmts[subregion]);
+      stmts.push_back(region_stmts[subregion]);
+      if (auto exit = subregion->getExit()) {
+        AddGoto(exit);
+      }
+      continue;
+    }
+
+    stmts = CreateBasicBlockStmts(block);
+    std::vector<llvm::BasicBlock *> succs;
+    for (auto succ : llvm::successors(block)) {
+      if (std::find(succs.begin(), succs.end(), succ) == succs.end()) {
+        succs.push_back(succ);
+      }
+    }
+    // The default destination of a switch is its first successor, but it is
+    // only taken if no case matches
+    if (llvm::isa<llvm::SwitchInst>(block->getTerminator())) {
+      std::rotate(succs.begin(), std::next(succs.begin()), succs.end());
+    }
+    // Every successor but the last one is jumped to if its edge is taken
+    for (size_t j{0}; j + 1 < succs.size(); ++j) {
+      StmtVec goto_stmt({ast.CreateGoto(GetTarget(succs[j]))});
+      auto jump{
+          ast.CreateIf(dec_ctx.marker_expr, ast.CreateCompoundStmt(goto_stmt))};
+      dec_ctx.conds[jump] =
+          dec_ctx.InsertZExpr(ToExpr(GetOrCreateEdgeCond(block, succs[j])));
+      stmts.push_back(jump);
+    }
+    if (!succs.empty()) {
+      AddGoto(succs.back());
+    }
+  }
+
+  StmtVec region_body;
+  for (size_t i{0}; i < elems.size(); ++i) {
+    auto block{elems[i]};
+    // The label of a subregion entry may already be inside the subregion
+    if (labels.count(block) && placed_labels.insert(block).second) {
+      region_body.push_back(
+          ast.CreateLabelStmt(labels[block], ast.CreateNullStmt()));
+    }
+    region_body.insert(region_body.end(), elem_stmts[i].begin(),
+                       elem_stmts[i].end());
+  }
+  if (exit_label) {
+    region_body.push_back(
+        ast.CreateLabelStmt(exit_label, ast.CreateNullStmt()));
+  }
+  return ast.CreateCompoundStmt(region_body);
+}
+
 clang::CompoundStmt *GenerateAST::StructureRegion(llvm::Region *region) {
   DLOG(INFO) << "Structuring region " << GetRegionNameStr(region);
+  llvm::TimeTraceScope trace("StructureRegion",
+                             [region]() { return GetRegionNameStr(region); });
   auto &region_stmt = region_stmts[region];
   if (region_stmt) {
     LOG(WARNING) << "Asking to re-structure region: "
@@ -521,6 +932,14 @@ clang::CompoundStmt *GenerateAST::StructureRegion(llvm::Region *region) {
                  << "; returning current region instead";
     return region_stmt;
   }
+  // Regions whose subregions were not all matched at first may match now
+  if (dec_ctx.structuring == StructuringEngine::Patterns &&
+      !unmatched_regions.count(region)) {
+    if ((region_stmt = StructurePatternRegion(region))) {
+      return region_stmt;
+    }
+  }
+
   bool is_cyclic{loops->isLoopHeader(region->getEntry())};
   if (llvm::isa<llvm::SwitchInst>(region->getEntry()->getTerminator()) &&
       !GetSubregion(region, region->getEntry()) && !is_cyclic) {
@@ -528,16 +947,354 @@ clang::CompoundStmt *GenerateAST::StructureRegion(llvm::Region *region) {
     return region_stmt;
   }
 
+  // Conditions that are too large to be worth simplifying and refining
+  if (ExceedsCondSize(region)) {
+    region_stmt = StructureGotoRegion(region, /*flatten=*/false);
+    return region_stmt;
+  }
+
   // Structure
   region_stmt = is_cyclic ? StructureCyclicRegion(region)
                           : StructureAcyclicRegion(region);
   return region_stmt;
 }
 
+GenerateAST::PatternJump GenerateAST::GetPatternJump(
+    llvm::BasicBlock *block) const {
+  // `break` leaves the innermost switch rather than the innermost loop, while
+  // `continue` is not affected by switches
+  const PatternFrame *inner_loop{nullptr};
+  bool in_switch{false};
+  for (auto it{pattern_frames.rbegin()}; it != pattern_frames.rend(); ++it) {
+    if (!it->loop) {
+      in_switch |= !inner_loop;
+    } else if (!inner_loop) {
+      inner_loop = &*it;
+      if (block == it->loop->getHeader()) {
+        return PatternJump::Continue;
+      }
+      if (block == it->exit) {
+        return in_switch ? PatternJump::Invalid : PatternJump::Break;
+      }
+    } else if (block == it->loop->getHeader() || block == it->exit) {
+      // Jumps out of several loops at once
+      return PatternJump::Invalid;
+    }
+  }
+  return PatternJump::None;
+}
+
+llvm::BasicBlock *GenerateAST::GetPatternJoin(llvm::BasicBlock *block) const {
+  auto node{postdomtree->getNode(block)};
+  auto ipdom{node && node->getIDom() ? node->getIDom()->getBlock() : nullptr};
+  for (auto it{pattern_frames.rbegin()}; ipdom && it != pattern_frames.rend();
+       ++it) {
+    if (it->loop) {
+      return it->loop->contains(ipdom) ? ipdom : nullptr;
+    }
+  }
+  return ipdom;
+}
+
+bool GenerateAST::StructurePatternSeq(llvm::BasicBlock *block,
+                                      llvm::BasicBlock *stop,
+                                      StmtVec &stmts) {
+  while (block != stop) {
+    switch (GetPatternJump(block)) {
+      case PatternJump::Continue:
+        stmts.push_back(ast.CreateContinue());
+        return true;
+      case PatternJump::Break:
+        stmts.push_back(ast.CreateBreak());
+        return true;
+      case PatternJump::Invalid:
+        return false;
+      case PatternJump::None:
+        break;
+    }
+    // Control flow that leaves the region before joining, or that reaches a
+    // block from two places, is not structured
+    auto id{GetBlockId(block)};
+    if (block == pattern_region->getExit() || pattern_blocks.test(id)) {
+      return false;
+    }
+    pattern_blocks.set(id);
+
+    if (auto subregion = GetSubregion(pattern_region, block)) {
+      auto it{region_stmts.find(subregion)};
+      if (it == region_stmts.end() || !it->second) {
+        return false;
+      }
+      stmts.insert(stmts.end(), it->second->body_begin(),
+                   it->second->body_end());
+      block = subregion->getExit();
+      continue;
+    }
+    if (!IsRegionBlock(pattern_region, block)) {
+      return false;
+    }
+
+    llvm::BasicBlock *next{nullptr};
+    auto matched{loops->isLoopHeader(block)
+                     ? StructurePatternLoop(block, stmts, next)
+                     : StructurePatternBlock(block, stmts, next)};
+    if (!matched) {
+      return false;
+    }
+    // Every path has ended in a return or a jump
+    if (!next) {
+      return true;
+    }
+    block = next;
+  }
+  return true;
+}
+
+bool GenerateAST::StructurePatternBlock(llvm::BasicBlock *block,
+                                        StmtVec &stmts,
+                                        llvm::BasicBlock *&next) {
+  auto block_stmts{CreateBasicBlockStmts(block)};
+  stmts.insert(stmts.end(), block_stmts.begin(), block_stmts.end());
+  auto term{block->getTerminator()};
+  if (llvm::isa<llvm::ReturnInst>(term) ||
+      llvm::isa<llvm::UnreachableInst>(term)) {
+    next = nullptr;
+    return true;
+  }
+  if (auto br = llvm::dyn_cast<llvm::BranchInst>(term)) {
+    if (br->isUnconditional() || br->getSuccessor(0) == br->getSuccessor(1)) {
+      next = br->getSuccessor(0);
+      return true;
+    }
+    return StructurePatternBranch(br, stmts, next);
+  }
+  if (auto sw = llvm::dyn_cast<llvm::SwitchInst>(term)) {
+    return StructurePatternSwitch(sw, stmts, next);
+  }
+  return false;
+}
+
+bool GenerateAST::StructurePatternBranch(llvm::BranchInst *br,
+                                         StmtVec &stmts,
+                                         llvm::BasicBlock *&next) {
+  auto block{br->getParent()};
+  auto then_block{br->getSuccessor(0)};
+  auto else_block{br->getSuccessor(1)};
+  auto then_jump{GetPatternJump(then_block)};
+  auto else_jump{GetPatternJump(else_block)};
+  if (then_jump == PatternJump::Invalid || else_jump == PatternJump::Invalid) {
+    return false;
+  }
+
+  StmtVec then_stmts;
+  StmtVec else_stmts;
+  if (then_jump != PatternJump::None || else_jump != PatternJump::None) {
+    // A jump is taken on its own, and the other successor follows in
+    // sequence. Loop exits are preferred, so that loops end up as
+    // `while (1) { if (c) break; ... }` or `while (1) { ...; if (c) break; }`,
+    // which the loop refinement passes turn into `while` and `do` loops.
+    if (then_jump == PatternJump::None ||
+        (else_jump == PatternJump::Break && then_jump != PatternJump::Break)) {
+      std::swap(then_block, else_block);
+      std::swap(then_jump, else_jump);
+    }
+    then_stmts.push_back(then_jump == PatternJump::Break
+                             ? static_cast<clang::Stmt *>(ast.CreateBreak())
+                             : ast.CreateContinue());
+    next = else_block;
+  } else {
+    next = GetPatternJoin(block);
+    if (!StructurePatternSeq(then_block, next, then_stmts) ||
+        !StructurePatternSeq(else_block, next, else_stmts)) {
+      return false;
+    }
+    if (then_stmts.empty()) {
+      std::swap(then_block, else_block);
+      std::swap(then_stmts, else_stmts);
+    }
+    if (then_stmts.empty()) {
+      return true;
+    }
+  }
+
+  auto if_stmt{ast.CreateIf(
+      dec_ctx.marker_expr, ast.CreateCompoundStmt(then_stmts),
+      else_stmts.empty() ? nullptr : ast.CreateCompoundStmt(else_stmts))};
+  pattern_conds.push_back({if_stmt, GetOrCreateEdgeCond(block, then_block)});
+  stmts.push_back(if_stmt);
+  return true;
+}
+
+bool GenerateAST::StructurePatternSwitch(llvm::SwitchInst *sw,
+                                         StmtVec &stmts,
+                                         llvm::BasicBlock *&next) {
+  // The successors of the switch, default first, with the values of the cases
+  // that go to each of them
+  struct Arm {
+    llvm::BasicBlock *succ;
+    bool is_default;
+    std::vector<llvm::ConstantInt *> values;
+  };
+  std::vector<Arm> arms{{sw->getDefaultDest(), true, {}}};
+  for (auto sw_case : sw->cases()) {
+    auto succ{sw_case.getCaseSuccessor()};
+    auto it{std::find_if(arms.begin(), arms.end(),
+                         [succ](const Arm &arm) { return arm.succ == succ; })};
+    if (it == arms.end()) {
+      arms.push_back({succ, false, {}});
+      it = std::prev(arms.end());
+    }
+    it->values.push_back(sw_case.getCaseValue());
+  }
+
+  next = GetPatternJoin(sw->getParent());
+  pattern_frames.push_back({nullptr, next});
+  StmtVec sw_body;
+  auto matched{true};
+  for (auto &arm : arms) {
+    // Cases that go straight to the join only need a label if there is a
+    // default case that would otherwise catch them
+    if (arm.succ == next && sw->getDefaultDest() == next) {
+      continue;
+    }
+    StmtVec arm_stmts;
+    if (!StructurePatternSeq(arm.succ, next, arm_stmts)) {
+      matched = false;
+      break;
+    }
+    clang::Stmt *label{ast.CreateCompoundStmt(arm_stmts)};
+    for (auto it{arm.values.rbegin()}; it != arm.values.rend(); ++it) {
+      auto case_stmt{ast.CreateCaseStmt(ast_gen.CreateConstantExpr(*it))};
+      case_stmt->setSubStmt(label);
+      label = case_stmt;
+    }
+    if (arm.is_default) {
+      label = ast.CreateDefaultStmt(label);
+    }
+    sw_body.push_back(label);
+    if (arm_stmts.empty() ||
+        !(llvm::isa<clang::ReturnStmt>(arm_stmts.back()) ||
+          llvm::isa<clang::ContinueStmt>(arm_stmts.back()))) {
+      sw_body.push_back(ast.CreateBreak());
+    }
+  }
+  pattern_frames.pop_back();
+  if (!matched) {
+    return false;
+  }
+
+  auto cond{ast_gen.CreateOperandExpr(sw->getOperandUse(0))};
+  auto sw_stmt{ast.CreateSwitchStmt(cond)};
+  sw_stmt->setBody(ast.CreateCompoundStmt(sw_body));
+  stmts.push_back(sw_stmt);
+  return true;
+}
+
+bool GenerateAST::StructurePatternLoop(llvm::BasicBlock *header,
+                                       StmtVec &stmts,
+                                       llvm::BasicBlock *&next) {
+  auto loop{loops->getLoopFor(header)};
+  auto exit{loop->getUniqueExitBlock()};
+  if (!exit ||
+      !(pattern_region->contains(exit) || exit == pattern_region->getExit())) {
+    return false;
+  }
+  for (auto block : loop->blocks()) {
+    if (!pattern_region->contains(block)) {
+      return false;
+    }
+  }
+
+  pattern_frames.push_back({loop, exit});
+  StmtVec body;
+  llvm::BasicBlock *body_next{nullptr};
+  auto matched{StructurePatternBlock(header, body, body_next) &&
+               (!body_next || StructurePatternSeq(body_next, nullptr, body))};
+  pattern_frames.pop_back();
+  if (!matched) {
+    return false;
+  }
+  // Going back to the header at the end of the body is implicit
+  if (!body.empty() && llvm::isa<clang::ContinueStmt>(body.back())) {
+    body.pop_back();
+  }
+  stmts.push_back(
+      ast.CreateWhile(ast.CreateTrue(), ast.CreateCompoundStmt(body)));
+  next = exit;
+  return true;
+}
+
+clang::CompoundStmt *GenerateAST::StructurePatternRegion(llvm::Region *region) {
+  DLOG(INFO) << "Matching region " << GetRegionNameStr(region);
+  pattern_region = region;
+  pattern_blocks.clear();
+  pattern_blocks.resize(blocks.size());
+  pattern_frames.clear();
+  pattern_conds.clear();
+  StmtVec body;
+  if (!StructurePatternSeq(region->getEntry(), region->getExit(), body)) {
+    unmatched_regions.insert(region);
+    return nullptr;
+  }
+  for (auto [stmt, idx] : pattern_conds) {
+    dec_ctx.conds[stmt] = idx;
+  }
+  return ast.CreateCompoundStmt(body);
+}
+
+bool GenerateAST::StructurePatterns() {
+  if (dec_ctx.structuring != StructuringEngine::Patterns) {
+    return false;
+  }
+  std::function<bool(llvm::Region *)> MatchSubRegions;
+  MatchSubRegions = [&](llvm::Region *region) {
+    auto matched{true};
+    for (auto &subregion : *region) {
+      matched &= MatchSubRegions(&*subregion);
+    }
+    // A region is only matched once all of its subregions are
+    if (!matched) {
+      return false;
+    }
+    auto stmt{StructurePatternRegion(region)};
+    if (!stmt) {
+      return false;
+    }
+    region_stmts[region] = stmt;
+    return true;
+  };
+  return MatchSubRegions(regions->getTopLevelRegion());
+}
+
 llvm::AnalysisKey GenerateAST::Key;
 
 GenerateAST::GenerateAST(DecompilationContext &dec_ctx)
-    : dec_ctx(dec_ctx), ast(dec_ctx.ast), ast_gen(dec_ctx) {}
+    : dec_ctx(dec_ctx),
+      ast(dec_ctx.ast),
+      cond_ctx(&dec_ctx),
+      ast_gen(dec_ctx) {}
+
+GenerateAST::GenerateAST(const GenerateAST &parent, Z3Conditions *cond_ctx)
+    : dec_ctx(parent.dec_ctx),
+      ast(parent.ast),
+      cond_ctx(cond_ctx),
+      ast_gen(parent.dec_ctx),
+      domtree(parent.domtree),
+      postdomtree(parent.postdomtree),
+      regions(parent.regions),
+      loops(parent.loops),
+      rpo_walk(parent.rpo_walk),
+      blocks(parent.blocks),
+      block_regions(parent.block_regions),
+      entry_regions(parent.entry_regions),
+      units(parent.units),
+      region_units(parent.region_units),
+      block_units(parent.block_units),
+      func_size(parent.func_size),
+      is_large(parent.is_large),
+      cyclic_blocks(parent.cyclic_blocks),
+      reach_vars(parent.reach_vars),
+      reach_sources(parent.reach_sources) {}
 
 GenerateAST::Result GenerateAST::run(llvm::Module &module,
                                      llvm::ModuleAnalysisManager &MAM) {
@@ -554,22 +1311,64 @@ GenerateAST::Result GenerateAST::run(llvm::Module &module,
 
 GenerateAST::Result GenerateAST::run(llvm::Function &func,
                                      llvm::FunctionAnalysisManager &FAM) {
-  if (func.isDeclaration()) {
+  if (func.isDeclaration() || dec_ctx.prototype_only.count(&func)) {
     return llvm::PreservedAnalyses::all();
   }
 
-  // Clear the region statements from previous functions
+  llvm::TimeTraceScope trace("GenerateAST", func.getName());
+  std::vector<llvm::BasicBlock *> chain;
+  if (GetStraightLineBlocks(func, chain)) {
+    StructureStraightLine(func, chain);
+    return llvm::PreservedAnalyses::all();
+  }
+  auto start{std::chrono::steady_clock::now()};
+  auto memory{GetAllocatedMemory(dec_ctx)};
+  SlowQueryScope slow_queries(cond_ctx->prover, dec_ctx.forensic_queries);
+  PrepareFunction(func, FAM);
+  // Functions whose regions all match patterns need no reaching conditions
+  auto complete{StructurePatterns() || CreateReachingConds(func)};
+  StructureFunction(func, /*timed_out=*/!complete);
+  auto &metrics{dec_ctx.function_metrics.emplace_back()};
+  metrics.name = func.getName().str();
+  metrics.size = func_size;
+  metrics.elapsed = std::chrono::steady_clock::now() - start;
+  metrics.memory = GetMemoryGrowth(dec_ctx, memory);
+  metrics.timed_out = !complete;
+  if (slow_queries.log) {
+    metrics.slowest_queries = slow_queries.log->GetSlowest();
+  }
+  return llvm::PreservedAnalyses::all();
+}
+
+void GenerateAST::PrepareFunction(llvm::Function &func,
+                                  llvm::FunctionAnalysisManager &FAM) {
+  // Clear the region statements and labels from previous functions
   region_stmts.clear();
-  // Get dominator tree
+  unmatched_regions.clear();
+  labels.clear();
+  placed_labels.clear();
+  num_labels = 0;
+  // Number the blocks of the function for the condition tables
+  cond_ctx->cfg_conds.Reset(func);
+  // Get dominator trees
   domtree = &FAM.getResult<llvm::DominatorTreeAnalysis>(func);
+  postdomtree = &FAM.getResult<llvm::PostDominatorTreeAnalysis>(func);
   // Get single-entry, single-exit regions
   regions = &FAM.getResult<llvm::RegionInfoAnalysis>(func);
   // Get loops
   loops = &FAM.getResult<llvm::LoopAnalysis>(func);
+  NumberRegions(func);
+  // Measure the function, to decide how much effort to put into it
+  func_size = MeasureFunction(func, *loops);
+  is_large = func_size.Exceeds(dec_ctx.large_function_limits);
   // Get a reverse post-order walk for iterating over region blocks in
   // structurization
   llvm::ReversePostOrderTraversal<llvm::Function *> rpo(&func);
   rpo_walk.assign(rpo.begin(), rpo.end());
+  FindReachSources();
+}
+
+bool GenerateAST::CreateReachingConds(llvm::Function &func) {
   // Computing reaching conditions is necessary in some cyclic regions:
   //
   //          %0
@@ -598,22 +1397,254 @@ GenerateAST::Result GenerateAST::run(llvm::Function &func,
   // reaching conditions are memoized, or `false` if not yet computed.
   // Unfortunately, this means that a single pass of computation might not
   // produce complete reaching conditions.
-  do {
-    reaching_conds_changed = false;
-    for (auto block : rpo_walk) {
-      CreateReachingCond(block);
+  //
+  // A block only needs to be recomputed when the condition of one of its
+  // predecessors changes, so blocks are kept in a worklist ordered by their
+  // position in the reverse post-order walk. Successors that come later in the
+  // walk are handled in the same sweep, while targets of back edges are
+  // revisited in the next one.
+  //
+  // On pathological control flow this may take very long, in which case the
+  // computation is abandoned once `goto_timeout` runs out and the whole
+  // function is structured with gotos instead.
+  Prover::CallSite site(cond_ctx->prover, "GenerateAST");
+  auto start{std::chrono::steady_clock::now()};
+  // Position of each block in the walk, by block number. Unreachable blocks
+  // are not part of it.
+  std::vector<unsigned> rpo_index(blocks.size(), CFGConds::none);
+  for (unsigned i{0}; i < rpo_walk.size(); ++i) {
+    rpo_index[GetBlockId(rpo_walk[i])] = i;
+  }
+  bool complete;
+  if (dec_ctx.unit_threads > 1 && units.size() > 1) {
+    complete = CreateUnitReachingConds(func, rpo_index, start);
+  } else {
+    std::set<unsigned> worklist;
+    for (unsigned i{0}; i < rpo_walk.size(); ++i) {
+      worklist.insert(i);
+    }
+    for (unsigned unit{1}; unit < units.size(); ++unit) {
+      cond_ctx->cfg_conds.reaching_conds[units[unit].entry] =
+          cond_ctx->InsertZExpr(cond_ctx->z3_ctx.bool_val(true));
+    }
+    complete = SolveReachingConds(worklist, rpo_index, start, CFGConds::none);
+  }
+  if (!complete) {
+    LOG(WARNING) << "Computing reaching conditions of " << func.getName().str()
+                 << " timed out, structuring it with gotos";
+  }
+  return complete;
+}
+
+bool GenerateAST::SolveReachingConds(
+    std::set<unsigned> &worklist, const std::vector<unsigned> &rpo_index,
+    std::chrono::steady_clock::time_point start, unsigned unit) {
+  auto Enqueue = [&](unsigned id) {
+    auto index{rpo_index[id]};
+    if (index != CFGConds::none &&
+        (unit == CFGConds::none || GetOwnerUnit(id) == unit)) {
+      worklist.insert(index);
+    }
+  };
+  while (!worklist.empty()) {
+    if (dec_ctx.goto_timeout.count() &&
+        std::chrono::steady_clock::now() - start > dec_ctx.goto_timeout) {
+      return false;
+    }
+    auto block{rpo_walk[*worklist.begin()]};
+    worklist.erase(worklist.begin());
+    if (!CreateReachingCond(block)) {
+      continue;
+    }
+    for (auto succ : llvm::successors(block)) {
+      Enqueue(GetBlockId(succ));
+    }
+    // So do the blocks that share its condition
+    for (auto child : domtree->getNode(block)->children()) {
+      auto id{GetBlockId(child->getBlock())};
+      if (reach_sources[id] == GetBlockId(block)) {
+        Enqueue(id);
+      }
+    }
+    // The conditions of the blocks that a unit reaches from the inside are
+    // composed with the condition of its entry: the exit of the unit, and the
+    // entry itself through back edges
+    auto id{GetBlockId(block)};
+    if (IsUnitEntry(id)) {
+      auto region{units[block_units[id]].region};
+      if (auto exit = region->getExit()) {
+        Enqueue(GetBlockId(exit));
+      }
+      for (auto pred : llvm::predecessors(block)) {
+        if (region->contains(pred)) {
+          Enqueue(id);
+          break;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+namespace {
+// The reaching conditions of a unit, computed on a worker thread in a Z3
+// context of its own once those of the units it contains have been merged
+// into it
+struct UnitTask {
+  std::unique_ptr<Z3Conditions> conds;
+  // Units directly nested in this one, and how many of them are not done yet
+  std::vector<unsigned> children;
+  size_t pending{0};
+  // Positions in the reverse post-order walk of the blocks whose conditions
+  // are computed within this unit
+  std::set<unsigned> worklist;
+};
+}  // namespace
+
+bool GenerateAST::CreateUnitReachingConds(
+    llvm::Function &func, const std::vector<unsigned> &rpo_index,
+    std::chrono::steady_clock::time_point start) {
+  // The conditions of the blocks of a unit are relative to its entry, so they
+  // only depend on the conditions of the units it contains. Units that do not
+  // contain each other are computed at the same time, innermost first.
+  std::vector<UnitTask> tasks(units.size());
+  for (unsigned i{0}; i < rpo_walk.size(); ++i) {
+    tasks[GetOwnerUnit(GetBlockId(rpo_walk[i]))].worklist.insert(i);
+  }
+  for (unsigned unit{1}; unit < units.size(); ++unit) {
+    tasks[units[unit].parent].children.push_back(unit);
+  }
+  std::vector<unsigned> ready;
+  for (unsigned unit{0}; unit < units.size(); ++unit) {
+    tasks[unit].pending = tasks[unit].children.size();
+    if (!tasks[unit].pending) {
+      ready.push_back(unit);
+    }
+  }
+
+  // Errors are rethrown on this thread, as an exception escaping a worker
+  // would terminate the process
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t num_done{0};
+  bool timed_out{false};
+  std::exception_ptr error;
+  auto Work = [&]() {
+    // The context of the generator is that of each of its units in turn
+    GenerateAST gen(*this, nullptr);
+    while (true) {
+      unsigned unit;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() {
+          return !ready.empty() || num_done == tasks.size() || timed_out ||
+                 error;
+        });
+        if (ready.empty() || timed_out || error) {
+          break;
+        }
+        unit = ready.back();
+        ready.pop_back();
+      }
+
+      auto &task{tasks[unit]};
+      auto complete{true};
+      try {
+        llvm::TimeTraceScope trace("UnitReachingConds", [&]() {
+          return GetRegionNameStr(units[unit].region);
+        });
+        task.conds = std::make_unique<Z3Conditions>(
+            dec_ctx.z3_lease.GetPool(), dec_ctx.z3_var_ids);
+        task.conds->prover.CopySettings(cond_ctx->prover);
+        task.conds->cfg_conds.Reset(func);
+        // The nested units are done, and no other thread uses their contexts
+        for (auto child : task.children) {
+          task.conds->Merge(*tasks[child].conds);
+          tasks[child].conds.reset();
+        }
+        gen.cond_ctx = task.conds.get();
+        Prover::CallSite site(task.conds->prover, "GenerateAST");
+        if (unit) {
+          task.conds->cfg_conds.reaching_conds[units[unit].entry] =
+              task.conds->InsertZExpr(task.conds->z3_ctx.bool_val(true));
+        }
+        complete =
+            gen.SolveReachingConds(task.worklist, rpo_index, start, unit);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        timed_out |= !complete;
+        ++num_done;
+        if (unit && !--tasks[units[unit].parent].pending) {
+          ready.push_back(units[unit].parent);
+        }
+      }
+      cv.notify_all();
     }
-  } while (reaching_conds_changed);
+  };
+
+  std::vector<std::thread> workers;
+  auto num_threads{std::min<size_t>(dec_ctx.unit_threads, units.size())};
+  auto tracing{IsTracing()};
+  for (size_t i{1}; i < num_threads; ++i) {
+    workers.emplace_back([&, tracing]() {
+      TraceThread trace_thread(tracing);
+      Work();
+    });
+  }
+  Work();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  if (timed_out) {
+    return false;
+  }
+  cond_ctx->Merge(*tasks[0].conds);
+  return true;
+}
+
+void GenerateAST::StructureFunction(llvm::Function &func, bool timed_out) {
+  Prover::CallSite site(dec_ctx.prover, "GenerateAST");
+  if (is_large) {
+    dec_ctx.large_functions.insert(&func);
+  }
   // Recursively walk regions in post-order and structure
   std::function<void(llvm::Region *)> POWalkSubRegions;
   POWalkSubRegions = [&](llvm::Region *region) {
     for (auto &subregion : *region) {
       POWalkSubRegions(&*subregion);
     }
-    StructureRegion(region);
+    // Regions may already have been structured with patterns
+    if (!region_stmts.count(region)) {
+      StructureRegion(region);
+    }
   };
   // Call the above declared bad boy
-  POWalkSubRegions(regions->getTopLevelRegion());
+  if (timed_out) {
+    region_stmts[regions->getTopLevelRegion()] =
+        StructureGotoRegion(regions->getTopLevelRegion(), /*flatten=*/true);
+  } else {
+    POWalkSubRegions(regions->getTopLevelRegion());
+  }
+  StmtVec stmts;
+  // Add statements of the top-level region compound
+  for (auto stmt : region_stmts[regions->getTopLevelRegion()]->body()) {
+    stmts.push_back(stmt);
+  }
+  CreateDefinition(func, stmts);
+  // The conditions of the blocks are only needed while structuring, and the
+  // statements that use them refer to them through `conds`
+  dec_ctx.cfg_conds.Clear();
+}
+
+void GenerateAST::CreateDefinition(llvm::Function &func,
+                                   const StmtVec &stmts) {
   // Get the function declaration AST node for `func`
   auto fdecl = clang::cast<clang::FunctionDecl>(dec_ctx.value_decls[&func]);
   // Create a redeclaration of `fdecl` that will serve as a definition
@@ -633,14 +1664,251 @@ GenerateAST::Result GenerateAST::run(llvm::Function &func,
       fbody.push_back(ast.CreateDeclStmt(decl));
     }
   }
-  // Add statements of the top-level region compound
-  for (auto stmt : region_stmts[regions->getTopLevelRegion()]->body()) {
-    fbody.push_back(stmt);
-  }
+  fbody.insert(fbody.end(), stmts.begin(), stmts.end());
   // Set body to a new compound
   fdefn->setBody(ast.CreateCompoundStmt(fbody));
+}
 
-  return llvm::PreservedAnalyses::all();
+bool GenerateAST::GetStraightLineBlocks(
+    llvm::Function &func, std::vector<llvm::BasicBlock *> &chain) {
+  chain.clear();
+  std::unordered_set<llvm::BasicBlock *> visited;
+  for (auto block{&func.getEntryBlock()}; visited.insert(block).second;) {
+    chain.push_back(block);
+    auto term{block->getTerminator()};
+    if (llvm::isa<llvm::ReturnInst>(term) ||
+        llvm::isa<llvm::UnreachableInst>(term)) {
+      return true;
+    }
+    auto br{llvm::dyn_cast<llvm::BranchInst>(term)};
+    if (!br || br->isConditional()) {
+      return false;
+    }
+    block = br->getSuccessor(0);
+  }
+  // The chain loops back on itself
+  return false;
+}
+
+void GenerateAST::StructureStraightLine(
+    llvm::Function &func, const std::vector<llvm::BasicBlock *> &chain) {
+  auto start{std::chrono::steady_clock::now()};
+  auto memory{GetAllocatedMemory(dec_ctx)};
+  // Each block is reached exactly when the entry is, so the statements that
+  // refinement would end up with are those of the blocks in order
+  StmtVec stmts;
+  for (auto block : chain) {
+    ast_gen.VisitBasicBlock(*block, stmts);
+  }
+  CreateDefinition(func, stmts);
+  dec_ctx.straight_line_functions.insert(&func);
+  FunctionSize size;
+  size.blocks = chain.size();
+  size.edges = chain.size() - 1;
+  size.cond_terms = chain.size();
+  auto &metrics{dec_ctx.function_metrics.emplace_back()};
+  metrics.name = func.getName().str();
+  metrics.size = size;
+  metrics.elapsed = std::chrono::steady_clock::now() - start;
+  metrics.memory = GetMemoryGrowth(dec_ctx, memory);
+}
+
+namespace {
+// A function whose analyses and reaching conditions are computed on a worker
+// thread, in a Z3 context of its own, before it is structured
+struct GenerateJob {
+  llvm::Function *func;
+  std::unique_ptr<Z3Conditions> conds;
+  std::unique_ptr<GenerateAST> gen;
+  bool timed_out{false};
+  // Blocks of a straight-line function, which is structured directly
+  bool straight_line{false};
+  std::vector<llvm::BasicBlock *> chain;
+  std::string error;
+  bool done{false};
+  // Time spent on the worker thread
+  std::chrono::nanoseconds elapsed{0};
+  // See `DecompilationContext::forensic_queries`
+  std::shared_ptr<QueryLog> slow_queries;
+};
+}  // namespace
+
+void GenerateAST::RunParallel(llvm::Module &module,
+                              DecompilationContext &dec_ctx) {
+  std::vector<GenerateJob> jobs;
+  for (auto &func : module.functions()) {
+    if (!func.isDeclaration() && !dec_ctx.prototype_only.count(&func)) {
+      auto &job{jobs.emplace_back()};
+      job.func = &func;
+      // Straight-line functions have nothing to compute ahead of time
+      job.straight_line = GetStraightLineBlocks(func, job.chain);
+      job.done = job.straight_line;
+    }
+  }
+  auto num_threads{std::min<size_t>(dec_ctx.generate_threads, jobs.size())};
+  auto patterns{dec_ctx.structuring == StructuringEngine::Patterns};
+  // Workers stay at most this many functions ahead of the structuring, so that
+  // the analyses and conditions of only so many functions are alive at once
+  auto window{2 * num_threads};
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t next_job{0};
+  size_t num_structured{0};
+  // The query log of `dec_ctx.prover` is swapped for that of each job while it
+  // is structured, and workers copy its settings, so both happen under `mutex`
+  auto query_log{dec_ctx.prover.GetQueryLog()};
+  auto SetQueryLog{[&](std::shared_ptr<QueryLog> log) {
+    std::lock_guard<std::mutex> lock(mutex);
+    dec_ctx.prover.SetQueryLog(std::move(log));
+  }};
+
+  // Each worker has an analysis manager of its own, which is kept alive until
+  // every function has been structured, as the results of the analyses are
+  // used by this thread. Results are dropped by the worker once their function
+  // has been structured.
+  llvm::PassBuilder pb;
+  std::vector<std::unique_ptr<llvm::FunctionAnalysisManager>> fams;
+  for (size_t i{0}; i < num_threads; ++i) {
+    pb.registerFunctionAnalyses(
+        *fams.emplace_back(std::make_unique<llvm::FunctionAnalysisManager>()));
+  }
+
+  std::vector<std::thread> workers;
+  auto tracing{IsTracing()};
+  for (auto &fam : fams) {
+    workers.emplace_back([&, tracing]() {
+      TraceThread trace_thread(tracing);
+      std::vector<size_t> cached;
+      while (true) {
+        size_t idx;
+        size_t structured;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&]() {
+            return next_job == jobs.size() ||
+                   next_job < num_structured + window;
+          });
+          if (next_job == jobs.size()) {
+            break;
+          }
+          idx = next_job++;
+          structured = num_structured;
+        }
+        auto it{std::partition(cached.begin(), cached.end(),
+                               [=](size_t i) { return i >= structured; })};
+        for (auto done{it}; done != cached.end(); ++done) {
+          auto &func{*jobs[*done].func};
+          fam->clear(func, func.getName());
+        }
+        cached.erase(it, cached.end());
+        if (jobs[idx].straight_line) {
+          continue;
+        }
+        cached.push_back(idx);
+
+        // Errors are reported on the structuring thread, as an exception
+        // escaping a worker would terminate the process
+        auto &job{jobs[idx]};
+        auto start{std::chrono::steady_clock::now()};
+        try {
+          llvm::TimeTraceScope trace("ReachingConds", job.func->getName());
+          job.conds = std::make_unique<Z3Conditions>(
+              dec_ctx.z3_lease.GetPool(), dec_ctx.z3_var_ids);
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            job.conds->prover.CopySettings(dec_ctx.prover);
+          }
+          if (dec_ctx.forensic_queries) {
+            job.slow_queries = std::make_shared<QueryLog>(
+                dec_ctx.forensic_queries, query_log);
+            job.conds->prover.SetQueryLog(job.slow_queries);
+          }
+          job.gen = std::make_unique<GenerateAST>(dec_ctx);
+          job.gen->cond_ctx = job.conds.get();
+          job.gen->PrepareFunction(*job.func, *fam);
+          // Patterns are matched on the structuring thread first, as they
+          // build the AST
+          if (!patterns) {
+            job.timed_out = !job.gen->CreateReachingConds(*job.func);
+          }
+        } catch (Exception &ex) {
+          job.error = ex.what();
+        } catch (z3::exception &ex) {
+          job.error = ex.msg();
+        }
+        job.elapsed = std::chrono::steady_clock::now() - start;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          job.done = true;
+        }
+        cv.notify_all();
+      }
+    });
+  }
+
+  // Functions are structured in module order, so that their definitions are
+  // added to the translation unit in the same order as sequentially
+  for (auto &job : jobs) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&job]() { return job.done; });
+    }
+    auto &func{*job.func};
+    if (job.straight_line) {
+      try {
+        llvm::TimeTraceScope trace("GenerateAST", func.getName());
+        GenerateAST(dec_ctx).StructureStraightLine(func, job.chain);
+      } catch (Exception &ex) {
+        dec_ctx.DropDefinition(func, ex.what());
+      }
+    } else if (!job.error.empty()) {
+      dec_ctx.DropDefinition(func, job.error);
+    } else {
+      if (job.slow_queries) {
+        SetQueryLog(job.slow_queries);
+      }
+      try {
+        llvm::TimeTraceScope trace("GenerateAST", func.getName());
+        auto start{std::chrono::steady_clock::now()};
+        auto memory{GetAllocatedMemory(dec_ctx)};
+        dec_ctx.Import(*job.conds);
+        job.gen->cond_ctx = &dec_ctx;
+        if (patterns) {
+          job.timed_out = !(job.gen->StructurePatterns() ||
+                            job.gen->CreateReachingConds(func));
+        }
+        job.gen->StructureFunction(func, job.timed_out);
+        auto &metrics{dec_ctx.function_metrics.emplace_back()};
+        metrics.name = func.getName().str();
+        metrics.size = job.gen->func_size;
+        metrics.elapsed =
+            job.elapsed + (std::chrono::steady_clock::now() - start);
+        metrics.memory = GetMemoryGrowth(dec_ctx, memory);
+        metrics.timed_out = job.timed_out;
+        if (job.slow_queries) {
+          metrics.slowest_queries = job.slow_queries->GetSlowest();
+        }
+      } catch (Exception &ex) {
+        dec_ctx.DropDefinition(func, ex.what());
+      } catch (z3::exception &ex) {
+        dec_ctx.DropDefinition(func, ex.msg());
+      }
+      if (job.slow_queries) {
+        SetQueryLog(query_log);
+      }
+    }
+    job.gen.reset();
+    job.conds.reset();
+    job.slow_queries.reset();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++num_structured;
+    }
+    cv.notify_all();
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
 }
 
 void GenerateAST::run(llvm::Module &module, DecompilationContext &dec_ctx) {
@@ -652,13 +1920,28 @@ void GenerateAST::run(llvm::Module &module, DecompilationContext &dec_ctx) {
   pb.registerModuleAnalyses(mam);
   mpm.run(module, mam);
 
+  if (dec_ctx.generate_threads > 1) {
+    RunParallel(module, dec_ctx);
+    return;
+  }
+
   llvm::FunctionPassManager fpm;
   llvm::FunctionAnalysisManager fam;
   fam.registerPass([&] { return rellic::GenerateAST(dec_ctx); });
   fpm.addPass(rellic::GenerateAST(dec_ctx));
   pb.registerFunctionAnalyses(fam);
+  // A function that cannot be structured is left as a prototype, so that the
+  // rest of the module can still be decompiled
   for (auto &func : module.functions()) {
-    fpm.run(func, fam);
+    try {
+      fpm.run(func, fam);
+    } catch (Exception &ex) {
+      dec_ctx.DropDefinition(func, ex.what());
+      fam.clear(func, func.getName());
+    } catch (z3::exception &ex) {
+      dec_ctx.DropDefinition(func, ex.msg());
+      fam.clear(func, func.getName());
+    }
   }
 }
 
@@ -6,11 +6,15 @@
  * the LICENSE file found in the root directory of this source tree.
  */
 
+#include <clang/AST/Attr.h>
 #include <clang/Basic/Builtins.h>
+#include <llvm/IR/CFG.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/IntrinsicInst.h>
 
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #define GOOGLE_STRIP_LOG 1
 
@@ -62,43 +66,109 @@ class ExprGen : public llvm::InstVisitor<ExprGen, clang::Expr *> {
 };
 
 clang::Expr *IRToASTVisitor::ConvertExpr(z3::expr expr) {
-  if (expr.decl().decl_kind() == Z3_OP_EQ) {
-    // Equalities generated form the reaching conditions of switch instructions
-    // Always in the for (VAR == CONST) or (CONST == VAR)
-    // VAR will uniquely identify a SwitchInst, CONST will represent the index
-    // of the case taken
-    CHECK_EQ(expr.num_args(), 2) << "Equalities must have 2 arguments";
-    auto a{expr.arg(0)};
-    auto b{expr.arg(1)};
-
-    llvm::SwitchInst *inst{dec_ctx.z3_sw_vars_inv[a.id()]};
-    unsigned case_idx{};
-
-    // GenerateAST always generates equalities in the form (VAR == CONST), but
-    // there is a chance that some Z3 simplification inverts the order, so
-    // handle that here.
-    if (!inst) {
-      inst = dec_ctx.z3_sw_vars_inv[b.id()];
-      case_idx = a.get_numeral_uint();
-    } else {
-      case_idx = b.get_numeral_uint();
+  // Reaching conditions share most of their subterms, and converting the
+  // operands of their atoms can be expensive, so conversions are memoized
+  auto it{converted_exprs.find(expr.id())};
+  if (it == converted_exprs.end()) {
+    auto converted{ConvertExprImpl(expr)};
+    it = converted_exprs.emplace(expr.id(), std::make_pair(expr, converted))
+             .first;
+  }
+  return Clone(dec_ctx.ast_unit, it->second.second, dec_ctx.use_provenance);
+}
+
+std::optional<z3::expr> IRToASTVisitor::FindSwitchVar(z3::expr expr) {
+  if (expr.is_const()) {
+    if (dec_ctx.z3_sw_vars_inv.count(expr.id())) {
+      return expr;
     }
+    return std::nullopt;
+  }
+  for (auto i{0U}; i < expr.num_args(); ++i) {
+    if (auto var = FindSwitchVar(expr.arg(i))) {
+      return var;
+    }
+  }
+  return std::nullopt;
+}
 
-    for (auto sw_case : inst->cases()) {
-      if (sw_case.getCaseIndex() == case_idx) {
-        return ast.CreateEQ(CreateOperandExpr(inst->getOperandUse(0)),
-                            CreateConstantExpr(sw_case.getCaseValue()));
-      }
+// The values of the variable of a switch stand for its cases, as ordered by
+// `GetSwitchCases`, and any other value for its default case. A condition on
+// the variable is converted by evaluating it on each of them, into a
+// comparison of the switch operand with the values of the cases on which it
+// differs from the default case.
+clang::Expr *IRToASTVisitor::ConvertSwitchCond(z3::expr expr, z3::expr var) {
+  auto inst{dec_ctx.z3_sw_vars_inv.at(var.id())};
+  auto &z3_ctx{var.ctx()};
+  auto Evaluate = [&](unsigned value) {
+    z3::expr_vector from{z3_ctx}, to{z3_ctx};
+    from.push_back(var);
+    to.push_back(z3_ctx.int_val(value));
+    auto result{dec_ctx.prover.Rewrite(expr.substitute(from, to))};
+    CHECK_THROW(result.is_true() || result.is_false())
+        << "Condition " << expr << " does not only depend on a switch";
+    return result.is_true();
+  };
+
+  auto cases{GetSwitchCases(inst)};
+  std::vector<bool> holds(cases.size());
+  for (unsigned i{0}; i < cases.size(); ++i) {
+    holds[cases[i].getCaseIndex()] = Evaluate(i);
+  }
+  auto default_holds{Evaluate(cases.size())};
+
+  clang::Expr *result{nullptr};
+  for (auto sw_case : inst->cases()) {
+    if (holds[sw_case.getCaseIndex()] == default_holds) {
+      continue;
     }
+    auto eq{ast.CreateEQ(CreateOperandExpr(inst->getOperandUse(0)),
+                         CreateConstantExpr(sw_case.getCaseValue()))};
+    result = result ? ast.CreateLOr(result, eq) : eq;
+  }
+  if (!result) {
+    return default_holds ? ast.CreateTrue() : ast.CreateFalse();
+  }
+  return default_holds ? ast.CreateLNot(result) : result;
+}
+
+clang::Expr *IRToASTVisitor::ConvertExprImpl(z3::expr expr) {
+  // Connectives are converted directly, only atoms and whole conditions go
+  // through the memoized conversion
+  auto ConvertArg = [this](z3::expr arg) {
+    switch (arg.decl().decl_kind()) {
+      case Z3_OP_TRUE:
+      case Z3_OP_FALSE:
+      case Z3_OP_AND:
+      case Z3_OP_OR:
+      case Z3_OP_NOT:
+        return ConvertExprImpl(arg);
+      default:
+        return ConvertExpr(arg);
+    }
+  };
 
-    LOG(FATAL) << "Couldn't find switch case";
+  if (expr.num_args() && !expr.arg(0).is_bool()) {
+    // Comparisons generated from the reaching conditions of switch
+    // instructions, between the variable of a switch and constants, though
+    // Z3 simplifications may have turned them into other arithmetic forms
+    auto var{FindSwitchVar(expr)};
+    CHECK_THROW(var) << "Unsupported condition " << expr;
+    return ConvertSwitchCond(expr, *var);
   }
 
   auto hash{expr.id()};
+  auto reach_def{dec_ctx.z3_reach_defs.find(hash)};
+  if (reach_def != dec_ctx.z3_reach_defs.end()) {
+    // expr is a variable that stands for a reaching condition, which is
+    // expanded here and nowhere else
+    return ConvertExpr(dec_ctx.z3_exprs[reach_def->second]);
+  }
   if (dec_ctx.z3_br_edges_inv.find(hash) != dec_ctx.z3_br_edges_inv.end()) {
     auto edge{dec_ctx.z3_br_edges_inv[hash]};
-    CHECK(edge.second) << "Inverse map should only be populated for branches "
-                          "taken when condition is true";
+    CHECK_THROW(edge.second)
+        << "Inverse map should only be populated for branches "
+           "taken when condition is true";
     // expr is a variable that represents the condition of a branch instruction.
 
     // FIXME(frabert): Unfortunately there is no public API in BranchInst that
@@ -110,45 +180,80 @@ clang::Expr *IRToASTVisitor::ConvertExpr(z3::expr expr) {
 
   switch (expr.decl().decl_kind()) {
     case Z3_OP_TRUE:
-      CHECK_EQ(expr.num_args(), 0) << "True cannot have arguments";
+      CHECK_THROW(expr.num_args() == 0) << "True cannot have arguments";
       return ast.CreateTrue();
     case Z3_OP_FALSE:
-      CHECK_EQ(expr.num_args(), 0) << "False cannot have arguments";
+      CHECK_THROW(expr.num_args() == 0) << "False cannot have arguments";
       return ast.CreateFalse();
     case Z3_OP_AND: {
       // Since AND and OR expressions are n-ary we need to convert them to
       // binary. If they have only one subexpression, we can forego the AND/OR
       // altogether.
-      clang::Expr *res{ConvertExpr(expr.arg(0))};
+      clang::Expr *res{ConvertArg(expr.arg(0))};
       for (auto i{1U}; i < expr.num_args(); ++i) {
-        res = ast.CreateLAnd(res, ConvertExpr(expr.arg(i)));
+        res = ast.CreateLAnd(res, ConvertArg(expr.arg(i)));
       }
       return res;
     }
     case Z3_OP_OR: {
-      clang::Expr *res{ConvertExpr(expr.arg(0))};
+      clang::Expr *res{ConvertArg(expr.arg(0))};
       for (auto i{1U}; i < expr.num_args(); ++i) {
-        res = ast.CreateLOr(res, ConvertExpr(expr.arg(i)));
+        res = ast.CreateLOr(res, ConvertArg(expr.arg(i)));
       }
       return res;
     }
     case Z3_OP_NOT: {
-      CHECK_EQ(expr.num_args(), 1) << "Not must have one argument";
-      auto sub{ConvertExpr(expr.arg(0))};
+      CHECK_THROW(expr.num_args() == 1) << "Not must have one argument";
+      auto sub{ConvertArg(expr.arg(0))};
       auto neg{ast.CreateLNot(sub)};
       CopyProvenance(sub, neg, dec_ctx.use_provenance);
       return neg;
     }
     default:
-      LOG(FATAL) << "Invalid z3 op";
+      THROW() << "Invalid z3 op";
   }
   return nullptr;
 }
 
+// Returns the bytes of the initializer of `gvar`, in target order, if it is an
+// array of integers or floats that takes at least `min_size` bytes. Arrays of
+// `i8` are left out, as they are already initialized by a string literal.
+static std::optional<std::string> GetBlobInitializer(
+    llvm::GlobalVariable &gvar, uint64_t min_size) {
+  if (!min_size || !gvar.hasInitializer()) {
+    return std::nullopt;
+  }
+
+  auto arr{llvm::dyn_cast<llvm::ConstantDataArray>(gvar.getInitializer())};
+  if (!arr || arr->getElementType()->isIntegerTy(8U)) {
+    return std::nullopt;
+  }
+
+  uint64_t elm_size{arr->getElementByteSize()};
+  uint64_t num_elms{arr->getNumElements()};
+  if (elm_size * num_elms < min_size) {
+    return std::nullopt;
+  }
+
+  auto little_endian{gvar.getParent()->getDataLayout().isLittleEndian()};
+  std::string bytes;
+  bytes.reserve(elm_size * num_elms);
+  for (uint64_t i{0}; i < num_elms; ++i) {
+    auto elm{arr->getElementType()->isIntegerTy()
+                 ? arr->getElementAsAPInt(i)
+                 : arr->getElementAsAPFloat(i).bitcastToAPInt()};
+    for (uint64_t j{0}; j < elm_size; ++j) {
+      auto byte{little_endian ? j : elm_size - 1 - j};
+      bytes.push_back(
+          static_cast<char>(elm.extractBitsAsZExtValue(8U, byte * 8U)));
+    }
+  }
+  return bytes;
+}
+
 void ExprGen::VisitGlobalVar(llvm::GlobalVariable &gvar) {
   DLOG(INFO) << "VisitGlobalVar: " << LLVMThingToString(&gvar);
-  auto &var{dec_ctx.value_decls[&gvar]};
-  if (var) {
+  if (dec_ctx.value_decls.lookup(&gvar)) {
     return;
   }
 
@@ -159,25 +264,42 @@ void ExprGen::VisitGlobalVar(llvm::GlobalVariable &gvar) {
     return;
   }
 
-  auto type{dec_ctx.type_provider->GetGlobalVarType(gvar)};
+  // Large data tables become a single blob, which uses of the global do not
+  // mind as they always cast its address to the type they access
+  auto blob{GetBlobInitializer(gvar, dec_ctx.blob_initializer_size)};
+  auto type{blob ? ast_ctx.getConstantArrayType(
+                       ast_ctx.UnsignedCharTy, llvm::APInt(64, blob->size()),
+                       nullptr, clang::ArrayType::ArraySizeModifier::Normal, 0)
+                 : dec_ctx.type_provider->GetGlobalVarType(gvar)};
   auto tudecl{ast_ctx.getTranslationUnitDecl()};
   auto name{gvar.getName().str()};
   if (name.empty()) {
-    name = "gvar" + std::to_string(GetNumDecls<clang::VarDecl>(tudecl));
+    name = "gvar" +
+           std::to_string(dec_ctx.GetNumDecls<clang::VarDecl>(tudecl));
   }
 
   // Create a variable declaration
-  var = ast.CreateVarDecl(tudecl, type, name);
+  auto var{ast.CreateVarDecl(tudecl, type, name)};
+  dec_ctx.value_decls[&gvar] = var;
   // Add to translation unit
   tudecl->addDecl(var);
 
   // Create an initalizer literal
-  if (gvar.hasInitializer()) {
+  if (blob) {
+    init = ast.CreateStrLit(*blob);
+    auto align{gvar.getParent()->getDataLayout().getPreferredAlign(&gvar)};
+    if (align.value() > 1) {
+      clang::AttributeCommonInfo info{clang::SourceLocation{}};
+      auto align_lit{ast.CreateIntLit(llvm::APInt(32U, align.value()))};
+      var->addAttr(clang::AlignedAttr::Create(
+          ast_ctx, /*IsAlignmentExpr=*/true, align_lit, info));
+    }
+  } else if (gvar.hasInitializer()) {
     init = CreateConstantExpr(gvar.getInitializer());
   }
 
   if (init) {
-    clang::cast<clang::VarDecl>(var)->setInit(init);
+    var->setInit(init);
   }
 }
 
@@ -203,7 +325,7 @@ static bool IsGVarAString(llvm::GlobalVariable *gvar) {
     return false;
   }
 
-  auto init{arr->getAsString().str()};
+  auto init{arr->getAsString()};
   if (init.find('\0') != init.size() - 1) {
     return false;
   }
@@ -211,9 +333,23 @@ static bool IsGVarAString(llvm::GlobalVariable *gvar) {
   return true;
 }
 
+// Cached version of `IsGVarAString`, as string globals are usually referred to
+// many times and checking them scans their whole initializer
+static bool IsGVarAString(llvm::GlobalVariable *gvar,
+                          DecompilationContext &dec_ctx) {
+  auto it{dec_ctx.string_globals.find(gvar)};
+  if (it != dec_ctx.string_globals.end()) {
+    return it->second;
+  }
+
+  auto res{IsGVarAString(gvar)};
+  dec_ctx.string_globals[gvar] = res;
+  return res;
+}
+
 clang::Expr *ExprGen::CreateConstantExpr(llvm::Constant *constant) {
   if (auto gvar = llvm::dyn_cast<llvm::GlobalVariable>(constant)) {
-    if (IsGVarAString(gvar)) {
+    if (IsGVarAString(gvar, dec_ctx)) {
       auto arr{llvm::cast<llvm::ConstantDataArray>(gvar->getInitializer())};
       return ast.CreateStrLit(arr->getAsString().str().c_str());
     }
@@ -331,9 +467,9 @@ clang::Expr *ExprGen::CreateLiteralExpr(llvm::Constant *constant) {
   return result;
 }
 
-#define ASSERT_ON_VALUE_TYPE(x)               \
-  if (llvm::isa<x>(val)) {                    \
-    LOG(FATAL) << "Invalid operand [" #x "]"; \
+#define ASSERT_ON_VALUE_TYPE(x)            \
+  if (llvm::isa<x>(val)) {                 \
+    THROW() << "Invalid operand [" #x "]"; \
   }
 
 clang::Expr *ExprGen::CreateOperandExpr(llvm::Use &val) {
@@ -398,9 +534,9 @@ clang::Expr *ExprGen::CreateOperandExpr(llvm::Use &val) {
     ASSERT_ON_VALUE_TYPE(llvm::Operator);
     ASSERT_ON_VALUE_TYPE(llvm::BlockAddress);
 
-    LOG(FATAL) << "Invalid operand value id: [" << val->getValueID() << "]\n"
-               << "Bitcode: [" << LLVMThingToString(val) << "]\n"
-               << "Type: [" << LLVMThingToString(val->getType()) << "]\n";
+    THROW() << "Invalid operand value id: [" << val->getValueID() << "]\n"
+            << "Bitcode: [" << LLVMThingToString(val) << "]\n"
+            << "Type: [" << LLVMThingToString(val->getType()) << "]\n";
   }
   dec_ctx.use_provenance[res] = &val;
   return res;
@@ -519,7 +655,7 @@ clang::Expr *ExprGen::visitCallInst(llvm::CallInst &inst) {
     auto cast{ast.CreateCStyleCast(funcPtr, CreateOperandExpr(callee))};
     callexpr = ast.CreateCall(cast, args);
   } else {
-    LOG(FATAL) << "Callee is not a function";
+    THROW() << "Callee is not a function";
   }
 
   return callexpr;
@@ -552,7 +688,7 @@ clang::Expr *ExprGen::visitGetElementPtrInst(llvm::GetElementPtrInst &inst) {
       return false;
     }
 
-    return IsGVarAString(gvar);
+    return IsGVarAString(gvar, dec_ctx);
   };
 
   // Maybe we're inspecting a string reference
@@ -573,7 +709,7 @@ clang::Expr *ExprGen::visitGetElementPtrInst(llvm::GetElementPtrInst &inst) {
     switch (indexed_type->getTypeID()) {
       // Initial pointer
       case llvm::Type::PointerTyID: {
-        CHECK(idx == *inst.idx_begin())
+        CHECK_THROW(idx == *inst.idx_begin())
             << "Indexing an llvm::PointerType is only valid at first index";
         base = ast.CreateArraySub(base, CreateOperandExpr(idx));
         std::vector<uint64_t> indices({0});
@@ -589,13 +725,15 @@ clang::Expr *ExprGen::visitGetElementPtrInst(llvm::GetElementPtrInst &inst) {
       // Structures
       case llvm::Type::StructTyID: {
         auto mem_idx = llvm::dyn_cast<llvm::ConstantInt>(idx);
-        CHECK(mem_idx) << "Non-constant GEP index while indexing a structure";
+        CHECK_THROW(mem_idx)
+            << "Non-constant GEP index while indexing a structure";
         auto tdecl{dec_ctx.type_decls[indexed_type]};
-        CHECK(tdecl) << "Structure declaration doesn't exist";
+        CHECK_THROW(tdecl) << "Structure declaration doesn't exist";
         auto record{clang::cast<clang::RecordDecl>(tdecl)};
         auto field_it{record->field_begin()};
         std::advance(field_it, mem_idx->getLimitedValue());
-        CHECK(field_it != record->field_end()) << "GEP index is out of bounds";
+        CHECK_THROW(field_it != record->field_end())
+            << "GEP index is out of bounds";
         base = ast.CreateDot(base, *field_it);
         indexed_type =
             llvm::cast<llvm::StructType>(indexed_type)->getTypeAtIndex(idx);
@@ -649,11 +787,11 @@ clang::Expr *ExprGen::visitExtractValueInst(llvm::ExtractValueInst &inst) {
       // Structures
       case llvm::Type::StructTyID: {
         auto tdecl{dec_ctx.type_decls[indexed_type]};
-        CHECK(tdecl) << "Structure declaration doesn't exist";
+        CHECK_THROW(tdecl) << "Structure declaration doesn't exist";
         auto record{clang::cast<clang::RecordDecl>(tdecl)};
         auto field_it{record->field_begin()};
         std::advance(field_it, idx);
-        CHECK(field_it != record->field_end())
+        CHECK_THROW(field_it != record->field_end())
             << "ExtractValue index is out of bounds";
         base = ast.CreateDot(base, *field_it);
         indexed_type =
@@ -1025,7 +1163,7 @@ clang::Stmt *StmtGen::visitStoreInst(llvm::StoreInst &inst) {
 }
 
 clang::Stmt *StmtGen::visitCallInst(llvm::CallInst &inst) {
-  auto &var{dec_ctx.value_decls[&inst]};
+  auto var{dec_ctx.value_decls.lookup(&inst)};
   auto expr{expr_gen.visit(inst)};
   if (var) {
     return ast.CreateAssign(ast.CreateDeclRef(var), expr);
@@ -1066,7 +1204,7 @@ clang::Stmt *StmtGen::visitUnreachableInst(llvm::UnreachableInst &inst) {
 clang::Stmt *StmtGen::visitPHINode(llvm::PHINode &inst) { return nullptr; }
 
 clang::Stmt *StmtGen::visitInstruction(llvm::Instruction &inst) {
-  auto &var{dec_ctx.value_decls[&inst]};
+  auto var{dec_ctx.value_decls.lookup(&inst)};
   if (var) {
     auto expr{expr_gen.visit(inst)};
     return ast.CreateAssign(ast.CreateDeclRef(var), expr);
@@ -1084,8 +1222,7 @@ void IRToASTVisitor::VisitGlobalVar(llvm::GlobalVariable &gvar) {
 
 void IRToASTVisitor::VisitArgument(llvm::Argument &arg) {
   DLOG(INFO) << "VisitArgument: " << LLVMThingToString(&arg);
-  auto &parm{dec_ctx.value_decls[&arg]};
-  if (parm) {
+  if (dec_ctx.value_decls.lookup(&arg)) {
     return;
   }
   // Create a name
@@ -1096,7 +1233,7 @@ void IRToASTVisitor::VisitArgument(llvm::Argument &arg) {
   auto fdecl{clang::cast<clang::FunctionDecl>(dec_ctx.value_decls[func])};
   auto argtype{dec_ctx.type_provider->GetArgumentType(arg)};
   // Create a declaration
-  parm = ast.CreateParamDecl(fdecl, argtype, name);
+  dec_ctx.value_decls[&arg] = ast.CreateParamDecl(fdecl, argtype, name);
 }
 
 void IRToASTVisitor::VisitBasicBlock(llvm::BasicBlock &block,
@@ -1120,6 +1257,214 @@ void IRToASTVisitor::VisitBasicBlock(llvm::BasicBlock &block,
   }
 }
 
+// Counts the instructions that ExprGen inlines into the expression of `inst`,
+// i.e. those that do not have a variable of their own, stopping as soon as
+// there are more than `limit`
+static unsigned GetInlinedSize(llvm::Instruction *inst,
+                               DecompilationContext::IRToValDeclMap &decls,
+                               unsigned limit) {
+  unsigned size{0};
+  std::vector<llvm::Instruction *> worklist{inst};
+  while (!worklist.empty() && size <= limit) {
+    auto cur{worklist.back()};
+    worklist.pop_back();
+    ++size;
+    for (auto &opnd : cur->operands()) {
+      auto op_inst{llvm::dyn_cast<llvm::Instruction>(opnd.get())};
+      if (op_inst && !decls.lookup(op_inst)) {
+        worklist.push_back(op_inst);
+      }
+    }
+  }
+  return size;
+}
+
+// Whether `VisitFunctionDecl` gives `inst` a variable of its own. The other
+// instructions are inlined into the expression of their only user.
+static bool HasVariable(llvm::Instruction &inst) {
+  return llvm::isa<llvm::AllocaInst>(inst) || inst.hasNUsesOrMore(2) ||
+         (inst.hasNUsesOrMore(1) && llvm::isa<llvm::CallInst>(inst)) ||
+         llvm::isa<llvm::PHINode>(inst);
+}
+
+namespace {
+// Blocks at whose entry and exit the variable of a PHI node holds its value
+struct PHILiveness {
+  std::unordered_set<llvm::BasicBlock *> in;
+  std::unordered_set<llvm::BasicBlock *> out;
+};
+}  // namespace
+
+// Computes where the value of `phi` is needed. Its uses are where the
+// expressions it is inlined into are evaluated, and the reaching conditions of
+// every block after a branch may evaluate the condition of the branch, so a
+// branch condition keeps its operands live in all of those blocks. The
+// variable is also assigned at the end of each incoming block and holds the
+// value at the entry of the block of `phi`.
+static PHILiveness GetPHILiveness(llvm::PHINode *phi) {
+  PHILiveness live;
+  auto def{phi->getParent()};
+  std::vector<llvm::BasicBlock *> worklist;
+  auto LiveIn = [&](llvm::BasicBlock *block) {
+    if (block != def && live.in.insert(block).second) {
+      worklist.push_back(block);
+    }
+  };
+
+  std::vector<llvm::Use *> uses;
+  for (auto &use : phi->uses()) {
+    uses.push_back(&use);
+  }
+  while (!uses.empty()) {
+    auto &use{*uses.back()};
+    uses.pop_back();
+    auto user{llvm::cast<llvm::Instruction>(use.getUser())};
+    if (auto user_phi = llvm::dyn_cast<llvm::PHINode>(user)) {
+      auto block{user_phi->getIncomingBlock(use)};
+      live.out.insert(block);
+      LiveIn(block);
+    } else if (llvm::isa<llvm::BranchInst>(user) ||
+               llvm::isa<llvm::SwitchInst>(user)) {
+      std::vector<llvm::BasicBlock *> reached{user->getParent()};
+      std::unordered_set<llvm::BasicBlock *> visited{user->getParent()};
+      while (!reached.empty()) {
+        auto block{reached.back()};
+        reached.pop_back();
+        live.out.insert(block);
+        for (auto succ : llvm::successors(block)) {
+          LiveIn(succ);
+          if (visited.insert(succ).second) {
+            reached.push_back(succ);
+          }
+        }
+      }
+    } else if (!HasVariable(*user)) {
+      for (auto &user_use : user->uses()) {
+        uses.push_back(&user_use);
+      }
+    } else {
+      LiveIn(user->getParent());
+    }
+  }
+  while (!worklist.empty()) {
+    auto block{worklist.back()};
+    worklist.pop_back();
+    for (auto pred : llvm::predecessors(block)) {
+      live.out.insert(pred);
+      LiveIn(pred);
+    }
+  }
+
+  live.in.insert(def);
+  for (auto pred : llvm::predecessors(def)) {
+    live.out.insert(pred);
+  }
+  return live;
+}
+
+// Value held by the variable of `phi` at the exit of `block`, which is in the
+// liveness of `phi`
+static llvm::Value *GetValueOut(llvm::PHINode *phi, llvm::BasicBlock *block) {
+  auto idx{phi->getBasicBlockIndex(block)};
+  return idx < 0 ? phi : phi->getIncomingValue(idx);
+}
+
+// Partitions the PHI nodes of `func` into webs of nodes that flow into each
+// other and whose variables can be merged: they are never needed at the entry
+// of the same block, and are only needed at the exit of the same block if
+// they hold the same value there. Returns the first node of the web of each
+// node that shares its web with others.
+static std::unordered_map<llvm::PHINode *, llvm::PHINode *> GetPHIWebs(
+    llvm::Function &func) {
+  std::vector<llvm::PHINode *> phis;
+  std::unordered_map<llvm::PHINode *, size_t> index;
+  for (auto &inst : llvm::instructions(func)) {
+    if (auto phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+      index[phi] = phis.size();
+      phis.push_back(phi);
+    }
+  }
+
+  std::vector<size_t> parent(phis.size());
+  std::vector<std::vector<size_t>> members(phis.size());
+  for (size_t i{0}; i < phis.size(); ++i) {
+    parent[i] = i;
+    members[i] = {i};
+  }
+  auto Find = [&](size_t i) {
+    while (parent[i] != i) {
+      i = parent[i] = parent[parent[i]];
+    }
+    return i;
+  };
+
+  std::unordered_map<size_t, PHILiveness> liveness;
+  auto GetLiveness = [&](size_t i) -> PHILiveness & {
+    auto it{liveness.find(i)};
+    if (it == liveness.end()) {
+      it = liveness.emplace(i, GetPHILiveness(phis[i])).first;
+    }
+    return it->second;
+  };
+  auto Interfere = [&](size_t a, size_t b) {
+    auto &live_a{GetLiveness(a)};
+    auto &live_b{GetLiveness(b)};
+    for (auto block : live_a.in) {
+      if (live_b.in.count(block)) {
+        return true;
+      }
+    }
+    for (auto block : live_a.out) {
+      if (live_b.out.count(block) && GetValueOut(phis[a], block) !=
+                                         GetValueOut(phis[b], block)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  for (size_t i{0}; i < phis.size(); ++i) {
+    auto phi{phis[i]};
+    for (auto &incoming : phi->incoming_values()) {
+      auto other{llvm::dyn_cast<llvm::PHINode>(incoming.get())};
+      if (!other || other == phi || other->getType() != phi->getType()) {
+        continue;
+      }
+      auto web_a{Find(i)};
+      auto web_b{Find(index[other])};
+      if (web_a == web_b) {
+        continue;
+      }
+      bool interfere{false};
+      for (auto a : members[web_a]) {
+        for (auto b : members[web_b]) {
+          interfere = interfere || Interfere(a, b);
+        }
+      }
+      if (interfere) {
+        continue;
+      }
+      // The first node of the web stays its representative
+      if (web_b < web_a) {
+        std::swap(web_a, web_b);
+      }
+      parent[web_b] = web_a;
+      members[web_a].insert(members[web_a].end(), members[web_b].begin(),
+                            members[web_b].end());
+      members[web_b].clear();
+    }
+  }
+
+  std::unordered_map<llvm::PHINode *, llvm::PHINode *> webs;
+  for (size_t i{0}; i < phis.size(); ++i) {
+    auto web{Find(i)};
+    if (members[web].size() > 1) {
+      webs[phis[i]] = phis[web];
+    }
+  }
+  return webs;
+}
+
 void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
   auto name{func.getName().str()};
   DLOG(INFO) << "VisitFunctionDecl: " << name;
@@ -1129,8 +1474,7 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
     return;
   }
 
-  auto &decl{dec_ctx.value_decls[&func]};
-  if (decl) {
+  if (dec_ctx.value_decls.lookup(&func)) {
     return;
   }
 
@@ -1145,7 +1489,8 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
   clang::FunctionProtoType::ExtProtoInfo epi;
   epi.Variadic = func.isVarArg();
   auto ftype{dec_ctx.ast_ctx.getFunctionType(ret_type, arg_types, epi)};
-  decl = ast.CreateFunctionDecl(tudecl, ftype, name);
+  auto decl{ast.CreateFunctionDecl(tudecl, ftype, name)};
+  dec_ctx.value_decls[&func] = decl;
 
   tudecl->addDecl(decl);
 
@@ -1159,10 +1504,20 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
   auto fdecl{decl->getAsFunction()};
   fdecl->setParams(params);
 
+  std::unordered_map<llvm::PHINode *, llvm::PHINode *> phi_webs;
+  if (dec_ctx.coalesce_phi_nodes) {
+    phi_webs = GetPHIWebs(func);
+  }
+  auto GetWeb = [&](llvm::Value *value) {
+    auto phi{llvm::dyn_cast<llvm::PHINode>(value)};
+    auto it{phi ? phi_webs.find(phi) : phi_webs.end()};
+    return it == phi_webs.end() ? value : it->second;
+  };
+
   for (auto &inst : llvm::instructions(func)) {
-    auto &var{dec_ctx.value_decls[&inst]};
     if (auto alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst)) {
-      auto name{"var" + std::to_string(GetNumDecls<clang::VarDecl>(fdecl))};
+      auto name{"var" +
+                std::to_string(dec_ctx.GetNumDecls<clang::VarDecl>(fdecl))};
       // TLDR: Here we discard the variable name as present in the bitcode
       // because there probably is a better one we can assign afterwards, using
       // debug metadata.
@@ -1181,13 +1536,15 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
       // (`varname_addr` being a common name used by clang for variables used as
       // storage for parameters e.g. a parameter named "foo" has a corresponding
       // local variable named "foo_addr").
-      var = ast.CreateVarDecl(
-          fdecl, dec_ctx.GetQualType(alloca->getAllocatedType()), name);
+      auto var{ast.CreateVarDecl(
+          fdecl, dec_ctx.GetQualType(alloca->getAllocatedType()), name)};
+      dec_ctx.value_decls[&inst] = var;
       fdecl->addDecl(var);
-    } else if (inst.hasNUsesOrMore(2) ||
-               (inst.hasNUsesOrMore(1) && llvm::isa<llvm::CallInst>(inst)) ||
-               llvm::isa<llvm::PHINode>(inst)) {
-      if (!inst.getType()->isVoidTy()) {
+    } else if (HasVariable(inst)) {
+      if (GetWeb(&inst) != &inst) {
+        // The first node of a web comes first, so its variable exists already
+        dec_ctx.value_decls[&inst] = dec_ctx.value_decls[GetWeb(&inst)];
+      } else if (!inst.getType()->isVoidTy()) {
         auto GetPrefix{[&](llvm::Instruction *inst) {
           if (llvm::isa<llvm::CallInst>(inst)) {
             return "call";
@@ -1198,23 +1555,32 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
           }
         }};
 
-        auto name{GetPrefix(&inst) +
-                  std::to_string(GetNumDecls<clang::VarDecl>(fdecl))};
+        auto name{
+            GetPrefix(&inst) +
+            std::to_string(dec_ctx.GetNumDecls<clang::VarDecl>(fdecl))};
         auto type{dec_ctx.GetQualType(inst.getType())};
         if (auto arrayType = clang::dyn_cast<clang::ArrayType>(type)) {
           type = dec_ctx.ast_ctx.getPointerType(arrayType->getElementType());
         }
 
-        var = ast.CreateVarDecl(fdecl, type, name);
+        auto var{ast.CreateVarDecl(fdecl, type, name)};
+        dec_ctx.value_decls[&inst] = var;
         fdecl->addDecl(var);
+      }
 
-        if (auto phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
-          for (auto i{0U}; i < phi->getNumIncomingValues(); ++i) {
-            auto bb{phi->getIncomingBlock(i)};
-            auto &use{phi->getOperandUse(i)};
-
-            dec_ctx.outgoing_uses[bb].push_back(&use);
+      auto phi{llvm::dyn_cast<llvm::PHINode>(&inst)};
+      if (phi && !phi->getType()->isVoidTy()) {
+        for (auto i{0U}; i < phi->getNumIncomingValues(); ++i) {
+          // Nodes of the same web share their variable, so copies between
+          // them are left out
+          if (dec_ctx.coalesce_phi_nodes &&
+              GetWeb(phi->getIncomingValue(i)) == GetWeb(phi)) {
+            continue;
           }
+          auto bb{phi->getIncomingBlock(i)};
+          auto &use{phi->getOperandUse(i)};
+
+          dec_ctx.outgoing_uses[bb].push_back(&use);
         }
       }
     }
@@ -1223,17 +1589,17 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
       if (auto iasm = llvm::dyn_cast<llvm::InlineAsm>(&opnd)) {
         // TODO(frabert): We still need to find a way to embed the inline asm
         // into the function
-        auto &decl{dec_ctx.value_decls[iasm]};
-        if (decl) {
+        if (dec_ctx.value_decls.lookup(iasm)) {
           return;
         }
 
         auto tudecl{dec_ctx.ast_ctx.getTranslationUnitDecl()};
-        auto name{"asm_" +
-                  std::to_string(GetNumDecls<clang::FunctionDecl>(tudecl))};
+        auto num_functions{dec_ctx.GetNumDecls<clang::FunctionDecl>(tudecl)};
+        auto name{"asm_" + std::to_string(num_functions)};
         auto ftype{iasm->getFunctionType()};
         auto type{dec_ctx.GetQualType(ftype)};
-        decl = ast.CreateFunctionDecl(tudecl, type, name);
+        auto decl{ast.CreateFunctionDecl(tudecl, type, name)};
+        dec_ctx.value_decls[iasm] = decl;
 
         std::vector<clang::ParmVarDecl *> iasm_params;
         for (auto arg : ftype->params()) {
@@ -1250,6 +1616,37 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
       }
     }
   }
+
+  // Conditions of branches and switches are materialized every time a
+  // reaching condition refers to them, so large ones are computed once into a
+  // variable instead
+  if (!dec_ctx.cond_var_size) {
+    return;
+  }
+
+  for (auto &block : func) {
+    auto term{block.getTerminator()};
+    llvm::Value *cond{nullptr};
+    if (auto br = llvm::dyn_cast<llvm::BranchInst>(term)) {
+      cond = br->isConditional() ? br->getCondition() : nullptr;
+    } else if (auto sw = llvm::dyn_cast<llvm::SwitchInst>(term)) {
+      cond = sw->getCondition();
+    }
+
+    auto inst{llvm::dyn_cast_or_null<llvm::Instruction>(cond)};
+    if (!inst || dec_ctx.value_decls.lookup(inst) ||
+        GetInlinedSize(inst, dec_ctx.value_decls, dec_ctx.cond_var_size) <=
+            dec_ctx.cond_var_size) {
+      continue;
+    }
+
+    auto name{"cond" +
+              std::to_string(dec_ctx.GetNumDecls<clang::VarDecl>(fdecl))};
+    auto var{
+        ast.CreateVarDecl(fdecl, dec_ctx.GetQualType(inst->getType()), name)};
+    dec_ctx.value_decls[inst] = var;
+    fdecl->addDecl(var);
+  }
 }
 
 clang::Expr *IRToASTVisitor::CreateOperandExpr(llvm::Use &val) {
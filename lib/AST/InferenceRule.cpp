@@ -11,27 +11,90 @@
 #include <clang/AST/Stmt.h>
 #include <clang/Frontend/ASTUnit.h>
 
+#include <chrono>
+
 namespace rellic {
 
-clang::Stmt *ApplyFirstMatchingRule(
-    DecompilationContext &dec_ctx, clang::Stmt *stmt,
-    std::vector<std::unique_ptr<InferenceRule>> &rules) {
-  clang::ast_matchers::MatchFinder::MatchFinderOptions opts;
-  clang::ast_matchers::MatchFinder finder(opts);
+void InferenceRuleSet::AddRule(std::string name,
+                               std::unique_ptr<InferenceRule> rule) {
+  rules.push_back(std::move(rule));
+  names.push_back(std::move(name));
+  index.clear();
+}
+
+InferenceRuleSet::Candidates &InferenceRuleSet::GetCandidates(
+    DecompilationContext &dec_ctx, clang::Stmt *stmt) {
+  auto &candidates{index[stmt->getStmtClass()]};
+  if (!candidates) {
+    candidates = std::make_unique<Candidates>();
+    auto kind{clang::ASTNodeKind::getFromNode(*stmt)};
+    for (size_t i{0}; i < rules.size(); ++i) {
+      auto &rule{rules[i]};
+      clang::ast_matchers::internal::DynTypedMatcher matcher{
+          rule->GetCondition()};
+      if (matcher.canMatchNodesOfKind(kind)) {
+        candidates->rules.push_back(rule.get());
+        // Entries of the map are never moved, and the rule set is only used
+        // with the decompilation context of its pass
+        candidates->stats.push_back(&dec_ctx.rule_stats[names[i]]);
+        candidates->finder.addMatcher(rule->GetCondition(), rule.get());
+      }
+    }
+  }
+  return *candidates;
+}
+
+clang::Stmt *InferenceRuleSet::ApplyFirstMatchingRule(
+    DecompilationContext &dec_ctx, clang::Stmt *stmt) {
+  auto &candidates{GetCandidates(dec_ctx, stmt)};
+  if (candidates.rules.empty()) {
+    return stmt;
+  }
 
-  for (auto &rule : rules) {
-    finder.addMatcher(rule->GetCondition(), rule.get());
+  for (auto rule : candidates.rules) {
+    rule->Reset();
   }
 
-  finder.match(*stmt, dec_ctx.ast_unit.getASTContext());
+  auto &ast_ctx{dec_ctx.ast_unit.getASTContext()};
+  auto num_rules{candidates.rules.size()};
+  if (dec_ctx.rule_timing) {
+    if (candidates.finders.empty()) {
+      for (auto rule : candidates.rules) {
+        auto &finder{*candidates.finders.emplace_back(
+            std::make_unique<clang::ast_matchers::MatchFinder>())};
+        finder.addMatcher(rule->GetCondition(), rule);
+      }
+    }
+    for (size_t i{0}; i < num_rules; ++i) {
+      auto start{std::chrono::steady_clock::now()};
+      candidates.finders[i]->match(*stmt, ast_ctx);
+      candidates.stats[i]->match_elapsed +=
+          std::chrono::steady_clock::now() - start;
+    }
+  } else {
+    candidates.finder.match(*stmt, ast_ctx);
+  }
 
-  for (auto &rule : rules) {
-    if (*rule) {
-      return rule->GetOrCreateSubstitution(dec_ctx, stmt);
+  clang::Stmt *sub{stmt};
+  bool fired{false};
+  for (size_t i{0}; i < num_rules; ++i) {
+    auto &rule{*candidates.rules[i]};
+    auto &stats{*candidates.stats[i]};
+    ++stats.num_attempts;
+    if (!rule) {
+      continue;
+    }
+    ++stats.num_matches;
+    if (!fired) {
+      auto start{std::chrono::steady_clock::now()};
+      sub = rule.GetOrCreateSubstitution(dec_ctx, stmt);
+      stats.fire_elapsed += std::chrono::steady_clock::now() - start;
+      ++stats.num_fires;
+      fired = true;
     }
   }
 
-  return stmt;
+  return sub;
 }
 
 }  // namespace rellic
\ No newline at end of file
@@ -18,17 +18,28 @@ namespace rellic {
 
 LocalDeclRenamer::LocalDeclRenamer(DecompilationContext &dec_ctx,
                                    IRToNameMap &names)
-    : TransformVisitor<LocalDeclRenamer>(dec_ctx),
-      seen_names(1),
-      names(names) {}
-
-bool LocalDeclRenamer::IsNameVisible(const std::string &name) {
-  for (auto &scope : seen_names) {
-    if (scope.find(name) != scope.end()) {
-      return true;
-    }
+    : TransformVisitor<LocalDeclRenamer>(dec_ctx), names(names) {}
+
+bool LocalDeclRenamer::IsNameVisible(llvm::StringRef name) {
+  auto it{visible_names.find(name)};
+  return it != visible_names.end() && it->second;
+}
+
+void LocalDeclRenamer::DeclareName(llvm::StringRef name) {
+  auto &entry{*visible_names.try_emplace(name, 0).first};
+  ++entry.second;
+  declared_names.push_back(&entry);
+}
+
+void LocalDeclRenamer::PushScope() { scopes.push_back(declared_names.size()); }
+
+void LocalDeclRenamer::PopScope() {
+  auto start{scopes.back()};
+  scopes.pop_back();
+  for (auto i{start}; i < declared_names.size(); ++i) {
+    --declared_names[i]->second;
   }
-  return false;
+  declared_names.resize(start);
 }
 
 bool LocalDeclRenamer::VisitVarDecl(clang::VarDecl *decl) {
@@ -44,12 +55,12 @@ bool LocalDeclRenamer::VisitVarDecl(clang::VarDecl *decl) {
 
   auto name{names.find(val->second)};
   if (name == names.end()) {
-    seen_names.back().insert(decl->getName().str());
+    DeclareName(decl->getName());
     return !Stopped();
   }
 
   if (!IsNameVisible(name->second)) {
-    seen_names.back().insert(name->second);
+    DeclareName(name->second);
     decl->setDeclName(dec_ctx.ast.CreateIdentifier(name->second));
   } else {
     // Append the automatically-generated name to the debug-info name in order
@@ -58,20 +69,19 @@ bool LocalDeclRenamer::VisitVarDecl(clang::VarDecl *decl) {
     auto old_name{decl->getName().str()};
     auto new_name{name->second + "_" + old_name};
     decl->setDeclName(dec_ctx.ast.CreateIdentifier(new_name));
-    seen_names.back().insert(new_name);
+    DeclareName(new_name);
   }
 
   return !Stopped();
 }
 
 bool LocalDeclRenamer::TraverseFunctionDecl(clang::FunctionDecl *decl) {
-  std::unordered_set<std::string> scope;
+  PushScope();
   for (auto param : decl->parameters()) {
-    scope.insert(param->getName().str());
+    DeclareName(param->getName());
   }
-  seen_names.push_back(scope);
-  RecursiveASTVisitor<LocalDeclRenamer>::TraverseFunctionDecl(decl);
-  seen_names.pop_back();
+  TransformVisitor<LocalDeclRenamer>::TraverseFunctionDecl(decl);
+  PopScope();
   return !Stopped();
 }
 
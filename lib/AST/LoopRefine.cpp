@@ -17,6 +17,7 @@
 #include "rellic/AST/ASTBuilder.h"
 #include "rellic/AST/InferenceRule.h"
 #include "rellic/AST/Util.h"
+#include "rellic/Exception.h"
 
 namespace rellic {
 
@@ -51,7 +52,7 @@ class WhileRule : public InferenceRule {
                                        clang::Stmt *stmt) override {
     auto loop{clang::dyn_cast<clang::WhileStmt>(stmt)};
 
-    CHECK(loop && loop == match)
+    CHECK_THROW(loop && loop == match)
         << "Substituted WhileStmt is not the matched WhileStmt!";
 
     auto comp{clang::cast<clang::CompoundStmt>(loop->getBody())};
@@ -64,8 +65,8 @@ class WhileRule : public InferenceRule {
               std::back_inserter(new_body));
     auto new_while{dec_ctx.ast.CreateWhile(
         dec_ctx.marker_expr, dec_ctx.ast.CreateCompoundStmt(new_body))};
-    dec_ctx.conds[new_while] =
-        dec_ctx.InsertZExpr(!dec_ctx.z3_exprs[dec_ctx.conds[ifstmt]]);
+    auto cond{dec_ctx.z3_exprs[dec_ctx.GetCond(ifstmt)]};
+    dec_ctx.SetCond(new_while, dec_ctx.InsertZExpr(!cond));
     return new_while;
   }
 };
@@ -91,7 +92,7 @@ class ElseWhileRule : public InferenceRule {
                                        clang::Stmt *stmt) override {
     auto loop{clang::dyn_cast<clang::WhileStmt>(stmt)};
 
-    CHECK(loop && loop == match)
+    CHECK_THROW(loop && loop == match)
         << "Substituted WhileStmt is not the matched WhileStmt!";
 
     auto comp{clang::cast<clang::CompoundStmt>(loop->getBody())};
@@ -99,7 +100,7 @@ class ElseWhileRule : public InferenceRule {
     std::vector<clang::Stmt *> new_body;
     auto new_while{dec_ctx.ast.CreateWhile(
         dec_ctx.marker_expr, dec_ctx.ast.CreateCompoundStmt(new_body))};
-    dec_ctx.conds[new_while] = dec_ctx.conds[ifstmt];
+    dec_ctx.SetCond(new_while, dec_ctx.conds.lookup(ifstmt));
     return new_while;
   }
 };
@@ -125,22 +126,23 @@ class DoWhileRule : public InferenceRule {
                                        clang::Stmt *stmt) override {
     auto loop{clang::dyn_cast<clang::WhileStmt>(stmt)};
 
-    CHECK(loop && loop == match)
+    CHECK_THROW(loop && loop == match)
         << "Substituted WhileStmt is not the matched WhileStmt!";
 
     auto comp{clang::cast<clang::CompoundStmt>(loop->getBody())};
     auto ifstmt{clang::cast<clang::IfStmt>(comp->body_back())};
-    auto cond{dec_ctx.z3_exprs[dec_ctx.conds[ifstmt]]};
+    auto cond{dec_ctx.z3_exprs[dec_ctx.GetCond(ifstmt)]};
     std::vector<clang::Stmt *> new_body(comp->body_begin(),
                                         comp->body_end() - 1);
+    auto not_cond{dec_ctx.InsertZExpr(!cond)};
     if (auto else_stmt = ifstmt->getElse()) {
       auto new_if{dec_ctx.ast.CreateIf(dec_ctx.marker_expr, else_stmt)};
-      dec_ctx.conds[new_if] = dec_ctx.z3_exprs.size();
+      dec_ctx.SetCond(new_if, not_cond);
       new_body.push_back(new_if);
     }
     auto new_do{dec_ctx.ast.CreateDo(dec_ctx.marker_expr,
                                      dec_ctx.ast.CreateCompoundStmt(new_body))};
-    dec_ctx.conds[new_do] = dec_ctx.InsertZExpr(!cond);
+    dec_ctx.SetCond(new_do, not_cond);
     return new_do;
   }
 };
@@ -166,7 +168,7 @@ class ElseDoWhileRule : public InferenceRule {
                                        clang::Stmt *stmt) override {
     auto loop{clang::dyn_cast<clang::WhileStmt>(stmt)};
 
-    CHECK(loop && loop == match)
+    CHECK_THROW(loop && loop == match)
         << "Substituted WhileStmt is not the matched WhileStmt!";
 
     auto comp{clang::cast<clang::CompoundStmt>(loop->getBody())};
@@ -174,12 +176,15 @@ class ElseDoWhileRule : public InferenceRule {
     std::vector<clang::Stmt *> new_body(comp->body_begin(),
                                         comp->body_end() - 1);
 
+    if (dec_ctx.journal) {
+      dec_ctx.journal->RecordChildren(ifstmt);
+    }
     ifstmt->setElse(nullptr);
     new_body.push_back(ifstmt);
 
     auto new_do{dec_ctx.ast.CreateDo(dec_ctx.marker_expr,
                                      dec_ctx.ast.CreateCompoundStmt(new_body))};
-    dec_ctx.conds[new_do] = dec_ctx.conds[ifstmt];
+    dec_ctx.SetCond(new_do, dec_ctx.conds.lookup(ifstmt));
     return new_do;
   }
 };
@@ -195,6 +200,11 @@ class NestedDoWhileRule : public InferenceRule {
                       hasBody(compoundStmt(findAll(ifStmt(
                           stmt().bind("if"), hasThen(has(breakStmt())))))))) {}
 
+  void Reset() override {
+    InferenceRule::Reset();
+    matched = false;
+  }
+
   void run(const MatchFinder::MatchResult &result) override {
     if (!matched) {
       auto loop{result.Nodes.getNodeAs<clang::WhileStmt>("while")};
@@ -213,28 +223,29 @@ class NestedDoWhileRule : public InferenceRule {
                                        clang::Stmt *stmt) override {
     auto loop{clang::dyn_cast<clang::WhileStmt>(stmt)};
 
-    CHECK(loop && loop == match)
+    CHECK_THROW(loop && loop == match)
         << "Substituted WhileStmt is not the matched WhileStmt!";
     auto comp{clang::cast<clang::CompoundStmt>(loop->getBody())};
     auto if_stmt{clang::cast<clang::IfStmt>(comp->body_back())};
-    auto cond{dec_ctx.z3_exprs[dec_ctx.conds[if_stmt]]};
+    auto cond{dec_ctx.z3_exprs[dec_ctx.GetCond(if_stmt)]};
 
     std::vector<clang::Stmt *> do_body(comp->body_begin(),
                                        comp->body_end() - 1);
+    auto not_cond{dec_ctx.InsertZExpr(!cond)};
     if (auto else_stmt = if_stmt->getElse()) {
       auto new_if{dec_ctx.ast.CreateIf(dec_ctx.marker_expr, else_stmt)};
-      dec_ctx.conds[new_if] = dec_ctx.z3_exprs.size();
+      dec_ctx.SetCond(new_if, not_cond);
       do_body.push_back(new_if);
     }
 
     auto do_stmt{dec_ctx.ast.CreateDo(dec_ctx.marker_expr,
                                       dec_ctx.ast.CreateCompoundStmt(do_body))};
-    dec_ctx.conds[do_stmt] = dec_ctx.InsertZExpr(!cond);
+    dec_ctx.SetCond(do_stmt, not_cond);
 
     std::vector<clang::Stmt *> while_body({do_stmt, if_stmt->getThen()});
     auto new_while{dec_ctx.ast.CreateWhile(
         dec_ctx.marker_expr, dec_ctx.ast.CreateCompoundStmt(while_body))};
-    dec_ctx.conds[new_while] = dec_ctx.conds[loop];
+    dec_ctx.SetCond(new_while, dec_ctx.conds.lookup(loop));
     return new_while;
   }
 };
@@ -265,7 +276,7 @@ class LoopToSeq : public InferenceRule {
                                        clang::Stmt *stmt) override {
     auto loop = clang::dyn_cast<clang::WhileStmt>(stmt);
 
-    CHECK(loop && loop == match)
+    CHECK_THROW(loop && loop == match)
         << "Substituted WhileStmt is not the matched WhileStmt!";
 
     auto loop_body{clang::cast<clang::CompoundStmt>(loop->getBody())};
@@ -288,6 +299,9 @@ class LoopToSeq : public InferenceRule {
         }
         branch = dec_ctx.ast.CreateCompoundStmt(new_branch_body);
       }
+      if (dec_ctx.journal) {
+        dec_ctx.journal->RecordChildren(ifstmt);
+      }
       ifstmt->setThen(branches[0]);
       ifstmt->setElse(branches[1]);
     } else {
@@ -317,14 +331,14 @@ class CondToSeqRule : public InferenceRule {
                                        clang::Stmt *stmt) override {
     auto loop{clang::dyn_cast<clang::WhileStmt>(stmt)};
 
-    CHECK(loop && loop == match)
+    CHECK_THROW(loop && loop == match)
         << "Substituted WhileStmt is not the matched WhileStmt!";
 
     auto body{clang::cast<clang::CompoundStmt>(loop->getBody())};
     auto ifstmt{clang::cast<clang::IfStmt>(body->body_front())};
     auto inner_loop{
         dec_ctx.ast.CreateWhile(dec_ctx.marker_expr, ifstmt->getThen())};
-    dec_ctx.conds[inner_loop] = dec_ctx.conds[ifstmt];
+    dec_ctx.SetCond(inner_loop, dec_ctx.conds.lookup(ifstmt));
     std::vector<clang::Stmt *> new_body({inner_loop});
     if (auto comp = clang::dyn_cast<clang::CompoundStmt>(ifstmt->getElse())) {
       new_body.insert(new_body.end(), comp->body_begin(), comp->body_end());
@@ -333,7 +347,7 @@ class CondToSeqRule : public InferenceRule {
     }
     auto new_while{dec_ctx.ast.CreateWhile(
         dec_ctx.marker_expr, dec_ctx.ast.CreateCompoundStmt(new_body))};
-    dec_ctx.conds[new_while] = dec_ctx.conds[loop];
+    dec_ctx.SetCond(new_while, dec_ctx.conds.lookup(loop));
     return new_while;
   }
 };
@@ -355,15 +369,15 @@ class CondToSeqNegRule : public InferenceRule {
                                        clang::Stmt *stmt) override {
     auto loop{clang::dyn_cast<clang::WhileStmt>(stmt)};
 
-    CHECK(loop && loop == match)
+    CHECK_THROW(loop && loop == match)
         << "Substituted WhileStmt is not the matched WhileStmt!";
 
     auto body{clang::cast<clang::CompoundStmt>(loop->getBody())};
     auto ifstmt{clang::cast<clang::IfStmt>(body->body_front())};
-    auto cond{dec_ctx.z3_exprs[dec_ctx.conds[ifstmt]]};
+    auto cond{dec_ctx.z3_exprs[dec_ctx.GetCond(ifstmt)]};
     auto inner_loop{
         dec_ctx.ast.CreateWhile(dec_ctx.marker_expr, ifstmt->getElse())};
-    dec_ctx.conds[inner_loop] = dec_ctx.InsertZExpr(!cond);
+    dec_ctx.SetCond(inner_loop, dec_ctx.InsertZExpr(!cond));
     std::vector<clang::Stmt *> new_body({inner_loop});
     if (auto comp = clang::dyn_cast<clang::CompoundStmt>(ifstmt->getThen())) {
       new_body.insert(new_body.end(), comp->body_begin(), comp->body_end());
@@ -373,7 +387,7 @@ class CondToSeqNegRule : public InferenceRule {
 
     auto new_while{dec_ctx.ast.CreateWhile(
         dec_ctx.marker_expr, dec_ctx.ast.CreateCompoundStmt(new_body))};
-    dec_ctx.conds[new_while] = dec_ctx.conds[loop];
+    dec_ctx.SetCond(new_while, dec_ctx.conds.lookup(loop));
     return new_while;
   }
 };
@@ -381,10 +395,23 @@ class CondToSeqNegRule : public InferenceRule {
 }  // namespace
 
 LoopRefine::LoopRefine(DecompilationContext &dec_ctx)
-    : TransformVisitor<LoopRefine>(dec_ctx) {}
+    : TransformVisitor<LoopRefine>(dec_ctx) {
+  rules.AddRule("CondToSeqRule", std::make_unique<CondToSeqRule>());
+  rules.AddRule("CondToSeqNegRule", std::make_unique<CondToSeqNegRule>());
+  rules.AddRule("NestedDoWhileRule", std::make_unique<NestedDoWhileRule>());
+  rules.AddRule("LoopToSeq", std::make_unique<LoopToSeq>());
+  rules.AddRule("WhileRule", std::make_unique<WhileRule>());
+  rules.AddRule("DoWhileRule", std::make_unique<DoWhileRule>());
+  rules.AddRule("ElseWhileRule", std::make_unique<ElseWhileRule>());
+  rules.AddRule("ElseDoWhileRule", std::make_unique<ElseDoWhileRule>());
+}
 
 bool LoopRefine::VisitWhileStmt(clang::WhileStmt *loop) {
   // DLOG(INFO) << "VisitWhileStmt";
+  // Only loops that are new or whose subtree changed can match now
+  if (dec_ctx.settled_loops.count(loop)) {
+    return !Stopped();
+  }
 
   // If a while statements has an unconditional break in it, it can be
   // substituted for an if statement and all statements after the break can be
@@ -400,29 +427,25 @@ bool LoopRefine::VisitWhileStmt(clang::WhileStmt *loop) {
     return !Stopped();
   }
 
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new CondToSeqRule);
-  rules.emplace_back(new CondToSeqNegRule);
-  rules.emplace_back(new NestedDoWhileRule);
-  rules.emplace_back(new LoopToSeq);
-  rules.emplace_back(new WhileRule);
-  rules.emplace_back(new DoWhileRule);
-  rules.emplace_back(new ElseWhileRule);
-  rules.emplace_back(new ElseDoWhileRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, loop, rules)};
+  auto sub{rules.ApplyFirstMatchingRule(dec_ctx, loop)};
   if (sub != loop) {
     substitutions[loop] = sub;
+  } else {
+    dec_ctx.settled_loops.insert(loop);
   }
 
   return !Stopped();
 }
 
+// Only `while` loops are refined
+bool LoopRefine::AppliesTo(
+    const DecompilationContext::FunctionFeatures &features) const {
+  return features.num_whiles != 0;
+}
+
 void LoopRefine::RunImpl() {
-  LOG(INFO) << "Rule-based loop refinement";
   TransformVisitor<LoopRefine>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  TraverseDirtyFunctions();
 }
 
 }  // namespace rellic
\ No newline at end of file
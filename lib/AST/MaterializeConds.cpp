@@ -19,33 +19,41 @@ MaterializeConds::MaterializeConds(DecompilationContext &dec_ctx)
     : TransformVisitor<MaterializeConds>(dec_ctx), ast_gen(dec_ctx) {}
 
 bool MaterializeConds::VisitIfStmt(clang::IfStmt *stmt) {
-  auto cond{dec_ctx.z3_exprs[dec_ctx.conds[stmt]]};
+  auto cond{dec_ctx.z3_exprs[dec_ctx.GetCond(stmt)]};
   if (stmt->getCond() == dec_ctx.marker_expr) {
+    if (dec_ctx.journal) {
+      dec_ctx.journal->RecordChildren(stmt);
+    }
     stmt->setCond(ast_gen.ConvertExpr(cond));
   }
   return true;
 }
 
 bool MaterializeConds::VisitWhileStmt(clang::WhileStmt *stmt) {
-  auto cond{dec_ctx.z3_exprs[dec_ctx.conds[stmt]]};
+  auto cond{dec_ctx.z3_exprs[dec_ctx.GetCond(stmt)]};
   if (stmt->getCond() == dec_ctx.marker_expr) {
+    if (dec_ctx.journal) {
+      dec_ctx.journal->RecordChildren(stmt);
+    }
     stmt->setCond(ast_gen.ConvertExpr(cond));
   }
   return true;
 }
 
 bool MaterializeConds::VisitDoStmt(clang::DoStmt *stmt) {
-  auto cond{dec_ctx.z3_exprs[dec_ctx.conds[stmt]]};
+  auto cond{dec_ctx.z3_exprs[dec_ctx.GetCond(stmt)]};
   if (stmt->getCond() == dec_ctx.marker_expr) {
+    if (dec_ctx.journal) {
+      dec_ctx.journal->RecordChildren(stmt);
+    }
     stmt->setCond(ast_gen.ConvertExpr(cond));
   }
   return true;
 }
 
 void MaterializeConds::RunImpl() {
-  LOG(INFO) << "Materializing conditions";
   TransformVisitor<MaterializeConds>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  TraverseDirtyFunctions();
 }
 
 }  // namespace rellic
@@ -12,7 +12,9 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <optional>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "rellic/AST/ASTBuilder.h"
@@ -21,8 +23,97 @@
 namespace rellic {
 // Stores a set of expression that have a known value, so that they can be
 // recognized as part of larger expressions and simplified.
-struct KnownExprs {
+//
+// Nested scopes are opened and closed with `Push` and `Pop`, which undo the
+// changes made since the matching `Push` instead of copying the whole set.
+class KnownExprs {
   std::unordered_map<unsigned, bool> values;
+  // Previous value of every entry changed since the outermost open scope
+  std::vector<std::pair<unsigned, std::optional<bool>>> undo_log;
+  // Size of `undo_log` when each open scope was pushed
+  std::vector<size_t> scopes;
+
+  // Incremented whenever `values` changes, so that each set of known values
+  // has its own version
+  unsigned version{0};
+  // Results of `ApplyAssumptions` for the current version, by expression id
+  std::unordered_map<unsigned, std::pair<z3::expr, bool>> memo;
+  unsigned memo_version{0};
+
+  void SetValue(unsigned id, bool value) {
+    auto it{values.find(id)};
+    if (it != values.end() && it->second == value) {
+      return;
+    }
+
+    if (!scopes.empty()) {
+      undo_log.emplace_back(id, it == values.end()
+                                    ? std::nullopt
+                                    : std::optional<bool>(it->second));
+    }
+    values[id] = value;
+    ++version;
+  }
+
+  z3::expr Apply(z3::expr expr, bool& changed) {
+    auto it{values.find(expr.id())};
+    if (it != values.end()) {
+      changed = true;
+      return expr.ctx().bool_val(it->second);
+    }
+
+    if (!expr.is_and() && !expr.is_or() && !expr.is_not()) {
+      return expr;
+    }
+
+    if (memo_version != version) {
+      memo.clear();
+      memo_version = version;
+    }
+    auto memoized{memo.find(expr.id())};
+    if (memoized != memo.end()) {
+      changed |= memoized->second.second;
+      return memoized->second.first;
+    }
+
+    bool expr_changed{false};
+    auto result{expr};
+    if (expr.is_not()) {
+      result = !Apply(expr.arg(0), expr_changed);
+    } else {
+      z3::expr_vector args{expr.ctx()};
+      for (auto arg : expr.args()) {
+        args.push_back(Apply(arg, expr_changed));
+      }
+      result = expr.is_and() ? z3::mk_and(args) : z3::mk_or(args);
+    }
+
+    memo.emplace(expr.id(), std::make_pair(result, expr_changed));
+    changed |= expr_changed;
+    return result;
+  }
+
+ public:
+  void Push() { scopes.push_back(undo_log.size()); }
+
+  void Pop() {
+    auto size{scopes.back()};
+    scopes.pop_back();
+    if (undo_log.size() == size) {
+      return;
+    }
+
+    while (undo_log.size() > size) {
+      auto [id, value] = undo_log.back();
+      undo_log.pop_back();
+      if (value) {
+        values[id] = *value;
+      } else {
+        values.erase(id);
+      }
+    }
+    ++version;
+  }
 
   void AddExpr(z3::expr expr, bool value) {
     // When adding expressions to the set of known values, it's important that
@@ -67,7 +158,7 @@ struct KnownExprs {
       return;
     }
 
-    values[expr.id()] = value;
+    SetValue(expr.id(), value);
   }
 
   // Simplify an expression `expr` using all the known values stored. Sets
@@ -76,30 +167,19 @@ struct KnownExprs {
     if (values.empty()) {
       return expr;
     }
+    return Apply(expr, changed);
+  }
+};
 
-    if (values.find(expr.id()) != values.end()) {
-      changed = true;
-      return expr.ctx().bool_val(values[expr.id()]);
-    }
-
-    if (expr.is_and() || expr.is_or()) {
-      z3::expr_vector args{expr.ctx()};
-      for (auto arg : expr.args()) {
-        args.push_back(ApplyAssumptions(arg, changed));
-      }
-      if (expr.is_and()) {
-        return z3::mk_and(args);
-      } else {
-        return z3::mk_or(args);
-      }
-    }
-
-    if (expr.is_not()) {
-      return !ApplyAssumptions(expr.arg(0), changed);
-    }
+// Opens a scope of known values for its lifetime
+class KnownExprsScope {
+  KnownExprs& known_exprs;
 
-    return expr;
+ public:
+  KnownExprsScope(KnownExprs& known_exprs) : known_exprs(known_exprs) {
+    known_exprs.Push();
   }
+  ~KnownExprsScope() { known_exprs.Pop(); }
 };
 
 class CompoundVisitor
@@ -109,24 +189,29 @@ class CompoundVisitor
 
   template <bool cond_is_true_in_body, typename T>
   bool VisitLoop(T* loop, KnownExprs& known_exprs) {
-    auto cond_idx{dec_ctx.conds[loop]};
+    auto cond_idx{dec_ctx.GetCond(loop)};
     bool changed{false};
     auto old_cond{dec_ctx.z3_exprs[cond_idx]};
     auto new_cond{known_exprs.ApplyAssumptions(old_cond, changed)};
     if (loop->getCond() != dec_ctx.marker_expr && changed) {
-      dec_ctx.z3_exprs.set(cond_idx, new_cond);
-      return true;
+      // The new condition may have the same canonical form as the old one
+      auto new_idx{dec_ctx.InsertZExpr(new_cond)};
+      if (new_idx != cond_idx) {
+        dec_ctx.SetCond(loop, new_idx);
+        return true;
+      }
     }
 
-    auto inner{known_exprs};
-    if constexpr (cond_is_true_in_body) {
-      inner.AddExpr(new_cond, true);
+    {
+      KnownExprsScope inner{known_exprs};
+      if constexpr (cond_is_true_in_body) {
+        known_exprs.AddExpr(new_cond, true);
+      }
+      if (Visit(loop->getBody(), known_exprs)) {
+        return true;
+      }
     }
     known_exprs.AddExpr(new_cond, false);
-
-    if (Visit(loop->getBody(), inner)) {
-      return true;
-    }
     return false;
   }
 
@@ -153,25 +238,31 @@ class CompoundVisitor
   }
 
   bool VisitIfStmt(clang::IfStmt* if_stmt, KnownExprs& known_exprs) {
-    auto cond_idx{dec_ctx.conds[if_stmt]};
+    auto cond_idx{dec_ctx.GetCond(if_stmt)};
     bool changed{false};
     auto old_cond{dec_ctx.z3_exprs[cond_idx]};
     auto new_cond{known_exprs.ApplyAssumptions(old_cond, changed)};
     if (if_stmt->getCond() == dec_ctx.marker_expr && changed) {
-      dec_ctx.z3_exprs.set(cond_idx, new_cond);
-      return true;
+      // The new condition may have the same canonical form as the old one
+      auto new_idx{dec_ctx.InsertZExpr(new_cond)};
+      if (new_idx != cond_idx) {
+        dec_ctx.SetCond(if_stmt, new_idx);
+        return true;
+      }
     }
 
-    auto inner_then{known_exprs};
-    inner_then.AddExpr(new_cond, true);
-    if (Visit(if_stmt->getThen(), inner_then)) {
-      return true;
+    {
+      KnownExprsScope inner_then{known_exprs};
+      known_exprs.AddExpr(new_cond, true);
+      if (Visit(if_stmt->getThen(), known_exprs)) {
+        return true;
+      }
     }
 
     if (if_stmt->getElse()) {
-      auto inner_else{known_exprs};
-      inner_else.AddExpr(new_cond, false);
-      if (Visit(if_stmt->getElse(), inner_else)) {
+      KnownExprsScope inner_else{known_exprs};
+      known_exprs.AddExpr(new_cond, false);
+      if (Visit(if_stmt->getElse(), known_exprs)) {
         return true;
       }
     }
@@ -183,7 +274,6 @@ NestedCondProp::NestedCondProp(DecompilationContext& dec_ctx)
     : ASTPass(dec_ctx) {}
 
 void NestedCondProp::RunImpl() {
-  LOG(INFO) << "Propagating conditions";
   changed = false;
   CompoundVisitor visitor{dec_ctx};
 
@@ -193,11 +283,26 @@ void NestedCondProp::RunImpl() {
         return;
       }
 
-      if (fdecl->hasBody()) {
+      if (!dec_ctx.track_function_changes && !dec_ctx.dirty_functions) {
+        if (fdecl->hasBody()) {
+          KnownExprs known_exprs{};
+          if (visitor.Visit(fdecl->getBody(), known_exprs)) {
+            changed = true;
+            return;
+          }
+        }
+        continue;
+      }
+
+      // Definitions are independent of each other, so when tracking changes
+      // a change only ends the visit of the current one
+      if (fdecl->doesThisDeclarationHaveABody() && dec_ctx.IsDirty(fdecl)) {
         KnownExprs known_exprs{};
         if (visitor.Visit(fdecl->getBody(), known_exprs)) {
           changed = true;
-          return;
+          if (dec_ctx.track_function_changes) {
+            dec_ctx.RecordFunctionChange(fdecl);
+          }
         }
       }
     }
@@ -10,6 +10,7 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
 
 #include "rellic/AST/Util.h"
 
@@ -22,10 +23,11 @@ bool NestedScopeCombine::VisitIfStmt(clang::IfStmt *ifstmt) {
   // DLOG(INFO) << "VisitIfStmt";
   // Determine whether `cond` is a constant expression that is always true and
   // `ifstmt` should be replaced by `then` in it's parent nodes.
-  auto cond{dec_ctx.z3_exprs[dec_ctx.conds[ifstmt]]};
-  if (Prove(cond)) {
+  // Conditions are checked once per index rather than once per iteration
+  auto cond{dec_ctx.GetCond(ifstmt)};
+  if (dec_ctx.IsValidZExpr(cond)) {
     substitutions[ifstmt] = ifstmt->getThen();
-  } else if (ifstmt->getElse() && Prove(!cond)) {
+  } else if (ifstmt->getElse() && dec_ctx.IsUnsatZExpr(cond)) {
     substitutions[ifstmt] = ifstmt->getElse();
   }
   return !Stopped();
@@ -34,12 +36,11 @@ bool NestedScopeCombine::VisitIfStmt(clang::IfStmt *ifstmt) {
 bool NestedScopeCombine::VisitWhileStmt(clang::WhileStmt *stmt) {
   // Substitute while statements in the form `while(1) { sth; break; }` with
   // just `{ sth; }`
-  auto cond{dec_ctx.z3_exprs[dec_ctx.conds[stmt]]};
-  if (Prove(cond)) {
+  if (dec_ctx.IsValidZExpr(dec_ctx.GetCond(stmt))) {
     auto body{clang::cast<clang::CompoundStmt>(stmt->getBody())};
     if (clang::isa<clang::BreakStmt>(body->body_back())) {
-      std::vector<clang::Stmt *> new_body{body->body_begin(),
-                                          body->body_end() - 1};
+      llvm::ArrayRef<clang::Stmt *> new_body{body->body_begin(),
+                                             body->body_end() - 1};
       substitutions[stmt] = dec_ctx.ast.CreateCompoundStmt(new_body);
     }
   }
@@ -49,7 +50,7 @@ bool NestedScopeCombine::VisitWhileStmt(clang::WhileStmt *stmt) {
 bool NestedScopeCombine::VisitCompoundStmt(clang::CompoundStmt *compound) {
   // DLOG(INFO) << "VisitCompoundStmt";
   bool has_compound = false;
-  std::vector<clang::Stmt *> new_body;
+  llvm::SmallVector<clang::Stmt *, 16> new_body;
   for (auto stmt : compound->body()) {
     if (auto child = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
       new_body.insert(new_body.end(), child->body_begin(), child->body_end());
@@ -66,10 +67,37 @@ bool NestedScopeCombine::VisitCompoundStmt(clang::CompoundStmt *compound) {
   return !Stopped();
 }
 
+// Conditional statements may be constant, and nested compound statements are
+// flattened
+bool NestedScopeCombine::AppliesTo(
+    const DecompilationContext::FunctionFeatures &features) const {
+  return features.num_ifs || features.num_whiles ||
+         features.num_nested_compounds;
+}
+
 void NestedScopeCombine::RunImpl() {
-  LOG(INFO) << "Combining nested scopes";
   TransformVisitor<NestedScopeCombine>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  // Only the conditions whose facts are not known yet reach the prover
+  dec_ctx.PrefetchProofs(
+      [this](clang::Stmt *stmt, std::vector<z3::expr> &queries) {
+        auto ifstmt{clang::dyn_cast<clang::IfStmt>(stmt)};
+        if (!ifstmt && !clang::isa<clang::WhileStmt>(stmt)) {
+          return;
+        }
+        auto idx{dec_ctx.conds.lookup(stmt)};
+        auto facts{idx < dec_ctx.z3_expr_facts.size()
+                       ? dec_ctx.z3_expr_facts[idx]
+                       : 0};
+        if (!(facts & DecompilationContext::ValidKnown)) {
+          queries.push_back(dec_ctx.z3_exprs[idx]);
+        }
+        if (ifstmt && ifstmt->getElse() &&
+            !(facts & DecompilationContext::UnsatKnown)) {
+          queries.push_back(!dec_ctx.z3_exprs[idx]);
+        }
+      },
+      [this](clang::FunctionDecl *fdecl) { return MayChange(fdecl); });
+  TraverseDirtyFunctions();
 }
 
 }  // namespace rellic
@@ -0,0 +1,928 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/Prover.h"
+
+#include <glog/logging.h>
+#include <llvm/Support/MathExtras.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "rellic/AST/QueryLog.h"
+#include "rellic/AST/Util.h"
+#include "rellic/Exception.h"
+#include "rellic/Trace.h"
+
+namespace rellic {
+
+void QueryStatistics::Record(std::chrono::nanoseconds elapsed) {
+  ++num_queries;
+  this->elapsed += elapsed;
+  auto us{std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+              .count()};
+  auto bucket{us > 0 ? std::min<unsigned>(llvm::Log2_64(us) + 1,
+                                          num_buckets - 1)
+                     : 0U};
+  ++latency[bucket];
+}
+
+void QueryStatistics::RecordFormula(const z3::expr& formula) {
+  ++num_z3;
+  size_t nodes{0};
+  std::unordered_set<unsigned> visited;
+  std::vector<z3::expr> worklist{formula};
+  while (!worklist.empty()) {
+    auto expr{worklist.back()};
+    worklist.pop_back();
+    if (!visited.insert(expr.id()).second) {
+      continue;
+    }
+
+    ++nodes;
+    if (!expr.is_app()) {
+      continue;
+    }
+    if (expr.num_args() == 0 &&
+        expr.decl().decl_kind() == Z3_OP_UNINTERPRETED) {
+      ++num_vars;
+    }
+    for (auto i{0U}; i < expr.num_args(); ++i) {
+      worklist.push_back(expr.arg(i));
+    }
+  }
+  num_nodes += nodes;
+  max_nodes = std::max(max_nodes, nodes);
+}
+
+void QueryStatistics::Add(const QueryStatistics& other) {
+  num_queries += other.num_queries;
+  num_z3 += other.num_z3;
+  elapsed += other.elapsed;
+  for (unsigned i{0}; i < num_buckets; ++i) {
+    latency[i] += other.latency[i];
+  }
+  num_nodes += other.num_nodes;
+  max_nodes = std::max(max_nodes, other.max_nodes);
+  num_vars += other.num_vars;
+}
+
+void SiteStatistics::Add(const SiteStatistics& other) {
+  for (size_t i{0}; i < queries.size(); ++i) {
+    queries[i].Add(other.queries[i]);
+  }
+}
+
+const char* GetQueryKindName(QueryKind kind) {
+  switch (kind) {
+    case QueryKind::Proof:
+      return "proofs";
+    case QueryKind::Simplification:
+      return "simplifications";
+    case QueryKind::Rewrite:
+      return "rewrites";
+    case QueryKind::Ordering:
+      return "orderings";
+    default:
+      return "unknown";
+  }
+}
+
+void ProverStatistics::Add(const ProverStatistics& other) {
+  num_proofs += other.num_proofs;
+  num_simplifications += other.num_simplifications;
+  num_cached += other.num_cached;
+  num_syntactic += other.num_syntactic;
+  num_truth_tables += other.num_truth_tables;
+  num_limit_hits += other.num_limit_hits;
+  num_interrupted += other.num_interrupted;
+  for (auto& [name, site] : other.sites) {
+    sites[name].Add(site);
+  }
+}
+
+namespace {
+// Records the time spent in an operation once it is done
+class QueryTimer {
+  QueryStatistics& queries;
+  std::chrono::steady_clock::time_point start;
+
+ public:
+  QueryTimer(QueryStatistics& queries)
+      : queries(queries), start(std::chrono::steady_clock::now()) {}
+  ~QueryTimer() { queries.Record(std::chrono::steady_clock::now() - start); }
+};
+
+// Bit `i` of a truth table is the value of a condition under the `i`-th
+// assignment of its atoms, where atom `k` is true iff bit `k` of `i` is set
+using Table = std::vector<uint64_t>;
+
+static bool IsBool(const z3::expr& expr) { return expr.get_sort().is_bool(); }
+
+// Whether `expr` is a boolean connective, as opposed to an atom
+static bool IsConnective(const z3::expr& expr) {
+  if (!expr.is_app()) {
+    return false;
+  }
+
+  switch (expr.decl().decl_kind()) {
+    case Z3_OP_TRUE:
+    case Z3_OP_FALSE:
+    case Z3_OP_AND:
+    case Z3_OP_OR:
+    case Z3_OP_NOT:
+    case Z3_OP_XOR:
+    case Z3_OP_IFF:
+    case Z3_OP_IMPLIES:
+      return true;
+    case Z3_OP_EQ:
+    case Z3_OP_DISTINCT:
+      return IsBool(expr.arg(0));
+    case Z3_OP_ITE:
+      return IsBool(expr);
+    default:
+      return false;
+  }
+}
+
+class TruthTableBuilder {
+  std::unordered_map<unsigned, unsigned> atoms;
+  std::unordered_set<unsigned> visited;
+  std::unordered_map<unsigned, Table> tables;
+  size_t num_words{1};
+
+  bool CollectAtoms(const z3::expr& expr) {
+    if (!visited.insert(expr.id()).second) {
+      return true;
+    }
+
+    if (!IsConnective(expr)) {
+      exact &= expr.is_const() &&
+               expr.decl().decl_kind() == Z3_OP_UNINTERPRETED;
+      atoms.emplace(expr.id(), atoms.size());
+      return atoms.size() <= Prover::max_truth_table_atoms;
+    }
+
+    for (auto i{0U}; i < expr.num_args(); ++i) {
+      if (!CollectAtoms(expr.arg(i))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  Table GetAtomTable(unsigned atom) {
+    static const uint64_t patterns[]{
+        0xAAAAAAAAAAAAAAAA, 0xCCCCCCCCCCCCCCCC, 0xF0F0F0F0F0F0F0F0,
+        0xFF00FF00FF00FF00, 0xFFFF0000FFFF0000, 0xFFFFFFFF00000000};
+    Table table(num_words);
+    for (size_t word{0}; word < num_words; ++word) {
+      if (atom < 6) {
+        table[word] = patterns[atom];
+      } else {
+        table[word] = (word >> (atom - 6)) & 1 ? ~uint64_t{0} : 0;
+      }
+    }
+    return table;
+  }
+
+  template <typename TOp>
+  static Table Combine(Table a, const Table& b, TOp op) {
+    for (size_t i{0}; i < a.size(); ++i) {
+      a[i] = op(a[i], b[i]);
+    }
+    return a;
+  }
+
+  static Table Not(Table a) {
+    for (auto& word : a) {
+      word = ~word;
+    }
+    return a;
+  }
+
+  Table Build(const z3::expr& expr) {
+    auto it{tables.find(expr.id())};
+    if (it != tables.end()) {
+      return it->second;
+    }
+
+    auto atom{atoms.find(expr.id())};
+    if (atom != atoms.end()) {
+      return tables[expr.id()] = GetAtomTable(atom->second);
+    }
+
+    auto And = [](uint64_t a, uint64_t b) { return a & b; };
+    auto Or = [](uint64_t a, uint64_t b) { return a | b; };
+    auto Xor = [](uint64_t a, uint64_t b) { return a ^ b; };
+    auto Iff = [](uint64_t a, uint64_t b) { return ~(a ^ b); };
+
+    Table result;
+    switch (expr.decl().decl_kind()) {
+      case Z3_OP_TRUE:
+        result = Table(num_words, ~uint64_t{0});
+        break;
+      case Z3_OP_FALSE:
+        result = Table(num_words, 0);
+        break;
+      case Z3_OP_NOT:
+        result = Not(Build(expr.arg(0)));
+        break;
+      case Z3_OP_AND:
+      case Z3_OP_OR:
+      case Z3_OP_XOR: {
+        auto kind{expr.decl().decl_kind()};
+        result = Build(expr.arg(0));
+        for (auto i{1U}; i < expr.num_args(); ++i) {
+          auto arg{Build(expr.arg(i))};
+          result = kind == Z3_OP_AND  ? Combine(result, arg, And)
+                   : kind == Z3_OP_OR ? Combine(result, arg, Or)
+                                      : Combine(result, arg, Xor);
+        }
+      } break;
+      case Z3_OP_IMPLIES:
+        result = Combine(Not(Build(expr.arg(0))), Build(expr.arg(1)), Or);
+        break;
+      case Z3_OP_IFF:
+      case Z3_OP_EQ: {
+        auto first{Build(expr.arg(0))};
+        result = Table(num_words, ~uint64_t{0});
+        for (auto i{1U}; i < expr.num_args(); ++i) {
+          result = Combine(result, Combine(first, Build(expr.arg(i)), Iff),
+                           And);
+        }
+      } break;
+      case Z3_OP_DISTINCT: {
+        result = Table(num_words, ~uint64_t{0});
+        for (auto i{0U}; i < expr.num_args(); ++i) {
+          for (auto j{i + 1}; j < expr.num_args(); ++j) {
+            result = Combine(
+                result,
+                Combine(Build(expr.arg(i)), Build(expr.arg(j)), Xor), And);
+          }
+        }
+      } break;
+      case Z3_OP_ITE: {
+        auto cond{Build(expr.arg(0))};
+        result = Combine(Combine(cond, Build(expr.arg(1)), And),
+                         Combine(Not(cond), Build(expr.arg(2)), And), Or);
+      } break;
+      default:
+        THROW() << "Unexpected boolean connective " << expr;
+    }
+    return tables[expr.id()] = result;
+  }
+
+ public:
+  // Whether every atom is a distinct boolean variable
+  bool exact{true};
+
+  // Returns the truth table of `expr`, if it does not have too many atoms
+  std::optional<Table> Evaluate(const z3::expr& expr) {
+    if (!IsBool(expr) || !CollectAtoms(expr)) {
+      return std::nullopt;
+    }
+
+    if (atoms.size() > 6) {
+      num_words = size_t{1} << (atoms.size() - 6);
+    }
+    return Build(expr);
+  }
+
+  // Returns the atom whose truth table is `table`, or its negation
+  std::optional<std::pair<unsigned, bool>> FindLiteral(const Table& table) {
+    for (auto [id, atom] : atoms) {
+      auto atom_table{GetAtomTable(atom)};
+      if (atom_table == table) {
+        return std::make_pair(id, false);
+      }
+      if (Not(atom_table) == table) {
+        return std::make_pair(id, true);
+      }
+    }
+    return std::nullopt;
+  }
+};
+
+static bool IsConstant(const Table& table, uint64_t word) {
+  for (auto w : table) {
+    if (w != word) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Finds the subexpression of `expr` with the given id
+static std::optional<z3::expr> FindById(const z3::expr& expr, unsigned id,
+                                        std::unordered_set<unsigned>& visited) {
+  if (expr.id() == id) {
+    return expr;
+  }
+  if (!expr.is_app() || !visited.insert(expr.id()).second) {
+    return std::nullopt;
+  }
+  for (auto i{0U}; i < expr.num_args(); ++i) {
+    auto found{FindById(expr.arg(i), id, visited)};
+    if (found) {
+      return found;
+    }
+  }
+  return std::nullopt;
+}
+
+// Strips the negations around `expr`, flipping `negated` for each of them
+static z3::expr StripNot(z3::expr expr, bool& negated) {
+  while (expr.is_not()) {
+    expr = expr.arg(0);
+    negated = !negated;
+  }
+  return expr;
+}
+
+// Whether `expr` is a boolean variable or a comparison between a variable and
+// a value, like the atoms created for branch and switch conditions
+static bool IsAtom(const z3::expr& expr) {
+  if (!expr.is_app()) {
+    return false;
+  }
+
+  auto IsVar = [](const z3::expr& e) {
+    return e.is_const() && e.decl().decl_kind() == Z3_OP_UNINTERPRETED;
+  };
+  if (IsVar(expr)) {
+    return IsBool(expr);
+  }
+  // Integer variables are unbounded, so they can be on either side of any
+  // value
+  switch (expr.decl().decl_kind()) {
+    case Z3_OP_EQ:
+      if (expr.num_args() != 2 || IsBool(expr.arg(0))) {
+        return false;
+      }
+      break;
+    case Z3_OP_LE:
+    case Z3_OP_GE:
+    case Z3_OP_LT:
+    case Z3_OP_GT:
+      if (expr.num_args() != 2 || !expr.arg(0).is_int()) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+  }
+  return (IsVar(expr.arg(0)) && expr.arg(1).is_numeral()) ||
+         (IsVar(expr.arg(1)) && expr.arg(0).is_numeral());
+}
+
+// Collects the ids of the variables `expr` depends on
+static void CollectSupport(const z3::expr& expr,
+                           std::unordered_set<unsigned>& support,
+                           std::unordered_set<unsigned>& visited) {
+  if (!expr.is_app() || !visited.insert(expr.id()).second) {
+    return;
+  }
+
+  if (expr.is_const() && expr.decl().decl_kind() == Z3_OP_UNINTERPRETED) {
+    support.insert(expr.id());
+    return;
+  }
+
+  for (auto i{0U}; i < expr.num_args(); ++i) {
+    CollectSupport(expr.arg(i), support, visited);
+  }
+}
+
+static std::unordered_set<unsigned> GetSupport(const z3::expr& expr) {
+  std::unordered_set<unsigned> support, visited;
+  CollectSupport(expr, support, visited);
+  return support;
+}
+
+static bool AreDisjoint(const std::unordered_set<unsigned>& a,
+                        const std::unordered_set<unsigned>& b) {
+  auto& smaller{a.size() < b.size() ? a : b};
+  auto& larger{a.size() < b.size() ? b : a};
+  for (auto id : smaller) {
+    if (larger.count(id)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether `expr` is known to take both values: literals are, and so are
+// conjunctions and disjunctions of such conditions over disjoint variables
+static bool IsNonConstant(const z3::expr& expr) {
+  bool negated{false};
+  auto stripped{StripNot(expr, negated)};
+  if (IsAtom(stripped)) {
+    return true;
+  }
+
+  if (!stripped.is_and() && !stripped.is_or()) {
+    return false;
+  }
+
+  std::unordered_set<unsigned> support;
+  for (auto i{0U}; i < stripped.num_args(); ++i) {
+    auto arg{stripped.arg(i)};
+    if (!IsNonConstant(arg)) {
+      return false;
+    }
+    auto arg_support{GetSupport(arg)};
+    if (!AreDisjoint(support, arg_support)) {
+      return false;
+    }
+    support.insert(arg_support.begin(), arg_support.end());
+  }
+  return true;
+}
+
+// Decides whether `a == b` is valid, where either side may be negated
+static std::optional<bool> DecideEquivalence(z3::expr a, bool negate_a,
+                                             z3::expr b, bool negate_b) {
+  a = StripNot(a, negate_a);
+  b = StripNot(b, negate_b);
+  if (a.id() == b.id()) {
+    return negate_a == negate_b;
+  }
+
+  if ((a.is_true() || a.is_false()) && (b.is_true() || b.is_false())) {
+    return (a.is_true() != negate_a) == (b.is_true() != negate_b);
+  }
+
+  // If `a` takes both values, it can be made to differ from whatever value
+  // `b` takes, as long as they do not share variables
+  if ((IsNonConstant(a) || IsNonConstant(b)) &&
+      AreDisjoint(GetSupport(a), GetSupport(b))) {
+    return false;
+  }
+  return std::nullopt;
+}
+
+// Decides the validity of `expr` without calling Z3, if possible
+static std::optional<bool> DecideSyntactically(const z3::expr& expr) {
+  if (!IsBool(expr)) {
+    return std::nullopt;
+  }
+
+  bool negated{false};
+  auto stripped{StripNot(expr, negated)};
+  if (stripped.is_true() || stripped.is_false()) {
+    return stripped.is_true() != negated;
+  }
+
+  if (IsNonConstant(stripped)) {
+    return false;
+  }
+
+  // `!(a == b)` is valid iff `a == !b` is
+  if (stripped.is_app() && stripped.num_args() == 2 &&
+      IsBool(stripped.arg(0)) &&
+      (stripped.decl().decl_kind() == Z3_OP_EQ ||
+       stripped.decl().decl_kind() == Z3_OP_IFF)) {
+    return DecideEquivalence(stripped.arg(0), false, stripped.arg(1), negated);
+  }
+  return std::nullopt;
+}
+}  // namespace
+
+SolverInterrupt::Call::Call(SolverInterrupt& interrupt, z3::context& ctx)
+    : interrupt(interrupt), ctx(ctx) {
+  std::lock_guard<std::mutex> lock(interrupt.mutex);
+  ++interrupt.running[&ctx];
+}
+
+SolverInterrupt::Call::~Call() {
+  std::lock_guard<std::mutex> lock(interrupt.mutex);
+  auto it{interrupt.running.find(&ctx)};
+  if (!--it->second) {
+    interrupt.running.erase(it);
+  }
+}
+
+void SolverInterrupt::Interrupt() {
+  // Calls check for the flag after registering, so they are either cancelled
+  // here or never started
+  std::lock_guard<std::mutex> lock(mutex);
+  interrupted = true;
+  for (auto [ctx, count] : running) {
+    ctx->interrupt();
+    interrupted_contexts.insert(ctx);
+  }
+}
+
+bool SolverInterrupt::Explains(z3::context& ctx) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return interrupted || interrupted_contexts.count(&ctx);
+}
+
+Prover::Prover(z3::context& ctx) : ctx(ctx), solver(ctx) {}
+
+Prover::Disjunction::Disjunction(Prover& prover)
+    : prover(prover), solver(prover.ctx), any(prover.ctx.bool_val(false)) {
+  z3::params params(prover.ctx);
+  params.set("timeout", prover.timeout ? prover.timeout : UINT_MAX);
+  params.set("rlimit", prover.rlimit);
+  solver.set(params);
+}
+
+void Prover::Disjunction::Add(const z3::expr& cond) {
+  auto& ctx{prover.ctx};
+  z3::expr next{ctx, Z3_mk_fresh_const(ctx, "any", ctx.bool_sort())};
+  solver.add(next == (any || cond));
+  any = next;
+  ++num_conds;
+}
+
+void Prover::Disjunction::Clear() {
+  solver.reset();
+  any = prover.ctx.bool_val(false);
+  num_conds = 0;
+}
+
+bool Prover::Disjunction::IsUnsat(const z3::expr& query) {
+  ++prover.stats.num_proofs;
+  auto& queries{prover.GetSite()[QueryKind::Proof]};
+  QueryTimer timer(queries);
+  SolverInterrupt::Call call(*prover.interrupt, prover.ctx);
+  if (prover.IsInterrupted()) {
+    ++prover.stats.num_interrupted;
+    return false;
+  }
+  queries.RecordFormula(query);
+  solver.push();
+  solver.add(query);
+  auto start{std::chrono::steady_clock::now()};
+  z3::check_result check;
+  {
+    llvm::TimeTraceScope trace("Z3Check", prover.site);
+    check = solver.check();
+  }
+  auto elapsed{std::chrono::steady_clock::now() - start};
+  solver.pop();
+  if (check == z3::unknown && prover.IsInterrupted()) {
+    ++prover.stats.num_interrupted;
+  } else if (check == z3::unknown && (prover.timeout || prover.rlimit)) {
+    ++prover.stats.num_limit_hits;
+  }
+
+  if (prover.query_log) {
+    prover.LogQuery(
+        "check", z3::mk_and(solver.assertions()) && query,
+        check == z3::sat     ? "sat"
+        : check == z3::unsat ? "unsat"
+                             : "unknown",
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed));
+  }
+  return check == z3::unsat;
+}
+
+bool Prover::Disjunction::IsDisjoint(const z3::expr& cond) {
+  return !num_conds || IsUnsat(cond && any);
+}
+
+bool Prover::Disjunction::IsComplete() {
+  return num_conds && IsUnsat(!any);
+}
+
+z3::tactic Prover::GetSimplificationTactic(z3::context& ctx) {
+  z3::tactic aig(ctx, "aig");
+  z3::tactic simplify(ctx, "simplify");
+  z3::tactic ctx_solver_simplify(ctx, "ctx-solver-simplify");
+  return simplify & aig & ctx_solver_simplify;
+}
+
+void Prover::LogQuery(const char* kind, const z3::expr& formula,
+                      std::string result, std::chrono::microseconds elapsed) {
+  if (!query_log->IsRecorded(elapsed)) {
+    return;
+  }
+  z3::solver benchmark(ctx);
+  benchmark.add(formula);
+  QueryLog::Query query;
+  query.site = site;
+  query.kind = kind;
+  query.smt2 = benchmark.to_smt2();
+  query.result = std::move(result);
+  query.elapsed = elapsed;
+  query_log->Record(query);
+}
+
+void Prover::SetLimits(unsigned timeout, unsigned rlimit) {
+  this->timeout = timeout;
+  this->rlimit = rlimit;
+  z3::params params(ctx);
+  params.set("timeout", timeout ? timeout : UINT_MAX);
+  params.set("rlimit", rlimit);
+  solver.set(params);
+}
+
+void Prover::CopySettings(const Prover& other) {
+  SetLimits(other.timeout, other.rlimit);
+  engine = other.engine;
+  query_log = other.query_log;
+  interrupt = other.interrupt;
+}
+
+void Prover::ClearCaches() {
+  proofs = {};
+  simplifications = {};
+  solver.reset();
+}
+
+void Prover::AddStatistics(const ProverStatistics& other) {
+  stats.Add(other);
+}
+
+SiteStatistics& Prover::GetSite() {
+  if (site != stats_site) {
+    auto it{stats.sites.find(site)};
+    if (it == stats.sites.end()) {
+      it = stats.sites.emplace(site, SiteStatistics{}).first;
+    }
+    stats_site = site;
+    site_stats = &it->second;
+  }
+  return *site_stats;
+}
+
+bool Prover::Prove(const z3::expr& expr) {
+  ++stats.num_proofs;
+  auto& queries{GetSite()[QueryKind::Proof]};
+  QueryTimer timer(queries);
+  auto it{proofs.find(expr.id())};
+  if (it != proofs.end()) {
+    ++stats.num_cached;
+    return it->second.second;
+  }
+
+  if (auto decision = DecideSyntactically(expr)) {
+    ++stats.num_syntactic;
+    proofs.emplace(expr.id(), std::make_pair(expr, *decision));
+    return *decision;
+  }
+
+  if (engine == ConditionEngine::TruthTable) {
+    TruthTableBuilder builder;
+    auto table{builder.Evaluate(expr)};
+    if (table && (IsConstant(*table, ~uint64_t{0}) || builder.exact)) {
+      ++stats.num_truth_tables;
+      auto result{IsConstant(*table, ~uint64_t{0})};
+      proofs.emplace(expr.id(), std::make_pair(expr, result));
+      return result;
+    }
+  }
+
+  // `expr` is valid iff its negation is unsatisfiable. The negation is only
+  // asserted in a local scope, so the solver is left as it was found.
+  SolverInterrupt::Call call(*interrupt, ctx);
+  if (IsInterrupted()) {
+    ++stats.num_interrupted;
+    return false;
+  }
+  z3::expr query{ctx};
+  try {
+    query = !expr.simplify();
+  } catch (z3::exception&) {
+    if (!interrupt->Explains(ctx)) {
+      throw;
+    }
+    ++stats.num_interrupted;
+    return false;
+  }
+  queries.RecordFormula(query);
+  solver.push();
+  solver.add(query);
+  auto start{std::chrono::steady_clock::now()};
+  z3::check_result check;
+  {
+    llvm::TimeTraceScope trace("Z3Check", site);
+    check = solver.check();
+  }
+  auto elapsed{std::chrono::steady_clock::now() - start};
+  solver.pop();
+  if (check == z3::unknown && IsInterrupted()) {
+    ++stats.num_interrupted;
+    return false;
+  }
+  if (check == z3::unknown && (timeout || rlimit)) {
+    ++stats.num_limit_hits;
+  }
+
+  if (query_log) {
+    LogQuery("check", query,
+             check == z3::sat     ? "sat"
+             : check == z3::unsat ? "unsat"
+                                  : "unknown",
+             std::chrono::duration_cast<std::chrono::microseconds>(elapsed));
+  }
+
+  auto result{check == z3::unsat};
+  proofs.emplace(expr.id(), std::make_pair(expr, result));
+  return result;
+}
+
+void Prover::ProveAll(const std::vector<z3::expr>& exprs,
+                      unsigned num_threads) {
+  // Below this many queries per chunk, translating them into a context of
+  // their own costs more than proving them
+  constexpr size_t min_chunk_size{4};
+  // Chunks per thread, so that threads which get cheap chunks can take over
+  // the remaining ones instead of waiting for the expensive ones
+  constexpr size_t chunks_per_thread{4};
+
+  std::unordered_set<unsigned> seen;
+  z3::expr_vector pending{ctx};
+  for (auto& expr : exprs) {
+    if (proofs.count(expr.id()) || !seen.insert(expr.id()).second ||
+        DecideSyntactically(expr)) {
+      continue;
+    }
+    pending.push_back(expr);
+  }
+  auto max_threads{std::min<size_t>(num_threads,
+                                    pending.size() / min_chunk_size)};
+  if (max_threads <= 1) {
+    return;
+  }
+
+  // Z3 contexts are not thread-safe, so expressions are translated into and
+  // out of the worker contexts on this thread
+  struct Chunk {
+    z3::context ctx;
+    std::unique_ptr<z3::expr_vector> exprs;
+    std::unique_ptr<Prover> prover;
+    std::vector<bool> results;
+    std::exception_ptr error;
+  };
+  // Queries of the same definition are next to each other and tend to be
+  // alike, so they are dealt out to the chunks in turn rather than sliced
+  auto num_chunks{std::min<size_t>(max_threads * chunks_per_thread,
+                                   pending.size() / min_chunk_size)};
+  std::vector<std::unique_ptr<Chunk>> chunks;
+  for (size_t c{0}; c < num_chunks; ++c) {
+    z3::expr_vector slice{ctx};
+    for (auto i{c}; i < pending.size(); i += num_chunks) {
+      slice.push_back(pending[static_cast<unsigned>(i)]);
+    }
+    auto& chunk{chunks.emplace_back(std::make_unique<Chunk>())};
+    chunk->exprs = std::make_unique<z3::expr_vector>(chunk->ctx, slice);
+    chunk->prover = std::make_unique<Prover>(chunk->ctx);
+    chunk->prover->CopySettings(*this);
+  }
+
+  // Errors are rethrown on this thread, as an exception escaping a worker
+  // would terminate the process
+  std::atomic_size_t next_chunk{0};
+  std::vector<std::thread> workers;
+  auto tracing{IsTracing()};
+  for (size_t t{0}; t < max_threads; ++t) {
+    workers.emplace_back([this, &chunks, &next_chunk, tracing]() {
+      TraceThread trace_thread(tracing);
+      for (auto c{next_chunk++}; c < chunks.size(); c = next_chunk++) {
+        auto& chunk{chunks[c]};
+        llvm::TimeTraceScope trace("Z3ProveAll", site);
+        try {
+          CallSite call_site(*chunk->prover, site);
+          auto& chunk_exprs{*chunk->exprs};
+          for (unsigned i{0}; i < chunk_exprs.size(); ++i) {
+            chunk->results.push_back(chunk->prover->Prove(chunk_exprs[i]));
+          }
+        } catch (...) {
+          chunk->error = std::current_exception();
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  for (auto& chunk : chunks) {
+    AddStatistics(chunk->prover->GetStatistics());
+    if (chunk->error) {
+      std::rethrow_exception(chunk->error);
+    }
+  }
+  // Some of the results may have been cut short, and answers to interrupted
+  // queries are not memoized
+  if (IsInterrupted()) {
+    return;
+  }
+
+  for (size_t c{0}; c < num_chunks; ++c) {
+    auto& results{chunks[c]->results};
+    for (size_t j{0}; j < results.size(); ++j) {
+      auto expr{pending[static_cast<unsigned>(c + j * num_chunks)]};
+      proofs.emplace(expr.id(), std::make_pair(expr, results[j]));
+    }
+  }
+}
+
+z3::expr Prover::Simplify(const z3::expr& expr) {
+  ++stats.num_simplifications;
+  auto& queries{GetSite()[QueryKind::Simplification]};
+  QueryTimer timer(queries);
+  auto it{simplifications.find(expr.id())};
+  if (it != simplifications.end()) {
+    ++stats.num_cached;
+    return it->second.second;
+  }
+
+  z3::expr result{ctx};
+  std::optional<std::pair<unsigned, bool>> literal;
+  std::optional<Table> table;
+  if (engine == ConditionEngine::TruthTable) {
+    // Constant and single literal conditions can be read off the truth table
+    TruthTableBuilder builder;
+    table = builder.Evaluate(expr);
+    if (table && !IsConstant(*table, 0) && !IsConstant(*table, ~uint64_t{0})) {
+      literal = builder.FindLiteral(*table);
+    }
+  }
+
+  if (table && IsConstant(*table, 0)) {
+    ++stats.num_truth_tables;
+    result = ctx.bool_val(false);
+  } else if (literal) {
+    ++stats.num_truth_tables;
+    std::unordered_set<unsigned> visited;
+    auto atom{*FindById(expr, literal->first, visited)};
+    result = literal->second ? !atom : atom;
+  } else if (Prove(expr)) {
+    result = ctx.bool_val(true);
+  } else {
+    auto tactic{GetSimplificationTactic(ctx)};
+    // Tactics only honor the time limit
+    if (timeout) {
+      tactic = z3::try_for(tactic, timeout);
+    }
+
+    SolverInterrupt::Call call(*interrupt, ctx);
+    if (IsInterrupted()) {
+      ++stats.num_interrupted;
+      return expr;
+    }
+    queries.RecordFormula(expr);
+    auto start{std::chrono::steady_clock::now()};
+    bool limit_hit{false};
+    try {
+      result = ApplyTactic(tactic, expr).as_expr();
+    } catch (z3::exception& ex) {
+      if (interrupt->Explains(ctx)) {
+        ++stats.num_interrupted;
+        return expr;
+      }
+      // Only a query that ran out of its limit is expected to fail
+      CHECK_THROW(timeout) << "Cannot simplify condition: " << ex.msg();
+      ++stats.num_limit_hits;
+      limit_hit = true;
+      result = expr.simplify();
+    }
+    auto elapsed{std::chrono::steady_clock::now() - start};
+
+    if (query_log) {
+      LogQuery("simplify", expr, limit_hit ? "unknown" : result.to_string(),
+               std::chrono::duration_cast<std::chrono::microseconds>(elapsed));
+    }
+  }
+
+  simplifications.emplace(expr.id(), std::make_pair(expr, result));
+  return result;
+}
+
+z3::expr Prover::Rewrite(const z3::expr& expr) {
+  auto& queries{GetQueries(QueryKind::Rewrite)};
+  QueryTimer timer(queries);
+  SolverInterrupt::Call call(*interrupt, ctx);
+  if (IsInterrupted()) {
+    ++stats.num_interrupted;
+    return expr;
+  }
+  queries.RecordFormula(expr);
+  try {
+    return expr.simplify();
+  } catch (z3::exception&) {
+    if (!interrupt->Explains(ctx)) {
+      throw;
+    }
+    ++stats.num_interrupted;
+    return expr;
+  }
+}
+
+}  // namespace rellic
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/QueryLog.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <algorithm>
+
+namespace rellic {
+
+QueryLog::QueryLog(std::unique_ptr<llvm::raw_fd_ostream> os)
+    : os(std::move(os)) {}
+
+QueryLog::QueryLog(size_t capacity, std::shared_ptr<QueryLog> next)
+    : capacity(capacity), next(std::move(next)) {}
+
+Result<std::unique_ptr<QueryLog>, std::string> QueryLog::Create(
+    llvm::StringRef path) {
+  std::error_code ec;
+  auto os{std::make_unique<llvm::raw_fd_ostream>(path, ec,
+                                                 llvm::sys::fs::OF_Text)};
+  if (ec) {
+    return "Cannot open query log " + path.str() + ": " + ec.message();
+  }
+  return std::make_unique<QueryLog>(std::move(os));
+}
+
+Result<std::vector<QueryLog::Query>, std::string> QueryLog::Read(
+    llvm::StringRef path) {
+  auto buffer{llvm::MemoryBuffer::getFile(path)};
+  if (!buffer) {
+    return "Cannot read query log " + path.str() + ": " +
+           buffer.getError().message();
+  }
+
+  std::vector<Query> queries;
+  llvm::SmallVector<llvm::StringRef, 0> lines;
+  (*buffer)->getBuffer().split(lines, '\n', /*MaxSplit=*/-1,
+                               /*KeepEmpty=*/false);
+  for (size_t i{0}; i < lines.size(); ++i) {
+    auto LineError = [&](llvm::StringRef msg) {
+      return path.str() + ":" + std::to_string(i + 1) + ": " + msg.str();
+    };
+
+    auto value{llvm::json::parse(lines[i])};
+    if (!value) {
+      return LineError(llvm::toString(value.takeError()));
+    }
+
+    auto obj{value->getAsObject()};
+    if (!obj) {
+      return LineError("Expected an object");
+    }
+
+    Query query;
+    auto site{obj->getString("site")};
+    auto kind{obj->getString("kind")};
+    auto smt2{obj->getString("smt2")};
+    auto result{obj->getString("result")};
+    auto elapsed{obj->getInteger("elapsed_us")};
+    if (!site || !kind || !smt2 || !result || !elapsed) {
+      return LineError("Missing query field");
+    }
+    query.site = site->str();
+    query.kind = kind->str();
+    query.smt2 = smt2->str();
+    query.result = result->str();
+    query.elapsed = std::chrono::microseconds(*elapsed);
+    queries.push_back(std::move(query));
+  }
+  return queries;
+}
+
+static bool IsSlower(const QueryLog::Query& a, const QueryLog::Query& b) {
+  return a.elapsed > b.elapsed;
+}
+
+bool QueryLog::IsRecorded(std::chrono::microseconds elapsed) {
+  if (os || (next && next->IsRecorded(elapsed))) {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  return slowest.size() < capacity ||
+         (capacity && elapsed > slowest.front().elapsed);
+}
+
+void QueryLog::Record(const Query& query) {
+  if (next) {
+    next->Record(query);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (capacity &&
+      (slowest.size() < capacity || IsSlower(query, slowest.front()))) {
+    if (slowest.size() == capacity) {
+      std::pop_heap(slowest.begin(), slowest.end(), IsSlower);
+      slowest.pop_back();
+    }
+    slowest.push_back(query);
+    std::push_heap(slowest.begin(), slowest.end(), IsSlower);
+  }
+  if (!os) {
+    return;
+  }
+
+  llvm::json::Object obj{
+      {"site", query.site},
+      {"kind", query.kind},
+      {"smt2", query.smt2},
+      {"result", query.result},
+      {"elapsed_us", static_cast<int64_t>(query.elapsed.count())}};
+  *os << llvm::json::Value(std::move(obj)) << '\n';
+  os->flush();
+}
+
+std::vector<QueryLog::Query> QueryLog::GetSlowest() {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto queries{slowest};
+  std::sort_heap(queries.begin(), queries.end(), IsSlower);
+  return queries;
+}
+
+}  // namespace rellic
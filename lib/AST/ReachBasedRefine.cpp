@@ -10,6 +10,7 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
 
 #include "rellic/AST/Util.h"
 
@@ -19,17 +20,20 @@ ReachBasedRefine::ReachBasedRefine(DecompilationContext &dec_ctx)
     : TransformVisitor<ReachBasedRefine>(dec_ctx) {}
 
 bool ReachBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
-  std::vector<clang::Stmt *> body{compound->body_begin(), compound->body_end()};
-  std::vector<clang::IfStmt *> ifs;
-  z3::expr_vector conds{dec_ctx.z3_ctx};
+  llvm::SmallVector<clang::Stmt *, 16> body{compound->body_begin(),
+                                            compound->body_end()};
+  llvm::SmallVector<clang::IfStmt *, 8> ifs;
+  // The conditions of the chain, asserted once each instead of rebuilding
+  // their disjunction for every new `if`
+  Prover::Disjunction conds{dec_ctx.prover};
 
   auto ResetChain = [&]() {
     ifs.clear();
-    conds.resize(0);
+    conds.Clear();
   };
 
   bool done_something{false};
-  for (size_t i{0}; i < body.size() && !done_something; ++i) {
+  for (size_t i{0}; i < body.size(); ++i) {
     auto if_stmt{clang::dyn_cast<clang::IfStmt>(body[i])};
     if (!if_stmt) {
       ResetChain();
@@ -37,7 +41,7 @@ bool ReachBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
     }
 
     ifs.push_back(if_stmt);
-    auto cond{dec_ctx.z3_exprs[dec_ctx.conds[if_stmt]]};
+    auto cond{dec_ctx.z3_exprs[dec_ctx.GetCond(if_stmt)]};
 
     if (if_stmt->getElse()) {
       // We cannot link `if` statements that contain `else` branches
@@ -46,17 +50,17 @@ bool ReachBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
     }
 
     // Is the current `if` statement unreachable from all the others?
-    bool is_unreachable{Prove(HeavySimplify(!(cond && z3::mk_or(conds))))};
+    bool is_unreachable{conds.IsDisjoint(cond)};
 
     if (!is_unreachable) {
       ResetChain();
       continue;
     }
 
-    conds.push_back(cond);
+    conds.Add(cond);
 
     // Do the collected statements cover all possibilities?
-    auto is_complete{Prove(HeavySimplify(z3::mk_or(conds)))};
+    auto is_complete{conds.IsComplete()};
 
     if (ifs.size() <= 2 || !is_complete) {
       // We need to collect more statements
@@ -90,6 +94,9 @@ bool ReachBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
       if (stmt == ifs.front()) {
         continue;
       }
+      if (dec_ctx.journal) {
+        dec_ctx.journal->RecordChildren(last_if);
+      }
       if (stmt == ifs.back()) {
         last_if->setElse(stmt->getThen());
       } else {
@@ -123,6 +130,11 @@ bool ReachBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
     body.erase(body.erase(std::next(body.begin(), start_delete),
                           std::next(body.begin(), end_delete)));
     done_something = true;
+
+    // The first statement of the chain now has an `else` branch and cannot be
+    // part of another one, so scanning resumes right after it
+    i = start_delete - 1;
+    ResetChain();
   }
 
   if (done_something) {
@@ -131,10 +143,15 @@ bool ReachBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
   return !Stopped();
 }
 
+// Chains need at least three `if` statements without an `else` branch
+bool ReachBasedRefine::AppliesTo(
+    const DecompilationContext::FunctionFeatures &features) const {
+  return features.max_plain_if_run >= 3;
+}
+
 void ReachBasedRefine::RunImpl() {
-  LOG(INFO) << "Reachability-based refinement";
   TransformVisitor<ReachBasedRefine>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  TraverseDirtyFunctions();
 }
 
 }  // namespace rellic
\ No newline at end of file
@@ -10,10 +10,11 @@
 #include <clang/AST/Decl.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/Support/Casting.h>
 
-#include <unordered_set>
+#include "rellic/Exception.h"
 
 namespace rellic {
 
@@ -22,52 +23,44 @@ StructFieldRenamer::StructFieldRenamer(DecompilationContext &dec_ctx,
     : ASTPass(dec_ctx), types(types) {}
 
 bool StructFieldRenamer::VisitRecordDecl(clang::RecordDecl *decl) {
+  // Names are based on the ones the fields were generated with, so renaming a
+  // record twice would give its clashing fields longer and longer names
+  if (!renamed_decls.insert(decl).second) {
+    return !Stopped();
+  }
+
   auto type{decls[decl]};
-  CHECK(type) << "Type information not present for declaration";
+  CHECK_THROW(type) << "Type information not present for declaration";
 
   auto di{types[type]};
   if (!di) {
     return !Stopped();
   }
 
-  auto ditype = llvm::cast<llvm::DICompositeType>(di);
-  std::vector<clang::FieldDecl *> decl_fields;
-  std::vector<llvm::DIDerivedType *> di_fields;
-
-  for (auto field : decl->fields()) {
-    decl_fields.push_back(field);
-  }
-
-  for (auto field : ditype->getElements()) {
-    di_fields.push_back(llvm::cast<llvm::DIDerivedType>(field));
-  }
-
-  std::unordered_set<std::string> seen_names;
-
-  for (auto i{0U}; i < decl_fields.size(); ++i) {
-    auto decl_field{decl_fields[i]};
-    auto di_field{di_fields[i]};
+  auto di_fields{llvm::cast<llvm::DICompositeType>(di)->getElements()};
+  // Field names point into the debug info, which outlives the pass
+  llvm::SmallDenseSet<llvm::StringRef, 16> seen_names;
+  unsigned i{0};
+  for (auto decl_field : decl->fields()) {
+    auto di_field{llvm::cast<llvm::DIDerivedType>(di_fields[i++])};
 
     // FIXME(frabert): Is a clash between field names actually possible?
     // Can this mechanism actually be left out?
-    auto name{di_field->getName().str()};
-    if (seen_names.find(name) == seen_names.end()) {
-      seen_names.insert(name);
-      decl_field->setDeclName(dec_ctx.ast.CreateIdentifier(name));
-      changed = true;
+    auto name{di_field->getName()};
+    if (seen_names.insert(name).second) {
+      decl_field->setDeclName(dec_ctx.ast.CreateIdentifier(name.str()));
     } else {
       auto old_name{decl_field->getName().str()};
       decl_field->setDeclName(
-          dec_ctx.ast.CreateIdentifier(name + "_" + old_name));
-      changed = true;
+          dec_ctx.ast.CreateIdentifier(name.str() + "_" + old_name));
     }
+    changed = true;
   }
 
   return !Stopped();
 }
 
 void StructFieldRenamer::RunImpl() {
-  LOG(INFO) << "Renaming struct fields";
   for (auto &pair : dec_ctx.type_decls) {
     decls[pair.second] = pair.first;
   }
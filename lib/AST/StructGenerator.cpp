@@ -17,8 +17,10 @@
 #include <glog/logging.h>
 #include <llvm/BinaryFormat/Dwarf.h>
 
+#include <algorithm>
 #include <string>
-#include <unordered_set>
+#include <tuple>
+#include <utility>
 
 #include "rellic/BC/Util.h"
 
@@ -63,45 +65,97 @@ static llvm::DICompositeType* GetBaseType(llvm::DIType* type) {
   return nullptr;
 }
 
-struct OffsetDIDerivedType {
-  uint64_t offset;
-  llvm::DIDerivedType* type;
-};
-
-static std::vector<OffsetDIDerivedType> GetFields(
+const std::vector<OffsetDIDerivedType>& StructGenerator::GetFields(
     llvm::DICompositeType* composite) {
-  std::vector<OffsetDIDerivedType> fields{};
-  auto nodes{composite->getElements()};
-  std::for_each(nodes.begin(), nodes.end(), [&](auto node) {
-    if (auto type = llvm::dyn_cast<llvm::DIDerivedType>(node)) {
-      auto tag{type->getTag()};
-
-      if (tag != llvm::dwarf::DW_TAG_member &&
-          tag != llvm::dwarf::DW_TAG_inheritance) {
-        return;
-      }
+  auto [it, inserted] = composite_fields.try_emplace(composite);
+  auto& fields{it->second};
+  if (!inserted) {
+    return fields;
+  }
 
-      if (type->getFlags() & llvm::DIDerivedType::DIFlags::FlagStaticMember) {
-        return;
-      }
+  for (auto node : composite->getElements()) {
+    auto type{llvm::dyn_cast<llvm::DIDerivedType>(node)};
+    if (!type) {
+      continue;
+    }
+
+    auto tag{type->getTag()};
+    if (tag != llvm::dwarf::DW_TAG_member &&
+        tag != llvm::dwarf::DW_TAG_inheritance) {
+      continue;
+    }
+
+    if (type->getFlags() & llvm::DIDerivedType::DIFlags::FlagStaticMember) {
+      continue;
+    }
 
-      if (tag == llvm::dwarf::DW_TAG_inheritance) {
-        auto sub_fields{GetFields(GetBaseType(type->getBaseType()))};
-        for (auto sub_field : sub_fields) {
-          fields.push_back(
-              {type->getOffsetInBits() + sub_field.offset, sub_field.type});
-        }
-      } else {
-        fields.push_back({type->getOffsetInBits(), type});
+    if (tag == llvm::dwarf::DW_TAG_inheritance) {
+      // Base classes are flattened once and reused by all derived classes
+      for (auto sub_field : GetFields(GetBaseType(type->getBaseType()))) {
+        fields.push_back(
+            {type->getOffsetInBits() + sub_field.offset, sub_field.type});
       }
+    } else {
+      fields.push_back({type->getOffsetInBits(), type});
     }
-  });
-  std::sort(fields.begin(), fields.end(),
-            [](auto a, auto b) { return a.offset < b.offset; });
+  }
+  std::stable_sort(fields.begin(), fields.end(),
+                   [](auto a, auto b) { return a.offset < b.offset; });
 
   return fields;
 }
 
+// Appends a description of `t` that does not look into records, which are
+// described by their name and size only
+static void DescribeType(llvm::DIType* t, std::string& desc) {
+  for (; t; t = llvm::cast<llvm::DIDerivedType>(t)->getBaseType()) {
+    desc += std::to_string(t->getTag()) + ":" + t->getName().str() + ":" +
+            std::to_string(t->getSizeInBits());
+    if (auto comp = llvm::dyn_cast<llvm::DICompositeType>(t)) {
+      if (comp->getTag() == llvm::dwarf::DW_TAG_array_type) {
+        desc += "[";
+        DescribeType(comp->getBaseType(), desc);
+        desc += "]";
+      }
+      return;
+    }
+    if (!llvm::isa<llvm::DIDerivedType>(t)) {
+      return;
+    }
+    desc += " ";
+  }
+}
+
+llvm::DICompositeType* StructGenerator::GetODRType(llvm::DICompositeType* t) {
+  auto tag{t->getTag()};
+  if (t->getName().empty() ||
+      (tag != llvm::dwarf::DW_TAG_class_type &&
+       tag != llvm::dwarf::DW_TAG_structure_type &&
+       tag != llvm::dwarf::DW_TAG_union_type)) {
+    return t;
+  }
+
+  auto& odr_type{odr_types[t]};
+  if (odr_type) {
+    return odr_type;
+  }
+
+  // Like the One Definition Rule, records with the same name and layout are
+  // assumed to be the same type, whatever the records they contain are
+  std::string key;
+  DescribeType(t, key);
+  key += ":" + std::to_string(t->getFlags());
+  for (auto& field : GetFields(t)) {
+    key += ";" + field.type->getName().str() + "@" +
+           std::to_string(field.offset) + ":" +
+           std::to_string(field.type->getSizeInBits()) + ":" +
+           std::to_string(field.type->getFlags()) + " ";
+    DescribeType(field.type->getBaseType(), key);
+  }
+  odr_type = odr_records.try_emplace(key, t).first->second;
+  return odr_type;
+}
+
 struct FieldInfo {
   std::string Name;
   clang::QualType Type;
@@ -160,8 +214,8 @@ static unsigned GetStructSize(clang::ASTContext& ast_ctx, ASTBuilder& ast,
 }
 
 void StructGenerator::DefineNonPackedStruct(
-    clang::RecordDecl* decl, std::vector<OffsetDIDerivedType>& fields) {
-  std::unordered_set<std::string> visible_field_names;
+    clang::RecordDecl* decl, const std::vector<OffsetDIDerivedType>& fields) {
+  NameTable visible_field_names;
   for (auto& field : fields) {
     auto type{
         BuildType(field.type->getBaseType(), field.type->getSizeInBits())};
@@ -176,7 +230,7 @@ void StructGenerator::DefineNonPackedStruct(
   }
 }
 
-static bool CheckOffsets(std::vector<OffsetDIDerivedType>& fields,
+static bool CheckOffsets(const std::vector<OffsetDIDerivedType>& fields,
                          const clang::ASTRecordLayout& layout) {
   for (auto i{0U}; i < fields.size(); ++i) {
     if (fields[i].offset != layout.getFieldOffset(i)) {
@@ -193,7 +247,7 @@ uint64_t StructGenerator::GetLayoutSize(const clang::ASTRecordLayout& layout) {
 void StructGenerator::VisitFields(clang::RecordDecl* decl,
                                   llvm::DICompositeType* s, DeclToDbgInfo& map,
                                   bool isUnion) {
-  auto elems{GetFields(s)};
+  auto& elems{GetFields(s)};
   static auto test_count{0U};
   auto test_decl{
       ast.CreateStructDecl(ast_ctx.getTranslationUnitDecl(),
@@ -221,7 +275,7 @@ void StructGenerator::VisitFields(clang::RecordDecl* decl,
     decl->addAttr(clang::PackedAttr::Create(ast_ctx, attrinfo));
   }
 
-  std::unordered_set<std::string> visible_field_names;
+  NameTable visible_field_names;
   for (auto elem : elems) {
     auto curr_offset{isUnion ? 0 : GetStructSize(ast_ctx, ast, fields)};
     DLOG(INFO) << "Field " << elem.type->getName().str()
@@ -439,7 +493,7 @@ clang::QualType StructGenerator::BuildSubroutine(llvm::DISubroutineType* s) {
 }
 
 clang::RecordDecl* StructGenerator::GetRecordDecl(llvm::DICompositeType* t) {
-  auto& decl{fwd_decl_records[t]};
+  auto& decl{fwd_decl_records[GetODRType(t)]};
   if (!decl) {
     auto tudecl{ast_ctx.getTranslationUnitDecl()};
     switch (t->getTag()) {
@@ -523,73 +577,114 @@ clang::QualType StructGenerator::BuildComposite(llvm::DICompositeType* type) {
   return {};
 }
 
-std::string StructGenerator::GetUniqueName(
-    const std::string& base, std::unordered_set<std::string>& names) {
+std::string StructGenerator::GetUniqueName(const std::string& base,
+                                           NameTable& names) {
   auto name{base == "" ? "anon" : base};
-  for (unsigned i{2}; names.find(name) != names.end(); ++i) {
-    name = MakeValid(base, i);
+  auto [it, inserted] = names.try_emplace(name, 2);
+  if (inserted) {
+    return name;
+  }
+
+  // Suffixes before the one recorded in the entry have all been taken, either
+  // by earlier requests for `base` or by names that already had them. Entries
+  // are not moved when the table grows.
+  auto& next_suffix{it->second};
+  while (true) {
+    name = MakeValid(base, next_suffix++);
+    if (names.try_emplace(name, 2).second) {
+      return name;
+    }
   }
-  names.insert(name);
-  return name;
 }
 
 void StructGenerator::VisitType(llvm::DIType* t,
                                 std::vector<llvm::DICompositeType*>& list,
-                                std::unordered_set<llvm::DIType*>& visited) {
-  VLOG(1) << "VisitType: " << rellic::LLVMThingToString(t);
-  if (!t || visited.count(t)) {
-    return;
-  }
-  visited.insert(t);
+                                llvm::DenseSet<llvm::DIType*>& visited) {
+  // Type graphs of C++ programs are too deep to be walked recursively, so
+  // types are visited depth-first with an explicit stack. A composite is added
+  // to `list` once all the types it depends on have been visited.
+  struct Frame {
+    llvm::DIType* type;
+    std::vector<llvm::DIType*> deps;
+    size_t next_dep;
+  };
+  std::vector<Frame> stack;
+
+  auto Enter = [&](llvm::DIType* t) {
+    VLOG(1) << "VisitType: " << rellic::LLVMThingToString(t);
+    if (auto comp = llvm::dyn_cast_or_null<llvm::DICompositeType>(t)) {
+      // Only the first of identical records is defined
+      t = GetODRType(comp);
+    }
+    if (!t || !visited.insert(t).second) {
+      return;
+    }
 
-  if (auto comp = llvm::dyn_cast<llvm::DICompositeType>(t)) {
-    auto tag{comp->getTag()};
-    switch (tag) {
-      case llvm::dwarf::DW_TAG_class_type:
-      case llvm::dwarf::DW_TAG_structure_type:
-      case llvm::dwarf::DW_TAG_union_type: {
-        GetRecordDecl(comp);
-        for (auto field : GetFields(comp)) {
-          VisitType(field.type->getBaseType(), list, visited);
-        }
-      } break;
-      case llvm::dwarf::DW_TAG_array_type:
-        VisitType(comp->getBaseType(), list, visited);
-        break;
-      case llvm::dwarf::DW_TAG_enumeration_type: {
-        GetEnumDecl(comp);
-        VisitType(comp->getBaseType(), list, visited);
-      } break;
-      default:
-        LOG(FATAL) << "Invalid DICompositeType tag: " << comp->getTag();
+    std::vector<llvm::DIType*> deps;
+    if (auto comp = llvm::dyn_cast<llvm::DICompositeType>(t)) {
+      switch (comp->getTag()) {
+        case llvm::dwarf::DW_TAG_class_type:
+        case llvm::dwarf::DW_TAG_structure_type:
+        case llvm::dwarf::DW_TAG_union_type: {
+          GetRecordDecl(comp);
+          for (auto& field : GetFields(comp)) {
+            deps.push_back(field.type->getBaseType());
+          }
+        } break;
+        case llvm::dwarf::DW_TAG_array_type:
+          deps.push_back(comp->getBaseType());
+          break;
+        case llvm::dwarf::DW_TAG_enumeration_type: {
+          GetEnumDecl(comp);
+          deps.push_back(comp->getBaseType());
+        } break;
+        default:
+          LOG(FATAL) << "Invalid DICompositeType tag: " << comp->getTag();
+      }
+    } else if (auto der = llvm::dyn_cast<llvm::DIDerivedType>(t)) {
+      switch (der->getTag()) {
+        case llvm::dwarf::DW_TAG_pointer_type:
+        case llvm::dwarf::DW_TAG_reference_type:
+        case llvm::dwarf::DW_TAG_ptr_to_member_type:
+        case llvm::dwarf::DW_TAG_rvalue_reference_type:
+          /* skip */
+          break;
+        default:
+          deps.push_back(der->getBaseType());
+          break;
+      }
+    } else if (auto basic = llvm::dyn_cast<llvm::DIBasicType>(t)) {
+      /* skip */
+    } else if (auto sub = llvm::dyn_cast<llvm::DISubroutineType>(t)) {
+      for (auto type : sub->getTypeArray()) {
+        deps.push_back(type);
+      }
+    } else {
+      LOG(FATAL) << "Unknown DIType: " << rellic::LLVMThingToString(t);
+    }
+    stack.push_back({t, std::move(deps), 0});
+  };
+
+  Enter(t);
+  while (!stack.empty()) {
+    auto& frame{stack.back()};
+    if (frame.next_dep < frame.deps.size()) {
+      // `Enter` may reallocate the stack, so `frame` is not used after it
+      Enter(frame.deps[frame.next_dep++]);
+      continue;
     }
 
+    auto comp{llvm::dyn_cast<llvm::DICompositeType>(frame.type)};
+    stack.pop_back();
+    if (!comp) {
+      continue;
+    }
+    auto tag{comp->getTag()};
     if (tag != llvm::dwarf::DW_TAG_array_type &&
         tag != llvm::dwarf::DW_TAG_enumeration_type) {
       VLOG(3) << "Adding " << comp->getName().str() << " to list";
       list.push_back(comp);
     }
-  } else if (auto der = llvm::dyn_cast<llvm::DIDerivedType>(t)) {
-    auto base{der->getBaseType()};
-    switch (der->getTag()) {
-      case llvm::dwarf::DW_TAG_pointer_type:
-      case llvm::dwarf::DW_TAG_reference_type:
-      case llvm::dwarf::DW_TAG_ptr_to_member_type:
-      case llvm::dwarf::DW_TAG_rvalue_reference_type:
-        /* skip */
-        break;
-      default:
-        VisitType(base, list, visited);
-        break;
-    }
-  } else if (auto basic = llvm::dyn_cast<llvm::DIBasicType>(t)) {
-    /* skip */
-  } else if (auto sub = llvm::dyn_cast<llvm::DISubroutineType>(t)) {
-    for (auto type : sub->getTypeArray()) {
-      VisitType(type, list, visited);
-    }
-  } else {
-    LOG(FATAL) << "Unknown DIType: " << rellic::LLVMThingToString(t);
   }
 }
 
@@ -597,34 +692,66 @@ clang::QualType StructGenerator::GetType(llvm::DIType* t) {
   return BuildType(t);
 }
 
+void StructGenerator::FlattenFields(clang::RecordDecl* decl, uint64_t offset,
+                                    std::vector<clang::FieldDecl*>& prefix,
+                                    std::vector<FieldPath>& table) {
+  auto& layout{ast_ctx.getASTRecordLayout(decl)};
+  for (auto field : decl->fields()) {
+    auto type{field->getType().getDesugaredType(ast_ctx)};
+    auto field_offset{offset + layout.getFieldOffset(field->getFieldIndex())};
+    prefix.push_back(field);
+    if (auto subdecl = type->getAsRecordDecl()) {
+      FlattenFields(subdecl, field_offset, prefix, table);
+    } else {
+      auto field_size{field->isBitField() ? field->getBitWidthValue(ast_ctx)
+                                          : ast_ctx.getTypeSize(type)};
+      table.push_back({field_offset, field_size, prefix});
+    }
+    prefix.pop_back();
+  }
+}
+
+const std::vector<StructGenerator::FieldPath>& StructGenerator::GetFieldTable(
+    clang::RecordDecl* decl) {
+  auto [it, inserted] = field_tables.try_emplace(decl);
+  auto& table{it->second};
+  if (inserted) {
+    std::vector<clang::FieldDecl*> prefix;
+    FlattenFields(decl, 0, prefix, table);
+    // Fields that overlap, like the ones of unions, stay in declaration order
+    std::stable_sort(table.begin(), table.end(),
+                     [](const FieldPath& a, const FieldPath& b) {
+                       return std::tie(a.offset, a.size) <
+                              std::tie(b.offset, b.size);
+                     });
+  }
+  return table;
+}
+
 std::vector<clang::Expr*> StructGenerator::GetAccessor(clang::Expr* base,
                                                        clang::RecordDecl* decl,
                                                        unsigned int offset,
                                                        unsigned int length) {
-  std::vector<clang::Expr*> res{};
-  auto& layout{ast_ctx.getASTRecordLayout(decl)};
+  // Only fields that are not records can be accessed, and the records that
+  // contain them always contain the whole access too
+  auto& table{GetFieldTable(decl)};
+  std::pair<uint64_t, uint64_t> key{offset, length};
+  auto first{std::lower_bound(
+      table.begin(), table.end(), key,
+      [](const FieldPath& path, const std::pair<uint64_t, uint64_t>& key) {
+        return std::make_pair(path.offset, path.size) < key;
+      })};
 
-  for (auto field : decl->fields()) {
-    auto idx{field->getFieldIndex()};
-    auto type{field->getType().getDesugaredType(ast_ctx)};
-    auto field_offset{layout.getFieldOffset(idx)};
-    auto field_size{field->isBitField() ? field->getBitWidthValue(ast_ctx)
-                                        : ast_ctx.getTypeSize(type)};
-    if (offset >= field_offset &&
-        offset + length <= field_offset + field_size) {
-      if (type->isAggregateType()) {
-        auto subdecl{type->getAsRecordDecl()};
-        auto suboffset{offset - field_offset};
-        auto new_base{ast.CreateDot(base, field)};
-        for (auto r : GetAccessor(new_base, subdecl, suboffset, length)) {
-          res.push_back(r);
-        }
-      } else if (offset == field_offset && length == field_size) {
-        res.push_back(ast.CreateDot(base, field));
-      }
+  std::vector<clang::Expr*> res{};
+  for (auto it{first}; it != table.end() &&
+                       std::make_pair(it->offset, it->size) == key;
+       ++it) {
+    auto expr{base};
+    for (auto field : it->fields) {
+      expr = ast.CreateDot(expr, field);
     }
+    res.push_back(expr);
   }
-
   return res;
 }
 
@@ -14,6 +14,8 @@ namespace rellic {
 TypeProvider::TypeProvider(DecompilationContext& dec_ctx) : dec_ctx(dec_ctx) {}
 TypeProvider::~TypeProvider() = default;
 
+void TypeProvider::Prefetch(llvm::Module&) {}
+
 clang::QualType TypeProvider::GetFunctionReturnType(llvm::Function&) {
   return {};
 }
@@ -24,6 +26,8 @@ clang::QualType TypeProvider::GetGlobalVarType(llvm::GlobalVariable&) {
   return {};
 }
 
+bool TypeProvider::IsCacheable() { return false; }
+
 // Defers to DecompilationContext::GetQualType
 class FallbackTypeProvider : public TypeProvider {
  public:
@@ -31,11 +35,14 @@ class FallbackTypeProvider : public TypeProvider {
   clang::QualType GetFunctionReturnType(llvm::Function& func) override;
   clang::QualType GetArgumentType(llvm::Argument& arg) override;
   clang::QualType GetGlobalVarType(llvm::GlobalVariable& gvar) override;
+  bool IsCacheable() override;
 };
 
 FallbackTypeProvider::FallbackTypeProvider(DecompilationContext& dec_ctx)
     : TypeProvider(dec_ctx) {}
 
+bool FallbackTypeProvider::IsCacheable() { return true; }
+
 clang::QualType FallbackTypeProvider::GetFunctionReturnType(
     llvm::Function& func) {
   return dec_ctx.GetQualType(func.getReturnType());
@@ -69,11 +76,14 @@ class ByValFixupTypeProvider : public TypeProvider {
   //
   //   `i32 @do_foo(%struct.foo %f)`
   clang::QualType GetArgumentType(llvm::Argument& arg) override;
+  bool IsCacheable() override;
 };
 
 ByValFixupTypeProvider::ByValFixupTypeProvider(DecompilationContext& dec_ctx)
     : TypeProvider(dec_ctx) {}
 
+bool ByValFixupTypeProvider::IsCacheable() { return true; }
+
 clang::QualType ByValFixupTypeProvider::GetArgumentType(llvm::Argument& arg) {
   if (!arg.hasByValAttr()) {
     return {};
@@ -89,10 +99,14 @@ class MainFuncTypeProvider : public TypeProvider {
   MainFuncTypeProvider(DecompilationContext& dec_ctx);
   clang::QualType GetFunctionReturnType(llvm::Function& func) override;
   clang::QualType GetArgumentType(llvm::Argument& arg) override;
+  bool IsCacheable() override;
 };
 
 MainFuncTypeProvider::MainFuncTypeProvider(DecompilationContext& dec_ctx)
     : TypeProvider(dec_ctx) {}
+
+bool MainFuncTypeProvider::IsCacheable() { return true; }
+
 clang::QualType MainFuncTypeProvider::GetFunctionReturnType(
     llvm::Function& func) {
   if (func.getName() != "main") {
@@ -130,15 +144,36 @@ TypeProviderCombiner::TypeProviderCombiner(DecompilationContext& dec_ctx)
 }
 
 void TypeProviderCombiner::AddProvider(std::unique_ptr<TypeProvider> provider) {
+  cacheable = cacheable && provider->IsCacheable();
   providers.push_back(std::move(provider));
+  // The new provider takes precedence over the results computed so far
+  return_types.clear();
+  arg_types.clear();
+  gvar_types.clear();
+}
+
+void TypeProviderCombiner::Prefetch(llvm::Module& module) {
+  for (auto& provider : providers) {
+    provider->Prefetch(module);
+  }
 }
 
 clang::QualType TypeProviderCombiner::GetFunctionReturnType(
     llvm::Function& func) {
+  if (cacheable) {
+    auto res{return_types.lookup(&func)};
+    if (!res.isNull()) {
+      return res;
+    }
+  }
+
   for (auto it{providers.rbegin()}; it != providers.rend(); ++it) {
     auto& provider{*it};
     auto res{provider->GetFunctionReturnType(func)};
     if (!res.isNull()) {
+      if (cacheable) {
+        return_types[&func] = res;
+      }
       return res;
     }
   }
@@ -146,10 +181,20 @@ clang::QualType TypeProviderCombiner::GetFunctionReturnType(
 }
 
 clang::QualType TypeProviderCombiner::GetArgumentType(llvm::Argument& arg) {
+  if (cacheable) {
+    auto res{arg_types.lookup(&arg)};
+    if (!res.isNull()) {
+      return res;
+    }
+  }
+
   for (auto it{providers.rbegin()}; it != providers.rend(); ++it) {
     auto& provider{*it};
     auto res{provider->GetArgumentType(arg)};
     if (!res.isNull()) {
+      if (cacheable) {
+        arg_types[&arg] = res;
+      }
       return res;
     }
   }
@@ -158,13 +203,30 @@ clang::QualType TypeProviderCombiner::GetArgumentType(llvm::Argument& arg) {
 
 clang::QualType TypeProviderCombiner::GetGlobalVarType(
     llvm::GlobalVariable& gvar) {
+  if (cacheable) {
+    auto res{gvar_types.lookup(&gvar)};
+    if (!res.isNull()) {
+      return res;
+    }
+  }
+
   for (auto it{providers.rbegin()}; it != providers.rend(); ++it) {
     auto& provider{*it};
     auto res{provider->GetGlobalVarType(gvar)};
     if (!res.isNull()) {
+      if (cacheable) {
+        gvar_types[&gvar] = res;
+      }
       return res;
     }
   }
   return {};
 }
+
+bool TypeProviderCombiner::IsCacheable() { return cacheable; }
+
+size_t TypeProviderCombiner::GetCacheSize() const {
+  return return_types.getMemorySize() + arg_types.getMemorySize() +
+         gvar_types.getMemorySize();
+}
 }  // namespace rellic
\ No newline at end of file
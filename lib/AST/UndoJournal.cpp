@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/UndoJournal.h"
+
+#include <clang/AST/Expr.h>
+
+#include <utility>
+
+#include "rellic/AST/DecompilationContext.h"
+
+namespace rellic {
+
+UndoJournal::UndoJournal(DecompilationContext &dec_ctx) : dec_ctx(dec_ctx) {}
+
+void UndoJournal::RecordSlot(clang::Stmt *&slot) {
+  if (Recording()) {
+    entries.push_back({Entry::Slot, &slot, nullptr, slot, std::nullopt});
+  }
+}
+
+void UndoJournal::RecordChildren(clang::Stmt *stmt) {
+  for (auto &child : stmt->children()) {
+    RecordSlot(child);
+  }
+}
+
+void UndoJournal::RecordBody(clang::FunctionDecl *fdecl) {
+  if (Recording()) {
+    entries.push_back(
+        {Entry::Body, nullptr, fdecl, fdecl->getBody(), std::nullopt});
+  }
+}
+
+void UndoJournal::RecordInit(clang::VarDecl *var) {
+  if (Recording()) {
+    entries.push_back(
+        {Entry::Init, nullptr, var, var->getInit(), std::nullopt});
+  }
+}
+
+void UndoJournal::RecordCond(clang::Stmt *stmt) {
+  if (!Recording()) {
+    return;
+  }
+  auto it{dec_ctx.conds.find(stmt)};
+  std::optional<unsigned> cond;
+  if (it != dec_ctx.conds.end()) {
+    cond = it->second;
+  }
+  entries.push_back({Entry::Cond, nullptr, nullptr, stmt, cond});
+}
+
+void UndoJournal::Swap(Entry &entry) {
+  switch (entry.kind) {
+    case Entry::Slot:
+      std::swap(*entry.slot, entry.stmt);
+      break;
+    case Entry::Body: {
+      auto fdecl{clang::cast<clang::FunctionDecl>(entry.decl)};
+      auto body{fdecl->getBody()};
+      fdecl->setBody(entry.stmt);
+      entry.stmt = body;
+    } break;
+    case Entry::Init: {
+      auto var{clang::cast<clang::VarDecl>(entry.decl)};
+      auto init{var->getInit()};
+      var->setInit(clang::cast_or_null<clang::Expr>(entry.stmt));
+      entry.stmt = init;
+    } break;
+    case Entry::Cond: {
+      std::optional<unsigned> cond;
+      auto it{dec_ctx.conds.find(entry.stmt)};
+      if (it != dec_ctx.conds.end()) {
+        cond = it->second;
+        dec_ctx.conds.erase(it);
+      }
+      if (entry.cond) {
+        dec_ctx.conds[entry.stmt] = *entry.cond;
+      }
+      entry.cond = cond;
+    } break;
+  }
+}
+
+UndoJournal::Branch UndoJournal::Rollback(size_t position) {
+  Branch undone(entries.begin() + position, entries.end());
+  entries.resize(position);
+  for (auto it{undone.rbegin()}; it != undone.rend(); ++it) {
+    Swap(*it);
+  }
+  return undone;
+}
+
+void UndoJournal::Redo(Branch branch) {
+  for (auto &entry : branch) {
+    Swap(entry);
+    entries.push_back(entry);
+  }
+}
+
+void UndoJournal::Take(const std::string &name) {
+  snapshots[name] = {entries.size(), {}};
+}
+
+bool UndoJournal::Restore(const std::string &name) {
+  auto it{snapshots.find(name)};
+  if (it == snapshots.end()) {
+    return false;
+  }
+
+  auto position{it->second.position};
+  auto branch{std::move(it->second.branch)};
+  auto undone{Rollback(position)};
+  // Snapshots of the states that were just undone are now reached from
+  // `position` as well
+  for (auto &[other_name, other] : snapshots) {
+    if (other.position > position) {
+      Branch path(undone.begin(), undone.begin() + (other.position - position));
+      path.insert(path.end(), other.branch.begin(), other.branch.end());
+      other = {position, std::move(path)};
+    }
+  }
+  Redo(std::move(branch));
+  it->second = {entries.size(), {}};
+
+  // The cached analyses of statements do not account for their restored
+  // children
+  dec_ctx.side_effects.clear();
+  dec_ctx.settled_loops.clear();
+  return true;
+}
+
+std::vector<std::string> UndoJournal::GetSnapshots() const {
+  std::vector<std::string> names;
+  for (auto &[name, snapshot] : snapshots) {
+    names.push_back(name);
+  }
+  return names;
+}
+
+size_t UndoJournal::GetNumChanges() const {
+  auto num_changes{entries.size()};
+  for (auto &[name, snapshot] : snapshots) {
+    num_changes += snapshot.branch.size();
+  }
+  return num_changes;
+}
+
+}  // namespace rellic
@@ -15,13 +15,26 @@
 #include <clang/Frontend/ASTUnit.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
-
-#include <numeric>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "rellic/AST/ASTBuilder.h"
 #include "rellic/AST/TypeProvider.h"
+#include "rellic/AST/UndoJournal.h"
 #include "rellic/BC/Util.h"
 #include "rellic/Exception.h"
+#include "rellic/Trace.h"
 
 namespace rellic {
 
@@ -31,6 +44,34 @@ unsigned GetHash(clang::ASTContext &ctx, clang::Stmt *stmt) {
   return id.ComputeHash();
 }
 
+unsigned GetFunctionHash(DecompilationContext &dec_ctx,
+                         clang::FunctionDecl *fdecl) {
+  auto body{fdecl->getBody()};
+  llvm::FoldingSetNodeID id;
+  body->Profile(id, dec_ctx.ast_ctx, /*Canonical=*/true);
+  // Statements that still use `marker_expr` only differ by their entry in
+  // `conds`. Z3 hashes are structural, so they do not depend on where the
+  // expressions are stored in `z3_exprs`.
+  unsigned index{0};
+  std::vector<clang::Stmt *> worklist{body};
+  while (!worklist.empty()) {
+    auto stmt{worklist.back()};
+    worklist.pop_back();
+    auto it{dec_ctx.conds.find(stmt)};
+    if (it != dec_ctx.conds.end()) {
+      id.AddInteger(index);
+      id.AddInteger(dec_ctx.z3_exprs[it->second].hash());
+    }
+    ++index;
+    for (auto child : stmt->children()) {
+      if (child) {
+        worklist.push_back(child);
+      }
+    }
+  }
+  return id.ComputeHash();
+}
+
 class EqualityVisitor
     : public clang::StmtVisitor<EqualityVisitor, bool, clang::Expr *> {
  private:
@@ -198,6 +239,142 @@ bool IsEquivalent(clang::Expr *a, clang::Expr *b) {
   return ev.Visit(a, b);
 }
 
+// Profiles exactly the properties of expressions that EqualityVisitor
+// compares, so that its hashes never tell equivalent expressions apart
+class StructuralHasher : public clang::StmtVisitor<StructuralHasher, void,
+                                                   llvm::FoldingSetNodeID &> {
+  ExprHashCache &cache;
+
+  void AddChild(clang::Expr *expr, llvm::FoldingSetNodeID &id) {
+    id.AddInteger(cache.Get(expr));
+  }
+
+ public:
+  StructuralHasher(ExprHashCache &cache) : cache(cache) {}
+
+  // EqualityVisitor never considers other expressions equivalent, not even to
+  // themselves, so any hash will do
+  void VisitStmt(clang::Stmt *stmt, llvm::FoldingSetNodeID &id) {
+    id.AddInteger(stmt->getStmtClass());
+  }
+
+  void VisitIntegerLiteral(clang::IntegerLiteral *expr,
+                           llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::IntegerLiteralClass);
+    id.Add(expr->getValue());
+  }
+
+  void VisitCharacterLiteral(clang::CharacterLiteral *expr,
+                             llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::CharacterLiteralClass);
+    id.AddInteger(expr->getValue());
+  }
+
+  void VisitStringLiteral(clang::StringLiteral *expr,
+                          llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::StringLiteralClass);
+    id.AddString(expr->getString());
+  }
+
+  // Floating point values compare equal to values with different bits, like
+  // 0.0 and -0.0, so they are not profiled
+  void VisitFloatingLiteral(clang::FloatingLiteral *expr,
+                            llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::FloatingLiteralClass);
+  }
+
+  // Any two casts can be equivalent, regardless of their kind
+  void VisitCastExpr(clang::CastExpr *expr, llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::ImplicitCastExprClass);
+    id.AddPointer(expr->getType().getAsOpaquePtr());
+    AddChild(expr->getSubExpr(), id);
+  }
+
+  void VisitUnaryOperator(clang::UnaryOperator *expr,
+                          llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::UnaryOperatorClass);
+    id.AddInteger(expr->getOpcode());
+    AddChild(expr->getSubExpr(), id);
+  }
+
+  void VisitBinaryOperator(clang::BinaryOperator *expr,
+                           llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::BinaryOperatorClass);
+    id.AddInteger(expr->getOpcode());
+    AddChild(expr->getLHS(), id);
+    AddChild(expr->getRHS(), id);
+  }
+
+  void VisitConditionalOperator(clang::ConditionalOperator *expr,
+                                llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::ConditionalOperatorClass);
+    AddChild(expr->getCond(), id);
+    AddChild(expr->getTrueExpr(), id);
+    AddChild(expr->getFalseExpr(), id);
+  }
+
+  void VisitArraySubscriptExpr(clang::ArraySubscriptExpr *expr,
+                               llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::ArraySubscriptExprClass);
+    AddChild(expr->getBase(), id);
+    AddChild(expr->getIdx(), id);
+  }
+
+  void VisitCallExpr(clang::CallExpr *expr, llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::CallExprClass);
+    id.AddInteger(expr->getNumArgs());
+    for (auto arg : expr->arguments()) {
+      AddChild(arg, id);
+    }
+    AddChild(expr->getCallee(), id);
+  }
+
+  void VisitMemberExpr(clang::MemberExpr *expr, llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::MemberExprClass);
+    id.AddBoolean(expr->isArrow());
+    id.AddPointer(expr->getMemberDecl());
+    id.AddPointer(expr->getType().getAsOpaquePtr());
+    AddChild(expr->getBase(), id);
+  }
+
+  void VisitDeclRefExpr(clang::DeclRefExpr *expr, llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::DeclRefExprClass);
+    id.AddPointer(expr->getDecl());
+  }
+
+  void VisitInitListExpr(clang::InitListExpr *expr,
+                         llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::InitListExprClass);
+    id.AddInteger(expr->getNumInits());
+    for (auto init : expr->inits()) {
+      AddChild(init, id);
+    }
+  }
+
+  void VisitCompoundLiteralExpr(clang::CompoundLiteralExpr *expr,
+                                llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::CompoundLiteralExprClass);
+    id.AddPointer(expr->getType().getAsOpaquePtr());
+    AddChild(expr->getInitializer(), id);
+  }
+
+  void VisitParenExpr(clang::ParenExpr *expr, llvm::FoldingSetNodeID &id) {
+    id.AddInteger(clang::Stmt::ParenExprClass);
+    AddChild(expr->getSubExpr(), id);
+  }
+};
+
+unsigned ExprHashCache::Get(clang::Expr *expr) {
+  auto it{hashes.find(expr)};
+  if (it != hashes.end()) {
+    return it->second;
+  }
+
+  llvm::FoldingSetNodeID id;
+  StructuralHasher(*this).Visit(expr, id);
+  return hashes[expr] = id.ComputeHash();
+}
+
 class ExprCloner : public clang::StmtVisitor<ExprCloner, clang::Expr *> {
   ASTBuilder ast;
   clang::ASTContext &ctx;
@@ -260,8 +437,10 @@ class ExprCloner : public clang::StmtVisitor<ExprCloner, clang::Expr *> {
   }
 
   clang::Expr *VisitMemberExpr(clang::MemberExpr *expr) {
+    // The base is cloned as well, so that the clone does not share any node
+    // with the original
     return clang::MemberExpr::Create(
-        ctx, expr->getBase(), expr->isArrow(), clang::SourceLocation(),
+        ctx, Visit(expr->getBase()), expr->isArrow(), clang::SourceLocation(),
         expr->getQualifierLoc(), clang::SourceLocation(), expr->getMemberDecl(),
         expr->getFoundDecl(), expr->getMemberNameInfo(),
         /*FIXME(frabert)*/ nullptr, expr->getType(), expr->getValueKind(),
@@ -290,7 +469,7 @@ class ExprCloner : public clang::StmtVisitor<ExprCloner, clang::Expr *> {
   }
 
   clang::Expr *VisitStmt(clang::Stmt *stmt) {
-    LOG(FATAL) << "Unexpected statement";
+    THROW() << "Unexpected statement";
     return nullptr;
   }
 
@@ -319,7 +498,334 @@ class ExprCloner : public clang::StmtVisitor<ExprCloner, clang::Expr *> {
 clang::Expr *Clone(clang::ASTUnit &unit, clang::Expr *expr,
                    DecompilationContext::ExprToUseMap &provenance) {
   ExprCloner cloner{unit, provenance};
-  return CHECK_NOTNULL(cloner.Visit(CHECK_NOTNULL(expr)));
+  CHECK_THROW(expr) << "Should not be null in Clone.";
+  auto clone{cloner.Visit(expr)};
+  CHECK_THROW(clone) << "Cannot clone expression";
+  return clone;
+}
+
+namespace {
+// Copies a function body node by node. Nodes are created directly rather than
+// through `ASTBuilder` wherever Sema would otherwise choose the type or insert
+// conversions, so that the copy is identical to the original.
+class BodyCloner : public clang::StmtVisitor<BodyCloner, clang::Stmt *> {
+  ASTBuilder ast;
+  clang::ASTContext &ctx;
+  clang::FunctionDecl *to;
+  std::unordered_map<clang::Decl *, clang::Decl *> &decls;
+  std::unordered_map<clang::Stmt *, clang::Stmt *> &clones;
+
+  clang::Expr *CloneExpr(clang::Expr *expr) {
+    return expr ? clang::cast<clang::Expr>(Visit(expr)) : nullptr;
+  }
+
+  clang::Stmt *CloneStmt(clang::Stmt *stmt) {
+    return stmt ? Visit(stmt) : nullptr;
+  }
+
+  clang::VarDecl *CloneVar(clang::VarDecl *var) {
+    auto &clone{decls[var]};
+    if (!clone) {
+      auto new_var{ast.CreateVarDecl(to, var->getType(), var->getName().str(),
+                                     var->getStorageClass())};
+      to->addDecl(new_var);
+      clone = new_var;
+    }
+    return clang::cast<clang::VarDecl>(clone);
+  }
+
+  clang::LabelDecl *CloneLabel(clang::LabelDecl *label) {
+    auto &clone{decls[label]};
+    if (!clone) {
+      clone = ast.CreateLabelDecl(to, label->getName().str());
+    }
+    return clang::cast<clang::LabelDecl>(clone);
+  }
+
+  clang::ValueDecl *MapDecl(clang::ValueDecl *decl) {
+    auto it{decls.find(decl)};
+    if (it != decls.end()) {
+      return clang::cast<clang::ValueDecl>(it->second);
+    }
+    auto var{clang::dyn_cast<clang::VarDecl>(decl)};
+    if (var && var->isLocalVarDecl()) {
+      return CloneVar(var);
+    }
+    return decl;
+  }
+
+ public:
+  BodyCloner(clang::ASTUnit &unit, clang::FunctionDecl *from,
+             clang::FunctionDecl *to,
+             std::unordered_map<clang::Decl *, clang::Decl *> &decls,
+             std::unordered_map<clang::Stmt *, clang::Stmt *> &clones)
+      : ast(unit),
+        ctx(unit.getASTContext()),
+        to(to),
+        decls(decls),
+        clones(clones) {
+    for (auto redecl : from->redecls()) {
+      decls[redecl] = to;
+    }
+    for (auto [from_param, to_param] :
+         llvm::zip(from->parameters(), to->parameters())) {
+      decls[from_param] = to_param;
+    }
+  }
+
+  clang::Stmt *VisitCompoundStmt(clang::CompoundStmt *stmt) {
+    std::vector<clang::Stmt *> body;
+    for (auto child : stmt->body()) {
+      body.push_back(Visit(child));
+    }
+    return ast.CreateCompoundStmt(body);
+  }
+
+  clang::Stmt *VisitDeclStmt(clang::DeclStmt *stmt) {
+    CHECK_THROW(stmt->isSingleDecl()) << "Cannot clone declaration groups";
+    auto var{clang::dyn_cast<clang::VarDecl>(stmt->getSingleDecl())};
+    CHECK_THROW(var) << "Cannot clone declaration of "
+                     << stmt->getSingleDecl()->getDeclKindName();
+    auto clone{clang::cast<clang::VarDecl>(MapDecl(var))};
+    if (var->hasInit()) {
+      clone->setInit(CloneExpr(var->getInit()));
+    }
+    return ast.CreateDeclStmt(clone);
+  }
+
+  clang::Stmt *VisitIfStmt(clang::IfStmt *stmt) {
+    auto cond{CloneExpr(stmt->getCond())};
+    auto then_stmt{Visit(stmt->getThen())};
+    auto else_stmt{CloneStmt(stmt->getElse())};
+    return clang::IfStmt::Create(
+        ctx, clang::SourceLocation(), stmt->getStatementKind(),
+        /*Init=*/nullptr, /*Var=*/nullptr, cond, clang::SourceLocation(),
+        clang::SourceLocation(), then_stmt, clang::SourceLocation(),
+        else_stmt);
+  }
+
+  clang::Stmt *VisitWhileStmt(clang::WhileStmt *stmt) {
+    auto cond{CloneExpr(stmt->getCond())};
+    return clang::WhileStmt::Create(ctx, nullptr, cond, Visit(stmt->getBody()),
+                                    clang::SourceLocation(),
+                                    clang::SourceLocation(),
+                                    clang::SourceLocation());
+  }
+
+  clang::Stmt *VisitDoStmt(clang::DoStmt *stmt) {
+    auto body{Visit(stmt->getBody())};
+    return new (ctx)
+        clang::DoStmt(body, CloneExpr(stmt->getCond()), clang::SourceLocation(),
+                      clang::SourceLocation(), clang::SourceLocation());
+  }
+
+  clang::Stmt *VisitSwitchStmt(clang::SwitchStmt *stmt) {
+    auto clone{clang::SwitchStmt::Create(
+        ctx, nullptr, nullptr, CloneExpr(stmt->getCond()),
+        clang::SourceLocation(), clang::SourceLocation())};
+    clone->setBody(Visit(stmt->getBody()));
+    return clone;
+  }
+
+  clang::Stmt *VisitCaseStmt(clang::CaseStmt *stmt) {
+    CHECK_THROW(!stmt->getRHS()) << "Cannot clone case ranges";
+    auto clone{ast.CreateCaseStmt(CloneExpr(stmt->getLHS()))};
+    clone->setSubStmt(Visit(stmt->getSubStmt()));
+    return clone;
+  }
+
+  clang::Stmt *VisitDefaultStmt(clang::DefaultStmt *stmt) {
+    return ast.CreateDefaultStmt(Visit(stmt->getSubStmt()));
+  }
+
+  clang::Stmt *VisitLabelStmt(clang::LabelStmt *stmt) {
+    auto label{CloneLabel(stmt->getDecl())};
+    return ast.CreateLabelStmt(label, Visit(stmt->getSubStmt()));
+  }
+
+  clang::Stmt *VisitGotoStmt(clang::GotoStmt *stmt) {
+    return ast.CreateGoto(CloneLabel(stmt->getLabel()));
+  }
+
+  clang::Stmt *VisitBreakStmt(clang::BreakStmt *stmt) {
+    return ast.CreateBreak();
+  }
+
+  clang::Stmt *VisitContinueStmt(clang::ContinueStmt *stmt) {
+    return new (ctx) clang::ContinueStmt(clang::SourceLocation());
+  }
+
+  clang::Stmt *VisitReturnStmt(clang::ReturnStmt *stmt) {
+    return ast.CreateReturn(CloneExpr(stmt->getRetValue()));
+  }
+
+  clang::Stmt *VisitNullStmt(clang::NullStmt *stmt) {
+    return ast.CreateNullStmt();
+  }
+
+  clang::Stmt *VisitIntegerLiteral(clang::IntegerLiteral *expr) {
+    return clang::IntegerLiteral::Create(ctx, expr->getValue(), expr->getType(),
+                                         clang::SourceLocation());
+  }
+
+  clang::Stmt *VisitCharacterLiteral(clang::CharacterLiteral *expr) {
+    return new (ctx)
+        clang::CharacterLiteral(expr->getValue(), expr->getKind(),
+                                expr->getType(), clang::SourceLocation());
+  }
+
+  clang::Stmt *VisitStringLiteral(clang::StringLiteral *expr) {
+    return clang::StringLiteral::Create(ctx, expr->getBytes(), expr->getKind(),
+                                        expr->isPascal(), expr->getType(),
+                                        clang::SourceLocation());
+  }
+
+  clang::Stmt *VisitFloatingLiteral(clang::FloatingLiteral *expr) {
+    return clang::FloatingLiteral::Create(ctx, expr->getValue(),
+                                          expr->isExact(), expr->getType(),
+                                          clang::SourceLocation());
+  }
+
+  clang::Stmt *VisitCStyleCastExpr(clang::CStyleCastExpr *expr) {
+    return clang::CStyleCastExpr::Create(
+        ctx, expr->getType(), expr->getValueKind(), expr->getCastKind(),
+        CloneExpr(expr->getSubExpr()), nullptr, clang::FPOptionsOverride(),
+        expr->getTypeInfoAsWritten(), clang::SourceLocation(),
+        clang::SourceLocation());
+  }
+
+  clang::Stmt *VisitImplicitCastExpr(clang::ImplicitCastExpr *expr) {
+    return clang::ImplicitCastExpr::Create(
+        ctx, expr->getType(), expr->getCastKind(),
+        CloneExpr(expr->getSubExpr()), nullptr, expr->getValueKind(),
+        clang::FPOptionsOverride());
+  }
+
+  clang::Stmt *VisitUnaryOperator(clang::UnaryOperator *expr) {
+    return clang::UnaryOperator::Create(
+        ctx, CloneExpr(expr->getSubExpr()), expr->getOpcode(), expr->getType(),
+        expr->getValueKind(), expr->getObjectKind(), clang::SourceLocation(),
+        expr->canOverflow(), clang::FPOptionsOverride());
+  }
+
+  clang::Stmt *VisitBinaryOperator(clang::BinaryOperator *expr) {
+    auto lhs{CloneExpr(expr->getLHS())};
+    auto rhs{CloneExpr(expr->getRHS())};
+    return clang::BinaryOperator::Create(
+        ctx, lhs, rhs, expr->getOpcode(), expr->getType(),
+        expr->getValueKind(), expr->getObjectKind(), clang::SourceLocation(),
+        clang::FPOptionsOverride());
+  }
+
+  clang::Stmt *VisitCompoundAssignOperator(
+      clang::CompoundAssignOperator *expr) {
+    auto lhs{CloneExpr(expr->getLHS())};
+    auto rhs{CloneExpr(expr->getRHS())};
+    return clang::CompoundAssignOperator::Create(
+        ctx, lhs, rhs, expr->getOpcode(), expr->getType(),
+        expr->getValueKind(), expr->getObjectKind(), clang::SourceLocation(),
+        clang::FPOptionsOverride(), expr->getComputationLHSType(),
+        expr->getComputationResultType());
+  }
+
+  clang::Stmt *VisitConditionalOperator(clang::ConditionalOperator *expr) {
+    auto cond{CloneExpr(expr->getCond())};
+    auto lhs{CloneExpr(expr->getTrueExpr())};
+    auto rhs{CloneExpr(expr->getFalseExpr())};
+    return new (ctx) clang::ConditionalOperator(
+        cond, clang::SourceLocation(), lhs, clang::SourceLocation(), rhs,
+        expr->getType(), expr->getValueKind(), expr->getObjectKind());
+  }
+
+  clang::Stmt *VisitArraySubscriptExpr(clang::ArraySubscriptExpr *expr) {
+    auto lhs{CloneExpr(expr->getLHS())};
+    auto rhs{CloneExpr(expr->getRHS())};
+    return new (ctx) clang::ArraySubscriptExpr(
+        lhs, rhs, expr->getType(), expr->getValueKind(), expr->getObjectKind(),
+        clang::SourceLocation());
+  }
+
+  clang::Stmt *VisitCallExpr(clang::CallExpr *expr) {
+    auto callee{CloneExpr(expr->getCallee())};
+    std::vector<clang::Expr *> args;
+    for (auto arg : expr->arguments()) {
+      args.push_back(CloneExpr(arg));
+    }
+    return clang::CallExpr::Create(ctx, callee, args, expr->getType(),
+                                   expr->getValueKind(),
+                                   clang::SourceLocation(),
+                                   clang::FPOptionsOverride());
+  }
+
+  clang::Stmt *VisitMemberExpr(clang::MemberExpr *expr) {
+    return clang::MemberExpr::Create(
+        ctx, CloneExpr(expr->getBase()), expr->isArrow(),
+        clang::SourceLocation(), expr->getQualifierLoc(),
+        clang::SourceLocation(), expr->getMemberDecl(), expr->getFoundDecl(),
+        expr->getMemberNameInfo(), nullptr, expr->getType(),
+        expr->getValueKind(), expr->getObjectKind(), expr->isNonOdrUse());
+  }
+
+  clang::Stmt *VisitDeclRefExpr(clang::DeclRefExpr *expr) {
+    auto decl{MapDecl(expr->getDecl())};
+    clang::DeclarationNameInfo dni(decl->getDeclName(),
+                                   clang::SourceLocation());
+    return clang::DeclRefExpr::Create(
+        ctx, clang::NestedNameSpecifierLoc(), clang::SourceLocation(), decl,
+        /*RefersToEnclosingVariableOrCapture=*/false, dni, expr->getType(),
+        expr->getValueKind());
+  }
+
+  clang::Stmt *VisitInitListExpr(clang::InitListExpr *expr) {
+    std::vector<clang::Expr *> inits;
+    for (auto init : expr->inits()) {
+      inits.push_back(CloneExpr(init));
+    }
+    auto clone{new (ctx) clang::InitListExpr(ctx, clang::SourceLocation(),
+                                             inits, clang::SourceLocation())};
+    clone->setType(expr->getType());
+    if (expr->hasArrayFiller()) {
+      clone->setArrayFiller(CloneExpr(expr->getArrayFiller()));
+    }
+    clone->setInitializedFieldInUnion(expr->getInitializedFieldInUnion());
+    return clone;
+  }
+
+  clang::Stmt *VisitCompoundLiteralExpr(clang::CompoundLiteralExpr *expr) {
+    return new (ctx) clang::CompoundLiteralExpr(
+        clang::SourceLocation(), expr->getTypeSourceInfo(), expr->getType(),
+        expr->getValueKind(), CloneExpr(expr->getInitializer()),
+        expr->isFileScope());
+  }
+
+  clang::Stmt *VisitParenExpr(clang::ParenExpr *expr) {
+    return new (ctx)
+        clang::ParenExpr(clang::SourceLocation(), clang::SourceLocation(),
+                         CloneExpr(expr->getSubExpr()));
+  }
+
+  clang::Stmt *VisitStmt(clang::Stmt *stmt) {
+    THROW() << "Cannot clone " << stmt->getStmtClassName();
+    return nullptr;
+  }
+
+  clang::Stmt *Visit(clang::Stmt *stmt) {
+    auto clone{clang::StmtVisitor<BodyCloner, clang::Stmt *>::Visit(stmt)};
+    clones[stmt] = clone;
+    return clone;
+  }
+};
+}  // namespace
+
+void CloneBody(clang::ASTUnit &unit, clang::FunctionDecl *from,
+               clang::FunctionDecl *to,
+               std::unordered_map<clang::Decl *, clang::Decl *> &decls,
+               std::unordered_map<clang::Stmt *, clang::Stmt *> &clones) {
+  CHECK_THROW(from->hasBody()) << "Should have a body in CloneBody.";
+  CHECK_THROW(from->getNumParams() == to->getNumParams())
+      << "Should have the same type in CloneBody.";
+  BodyCloner cloner{unit, from, to, decls, clones};
+  to->setBody(cloner.Visit(from->getBody()));
 }
 
 std::string ClangThingToString(const clang::Stmt *stmt) {
@@ -330,10 +836,11 @@ std::string ClangThingToString(const clang::Stmt *stmt) {
 }
 
 z3::goal ApplyTactic(const z3::tactic &tactic, z3::expr expr) {
+  llvm::TimeTraceScope trace("Z3Tactic");
   z3::goal goal(tactic.ctx());
   goal.add(expr.simplify());
   auto app{tactic(goal)};
-  CHECK(app.size() == 1) << "Unexpected multiple goals in application!";
+  CHECK_THROW(app.size() == 1) << "Unexpected multiple goals in application!";
   return app[0];
 }
 
@@ -363,46 +870,749 @@ z3::expr_vector Clone(z3::expr_vector &vec) {
   return clone;
 }
 
-z3::expr OrderById(z3::expr expr) {
-  if (expr.is_and() || expr.is_or()) {
-    std::vector<unsigned> args_indices(expr.num_args(), 0);
-    std::iota(args_indices.begin(), args_indices.end(), 0);
-    std::sort(args_indices.begin(), args_indices.end(),
-              [&expr](unsigned a, unsigned b) {
-                return expr.arg(a).id() < expr.arg(b).id();
-              });
-    z3::expr_vector new_args{expr.ctx()};
-    for (auto idx : args_indices) {
-      new_args.push_back(OrderById(expr.arg(idx)));
-    }
-    if (expr.is_and()) {
-      return z3::mk_and(new_args);
+static z3::expr OrderById(z3::expr expr,
+                          std::unordered_map<unsigned, z3::expr> &cache) {
+  auto it{cache.find(expr.id())};
+  if (it != cache.end()) {
+    return it->second;
+  }
+
+  auto &ctx{expr.ctx()};
+  auto result{expr};
+  if (expr.is_not()) {
+    auto arg{OrderById(expr.arg(0), cache)};
+    if (arg.is_true() || arg.is_false()) {
+      result = ctx.bool_val(arg.is_false());
+    } else if (arg.is_not()) {
+      result = arg.arg(0);
+    } else {
+      result = !arg;
+    }
+  } else if (expr.is_and() || expr.is_or()) {
+    // `unit` is the neutral element of the connective, `!unit` the absorbing
+    bool unit{expr.is_and()};
+    std::vector<z3::expr> args;
+    std::unordered_set<unsigned> ids;
+    bool absorbed{false};
+    auto kind{expr.decl().decl_kind()};
+    std::function<void(const z3::expr &)> AddArg;
+    AddArg = [&](const z3::expr &arg) {
+      if (arg.is_app() && arg.decl().decl_kind() == kind) {
+        for (auto i{0U}; i < arg.num_args(); ++i) {
+          AddArg(arg.arg(i));
+        }
+      } else if (arg.is_true() || arg.is_false()) {
+        absorbed |= arg.is_true() != unit;
+      } else if (ids.insert(arg.id()).second) {
+        args.push_back(arg);
+      }
+    };
+    for (auto i{0U}; i < expr.num_args(); ++i) {
+      AddArg(OrderById(expr.arg(i), cache));
+    }
+
+    for (auto &arg : args) {
+      if (arg.is_not() && ids.count(arg.arg(0).id())) {
+        absorbed = true;
+      }
+    }
+
+    if (absorbed) {
+      result = ctx.bool_val(!unit);
+    } else if (args.empty()) {
+      result = ctx.bool_val(unit);
+    } else if (args.size() == 1) {
+      result = args[0];
     } else {
-      return z3::mk_or(new_args);
+      std::sort(args.begin(), args.end(),
+                [](const z3::expr &a, const z3::expr &b) {
+                  return a.id() < b.id();
+                });
+      z3::expr_vector new_args{ctx};
+      for (auto &arg : args) {
+        new_args.push_back(arg);
+      }
+      result = unit ? z3::mk_and(new_args) : z3::mk_or(new_args);
     }
   }
 
-  if (expr.is_not()) {
-    return !OrderById(expr.arg(0));
+  cache.emplace(expr.id(), result);
+  return result;
+}
+
+z3::expr OrderById(z3::expr expr) {
+  std::unordered_map<unsigned, z3::expr> cache;
+  return OrderById(expr, cache);
+}
+
+std::vector<llvm::SwitchInst::CaseHandle> GetSwitchCases(
+    llvm::SwitchInst *inst) {
+  std::vector<llvm::SwitchInst::CaseHandle> cases{inst->case_begin(),
+                                                  inst->case_end()};
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> first_cases;
+  for (auto sw_case : cases) {
+    first_cases.try_emplace(sw_case.getCaseSuccessor(), first_cases.size());
+  }
+  std::stable_sort(cases.begin(), cases.end(),
+                   [&first_cases](const llvm::SwitchInst::CaseHandle &a,
+                                  const llvm::SwitchInst::CaseHandle &b) {
+                     return first_cases.lookup(a.getCaseSuccessor()) <
+                            first_cases.lookup(b.getCaseSuccessor());
+                   });
+  return cases;
+}
+
+void CFGConds::Reset(llvm::Function &func) {
+  Clear();
+  unsigned num_blocks{0};
+  unsigned num_sw_edges{0};
+  for (auto &block : func) {
+    block_ids[&block] = num_blocks++;
+    sw_offsets.push_back(num_sw_edges);
+    if (auto sw = llvm::dyn_cast<llvm::SwitchInst>(block.getTerminator())) {
+      num_sw_edges += sw->getNumCases() + 1;
+    }
+  }
+  br_edges.assign(num_blocks, {none, none});
+  sw_vars.assign(num_blocks, none);
+  sw_edges.assign(num_sw_edges, none);
+  reaching_conds.assign(num_blocks, none);
+  entry_conds.assign(num_blocks, none);
+}
+
+void CFGConds::Clear() {
+  block_ids.clear();
+  br_edges.clear();
+  sw_vars.clear();
+  sw_offsets.clear();
+  sw_edges.clear();
+  edges.clear();
+  reaching_conds.clear();
+  entry_conds.clear();
+}
+
+unsigned CFGConds::GetBlockId(llvm::BasicBlock *block) const {
+  auto it{block_ids.find(block)};
+  CHECK_THROW(it != block_ids.end())
+      << "Block is not part of the current function";
+  return it->second;
+}
+
+size_t CFGConds::GetMemoryUsage() const {
+  return block_ids.getMemorySize() + edges.getMemorySize() +
+         br_edges.capacity() * sizeof(br_edges[0]) +
+         (sw_vars.capacity() + sw_offsets.capacity() + sw_edges.capacity() +
+          reaching_conds.capacity() + entry_conds.capacity()) *
+             sizeof(unsigned);
+}
+
+FunctionSize MeasureFunction(llvm::Function &func,
+                             const llvm::LoopInfo &loops) {
+  FunctionSize size;
+  for (auto &block : func) {
+    auto term{block.getTerminator()};
+    ++size.blocks;
+    size.edges += term->getNumSuccessors();
+    size.loop_depth = std::max(size.loop_depth, loops.getLoopDepth(&block));
+    if (auto sw = llvm::dyn_cast<llvm::SwitchInst>(term)) {
+      size.switch_cases = std::max(size.switch_cases, sw->getNumCases());
+    }
   }
 
-  return expr;
+  // Paths are counted in reverse post-order, in which the blocks that have
+  // already been visited are the targets of back edges
+  llvm::ReversePostOrderTraversal<llvm::Function *> rpo(&func);
+  llvm::DenseMap<llvm::BasicBlock *, uint64_t> paths;
+  llvm::DenseSet<llvm::BasicBlock *> visited;
+  paths[&func.getEntryBlock()] = 1;
+  for (auto block : rpo) {
+    visited.insert(block);
+    auto block_paths{paths[block]};
+    size.cond_terms += block_paths;
+    for (auto succ : llvm::successors(block)) {
+      if (!visited.count(succ)) {
+        auto &succ_paths{paths[succ]};
+        succ_paths =
+            std::min(succ_paths + block_paths, FunctionSize::max_paths);
+      }
+    }
+  }
+  return size;
 }
 
-DecompilationContext::DecompilationContext(clang::ASTUnit &ast_unit)
-    : ast_unit(ast_unit),
+FunctionSize MeasureFunction(llvm::Function &func) {
+  llvm::DominatorTree domtree(func);
+  llvm::LoopInfo loops(domtree);
+  return MeasureFunction(func, loops);
+}
+
+DecompilationContext::DecompilationContext(
+    clang::ASTUnit &ast_unit, std::shared_ptr<Z3ContextPool> z3_pool)
+    : Z3Conditions(std::move(z3_pool)),
+      ast_unit(ast_unit),
       ast_ctx(ast_unit.getASTContext()),
       ast(ast_unit),
       marker_expr(ast.CreateAdd(ast.CreateFalse(), ast.CreateFalse())),
       type_provider(std::make_unique<TypeProviderCombiner>(*this)) {}
 
-unsigned DecompilationContext::InsertZExpr(const z3::expr &e) {
-  auto idx{z3_exprs.size()};
-  z3_exprs.push_back(e);
-  return idx;
+void DecompilationContext::DropDefinition(llvm::Function &func,
+                                          std::string error) {
+  LOG(WARNING) << "Cannot decompile " << func.getName().str() << ": "
+               << error;
+  prototype_only.insert(&func);
+  large_functions.erase(&func);
+  straight_line_functions.erase(&func);
+  function_errors[&func] = std::move(error);
+  // The failure may have happened while GenerateAST was structuring `func`
+  cfg_conds.Clear();
+
+  auto fdefn{clang::dyn_cast_or_null<clang::FunctionDecl>(
+      value_decls.lookup(&func))};
+  if (!fdefn || !fdefn->doesThisDeclarationHaveABody()) {
+    return;
+  }
+
+  // Removing the definition from the translation unit also removes it from
+  // name lookup, where it stood for the whole redeclaration chain
+  auto fdecl{fdefn->getPreviousDecl()};
+  auto tudecl{ast_ctx.getTranslationUnitDecl()};
+  tudecl->removeDecl(fdefn);
+  tudecl->makeDeclVisibleInContext(fdecl);
+  decl_counts.erase(tudecl);
+  value_decls[&func] = fdecl;
+  changed_functions.erase(fdefn);
+  function_features.erase(fdefn);
+  if (dirty_functions) {
+    dirty_functions->erase(fdefn);
+  }
+}
+
+void DecompilationContext::SetCond(clang::Stmt *stmt, unsigned idx) {
+  if (journal) {
+    journal->RecordCond(stmt);
+  }
+  conds[stmt] = idx;
+}
+
+bool DecompilationContext::HasSideEffects(clang::Expr *expr) {
+  auto it{side_effects.find(expr)};
+  if (it != side_effects.end()) {
+    return it->second;
+  }
+  return side_effects[expr] = expr->HasSideEffects(ast_ctx);
+}
+
+bool DecompilationContext::IsValidZExpr(unsigned idx) {
+  if (z3_expr_facts.size() <= idx) {
+    z3_expr_facts.resize(z3_exprs.size());
+  }
+  auto &facts{z3_expr_facts[idx]};
+  if (!(facts & ValidKnown)) {
+    auto expr{z3_exprs[idx]};
+    auto valid{expr.is_true() || (!expr.is_false() && prover.Prove(expr))};
+    facts |= ValidKnown | (valid ? Valid : 0);
+    if (valid) {
+      facts |= UnsatKnown;
+    }
+  }
+  return facts & Valid;
+}
+
+bool DecompilationContext::IsUnsatZExpr(unsigned idx) {
+  if (z3_expr_facts.size() <= idx) {
+    z3_expr_facts.resize(z3_exprs.size());
+  }
+  auto &facts{z3_expr_facts[idx]};
+  if (!(facts & UnsatKnown)) {
+    auto expr{z3_exprs[idx]};
+    auto unsat{expr.is_false() || (!expr.is_true() && prover.Prove(!expr))};
+    facts |= UnsatKnown | (unsat ? Unsat : 0);
+    if (unsat) {
+      facts |= ValidKnown;
+    }
+  }
+  return facts & Unsat;
+}
+
+static void CountFeatures(clang::Stmt *stmt,
+                          DecompilationContext::FunctionFeatures &features) {
+  if (!stmt) {
+    return;
+  }
+
+  if (clang::isa<clang::IfStmt>(stmt)) {
+    ++features.num_ifs;
+  } else if (clang::isa<clang::WhileStmt>(stmt)) {
+    ++features.num_whiles;
+  } else if (auto compound = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
+    unsigned if_run{0}, plain_if_run{0};
+    for (auto child : compound->body()) {
+      auto ifstmt{clang::dyn_cast<clang::IfStmt>(child)};
+      if_run = ifstmt ? if_run + 1 : 0;
+      plain_if_run = ifstmt && !ifstmt->getElse() ? plain_if_run + 1 : 0;
+      features.max_if_run = std::max(features.max_if_run, if_run);
+      features.max_plain_if_run =
+          std::max(features.max_plain_if_run, plain_if_run);
+      if (clang::isa<clang::CompoundStmt>(child)) {
+        ++features.num_nested_compounds;
+      }
+    }
+  }
+
+  for (auto child : stmt->children()) {
+    CountFeatures(child, features);
+  }
+}
+
+const DecompilationContext::FunctionFeatures *
+DecompilationContext::GetFunctionFeatures(clang::FunctionDecl *fdecl) {
+  if (!track_function_changes) {
+    return nullptr;
+  }
+
+  auto [it, inserted] = function_features.try_emplace(fdecl);
+  if (inserted) {
+    CountFeatures(fdecl->getBody(), it->second);
+  }
+  return &it->second;
+}
+
+static void CollectQueries(
+    clang::Stmt *stmt,
+    const std::function<void(clang::Stmt *, std::vector<z3::expr> &)>
+        &collect,
+    std::vector<z3::expr> &queries) {
+  if (!stmt) {
+    return;
+  }
+
+  collect(stmt, queries);
+  for (auto child : stmt->children()) {
+    CollectQueries(child, collect, queries);
+  }
+}
+
+void DecompilationContext::PrefetchProofs(
+    const std::function<void(clang::Stmt *, std::vector<z3::expr> &)>
+        &collect,
+    const std::function<bool(clang::FunctionDecl *)> &visit) {
+  if (prove_threads <= 1) {
+    return;
+  }
+
+  std::vector<z3::expr> queries;
+  for (auto decl : ast_ctx.getTranslationUnitDecl()->decls()) {
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    if (fdecl && fdecl->doesThisDeclarationHaveABody() && IsDirty(fdecl) &&
+        (!visit || visit(fdecl))) {
+      CollectQueries(fdecl->getBody(), collect, queries);
+    }
+  }
+  prover.ProveAll(queries, prove_threads);
+}
+
+std::unique_ptr<z3::context> Z3ContextPool::Take() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!contexts.empty()) {
+      auto ctx{std::move(contexts.back())};
+      contexts.pop_back();
+      return ctx;
+    }
+  }
+  return std::make_unique<z3::context>();
+}
+
+void Z3ContextPool::Give(std::unique_ptr<z3::context> ctx) {
+  std::lock_guard<std::mutex> lock(mutex);
+  contexts.push_back(std::move(ctx));
+}
+
+Z3ContextLease::Z3ContextLease(std::shared_ptr<Z3ContextPool> pool)
+    : pool(std::move(pool)),
+      ctx(this->pool ? this->pool->Take()
+                     : std::make_unique<z3::context>()) {}
+
+Z3ContextLease::~Z3ContextLease() {
+  if (pool) {
+    pool->Give(std::move(ctx));
+  }
+}
+
+unsigned Z3VarIds::Get(llvm::Value *value) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto [it, inserted] = ids.try_emplace(value, ids.size());
+  return it->second;
+}
+
+Z3Conditions::Z3Conditions(std::shared_ptr<Z3ContextPool> z3_pool,
+                           std::shared_ptr<Z3VarIds> z3_var_ids)
+    : z3_lease(std::move(z3_pool)),
+      z3_var_ids(z3_var_ids ? std::move(z3_var_ids)
+                            : std::make_shared<Z3VarIds>()) {}
+
+Z3Conditions::~Z3Conditions() {
+  // Z3 may keep failing the calls of an interrupted context
+  if (prover.GetInterrupt().Explains(z3_ctx)) {
+    z3_lease.Discard();
+  }
+}
+
+unsigned Z3Conditions::InsertZExpr(const z3::expr &e) {
+  auto start{std::chrono::steady_clock::now()};
+  auto expr{OrderById(e)};
+  prover.GetQueries(QueryKind::Ordering)
+      .Record(std::chrono::steady_clock::now() - start);
+  auto [it, inserted] = z3_expr_indices.emplace(expr.id(), z3_exprs.size());
+  if (inserted) {
+    z3_exprs.push_back(expr);
+  }
+  return it->second;
+}
+
+// Translates the expressions and variables of `from` into `to`, returning the
+// index in `to` of each expression of `from`
+static std::vector<unsigned> TranslateConds(Z3Conditions &to,
+                                            Z3Conditions &from) {
+  auto &z3_ctx{to.z3_ctx};
+  // Vectors are translated as a whole, so that shared subexpressions are only
+  // translated once
+  z3::expr_vector exprs{z3_ctx, from.z3_exprs};
+  std::vector<unsigned> indices;
+  indices.reserve(exprs.size());
+  for (auto expr : exprs) {
+    indices.push_back(to.InsertZExpr(expr));
+  }
+
+  z3::expr_vector vars{z3_ctx, from.z3_vars};
+  for (unsigned i{0}; i < vars.size(); ++i) {
+    // Variables shared by several merged contexts are only kept once
+    auto var_id{vars[i].id()};
+    if (to.z3_br_edges_inv.count(var_id) || to.z3_sw_vars_inv.count(var_id) ||
+        to.z3_reach_defs.count(var_id)) {
+      continue;
+    }
+    auto id{from.z3_vars[i].id()};
+    auto br_edge{from.z3_br_edges_inv.find(id)};
+    auto reach_def{from.z3_reach_defs.find(id)};
+    if (br_edge != from.z3_br_edges_inv.end()) {
+      to.z3_br_edges_inv[var_id] = br_edge->second;
+    } else if (reach_def != from.z3_reach_defs.end()) {
+      to.z3_reach_defs[var_id] = indices[reach_def->second];
+    } else {
+      to.z3_sw_vars_inv[var_id] = from.z3_sw_vars_inv.at(id);
+    }
+    to.z3_vars.push_back(vars[i]);
+  }
+  return indices;
+}
+
+void Z3Conditions::Import(Z3Conditions &from) {
+  auto indices{TranslateConds(*this, from)};
+  auto Translate = [&indices](unsigned &idx) {
+    if (idx != CFGConds::none) {
+      idx = indices[idx];
+    }
+  };
+  cfg_conds = from.cfg_conds;
+  for (auto &br_edges : cfg_conds.br_edges) {
+    for (auto &idx : br_edges) {
+      Translate(idx);
+    }
+  }
+  for (auto &idx : cfg_conds.sw_vars) {
+    Translate(idx);
+  }
+  for (auto &idx : cfg_conds.sw_edges) {
+    Translate(idx);
+  }
+  for (auto &edge : cfg_conds.edges) {
+    Translate(edge.second);
+  }
+  for (auto &idx : cfg_conds.reaching_conds) {
+    Translate(idx);
+  }
+  for (auto &idx : cfg_conds.entry_conds) {
+    Translate(idx);
+  }
+
+  prover.AddStatistics(from.prover.GetStatistics());
+}
+
+void Z3Conditions::Merge(Z3Conditions &from) {
+  auto &cfg{from.cfg_conds};
+  CHECK_THROW(cfg_conds.reaching_conds.size() == cfg.reaching_conds.size() &&
+              cfg_conds.sw_edges.size() == cfg.sw_edges.size())
+      << "Cannot merge the conditions of different functions";
+  auto indices{TranslateConds(*this, from)};
+  auto Fill = [&indices](unsigned &to, unsigned idx) {
+    if (to == CFGConds::none && idx != CFGConds::none) {
+      to = indices[idx];
+    }
+  };
+  for (size_t i{0}; i < cfg.br_edges.size(); ++i) {
+    Fill(cfg_conds.br_edges[i][0], cfg.br_edges[i][0]);
+    Fill(cfg_conds.br_edges[i][1], cfg.br_edges[i][1]);
+  }
+  for (size_t i{0}; i < cfg.sw_vars.size(); ++i) {
+    Fill(cfg_conds.sw_vars[i], cfg.sw_vars[i]);
+  }
+  for (size_t i{0}; i < cfg.sw_edges.size(); ++i) {
+    Fill(cfg_conds.sw_edges[i], cfg.sw_edges[i]);
+  }
+  for (auto &[edge, idx] : cfg.edges) {
+    cfg_conds.edges.try_emplace(edge, indices[idx]);
+  }
+  for (size_t i{0}; i < cfg.reaching_conds.size(); ++i) {
+    Fill(cfg_conds.reaching_conds[i], cfg.reaching_conds[i]);
+    Fill(cfg_conds.entry_conds[i], cfg.entry_conds[i]);
+  }
+
+  prover.AddStatistics(from.prover.GetStatistics());
+}
+
+static void CollectBodyStmts(clang::Stmt *stmt,
+                             std::unordered_set<clang::Stmt *> &stmts) {
+  if (!stmt || !stmts.insert(stmt).second) {
+    return;
+  }
+
+  for (auto child : stmt->children()) {
+    CollectBodyStmts(child, stmts);
+  }
+}
+
+// Collects the statements of the function bodies and global initializers of
+// the translation unit
+static void CollectLiveStmts(clang::ASTContext &ast_ctx,
+                             std::unordered_set<clang::Stmt *> &stmts) {
+  for (auto decl : ast_ctx.getTranslationUnitDecl()->decls()) {
+    if (auto fdecl = clang::dyn_cast<clang::FunctionDecl>(decl)) {
+      if (fdecl->doesThisDeclarationHaveABody()) {
+        CollectBodyStmts(fdecl->getBody(), stmts);
+      }
+    } else if (auto vdecl = clang::dyn_cast<clang::VarDecl>(decl)) {
+      CollectBodyStmts(vdecl->getInit(), stmts);
+    }
+  }
+}
+
+void DecompilationContext::ReleaseDefinition(llvm::Function &func) {
+  auto fdefn{clang::dyn_cast_or_null<clang::FunctionDecl>(
+      value_decls.lookup(&func))};
+  if (!fdefn || !fdefn->doesThisDeclarationHaveABody()) {
+    return;
+  }
+
+  std::unordered_set<clang::Stmt *> stmts;
+  CollectBodyStmts(fdefn->getBody(), stmts);
+  for (auto stmt : stmts) {
+    released_conds += conds.erase(stmt);
+    stmt_provenance.erase(stmt);
+    if (auto expr = clang::dyn_cast<clang::Expr>(stmt)) {
+      use_provenance.erase(expr);
+    }
+    side_effects.erase(stmt);
+    settled_loops.erase(stmt);
+  }
+  for (auto &arg : func.args()) {
+    value_decls.erase(&arg);
+    temp_decls.erase(&arg);
+  }
+  for (auto &block : func) {
+    outgoing_uses.erase(&block);
+    for (auto &inst : block) {
+      value_decls.erase(&inst);
+    }
+  }
+
+  auto fdecl{fdefn->getPreviousDecl()};
+  auto tudecl{ast_ctx.getTranslationUnitDecl()};
+  tudecl->removeDecl(fdefn);
+  tudecl->makeDeclVisibleInContext(fdecl);
+  decl_counts.erase(tudecl);
+  value_decls[&func] = fdecl;
+  changed_functions.erase(fdefn);
+  function_features.erase(fdefn);
+  if (dirty_functions) {
+    dirty_functions->erase(fdefn);
+  }
+
+  // Compacting walks every remaining body, so it is only worth it once a
+  // large part of the conditions is garbage
+  if (released_conds && released_conds * 2 >= z3_exprs.size()) {
+    CompactZExprs();
+  }
+}
+
+void DecompilationContext::CompactZExprs() {
+  std::unordered_set<clang::Stmt *> live_stmts;
+  CollectLiveStmts(ast_ctx, live_stmts);
+
+  z3::expr_vector live_exprs{z3_ctx};
+  std::vector<uint8_t> live_facts;
+  std::unordered_map<unsigned, unsigned> new_indices;
+  auto Renumber{[&](unsigned &idx) {
+    // Leave sentinel values such as GenerateAST's poison index alone
+    if (idx >= z3_exprs.size()) {
+      return;
+    }
+    auto [it, inserted] = new_indices.emplace(idx, live_exprs.size());
+    if (inserted) {
+      live_exprs.push_back(z3_exprs[idx]);
+      live_facts.push_back(idx < z3_expr_facts.size() ? z3_expr_facts[idx]
+                                                       : 0);
+    }
+    idx = it->second;
+  }};
+
+  // Erasing from a DenseMap leaves a tombstone in place, so it does not
+  // invalidate the other iterators
+  for (auto it{conds.begin()}, end{conds.end()}; it != end;) {
+    auto cur{it++};
+    if (live_stmts.count(cur->first)) {
+      Renumber(cur->second);
+    } else {
+      conds.erase(cur);
+    }
+  }
+
+  // The inverse tables are keyed by expression id rather than by index, and
+  // the expressions they refer to are kept alive by `z3_vars`
+  for (auto &edges : cfg_conds.br_edges) {
+    Renumber(edges[0]);
+    Renumber(edges[1]);
+  }
+  for (auto &idx : cfg_conds.sw_vars) {
+    Renumber(idx);
+  }
+  for (auto &idx : cfg_conds.sw_edges) {
+    Renumber(idx);
+  }
+  for (auto &[edge, idx] : cfg_conds.edges) {
+    Renumber(idx);
+  }
+  for (auto &idx : cfg_conds.reaching_conds) {
+    Renumber(idx);
+  }
+  for (auto &[id, idx] : z3_reach_defs) {
+    Renumber(idx);
+  }
+
+  DLOG(INFO) << "Compacted z3_exprs from " << z3_exprs.size() << " to "
+             << live_exprs.size();
+  z3_exprs = live_exprs;
+  z3_expr_facts = std::move(live_facts);
+  z3_expr_indices.clear();
+  released_conds = 0;
+  for (unsigned i{0}; i < z3_exprs.size(); ++i) {
+    z3_expr_indices.emplace(z3_exprs[i].id(), i);
+  }
+}
+
+void DecompilationContext::PruneProvenance() {
+  std::unordered_set<clang::Stmt *> live_stmts;
+  CollectLiveStmts(ast_ctx, live_stmts);
+
+  // The tables are rebuilt rather than erased from, so that their memory
+  // shrinks with them
+  StmtToIRMap live_stmt_provenance;
+  for (auto [stmt, value] : stmt_provenance) {
+    if (live_stmts.count(stmt)) {
+      live_stmt_provenance[stmt] = value;
+    }
+  }
+  stmt_provenance = std::move(live_stmt_provenance);
+
+  ExprToUseMap live_use_provenance;
+  for (auto [expr, use] : use_provenance) {
+    if (live_stmts.count(expr)) {
+      live_use_provenance[expr] = use;
+    }
+  }
+  use_provenance = std::move(live_use_provenance);
+}
+
+void DecompilationContext::ReleaseSolverState() {
+  // Assigning empty tables frees their memory, which clearing them may not
+  conds = {};
+  z3_exprs = z3::expr_vector(z3_ctx);
+  z3_expr_indices = {};
+  z3_expr_facts = {};
+  z3_br_edges_inv = {};
+  z3_sw_vars_inv = {};
+  z3_vars = z3::expr_vector(z3_ctx);
+  z3_reach_defs = {};
+  cfg_conds = {};
+  prover.ClearCaches();
+  side_effects = {};
+  settled_loops = {};
+}
+
+template <typename TMap>
+static size_t GetTableSize(const TMap &map) {
+  // Every entry lives in its own node, which holds a link to the next one and
+  // possibly a cached hash
+  return map.size() * (sizeof(typename TMap::value_type) + 2 * sizeof(void *));
+}
+
+template <typename TKey, typename TValue>
+static size_t GetTableSize(const llvm::DenseMap<TKey, TValue> &map) {
+  return map.getMemorySize();
+}
+
+template <typename TKey, typename TValue>
+static size_t GetTableSize(const std::unordered_map<TKey, TValue> &map) {
+  return map.bucket_count() * sizeof(void *) +
+         map.size() * (sizeof(std::pair<const TKey, TValue>) +
+                       2 * sizeof(void *));
+}
+
+MemoryUsage DecompilationContext::GetMemoryUsage() const {
+  MemoryUsage usage;
+  usage.ast =
+      ast_ctx.getASTAllocatedMemory() + ast_ctx.getSideTableAllocatedMemory();
+  usage.z3 = Z3_get_estimated_alloc_size();
+  usage.tables = GetTableSize(stmt_provenance) + GetTableSize(use_provenance) +
+                 GetTableSize(type_decls) + GetTableSize(value_decls) +
+                 GetTableSize(temp_decls) + GetTableSize(outgoing_uses) +
+                 GetTableSize(conds) + GetTableSize(z3_br_edges_inv) +
+                 GetTableSize(z3_sw_vars_inv) + GetTableSize(z3_reach_defs) +
+                 cfg_conds.GetMemoryUsage() +
+                 GetTableSize(z3_expr_indices) + GetTableSize(side_effects) +
+                 GetTableSize(settled_loops) +
+                 GetTableSize(string_globals) + GetTableSize(qual_types) +
+                 GetTableSize(decl_counts) +
+                 type_provider->GetCacheSize() +
+                 GetTableSize(prover.GetProofs()) +
+                 GetTableSize(prover.GetSimplifications()) +
+                 (z3_exprs.size() + z3_vars.size()) * sizeof(Z3_ast);
+  for (auto &[block, uses] : outgoing_uses) {
+    usage.tables += uses.capacity() * sizeof(llvm::Use *);
+  }
+  return usage;
+}
+
+DecompilationContext::DeclCounts DecompilationContext::CountDecls(
+    clang::DeclContext *decl_ctx) {
+  auto &counts{decl_counts[decl_ctx]};
+  auto it{counts.last ? clang::DeclContext::decl_iterator(
+                            counts.last->getNextDeclInContext())
+                      : decl_ctx->decls_begin()};
+  for (auto end{decl_ctx->decls_end()}; it != end; ++it) {
+    counts.vars += clang::isa<clang::VarDecl>(*it);
+    counts.functions += clang::isa<clang::FunctionDecl>(*it);
+    counts.last = *it;
+  }
+  return counts;
 }
 
 clang::QualType DecompilationContext::GetQualType(llvm::Type *type) {
+  auto cached{qual_types.lookup(type)};
+  if (!cached.isNull()) {
+    return cached;
+  }
+
   DLOG(INFO) << "GetQualType: " << LLVMThingToString(type);
 
   clang::QualType result;
@@ -433,7 +1643,7 @@ clang::QualType DecompilationContext::GetQualType(llvm::Type *type) {
 
     case llvm::Type::IntegerTyID: {
       auto size{type->getIntegerBitWidth()};
-      CHECK(size > 0) << "Integer bit width has to be greater than 0";
+      CHECK_THROW(size > 0) << "Integer bit width has to be greater than 0";
       if (size == 8) {
         result = ast_ctx.CharTy;
       } else {
@@ -473,7 +1683,7 @@ clang::QualType DecompilationContext::GetQualType(llvm::Type *type) {
 
     case llvm::Type::StructTyID: {
       clang::RecordDecl *sdecl{nullptr};
-      auto &decl{type_decls[type]};
+      auto decl{type_decls.lookup(type)};
       if (!decl) {
         auto tudecl{ast_ctx.getTranslationUnitDecl()};
         auto strct{llvm::cast<llvm::StructType>(type)};
@@ -484,8 +1694,10 @@ clang::QualType DecompilationContext::GetQualType(llvm::Type *type) {
           sname = "struct" + std::to_string(num_declared_structs++);
         }
 
-        // Create a C struct declaration
-        decl = sdecl = ast.CreateStructDecl(tudecl, sname);
+        // Create a C struct declaration. It is recorded before its fields
+        // are, since they may refer to it.
+        sdecl = ast.CreateStructDecl(tudecl, sname);
+        type_decls[type] = sdecl;
 
         // Add fields to the C struct
         for (auto ecnt{0U}; ecnt < strct->getNumElements(); ++ecnt) {
@@ -524,6 +1736,7 @@ clang::QualType DecompilationContext::GetQualType(llvm::Type *type) {
 
   CHECK_THROW(!result.isNull()) << "Unknown LLVM Type";
 
+  qual_types[type] = result;
   return result;
 }
 }  // namespace rellic
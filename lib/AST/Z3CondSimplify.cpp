@@ -11,18 +11,170 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 #include "rellic/AST/Util.h"
+#include "rellic/Trace.h"
 
 namespace rellic {
 
 Z3CondSimplify::Z3CondSimplify(DecompilationContext& dec_ctx)
     : ASTPass(dec_ctx) {}
 
+static void CollectConds(clang::Stmt* stmt, DecompilationContext& dec_ctx,
+                         std::vector<clang::Stmt*>& stmts) {
+  if (!stmt) {
+    return;
+  }
+
+  if (dec_ctx.conds.count(stmt)) {
+    stmts.push_back(stmt);
+  }
+
+  for (auto child : stmt->children()) {
+    CollectConds(child, dec_ctx, stmts);
+  }
+}
+
 void Z3CondSimplify::RunImpl() {
-  LOG(INFO) << "Simplifying conditions using Z3";
-  for (size_t i{0}; i < dec_ctx.z3_exprs.size() && !Stopped(); ++i) {
-    auto simpl{OrderById(dec_ctx.z3_exprs[i].simplify())};
-    dec_ctx.z3_exprs.set(i, simpl);
+  // Conditions are collected in the order of the translation unit rather than
+  // that of the containers keyed by pointer, as Z3 orders the operands of the
+  // expressions it builds by their creation order. Only the conditions used by
+  // the definitions that may still change are simplified, the others have
+  // been simplified already.
+  std::vector<clang::Stmt*> stmts;
+  for (auto decl : dec_ctx.ast_ctx.getTranslationUnitDecl()->decls()) {
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    if (fdecl && fdecl->doesThisDeclarationHaveABody() &&
+        dec_ctx.IsDirty(fdecl)) {
+      CollectConds(fdecl->getBody(), dec_ctx, stmts);
+    }
+  }
+
+  // Conditions are shared between statements, so each of them is only
+  // simplified once
+  std::unordered_map<unsigned, unsigned> simplified;
+  std::vector<unsigned> indices;
+  z3::expr_vector exprs{dec_ctx.z3_ctx};
+  for (auto stmt : stmts) {
+    auto idx{dec_ctx.GetCond(stmt)};
+    if (simplified.emplace(idx, idx).second) {
+      indices.push_back(idx);
+      exprs.push_back(dec_ctx.z3_exprs[idx]);
+    }
+  }
+
+  Simplify(exprs);
+  for (size_t i{0}; i < indices.size(); ++i) {
+    simplified[indices[i]] = dec_ctx.InsertZExpr(exprs[i]);
+  }
+  for (auto stmt : stmts) {
+    auto idx{dec_ctx.conds.lookup(stmt)};
+    auto new_idx{simplified[idx]};
+    if (new_idx != idx) {
+      dec_ctx.SetCond(stmt, new_idx);
+    }
+  }
+}
+
+void Z3CondSimplify::Simplify(z3::expr_vector& exprs) {
+  // Below this many conditions per chunk, translating them costs more than
+  // simplifying them
+  constexpr unsigned min_chunk_size{64};
+  // Chunks per thread, so that threads which get cheap chunks can take over
+  // the remaining ones instead of waiting for the expensive ones
+  constexpr unsigned chunks_per_thread{4};
+  auto num_threads{std::min(dec_ctx.simplify_threads,
+                            exprs.size() / min_chunk_size)};
+  if (num_threads <= 1) {
+    for (unsigned i{0}; i < exprs.size() && !Stopped(); ++i) {
+      exprs.set(i, dec_ctx.prover.Rewrite(exprs[i]));
+    }
+    return;
+  }
+
+  // Z3 contexts are not thread-safe, so expressions are translated into and
+  // out of the worker contexts on this thread
+  struct Chunk {
+    z3::context ctx;
+    std::unique_ptr<z3::expr_vector> exprs;
+    // Counted on the prover once the workers are done, as it is not
+    // thread-safe
+    QueryStatistics rewrites;
+    std::exception_ptr error;
+  };
+  // Conditions of the same definition are next to each other and tend to be
+  // alike, so they are dealt out to the chunks in turn rather than sliced
+  auto num_chunks{std::min<unsigned>(num_threads * chunks_per_thread,
+                                     exprs.size() / min_chunk_size)};
+  std::vector<std::unique_ptr<Chunk>> chunks;
+  for (unsigned c{0}; c < num_chunks; ++c) {
+    z3::expr_vector slice{dec_ctx.z3_ctx};
+    for (auto i{c}; i < exprs.size(); i += num_chunks) {
+      slice.push_back(exprs[i]);
+    }
+    auto& chunk{chunks.emplace_back(std::make_unique<Chunk>())};
+    chunk->exprs = std::make_unique<z3::expr_vector>(chunk->ctx, slice);
+  }
+
+  // Errors are rethrown on this thread, as an exception escaping a worker
+  // would terminate the process
+  std::atomic_uint next_chunk{0};
+  std::vector<std::thread> workers;
+  auto tracing{IsTracing()};
+  auto& interrupt{dec_ctx.prover.GetInterrupt()};
+  for (unsigned t{0}; t < num_threads; ++t) {
+    workers.emplace_back([this, &chunks, &next_chunk, &interrupt, tracing]() {
+      TraceThread trace_thread(tracing);
+      for (auto c{next_chunk++}; c < chunks.size() && !Stopped();
+           c = next_chunk++) {
+        auto& chunk{chunks[c]};
+        llvm::TimeTraceScope trace("Z3Simplify");
+        try {
+          // Conditions whose rewrite is interrupted are left as they are
+          auto& chunk_exprs{*chunk->exprs};
+          SolverInterrupt::Call call(interrupt, chunk->ctx);
+          for (unsigned i{0}; i < chunk_exprs.size() && !Stopped() &&
+                              !interrupt.IsInterrupted();
+               ++i) {
+            auto start{std::chrono::steady_clock::now()};
+            chunk->rewrites.RecordFormula(chunk_exprs[i]);
+            chunk_exprs.set(i, chunk_exprs[i].simplify());
+            chunk->rewrites.Record(std::chrono::steady_clock::now() - start);
+          }
+        } catch (z3::exception&) {
+          if (!interrupt.Explains(chunk->ctx)) {
+            chunk->error = std::current_exception();
+          }
+        } catch (...) {
+          chunk->error = std::current_exception();
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  auto& rewrites{dec_ctx.prover.GetQueries(QueryKind::Rewrite)};
+  for (auto& chunk : chunks) {
+    rewrites.Add(chunk->rewrites);
+    if (chunk->error) {
+      std::rethrow_exception(chunk->error);
+    }
+  }
+
+  for (unsigned c{0}; c < num_chunks; ++c) {
+    z3::expr_vector results{dec_ctx.z3_ctx, *chunks[c]->exprs};
+    for (unsigned j{0}; j < results.size(); ++j) {
+      exprs.set(c + j * num_chunks, results[j]);
+    }
   }
 }
 
@@ -0,0 +1,578 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/BC/Synthetic.h"
+
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Host.h>
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rellic/BC/Util.h"
+#include "rellic/Exception.h"
+
+namespace rellic {
+
+static const SyntheticShape shapes[]{
+    SyntheticShape::SequentialIfs, SyntheticShape::NestedLoops,
+    SyntheticShape::WideSwitch,    SyntheticShape::DiamondChain,
+    SyntheticShape::Irreducible,   SyntheticShape::ExprDag,
+};
+
+llvm::ArrayRef<SyntheticShape> GetSyntheticShapes() { return shapes; }
+
+const char *GetSyntheticShapeName(SyntheticShape shape) {
+  switch (shape) {
+    case SyntheticShape::SequentialIfs:
+      return "sequential_ifs";
+    case SyntheticShape::NestedLoops:
+      return "nested_loops";
+    case SyntheticShape::WideSwitch:
+      return "wide_switch";
+    case SyntheticShape::DiamondChain:
+      return "diamond_chain";
+    case SyntheticShape::Irreducible:
+      return "irreducible";
+    case SyntheticShape::ExprDag:
+      return "expr_dag";
+  }
+  THROW() << "Unknown synthetic shape";
+  return "";
+}
+
+llvm::Optional<SyntheticShape> ParseSyntheticShape(llvm::StringRef name) {
+  for (auto shape : shapes) {
+    if (name == GetSyntheticShapeName(shape)) {
+      return shape;
+    }
+  }
+  return llvm::None;
+}
+
+namespace {
+// Builds the body of a synthetic function. Every shape updates `acc`, which
+// is returned once the shape is done, so that none of it is dead.
+class SyntheticBuilder {
+  llvm::LLVMContext &ctx;
+  llvm::Function *func;
+  llvm::IRBuilder<> ir;
+  llvm::Type *i32;
+  llvm::Value *a;
+  llvm::Value *b;
+  llvm::Value *acc;
+
+  llvm::BasicBlock *CreateBlock(const llvm::Twine &name) {
+    return llvm::BasicBlock::Create(ctx, name, func);
+  }
+
+  llvm::Value *LoadAcc() { return ir.CreateLoad(i32, acc); }
+
+  // acc = acc + `value`
+  void AddToAcc(llvm::Value *value) {
+    ir.CreateStore(ir.CreateAdd(LoadAcc(), value), acc);
+  }
+
+ public:
+  SyntheticBuilder(llvm::Function *func)
+      : ctx(func->getContext()),
+        func(func),
+        ir(llvm::BasicBlock::Create(ctx, "entry", func)),
+        i32(ir.getInt32Ty()),
+        a(func->getArg(0)),
+        b(func->getArg(1)) {
+    acc = ir.CreateAlloca(i32, nullptr, "acc");
+    ir.CreateStore(ir.getInt32(0), acc);
+  }
+
+  void SequentialIfs(unsigned size) {
+    for (unsigned i{0}; i < size; ++i) {
+      auto then_block{CreateBlock("if.then")};
+      auto next_block{CreateBlock("if.end")};
+      ir.CreateCondBr(ir.CreateICmpSGT(a, ir.getInt32(i)), then_block,
+                      next_block);
+      ir.SetInsertPoint(then_block);
+      AddToAcc(ir.getInt32(i));
+      ir.CreateBr(next_block);
+      ir.SetInsertPoint(next_block);
+    }
+  }
+
+  void NestedLoops(unsigned size) {
+    // Allocas are kept in the entry block, where the builder still is
+    std::vector<llvm::Value *> counters;
+    for (unsigned i{0}; i < size; ++i) {
+      counters.push_back(ir.CreateAlloca(i32, nullptr, "i"));
+    }
+
+    std::vector<llvm::BasicBlock *> headers;
+    std::vector<llvm::BasicBlock *> exits;
+    for (unsigned i{0}; i < size; ++i) {
+      auto header{CreateBlock("for.cond")};
+      auto body{CreateBlock("for.body")};
+      auto exit{CreateBlock("for.end")};
+      ir.CreateStore(ir.getInt32(0), counters[i]);
+      ir.CreateBr(header);
+      ir.SetInsertPoint(header);
+      auto counter{ir.CreateLoad(i32, counters[i])};
+      ir.CreateCondBr(ir.CreateICmpSLT(counter, b), body, exit);
+      ir.SetInsertPoint(body);
+      headers.push_back(header);
+      exits.push_back(exit);
+    }
+
+    AddToAcc(a);
+
+    // The latch of each loop follows the exit of the loop it contains
+    for (unsigned i{size}; i-- > 0;) {
+      auto counter{ir.CreateLoad(i32, counters[i])};
+      ir.CreateStore(ir.CreateAdd(counter, ir.getInt32(1)), counters[i]);
+      ir.CreateBr(headers[i]);
+      ir.SetInsertPoint(exits[i]);
+    }
+  }
+
+  void WideSwitch(unsigned size) {
+    auto default_block{CreateBlock("sw.default")};
+    auto exit{CreateBlock("sw.epilog")};
+    auto inst{ir.CreateSwitch(a, default_block, size)};
+    for (unsigned i{0}; i < size; ++i) {
+      auto case_block{CreateBlock("sw.bb")};
+      inst->addCase(ir.getInt32(i), case_block);
+      ir.SetInsertPoint(case_block);
+      ir.CreateStore(ir.CreateMul(b, ir.getInt32(i + 1)), acc);
+      ir.CreateBr(exit);
+    }
+    ir.SetInsertPoint(default_block);
+    ir.CreateStore(b, acc);
+    ir.CreateBr(exit);
+    ir.SetInsertPoint(exit);
+  }
+
+  void DiamondChain(unsigned size) {
+    for (unsigned i{0}; i < size; ++i) {
+      auto then_block{CreateBlock("if.then")};
+      auto else_block{CreateBlock("if.else")};
+      auto next_block{CreateBlock("if.end")};
+      auto bit{ir.CreateAnd(a, ir.getInt32(1u << (i % 31)))};
+      ir.CreateCondBr(ir.CreateICmpEQ(bit, ir.getInt32(0)), then_block,
+                      else_block);
+      ir.SetInsertPoint(then_block);
+      AddToAcc(ir.getInt32(i));
+      ir.CreateBr(next_block);
+      ir.SetInsertPoint(else_block);
+      ir.CreateStore(ir.CreateXor(LoadAcc(), ir.getInt32(i)), acc);
+      ir.CreateBr(next_block);
+      ir.SetInsertPoint(next_block);
+    }
+  }
+
+  void Irreducible(unsigned size) {
+    auto counter{ir.CreateAlloca(i32, nullptr, "n")};
+    ir.CreateStore(b, counter);
+    for (unsigned i{0}; i < size; ++i) {
+      auto first{CreateBlock("first")};
+      auto second{CreateBlock("second")};
+      auto next_block{CreateBlock("next")};
+      ir.CreateCondBr(ir.CreateICmpSGT(a, ir.getInt32(i)), first, second);
+
+      // Each block of the cycle can be entered from outside of it
+      auto Step{[&](unsigned increment, llvm::BasicBlock *other) {
+        AddToAcc(ir.getInt32(increment));
+        auto n{ir.CreateSub(ir.CreateLoad(i32, counter), ir.getInt32(1))};
+        ir.CreateStore(n, counter);
+        ir.CreateCondBr(ir.CreateICmpSGT(n, ir.getInt32(0)), other,
+                        next_block);
+      }};
+      ir.SetInsertPoint(first);
+      Step(1, second);
+      ir.SetInsertPoint(second);
+      Step(2, first);
+      ir.SetInsertPoint(next_block);
+    }
+  }
+
+  void ExprDag(unsigned size) {
+    llvm::Value *x{a};
+    llvm::Value *y{b};
+    for (unsigned i{0}; i < size; ++i) {
+      llvm::Value *z;
+      switch (i % 4) {
+        case 0:
+          z = ir.CreateAdd(x, y);
+          break;
+        case 1:
+          z = ir.CreateMul(x, y);
+          break;
+        case 2:
+          z = ir.CreateXor(x, y);
+          break;
+        default:
+          z = ir.CreateSub(x, y);
+          break;
+      }
+      x = y;
+      y = z;
+    }
+    ir.CreateStore(y, acc);
+
+    llvm::Value *p{ir.CreateICmpSLT(a, ir.getInt32(0))};
+    llvm::Value *q{ir.CreateICmpSGT(b, ir.getInt32(0))};
+    for (unsigned i{0}; i < size; ++i) {
+      llvm::Value *r;
+      switch (i % 3) {
+        case 0:
+          r = ir.CreateAnd(p, q);
+          break;
+        case 1:
+          r = ir.CreateOr(p, q);
+          break;
+        default:
+          r = ir.CreateXor(p, q);
+          break;
+      }
+      p = q;
+      q = r;
+    }
+    auto then_block{CreateBlock("if.then")};
+    auto next_block{CreateBlock("if.end")};
+    ir.CreateCondBr(q, then_block, next_block);
+    ir.SetInsertPoint(then_block);
+    AddToAcc(ir.getInt32(1));
+    ir.CreateBr(next_block);
+    ir.SetInsertPoint(next_block);
+  }
+
+  // Decodes `data` one byte at a time, see `CreateFuzzedModule`. Bytes past
+  // its end read as zero, which ends blocks with a branch to the exit.
+  void FromBytes(llvm::ArrayRef<uint8_t> data) {
+    static constexpr unsigned max_blocks{64};
+    static constexpr unsigned max_depth{4};
+    static constexpr unsigned max_cases{8};
+    size_t pos{0};
+    auto Next{[&]() -> unsigned {
+      return pos < data.size() ? data[pos++] : 0;
+    }};
+
+    auto num_blocks{1 + Next() % max_blocks};
+    std::vector<llvm::BasicBlock *> blocks;
+    for (unsigned i{0}; i < num_blocks; ++i) {
+      blocks.push_back(CreateBlock("bb"));
+    }
+    auto exit{CreateBlock("exit")};
+    auto Target{[&]() {
+      auto idx{Next() % (num_blocks + 1)};
+      return idx < num_blocks ? blocks[idx] : exit;
+    }};
+
+    // A comparison of an argument or of `acc` with a constant, or a boolean
+    // operator on two conditions
+    std::function<llvm::Value *(unsigned)> Cond;
+    Cond = [&](unsigned depth) -> llvm::Value * {
+      auto op{depth < max_depth ? Next() % 4 : 0};
+      if (!op) {
+        static const llvm::CmpInst::Predicate preds[]{
+            llvm::CmpInst::ICMP_EQ, llvm::CmpInst::ICMP_NE,
+            llvm::CmpInst::ICMP_SLT, llvm::CmpInst::ICMP_SGT};
+        auto pred{preds[Next() % 4]};
+        auto operand{Next() % 3};
+        auto lhs{operand == 0 ? a : operand == 1 ? b : LoadAcc()};
+        return ir.CreateICmp(pred, lhs, ir.getInt32(Next()));
+      }
+      auto lhs{Cond(depth + 1)};
+      auto rhs{Cond(depth + 1)};
+      switch (op) {
+        case 1:
+          return ir.CreateAnd(lhs, rhs);
+        case 2:
+          return ir.CreateOr(lhs, rhs);
+        default:
+          return ir.CreateXor(lhs, rhs);
+      }
+    };
+
+    ir.CreateBr(blocks[0]);
+    for (unsigned i{0}; i < num_blocks; ++i) {
+      ir.SetInsertPoint(blocks[i]);
+      AddToAcc(ir.getInt32(i));
+      switch (Next() % 4) {
+        case 0:
+          ir.CreateBr(exit);
+          break;
+        case 1:
+          ir.CreateBr(Target());
+          break;
+        case 2: {
+          auto cond{Cond(0)};
+          auto then_block{Target()};
+          auto else_block{Target()};
+          ir.CreateCondBr(cond, then_block, else_block);
+        } break;
+        default: {
+          auto num_cases{1 + Next() % max_cases};
+          auto inst{ir.CreateSwitch(b, Target(), num_cases)};
+          for (unsigned j{0}; j < num_cases; ++j) {
+            inst->addCase(ir.getInt32(j), Target());
+          }
+        } break;
+      }
+    }
+    ir.SetInsertPoint(exit);
+  }
+
+  void Finish() { ir.CreateRet(LoadAcc()); }
+};
+}  // namespace
+
+// Appends `i32 name(i32 a, i32 b)` to `module`, for a SyntheticBuilder to
+// define
+static llvm::Function *CreateFunction(llvm::Module &module,
+                                      llvm::StringRef name) {
+  auto &ctx{module.getContext()};
+  auto i32{llvm::Type::getInt32Ty(ctx)};
+  auto type{llvm::FunctionType::get(i32, {i32, i32}, false)};
+  auto func{llvm::Function::Create(type, llvm::GlobalValue::ExternalLinkage,
+                                   name, module)};
+  func->getArg(0)->setName("a");
+  func->getArg(1)->setName("b");
+  return func;
+}
+
+llvm::Function *CreateSyntheticFunction(llvm::Module &module,
+                                        SyntheticShape shape, unsigned size,
+                                        llvm::StringRef name) {
+  auto func{CreateFunction(module, name)};
+  SyntheticBuilder builder(func);
+  switch (shape) {
+    case SyntheticShape::SequentialIfs:
+      builder.SequentialIfs(size);
+      break;
+    case SyntheticShape::NestedLoops:
+      builder.NestedLoops(size);
+      break;
+    case SyntheticShape::WideSwitch:
+      builder.WideSwitch(size);
+      break;
+    case SyntheticShape::DiamondChain:
+      builder.DiamondChain(size);
+      break;
+    case SyntheticShape::Irreducible:
+      builder.Irreducible(size);
+      break;
+    case SyntheticShape::ExprDag:
+      builder.ExprDag(size);
+      break;
+  }
+  builder.Finish();
+  return func;
+}
+
+std::unique_ptr<llvm::Module> CreateSyntheticModule(llvm::LLVMContext &ctx,
+                                                    SyntheticShape shape,
+                                                    unsigned size,
+                                                    unsigned num_functions) {
+  std::string name{GetSyntheticShapeName(shape)};
+  auto module{std::make_unique<llvm::Module>(name, ctx)};
+  module->setTargetTriple(llvm::sys::getDefaultTargetTriple());
+  for (unsigned i{0}; i < num_functions; ++i) {
+    CreateSyntheticFunction(*module, shape, size,
+                            name + "_" + std::to_string(i));
+  }
+  CHECK_THROW(VerifyModule(module.get()))
+      << "Synthetic module " << name << " is not well formed";
+  return module;
+}
+
+std::unique_ptr<llvm::Module> CreateFuzzedModule(llvm::LLVMContext &ctx,
+                                                 llvm::ArrayRef<uint8_t> data) {
+  auto module{std::make_unique<llvm::Module>("fuzzed", ctx)};
+  module->setTargetTriple(llvm::sys::getDefaultTargetTriple());
+  SyntheticBuilder builder(CreateFunction(*module, "fuzzed"));
+  builder.FromBytes(data);
+  builder.Finish();
+  CHECK_THROW(VerifyModule(module.get()))
+      << "Fuzzed module is not well formed";
+  return module;
+}
+
+static const SyntheticTypeGraph type_graphs[]{
+    SyntheticTypeGraph::DeepNesting,
+    SyntheticTypeGraph::WideStruct,
+    SyntheticTypeGraph::PointerCycle,
+    SyntheticTypeGraph::Duplicates,
+};
+
+llvm::ArrayRef<SyntheticTypeGraph> GetSyntheticTypeGraphs() {
+  return type_graphs;
+}
+
+const char *GetSyntheticTypeGraphName(SyntheticTypeGraph graph) {
+  switch (graph) {
+    case SyntheticTypeGraph::DeepNesting:
+      return "deep_nesting";
+    case SyntheticTypeGraph::WideStruct:
+      return "wide_struct";
+    case SyntheticTypeGraph::PointerCycle:
+      return "pointer_cycle";
+    case SyntheticTypeGraph::Duplicates:
+      return "duplicates";
+  }
+  THROW() << "Unknown synthetic type graph";
+  return "";
+}
+
+namespace {
+// Builds the debug info of a synthetic type module. Structs are created
+// without fields, which are added once every struct exists, so that fields
+// can refer to any of them.
+class SyntheticTypeBuilder {
+  llvm::Module &module;
+  llvm::DIBuilder dib;
+  llvm::DIFile *file;
+  llvm::DIBasicType *int_type;
+  static constexpr uint64_t pointer_size{64};
+
+ public:
+  using Field = std::pair<std::string, llvm::DIType *>;
+
+  SyntheticTypeBuilder(llvm::Module &module) : module(module), dib(module) {
+    file = dib.createFile(module.getName().str() + ".c", "/");
+    dib.createCompileUnit(llvm::dwarf::DW_LANG_C99, file, "rellic-synth",
+                          /*isOptimized=*/false, "", 0);
+    int_type = dib.createBasicType("int", 32, llvm::dwarf::DW_ATE_signed);
+  }
+
+  llvm::DIType *GetInt() { return int_type; }
+
+  llvm::DIType *GetPointer(llvm::DIType *type) {
+    return dib.createPointerType(type, pointer_size);
+  }
+
+  // Distinct structs only differ in their line, so that copies with the same
+  // name and fields are not uniqued into one
+  llvm::DICompositeType *CreateStruct(const std::string &name, uint64_t size,
+                                      unsigned line) {
+    return dib.createStructType(file, name, file, line, size, 0,
+                                llvm::DINode::FlagZero, nullptr,
+                                llvm::DINodeArray());
+  }
+
+  void SetFields(llvm::DICompositeType *&strct,
+                 const std::vector<Field> &fields) {
+    std::vector<llvm::Metadata *> members;
+    uint64_t offset{0};
+    for (auto &[name, type] : fields) {
+      auto size{type->getSizeInBits()};
+      members.push_back(dib.createMemberType(strct, name, file,
+                                             strct->getLine(), size, 0, offset,
+                                             llvm::DINode::FlagZero, type));
+      offset += size;
+    }
+    dib.replaceArrays(strct, dib.getOrCreateArray(members));
+  }
+
+  // Appends `void name(void *)`, whose debug info types its parameter as a
+  // pointer to `root`
+  void CreateUser(llvm::DIType *root, const std::string &name) {
+    auto &ctx{module.getContext()};
+    auto type{llvm::FunctionType::get(llvm::Type::getVoidTy(ctx),
+                                      {llvm::Type::getInt8PtrTy(ctx)}, false)};
+    auto func{llvm::Function::Create(type, llvm::GlobalValue::ExternalLinkage,
+                                     name, module)};
+    llvm::IRBuilder<> ir(llvm::BasicBlock::Create(ctx, "entry", func));
+    ir.CreateRetVoid();
+    auto ditype{dib.createSubroutineType(
+        dib.getOrCreateTypeArray({nullptr, GetPointer(root)}))};
+    func->setSubprogram(dib.createFunction(
+        file, name, "", file, 1, ditype, 1, llvm::DINode::FlagPrototyped,
+        llvm::DISubprogram::SPFlagDefinition));
+  }
+
+  void Finalize() {
+    dib.finalize();
+    module.addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                         llvm::DEBUG_METADATA_VERSION);
+  }
+};
+}  // namespace
+
+std::unique_ptr<llvm::Module> CreateSyntheticTypeModule(
+    llvm::LLVMContext &ctx, SyntheticTypeGraph graph, unsigned size) {
+  std::string name{GetSyntheticTypeGraphName(graph)};
+  auto module{std::make_unique<llvm::Module>(name, ctx)};
+  module->setTargetTriple(llvm::sys::getDefaultTargetTriple());
+  SyntheticTypeBuilder builder(*module);
+  auto int_size{builder.GetInt()->getSizeInBits()};
+  auto pointer_size{builder.GetPointer(builder.GetInt())->getSizeInBits()};
+  std::vector<llvm::DICompositeType *> structs;
+  switch (graph) {
+    case SyntheticTypeGraph::DeepNesting: {
+      llvm::DIType *inner{builder.GetInt()};
+      for (unsigned i{0}; i < size; ++i) {
+        auto strct{builder.CreateStruct("level_" + std::to_string(i),
+                                        int_size + inner->getSizeInBits(),
+                                        i + 1)};
+        builder.SetFields(strct, {{"value", builder.GetInt()},
+                                  {"inner", inner}});
+        inner = strct;
+      }
+      builder.CreateUser(inner, "use_" + name);
+    } break;
+    case SyntheticTypeGraph::WideStruct: {
+      std::vector<SyntheticTypeBuilder::Field> fields;
+      for (unsigned i{0}; i < size; ++i) {
+        auto strct{builder.CreateStruct("field_" + std::to_string(i),
+                                        int_size, i + 1)};
+        builder.SetFields(strct, {{"value", builder.GetInt()}});
+        fields.push_back({"f" + std::to_string(i), strct});
+      }
+      auto wide{builder.CreateStruct("wide", int_size * size, size + 1)};
+      builder.SetFields(wide, fields);
+      builder.CreateUser(wide, "use_" + name);
+    } break;
+    case SyntheticTypeGraph::PointerCycle: {
+      for (unsigned i{0}; i < size; ++i) {
+        structs.push_back(builder.CreateStruct("node_" + std::to_string(i),
+                                               2 * pointer_size, i + 1));
+      }
+      for (unsigned i{0}; i < size; ++i) {
+        auto next{structs[(i + 1) % size]};
+        builder.SetFields(structs[i],
+                          {{"self", builder.GetPointer(structs[i])},
+                           {"next", builder.GetPointer(next)}});
+      }
+      if (size) {
+        builder.CreateUser(structs[0], "use_" + name);
+      }
+    } break;
+    case SyntheticTypeGraph::Duplicates: {
+      for (unsigned i{0}; i < size; ++i) {
+        auto strct{builder.CreateStruct("duplicate", int_size + pointer_size,
+                                        i + 1)};
+        builder.SetFields(strct,
+                          {{"value", builder.GetInt()},
+                           {"ptr", builder.GetPointer(builder.GetInt())}});
+        builder.CreateUser(strct, "use_" + name + "_" + std::to_string(i));
+      }
+    } break;
+  }
+  builder.Finalize();
+  CHECK_THROW(VerifyModule(module.get()))
+      << "Synthetic module " << name << " is not well formed";
+  return module;
+}
+
+}  // namespace rellic
@@ -11,6 +11,7 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
@@ -27,12 +28,22 @@
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/SourceMgr.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Scalar/DCE.h>
+#include <llvm/Transforms/Scalar/DeadStoreElimination.h>
+#include <llvm/Transforms/Scalar/EarlyCSE.h>
+#include <llvm/Transforms/Scalar/InstSimplifyPass.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
 #include <llvm/Transforms/Utils.h>
-#include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Transforms/Utils/Local.h>
 #include <llvm/Transforms/Utils/LowerSwitch.h>
 
+#include <atomic>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+
+#include "rellic/Exception.h"
+#include "rellic/Trace.h"
 
 namespace rellic {
 
@@ -112,9 +123,15 @@ llvm::Module *LoadModuleFromFile(llvm::LLVMContext *context,
 
 llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
                                    std::string file_data, bool allow_failure) {
-  llvm::SMDiagnostic err;
   llvm::MemoryBufferRef ref(file_data, "memory");
-  auto mod_ptr = llvm::parseIR(ref, err, *context);
+  return LoadModuleFromMemory(context, ref, allow_failure);
+}
+
+llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
+                                   llvm::MemoryBufferRef buffer,
+                                   bool allow_failure) {
+  llvm::SMDiagnostic err;
+  auto mod_ptr = llvm::parseIR(buffer, err, *context);
   auto module = mod_ptr.release();
 
   if (!module) {
@@ -139,10 +156,74 @@ llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
   return module;
 }
 
+llvm::Module *LoadLazyModuleFromFile(llvm::LLVMContext *context,
+                                     std::string file_name,
+                                     bool allow_failure) {
+  auto buffer{llvm::MemoryBuffer::getFile(file_name)};
+  if (!buffer) {
+    LOG_IF(FATAL, !allow_failure) << "Unable to read module file " << file_name
+                                  << ": " << buffer.getError().message();
+    return nullptr;
+  }
+
+  // Textual IR cannot be loaded lazily
+  auto &data{**buffer};
+  if (!llvm::isBitcode(
+          reinterpret_cast<const unsigned char *>(data.getBufferStart()),
+          reinterpret_cast<const unsigned char *>(data.getBufferEnd()))) {
+    return LoadModuleFromFile(context, file_name, allow_failure);
+  }
+
+  auto module{llvm::getOwningLazyBitcodeModule(std::move(*buffer), *context)};
+  if (!module) {
+    auto msg{llvm::toString(module.takeError())};
+    LOG_IF(FATAL, !allow_failure)
+        << "Unable to parse module file " << file_name << ": " << msg;
+    return nullptr;
+  }
+
+  return module->release();
+}
+
+llvm::Module *LoadLazyModuleFromMemory(llvm::LLVMContext *context,
+                                       llvm::MemoryBufferRef buffer,
+                                       bool allow_failure) {
+  auto module{llvm::getLazyBitcodeModule(buffer, *context)};
+  if (!module) {
+    auto msg{llvm::toString(module.takeError())};
+    LOG_IF(FATAL, !allow_failure)
+        << "Unable to parse module " << buffer.getBufferIdentifier().str()
+        << ": " << msg;
+    return nullptr;
+  }
+
+  return module->release();
+}
+
 bool IsGlobalMetadata(const llvm::GlobalObject &go) {
   return go.getSection() == "llvm.metadata";
 }
 
+llvm::Optional<llvm::APInt> GetPCMetadata(llvm::Value *value) {
+  llvm::MDNode *pc{nullptr};
+  if (auto func = llvm::dyn_cast<llvm::Function>(value)) {
+    pc = func->getMetadata("pc");
+    if (!pc && !func->isDeclaration()) {
+      return GetPCMetadata(&func->getEntryBlock().front());
+    }
+  } else if (auto inst = llvm::dyn_cast<llvm::Instruction>(value)) {
+    pc = inst->getMetadata("pc");
+  }
+
+  if (!pc) {
+    return llvm::Optional<llvm::APInt>();
+  }
+
+  auto &cop{pc->getOperand(0U)};
+  auto cval{llvm::cast<llvm::ConstantAsMetadata>(cop)->getValue()};
+  return llvm::cast<llvm::ConstantInt>(cval)->getValue();
+}
+
 bool IsAnnotationIntrinsic(llvm::Intrinsic::ID id) {
   // this is a copy of IntrinsicInst::isAssumeLikeIntrinsic in LLVM12+
   // NOTE(artem): This probalby needs some compat wrappers for older LLVM
@@ -200,6 +281,7 @@ void CopyMetadataTo(llvm::Value *src, llvm::Value *dst) {
 }
 
 void RemovePHINodes(llvm::Module &module) {
+  llvm::TimeTraceScope trace("RemovePHINodes");
   std::vector<llvm::PHINode *> work_list;
   for (auto &func : module) {
     for (auto &inst : llvm::instructions(func)) {
@@ -217,6 +299,7 @@ void RemovePHINodes(llvm::Module &module) {
 }
 
 void LowerSwitches(llvm::Module &module) {
+  llvm::TimeTraceScope trace("LowerSwitches");
   llvm::PassBuilder pb;
   llvm::ModulePassManager mpm;
   llvm::ModuleAnalysisManager mam;
@@ -241,7 +324,8 @@ void LowerSwitches(llvm::Module &module) {
   fam.clear();
   cam.clear();
   lam.clear();
-  CHECK(VerifyModule(&module)) << "Transformation broke module correctness";
+  CHECK_THROW(VerifyModule(&module))
+      << "Transformation broke module correctness";
 }
 
 // Takes an insertvalue node and converts into an alloca, store, load sequence
@@ -283,7 +367,18 @@ static llvm::LoadInst *ConvertInsertValue(llvm::InsertValueInst *I) {
   return load;
 }
 
+static void ConvertInsertValues(
+    const std::vector<llvm::InsertValueInst *> &work_list) {
+  for (auto iv : work_list) {
+    llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 16u> mds;
+    iv->getAllMetadataOtherThanDebugLoc(mds);
+    auto new_load{ConvertInsertValue(iv)};
+    CloneMetadataInto(new_load, mds);
+  }
+}
+
 void RemoveInsertValues(llvm::Module &m) {
+  llvm::TimeTraceScope trace("RemoveInsertValues");
   std::vector<llvm::InsertValueInst *> work_list;
   for (auto &func : m) {
     for (auto &inst : llvm::instructions(func)) {
@@ -293,17 +388,16 @@ void RemoveInsertValues(llvm::Module &m) {
     }
   }
 
-  for (auto iv : work_list) {
-    llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 16u> mds;
-    iv->getAllMetadataOtherThanDebugLoc(mds);
-    auto new_load{ConvertInsertValue(iv)};
-    CloneMetadataInto(new_load, mds);
-  }
+  ConvertInsertValues(work_list);
 
-  CHECK(VerifyModule(&m)) << "Transformation broke module correctness";
+  CHECK_THROW(VerifyModule(&m)) << "Transformation broke module correctness";
 }
 
-void ConvertArrayArguments(llvm::Module &m) {
+// Returns the function definitions that were created or modified, which may
+// contain new `insertvalue` instructions
+static std::unordered_set<llvm::Function *> ConvertArrayArgumentsImpl(
+    llvm::Module &m) {
+  std::unordered_set<llvm::Function *> changed;
   std::unordered_map<llvm::Type *, llvm::Type *> conv_types;
   std::vector<unsigned> indices;
   indices.push_back(0);
@@ -323,6 +417,9 @@ void ConvertArrayArguments(llvm::Module &m) {
     return ty;
   };
 
+  // The type of a function cannot change, so a function with a new signature
+  // is created. The body of the original function is moved into it rather
+  // than cloned, so that the module never holds two copies of it.
   auto ConvertFunction = [&](llvm::Function *orig_func) -> llvm::Function * {
     auto return_ty{ConvertType(orig_func->getReturnType())};
     std::vector<llvm::Type *> arg_types;
@@ -333,39 +430,47 @@ void ConvertArrayArguments(llvm::Module &m) {
         llvm::FunctionType::get(return_ty, arg_types, orig_func->isVarArg())};
     auto new_func{llvm::Function::Create(func_type, orig_func->getLinkage(),
                                          orig_func->getName(), m)};
+    new_func->copyAttributesFrom(orig_func);
     if (orig_func->isDeclaration()) {
       return new_func;
     }
-    auto bb{llvm::BasicBlock::Create(m.getContext(), "", new_func)};
+    new_func->copyMetadata(orig_func, 0);
+    orig_func->clearMetadata();
+    auto entry{&orig_func->getEntryBlock()};
+    new_func->splice(new_func->end(), orig_func);
+    auto bb{llvm::BasicBlock::Create(ctx, "", new_func, entry)};
 
-    llvm::ValueToValueMapTy ValueMap;
     auto new_args{new_func->arg_begin()};
     for (auto &old_arg : orig_func->args()) {
       new_args->setName(old_arg.getName());
       if (old_arg.getType()->isArrayTy()) {
-        ValueMap[&old_arg] =
-            llvm::ExtractValueInst::Create(new_args, indices, "", bb);
+        old_arg.replaceAllUsesWith(
+            llvm::ExtractValueInst::Create(new_args, indices, "", bb));
       } else {
-        ValueMap[&old_arg] = new_args;
+        old_arg.replaceAllUsesWith(new_args);
       }
       ++new_args;
     }
-    llvm::SmallVector<llvm::ReturnInst *, 8> Returns;
-    llvm::CloneFunctionInto(new_func, orig_func, ValueMap,
-                            llvm::CloneFunctionChangeType::LocalChangesOnly,
-                            Returns);
-    llvm::BranchInst::Create(bb->getNextNode(), bb);
+    llvm::BranchInst::Create(entry, bb);
 
     if (orig_func->getReturnType()->isArrayTy()) {
       auto undef{llvm::UndefValue::get(return_ty)};
-      for (auto ret : Returns) {
+      std::vector<llvm::ReturnInst *> returns;
+      for (auto &block : *new_func) {
+        auto term{block.getTerminator()};
+        if (auto ret = llvm::dyn_cast_or_null<llvm::ReturnInst>(term)) {
+          returns.push_back(ret);
+        }
+      }
+      for (auto ret : returns) {
         auto wrap{llvm::InsertValueInst::Create(undef, ret->getReturnValue(),
                                                 indices, "", ret)};
-        auto new_ret{llvm::ReturnInst::Create(ctx, wrap, ret)};
+        llvm::ReturnInst::Create(ctx, wrap, ret);
         ret->eraseFromParent();
       }
     }
     funcs_to_remove.push_back(std::make_pair(orig_func, new_func));
+    changed.insert(new_func);
     return new_func;
   };
 
@@ -382,16 +487,20 @@ void ConvertArrayArguments(llvm::Module &m) {
       }
     }
   }
+  if (fmap.empty()) {
+    return changed;
+  }
 
   for (auto &f : m.functions()) {
     std::vector<llvm::Instruction *> insts_to_remove;
     for (auto &i : llvm::instructions(f)) {
       if (auto call = llvm::dyn_cast<llvm::CallInst>(&i)) {
         auto callee{call->getCalledFunction()};
-        auto new_func{fmap[callee]};
-        if (!new_func) {
+        auto it{fmap.find(callee)};
+        if (it == fmap.end()) {
           continue;
         }
+        auto new_func{it->second};
 
         std::vector<llvm::Value *> args;
         for (auto &old_arg : call->args()) {
@@ -418,6 +527,7 @@ void ConvertArrayArguments(llvm::Module &m) {
           call->replaceAllUsesWith(new_call);
         }
         insts_to_remove.push_back(call);
+        changed.insert(&f);
       }
     }
 
@@ -434,6 +544,7 @@ void ConvertArrayArguments(llvm::Module &m) {
     if (!func_to_remove->hasAddressTaken(&user, false, false, true, false)) {
       auto orig_name = func_to_remove->getName().str();
       func_to_remove->replaceAllUsesWith(replacement);
+      changed.erase(func_to_remove);
       func_to_remove->eraseFromParent();
       replacement->setName(orig_name);
     } else {
@@ -442,7 +553,176 @@ void ConvertArrayArguments(llvm::Module &m) {
     }
   }
 
-  CHECK(VerifyModule(&m)) << "Transformation broke module correctness";
+  return changed;
+}
+
+void ConvertArrayArguments(llvm::Module &m) {
+  llvm::TimeTraceScope trace("ConvertArrayArguments");
+  ConvertArrayArgumentsImpl(m);
+  CHECK_THROW(VerifyModule(&m)) << "Transformation broke module correctness";
+}
+
+namespace {
+// Instructions of a function definition that preprocessing has to rewrite
+struct PreprocessWork {
+  std::vector<llvm::PHINode *> phis;
+  std::vector<llvm::InsertValueInst *> insert_values;
+  bool has_switches{false};
+};
+}  // namespace
+
+static void CollectPreprocessWork(llvm::Function &func,
+                                  const PreprocessOptions &options,
+                                  PreprocessWork &work) {
+  for (auto &inst : llvm::instructions(func)) {
+    if (auto phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+      if (options.remove_phi_nodes) {
+        work.phis.push_back(phi);
+      }
+    } else if (auto iv = llvm::dyn_cast<llvm::InsertValueInst>(&inst)) {
+      work.insert_values.push_back(iv);
+    } else if (llvm::isa<llvm::SwitchInst>(inst)) {
+      work.has_switches = options.lower_switches;
+    }
+  }
+}
+
+// Runs the cleanup passes of `PreprocessOptions::pre_opt` on every function
+// definition of `m`
+static void RunCleanupPasses(llvm::Module &m, unsigned level) {
+  llvm::TimeTraceScope trace("RunCleanupPasses");
+  llvm::PassBuilder pb;
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cam;
+  llvm::ModuleAnalysisManager mam;
+  pb.registerFunctionAnalyses(fam);
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cam, mam);
+
+  // Blocks are neither speculated nor merged into selects, so that the
+  // control flow that remains is the one of the input
+  auto cfg_options{llvm::SimplifyCFGOptions()
+                       .speculateBlocks(false)
+                       .setFoldTwoEntryPHINode(false)};
+  llvm::FunctionPassManager fpm;
+  fpm.addPass(llvm::InstSimplifyPass());
+  fpm.addPass(llvm::SimplifyCFGPass(cfg_options));
+  fpm.addPass(llvm::EarlyCSEPass(/*UseMemorySSA=*/level > 1));
+  if (level > 1) {
+    fpm.addPass(llvm::DSEPass());
+  }
+  fpm.addPass(llvm::DCEPass());
+  fpm.addPass(llvm::SimplifyCFGPass(cfg_options));
+
+  llvm::ModulePassManager mpm;
+  mpm.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(fpm)));
+  mpm.run(m, mam);
+
+  mam.clear();
+  fam.clear();
+  cam.clear();
+  lam.clear();
+}
+
+void PreprocessModule(llvm::Module &m, const PreprocessOptions &options) {
+  llvm::TimeTraceScope trace("PreprocessModule");
+  if (options.pre_opt) {
+    RunCleanupPasses(m, options.pre_opt);
+  }
+
+  std::vector<llvm::Function *> funcs;
+  for (auto &func : m) {
+    if (!func.isDeclaration()) {
+      funcs.push_back(&func);
+    }
+  }
+
+  // Finding the instructions to rewrite only reads the IR, so it is split
+  // among threads. The rewrites themselves create constants and add uses to
+  // values that are shared by all functions of the module, and are therefore
+  // done sequentially.
+  std::vector<PreprocessWork> work(funcs.size());
+  std::atomic_size_t next_func{0};
+  auto collect = [&]() {
+    llvm::TimeTraceScope trace("CollectPreprocessWork");
+    for (auto i{next_func++}; i < funcs.size(); i = next_func++) {
+      CollectPreprocessWork(*funcs[i], options, work[i]);
+    }
+  };
+  auto num_threads{std::min<size_t>(options.num_threads, funcs.size())};
+  if (num_threads > 1) {
+    std::vector<std::thread> workers;
+    auto tracing{IsTracing()};
+    for (size_t i{0}; i < num_threads; ++i) {
+      workers.emplace_back([&collect, tracing]() {
+        TraceThread trace_thread(tracing);
+        collect();
+      });
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  } else {
+    collect();
+  }
+
+  // A single set of analysis managers serves all functions that contain
+  // switches
+  llvm::PassBuilder pb;
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cam;
+  llvm::ModuleAnalysisManager mam;
+  pb.registerFunctionAnalyses(fam);
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cam, mam);
+  llvm::LowerSwitchPass lower_switch;
+
+  for (size_t i{0}; i < funcs.size(); ++i) {
+    auto &func{*funcs[i]};
+    llvm::TimeTraceScope func_trace("PreprocessFunction", func.getName());
+    for (auto phi : work[i].phis) {
+      llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 16u> mds;
+      phi->getAllMetadataOtherThanDebugLoc(mds);
+      auto new_alloca{DemotePHIToStack(phi)};
+      CloneMetadataInto(new_alloca, mds);
+    }
+
+    // Lowering switches may delete blocks, so the instructions that were
+    // collected are rewritten first
+    ConvertInsertValues(work[i].insert_values);
+
+    if (work[i].has_switches) {
+      lower_switch.run(func, fam);
+      fam.clear(func, func.getName());
+    }
+  }
+
+  mam.clear();
+  fam.clear();
+  cam.clear();
+  lam.clear();
+
+  // Array arguments are converted last, as the definitions they replace are
+  // cloned. Only the definitions that were changed can contain new
+  // `insertvalue` instructions.
+  llvm::TimeTraceScope array_trace("ConvertArrayArguments");
+  for (auto func : ConvertArrayArgumentsImpl(m)) {
+    std::vector<llvm::InsertValueInst *> work_list;
+    for (auto &inst : llvm::instructions(*func)) {
+      if (auto iv = llvm::dyn_cast<llvm::InsertValueInst>(&inst)) {
+        work_list.push_back(iv);
+      }
+    }
+    ConvertInsertValues(work_list);
+  }
+
+  CHECK_THROW(VerifyModule(&m)) << "Transformation broke module correctness";
 }
 
 }  // namespace rellic
\ No newline at end of file
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/DecompilationCache.h"
+
+#include <clang/AST/Decl.h>
+#include <glog/logging.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/ModuleSlotTracker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "rellic/AST/DebugInfoCollector.h"
+#include "rellic/AST/DecompilationContext.h"
+
+namespace rellic {
+
+namespace {
+// Drops the numbers of metadata and attribute group slots, which depend on the
+// rest of the module
+static void PrintWithoutSlots(llvm::StringRef text, llvm::raw_ostream& os) {
+  for (size_t i{0}; i < text.size(); ++i) {
+    os << text[i];
+    if (text[i] == '!' || text[i] == '#') {
+      while (i + 1 < text.size() && llvm::isDigit(text[i + 1])) {
+        ++i;
+      }
+    }
+  }
+  os << '\n';
+}
+
+class KeyBuilder {
+  llvm::Module& module;
+  llvm::ModuleSlotTracker slots;
+  DecompilationContext& dec_ctx;
+  DebugInfoCollector& dic;
+
+  std::string text;
+  llvm::raw_string_ostream os{text};
+  std::unordered_map<llvm::Metadata*, unsigned> nodes;
+  std::unordered_set<llvm::Type*> types;
+  std::vector<llvm::StructType*> structs;
+
+  template <typename T>
+  void Print(T& value) {
+    std::string str;
+    llvm::raw_string_ostream str_os(str);
+    value.print(str_os, slots);
+    PrintWithoutSlots(str_os.str(), os);
+  }
+
+  void AddMetadata(llvm::Metadata* md) {
+    if (!md) {
+      return;
+    }
+
+    auto [it, inserted] = nodes.emplace(md, nodes.size());
+    if (!inserted) {
+      os << "!ref" << it->second << '\n';
+      return;
+    }
+
+    std::string str;
+    llvm::raw_string_ostream str_os(str);
+    md->print(str_os, slots, &module);
+    PrintWithoutSlots(str_os.str(), os);
+
+    // The compilation unit refers to every global of the module, so it is not
+    // followed
+    auto node{llvm::dyn_cast<llvm::MDNode>(md)};
+    if (!node || llvm::isa<llvm::DICompileUnit>(node)) {
+      return;
+    }
+
+    for (auto& op : node->operands()) {
+      AddMetadata(op.get());
+    }
+  }
+
+  void AddType(llvm::Type* type) {
+    if (!type || !types.insert(type).second) {
+      return;
+    }
+
+    if (auto strct = llvm::dyn_cast<llvm::StructType>(type)) {
+      structs.push_back(strct);
+    }
+
+    for (auto subtype : type->subtypes()) {
+      AddType(subtype);
+    }
+  }
+
+  void AddAttachments(llvm::SmallVectorImpl<
+                      std::pair<unsigned, llvm::MDNode*>>& attachments) {
+    for (auto [kind, node] : attachments) {
+      AddMetadata(node);
+    }
+  }
+
+  void AddInstruction(llvm::Instruction& inst) {
+    Print(inst);
+    AddType(inst.getType());
+    for (auto& op : inst.operands()) {
+      AddType(op->getType());
+      if (auto md = llvm::dyn_cast<llvm::MetadataAsValue>(op.get())) {
+        AddMetadata(md->getMetadata());
+      }
+    }
+
+    if (auto gep = llvm::dyn_cast<llvm::GetElementPtrInst>(&inst)) {
+      AddType(gep->getSourceElementType());
+    } else if (auto alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst)) {
+      AddType(alloca->getAllocatedType());
+    } else if (auto call = llvm::dyn_cast<llvm::CallBase>(&inst)) {
+      AddType(call->getFunctionType());
+    }
+
+    llvm::SmallVector<std::pair<unsigned, llvm::MDNode*>, 4> attachments;
+    inst.getAllMetadata(attachments);
+    AddAttachments(attachments);
+  }
+
+  // The C names of struct types are assigned by rellic and are the only part
+  // of the output that does not come from the IR of the function itself
+  void AddStructNames() {
+    auto& ditypes{dic.GetIRTypeToDITypeMap()};
+    for (auto strct : structs) {
+      auto it{dec_ctx.type_decls.find(strct)};
+      if (it == dec_ctx.type_decls.end() || !it->second) {
+        continue;
+      }
+
+      os << "struct " << it->second->getName() << '\n';
+      auto ditype{ditypes.find(strct)};
+      if (ditype != ditypes.end()) {
+        AddMetadata(ditype->second);
+      }
+    }
+  }
+
+ public:
+  KeyBuilder(llvm::Module& module, DecompilationContext& dec_ctx,
+             DebugInfoCollector& dic)
+      : module(module),
+        slots(&module, /*ShouldInitializeAllMetadata=*/false),
+        dec_ctx(dec_ctx),
+        dic(dic) {}
+
+  std::string GetKey(llvm::Function& func, llvm::StringRef salt) {
+    text.clear();
+    nodes.clear();
+    types.clear();
+    structs.clear();
+    slots.incorporateFunction(func);
+
+    os << salt << '\n';
+    os << func.getName() << ' ' << func.getLinkage() << '\n';
+    AddType(func.getFunctionType());
+    os << *func.getFunctionType() << '\n';
+    for (auto& arg : func.args()) {
+      os << arg.getName() << '\n';
+    }
+
+    llvm::SmallVector<std::pair<unsigned, llvm::MDNode*>, 4> attachments;
+    func.getAllMetadata(attachments);
+    AddAttachments(attachments);
+
+    for (auto& block : func) {
+      block.printAsOperand(os, /*PrintType=*/false, slots);
+      os << ":\n";
+      for (auto& inst : block) {
+        AddInstruction(inst);
+      }
+    }
+    AddStructNames();
+
+    auto hash{llvm::SHA1::hash(llvm::arrayRefFromStringRef(os.str()))};
+    return llvm::toHex(hash, /*LowerCase=*/true);
+  }
+};
+}  // namespace
+
+struct DecompilationCache::MemoryStore {
+  std::mutex mutex;
+  std::unordered_map<std::string, std::string> entries;
+};
+
+DecompilationCache::DecompilationCache()
+    : memory(std::make_shared<MemoryStore>()) {}
+
+DecompilationCache::DecompilationCache(std::string directory)
+    : directory(std::move(directory)) {}
+
+std::string DecompilationCache::GetPath(const std::string& key) const {
+  llvm::SmallString<256> path(directory);
+  llvm::sys::path::append(path, key.substr(0, 2), key + ".c");
+  return path.str().str();
+}
+
+DecompilationCache::KeyMap DecompilationCache::GetKeys(
+    llvm::Module& module, DecompilationContext& dec_ctx,
+    DebugInfoCollector& dic, llvm::StringRef salt) {
+  KeyMap keys;
+  KeyBuilder builder(module, dec_ctx, dic);
+  for (auto& func : module.functions()) {
+    if (!func.isDeclaration() && !dec_ctx.prototype_only.count(&func)) {
+      keys[&func] = builder.GetKey(func, salt);
+    }
+  }
+  return keys;
+}
+
+std::optional<std::string> DecompilationCache::Load(
+    const std::string& key) const {
+  if (memory) {
+    std::unique_lock<std::mutex> lock(memory->mutex);
+    auto it{memory->entries.find(key)};
+    if (it == memory->entries.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  auto buffer{llvm::MemoryBuffer::getFile(GetPath(key))};
+  if (!buffer) {
+    return std::nullopt;
+  }
+  return (*buffer)->getBuffer().str();
+}
+
+void DecompilationCache::Store(const std::string& key,
+                               llvm::StringRef code) const {
+  if (memory) {
+    std::unique_lock<std::mutex> lock(memory->mutex);
+    memory->entries.emplace(key, code.str());
+    return;
+  }
+
+  // Entries are written to a temporary file first and then renamed, so that
+  // concurrent readers never observe a partial entry
+  auto path{GetPath(key)};
+  auto ec{
+      llvm::sys::fs::create_directories(llvm::sys::path::parent_path(path))};
+  if (ec) {
+    LOG(WARNING) << "Cannot create cache directory for " << path << ": "
+                 << ec.message();
+    return;
+  }
+
+  int fd;
+  llvm::SmallString<256> tmp_path;
+  ec = llvm::sys::fs::createUniqueFile(path + ".%%%%%%.tmp", fd, tmp_path);
+  if (ec) {
+    LOG(WARNING) << "Cannot create cache entry " << path << ": "
+                 << ec.message();
+    return;
+  }
+
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << code;
+    os.close();
+    if (os.has_error()) {
+      LOG(WARNING) << "Cannot write cache entry " << path << ": "
+                   << os.error().message();
+      os.clear_error();
+      llvm::sys::fs::remove(tmp_path);
+      return;
+    }
+  }
+
+  ec = llvm::sys::fs::rename(tmp_path, path);
+  if (ec) {
+    LOG(WARNING) << "Cannot store cache entry " << path << ": "
+                 << ec.message();
+    llvm::sys::fs::remove(tmp_path);
+  }
+}
+
+}  // namespace rellic
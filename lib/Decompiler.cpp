@@ -8,23 +8,44 @@
 
 #include "rellic/Decompiler.h"
 
+#include <clang/AST/ASTImporter.h>
 #include <clang/Basic/TargetInfo.h>
 #include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/PassManager.h>
+#include <llvm/IR/TypeFinder.h>
 #include <llvm/InitializePasses.h>
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils.h>
+#include <llvm/Transforms/Utils/FunctionComparator.h>
 #include <llvm/Transforms/Utils/Local.h>
 #include <llvm/Transforms/Utils/LowerSwitch.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
+#include "rellic/AST/CPrinter.h"
 #include "rellic/AST/CondBasedRefine.h"
 #include "rellic/AST/DeadStmtElim.h"
 #include "rellic/AST/DebugInfoCollector.h"
 #include "rellic/AST/ExprCombine.h"
+#include "rellic/AST/FusedASTPass.h"
 #include "rellic/AST/GenerateAST.h"
 #include "rellic/AST/IRToASTVisitor.h"
 #include "rellic/AST/LocalDeclRenamer.h"
@@ -34,136 +55,2214 @@
 #include "rellic/AST/NestedScopeCombine.h"
 #include "rellic/AST/ReachBasedRefine.h"
 #include "rellic/AST/StructFieldRenamer.h"
+#include "rellic/AST/Util.h"
 #include "rellic/AST/Z3CondSimplify.h"
 #include "rellic/BC/Util.h"
+#include "rellic/DecompilationCache.h"
 #include "rellic/Exception.h"
+#include "rellic/Forensics.h"
+#include "rellic/Serialization.h"
+#include "rellic/Trace.h"
+#include "rellic/Version.h"
 
 namespace {
 
+// The pass registry is global, so it is only initialized by the first
+// `Decompile` call
 static void InitOptPasses(void) {
-  auto& pr{*llvm::PassRegistry::getPassRegistry()};
-  initializeCore(pr);
-  initializeAnalysis(pr);
+  static std::once_flag initialized;
+  std::call_once(initialized, []() {
+    auto& pr{*llvm::PassRegistry::getPassRegistry()};
+    initializeCore(pr);
+    initializeAnalysis(pr);
+  });
+}
+
+static std::unique_ptr<clang::ASTUnit> CreateASTUnit(
+    const std::string& target_triple) {
+  std::vector<std::string> args{"-Wno-pointer-to-int-cast",
+                                "-Wno-pointer-sign", "-target", target_triple};
+  // Silence clang warning
+  // warning: unknown platform, assumming -mfloat-abi=soft
+  const auto& triple{llvm::Triple(target_triple)};
+  if (triple.isARM()) {
+    args.push_back("-mfloat-abi=soft");
+  }
+  return clang::tooling::buildASTFromCodeWithArgs("", args, "out.c");
+}
+
+static void ConfigureContext(llvm::Module& module,
+                             rellic::DecompilationContext& dec_ctx,
+                             const rellic::DecompilationOptions& options) {
+  for (auto& provider : options.additional_providers) {
+    dec_ctx.type_provider->AddProvider(provider->create(dec_ctx));
+  }
+  dec_ctx.type_provider->Prefetch(module);
+  dec_ctx.prover.SetLimits(options.z3_timeout, options.z3_rlimit);
+  dec_ctx.prover.SetEngine(options.condition_engine);
+  dec_ctx.prover.SetQueryLog(options.query_log);
+  dec_ctx.events = options.event_log;
+  dec_ctx.simplify_threads = options.simplify_threads;
+  dec_ctx.prove_threads = options.prove_threads;
+  dec_ctx.generate_threads = options.generate_threads;
+  dec_ctx.unit_threads = options.unit_threads;
+  dec_ctx.large_function_limits = options.large_function_limits;
+  dec_ctx.cond_var_size = options.cond_var_size;
+  dec_ctx.coalesce_phi_nodes = options.coalesce_phi_nodes;
+  dec_ctx.blob_initializer_size = options.blob_initializer_size;
+  dec_ctx.reach_var_size = options.reach_var_size;
+  dec_ctx.region_unit_size = options.region_unit_size;
+  dec_ctx.structuring = options.structuring;
+  dec_ctx.goto_cond_size = options.goto_cond_size;
+  dec_ctx.goto_timeout = options.goto_timeout;
+  dec_ctx.rule_timing = options.rule_timing;
+  dec_ctx.forensic_queries =
+      options.forensics_directory.empty() ? 0 : options.forensics_queries;
+}
+
+static void Accumulate(const rellic::ASTPassStatistics& from,
+                       rellic::ASTPassStatistics& to) {
+  to.num_runs += from.num_runs;
+  to.num_changes += from.num_changes;
+  to.elapsed += from.elapsed;
+  to.num_cycles += from.num_cycles;
+  to.ast_bytes += from.ast_bytes;
+  to.ast_nodes += from.ast_nodes;
+  to.z3_exprs += from.z3_exprs;
+}
+
+static void RecordStage(const char* name, rellic::CompositeASTPass& pass,
+                        unsigned num_iterations,
+                        rellic::PassStatistics& stats) {
+  auto& stage{stats.stages.emplace_back()};
+  stage.name = name;
+  stage.num_iterations = num_iterations;
+  stage.stats = pass.GetStatistics();
+  for (auto& subpass : pass.GetPasses()) {
+    stage.passes.push_back({subpass->GetName(), subpass->GetStatistics()});
+  }
+}
+
+static void UpdatePeakMemory(const rellic::MemoryUsage& usage,
+                             rellic::MemoryUsage& peak) {
+  if (usage.Total() > peak.Total()) {
+    peak = usage;
+  }
+}
+
+static void MergeStatistics(const rellic::PassStatistics& from,
+                            rellic::PassStatistics& to) {
+  UpdatePeakMemory(from.peak_memory, to.peak_memory);
+  to.prover.Add(from.prover);
+
+  if (to.stages.empty()) {
+    to = from;
+    return;
+  }
+
+  to.functions.insert(to.functions.end(), from.functions.begin(),
+                      from.functions.end());
+  for (auto& [name, rule] : from.rules) {
+    to.rules[name].Add(rule);
+  }
+
+  for (auto [from_stage, to_stage] : llvm::zip(from.stages, to.stages)) {
+    to_stage.num_iterations += from_stage.num_iterations;
+    to_stage.truncated |= from_stage.truncated;
+    Accumulate(from_stage.stats, to_stage.stats);
+    for (auto [from_pass, to_pass] :
+         llvm::zip(from_stage.passes, to_stage.passes)) {
+      Accumulate(from_pass.stats, to_pass.stats);
+    }
+  }
+}
+
+static void ReportProgress(
+    const std::shared_ptr<rellic::DecompilationToken>& token,
+    std::string stage, unsigned iteration = 0) {
+  if (token) {
+    token->SetProgress(std::move(stage), iteration);
+  }
+}
+
+static void CheckCancelled(
+    const std::shared_ptr<rellic::DecompilationToken>& token) {
+  CHECK_THROW(!token || !token->IsCancelled())
+      << "Decompilation was cancelled";
+}
+
+// Calls `on_cancel` if `token` is cancelled while the scope is alive
+class CancellationScope {
+  std::shared_ptr<rellic::DecompilationToken> token;
+  unsigned id{0};
+
+ public:
+  CancellationScope(std::shared_ptr<rellic::DecompilationToken> token,
+                    std::function<void()> on_cancel)
+      : token(std::move(token)) {
+    if (this->token) {
+      id = this->token->Subscribe(std::move(on_cancel));
+    }
+  }
+
+  ~CancellationScope() {
+    if (token) {
+      token->Unsubscribe(id);
+    }
+  }
+
+  CancellationScope(const CancellationScope&) = delete;
+  CancellationScope& operator=(const CancellationScope&) = delete;
+};
+
+static void BuildAST(llvm::Module& module,
+                     rellic::DecompilationContext& dec_ctx,
+                     rellic::PassStatistics& stats,
+                     const std::shared_ptr<rellic::DecompilationToken>& token) {
+  rellic::AllocationScope allocations(dec_ctx);
+  auto start{std::chrono::steady_clock::now()};
+  ReportProgress(token, "generate");
+  {
+    // Interrupted queries are answered conservatively, so GenerateAST
+    // finishes quickly and the cancellation is reported below
+    CancellationScope cancellation(token,
+                                   [&]() { dec_ctx.prover.Interrupt(); });
+    rellic::GenerateAST::run(module, dec_ctx);
+  }
+  CheckCancelled(token);
+  auto& stage{stats.stages.emplace_back()};
+  stage.name = "generate";
+  stage.stats.num_runs = 1;
+  stage.stats.elapsed = std::chrono::steady_clock::now() - start;
+  allocations.Record(stage.stats);
+  UpdatePeakMemory(dec_ctx.GetMemoryUsage(), stats.peak_memory);
+  stats.functions = std::move(dec_ctx.function_metrics);
+  dec_ctx.function_metrics.clear();
+}
+
+// Same as `BuildAST`, but restores the AST from a checkpoint
+static void ResumeAST(llvm::Module& module,
+                      rellic::DecompilationContext& dec_ctx,
+                      const std::string& path, rellic::PassStatistics& stats) {
+  auto start{std::chrono::steady_clock::now()};
+  rellic::ReadCheckpoint(dec_ctx, module, path);
+  auto& stage{stats.stages.emplace_back()};
+  stage.name = "resume";
+  stage.stats.num_runs = 1;
+  stage.stats.elapsed = std::chrono::steady_clock::now() - start;
+  UpdatePeakMemory(dec_ctx.GetMemoryUsage(), stats.peak_memory);
+}
+
+// Calls `Stop` on the pass that is being watched once the deadline has passed
+// or the decompilation has been cancelled
+class Watchdog {
+  std::mutex mutex;
+  std::condition_variable cv;
+  rellic::ASTPass* pass{nullptr};
+  std::atomic_bool expired{false};
+  bool done{false};
+  std::thread thread;
+  std::optional<CancellationScope> cancellation;
+
+  // Must be called with `mutex` held
+  void Expire() {
+    expired = true;
+    if (pass) {
+      pass->Stop();
+    }
+  }
+
+ public:
+  Watchdog(std::chrono::steady_clock::time_point deadline,
+           const std::shared_ptr<rellic::DecompilationToken>& token) {
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+      thread = std::thread([this, deadline]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!cv.wait_until(lock, deadline, [this]() { return done; })) {
+          Expire();
+        }
+      });
+    }
+    cancellation.emplace(token, [this]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      Expire();
+    });
+  }
+
+  ~Watchdog() {
+    cancellation.reset();
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      done = true;
+    }
+    cv.notify_all();
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+
+  void Watch(rellic::ASTPass* new_pass) {
+    std::unique_lock<std::mutex> lock(mutex);
+    pass = new_pass;
+  }
+
+  bool Expired() const { return expired; }
+};
+
+struct Budget {
+  unsigned max_iterations{0};
+  size_t memory_limit{0};
+  std::unique_ptr<Watchdog> watchdog;
+  std::shared_ptr<rellic::DecompilationToken> token;
+};
+
+static Budget CreateBudget(const rellic::DecompilationOptions& options,
+                           std::chrono::steady_clock::time_point start,
+                           size_t num_definitions) {
+  Budget budget;
+  budget.max_iterations = options.max_fixpoint_iterations;
+  budget.memory_limit = options.memory_limit;
+  budget.token = options.token;
+
+  auto deadline{std::chrono::steady_clock::time_point::max()};
+  if (options.module_timeout.count()) {
+    deadline = start + options.module_timeout;
+  }
+  if (options.function_timeout.count()) {
+    auto timeout{std::chrono::steady_clock::duration(options.function_timeout) *
+                 static_cast<std::chrono::steady_clock::rep>(
+                     std::max<size_t>(num_definitions, 1))};
+    deadline = std::min(deadline, std::chrono::steady_clock::now() + timeout);
+  }
+  if (deadline != std::chrono::steady_clock::time_point::max() ||
+      options.token) {
+    budget.watchdog = std::make_unique<Watchdog>(deadline, options.token);
+  }
+  return budget;
+}
+
+// A stage of a pipeline description, see `DecompilationOptions::pipeline`
+struct StageSpec {
+  std::string name;
+  bool fixpoint{false};
+  // Each element is either a single pass or a group of passes to be fused
+  std::vector<std::vector<std::string>> passes;
+};
+
+struct PipelinePreset {
+  const char* name;
+  const char* description;
+};
+
+static const PipelinePreset pipeline_presets[]{
+    {"full",
+     "ast:dse,ldr,sfr;"
+     "cbr:fix(zcs,ncp,fuse(nsc,cbr,rbr));"
+     "loop:fix(lr,ncp,nsc);"
+     "scope:fix(zcs,ncp,nsc);"
+     "ec:mc,ec"},
+    // Skips the Z3 simplification of conditions and reachability-based
+    // refinement, which account for most of the decompilation time
+    {"fast",
+     "ast:dse,ldr,sfr;"
+     "cbr:fix(ncp,fuse(nsc,cbr));"
+     "loop:fix(lr,ncp,nsc);"
+     "ec:mc,ec"},
+};
+
+struct PassInfo {
+  const char* name;
+  // Whether the pass can be part of a `fuse` group
+  bool fusable;
+  // Whether the pass can be part of a fixpoint. Renaming passes only do
+  // something the first time they see a declaration, so they belong in a
+  // stage that runs once.
+  bool iterable;
+};
+
+static const PassInfo pass_infos[]{
+    {"dse", true, true},  {"ldr", false, false}, {"sfr", false, false},
+    {"zcs", false, true}, {"ncp", false, true},  {"nsc", true, true},
+    {"cbr", true, true},  {"rbr", true, true},   {"lr", true, true},
+    {"mc", false, true},  {"ec", true, true},
+};
+
+static const PassInfo* FindPass(llvm::StringRef name) {
+  for (auto& info : pass_infos) {
+    if (name == info.name) {
+      return &info;
+    }
+  }
+  return nullptr;
+}
+
+static std::vector<std::string> ParsePassGroup(llvm::StringRef text) {
+  std::vector<std::string> group;
+  bool fused{text.consume_front("fuse(")};
+  if (fused) {
+    CHECK_THROW(text.consume_back(")"))
+        << "Unterminated fuse group in pipeline: " << text.str();
+  }
+
+  llvm::SmallVector<llvm::StringRef, 4> names;
+  text.split(names, ',', /*MaxSplit=*/-1, /*KeepEmpty=*/true);
+  for (auto name : names) {
+    name = name.trim();
+    auto info{FindPass(name)};
+    CHECK_THROW(info) << "Unknown pass in pipeline: '" << name.str() << "'";
+    CHECK_THROW(!fused || info->fusable)
+        << "Pass '" << name.str() << "' cannot be fused";
+    group.push_back(name.str());
+  }
+  return group;
+}
+
+static std::vector<std::string> SplitTopLevel(llvm::StringRef text) {
+  std::vector<std::string> items;
+  unsigned depth{0};
+  size_t start{0};
+  for (size_t i{0}; i <= text.size(); ++i) {
+    if (i == text.size() || (text[i] == ',' && !depth)) {
+      items.push_back(text.slice(start, i).trim().str());
+      start = i + 1;
+    } else if (text[i] == '(') {
+      ++depth;
+    } else if (text[i] == ')') {
+      CHECK_THROW(depth) << "Unbalanced parentheses in pipeline";
+      --depth;
+    }
+  }
+  CHECK_THROW(!depth) << "Unbalanced parentheses in pipeline";
+  return items;
+}
+
+// Parses a pipeline description or the name of a preset
+static std::vector<StageSpec> ParsePipeline(llvm::StringRef text) {
+  text = text.trim();
+  if (text.empty()) {
+    text = "full";
+  }
+  for (auto& preset : pipeline_presets) {
+    if (text == preset.name) {
+      text = preset.description;
+      break;
+    }
+  }
+
+  std::vector<StageSpec> stages;
+  llvm::SmallVector<llvm::StringRef, 8> stage_texts;
+  text.split(stage_texts, ';', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  for (auto stage_text : stage_texts) {
+    stage_text = stage_text.trim();
+    if (stage_text.empty()) {
+      continue;
+    }
+
+    auto& stage{stages.emplace_back()};
+    if (stage_text.find(':') != llvm::StringRef::npos) {
+      auto [label, body] = stage_text.split(':');
+      stage.name = label.trim().str();
+      stage_text = body.trim();
+    }
+    if (stage.name.empty()) {
+      stage.name = "stage" + std::to_string(stages.size());
+    }
+
+    if (stage_text.consume_front("fix(")) {
+      CHECK_THROW(stage_text.consume_back(")"))
+          << "Unterminated fixpoint in pipeline stage " << stage.name;
+      stage.fixpoint = true;
+    }
+
+    for (auto& item : SplitTopLevel(stage_text)) {
+      auto& group{stage.passes.emplace_back(ParsePassGroup(item))};
+      for (auto& name : group) {
+        CHECK_THROW(!stage.fixpoint || FindPass(name)->iterable)
+            << "Pass '" << name << "' cannot be part of a fixpoint";
+      }
+    }
+  }
+  CHECK_THROW(!stages.empty()) << "Empty pipeline";
+  return stages;
+}
+
+template <typename TPass>
+static std::unique_ptr<rellic::ASTPass> WithVisitor(
+    std::unique_ptr<TPass> pass, rellic::NodeVisitor** visitor) {
+  *visitor = pass.get();
+  return pass;
+}
+
+// Creates a pass known to `FindPass`. `visitor` is set for fusable passes.
+static std::unique_ptr<rellic::ASTPass> CreatePass(
+    llvm::StringRef name, rellic::DecompilationContext& dec_ctx,
+    rellic::DebugInfoCollector& dic, rellic::NodeVisitor** visitor) {
+  *visitor = nullptr;
+  if (name == "dse") {
+    return WithVisitor(std::make_unique<rellic::DeadStmtElim>(dec_ctx),
+                       visitor);
+  } else if (name == "ldr") {
+    return std::make_unique<rellic::LocalDeclRenamer>(dec_ctx,
+                                                      dic.GetIRToNameMap());
+  } else if (name == "sfr") {
+    return std::make_unique<rellic::StructFieldRenamer>(
+        dec_ctx, dic.GetIRTypeToDITypeMap());
+  } else if (name == "zcs") {
+    return std::make_unique<rellic::Z3CondSimplify>(dec_ctx);
+  } else if (name == "ncp") {
+    return std::make_unique<rellic::NestedCondProp>(dec_ctx);
+  } else if (name == "nsc") {
+    return WithVisitor(std::make_unique<rellic::NestedScopeCombine>(dec_ctx),
+                       visitor);
+  } else if (name == "cbr") {
+    return WithVisitor(std::make_unique<rellic::CondBasedRefine>(dec_ctx),
+                       visitor);
+  } else if (name == "rbr") {
+    return WithVisitor(std::make_unique<rellic::ReachBasedRefine>(dec_ctx),
+                       visitor);
+  } else if (name == "lr") {
+    return WithVisitor(std::make_unique<rellic::LoopRefine>(dec_ctx),
+                       visitor);
+  } else if (name == "mc") {
+    return std::make_unique<rellic::MaterializeConds>(dec_ctx);
+  } else if (name == "ec") {
+    return WithVisitor(std::make_unique<rellic::ExprCombine>(dec_ctx),
+                       visitor);
+  }
+  THROW() << "Unknown pass " << name.str();
+  return nullptr;
+}
+
+// The refinement pipeline run after the initial AST has been generated. It
+// can either refine the whole translation unit at once, or be run repeatedly
+// on single function definitions.
+//
+// The stages before the first fixpoint are only run once, over the whole
+// translation unit, by `RunAST`. All others are run by `Refine`. Stages that
+// are not fixpoints are run once per call to `Refine`, and are also the ones
+// that `CombineDeclarations` runs.
+class Pipeline {
+  using FunctionSet = rellic::DecompilationContext::FunctionSet;
+
+  struct Stage {
+    std::string name;
+    bool fixpoint;
+    rellic::CompositeASTPass pass;
+    unsigned num_iterations{0};
+    bool truncated{false};
+
+    Stage(std::string name, bool fixpoint,
+          rellic::DecompilationContext& dec_ctx)
+        : name(std::move(name)), fixpoint(fixpoint), pass(dec_ctx) {}
+  };
+
+  rellic::DecompilationContext& dec_ctx;
+  Budget& budget;
+  std::vector<std::unique_ptr<Stage>> stages;
+  // Definitions of `DecompilationContext::straight_line_functions`, which
+  // fixpoint stages skip
+  FunctionSet straight_line_definitions;
+  // Number of leading stages run by `RunAST`
+  size_t num_ast_stages{0};
+  rellic::MemoryUsage peak_memory;
+  // Size of `z3_exprs` after the last compaction
+  unsigned num_live_exprs{0};
+  // Size of `stmt_provenance` after it was last pruned
+  size_t num_live_provenance{0};
+
+  bool Expired() const {
+    return budget.watchdog && budget.watchdog->Expired();
+  }
+
+  // Measures the memory in use, returning whether it is over the limit
+  bool OverMemoryLimit() {
+    auto usage{dec_ctx.GetMemoryUsage()};
+    UpdatePeakMemory(usage, peak_memory);
+    return budget.memory_limit && usage.Total() > budget.memory_limit;
+  }
+
+  // Refinement passes replace conditions rather than updating them, so most of
+  // `z3_exprs` is garbage after a few iterations. Compacting whenever the table
+  // has doubled keeps its size proportional to the live conditions, at an
+  // amortized cost of one AST traversal per doubling.
+  void MaybeCompactZExprs() {
+    if (dec_ctx.z3_exprs.size() <= 2 * std::max(num_live_exprs, 1024U)) {
+      return;
+    }
+    dec_ctx.CompactZExprs();
+    num_live_exprs = dec_ctx.z3_exprs.size();
+  }
+
+  // Replaced statements keep their provenance, so it is pruned the same way
+  void MaybePruneProvenance() {
+    auto size{dec_ctx.stmt_provenance.size() + dec_ctx.use_provenance.size()};
+    if (size <= 2 * std::max<size_t>(num_live_provenance, 4096)) {
+      return;
+    }
+    dec_ctx.PruneProvenance();
+    num_live_provenance =
+        dec_ctx.stmt_provenance.size() + dec_ctx.use_provenance.size();
+  }
+
+  // The definitions of `functions`, or of the whole translation unit if not
+  // set, that are not straight-line
+  FunctionSet GetRefinedDefinitions(
+      const std::optional<FunctionSet>& functions) const {
+    FunctionSet result;
+    auto Add = [&](clang::FunctionDecl* fdefn) {
+      if (!straight_line_definitions.count(fdefn)) {
+        result.insert(fdefn);
+      }
+    };
+    if (functions) {
+      for (auto fdefn : *functions) {
+        Add(fdefn);
+      }
+    } else {
+      auto tudecl{dec_ctx.ast_ctx.getTranslationUnitDecl()};
+      for (auto decl : tudecl->decls()) {
+        auto fdefn{clang::dyn_cast<clang::FunctionDecl>(decl)};
+        if (fdefn && fdefn->doesThisDeclarationHaveABody()) {
+          Add(fdefn);
+        }
+      }
+    }
+    return result;
+  }
+
+  // Iterates `fixpoint` until it converges or the budget runs out, in which
+  // case the stage is marked as truncated and false is returned
+  bool RunFixpoint(Stage& fixpoint,
+                   const std::optional<FunctionSet>& functions) {
+    auto& pass{fixpoint.pass};
+    llvm::TimeTraceScope trace("Stage", fixpoint.name);
+    if (budget.watchdog) {
+      budget.watchdog->Watch(&pass);
+    }
+    pass.SkipConvergedFunctions(true);
+    dec_ctx.dirty_functions = functions;
+    if (!straight_line_definitions.empty()) {
+      dec_ctx.dirty_functions = GetRefinedDefinitions(functions);
+    }
+    unsigned iterations{0};
+    bool truncated{false};
+    while (true) {
+      MaybeCompactZExprs();
+      MaybePruneProvenance();
+      if (Expired() || OverMemoryLimit() ||
+          (budget.max_iterations && iterations >= budget.max_iterations)) {
+        truncated = true;
+        break;
+      }
+
+      ReportProgress(budget.token, fixpoint.name, iterations);
+      llvm::TimeTraceScope iteration_trace("Iteration", [&]() {
+        return fixpoint.name + " #" + std::to_string(iterations);
+      });
+      if (!pass.Run()) {
+        // A pass that has been stopped may have returned early without
+        // reporting any change
+        truncated = Expired();
+        break;
+      }
+      ++iterations;
+    }
+    fixpoint.num_iterations += iterations;
+    fixpoint.truncated |= truncated;
+    pass.SkipConvergedFunctions(false);
+    if (budget.watchdog) {
+      budget.watchdog->Watch(nullptr);
+    }
+    return !truncated;
+  }
+
+ public:
+  Pipeline(rellic::DecompilationContext& dec_ctx,
+           rellic::DebugInfoCollector& dic, Budget& budget,
+           const std::vector<StageSpec>& specs)
+      : dec_ctx(dec_ctx), budget(budget) {
+    for (auto func : dec_ctx.straight_line_functions) {
+      straight_line_definitions.insert(
+          clang::cast<clang::FunctionDecl>(dec_ctx.value_decls[func]));
+    }
+    for (auto& spec : specs) {
+      auto& stage{*stages.emplace_back(
+          std::make_unique<Stage>(spec.name, spec.fixpoint, dec_ctx))};
+      if (!spec.fixpoint && num_ast_stages + 1 == stages.size()) {
+        ++num_ast_stages;
+      }
+
+      auto& passes{stage.pass.GetPasses()};
+      for (auto& group : spec.passes) {
+        rellic::NodeVisitor* visitor;
+        if (group.size() == 1) {
+          passes.push_back(CreatePass(group[0], dec_ctx, dic, &visitor));
+          continue;
+        }
+
+        // These only look at a node and its children, so they can share a
+        // single traversal of each definition
+        auto fused{std::make_unique<rellic::FusedASTPass>(dec_ctx)};
+        for (auto& name : group) {
+          auto pass{CreatePass(name, dec_ctx, dic, &visitor)};
+          fused->AddPass(std::move(pass), visitor);
+        }
+        passes.push_back(std::move(fused));
+      }
+    }
+  }
+
+  // Runs the stages that precede the first fixpoint, like dead statement
+  // elimination and renaming, over the whole translation unit
+  void RunAST() {
+    for (size_t i{0}; i < num_ast_stages; ++i) {
+      llvm::TimeTraceScope trace("Stage", stages[i]->name);
+      ReportProgress(budget.token, stages[i]->name);
+      stages[i]->pass.Run();
+    }
+  }
+
+  // Refines `functions`, or the whole translation unit if not set. Returns
+  // false if the budget ran out before refinement was complete.
+  bool Refine(const std::optional<FunctionSet>& functions = std::nullopt) {
+    bool complete{true};
+    for (size_t i{num_ast_stages}; i < stages.size(); ++i) {
+      auto& stage{*stages[i]};
+      if (stage.fixpoint) {
+        complete &= RunFixpoint(stage, functions);
+        continue;
+      }
+      llvm::TimeTraceScope trace("Stage", stage.name);
+      ReportProgress(budget.token, stage.name);
+      if (functions) {
+        // Only visit the definitions, top-level declarations are handled by
+        // `CombineDeclarations`
+        stage.pass.SkipConvergedFunctions(true);
+        dec_ctx.dirty_functions = functions;
+        stage.pass.Run();
+        stage.pass.SkipConvergedFunctions(false);
+      } else {
+        stage.pass.Run();
+      }
+    }
+    return complete;
+  }
+
+  // Simplifies the expressions in top-level declarations, like global variable
+  // initializers, without touching any function definition
+  void CombineDeclarations() {
+    llvm::TimeTraceScope trace("CombineDeclarations");
+    for (size_t i{num_ast_stages}; i < stages.size(); ++i) {
+      if (!stages[i]->fixpoint) {
+        dec_ctx.dirty_functions = FunctionSet{};
+        stages[i]->pass.Run();
+      }
+    }
+    dec_ctx.dirty_functions.reset();
+  }
+
+  // Clears the state left behind by a refinement that was interrupted by an
+  // exception
+  void Reset() {
+    for (auto& stage : stages) {
+      stage->pass.SkipConvergedFunctions(false);
+    }
+    if (budget.watchdog) {
+      budget.watchdog->Watch(nullptr);
+    }
+    dec_ctx.track_function_changes = false;
+    dec_ctx.dirty_functions.reset();
+  }
+
+  void Record(rellic::PassStatistics& stats) {
+    for (auto& stage : stages) {
+      auto num_iterations{stage->fixpoint
+                              ? stage->num_iterations
+                              : stage->pass.GetStatistics().num_runs};
+      RecordStage(stage->name.c_str(), stage->pass, num_iterations, stats);
+      stats.stages.back().truncated = stage->truncated;
+    }
+    UpdatePeakMemory(dec_ctx.GetMemoryUsage(), peak_memory);
+    UpdatePeakMemory(peak_memory, stats.peak_memory);
+    stats.prover = dec_ctx.prover.GetStatistics();
+    stats.rules = dec_ctx.rule_stats;
+  }
+};
+
+// Runs `pipeline` on all function definitions except large ones, which are
+// refined with `large_pipeline`, see
+// `DecompilationOptions::large_function_limits`
+class Refinement {
+  using FunctionSet = rellic::DecompilationContext::FunctionSet;
+
+  rellic::DecompilationContext& dec_ctx;
+  Pipeline pipeline;
+  std::optional<Pipeline> large_pipeline;
+  FunctionSet large_definitions;
+
+ public:
+  Refinement(rellic::DecompilationContext& dec_ctx,
+             rellic::DebugInfoCollector& dic, Budget& budget,
+             const rellic::DecompilationOptions& options)
+      : dec_ctx(dec_ctx),
+        pipeline(dec_ctx, dic, budget, ParsePipeline(options.pipeline)) {
+    for (auto func : dec_ctx.large_functions) {
+      large_definitions.insert(
+          clang::cast<clang::FunctionDecl>(dec_ctx.value_decls[func]));
+    }
+
+    if (!large_definitions.empty()) {
+      large_pipeline.emplace(dec_ctx, dic, budget,
+                             ParsePipeline(options.large_function_pipeline));
+    }
+  }
+
+  void RunAST() { pipeline.RunAST(); }
+
+  // Refines `functions`, or the whole translation unit if not set. Returns
+  // false if the budget ran out before refinement was complete.
+  bool Refine(const std::optional<FunctionSet>& functions = std::nullopt) {
+    if (!large_pipeline) {
+      return pipeline.Refine(functions);
+    }
+
+    FunctionSet small, large;
+    auto Classify = [&](clang::FunctionDecl* fdefn) {
+      (large_definitions.count(fdefn) ? large : small).insert(fdefn);
+    };
+    if (functions) {
+      for (auto fdefn : *functions) {
+        Classify(fdefn);
+      }
+    } else {
+      auto tudecl{dec_ctx.ast_ctx.getTranslationUnitDecl()};
+      for (auto decl : tudecl->decls()) {
+        auto fdefn{clang::dyn_cast<clang::FunctionDecl>(decl)};
+        if (fdefn && fdefn->doesThisDeclarationHaveABody()) {
+          Classify(fdefn);
+        }
+      }
+    }
+
+    bool complete{true};
+    if (!small.empty()) {
+      complete &= pipeline.Refine(small);
+    }
+    if (!large.empty()) {
+      complete &= large_pipeline->Refine(large);
+    }
+    if (!functions) {
+      pipeline.CombineDeclarations();
+    }
+    return complete;
+  }
+
+  void CombineDeclarations() { pipeline.CombineDeclarations(); }
+
+  void Reset() {
+    pipeline.Reset();
+    if (large_pipeline) {
+      large_pipeline->Reset();
+    }
+  }
+
+  void Record(rellic::PassStatistics& stats) {
+    pipeline.Record(stats);
+    if (large_pipeline) {
+      auto num_stages{stats.stages.size()};
+      large_pipeline->Record(stats);
+      for (auto i{num_stages}; i < stats.stages.size(); ++i) {
+        stats.stages[i].name = "large:" + stats.stages[i].name;
+      }
+    }
+  }
+};
+
+// Refines the definition of `func` on its own. If that fails, the definition
+// is dropped and only the prototype of `func` remains. Returns whether `func`
+// still has a definition, and whether its refinement was complete.
+static std::pair<bool, bool> RefineDefinition(
+    Refinement& pipeline, llvm::Function& func,
+    rellic::DecompilationContext& dec_ctx) {
+  auto fdefn{clang::cast<clang::FunctionDecl>(dec_ctx.value_decls[&func])};
+  rellic::DecompilationContext::FunctionSet functions{fdefn};
+  try {
+    return {true, pipeline.Refine(functions)};
+  } catch (rellic::Exception& ex) {
+    pipeline.Reset();
+    dec_ctx.DropDefinition(func, ex.what());
+  } catch (z3::exception& ex) {
+    pipeline.Reset();
+    dec_ctx.DropDefinition(func, ex.msg());
+  }
+  return {false, false};
+}
+
+// Refines the whole translation unit generated from `module`. If refinement
+// fails, the definitions are refined again one at a time, so that only the
+// ones that fail on their own are dropped.
+static void RefineModule(Refinement& pipeline, llvm::Module& module,
+                         rellic::DecompilationContext& dec_ctx) {
+  try {
+    pipeline.Refine();
+    return;
+  } catch (rellic::Exception& ex) {
+    LOG(WARNING) << "Refinement failed, retrying one function at a time: "
+                 << ex.what();
+  } catch (z3::exception& ex) {
+    LOG(WARNING) << "Refinement failed, retrying one function at a time: "
+                 << ex.msg();
+  }
+
+  pipeline.Reset();
+  for (auto& func : module.functions()) {
+    if (!func.isDeclaration() && !dec_ctx.prototype_only.count(&func)) {
+      RefineDefinition(pipeline, func, dec_ctx);
+    }
+  }
+  pipeline.CombineDeclarations();
+}
+
+// Lists the function definitions of `module` that could not be decompiled
+static void CollectFunctionErrors(llvm::Module& module,
+                                  rellic::DecompilationContext& dec_ctx,
+                                  rellic::DecompilationResult& result) {
+  for (auto& func : module.functions()) {
+    auto it{dec_ctx.function_errors.find(&func)};
+    if (it != dec_ctx.function_errors.end()) {
+      result.function_errors.push_back({&func, func.getName().str(),
+                                        it->second});
+    }
+  }
+}
+
+// Prints a top-level declaration the same way it would be printed as part of
+// its translation unit
+static void PrintTopLevelDecl(rellic::CPrinter& printer, clang::Decl* decl,
+                              llvm::raw_ostream& os) {
+  auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+  printer.PrintDecl(decl);
+  printer.Flush();
+  if (!fdecl || !fdecl->doesThisDeclarationHaveABody()) {
+    os << ';';
+  }
+  os << '\n';
+}
+
+static rellic::CPrinterOptions GetPrinterOptions(
+    const rellic::DecompilationOptions& options) {
+  rellic::CPrinterOptions printer_options;
+  if (auto threshold = options.hex_literals_from) {
+    printer_options.hex_literals = [threshold](const llvm::APInt& value) {
+      return value.uge(*threshold);
+    };
+  }
+  return printer_options;
+}
+
+// Passes every top-level declaration that is not a function definition to the
+// `on_declarations` callback, except the prototypes of the definitions of
+// other shards
+static void StreamDeclarations(llvm::Module& module,
+                               rellic::DecompilationContext& dec_ctx,
+                               const rellic::DecompilationOptions& options) {
+  std::unordered_set<clang::Decl*> other_shards;
+  unsigned idx{0};
+  for (auto& func : module.functions()) {
+    if (!func.isDeclaration() &&
+        idx++ % options.num_shards != options.shard_index) {
+      other_shards.insert(dec_ctx.value_decls[&func]);
+    }
+  }
+
+  auto& ast_ctx{dec_ctx.ast_ctx};
+  std::string code;
+  llvm::raw_string_ostream os(code);
+  rellic::CPrinter printer(os, ast_ctx, GetPrinterOptions(options));
+  for (auto decl : ast_ctx.getTranslationUnitDecl()->decls()) {
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    if (decl->isImplicit() ||
+        (fdecl && fdecl->doesThisDeclarationHaveABody()) ||
+        other_shards.count(decl)) {
+      continue;
+    }
+    PrintTopLevelDecl(printer, decl, os);
+  }
+  if (options.on_declarations) {
+    options.on_declarations(os.str());
+  }
+}
+
+static std::string StreamDefinition(
+    llvm::Function& func, clang::FunctionDecl* fdefn,
+    const rellic::DecompilationOptions& options) {
+  std::string code;
+  llvm::raw_string_ostream os(code);
+  rellic::CPrinter printer(os, fdefn->getASTContext(),
+                          GetPrinterOptions(options));
+  PrintTopLevelDecl(printer, fdefn, os);
+  if (options.on_definition) {
+    options.on_definition(func, os.str());
+  }
+  return os.str();
+}
+
+// The definitions of a module that have been found in the decompilation
+// cache, and the keys under which the others are stored once decompiled
+struct CachedDefinitions {
+  std::optional<rellic::DecompilationCache> cache;
+  rellic::DecompilationCache::KeyMap keys;
+  std::unordered_map<llvm::Function*, std::string> hits;
+
+  // Passes the cached definition of `func` to the `on_definition` callback, if
+  // there is one
+  bool Stream(llvm::Function& func,
+              const rellic::DecompilationOptions& options) const {
+    auto it{hits.find(&func)};
+    if (it == hits.end()) {
+      return false;
+    }
+    if (options.on_definition) {
+      options.on_definition(func, it->second);
+    }
+    return true;
+  }
+
+  void Store(llvm::Function& func, llvm::StringRef code) const {
+    if (cache) {
+      cache->Store(keys.at(&func), code);
+    }
+  }
+};
+
+// Looks up the definitions of `module` in the cache. Definitions that are
+// found are only declared by GenerateAST. The struct types of `module` must
+// already be declared in `dec_ctx`.
+static CachedDefinitions LookupCache(
+    llvm::Module& module, rellic::DecompilationContext& dec_ctx,
+    rellic::DebugInfoCollector& dic,
+    const rellic::DecompilationOptions& options) {
+  CachedDefinitions cached;
+  if ((options.cache_directory.empty() && !options.definition_cache) ||
+      !options.IsStreaming()) {
+    return cached;
+  }
+
+  std::string salt;
+  llvm::raw_string_ostream os(salt);
+  os << "rellic " << rellic::Version::GetCommitHash()
+     << " llvm " << LLVM_VERSION_MAJOR << '.' << LLVM_VERSION_MINOR
+     << " lower_switches " << options.lower_switches
+     << " remove_phi_nodes " << options.remove_phi_nodes
+     << " pre_opt " << options.pre_opt
+     << " coalesce_phi_nodes " << options.coalesce_phi_nodes
+     << " max_fixpoint_iterations " << options.max_fixpoint_iterations
+     << " pipeline " << options.pipeline << " large_function_limits "
+     << options.large_function_limits.blocks << ','
+     << options.large_function_limits.edges << ','
+     << options.large_function_limits.loop_depth << ','
+     << options.large_function_limits.switch_cases
+     << " large_function_pipeline " << options.large_function_pipeline
+     << " blob_initializer_size " << options.blob_initializer_size
+     << " cond_var_size " << options.cond_var_size
+     << " reach_var_size " << options.reach_var_size
+     << " region_unit_size " << options.region_unit_size
+     << " structuring " << static_cast<int>(options.structuring)
+     << " goto_cond_size " << options.goto_cond_size << " goto_timeout "
+     << options.goto_timeout.count() << " hex_literals_from "
+     << (options.hex_literals_from ? std::to_string(*options.hex_literals_from)
+                                   : "none");
+
+  if (options.definition_cache) {
+    cached.cache = *options.definition_cache;
+  } else {
+    cached.cache.emplace(options.cache_directory);
+  }
+  cached.keys = rellic::DecompilationCache::GetKeys(module, dec_ctx, dic,
+                                                    os.str());
+  for (auto& [func, key] : cached.keys) {
+    auto code{cached.cache->Load(key)};
+    if (code) {
+      cached.hits[func] = std::move(*code);
+      dec_ctx.prototype_only.insert(func);
+    }
+  }
+  RELLIC_EVENT(dec_ctx.events, rellic::EventLevel::Info, "cache")
+      << "Found " << cached.hits.size() << " of " << cached.keys.size()
+      << " definitions in the decompilation cache";
+  return cached;
+}
+
+// Creates the C declarations of all the structure types used in `module` in a
+// fixed order, so that every shard of the same module agrees on their names.
+static void DeclareStructTypes(llvm::Module& module,
+                               rellic::DecompilationContext& dec_ctx) {
+  llvm::TypeFinder types;
+  types.run(module, /*onlyNamed=*/false);
+  for (auto type : types) {
+    dec_ctx.GetQualType(type);
+  }
+}
+
+// Whether `func` is one of the functions requested in `options.functions`
+static bool IsRequested(llvm::Function& func,
+                        const rellic::DecompilationOptions& options) {
+  if (options.functions.count(func.getName().str())) {
+    return true;
+  }
+
+  auto pc{rellic::GetPCMetadata(&func)};
+  if (!pc) {
+    return false;
+  }
+
+  for (auto& name : options.functions) {
+    llvm::APInt addr;
+    if (!llvm::StringRef(name).getAsInteger(0, addr) &&
+        addr.zextOrTrunc(pc->getBitWidth()) == *pc) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Marks every definition that has not been requested in `options.functions`,
+// nor is called by one that has, or that belongs to another shard as only
+// needing a prototype
+static void SelectFunctions(llvm::Module& module,
+                            rellic::DecompilationContext& dec_ctx,
+                            const rellic::DecompilationOptions& options) {
+  unsigned idx{0};
+  for (auto& func : module.functions()) {
+    if (!func.isDeclaration() &&
+        idx++ % options.num_shards != options.shard_index) {
+      dec_ctx.prototype_only.insert(&func);
+    }
+  }
+
+  if (options.functions.empty()) {
+    return;
+  }
+
+  std::unordered_set<llvm::Function*> selected;
+  std::vector<llvm::Function*> worklist;
+  for (auto& func : module.functions()) {
+    if (!func.isDeclaration() && IsRequested(func, options)) {
+      selected.insert(&func);
+      worklist.push_back(&func);
+    }
+  }
+
+  while (options.include_callees && !worklist.empty()) {
+    auto func{worklist.back()};
+    worklist.pop_back();
+    for (auto& inst : llvm::instructions(*func)) {
+      auto call{llvm::dyn_cast<llvm::CallBase>(&inst)};
+      auto callee{call ? call->getCalledFunction() : nullptr};
+      if (callee && !callee->isDeclaration() &&
+          selected.insert(callee).second) {
+        worklist.push_back(callee);
+      }
+    }
+  }
+
+  for (auto& func : module.functions()) {
+    if (!func.isDeclaration() && !selected.count(&func)) {
+      dec_ctx.prototype_only.insert(&func);
+    }
+  }
+}
+
+// Definitions of a module that are structurally identical to an earlier one,
+// their representative, and whose body is copied from it instead of being
+// decompiled again
+struct DuplicateDefinitions {
+  std::unordered_map<llvm::Function*, llvm::Function*> representatives;
+
+  bool Contains(llvm::Function& func) const {
+    return representatives.count(&func);
+  }
+};
+
+// Pairs the arguments, blocks and instructions of `from` and `to`, which
+// `llvm::FunctionComparator` found equal. The comparator walks the control
+// flow graph from the entry block rather than the block list, and so does
+// this. Returns false if some block was not reached, and thus not compared.
+static bool PairValues(llvm::Function& from, llvm::Function& to,
+                       std::unordered_map<llvm::Value*, llvm::Value*>& values) {
+  if (from.size() != to.size()) {
+    return false;
+  }
+
+  values[&from] = &to;
+  for (auto [from_arg, to_arg] : llvm::zip(from.args(), to.args())) {
+    values[&from_arg] = &to_arg;
+  }
+
+  size_t num_blocks{0};
+  std::vector<std::pair<llvm::BasicBlock*, llvm::BasicBlock*>> worklist{
+      {&from.getEntryBlock(), &to.getEntryBlock()}};
+  while (!worklist.empty()) {
+    auto [from_bb, to_bb] = worklist.back();
+    worklist.pop_back();
+    if (!values.emplace(from_bb, to_bb).second) {
+      continue;
+    }
+
+    ++num_blocks;
+    for (auto [from_inst, to_inst] : llvm::zip(*from_bb, *to_bb)) {
+      values[&from_inst] = &to_inst;
+    }
+    auto from_term{from_bb->getTerminator()};
+    auto to_term{to_bb->getTerminator()};
+    for (unsigned i{0}; i < from_term->getNumSuccessors(); ++i) {
+      worklist.emplace_back(from_term->getSuccessor(i),
+                            to_term->getSuccessor(i));
+    }
+  }
+  return num_blocks == from.size();
+}
+
+// Groups the definitions that GenerateAST would structure into classes of
+// structurally identical ones, using the same hash and comparison as LLVM's
+// MergeFunctions pass. All but the first definition of each class are marked
+// as only needing a prototype. Definitions with debug information are left
+// alone, since their variables are named and typed after it.
+static DuplicateDefinitions FindDuplicateDefinitions(
+    llvm::Module& module, rellic::DecompilationContext& dec_ctx,
+    const rellic::DecompilationOptions& options) {
+  DuplicateDefinitions dups;
+  if (!options.deduplicate_functions) {
+    return dups;
+  }
+
+  llvm::GlobalNumberState numbers;
+  std::unordered_map<llvm::FunctionComparator::FunctionHash,
+                     std::vector<llvm::Function*>>
+      classes;
+  std::unordered_map<llvm::Value*, llvm::Value*> values;
+  for (auto& func : module.functions()) {
+    if (func.isDeclaration() || dec_ctx.prototype_only.count(&func) ||
+        func.getSubprogram()) {
+      continue;
+    }
+
+    auto& reps{classes[llvm::FunctionComparator::functionHash(func)]};
+    auto rep{llvm::find_if(reps, [&](llvm::Function* candidate) {
+      values.clear();
+      return llvm::FunctionComparator(candidate, &func, &numbers).compare() ==
+                 0 &&
+             PairValues(*candidate, func, values);
+    })};
+    if (rep == reps.end()) {
+      reps.push_back(&func);
+      continue;
+    }
+
+    dups.representatives[&func] = *rep;
+    dec_ctx.prototype_only.insert(&func);
+  }
+  RELLIC_EVENT(dec_ctx.events, rellic::EventLevel::Info, "deduplicate")
+      << "Found " << dups.representatives.size() << " duplicate definitions";
+  return dups;
+}
+
+// Gives the duplicate `func` a copy of the refined definition of its
+// representative, along with the provenance of its statements. Returns whether
+// `func` has a definition afterwards.
+static bool CloneDuplicate(llvm::Function& func,
+                           const DuplicateDefinitions& dups,
+                           clang::ASTUnit& ast_unit,
+                           rellic::DecompilationContext& dec_ctx) {
+  auto rep{dups.representatives.at(&func)};
+  auto from{clang::dyn_cast_or_null<clang::FunctionDecl>(
+      dec_ctx.value_decls.lookup(rep))};
+  if (!from || !from->doesThisDeclarationHaveABody()) {
+    dec_ctx.DropDefinition(func, "Identical to " + rep->getName().str() +
+                                     ", which could not be decompiled");
+    return false;
+  }
+
+  std::unordered_map<llvm::Value*, llvm::Value*> values;
+  PairValues(*rep, func, values);
+  std::unordered_map<clang::Decl*, clang::Decl*> decls;
+  for (auto [from_value, to_value] : values) {
+    auto from_decl{dec_ctx.value_decls.lookup(from_value)};
+    auto to_decl{dec_ctx.value_decls.lookup(to_value)};
+    if (from_decl && to_decl && llvm::isa<llvm::Instruction>(from_value)) {
+      // Refinement may have renamed the variables of the representative
+      to_decl->setDeclName(from_decl->getDeclName());
+      decls[from_decl] = to_decl;
+    }
+  }
+
+  auto fdecl{clang::cast<clang::FunctionDecl>(dec_ctx.value_decls[&func])};
+  auto tudecl{dec_ctx.ast_ctx.getTranslationUnitDecl()};
+  auto fdefn{dec_ctx.ast.CreateFunctionDecl(tudecl, fdecl->getType(),
+                                            fdecl->getIdentifier())};
+  fdefn->setPreviousDecl(fdecl);
+  fdefn->setParams(fdecl->parameters());
+  std::unordered_map<clang::Stmt*, clang::Stmt*> clones;
+  try {
+    rellic::CloneBody(ast_unit, from, fdefn, decls, clones);
+  } catch (rellic::Exception& ex) {
+    dec_ctx.DropDefinition(func, ex.what());
+    return false;
+  }
+  tudecl->addDecl(fdefn);
+  dec_ctx.value_decls[&func] = fdefn;
+  dec_ctx.prototype_only.erase(&func);
+
+  for (auto [from_stmt, to_stmt] : clones) {
+    auto value{dec_ctx.stmt_provenance.lookup(from_stmt)};
+    if (value) {
+      auto it{values.find(value)};
+      dec_ctx.stmt_provenance[to_stmt] =
+          it == values.end() ? value : it->second;
+    }
+
+    auto expr{clang::dyn_cast<clang::Expr>(from_stmt)};
+    auto use{expr ? dec_ctx.use_provenance.lookup(expr) : nullptr};
+    auto user{use ? values.find(use->getUser()) : values.end()};
+    if (user != values.end()) {
+      auto to_use{&llvm::cast<llvm::User>(user->second)
+                       ->getOperandUse(use->getOperandNo())};
+      dec_ctx.use_provenance[clang::cast<clang::Expr>(to_stmt)] = to_use;
+    }
+  }
+  return true;
+}
+
+// Copies the definitions of all the duplicates in `module`, in module order
+static void CloneDuplicates(llvm::Module& module,
+                            const DuplicateDefinitions& dups,
+                            clang::ASTUnit& ast_unit,
+                            rellic::DecompilationContext& dec_ctx) {
+  for (auto& func : module.functions()) {
+    if (dups.Contains(func)) {
+      CloneDuplicate(func, dups, ast_unit, dec_ctx);
+    }
+  }
 }
-}  // namespace
 
-template <typename TKey, typename TValue>
-static void CopyMap(const std::unordered_map<TKey*, TValue*>& from,
-                    std::unordered_map<const TKey*, const TValue*>& to,
-                    std::unordered_map<const TValue*, const TKey*>& inverse) {
-  for (auto [key, value] : from) {
-    if (value) {
-      to[key] = value;
-      inverse[value] = key;
+static void Materialize(llvm::GlobalValue& value) {
+  auto err{value.materialize()};
+  CHECK_THROW(!err) << "Cannot materialize " << value.getName().str() << ": "
+                    << llvm::toString(std::move(err));
+}
+
+// Materializes the bodies of a lazily loaded module that decompilation reads.
+// When only some functions are requested, the bodies of the others are never
+// loaded, and they are declared from their signature alone.
+static void MaterializeFunctions(llvm::Module& module,
+                                 const rellic::DecompilationOptions& options) {
+  if (module.isMaterialized()) {
+    return;
+  }
+
+  auto materialize_all = [&]() {
+    auto err{module.materializeAll()};
+    CHECK_THROW(!err) << "Cannot materialize module: "
+                      << llvm::toString(std::move(err));
+  };
+
+  // Shards are given a serialized copy of the whole module
+  if (options.functions.empty() || options.num_threads > 1) {
+    materialize_all();
+    return;
+  }
+
+  std::unordered_set<llvm::Function*> visited;
+  std::vector<llvm::Function*> worklist;
+  for (auto& name : options.functions) {
+    auto func{module.getFunction(name)};
+    if (func) {
+      if (visited.insert(func).second) {
+        worklist.push_back(func);
+      }
+      continue;
+    }
+
+    // Functions requested by address can only be found through the `pc`
+    // metadata of their bodies
+    llvm::APInt addr;
+    if (!llvm::StringRef(name).getAsInteger(0, addr)) {
+      materialize_all();
+      return;
+    }
+  }
+
+  while (!worklist.empty()) {
+    auto func{worklist.back()};
+    worklist.pop_back();
+    Materialize(*func);
+    if (!options.include_callees) {
+      continue;
+    }
+
+    for (auto& inst : llvm::instructions(*func)) {
+      auto call{llvm::dyn_cast<llvm::CallBase>(&inst)};
+      auto callee{call ? call->getCalledFunction() : nullptr};
+      if (callee && visited.insert(callee).second) {
+        worklist.push_back(callee);
+      }
+    }
+  }
+
+  // Definitions with array arguments or return values are cloned by
+  // `ConvertArrayArguments`
+  for (auto& func : module.functions()) {
+    auto type{func.getFunctionType()};
+    auto has_arrays{type->getReturnType()->isArrayTy() ||
+                    llvm::any_of(type->params(), [](llvm::Type* param) {
+                      return param->isArrayTy();
+                    })};
+    if (has_arrays) {
+      Materialize(func);
     }
   }
+
+  auto err{module.materializeMetadata()};
+  CHECK_THROW(!err) << "Cannot materialize module metadata: "
+                    << llvm::toString(std::move(err));
 }
 
-namespace rellic {
-Result<DecompilationResult, DecompilationError> Decompile(
-    std::unique_ptr<llvm::Module> module, DecompilationOptions options) {
+// Provides empty translation units for a given target triple
+using ASTUnitFactory =
+    std::function<std::unique_ptr<clang::ASTUnit>(const std::string&)>;
+
+// A shard owns a subset of the function definitions of a module. It works on
+// its own copy of the module, deserialized into its own `llvm::LLVMContext`,
+// and has its own `clang::ASTUnit` and `DecompilationContext`, so that shards
+// can be decompiled on different threads without sharing any state.
+struct DecompilationShard {
+  std::vector<unsigned> functions;
+  std::unique_ptr<llvm::LLVMContext> llvm_ctx;
+  std::unique_ptr<llvm::Module> module;
+  std::unique_ptr<clang::ASTUnit> ast_unit;
+  std::unique_ptr<rellic::DecompilationContext> dec_ctx;
+  std::unique_ptr<rellic::DebugInfoCollector> dic;
+  rellic::PassStatistics stats;
+  std::string error;
+};
+
+static void DecompileShard(
+    DecompilationShard& shard, llvm::StringRef bitcode,
+    const rellic::DecompilationOptions& options,
+    const ASTUnitFactory& create_ast_unit,
+    const std::shared_ptr<rellic::Z3ContextPool>& z3_pool,
+    std::chrono::steady_clock::time_point start) {
+  llvm::TimeTraceScope trace("DecompileShard");
   try {
-    if (options.remove_phi_nodes) {
-      RemovePHINodes(*module);
+    shard.llvm_ctx = std::make_unique<llvm::LLVMContext>();
+    auto buffer{llvm::MemoryBufferRef(bitcode, "shard")};
+    auto module{llvm::parseBitcodeFile(buffer, *shard.llvm_ctx)};
+    CHECK_THROW(!!module) << "Cannot deserialize shard module: "
+                          << llvm::toString(module.takeError());
+    shard.module = std::move(*module);
+
+    // Debug info is collected before bodies are dropped so that every shard
+    // names struct fields the same way
+    shard.dic = std::make_unique<rellic::DebugInfoCollector>();
+    shard.dic->visit(*shard.module);
+
+    shard.ast_unit = create_ast_unit(shard.module->getTargetTriple());
+    shard.dec_ctx = std::make_unique<rellic::DecompilationContext>(
+        *shard.ast_unit, z3_pool);
+    ConfigureContext(*shard.module, *shard.dec_ctx, options);
+    DeclareStructTypes(*shard.module, *shard.dec_ctx);
+
+    std::unordered_set<unsigned> owned(shard.functions.begin(),
+                                       shard.functions.end());
+    unsigned idx{0};
+    for (auto& func : shard.module->functions()) {
+      if (!owned.count(idx++) && !func.isDeclaration()) {
+        func.deleteBody();
+      }
+    }
+
+    BuildAST(*shard.module, *shard.dec_ctx, shard.stats, options.token);
+    auto budget{CreateBudget(options, start, shard.functions.size())};
+    Refinement pipeline(*shard.dec_ctx, *shard.dic, budget, options);
+    pipeline.RunAST();
+    RefineModule(pipeline, *shard.module, *shard.dec_ctx);
+    CheckCancelled(options.token);
+    pipeline.Record(shard.stats);
+    shard.dec_ctx->ReleaseSolverState();
+  } catch (rellic::Exception& ex) {
+    shard.error = ex.what();
+  } catch (z3::exception& ex) {
+    shard.error = ex.msg();
+  }
+}
+
+// The shard module is deserialized from the bitcode of `to`, so their
+// functions, arguments, blocks, instructions and globals line up one to one.
+static void MapShardValues(
+    llvm::Module& from, llvm::Module& to,
+    std::unordered_map<llvm::Value*, llvm::Value*>& values) {
+  for (auto [from_var, to_var] : llvm::zip(from.globals(), to.globals())) {
+    values[&from_var] = &to_var;
+  }
+
+  for (auto [from_func, to_func] :
+       llvm::zip(from.functions(), to.functions())) {
+    values[&from_func] = &to_func;
+    for (auto [from_arg, to_arg] :
+         llvm::zip(from_func.args(), to_func.args())) {
+      values[&from_arg] = &to_arg;
     }
 
-    if (options.lower_switches) {
-      LowerSwitches(*module);
+    if (from_func.isDeclaration()) {
+      continue;
     }
 
-    ConvertArrayArguments(*module);
-    RemoveInsertValues(*module);
+    for (auto [from_bb, to_bb] : llvm::zip(from_func, to_func)) {
+      values[&from_bb] = &to_bb;
+      for (auto [from_inst, to_inst] : llvm::zip(from_bb, to_bb)) {
+        values[&from_inst] = &to_inst;
+      }
+    }
+  }
+}
 
-    InitOptPasses();
-    rellic::DebugInfoCollector dic;
-    dic.visit(*module);
+// Values that are defined by the function bodies of a shard. Declarations of
+// globals and functions are provided by the skeleton instead, as are the
+// prototypes of the definitions that the shard failed to decompile.
+static bool IsOwnedByShard(llvm::Value* value,
+                           rellic::DecompilationContext& dec_ctx) {
+  llvm::Function* func;
+  if (auto arg = llvm::dyn_cast<llvm::Argument>(value)) {
+    func = arg->getParent();
+  } else if (auto inst = llvm::dyn_cast<llvm::Instruction>(value)) {
+    func = inst->getFunction();
+  } else if (auto block = llvm::dyn_cast<llvm::BasicBlock>(value)) {
+    func = block->getParent();
+  } else {
+    func = llvm::dyn_cast<llvm::Function>(value);
+  }
+  return func && !func->isDeclaration() && !dec_ctx.prototype_only.count(func);
+}
+
+static void CollectStmts(clang::Stmt* stmt,
+                         std::unordered_set<clang::Stmt*>& stmts) {
+  if (!stmt || !stmts.insert(stmt).second) {
+    return;
+  }
+
+  for (auto child : stmt->children()) {
+    CollectStmts(child, stmts);
+  }
+}
+}  // namespace
+
+namespace rellic {
+// Hands the provenance tables of `dec_ctx` over to `result`, if requested,
+// keeping only the statements that are part of the final AST. `dec_ctx` must
+// not be used afterwards.
+static void MoveProvenance(DecompilationContext& dec_ctx,
+                           const DecompilationOptions& options,
+                           DecompilationResult& result) {
+  if (!options.provenance_maps) {
+    return;
+  }
+
+  dec_ctx.PruneProvenance();
+  result.stmt_provenance = ProvenanceMap<clang::Stmt, llvm::Value>(
+      std::move(dec_ctx.stmt_provenance));
+  result.value_decls = ProvenanceMap<llvm::Value, clang::ValueDecl>(
+      std::move(dec_ctx.value_decls));
+  result.type_decls = ProvenanceMap<llvm::Type, clang::TypeDecl>(
+      std::move(dec_ctx.type_decls));
+  result.use_provenance = ProvenanceMap<clang::Expr, llvm::Use>(
+      std::move(dec_ctx.use_provenance));
+}
+
+// Imports the function definitions of a shard into the merged translation unit
+// and translates the shard's provenance information into the tables of
+// `dec_ctx`. Statement and use provenance are only translated if requested.
+static void MergeShard(DecompilationShard& shard, llvm::Module& module,
+                       clang::ASTUnit& ast_unit, DecompilationContext& dec_ctx,
+                       const DecompilationOptions& options) {
+  clang::ASTImporter importer(
+      ast_unit.getASTContext(), ast_unit.getFileManager(),
+      shard.ast_unit->getASTContext(), shard.ast_unit->getFileManager(),
+      /*MinimalImport=*/false);
+
+  std::unordered_map<llvm::Value*, llvm::Value*> values;
+  MapShardValues(*shard.module, module, values);
 
-    std::vector<std::string> args{"-Wno-pointer-to-int-cast",
-                                  "-Wno-pointer-sign", "-target",
-                                  module->getTargetTriple()};
-    // Silence clang warning
-    // warning: unknown platform, assumming -mfloat-abi=soft
-    const auto& triple{llvm::Triple(module->getTargetTriple())};
-    if (triple.isARM()) {
-        args.push_back("-mfloat-abi=soft");
+  std::unordered_set<clang::Stmt*> stmts;
+  for (auto& func : shard.module->functions()) {
+    if (func.isDeclaration()) {
+      continue;
     }
-    auto ast_unit{clang::tooling::buildASTFromCodeWithArgs("", args, "out.c")};
-    rellic::DecompilationContext dec_ctx(*ast_unit);
 
-    for (auto& provider : options.additional_providers) {
-      dec_ctx.type_provider->AddProvider(provider->create(dec_ctx));
+    auto error{shard.dec_ctx->function_errors.find(&func)};
+    if (error != shard.dec_ctx->function_errors.end()) {
+      auto to_func{llvm::cast<llvm::Function>(values[&func])};
+      dec_ctx.prototype_only.insert(to_func);
+      dec_ctx.function_errors[to_func] = error->second;
+      continue;
     }
 
-    rellic::GenerateAST::run(*module, dec_ctx);
-    // TODO(surovic): Add llvm::Value* -> clang::Decl* map
-    // Especially for llvm::Argument* and llvm::Function*.
+    auto fdefn{shard.dec_ctx->value_decls[&func]};
+    auto imported{importer.Import(fdefn)};
+    CHECK_THROW(!!imported) << "Cannot merge definition of "
+                            << func.getName().str() << ": "
+                            << llvm::toString(imported.takeError());
+    if (options.provenance_maps) {
+      CollectStmts(clang::cast<clang::FunctionDecl>(fdefn)->getBody(), stmts);
+    }
+  }
+
+  for (auto [decl, value] : shard.dec_ctx->value_decls) {
+    if (!decl || !IsOwnedByShard(value, *shard.dec_ctx)) {
+      continue;
+    }
+
+    auto to_decl{importer.GetAlreadyImportedOrNull(decl)};
+    if (to_decl) {
+      dec_ctx.value_decls[values[value]] =
+          clang::cast<clang::ValueDecl>(to_decl);
+    }
+  }
+
+  if (!options.provenance_maps) {
+    return;
+  }
+
+  for (auto [stmt, value] : shard.dec_ctx->stmt_provenance) {
+    if (!value || !stmts.count(stmt) || !values.count(value)) {
+      continue;
+    }
+
+    // `stmt` is part of an imported body, so this only queries the importer's
+    // cache instead of creating a new node
+    auto to_stmt{importer.Import(stmt)};
+    if (!to_stmt) {
+      llvm::consumeError(to_stmt.takeError());
+      continue;
+    }
+    dec_ctx.stmt_provenance[*to_stmt] = values[value];
+  }
+
+  for (auto [expr, use] : shard.dec_ctx->use_provenance) {
+    if (!use || !stmts.count(expr) || !values.count(use->getUser())) {
+      continue;
+    }
+
+    auto to_expr{importer.Import(expr)};
+    if (!to_expr) {
+      llvm::consumeError(to_expr.takeError());
+      continue;
+    }
+    auto user{llvm::cast<llvm::User>(values[use->getUser()])};
+    auto to_use{&user->getOperandUse(use->getOperandNo())};
+    dec_ctx.use_provenance[clang::cast<clang::Expr>(*to_expr)] = to_use;
+  }
+}
+
+// Deep-copies the translation unit of `result` into a fresh one and frees the
+// old unit, along with every node that refinement replaced but could not free
+// since clang allocates them in the `ASTContext`. Provenance is remapped to
+// the copies. If a declaration cannot be copied, `result` is left as it is.
+static void CompactAST(DecompilationResult& result,
+                       const ASTUnitFactory& create_ast_unit) {
+  llvm::TimeTraceScope trace("CompactAST");
+  auto ast_unit{create_ast_unit(result.module->getTargetTriple())};
+  auto& from_ctx{result.ast->getASTContext()};
+  auto to_tu{ast_unit->getASTContext().getTranslationUnitDecl()};
+  auto importer{std::make_unique<clang::ASTImporter>(
+      ast_unit->getASTContext(), ast_unit->getFileManager(), from_ctx,
+      result.ast->getFileManager(), /*MinimalImport=*/false)};
+
+  std::vector<clang::Decl*> decls;
+  std::unordered_set<clang::Decl*> seen;
+  std::unordered_set<clang::Stmt*> stmts;
+  for (auto decl : from_ctx.getTranslationUnitDecl()->decls()) {
+    if (decl->isImplicit()) {
+      continue;
+    }
+
+    auto imported{importer->Import(decl)};
+    if (!imported) {
+      LOG(WARNING) << "Cannot compact AST: "
+                   << llvm::toString(imported.takeError());
+      return;
+    }
+    if (seen.insert(*imported).second) {
+      decls.push_back(*imported);
+    }
+
+    if (auto fdecl = clang::dyn_cast<clang::FunctionDecl>(decl)) {
+      CollectStmts(fdecl->getBody(), stmts);
+    } else if (auto var = clang::dyn_cast<clang::VarDecl>(decl)) {
+      CollectStmts(var->getInit(), stmts);
+    }
+  }
+
+  // The importer adds the declarations that a declaration depends on before
+  // it, so the declarations are put back in their original order
+  for (auto decl : decls) {
+    if (decl->getLexicalDeclContext() == to_tu && to_tu->containsDecl(decl)) {
+      to_tu->removeDecl(decl);
+    }
+  }
+  for (auto decl : decls) {
+    to_tu->addDecl(decl);
+  }
+
+  // Nodes of the final AST have all been imported, so this only queries the
+  // importer's cache instead of creating new nodes
+  auto import_stmt{[&](clang::Stmt* stmt) -> clang::Stmt* {
+    if (!stmts.count(stmt)) {
+      return nullptr;
+    }
+    auto to_stmt{importer->Import(stmt)};
+    if (!to_stmt) {
+      llvm::consumeError(to_stmt.takeError());
+      return nullptr;
+    }
+    return *to_stmt;
+  }};
+
+  if (result.stmt_provenance.IsAvailable()) {
+    ProvenanceMap<clang::Stmt, llvm::Value>::Map stmt_provenance;
+    for (auto [stmt, value] : result.stmt_provenance.Forward()) {
+      if (auto to_stmt = import_stmt(stmt)) {
+        stmt_provenance[to_stmt] = value;
+      }
+    }
+    result.stmt_provenance =
+        ProvenanceMap<clang::Stmt, llvm::Value>(std::move(stmt_provenance));
+  }
+
+  if (result.use_provenance.IsAvailable()) {
+    ProvenanceMap<clang::Expr, llvm::Use>::Map use_provenance;
+    for (auto [expr, use] : result.use_provenance.Forward()) {
+      if (auto to_expr = import_stmt(expr)) {
+        use_provenance[clang::cast<clang::Expr>(to_expr)] = use;
+      }
+    }
+    result.use_provenance =
+        ProvenanceMap<clang::Expr, llvm::Use>(std::move(use_provenance));
+  }
+
+  if (result.value_decls.IsAvailable()) {
+    ProvenanceMap<llvm::Value, clang::ValueDecl>::Map value_decls;
+    for (auto [value, decl] : result.value_decls.Forward()) {
+      auto to_decl{decl ? importer->GetAlreadyImportedOrNull(decl) : nullptr};
+      if (to_decl) {
+        value_decls[value] = clang::cast<clang::ValueDecl>(to_decl);
+      }
+    }
+    result.value_decls =
+        ProvenanceMap<llvm::Value, clang::ValueDecl>(std::move(value_decls));
+  }
+
+  if (result.type_decls.IsAvailable()) {
+    ProvenanceMap<llvm::Type, clang::TypeDecl>::Map type_decls;
+    for (auto [type, decl] : result.type_decls.Forward()) {
+      auto to_decl{decl ? importer->GetAlreadyImportedOrNull(decl) : nullptr};
+      if (to_decl) {
+        type_decls[type] = clang::cast<clang::TypeDecl>(to_decl);
+      }
+    }
+    result.type_decls =
+        ProvenanceMap<llvm::Type, clang::TypeDecl>(std::move(type_decls));
+  }
+
+  // The importer refers to both contexts, so it goes before the old unit
+  importer.reset();
+  result.ast = std::move(ast_unit);
+}
+
+// Drops the module of `result` unless `DecompilationOptions::keep_module` is
+// set, along with the references to its functions
+static void ReleaseModule(DecompilationResult& result,
+                          const DecompilationOptions& options) {
+  if (options.keep_module) {
+    return;
+  }
+
+  for (auto& error : result.function_errors) {
+    error.function = nullptr;
+  }
+  result.module.reset();
+}
+
+// A previous decompilation of a module, and the functions of the module whose
+// bodies have been edited since, see `Redecompile`
+struct ReusedDefinitions {
+  DecompilationResult previous;
+  std::unordered_set<const llvm::Function*> changed;
+  // Previous definitions that are imported instead of being decompiled again
+  std::unordered_map<llvm::Function*, clang::FunctionDecl*> definitions;
+};
+
+// Chooses the definitions of `module` that can be taken from the previous
+// decompilation, and marks them as only needing a prototype. Definitions that
+// have been changed, or that use a changed function and may thus refer to its
+// old prototype, are decompiled again.
+static void SelectReusedDefinitions(llvm::Module& module,
+                                    DecompilationContext& dec_ctx,
+                                    ReusedDefinitions& reuse) {
+  auto& previous{reuse.previous};
+  CHECK_THROW(previous.value_decls.IsAvailable() && previous.ast)
+      << "Redecompiling requires the AST and provenance maps of the previous "
+         "decompilation";
+
+  std::unordered_set<const llvm::Function*> dirty(reuse.changed.begin(),
+                                                  reuse.changed.end());
+  std::vector<const llvm::User*> worklist;
+  for (auto func : reuse.changed) {
+    worklist.insert(worklist.end(), func->user_begin(), func->user_end());
+  }
+  while (!worklist.empty()) {
+    auto user{worklist.back()};
+    worklist.pop_back();
+    if (auto inst = llvm::dyn_cast<llvm::Instruction>(user)) {
+      dirty.insert(inst->getFunction());
+    } else if (llvm::isa<llvm::Constant>(user) &&
+               !llvm::isa<llvm::GlobalValue>(user)) {
+      worklist.insert(worklist.end(), user->user_begin(), user->user_end());
+    }
+  }
+
+  for (auto& func : module.functions()) {
+    if (func.isDeclaration() || dec_ctx.prototype_only.count(&func) ||
+        dirty.count(&func)) {
+      continue;
+    }
+
+    // Definitions that could not be decompiled were only declared
+    auto fdefn{clang::dyn_cast_or_null<clang::FunctionDecl>(
+        const_cast<clang::ValueDecl*>(previous.value_decls.Lookup(&func)))};
+    if (fdefn && fdefn->doesThisDeclarationHaveABody()) {
+      reuse.definitions[&func] = fdefn;
+      dec_ctx.prototype_only.insert(&func);
+    }
+  }
+  RELLIC_EVENT(dec_ctx.events, rellic::EventLevel::Info, "redecompile")
+      << "Reusing " << reuse.definitions.size()
+      << " definitions of the previous decompilation";
+}
+
+// Imports the definitions chosen by `SelectReusedDefinitions` into the
+// translation unit of `dec_ctx`, in module order, and translates their
+// provenance. The values they refer to are those of `module` itself.
+static void ImportReusedDefinitions(llvm::Module& module,
+                                    clang::ASTUnit& ast_unit,
+                                    DecompilationContext& dec_ctx,
+                                    ReusedDefinitions& reuse) {
+  if (reuse.definitions.empty()) {
+    return;
+  }
+
+  auto& previous{reuse.previous};
+  clang::ASTImporter importer(
+      ast_unit.getASTContext(), ast_unit.getFileManager(),
+      previous.ast->getASTContext(), previous.ast->getFileManager(),
+      /*MinimalImport=*/false);
 
-    rellic::CompositeASTPass pass_ast(dec_ctx);
-    auto& ast_passes{pass_ast.GetPasses()};
+  // Only the values of reused definitions are known to still exist, entries
+  // for anything else may refer to deleted values
+  std::unordered_set<llvm::Value*> values;
+  for (auto& var : module.globals()) {
+    values.insert(&var);
+  }
+  std::unordered_set<clang::Stmt*> stmts;
+  for (auto& func : module.functions()) {
+    values.insert(&func);
+    auto it{reuse.definitions.find(&func)};
+    if (it == reuse.definitions.end()) {
+      continue;
+    }
+
+    auto imported{importer.Import(it->second)};
+    if (!imported) {
+      dec_ctx.DropDefinition(func,
+                             "Cannot reuse the previous definition: " +
+                                 llvm::toString(imported.takeError()));
+      continue;
+    }
+    dec_ctx.prototype_only.erase(&func);
+    dec_ctx.value_decls[&func] = clang::cast<clang::ValueDecl>(*imported);
+    CollectStmts(it->second->getBody(), stmts);
+
+    for (auto& arg : func.args()) {
+      values.insert(&arg);
+    }
+    for (auto& inst : llvm::instructions(func)) {
+      values.insert(&inst);
+    }
+  }
+
+  for (auto [value, decl] : previous.value_decls.Forward()) {
+    if (!decl || !values.count(value) || llvm::isa<llvm::GlobalValue>(value)) {
+      continue;
+    }
+
+    auto to_decl{importer.GetAlreadyImportedOrNull(decl)};
+    if (to_decl) {
+      dec_ctx.value_decls[value] = clang::cast<clang::ValueDecl>(to_decl);
+    }
+  }
+
+  for (auto [stmt, value] : previous.stmt_provenance.Forward()) {
+    if (!value || !stmts.count(stmt) || !values.count(value)) {
+      continue;
+    }
+
+    // `stmt` is part of an imported body, so this only queries the importer's
+    // cache instead of creating a new node
+    auto to_stmt{importer.Import(stmt)};
+    if (!to_stmt) {
+      llvm::consumeError(to_stmt.takeError());
+      continue;
+    }
+    dec_ctx.stmt_provenance[*to_stmt] = value;
+  }
+
+  // The uses of reused expressions are operands of instructions of the same,
+  // unchanged, definition
+  for (auto [expr, use] : previous.use_provenance.Forward()) {
+    if (!use || !stmts.count(expr)) {
+      continue;
+    }
 
-    ast_passes.push_back(std::make_unique<rellic::DeadStmtElim>(dec_ctx));
-    ast_passes.push_back(std::make_unique<rellic::LocalDeclRenamer>(
-        dec_ctx, dic.GetIRToNameMap()));
-    ast_passes.push_back(std::make_unique<rellic::StructFieldRenamer>(
-        dec_ctx, dic.GetIRTypeToDITypeMap()));
-    pass_ast.Run();
+    auto to_expr{importer.Import(expr)};
+    if (!to_expr) {
+      llvm::consumeError(to_expr.takeError());
+      continue;
+    }
+    dec_ctx.use_provenance[clang::cast<clang::Expr>(*to_expr)] = use;
+  }
+}
 
-    rellic::CompositeASTPass pass_cbr(dec_ctx);
-    auto& cbr_passes{pass_cbr.GetPasses()};
+// Decompiles `module` using `options.num_threads` shards. The calling thread
+// builds a skeleton translation unit holding every type, global and function
+// prototype, while the shards generate and refine the function bodies. The
+// definitions are finally imported into the skeleton in module order.
+static DecompilationResult DecompileParallel(
+    std::unique_ptr<llvm::Module>& module, const DecompilationOptions& options,
+    DebugInfoCollector& dic, const ASTUnitFactory& create_ast_unit,
+    const std::shared_ptr<Z3ContextPool>& z3_pool,
+    std::chrono::steady_clock::time_point start, ReusedDefinitions* reuse) {
+  auto ast_unit{create_ast_unit(module->getTargetTriple())};
+  auto dec_ctx{std::make_unique<DecompilationContext>(*ast_unit, z3_pool)};
+  ConfigureContext(*module, *dec_ctx, options);
+  DeclareStructTypes(*module, *dec_ctx);
+  SelectFunctions(*module, *dec_ctx, options);
+  auto cached{LookupCache(*module, *dec_ctx, dic, options)};
+  if (reuse) {
+    SelectReusedDefinitions(*module, *dec_ctx, *reuse);
+  }
+  auto dups{FindDuplicateDefinitions(*module, *dec_ctx, options)};
+  // Only the declarations are generated here, definitions come from the
+  // shards
+  IRToASTVisitor ast_gen(*dec_ctx);
+  for (auto& func : module->functions()) {
+    ast_gen.VisitFunctionDecl(func);
+  }
+  for (auto& var : module->globals()) {
+    ast_gen.VisitGlobalVar(var);
+  }
+  StructFieldRenamer sfr{*dec_ctx, dic.GetIRTypeToDITypeMap()};
+  sfr.Run();
 
-    cbr_passes.push_back(std::make_unique<rellic::Z3CondSimplify>(dec_ctx));
-    cbr_passes.push_back(std::make_unique<rellic::NestedCondProp>(dec_ctx));
+  // A shard takes as long as the sum of its definitions, so the most expensive
+  // definitions are dealt first, each to the shard with the lowest estimated
+  // cost so far. Shards still decompile their definitions in module order.
+  std::vector<std::pair<uint64_t, unsigned>> definitions;
+  unsigned idx{0};
+  for (auto& func : module->functions()) {
+    if (!func.isDeclaration() && !dec_ctx->prototype_only.count(&func)) {
+      definitions.emplace_back(MeasureFunction(func).Cost(), idx);
+    }
+    ++idx;
+  }
+  std::stable_sort(definitions.begin(), definitions.end(),
+                   [](auto& a, auto& b) { return a.first > b.first; });
 
-    cbr_passes.push_back(std::make_unique<rellic::NestedScopeCombine>(dec_ctx));
+  std::vector<DecompilationShard> shards(
+      std::min<size_t>(options.num_threads, definitions.size()));
+  std::vector<uint64_t> costs(shards.size());
+  for (auto [cost, func_idx] : definitions) {
+    auto cheapest{std::min_element(costs.begin(), costs.end()) -
+                  costs.begin()};
+    costs[cheapest] += cost;
+    shards[cheapest].functions.push_back(func_idx);
+  }
+  for (auto& shard : shards) {
+    std::sort(shard.functions.begin(), shard.functions.end());
+  }
 
-    cbr_passes.push_back(std::make_unique<rellic::CondBasedRefine>(dec_ctx));
-    cbr_passes.push_back(std::make_unique<rellic::ReachBasedRefine>(dec_ctx));
+  // The bitcode is only needed until every shard has parsed it
+  {
+    llvm::SmallVector<char, 0> bitcode;
+    {
+      llvm::raw_svector_ostream os(bitcode);
+      llvm::WriteBitcodeToFile(*module, os);
+    }
+    llvm::StringRef bitcode_ref(bitcode.data(), bitcode.size());
 
-    while (pass_cbr.Run()) {
-      ;
+    std::atomic_size_t next_shard{0};
+    std::vector<std::thread> workers;
+    auto tracing{IsTracing()};
+    for (size_t i{0}; i < shards.size(); ++i) {
+      workers.emplace_back([&, tracing]() {
+        TraceThread trace_thread(tracing);
+        for (auto shard{next_shard++}; shard < shards.size();
+             shard = next_shard++) {
+          DecompileShard(shards[shard], bitcode_ref, options, create_ast_unit,
+                         z3_pool, start);
+        }
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
     }
+  }
+
+  for (auto& shard : shards) {
+    CHECK_THROW(shard.error.empty()) << shard.error;
+  }
+  CheckCancelled(options.token);
+
+  DecompilationResult result{};
+  for (auto& shard : shards) {
+    MergeShard(shard, *module, *ast_unit, *dec_ctx, options);
+    MergeStatistics(shard.stats, result.statistics);
+    // Each shard is freed as soon as it has been merged, users before the
+    // contexts they refer to
+    shard.dec_ctx.reset();
+    shard.dic.reset();
+    shard.ast_unit.reset();
+    shard.module.reset();
+    shard.llvm_ctx.reset();
+  }
+  CloneDuplicates(*module, dups, *ast_unit, *dec_ctx);
+  if (reuse) {
+    ImportReusedDefinitions(*module, *ast_unit, *dec_ctx, *reuse);
+  }
+  CollectFunctionErrors(*module, *dec_ctx, result);
 
-    rellic::CompositeASTPass pass_loop{dec_ctx};
-    auto& loop_passes{pass_loop.GetPasses()};
+  if (options.IsStreaming()) {
+    bool complete{true};
+    for (auto& stage : result.statistics.stages) {
+      complete &= !stage.truncated;
+    }
 
-    loop_passes.push_back(std::make_unique<rellic::LoopRefine>(dec_ctx));
-    loop_passes.push_back(std::make_unique<rellic::NestedCondProp>(dec_ctx));
-    loop_passes.push_back(
-        std::make_unique<rellic::NestedScopeCombine>(dec_ctx));
+    StreamDeclarations(*module, *dec_ctx, options);
+    for (auto& func : module->functions()) {
+      if (func.isDeclaration() || cached.Stream(func, options) ||
+          dec_ctx->prototype_only.count(&func)) {
+        continue;
+      }
 
-    while (pass_loop.Run()) {
-      ;
+      auto fdefn{
+          clang::cast<clang::FunctionDecl>(dec_ctx->value_decls[&func])};
+      auto code{StreamDefinition(func, fdefn, options)};
+      if (complete) {
+        cached.Store(func, code);
+      }
+      if (options.release_streamed_definitions) {
+        dec_ctx->ReleaseDefinition(func);
+      }
     }
+  }
 
-    rellic::CompositeASTPass pass_scope{dec_ctx};
-    auto& scope_passes{pass_scope.GetPasses()};
-    scope_passes.push_back(std::make_unique<rellic::Z3CondSimplify>(dec_ctx));
-    scope_passes.push_back(std::make_unique<rellic::NestedCondProp>(dec_ctx));
+  MoveProvenance(*dec_ctx, options, result);
+  result.ast = std::move(ast_unit);
+  result.module = std::move(module);
+  return result;
+}
+
+static Result<DecompilationResult, DecompilationError> DecompileImpl(
+    std::unique_ptr<llvm::Module> module, const DecompilationOptions& options,
+    const ASTUnitFactory& create_ast_unit,
+    const std::shared_ptr<Z3ContextPool>& z3_pool = nullptr,
+    ReusedDefinitions* reuse = nullptr) {
+  auto start{std::chrono::steady_clock::now()};
+  llvm::TimeTraceScope trace("Decompile", module->getModuleIdentifier());
+  try {
+    ReportProgress(options.token, "prepare");
+    CheckCancelled(options.token);
+    // Invalid pipelines are reported before doing any work
+    ParsePipeline(options.pipeline);
+    ParsePipeline(options.large_function_pipeline);
+    CHECK_THROW(options.keep_module || !options.provenance_maps)
+        << "Provenance maps refer to the module, which must be kept";
+    CHECK_THROW(options.shard_index < options.num_shards)
+        << "Invalid shard " << options.shard_index << " of "
+        << options.num_shards;
+    auto checkpoints{!options.checkpoint_out.empty() ||
+                     !options.resume_from.empty()};
+    CHECK_THROW(!checkpoints ||
+                (options.num_threads <= 1 && options.num_shards == 1 &&
+                 options.cache_directory.empty() &&
+                 !options.definition_cache && !reuse))
+        << "Checkpoints are only supported by single-threaded, unsharded "
+           "decompilations without a cache";
+
+    MaterializeFunctions(*module, options);
 
-    scope_passes.push_back(
-        std::make_unique<rellic::NestedScopeCombine>(dec_ctx));
+    PreprocessOptions preprocess;
+    preprocess.remove_phi_nodes = options.remove_phi_nodes;
+    preprocess.lower_switches = options.lower_switches;
+    preprocess.pre_opt = options.pre_opt;
+    preprocess.num_threads = options.num_threads;
+    PreprocessModule(*module, preprocess);
 
-    while (pass_scope.Run()) {
-      ;
+    InitOptPasses();
+    rellic::DebugInfoCollector dic;
+    dic.visit(*module, options.num_threads);
+
+    if (options.num_threads > 1) {
+      auto result{DecompileParallel(module, options, dic, create_ast_unit,
+                                    z3_pool, start, reuse)};
+      if (!options.forensics_directory.empty()) {
+        WriteForensics(*result.module, result.statistics, {}, options);
+      }
+      if (options.compact_ast) {
+        CompactAST(result, create_ast_unit);
+      }
+      ReleaseModule(result, options);
+      ReportProgress(options.token, "done");
+      return Result<DecompilationResult, DecompilationError>(std::move(result));
     }
 
-    rellic::CompositeASTPass pass_ec{dec_ctx};
-    auto& ec_passes{pass_ec.GetPasses()};
-    ec_passes.push_back(std::make_unique<rellic::MaterializeConds>(dec_ctx));
-    ec_passes.push_back(std::make_unique<rellic::ExprCombine>(dec_ctx));
+    auto ast_unit{create_ast_unit(module->getTargetTriple())};
+    rellic::DecompilationContext dec_ctx(*ast_unit, z3_pool);
+    ConfigureContext(*module, dec_ctx, options);
 
-    pass_ec.Run();
+    SelectFunctions(*module, dec_ctx, options);
+    CachedDefinitions cached;
+    if (!options.cache_directory.empty() || options.definition_cache ||
+        reuse || options.num_shards > 1) {
+      // Struct types are declared up front so that their names, which are part
+      // of the cache keys, do not depend on which definitions are cached,
+      // reused or decompiled by other shards
+      DeclareStructTypes(*module, dec_ctx);
+      cached = LookupCache(*module, dec_ctx, dic, options);
+    }
+    if (reuse) {
+      SelectReusedDefinitions(*module, dec_ctx, *reuse);
+    }
+    auto dups{FindDuplicateDefinitions(*module, dec_ctx, options)};
 
     DecompilationResult result{};
+    RefinementMetricsMap refinements;
+    if (options.resume_from.empty()) {
+      BuildAST(*module, dec_ctx, result.statistics, options.token);
+      if (!options.checkpoint_out.empty()) {
+        WriteCheckpoint(dec_ctx, *module, options.checkpoint_out);
+      }
+    } else {
+      ResumeAST(*module, dec_ctx, options.resume_from, result.statistics);
+    }
+    // TODO(surovic): Add llvm::Value* -> clang::Decl* map
+    // Especially for llvm::Argument* and llvm::Function*.
+
+    size_t num_definitions{0};
+    for (auto& func : module->functions()) {
+      num_definitions +=
+          !func.isDeclaration() && !dec_ctx.prototype_only.count(&func);
+    }
+    auto budget{CreateBudget(options, start, num_definitions)};
+    Refinement pipeline(dec_ctx, dic, budget, options);
+    pipeline.RunAST();
+    if (options.IsStreaming()) {
+      // Refine one definition at a time, so that each can be emitted as soon
+      // as it is final
+      pipeline.CombineDeclarations();
+      if (reuse) {
+        ImportReusedDefinitions(*module, *ast_unit, dec_ctx, *reuse);
+      }
+      StreamDeclarations(*module, dec_ctx, options);
+      // Representatives precede their duplicates in module order, so they
+      // are always refined first, and kept for them to be copied from
+      std::unordered_set<llvm::Function*> truncated, representatives;
+      for (auto [dup, rep] : dups.representatives) {
+        representatives.insert(rep);
+      }
+      for (auto& func : module->functions()) {
+        if (func.isDeclaration() || cached.Stream(func, options) ||
+            (dec_ctx.prototype_only.count(&func) && !dups.Contains(func))) {
+          continue;
+        }
+
+        CheckCancelled(options.token);
+        // Reused definitions are already refined, and duplicates are copies
+        // of refined definitions
+        bool defined{true}, complete{true};
+        if (dups.Contains(func)) {
+          defined = CloneDuplicate(func, dups, *ast_unit, dec_ctx);
+          complete = !truncated.count(dups.representatives.at(&func));
+        } else if (!reuse || !reuse->definitions.count(&func)) {
+          // The queries of each definition are kept for its forensic capture
+          auto query_log{dec_ctx.prover.GetQueryLog()};
+          std::shared_ptr<QueryLog> slow_queries;
+          if (dec_ctx.forensic_queries) {
+            slow_queries = std::make_shared<QueryLog>(dec_ctx.forensic_queries,
+                                                      query_log);
+            dec_ctx.prover.SetQueryLog(slow_queries);
+          }
+          auto refine_start{std::chrono::steady_clock::now()};
+          std::tie(defined, complete) =
+              RefineDefinition(pipeline, func, dec_ctx);
+          if (slow_queries) {
+            dec_ctx.prover.SetQueryLog(query_log);
+            auto& metrics{refinements[&func]};
+            metrics.elapsed = std::chrono::steady_clock::now() - refine_start;
+            metrics.truncated = !complete;
+            metrics.slowest_queries = slow_queries->GetSlowest();
+          }
+        }
+        if (!defined) {
+          continue;
+        }
+        if (!complete) {
+          truncated.insert(&func);
+        }
+
+        auto fdefn{
+            clang::cast<clang::FunctionDecl>(dec_ctx.value_decls[&func])};
+        auto code{StreamDefinition(func, fdefn, options)};
+        if (complete) {
+          cached.Store(func, code);
+        }
+        if (options.release_streamed_definitions &&
+            !representatives.count(&func)) {
+          dec_ctx.ReleaseDefinition(func);
+        }
+      }
+    } else {
+      RefineModule(pipeline, *module, dec_ctx);
+      CheckCancelled(options.token);
+      CloneDuplicates(*module, dups, *ast_unit, dec_ctx);
+      if (reuse) {
+        ImportReusedDefinitions(*module, *ast_unit, dec_ctx, *reuse);
+      }
+    }
+    pipeline.Record(result.statistics);
+    dec_ctx.ReleaseSolverState();
+    CollectFunctionErrors(*module, dec_ctx, result);
+
+    if (!options.forensics_directory.empty()) {
+      WriteForensics(*module, result.statistics, refinements, options);
+    }
+
     result.ast = std::move(ast_unit);
     result.module = std::move(module);
-    CopyMap(dec_ctx.stmt_provenance, result.stmt_provenance_map,
-            result.value_to_stmt_map);
-    CopyMap(dec_ctx.value_decls, result.value_to_decl_map,
-            result.decl_provenance_map);
-    CopyMap(dec_ctx.type_decls, result.type_to_decl_map,
-            result.type_provenance_map);
-    CopyMap(dec_ctx.use_provenance, result.expr_use_map, result.use_expr_map);
+    MoveProvenance(dec_ctx, options, result);
+    if (options.compact_ast) {
+      CompactAST(result, create_ast_unit);
+    }
+    ReleaseModule(result, options);
+    ReportProgress(options.token, "done");
 
     return Result<DecompilationResult, DecompilationError>(std::move(result));
   } catch (Exception& ex) {
@@ -171,6 +2270,266 @@ Result<DecompilationResult, DecompilationError> Decompile(
     error.message = ex.what();
     error.module = std::move(module);
     return Result<DecompilationResult, DecompilationError>(std::move(error));
+  } catch (z3::exception& ex) {
+    DecompilationError error{};
+    error.message = ex.msg();
+    error.module = std::move(module);
+    return Result<DecompilationResult, DecompilationError>(std::move(error));
   }
 }
+
+Result<DecompilationResult, DecompilationError> Decompile(
+    std::unique_ptr<llvm::Module> module, DecompilationOptions options) {
+  return DecompileImpl(std::move(module), std::move(options), CreateASTUnit);
+}
+
+Result<DecompilationResult, DecompilationError> Redecompile(
+    DecompilationResult previous,
+    const std::unordered_set<const llvm::Function*>& changed,
+    DecompilationOptions options) {
+  ReusedDefinitions reuse{std::move(previous), changed, {}};
+  auto module{std::move(reuse.previous.module)};
+  // Provenance is what allows the result to be redecompiled in turn
+  options.provenance_maps = true;
+  return DecompileImpl(std::move(module), std::move(options), CreateASTUnit,
+                       nullptr, &reuse);
+}
+
+// Decompiles `modules` with `create_ast_unit` and `z3_pool`, see
+// `DecompileMany`
+static std::vector<Result<DecompilationResult, DecompilationError>>
+DecompileBatch(std::vector<std::unique_ptr<llvm::Module>> modules,
+               DecompilationOptions options, unsigned num_threads,
+               const ASTUnitFactory& create_ast_unit,
+               const std::shared_ptr<Z3ContextPool>& z3_pool) {
+  if (options.IsStreaming() && options.cache_directory.empty() &&
+      !options.definition_cache) {
+    options.definition_cache = std::make_shared<DecompilationCache>();
+  }
+
+  // Modules that share a context cannot be decompiled concurrently, so each
+  // group of them is decompiled by one thread
+  std::vector<std::vector<size_t>> groups;
+  std::unordered_map<llvm::LLVMContext*, size_t> group_of;
+  for (size_t i{0}; i < modules.size(); ++i) {
+    auto [it, inserted]{
+        group_of.try_emplace(&modules[i]->getContext(), groups.size())};
+    if (inserted) {
+      groups.emplace_back();
+    }
+    groups[it->second].push_back(i);
+  }
+
+  std::vector<std::optional<Result<DecompilationResult, DecompilationError>>>
+      results(modules.size());
+  std::atomic_size_t next_group{0};
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  auto run{[&]() {
+    for (auto group{next_group++}; group < groups.size();
+         group = next_group++) {
+      for (auto i : groups[group]) {
+        try {
+          results[i].emplace(DecompileImpl(std::move(modules[i]), options,
+                                           create_ast_unit, z3_pool));
+        } catch (...) {
+          std::unique_lock<std::mutex> lock(error_mutex);
+          if (!error) {
+            error = std::current_exception();
+          }
+          return;
+        }
+      }
+    }
+  }};
+
+  auto num_workers{std::min<size_t>(std::max(num_threads, 1u), groups.size())};
+  std::vector<std::thread> workers;
+  auto tracing{IsTracing()};
+  for (size_t i{1}; i < num_workers; ++i) {
+    workers.emplace_back([&, tracing]() {
+      TraceThread trace_thread(tracing);
+      run();
+    });
+  }
+  if (num_workers) {
+    run();
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  std::vector<Result<DecompilationResult, DecompilationError>> batch;
+  batch.reserve(results.size());
+  for (auto& result : results) {
+    batch.push_back(std::move(*result));
+  }
+  return batch;
+}
+
+std::vector<Result<DecompilationResult, DecompilationError>> DecompileMany(
+    std::vector<std::unique_ptr<llvm::Module>> modules,
+    DecompilationOptions options, unsigned num_threads) {
+  // Without a session the frontend and Z3 contexts are still shared by the
+  // batch, and the translation unit of the next module is prepared while the
+  // current ones are decompiled
+  Decompiler session(
+      modules.empty() ? 0 : std::min<size_t>(num_threads, modules.size() - 1));
+  return session.DecompileMany(std::move(modules), std::move(options),
+                               num_threads);
+}
+
+void DecompilationToken::Cancel() {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (cancelled) {
+    return;
+  }
+  cancelled = true;
+  for (auto& [id, callback] : callbacks) {
+    callback();
+  }
+}
+
+bool DecompilationToken::IsCancelled() const {
+  std::unique_lock<std::mutex> lock(mutex);
+  return cancelled;
+}
+
+DecompilationProgress DecompilationToken::GetProgress() const {
+  std::unique_lock<std::mutex> lock(mutex);
+  return progress;
+}
+
+unsigned DecompilationToken::Subscribe(std::function<void()> callback) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (cancelled) {
+    callback();
+  }
+  auto id{next_callback++};
+  callbacks[id] = std::move(callback);
+  return id;
+}
+
+void DecompilationToken::Unsubscribe(unsigned id) {
+  std::unique_lock<std::mutex> lock(mutex);
+  callbacks.erase(id);
+}
+
+void DecompilationToken::SetProgress(std::string stage, unsigned iteration) {
+  std::unique_lock<std::mutex> lock(mutex);
+  progress.stage = std::move(stage);
+  progress.iteration = iteration;
+}
+
+using DecompileFunction =
+    std::function<Result<DecompilationResult, DecompilationError>(
+        std::unique_ptr<llvm::Module>, DecompilationOptions)>;
+
+// Runs `decompile` on `executor`, see `DecompileAsync`
+static DecompilationJob StartJob(std::unique_ptr<llvm::Module> module,
+                                 DecompilationOptions options,
+                                 const DecompilationExecutor& executor,
+                                 DecompileFunction decompile) {
+  if (!options.token) {
+    options.token = std::make_shared<DecompilationToken>();
+  }
+
+  struct Task {
+    std::unique_ptr<llvm::Module> module;
+    DecompilationOptions options;
+    DecompileFunction decompile;
+    std::promise<Result<DecompilationResult, DecompilationError>> promise;
+  };
+  auto task{std::make_shared<Task>()};
+  DecompilationJob job(options.token, task->promise.get_future());
+  task->module = std::move(module);
+  task->options = std::move(options);
+  task->decompile = std::move(decompile);
+
+  // The task is shared so that it can be copied into a `std::function`, and
+  // is destroyed along with its promise if the executor drops it
+  std::function<void()> run{[task]() {
+    try {
+      task->promise.set_value(
+          task->decompile(std::move(task->module), std::move(task->options)));
+    } catch (...) {
+      task->promise.set_exception(std::current_exception());
+    }
+  }};
+  if (executor) {
+    executor(std::move(run));
+  } else {
+    std::thread(std::move(run)).detach();
+  }
+  return job;
+}
+
+DecompilationJob DecompileAsync(std::unique_ptr<llvm::Module> module,
+                                DecompilationOptions options,
+                                DecompilationExecutor executor) {
+  return StartJob(std::move(module), std::move(options), executor,
+                  [](std::unique_ptr<llvm::Module> module,
+                     DecompilationOptions options) {
+                    return Decompile(std::move(module), std::move(options));
+                  });
+}
+
+Decompiler::Decompiler(unsigned num_prepared_units)
+    : num_prepared_units(num_prepared_units),
+      z3_pool(std::make_shared<Z3ContextPool>()) {}
+
+Decompiler::~Decompiler() = default;
+
+std::unique_ptr<clang::ASTUnit> Decompiler::TakeASTUnit(
+    const std::string& triple) {
+  std::future<std::unique_ptr<clang::ASTUnit>> unit;
+  {
+    std::unique_lock<std::mutex> lock(prepared_units_mutex);
+    auto& units{prepared_units[triple]};
+    if (!units.empty()) {
+      unit = std::move(units.front());
+      units.pop_front();
+    }
+    // Replace the unit that is being handed out, so that the next request
+    // for this triple doesn't have to wait for the frontend
+    while (units.size() < num_prepared_units) {
+      units.push_back(std::async(std::launch::async, CreateASTUnit, triple));
+    }
+  }
+
+  if (unit.valid()) {
+    return unit.get();
+  }
+  return CreateASTUnit(triple);
+}
+
+Result<DecompilationResult, DecompilationError> Decompiler::Decompile(
+    std::unique_ptr<llvm::Module> module, DecompilationOptions options) {
+  return DecompileImpl(
+      std::move(module), std::move(options),
+      [this](const std::string& triple) { return TakeASTUnit(triple); },
+      z3_pool);
+}
+
+DecompilationJob Decompiler::DecompileAsync(
+    std::unique_ptr<llvm::Module> module, DecompilationOptions options,
+    DecompilationExecutor executor) {
+  return StartJob(std::move(module), std::move(options), executor,
+                  [this](std::unique_ptr<llvm::Module> module,
+                         DecompilationOptions options) {
+                    return Decompile(std::move(module), std::move(options));
+                  });
+}
+
+std::vector<Result<DecompilationResult, DecompilationError>>
+Decompiler::DecompileMany(std::vector<std::unique_ptr<llvm::Module>> modules,
+                          DecompilationOptions options, unsigned num_threads) {
+  return DecompileBatch(
+      std::move(modules), std::move(options), num_threads,
+      [this](const std::string& triple) { return TakeASTUnit(triple); },
+      z3_pool);
+}
 }  // namespace rellic
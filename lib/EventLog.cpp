@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/EventLog.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+
+#include "rellic/Trace.h"
+
+namespace rellic {
+
+const char* GetEventLevelName(EventLevel level) {
+  switch (level) {
+    case EventLevel::Debug:
+      return "debug";
+    case EventLevel::Info:
+      return "info";
+    case EventLevel::Warning:
+      return "warning";
+  }
+  return "unknown";
+}
+
+std::optional<EventLevel> ParseEventLevel(llvm::StringRef name) {
+  for (auto level :
+       {EventLevel::Debug, EventLevel::Info, EventLevel::Warning}) {
+    if (name == GetEventLevelName(level)) {
+      return level;
+    }
+  }
+  return std::nullopt;
+}
+
+EventLog::EventLog(Sink sink, EventLevel level, size_t batch_size)
+    : level(level),
+      batch_size(batch_size),
+      start(std::chrono::steady_clock::now()),
+      sink(std::move(sink)) {}
+
+EventLog::~EventLog() { Flush(); }
+
+Result<std::unique_ptr<EventLog>, std::string> EventLog::Create(
+    llvm::StringRef path, EventLevel level) {
+  std::error_code ec;
+  std::shared_ptr<llvm::raw_fd_ostream> os{
+      std::make_shared<llvm::raw_fd_ostream>(path, ec,
+                                             llvm::sys::fs::OF_Text)};
+  if (ec) {
+    return "Cannot open event log " + path.str() + ": " + ec.message();
+  }
+
+  auto sink{[os](const std::vector<Event>& events) {
+    for (auto& event : events) {
+      *os << llvm::json::Value(llvm::json::Object{
+                 {"time_us", static_cast<int64_t>(event.time.count())},
+                 {"level", GetEventLevelName(event.level)},
+                 {"name", event.name},
+                 {"message", llvm::json::isUTF8(event.message)
+                                 ? event.message
+                                 : llvm::json::fixUTF8(event.message)}})
+          << '\n';
+    }
+    os->flush();
+  }};
+  return std::make_unique<EventLog>(std::move(sink), level);
+}
+
+void EventLog::Record(EventLevel event_level, llvm::StringRef name,
+                      std::string message) {
+  auto time{std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start)};
+  if (IsTracing()) {
+    llvm::TimeTraceScope trace(name, message);
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  pending.push_back({event_level, name.str(), std::move(message), time});
+  if (pending.size() < batch_size) {
+    return;
+  }
+
+  // The sink is taken before the next batch can be, so that batches are
+  // written in order
+  std::vector<Event> batch;
+  batch.swap(pending);
+  std::lock_guard<std::mutex> sink_lock(sink_mutex);
+  lock.unlock();
+  sink(batch);
+}
+
+void EventLog::Flush() {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (pending.empty()) {
+    return;
+  }
+  std::vector<Event> batch;
+  batch.swap(pending);
+  std::lock_guard<std::mutex> sink_lock(sink_mutex);
+  lock.unlock();
+  sink(batch);
+}
+
+EventMessage::~EventMessage() { log.Record(level, name, std::move(os.str())); }
+
+}  // namespace rellic
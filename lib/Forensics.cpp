@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Forensics.h"
+
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <algorithm>
+#include <string>
+#include <system_error>
+#include <unordered_set>
+
+namespace rellic {
+
+std::unique_ptr<llvm::Module> ExtractFunction(const llvm::Module& module,
+                                              const llvm::Function& func) {
+  llvm::ValueToValueMapTy map;
+  auto copy{llvm::CloneModule(
+      module, map,
+      [&](const llvm::GlobalValue* value) { return value == &func; })};
+  // Declarations are all that is left of the other globals, so those that are
+  // not referred to can go
+  for (auto& other : llvm::make_early_inc_range(copy->functions())) {
+    if (other.isDeclaration() && other.use_empty()) {
+      other.eraseFromParent();
+    }
+  }
+  for (auto& var : llvm::make_early_inc_range(copy->globals())) {
+    if (var.isDeclaration() && var.use_empty()) {
+      var.eraseFromParent();
+    }
+  }
+  return copy;
+}
+
+// Names the files of a capture after its function, like those of
+// `--split_output`
+static std::string GetStem(llvm::StringRef function,
+                           std::unordered_set<std::string>& stems) {
+  std::string base;
+  for (auto c : function.take_front(128)) {
+    auto valid{llvm::isAlnum(c) || c == '_' || c == '-' ||
+               (c == '.' && !base.empty())};
+    base.push_back(valid ? c : '_');
+  }
+  if (base.empty()) {
+    base = "function";
+  }
+
+  auto stem{base};
+  for (unsigned i{1}; !stems.insert(llvm::StringRef(stem).lower()).second;
+       ++i) {
+    stem = base + "-" + std::to_string(i);
+  }
+  return stem;
+}
+
+static double ToMilliseconds(std::chrono::nanoseconds elapsed) {
+  return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+static llvm::json::Object FunctionToJSON(const FunctionMetrics& metrics,
+                                         const RefinementMetrics* refinement) {
+  auto& size{metrics.size};
+  llvm::json::Object obj{
+      {"name", llvm::json::isUTF8(metrics.name)
+                   ? metrics.name
+                   : llvm::json::fixUTF8(metrics.name)},
+      {"blocks", size.blocks},
+      {"edges", size.edges},
+      {"loop_depth", size.loop_depth},
+      {"switch_cases", size.switch_cases},
+      {"cond_terms", static_cast<int64_t>(size.cond_terms)},
+      {"cost", static_cast<int64_t>(size.Cost())},
+      {"generate_ms", ToMilliseconds(metrics.elapsed)},
+      {"generate_bytes", static_cast<int64_t>(metrics.memory)},
+      {"generate_timed_out", metrics.timed_out}};
+  if (refinement) {
+    obj["refine_ms"] = ToMilliseconds(refinement->elapsed);
+    obj["refine_truncated"] = refinement->truncated;
+  }
+  return obj;
+}
+
+static llvm::json::Array StagesToJSON(const PassStatistics& stats) {
+  llvm::json::Array stages;
+  for (auto& stage : stats.stages) {
+    llvm::json::Array passes;
+    for (auto& pass : stage.passes) {
+      passes.push_back(llvm::json::Object{
+          {"name", pass.name},
+          {"runs", pass.stats.num_runs},
+          {"changes", pass.stats.num_changes},
+          {"elapsed_ms", ToMilliseconds(pass.stats.elapsed)}});
+    }
+    stages.push_back(llvm::json::Object{
+        {"name", stage.name},
+        {"iterations", stage.num_iterations},
+        {"truncated", stage.truncated},
+        {"elapsed_ms", ToMilliseconds(stage.stats.elapsed)},
+        {"passes", std::move(passes)}});
+  }
+  return stages;
+}
+
+// Writes `write` to `path`. Returns whether it succeeded.
+template <typename TWrite>
+static bool WriteFile(const std::string& path, llvm::sys::fs::OpenFlags flags,
+                      TWrite write) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, flags);
+  if (ec) {
+    LOG(WARNING) << "Cannot create forensic capture " << path << ": "
+                 << ec.message();
+    return false;
+  }
+  write(os);
+  os.close();
+  if (os.has_error()) {
+    LOG(WARNING) << "Cannot write forensic capture " << path << ": "
+                 << os.error().message();
+    os.clear_error();
+    return false;
+  }
+  return true;
+}
+
+unsigned WriteForensics(const llvm::Module& module,
+                        const PassStatistics& stats,
+                        const RefinementMetricsMap& refinements,
+                        const DecompilationOptions& options) {
+  auto& directory{options.forensics_directory};
+  auto ec{llvm::sys::fs::create_directories(directory)};
+  if (ec) {
+    LOG(WARNING) << "Cannot create forensics directory " << directory << ": "
+                 << ec.message();
+    return 0;
+  }
+
+  unsigned num_captures{0};
+  std::unordered_set<std::string> stems;
+  for (auto& metrics : stats.functions) {
+    auto func{module.getFunction(metrics.name)};
+    if (!func || func->isDeclaration()) {
+      continue;
+    }
+
+    const RefinementMetrics* refinement{nullptr};
+    auto elapsed{metrics.elapsed};
+    if (auto it{refinements.find(func)}; it != refinements.end()) {
+      refinement = &it->second;
+      elapsed += refinement->elapsed;
+    }
+    llvm::json::Array reasons;
+    if (options.forensics_time.count() && elapsed > options.forensics_time) {
+      reasons.push_back("time");
+    }
+    if (options.forensics_memory && metrics.memory > options.forensics_memory) {
+      reasons.push_back("memory");
+    }
+    if (metrics.timed_out) {
+      reasons.push_back("goto_timeout");
+    }
+    if (refinement && refinement->truncated) {
+      reasons.push_back("refinement_budget");
+    }
+    if (reasons.empty()) {
+      continue;
+    }
+
+    llvm::SmallString<256> path(directory);
+    llvm::sys::path::append(path, GetStem(metrics.name, stems));
+    auto base{path.str().str()};
+    auto extracted{ExtractFunction(module, *func)};
+    auto written{WriteFile(base + ".bc", llvm::sys::fs::OF_None,
+                           [&](llvm::raw_ostream& os) {
+                             llvm::WriteBitcodeToFile(*extracted, os);
+                           })};
+
+    llvm::json::Object capture{
+        {"reasons", std::move(reasons)},
+        {"function", FunctionToJSON(metrics, refinement)},
+        {"stages", StagesToJSON(stats)}};
+    written &= WriteFile(base + ".json", llvm::sys::fs::OF_Text,
+                         [&](llvm::raw_ostream& os) {
+                           os << llvm::json::Value(std::move(capture)) << '\n';
+                         });
+
+    auto queries{metrics.slowest_queries};
+    if (refinement) {
+      queries.insert(queries.end(), refinement->slowest_queries.begin(),
+                     refinement->slowest_queries.end());
+      std::stable_sort(queries.begin(), queries.end(),
+                       [](const QueryLog::Query& a, const QueryLog::Query& b) {
+                         return a.elapsed > b.elapsed;
+                       });
+      queries.resize(std::min<size_t>(queries.size(),
+                                      options.forensics_queries));
+    }
+    auto log{QueryLog::Create(base + ".queries.jsonl")};
+    if (log.Succeeded()) {
+      auto query_log{log.TakeValue()};
+      for (auto& query : queries) {
+        query_log->Record(query);
+      }
+    } else {
+      LOG(WARNING) << "Cannot create forensic capture: " << log.Error();
+      written = false;
+    }
+    num_captures += written;
+  }
+  return num_captures;
+}
+
+}  // namespace rellic
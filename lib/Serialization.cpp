@@ -0,0 +1,816 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Serialization.h"
+
+#include <clang/AST/ASTImporter.h>
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Sema/Sema.h>
+#include <clang/Serialization/ASTWriter.h>
+#include <clang/Serialization/InMemoryModuleCache.h>
+#include <clang/Serialization/PCHContainerOperations.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Bitstream/BitstreamWriter.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/TypeFinder.h>
+#include <llvm/Support/JSON.h>
+
+#include <algorithm>
+#include <array>
+#include <system_error>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "rellic/Exception.h"
+#include "rellic/Trace.h"
+
+namespace rellic {
+
+void ValueNumbering::Add(const llvm::Value* value) {
+  ids[value] = values.size();
+  values.push_back(value);
+}
+
+ValueNumbering::ValueNumbering(const llvm::Module& module) {
+  for (auto& gvar : module.globals()) {
+    Add(&gvar);
+  }
+  for (auto& func : module) {
+    Add(&func);
+  }
+  for (auto& alias : module.aliases()) {
+    Add(&alias);
+  }
+  for (auto& ifunc : module.ifuncs()) {
+    Add(&ifunc);
+  }
+  for (auto& func : module) {
+    for (auto& arg : func.args()) {
+      Add(&arg);
+    }
+    for (auto& block : func) {
+      Add(&block);
+      for (auto& inst : block) {
+        Add(&inst);
+      }
+    }
+  }
+}
+
+uint32_t ValueNumbering::GetId(const llvm::Value* value) const {
+  auto it{ids.find(value)};
+  return it == ids.end() ? None : it->second;
+}
+
+const llvm::Value* ValueNumbering::GetValue(uint32_t id) const {
+  return id < values.size() ? values[id] : nullptr;
+}
+
+std::vector<clang::Stmt*> GetNumberedStmts(clang::Decl* decl) {
+  clang::Stmt* root{nullptr};
+  if (auto func = clang::dyn_cast<clang::FunctionDecl>(decl)) {
+    if (func->doesThisDeclarationHaveABody()) {
+      root = func->getBody();
+    }
+  } else if (auto var = clang::dyn_cast<clang::VarDecl>(decl)) {
+    // The initializers of local variables are numbered with the body of their
+    // function
+    if (var->getDeclContext()->isFileContext()) {
+      root = var->getInit();
+    }
+  }
+
+  std::vector<clang::Stmt*> stmts;
+  if (!root) {
+    return stmts;
+  }
+
+  std::vector<clang::Stmt*> worklist{root};
+  while (!worklist.empty()) {
+    auto stmt{worklist.back()};
+    worklist.pop_back();
+    stmts.push_back(stmt);
+    auto first{worklist.size()};
+    for (auto child : stmt->children()) {
+      if (child) {
+        worklist.push_back(child);
+      }
+    }
+    std::reverse(worklist.begin() + first, worklist.end());
+  }
+  return stmts;
+}
+
+Result<ProvenanceTable, std::string> ProvenanceTable::Load(
+    std::unique_ptr<llvm::MemoryBuffer> buffer) {
+  auto data{buffer->getBufferStart()};
+  auto size{buffer->getBufferSize()};
+  if (size < sizeof(Header)) {
+    return std::string("Truncated provenance table");
+  }
+
+  auto header{reinterpret_cast<const Header*>(data)};
+  if (header->magic != Magic) {
+    return std::string("Not a provenance table");
+  }
+  uint32_t version{header->version};
+  if (version != Version) {
+    return "Unsupported provenance table version " + std::to_string(version);
+  }
+
+  uint32_t num_decls{header->num_decls};
+  uint32_t num_stmts{header->num_stmts};
+  auto expected_size{sizeof(Header) +
+                     uint64_t(num_decls) * sizeof(DeclRecord) +
+                     uint64_t(num_stmts) * sizeof(StmtRecord)};
+  if (size != expected_size) {
+    return std::string("Provenance table has the wrong size");
+  }
+
+  ProvenanceTable table;
+  table.num_values = header->num_values;
+  auto decls_start{data + sizeof(Header)};
+  table.decls = llvm::ArrayRef<DeclRecord>(
+      reinterpret_cast<const DeclRecord*>(decls_start), num_decls);
+  auto stmts_start{decls_start + num_decls * sizeof(DeclRecord)};
+  table.stmts = llvm::ArrayRef<StmtRecord>(
+      reinterpret_cast<const StmtRecord*>(stmts_start), num_stmts);
+  table.buffer = std::move(buffer);
+  return table;
+}
+
+Result<ProvenanceTable, std::string> ProvenanceTable::Open(
+    llvm::StringRef path) {
+  auto buffer{llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                          /*RequiresNullTerminator=*/false)};
+  if (!buffer) {
+    return "Cannot read provenance table " + path.str() + ": " +
+           buffer.getError().message();
+  }
+  return Load(std::move(*buffer));
+}
+
+namespace {
+template <typename T>
+static bool DeclBefore(const T& record, uint32_t decl) {
+  return record.decl < decl;
+}
+
+static bool DeclAfter(uint32_t decl,
+                      const ProvenanceTable::StmtRecord& record) {
+  return decl < record.decl;
+}
+
+static bool StmtBefore(const ProvenanceTable::StmtRecord& record,
+                       uint32_t stmt) {
+  return record.stmt < stmt;
+}
+
+class DeclCollector : public clang::RecursiveASTVisitor<DeclCollector> {
+ public:
+  std::vector<clang::Decl*> decls;
+
+  bool VisitDecl(clang::Decl* decl) {
+    decls.push_back(decl);
+    return true;
+  }
+};
+
+// Same as `clang::ASTUnit::serialize`, but keeping the writer around for the
+// ids of the declarations
+struct ASTFileWriter {
+  llvm::SmallString<0> buffer;
+  llvm::BitstreamWriter stream{buffer};
+  clang::InMemoryModuleCache module_cache;
+  clang::ASTWriter writer{stream, buffer, module_cache, {}};
+
+  explicit ASTFileWriter(clang::ASTUnit& unit) {
+    writer.WriteAST(unit.getSema(), std::string(), nullptr, "",
+                    unit.getDiagnostics().hasErrorOccurred());
+  }
+};
+
+template <typename T>
+static void WriteRaw(llvm::raw_ostream& os, const T* data, size_t count) {
+  os.write(reinterpret_cast<const char*>(data), sizeof(T) * count);
+}
+}  // namespace
+
+llvm::ArrayRef<ProvenanceTable::StmtRecord> ProvenanceTable::GetStmts(
+    uint32_t decl) const {
+  auto begin{std::lower_bound(stmts.begin(), stmts.end(), decl,
+                              DeclBefore<StmtRecord>)};
+  auto end{std::upper_bound(begin, stmts.end(), decl, DeclAfter)};
+  return {begin, end};
+}
+
+uint32_t ProvenanceTable::LookupDecl(uint32_t decl) const {
+  auto it{std::lower_bound(decls.begin(), decls.end(), decl,
+                           DeclBefore<DeclRecord>)};
+  if (it == decls.end() || it->decl != decl) {
+    return ValueNumbering::None;
+  }
+  return it->value;
+}
+
+uint32_t ProvenanceTable::LookupStmt(uint32_t decl, uint32_t stmt) const {
+  auto records{GetStmts(decl)};
+  auto it{std::lower_bound(records.begin(), records.end(), stmt, StmtBefore)};
+  if (it == records.end() || it->stmt != stmt) {
+    return ValueNumbering::None;
+  }
+  return it->value;
+}
+
+Result<SerializationStatistics, std::string> SerializeAST(
+    const DecompilationResult& result, llvm::raw_ostream& ast_os,
+    llvm::raw_ostream& table_os) {
+  llvm::TimeTraceScope scope("SerializeAST");
+  if (!result.ast || !result.module) {
+    return std::string("No AST to serialize");
+  }
+  if (!result.stmt_provenance.IsAvailable()) {
+    return std::string("No provenance maps to serialize");
+  }
+
+  auto& unit{*result.ast};
+  ASTFileWriter ast_file(unit);
+  auto& writer{ast_file.writer};
+  ast_os.write(ast_file.buffer.data(), ast_file.buffer.size());
+
+  // Only declarations that are still part of the AST have been written, so
+  // the provenance maps are looked up from the AST rather than iterated
+  DeclCollector collector;
+  collector.TraverseDecl(unit.getASTContext().getTranslationUnitDecl());
+
+  ValueNumbering numbering(*result.module);
+  std::vector<ProvenanceTable::DeclRecord> decl_records;
+  std::vector<ProvenanceTable::StmtRecord> stmt_records;
+  for (auto decl : collector.decls) {
+    if (auto vdecl = clang::dyn_cast<clang::ValueDecl>(decl)) {
+      auto value{numbering.GetId(result.value_decls.InverseLookup(vdecl))};
+      if (value != ValueNumbering::None) {
+        ProvenanceTable::DeclRecord record;
+        record.decl = writer.getDeclID(decl);
+        record.value = value;
+        decl_records.push_back(record);
+      }
+    }
+
+    auto stmts{GetNumberedStmts(decl)};
+    if (stmts.empty()) {
+      continue;
+    }
+    uint32_t owner{writer.getDeclID(decl)};
+    for (size_t i{0}; i < stmts.size(); ++i) {
+      auto value{numbering.GetId(result.stmt_provenance.Lookup(stmts[i]))};
+      if (value != ValueNumbering::None) {
+        ProvenanceTable::StmtRecord record;
+        record.decl = owner;
+        record.stmt = static_cast<uint32_t>(i);
+        record.value = value;
+        stmt_records.push_back(record);
+      }
+    }
+  }
+
+  std::sort(decl_records.begin(), decl_records.end(),
+            [](const ProvenanceTable::DeclRecord& a,
+               const ProvenanceTable::DeclRecord& b) {
+              return a.decl < b.decl;
+            });
+  std::sort(stmt_records.begin(), stmt_records.end(),
+            [](const ProvenanceTable::StmtRecord& a,
+               const ProvenanceTable::StmtRecord& b) {
+              return std::make_tuple(uint32_t(a.decl), uint32_t(a.stmt)) <
+                     std::make_tuple(uint32_t(b.decl), uint32_t(b.stmt));
+            });
+
+  ProvenanceTable::Header header;
+  header.magic = ProvenanceTable::Magic;
+  header.version = ProvenanceTable::Version;
+  header.num_values = numbering.GetNumValues();
+  header.num_decls = decl_records.size();
+  header.num_stmts = stmt_records.size();
+  WriteRaw(table_os, &header, 1);
+  WriteRaw(table_os, decl_records.data(), decl_records.size());
+  WriteRaw(table_os, stmt_records.data(), stmt_records.size());
+
+  SerializationStatistics stats;
+  stats.num_decls = decl_records.size();
+  stats.num_stmts = stmt_records.size();
+  return stats;
+}
+
+
+namespace {
+static constexpr int64_t CheckpointVersion{1};
+
+// Sorts `rows` so that checkpoints do not depend on the addresses of the nodes
+// they were written from
+template <size_t N>
+static std::vector<std::array<uint32_t, N>> Sorted(
+    std::vector<std::array<uint32_t, N>> rows) {
+  std::sort(rows.begin(), rows.end());
+  return rows;
+}
+
+template <size_t N>
+static llvm::json::Array ToJSON(
+    const std::vector<std::array<uint32_t, N>>& rows) {
+  llvm::json::Array array;
+  for (auto& row : rows) {
+    array.push_back(llvm::json::Array(row));
+  }
+  return array;
+}
+
+template <typename Set>
+static llvm::json::Array FunctionsToJSON(const ValueNumbering& numbering,
+                                         const Set& funcs) {
+  std::vector<std::array<uint32_t, 1>> rows;
+  for (auto func : funcs) {
+    rows.push_back({numbering.GetId(func)});
+  }
+  return ToJSON(Sorted(std::move(rows)));
+}
+
+static const llvm::json::Array& GetArray(const llvm::json::Object& obj,
+                                         llvm::StringRef key) {
+  auto array{obj.getArray(key)};
+  CHECK_THROW(array) << "Malformed checkpoint: missing `" << key.str() << '`';
+  return *array;
+}
+
+static uint32_t GetId(const llvm::json::Value& value) {
+  auto id{value.getAsInteger()};
+  CHECK_THROW(id && *id >= 0 && *id < ValueNumbering::None)
+      << "Malformed checkpoint: invalid id";
+  return static_cast<uint32_t>(*id);
+}
+
+// Reads the array `key` of `obj`, whose elements are arrays of `width` ids
+static std::vector<std::vector<uint32_t>> GetRows(const llvm::json::Object& obj,
+                                                  llvm::StringRef key,
+                                                  size_t width) {
+  std::vector<std::vector<uint32_t>> rows;
+  for (auto& elem : GetArray(obj, key)) {
+    auto row{elem.getAsArray()};
+    CHECK_THROW(row && row->size() == width)
+        << "Malformed checkpoint: invalid entry of `" << key.str() << '`';
+    auto& ids{rows.emplace_back()};
+    for (auto& id : *row) {
+      ids.push_back(GetId(id));
+    }
+  }
+  return rows;
+}
+
+template <typename T>
+static T* GetValue(const ValueNumbering& numbering, uint32_t id) {
+  auto value{const_cast<llvm::Value*>(numbering.GetValue(id))};
+  auto typed{llvm::dyn_cast_or_null<T>(value)};
+  CHECK_THROW(typed) << "Malformed checkpoint: unexpected value " << id;
+  return typed;
+}
+
+template <typename T>
+static T* CastDecl(clang::Decl* decl, uint32_t id) {
+  auto typed{clang::dyn_cast<T>(decl)};
+  CHECK_THROW(typed) << "Malformed checkpoint: unexpected declaration " << id;
+  return typed;
+}
+
+static llvm::Use* GetUse(const ValueNumbering& numbering, uint32_t user_id,
+                         uint32_t operand) {
+  auto user{GetValue<llvm::User>(numbering, user_id)};
+  CHECK_THROW(operand < user->getNumOperands())
+      << "Malformed checkpoint: unexpected operand " << operand << " of value "
+      << user_id;
+  return &user->getOperandUse(operand);
+}
+
+static llvm::DenseMap<llvm::Type*, uint32_t> NumberTypes(
+    llvm::Module& module, std::vector<llvm::StructType*>& types) {
+  llvm::TypeFinder finder;
+  finder.run(module, /*onlyNamed=*/false);
+  llvm::DenseMap<llvm::Type*, uint32_t> ids;
+  for (auto type : finder) {
+    ids[type] = types.size();
+    types.push_back(type);
+  }
+  return ids;
+}
+}  // namespace
+
+void WriteCheckpoint(DecompilationContext& dec_ctx, llvm::Module& module,
+                     const std::string& path) {
+  llvm::TimeTraceScope scope("WriteCheckpoint");
+  ASTFileWriter ast_file(dec_ctx.ast_unit);
+
+  DeclCollector collector;
+  collector.TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  llvm::DenseMap<clang::Decl*, uint32_t> decl_ids;
+  llvm::DenseMap<clang::Stmt*, std::pair<uint32_t, uint32_t>> stmt_ids;
+  for (auto decl : collector.decls) {
+    uint32_t id{ast_file.writer.getDeclID(decl)};
+    decl_ids[decl] = id;
+    auto stmts{GetNumberedStmts(decl)};
+    for (size_t i{0}; i < stmts.size(); ++i) {
+      stmt_ids.try_emplace(stmts[i], id, static_cast<uint32_t>(i));
+    }
+  }
+
+  ValueNumbering numbering(module);
+  std::vector<llvm::StructType*> types;
+  auto type_ids{NumberTypes(module, types)};
+  auto get_value{[&](const llvm::Value* value) {
+    return value ? numbering.GetId(value) : ValueNumbering::None;
+  }};
+
+  // Entries that refer to nodes which are no longer part of the AST, or to
+  // values that are not numbered, are left out
+  std::vector<std::array<uint32_t, 3>> conds, stmt_provenance, outgoing_uses;
+  for (auto [stmt, idx] : dec_ctx.conds) {
+    if (auto it = stmt_ids.find(stmt); it != stmt_ids.end()) {
+      conds.push_back({it->second.first, it->second.second, idx});
+    }
+  }
+  for (auto [stmt, value] : dec_ctx.stmt_provenance) {
+    auto it{stmt_ids.find(stmt)};
+    auto id{get_value(value)};
+    if (it != stmt_ids.end() && id != ValueNumbering::None) {
+      stmt_provenance.push_back({it->second.first, it->second.second, id});
+    }
+  }
+  std::vector<std::array<uint32_t, 4>> use_provenance;
+  for (auto [expr, use] : dec_ctx.use_provenance) {
+    auto it{stmt_ids.find(expr)};
+    auto user{use ? get_value(use->getUser()) : ValueNumbering::None};
+    if (it != stmt_ids.end() && user != ValueNumbering::None) {
+      use_provenance.push_back(
+          {it->second.first, it->second.second, user, use->getOperandNo()});
+    }
+  }
+  // The uses of each block are kept in order
+  for (auto& func : module) {
+    for (auto& block : func) {
+      auto it{dec_ctx.outgoing_uses.find(&block)};
+      if (it == dec_ctx.outgoing_uses.end()) {
+        continue;
+      }
+      for (auto use : it->second) {
+        auto user{get_value(use->getUser())};
+        if (user != ValueNumbering::None) {
+          outgoing_uses.push_back(
+              {numbering.GetId(&block), user, use->getOperandNo()});
+        }
+      }
+    }
+  }
+
+  std::vector<std::array<uint32_t, 2>> value_decls, type_decls, temp_decls;
+  for (auto [value, decl] : dec_ctx.value_decls) {
+    auto it{decl_ids.find(decl)};
+    auto id{get_value(value)};
+    if (it != decl_ids.end() && id != ValueNumbering::None) {
+      value_decls.push_back({id, it->second});
+    }
+  }
+  for (auto [type, decl] : dec_ctx.type_decls) {
+    auto it{decl_ids.find(decl)};
+    auto type_it{type_ids.find(type)};
+    if (it != decl_ids.end() && type_it != type_ids.end()) {
+      type_decls.push_back({type_it->second, it->second});
+    }
+  }
+  for (auto [arg, decl] : dec_ctx.temp_decls) {
+    auto it{decl_ids.find(decl)};
+    auto id{get_value(arg)};
+    if (it != decl_ids.end() && id != ValueNumbering::None) {
+      temp_decls.push_back({id, it->second});
+    }
+  }
+
+  // Boolean conditions and variables are written as the assertions of an
+  // SMT-LIB benchmark, in order, while the integer variables of switches are
+  // written by name. Variables are named by numeric symbols, which are written
+  // the way the benchmark refers to them, e.g. `k!3`.
+  z3::solver solver(dec_ctx.z3_ctx);
+  llvm::json::Array int_exprs, vars;
+  for (unsigned i{0}; i < dec_ctx.z3_exprs.size(); ++i) {
+    auto expr{dec_ctx.z3_exprs[i]};
+    if (expr.is_bool()) {
+      solver.add(expr);
+      continue;
+    }
+    CHECK_THROW(expr.is_const()) << "Cannot checkpoint condition " << expr;
+    int_exprs.push_back(llvm::json::Array{i, expr.to_string()});
+  }
+  for (unsigned i{0}; i < dec_ctx.z3_vars.size(); ++i) {
+    auto var{dec_ctx.z3_vars[i]};
+    auto id{var.id()};
+    if (auto it = dec_ctx.z3_br_edges_inv.find(id);
+        it != dec_ctx.z3_br_edges_inv.end()) {
+      solver.add(var);
+      vars.push_back(llvm::json::Array{"branch", get_value(it->second.first),
+                                       it->second.second});
+    } else if (auto it = dec_ctx.z3_sw_vars_inv.find(id);
+               it != dec_ctx.z3_sw_vars_inv.end()) {
+      vars.push_back(llvm::json::Array{"switch", get_value(it->second),
+                                       var.to_string()});
+    } else if (auto it = dec_ctx.z3_reach_defs.find(id);
+               it != dec_ctx.z3_reach_defs.end()) {
+      solver.add(var);
+      vars.push_back(llvm::json::Array{"reach", it->second});
+    } else {
+      THROW() << "Cannot checkpoint variable " << var;
+    }
+  }
+  // An empty benchmark would still assert `true`
+  std::string smt2;
+  if (solver.assertions().size()) {
+    smt2 = solver.to_smt2();
+  }
+
+  std::vector<std::pair<uint32_t, std::string>> errors;
+  for (auto& [func, error] : dec_ctx.function_errors) {
+    errors.emplace_back(numbering.GetId(func), error);
+  }
+  std::sort(errors.begin(), errors.end());
+  llvm::json::Array function_errors;
+  for (auto& [func, error] : errors) {
+    function_errors.push_back(llvm::json::Array{func, error});
+  }
+
+  llvm::json::Object state{
+      {"format", "rellic-checkpoint"},
+      {"version", CheckpointVersion},
+      {"num_values", numbering.GetNumValues()},
+      {"num_types", static_cast<int64_t>(types.size())},
+      {"num_exprs", dec_ctx.z3_exprs.size()},
+      {"smt2", std::move(smt2)},
+      {"int_exprs", std::move(int_exprs)},
+      {"vars", std::move(vars)},
+      {"conds", ToJSON(Sorted(std::move(conds)))},
+      {"stmt_provenance", ToJSON(Sorted(std::move(stmt_provenance)))},
+      {"use_provenance", ToJSON(Sorted(std::move(use_provenance)))},
+      {"value_decls", ToJSON(Sorted(std::move(value_decls)))},
+      {"type_decls", ToJSON(Sorted(std::move(type_decls)))},
+      {"temp_decls", ToJSON(Sorted(std::move(temp_decls)))},
+      {"outgoing_uses", ToJSON(outgoing_uses)},
+      {"prototype_only", FunctionsToJSON(numbering, dec_ctx.prototype_only)},
+      {"large_functions", FunctionsToJSON(numbering, dec_ctx.large_functions)},
+      {"straight_line_functions",
+       FunctionsToJSON(numbering, dec_ctx.straight_line_functions)},
+      {"function_errors", std::move(function_errors)},
+      {"num_literal_structs",
+       static_cast<int64_t>(dec_ctx.num_literal_structs)},
+      {"num_declared_structs",
+       static_cast<int64_t>(dec_ctx.num_declared_structs)},
+  };
+
+  std::error_code ec;
+  llvm::raw_fd_ostream ast_os(path, ec);
+  CHECK_THROW(!ec) << "Cannot write checkpoint " << path << ": "
+                   << ec.message();
+  ast_os.write(ast_file.buffer.data(), ast_file.buffer.size());
+  llvm::raw_fd_ostream state_os(path + ".json", ec);
+  CHECK_THROW(!ec) << "Cannot write checkpoint " << path << ".json: "
+                   << ec.message();
+  state_os << llvm::json::Value(std::move(state)) << '\n';
+  ast_os.close();
+  state_os.close();
+  CHECK_THROW(!ast_os.has_error() && !state_os.has_error())
+      << "Cannot write checkpoint " << path;
+}
+
+void ReadCheckpoint(DecompilationContext& dec_ctx, llvm::Module& module,
+                    const std::string& path) {
+  llvm::TimeTraceScope scope("ReadCheckpoint");
+  auto buffer{llvm::MemoryBuffer::getFile(path + ".json")};
+  CHECK_THROW(buffer) << "Cannot read checkpoint " << path
+                      << ".json: " << buffer.getError().message();
+  auto json{llvm::json::parse(buffer.get()->getBuffer())};
+  if (!json) {
+    THROW() << "Malformed checkpoint: " << llvm::toString(json.takeError());
+  }
+  auto state{json->getAsObject()};
+  CHECK_THROW(state && state->getString("format") == "rellic-checkpoint")
+      << path << ".json is not a checkpoint";
+  CHECK_THROW(state->getInteger("version") == CheckpointVersion)
+      << "Unsupported checkpoint version";
+
+  ValueNumbering numbering(module);
+  std::vector<llvm::StructType*> types;
+  NumberTypes(module, types);
+  CHECK_THROW(state->getInteger("num_values") == numbering.GetNumValues() &&
+              state->getInteger("num_types") == int64_t(types.size()))
+      << "Checkpoint " << path << " was written for a different module";
+
+  static const clang::RawPCHContainerReader pch_reader;
+  auto diags{clang::CompilerInstance::createDiagnostics(
+      new clang::DiagnosticOptions())};
+  auto from_unit{clang::ASTUnit::LoadFromASTFile(
+      path, pch_reader, clang::ASTUnit::LoadEverything, diags,
+      clang::FileSystemOptions())};
+  CHECK_THROW(from_unit) << "Cannot load the AST of checkpoint " << path;
+  auto& from_ctx{from_unit->getASTContext()};
+  auto source{from_ctx.getExternalSource()};
+  clang::ASTImporter importer(
+      dec_ctx.ast_ctx, dec_ctx.ast_unit.getFileManager(), from_ctx,
+      from_unit->getFileManager(), /*MinimalImport=*/false);
+
+  // Same as `CompactAST`: the importer adds the declarations that a
+  // declaration depends on before it, so the declarations are put back in
+  // their original order
+  auto to_tu{dec_ctx.ast_ctx.getTranslationUnitDecl()};
+  std::vector<clang::Decl*> decls;
+  std::unordered_set<clang::Decl*> seen;
+  for (auto decl : from_ctx.getTranslationUnitDecl()->decls()) {
+    if (decl->isImplicit()) {
+      continue;
+    }
+    auto imported{importer.Import(decl)};
+    if (!imported) {
+      THROW() << "Cannot import the AST of checkpoint " << path << ": "
+              << llvm::toString(imported.takeError());
+    }
+    if (seen.insert(*imported).second) {
+      decls.push_back(*imported);
+    }
+  }
+  for (auto decl : decls) {
+    if (decl->getLexicalDeclContext() == to_tu && to_tu->containsDecl(decl)) {
+      to_tu->removeDecl(decl);
+    }
+  }
+  for (auto decl : decls) {
+    to_tu->addDecl(decl);
+  }
+  dec_ctx.decl_counts.erase(to_tu);
+
+  // Every node has been imported, so this only queries the importer's cache
+  auto get_decl{[&](uint32_t id) {
+    auto from{source->GetExternalDecl(id)};
+    auto decl{from ? importer.GetAlreadyImportedOrNull(from) : nullptr};
+    CHECK_THROW(decl) << "Malformed checkpoint: unknown declaration " << id;
+    return decl;
+  }};
+  std::unordered_map<uint32_t, std::vector<clang::Stmt*>> numbered_stmts;
+  auto get_stmt{[&](uint32_t decl_id, uint32_t idx) {
+    auto it{numbered_stmts.find(decl_id)};
+    if (it == numbered_stmts.end()) {
+      auto from{source->GetExternalDecl(decl_id)};
+      CHECK_THROW(from) << "Malformed checkpoint: unknown declaration "
+                        << decl_id;
+      it = numbered_stmts.emplace(decl_id, GetNumberedStmts(from)).first;
+    }
+    CHECK_THROW(idx < it->second.size())
+        << "Malformed checkpoint: unknown statement " << idx
+        << " of declaration " << decl_id;
+    auto stmt{importer.Import(it->second[idx])};
+    if (!stmt) {
+      THROW() << "Malformed checkpoint: "
+              << llvm::toString(stmt.takeError());
+    }
+    return *stmt;
+  }};
+
+  // Expressions are hash-consed by Z3, so parsing them back gives the ids
+  // that `z3_expr_indices` and the inverse tables are keyed by
+  auto smt2{state->getString("smt2")};
+  CHECK_THROW(smt2) << "Malformed checkpoint: missing `smt2`";
+  z3::expr_vector assertions(dec_ctx.z3_ctx);
+  if (!smt2->empty()) {
+    assertions = dec_ctx.z3_ctx.parse_string(smt2->str().c_str());
+  }
+  unsigned next_assertion{0};
+  auto next_bool{[&]() {
+    CHECK_THROW(next_assertion < assertions.size())
+        << "Malformed checkpoint: missing condition";
+    return assertions[next_assertion++];
+  }};
+
+  std::unordered_map<uint32_t, std::string> int_exprs;
+  for (auto& elem : GetArray(*state, "int_exprs")) {
+    auto row{elem.getAsArray()};
+    CHECK_THROW(row && row->size() == 2 && (*row)[1].getAsString())
+        << "Malformed checkpoint: invalid entry of `int_exprs`";
+    int_exprs[GetId((*row)[0])] = (*row)[1].getAsString()->str();
+  }
+  auto num_exprs{state->getInteger("num_exprs")};
+  CHECK_THROW(num_exprs) << "Malformed checkpoint: missing `num_exprs`";
+  for (unsigned i{0}; i < *num_exprs; ++i) {
+    auto it{int_exprs.find(i)};
+    auto expr{it == int_exprs.end()
+                  ? next_bool()
+                  : dec_ctx.z3_ctx.int_const(it->second.c_str())};
+    dec_ctx.z3_expr_indices.emplace(expr.id(), i);
+    dec_ctx.z3_exprs.push_back(expr);
+  }
+  for (auto& elem : GetArray(*state, "vars")) {
+    auto row_ptr{elem.getAsArray()};
+    CHECK_THROW(row_ptr && row_ptr->size() >= 2 && (*row_ptr)[0].getAsString())
+        << "Malformed checkpoint: invalid entry of `vars`";
+    auto& row{*row_ptr};
+    auto kind{*row[0].getAsString()};
+    if (kind == "branch") {
+      CHECK_THROW(row.size() == 3 && row[2].getAsBoolean())
+          << "Malformed checkpoint: invalid branch variable";
+      auto var{next_bool()};
+      dec_ctx.z3_br_edges_inv[var.id()] = {
+          GetValue<llvm::BranchInst>(numbering, GetId(row[1])),
+          *row[2].getAsBoolean()};
+      dec_ctx.z3_vars.push_back(var);
+    } else if (kind == "switch") {
+      CHECK_THROW(row.size() == 3 && row[2].getAsString())
+          << "Malformed checkpoint: invalid switch variable";
+      auto name{row[2].getAsString()->str()};
+      auto var{dec_ctx.z3_ctx.int_const(name.c_str())};
+      dec_ctx.z3_sw_vars_inv[var.id()] =
+          GetValue<llvm::SwitchInst>(numbering, GetId(row[1]));
+      dec_ctx.z3_vars.push_back(var);
+    } else if (kind == "reach") {
+      CHECK_THROW(row.size() == 2)
+          << "Malformed checkpoint: invalid reach variable";
+      auto def{GetId(row[1])};
+      CHECK_THROW(def < dec_ctx.z3_exprs.size())
+          << "Malformed checkpoint: unknown condition " << def;
+      auto var{next_bool()};
+      dec_ctx.z3_reach_defs[var.id()] = def;
+      dec_ctx.z3_vars.push_back(var);
+    } else {
+      THROW() << "Malformed checkpoint: unknown variable kind " << kind.str();
+    }
+  }
+  CHECK_THROW(next_assertion == assertions.size())
+      << "Malformed checkpoint: unexpected conditions";
+
+  for (auto& row : GetRows(*state, "conds", 3)) {
+    CHECK_THROW(row[2] < dec_ctx.z3_exprs.size())
+        << "Malformed checkpoint: unknown condition " << row[2];
+    dec_ctx.conds[get_stmt(row[0], row[1])] = row[2];
+  }
+  for (auto& row : GetRows(*state, "stmt_provenance", 3)) {
+    dec_ctx.stmt_provenance[get_stmt(row[0], row[1])] =
+        GetValue<llvm::Value>(numbering, row[2]);
+  }
+  for (auto& row : GetRows(*state, "use_provenance", 4)) {
+    auto expr{clang::dyn_cast<clang::Expr>(get_stmt(row[0], row[1]))};
+    CHECK_THROW(expr) << "Malformed checkpoint: use of a statement";
+    dec_ctx.use_provenance[expr] = GetUse(numbering, row[2], row[3]);
+  }
+  for (auto& row : GetRows(*state, "outgoing_uses", 3)) {
+    auto block{GetValue<llvm::BasicBlock>(numbering, row[0])};
+    dec_ctx.outgoing_uses[block].push_back(GetUse(numbering, row[1], row[2]));
+  }
+  for (auto& row : GetRows(*state, "value_decls", 2)) {
+    dec_ctx.value_decls[GetValue<llvm::Value>(numbering, row[0])] =
+        CastDecl<clang::ValueDecl>(get_decl(row[1]), row[1]);
+  }
+  for (auto& row : GetRows(*state, "type_decls", 2)) {
+    CHECK_THROW(row[0] < types.size())
+        << "Malformed checkpoint: unknown type " << row[0];
+    dec_ctx.type_decls[types[row[0]]] =
+        CastDecl<clang::TypeDecl>(get_decl(row[1]), row[1]);
+  }
+  for (auto& row : GetRows(*state, "temp_decls", 2)) {
+    dec_ctx.temp_decls[GetValue<llvm::Argument>(numbering, row[0])] =
+        CastDecl<clang::VarDecl>(get_decl(row[1]), row[1]);
+  }
+
+  for (auto& row : GetRows(*state, "prototype_only", 1)) {
+    dec_ctx.prototype_only.insert(
+        GetValue<llvm::Function>(numbering, row[0]));
+  }
+  for (auto& row : GetRows(*state, "large_functions", 1)) {
+    dec_ctx.large_functions.insert(
+        GetValue<llvm::Function>(numbering, row[0]));
+  }
+  for (auto& row : GetRows(*state, "straight_line_functions", 1)) {
+    dec_ctx.straight_line_functions.insert(
+        GetValue<llvm::Function>(numbering, row[0]));
+  }
+  for (auto& elem : GetArray(*state, "function_errors")) {
+    auto row{elem.getAsArray()};
+    CHECK_THROW(row && row->size() == 2 && (*row)[1].getAsString())
+        << "Malformed checkpoint: invalid entry of `function_errors`";
+    dec_ctx.function_errors[GetValue<llvm::Function>(
+        numbering, GetId((*row)[0]))] = (*row)[1].getAsString()->str();
+  }
+  dec_ctx.num_literal_structs =
+      state->getInteger("num_literal_structs").value_or(0);
+  dec_ctx.num_declared_structs =
+      state->getInteger("num_declared_structs").value_or(0);
+}
+
+}  // namespace rellic
@@ -0,0 +1,443 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/Stmt.h>
+#include <glog/logging.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Value.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <pybind11/chrono.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "rellic/AST/CPrinter.h"
+#include "rellic/BC/Util.h"
+#include "rellic/Decompiler.h"
+
+namespace py = pybind11;
+
+// Type providers make the options move-only, which pybind11 cannot tell from
+// the type traits alone
+template <>
+struct pybind11::detail::is_copy_constructible<rellic::DecompilationOptions>
+    : std::false_type {};
+
+namespace {
+
+// A decompilation shared with Python. Every object handed out for its AST or
+// IR keeps it alive, so they refer to the nodes themselves instead of copies.
+// The LLVM context is declared first so that it outlives the module.
+struct Decompilation {
+  std::unique_ptr<llvm::LLVMContext> llvm_ctx;
+  rellic::DecompilationResult result;
+};
+using DecompilationPtr = std::shared_ptr<Decompilation>;
+
+struct Value {
+  DecompilationPtr owner;
+  const llvm::Value* value;
+};
+
+struct Stmt {
+  DecompilationPtr owner;
+  clang::Stmt* stmt;
+};
+
+struct Function {
+  DecompilationPtr owner;
+  clang::FunctionDecl* decl;
+};
+
+py::object GetValue(const DecompilationPtr& owner, const llvm::Value* value) {
+  return value ? py::cast(Value{owner, value}) : py::none();
+}
+
+std::string PrintValue(const llvm::Value* value) {
+  std::string code;
+  llvm::raw_string_ostream os(code);
+  value->print(os);
+  return os.str();
+}
+
+std::string Print(Decompilation& dec,
+                  const std::function<void(rellic::CPrinter&)>& print) {
+  std::string code;
+  llvm::raw_string_ostream os(code);
+  {
+    rellic::CPrinter printer(os, dec.result.ast->getASTContext());
+    print(printer);
+  }
+  return os.str();
+}
+
+template <typename T>
+py::int_ GetId(const T* ptr) {
+  return py::int_(reinterpret_cast<uintptr_t>(ptr));
+}
+
+// Only the options that can be represented in Python are copied. Type
+// providers and callbacks are left out.
+rellic::DecompilationOptions CopyOptions(
+    const rellic::DecompilationOptions& options) {
+  rellic::DecompilationOptions copy;
+  copy.lower_switches = options.lower_switches;
+  copy.remove_phi_nodes = options.remove_phi_nodes;
+  copy.pre_opt = options.pre_opt;
+  copy.coalesce_phi_nodes = options.coalesce_phi_nodes;
+  copy.provenance_maps = options.provenance_maps;
+  copy.compact_ast = options.compact_ast;
+  copy.keep_module = options.keep_module;
+  copy.functions = options.functions;
+  copy.include_callees = options.include_callees;
+  copy.shard_index = options.shard_index;
+  copy.num_shards = options.num_shards;
+  copy.deduplicate_functions = options.deduplicate_functions;
+  copy.num_threads = options.num_threads;
+  copy.simplify_threads = options.simplify_threads;
+  copy.prove_threads = options.prove_threads;
+  copy.generate_threads = options.generate_threads;
+  copy.unit_threads = options.unit_threads;
+  copy.pipeline = options.pipeline;
+  copy.large_function_limits = options.large_function_limits;
+  copy.large_function_pipeline = options.large_function_pipeline;
+  copy.blob_initializer_size = options.blob_initializer_size;
+  copy.cond_var_size = options.cond_var_size;
+  copy.reach_var_size = options.reach_var_size;
+  copy.region_unit_size = options.region_unit_size;
+  copy.structuring = options.structuring;
+  copy.goto_cond_size = options.goto_cond_size;
+  copy.goto_timeout = options.goto_timeout;
+  copy.max_fixpoint_iterations = options.max_fixpoint_iterations;
+  copy.module_timeout = options.module_timeout;
+  copy.function_timeout = options.function_timeout;
+  copy.memory_limit = options.memory_limit;
+  copy.z3_timeout = options.z3_timeout;
+  copy.z3_rlimit = options.z3_rlimit;
+  copy.condition_engine = options.condition_engine;
+  copy.rule_timing = options.rule_timing;
+  copy.checkpoint_out = options.checkpoint_out;
+  copy.resume_from = options.resume_from;
+  copy.forensics_directory = options.forensics_directory;
+  copy.forensics_time = options.forensics_time;
+  copy.forensics_memory = options.forensics_memory;
+  copy.forensics_queries = options.forensics_queries;
+  return copy;
+}
+
+DecompilationPtr Decompile(std::unique_ptr<llvm::LLVMContext> llvm_ctx,
+                           llvm::Module* module,
+                           const rellic::DecompilationOptions& options) {
+  if (!module) {
+    throw std::runtime_error("Cannot load module");
+  }
+
+  auto result{rellic::Decompile(std::unique_ptr<llvm::Module>(module),
+                                CopyOptions(options))};
+  if (!result.Succeeded()) {
+    throw std::runtime_error(result.TakeError().message);
+  }
+  return std::make_shared<Decompilation>(
+      Decompilation{std::move(llvm_ctx), result.TakeValue()});
+}
+
+DecompilationPtr DecompileFile(const std::string& path,
+                               const rellic::DecompilationOptions& options) {
+  std::unique_ptr<llvm::LLVMContext> llvm_ctx(new llvm::LLVMContext);
+  auto module{rellic::LoadModuleFromFile(llvm_ctx.get(), path, true)};
+  return Decompile(std::move(llvm_ctx), module, options);
+}
+
+DecompilationPtr DecompileBytes(const std::string& data,
+                                const rellic::DecompilationOptions& options) {
+  std::unique_ptr<llvm::LLVMContext> llvm_ctx(new llvm::LLVMContext);
+  auto module{rellic::LoadModuleFromMemory(
+      llvm_ctx.get(), llvm::MemoryBufferRef(data, "module"), true)};
+  return Decompile(std::move(llvm_ctx), module, options);
+}
+
+}  // namespace
+
+PYBIND11_MODULE(rellic, m) {
+  m.doc() = "Decompiles LLVM modules to C";
+
+  // Decompilation logs through glog, which must be initialized once per
+  // process
+  if (!google::IsGoogleLoggingInitialized()) {
+    google::InitGoogleLogging("rellic");
+  }
+
+  py::enum_<rellic::ConditionEngine>(m, "ConditionEngine")
+      .value("Z3", rellic::ConditionEngine::Z3)
+      .value("TruthTable", rellic::ConditionEngine::TruthTable);
+
+  py::enum_<rellic::StructuringEngine>(m, "StructuringEngine")
+      .value("ReachingConditions",
+             rellic::StructuringEngine::ReachingConditions)
+      .value("Patterns", rellic::StructuringEngine::Patterns);
+
+  py::class_<rellic::FunctionSize>(m, "FunctionSize")
+      .def(py::init<>())
+      .def_readwrite("blocks", &rellic::FunctionSize::blocks)
+      .def_readwrite("edges", &rellic::FunctionSize::edges)
+      .def_readwrite("loop_depth", &rellic::FunctionSize::loop_depth)
+      .def_readwrite("switch_cases", &rellic::FunctionSize::switch_cases)
+      .def_readonly("cond_terms", &rellic::FunctionSize::cond_terms)
+      .def("cost", &rellic::FunctionSize::Cost);
+
+  using Options = rellic::DecompilationOptions;
+  py::class_<Options>(m, "DecompilationOptions")
+      .def(py::init<>())
+      .def_readwrite("lower_switches", &Options::lower_switches)
+      .def_readwrite("remove_phi_nodes", &Options::remove_phi_nodes)
+      .def_readwrite("pre_opt", &Options::pre_opt)
+      .def_readwrite("coalesce_phi_nodes", &Options::coalesce_phi_nodes)
+      .def_readwrite("provenance_maps", &Options::provenance_maps)
+      .def_readwrite("compact_ast", &Options::compact_ast)
+      .def_readwrite("keep_module", &Options::keep_module)
+      .def_readwrite("functions", &Options::functions)
+      .def_readwrite("include_callees", &Options::include_callees)
+      .def_readwrite("shard_index", &Options::shard_index)
+      .def_readwrite("num_shards", &Options::num_shards)
+      .def_readwrite("deduplicate_functions", &Options::deduplicate_functions)
+      .def_readwrite("num_threads", &Options::num_threads)
+      .def_readwrite("simplify_threads", &Options::simplify_threads)
+      .def_readwrite("prove_threads", &Options::prove_threads)
+      .def_readwrite("generate_threads", &Options::generate_threads)
+      .def_readwrite("unit_threads", &Options::unit_threads)
+      .def_readwrite("pipeline", &Options::pipeline)
+      .def_readwrite("large_function_limits", &Options::large_function_limits)
+      .def_readwrite("large_function_pipeline",
+                     &Options::large_function_pipeline)
+      .def_readwrite("blob_initializer_size",
+                     &Options::blob_initializer_size)
+      .def_readwrite("cond_var_size", &Options::cond_var_size)
+      .def_readwrite("reach_var_size", &Options::reach_var_size)
+      .def_readwrite("region_unit_size", &Options::region_unit_size)
+      .def_readwrite("structuring", &Options::structuring)
+      .def_readwrite("goto_cond_size", &Options::goto_cond_size)
+      .def_readwrite("goto_timeout", &Options::goto_timeout)
+      .def_readwrite("max_fixpoint_iterations",
+                     &Options::max_fixpoint_iterations)
+      .def_readwrite("module_timeout", &Options::module_timeout)
+      .def_readwrite("function_timeout", &Options::function_timeout)
+      .def_readwrite("memory_limit", &Options::memory_limit)
+      .def_readwrite("z3_timeout", &Options::z3_timeout)
+      .def_readwrite("z3_rlimit", &Options::z3_rlimit)
+      .def_readwrite("condition_engine", &Options::condition_engine)
+      .def_readwrite("rule_timing", &Options::rule_timing)
+      .def_readwrite("checkpoint_out", &Options::checkpoint_out)
+      .def_readwrite("forensics_directory", &Options::forensics_directory)
+      .def_readwrite("forensics_time", &Options::forensics_time)
+      .def_readwrite("forensics_memory", &Options::forensics_memory)
+      .def_readwrite("forensics_queries", &Options::forensics_queries)
+      .def_readwrite("resume_from", &Options::resume_from);
+
+  py::class_<rellic::ASTPassStatistics>(m, "ASTPassStatistics")
+      .def_readonly("num_runs", &rellic::ASTPassStatistics::num_runs)
+      .def_readonly("num_changes", &rellic::ASTPassStatistics::num_changes)
+      .def_readonly("elapsed", &rellic::ASTPassStatistics::elapsed)
+      .def_readonly("num_cycles", &rellic::ASTPassStatistics::num_cycles)
+      .def_readonly("ast_bytes", &rellic::ASTPassStatistics::ast_bytes)
+      .def_readonly("ast_nodes", &rellic::ASTPassStatistics::ast_nodes)
+      .def_readonly("z3_exprs", &rellic::ASTPassStatistics::z3_exprs);
+
+  py::class_<rellic::PassStatistics::Pass>(m, "Pass")
+      .def_readonly("name", &rellic::PassStatistics::Pass::name)
+      .def_readonly("stats", &rellic::PassStatistics::Pass::stats);
+
+  py::class_<rellic::PassStatistics::Stage>(m, "Stage")
+      .def_readonly("name", &rellic::PassStatistics::Stage::name)
+      .def_readonly("num_iterations",
+                    &rellic::PassStatistics::Stage::num_iterations)
+      .def_readonly("truncated", &rellic::PassStatistics::Stage::truncated)
+      .def_readonly("stats", &rellic::PassStatistics::Stage::stats)
+      .def_readonly("passes", &rellic::PassStatistics::Stage::passes);
+
+  py::class_<rellic::MemoryUsage>(m, "MemoryUsage")
+      .def_readonly("ast", &rellic::MemoryUsage::ast)
+      .def_readonly("z3", &rellic::MemoryUsage::z3)
+      .def_readonly("tables", &rellic::MemoryUsage::tables)
+      .def("total", &rellic::MemoryUsage::Total);
+
+  py::class_<rellic::ProverStatistics>(m, "ProverStatistics")
+      .def_readonly("num_proofs", &rellic::ProverStatistics::num_proofs)
+      .def_readonly("num_simplifications",
+                    &rellic::ProverStatistics::num_simplifications)
+      .def_readonly("num_cached", &rellic::ProverStatistics::num_cached)
+      .def_readonly("num_syntactic", &rellic::ProverStatistics::num_syntactic)
+      .def_readonly("num_truth_tables",
+                    &rellic::ProverStatistics::num_truth_tables)
+      .def_readonly("num_limit_hits",
+                    &rellic::ProverStatistics::num_limit_hits)
+      .def_readonly("num_interrupted",
+                    &rellic::ProverStatistics::num_interrupted);
+
+  py::class_<rellic::RuleStatistics>(m, "RuleStatistics")
+      .def_readonly("num_attempts", &rellic::RuleStatistics::num_attempts)
+      .def_readonly("num_matches", &rellic::RuleStatistics::num_matches)
+      .def_readonly("num_fires", &rellic::RuleStatistics::num_fires)
+      .def_readonly("match_elapsed", &rellic::RuleStatistics::match_elapsed)
+      .def_readonly("fire_elapsed", &rellic::RuleStatistics::fire_elapsed);
+
+  py::class_<rellic::FunctionMetrics>(m, "FunctionMetrics")
+      .def_readonly("name", &rellic::FunctionMetrics::name)
+      .def_readonly("size", &rellic::FunctionMetrics::size)
+      .def_readonly("elapsed", &rellic::FunctionMetrics::elapsed)
+      .def_readonly("memory", &rellic::FunctionMetrics::memory)
+      .def_readonly("timed_out", &rellic::FunctionMetrics::timed_out);
+
+  py::class_<rellic::PassStatistics>(m, "PassStatistics")
+      .def_readonly("stages", &rellic::PassStatistics::stages)
+      .def_readonly("peak_memory", &rellic::PassStatistics::peak_memory)
+      .def_readonly("prover", &rellic::PassStatistics::prover)
+      .def_readonly("rules", &rellic::PassStatistics::rules)
+      .def_readonly("functions", &rellic::PassStatistics::functions);
+
+  py::class_<Value>(m, "Value")
+      .def_property_readonly("name",
+                             [](const Value& v) {
+                               return v.value->getName().str();
+                             })
+      .def_property_readonly("code",
+                             [](const Value& v) { return PrintValue(v.value); })
+      .def("__eq__",
+           [](const Value& a, const Value& b) { return a.value == b.value; })
+      .def("__hash__", [](const Value& v) { return py::hash(GetId(v.value)); });
+
+  py::class_<Stmt>(m, "Stmt")
+      .def_property_readonly(
+          "kind", [](const Stmt& s) { return s.stmt->getStmtClassName(); })
+      .def_property_readonly(
+          "code",
+          [](const Stmt& s) {
+            return Print(*s.owner, [&s](rellic::CPrinter& printer) {
+              printer.PrintStmt(s.stmt, 0);
+            });
+          })
+      .def_property_readonly("children",
+                             [](const Stmt& s) {
+                               std::vector<Stmt> children;
+                               for (auto child : s.stmt->children()) {
+                                 if (child) {
+                                   children.push_back({s.owner, child});
+                                 }
+                               }
+                               return children;
+                             })
+      // The IR value the statement was generated from, if provenance maps
+      // were requested
+      .def_property_readonly("value",
+                             [](const Stmt& s) {
+                               return GetValue(
+                                   s.owner,
+                                   s.owner->result.stmt_provenance.Lookup(
+                                       s.stmt));
+                             })
+      .def("__eq__",
+           [](const Stmt& a, const Stmt& b) { return a.stmt == b.stmt; })
+      .def("__hash__", [](const Stmt& s) { return py::hash(GetId(s.stmt)); });
+
+  py::class_<Function>(m, "Function")
+      .def_property_readonly(
+          "name", [](const Function& f) { return f.decl->getNameAsString(); })
+      .def_property_readonly(
+          "code",
+          [](const Function& f) {
+            return Print(*f.owner, [&f](rellic::CPrinter& printer) {
+              printer.PrintDecl(f.decl);
+            });
+          })
+      .def_property_readonly("body",
+                             [](const Function& f) {
+                               return Stmt{f.owner, f.decl->getBody()};
+                             })
+      // The LLVM function the definition was generated from, if provenance
+      // maps were requested
+      .def_property_readonly("value", [](const Function& f) {
+        return GetValue(f.owner,
+                        f.owner->result.value_decls.InverseLookup(f.decl));
+      });
+
+  py::class_<Decompilation, DecompilationPtr>(m, "DecompilationResult")
+      .def_property_readonly(
+          "code",
+          [](Decompilation& dec) {
+            return Print(dec, [](rellic::CPrinter& printer) {
+              printer.PrintTranslationUnit();
+            });
+          })
+      // The function definitions of the translation unit, in order
+      .def_property_readonly(
+          "functions",
+          [](const DecompilationPtr& dec) {
+            std::vector<Function> functions;
+            auto tu{dec->result.ast->getASTContext().getTranslationUnitDecl()};
+            for (auto decl : tu->decls()) {
+              auto func{clang::dyn_cast<clang::FunctionDecl>(decl)};
+              if (func && func->hasBody()) {
+                functions.push_back({dec, func});
+              }
+            }
+            return functions;
+          })
+      // The statements that have a known provenance, along with the IR value
+      // each one was generated from
+      .def_property_readonly(
+          "provenance",
+          [](const DecompilationPtr& dec) {
+            std::vector<std::pair<Stmt, Value>> provenance;
+            for (auto [stmt, value] : dec->result.stmt_provenance.Forward()) {
+              if (value) {
+                provenance.push_back({{dec, stmt}, {dec, value}});
+              }
+            }
+            return provenance;
+          })
+      .def_property_readonly(
+          "function_errors",
+          [](const Decompilation& dec) {
+            std::vector<std::pair<std::string, std::string>> errors;
+            for (auto& error : dec.result.function_errors) {
+              errors.emplace_back(error.name, error.message);
+            }
+            return errors;
+          })
+      .def_property_readonly(
+          "statistics",
+          [](const Decompilation& dec) -> const rellic::PassStatistics& {
+            return dec.result.statistics;
+          },
+          py::return_value_policy::reference_internal);
+
+  m.def("decompile", &DecompileFile, py::arg("path"),
+        py::arg("options") = rellic::DecompilationOptions(),
+        py::call_guard<py::gil_scoped_release>(),
+        "Decompiles the bitcode or textual IR file at `path`");
+  m.def(
+      "decompile_bytes",
+      [](py::bytes data, const rellic::DecompilationOptions& options) {
+        std::string buffer{data};
+        py::gil_scoped_release release;
+        return DecompileBytes(buffer, options);
+      },
+      py::arg("data"), py::arg("options") = rellic::DecompilationOptions(),
+      "Decompiles the bitcode or textual IR in `data`");
+}
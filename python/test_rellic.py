@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (c) 2022-present, Trail of Bits, Inc.
+# All rights reserved.
+#
+# This source code is licensed in accordance with the terms specified in
+# the LICENSE file found in the root directory of this source tree.
+#
+
+import datetime
+import unittest
+
+import rellic
+
+MODULE = b"""
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @twice(i32 %x) {
+entry:
+  %res = mul i32 %x, 2
+  ret i32 %res
+}
+
+define i32 @call_twice(i32 %x) {
+entry:
+  %res = call i32 @twice(i32 %x)
+  ret i32 %res
+}
+"""
+
+
+class TestDecompile(unittest.TestCase):
+    def test_functions(self):
+        result = rellic.decompile_bytes(MODULE)
+        names = [func.name for func in result.functions]
+        self.assertEqual(names, ["twice", "call_twice"])
+        for func in result.functions:
+            self.assertIn(func.code, result.code)
+        self.assertEqual(result.function_errors, [])
+
+    def test_options(self):
+        options = rellic.DecompilationOptions()
+        options.functions = {"twice"}
+        options.module_timeout = datetime.timedelta(seconds=30)
+        result = rellic.decompile_bytes(MODULE, options)
+        self.assertEqual([func.name for func in result.functions], ["twice"])
+
+    def test_provenance(self):
+        options = rellic.DecompilationOptions()
+        options.provenance_maps = True
+        result = rellic.decompile_bytes(MODULE, options)
+        self.assertTrue(result.provenance)
+        for stmt, value in result.provenance:
+            self.assertEqual(stmt.value, value)
+        func = result.functions[0]
+        self.assertEqual(func.value.name, "twice")
+        self.assertEqual(func.body.kind, "CompoundStmt")
+
+    def test_statistics(self):
+        result = rellic.decompile_bytes(MODULE)
+        stats = result.statistics
+        self.assertTrue(stats.stages)
+        self.assertEqual(len(stats.functions), 2)
+        self.assertGreater(stats.peak_memory.total(), 0)
+
+    def test_objects_outlive_result(self):
+        body = rellic.decompile_bytes(MODULE).functions[0].body
+        self.assertIn("return", body.code)
+
+    def test_invalid_module(self):
+        with self.assertRaises(RuntimeError):
+            rellic.decompile_bytes(b"not a module")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -4,6 +4,10 @@ import unittest
 import subprocess
 import argparse
 import tempfile
+import threading
+import platform
+import json
+import time
 import os
 import sys
 
@@ -33,6 +37,139 @@ def run_cmd(cmd, timeout):
     return p
 
 
+class Measurement:
+    def __init__(self, stdout, stderr, returncode, elapsed, memory):
+        self.stdout = stdout
+        self.stderr = stderr
+        self.returncode = returncode
+        # Wall time in seconds and peak resident set size in bytes
+        self.elapsed = elapsed
+        self.memory = memory
+
+
+def run_measured(cmd, timeout):
+    """Like run_cmd, but also measures the time and memory used by the command.
+    The child is waited for with wait4 so that its peak memory is not mixed up
+    with that of other children."""
+    with tempfile.TemporaryFile() as out, tempfile.TemporaryFile() as err:
+        start = time.monotonic()
+        try:
+            proc = subprocess.Popen(cmd, stdout=out, stderr=err)
+        except FileNotFoundError as e:
+            raise RunError('Error: No such file or directory: "' + e.filename + '"')
+        except PermissionError as e:
+            raise RunError('Error: File "' + e.filename + '" is not an executable.')
+
+        timed_out = threading.Event()
+
+        def kill():
+            timed_out.set()
+            proc.kill()
+
+        timer = threading.Timer(timeout, kill) if timeout else None
+        if timer:
+            timer.start()
+        try:
+            _, status, usage = os.wait4(proc.pid, 0)
+        finally:
+            if timer:
+                timer.cancel()
+        elapsed = time.monotonic() - start
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        if timed_out.is_set():
+            raise subprocess.TimeoutExpired(cmd, timeout)
+
+        out.seek(0)
+        err.seek(0)
+        # Linux reports kilobytes, macOS bytes
+        scale = 1 if sys.platform == "darwin" else 1024
+        return Measurement(
+            out.read().decode(errors="replace"),
+            err.read().decode(errors="replace"),
+            proc.returncode,
+            elapsed,
+            usage.ru_maxrss * scale,
+        )
+
+
+class PerfConfig:
+    """Time and memory budgets of each case, and the baseline that the
+    decompilation of each case is compared against in perf-regression mode"""
+
+    def __init__(self):
+        # Budgets by test name, with "default" applying to the others
+        self.budgets = {}
+        self.baseline = None
+        self.time_tolerance = 0.2
+        self.memory_tolerance = 0.2
+        # Differences below these are noise, whatever their ratio
+        self.min_time_delta = 0.05
+        self.min_memory_delta = 16 << 20
+        self.repeat = 1
+        # Where the measurements are written once all tests have run
+        self.record = None
+        self.results = {}
+        self.lock = threading.Lock()
+
+    def measuring(self):
+        return bool(self.budgets) or self.baseline is not None or self.record
+
+    def check(self, test, case, m):
+        name = os.path.splitext(os.path.basename(case.split(" ")[0]))[0]
+        budget = self.budgets.get(name, self.budgets.get("default", {}))
+        if "time_s" in budget:
+            test.assertLessEqual(
+                m.elapsed,
+                budget["time_s"],
+                "%s: decompilation took %.2fs, over its budget of %.2fs"
+                % (case, m.elapsed, budget["time_s"]),
+            )
+        if "memory_mb" in budget:
+            test.assertLessEqual(
+                m.memory,
+                budget["memory_mb"] << 20,
+                "%s: decompilation used %.1f MiB, over its budget of %d MiB"
+                % (case, m.memory / (1 << 20), budget["memory_mb"]),
+            )
+
+        with self.lock:
+            self.results[case] = {"time_s": m.elapsed, "memory": m.memory}
+
+        if self.baseline is None:
+            return
+        base = self.baseline["cases"].get(case)
+        if base is None:
+            return
+        limit = max(
+            base["time_s"] * (1 + self.time_tolerance),
+            base["time_s"] + self.min_time_delta,
+        )
+        test.assertLessEqual(
+            m.elapsed,
+            limit,
+            "%s: decompilation took %.3fs, %.0f%% slower than the baseline of %.3fs"
+            % (case, m.elapsed, (m.elapsed / base["time_s"] - 1) * 100, base["time_s"]),
+        )
+        limit = max(
+            base["memory"] * (1 + self.memory_tolerance),
+            base["memory"] + self.min_memory_delta,
+        )
+        test.assertLessEqual(
+            m.memory,
+            limit,
+            "%s: decompilation used %.1f MiB, more than the baseline of %.1f MiB"
+            % (case, m.memory / (1 << 20), base["memory"] / (1 << 20)),
+        )
+
+
+perf = PerfConfig()
+
+
+def machine_class():
+    """Baselines are only comparable between machines of the same class"""
+    return "%s-%s-%d" % (platform.system(), platform.machine(), os.cpu_count())
+
+
 def compile(self, clang, input, output, timeout, options=None):
     cmd = []
     cmd.append(clang)
@@ -49,22 +186,33 @@ def compile(self, clang, input, output, timeout, options=None):
     return p
 
 
-def decompile(self, rellic, input, output, timeout):
+def decompile(self, rellic, input, output, timeout, options=None, case=None):
     cmd = [rellic]
+    if options is not None:
+        cmd.extend(options)
     cmd.extend(
         ["--input", input, "--output", output]
     )
-    p = run_cmd(cmd, timeout)
+    if not perf.measuring() or case is None:
+        p = run_cmd(cmd, timeout)
+    else:
+        # The fastest of several runs is the least noisy measurement of time,
+        # while memory is stable from one run to the next
+        runs = [run_measured(cmd, timeout) for _ in range(max(perf.repeat, 1))]
+        p = min(runs, key=lambda m: m.elapsed)
 
     self.assertEqual(p.returncode, 0, "rellic-decomp failure: %s" % p.stderr)
     self.assertEqual(
         len(p.stderr), 0, "errors or warnings during decompilation: %s" % p.stderr
     )
 
+    if isinstance(p, Measurement):
+        perf.check(self, case, p)
+
     return p
 
 
-def roundtrip(self, rellic, filename, clang, timeout, translate_only, general_flags, binary_compile_flags, bitcode_compile_flags, recompile_flags):
+def roundtrip(self, rellic, filename, clang, timeout, translate_only, general_flags, binary_compile_flags, bitcode_compile_flags, recompile_flags, decomp_flags=None):
     with tempfile.TemporaryDirectory() as tempdir:
         out1 = os.path.join(tempdir, "out1")
         compile(self, clang, filename, out1, timeout, general_flags + binary_compile_flags)
@@ -77,7 +225,8 @@ def roundtrip(self, rellic, filename, clang, timeout, translate_only, general_fl
         compile(self, clang, filename, rt_bc, timeout, general_flags + bitcode_compile_flags + flags)
 
         rt_c = os.path.join(tempdir, "rt.c")
-        decompile(self, rellic, rt_bc, rt_c, timeout)
+        case = " ".join([os.path.basename(filename)] + bitcode_compile_flags)
+        decompile(self, rellic, rt_bc, rt_c, timeout, decomp_flags, case)
 
         # ensure there is a C output file
         self.assertTrue(os.path.exists(rt_c))
@@ -113,16 +262,46 @@ if __name__ == "__main__":
     parser.add_argument("-t", "--timeout", help="set timeout in seconds", type=int)
     parser.add_argument(
         "--cflags", help="additional CFLAGS", action='append', default=[], type=str)
+    parser.add_argument(
+        "--decomp-flags", help="additional rellic-decomp flags", action='append', default=[], type=str)
+    parser.add_argument(
+        "--budgets", help="JSON file of time and memory budgets for the decompilation of each test")
+    parser.add_argument(
+        "--perf-baseline", help="JSON file of measurements to compare the decompilation of each test against")
+    parser.add_argument(
+        "--perf-record", help="JSON file in which to record the measurements, to be used as a baseline")
+    parser.add_argument(
+        "--perf-tolerance", help="fail tests that are this many percent slower than the baseline", type=float, default=20)
+    parser.add_argument(
+        "--perf-memory-tolerance", help="fail tests that use this many percent more memory than the baseline", type=float, default=20)
+    parser.add_argument(
+        "--perf-repeat", help="decompile each test this many times and keep the fastest run", type=int, default=1)
 
     args = parser.parse_args()
 
+    if args.budgets:
+        with open(args.budgets) as f:
+            perf.budgets = json.load(f)
+    if args.perf_baseline:
+        with open(args.perf_baseline) as f:
+            perf.baseline = json.load(f)
+        if perf.baseline.get("machine") != machine_class():
+            sys.exit(
+                "Baseline %s was recorded on %s, not on %s"
+                % (args.perf_baseline, perf.baseline.get("machine"), machine_class())
+            )
+    perf.record = args.perf_record
+    perf.time_tolerance = args.perf_tolerance / 100
+    perf.memory_tolerance = args.perf_memory_tolerance / 100
+    perf.repeat = args.perf_repeat
+
     def test_generator(path):
         def test(self):
-            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], []     , [])
-            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O1"], [])
-            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O2"], [])
-            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O3"], [])
-            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-g3"], [])
+            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], []     , [], args.decomp_flags)
+            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O1"], [], args.decomp_flags)
+            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O2"], [], args.decomp_flags)
+            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O3"], [], args.decomp_flags)
+            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-g3"], [], args.decomp_flags)
 
         return test
 
@@ -135,4 +314,8 @@ if __name__ == "__main__":
                 test = test_generator(item.path)
                 setattr(TestRoundtrip, test_name, test)
 
-    unittest.main(argv=[sys.argv[0]])
+    program = unittest.main(argv=[sys.argv[0]], exit=False)
+    if perf.record:
+        with open(perf.record, "w") as f:
+            json.dump({"machine": machine_class(), "cases": perf.results}, f, indent=2, sort_keys=True)
+    sys.exit(0 if program.result.wasSuccessful() else 1)
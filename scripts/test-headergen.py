@@ -49,11 +49,13 @@ def compile(self, clang, input, output, timeout, options=None):
     return p
 
 
-def genlayout(self, rellic, input, output, timeout):
+def genlayout(self, rellic, input, output, timeout, options=None):
     cmd = [rellic]
     cmd.extend(
         ["--input", input, "--output", output]
     )
+    if options is not None:
+        cmd.extend(options)
     p = run_cmd(cmd, timeout)
 
     self.assertEqual(
@@ -70,18 +72,20 @@ def roundtrip(self, rellic, filename, clang, timeout, cflags):
         flags = ["-c", "-emit-llvm", "-g3"]
         compile(self, clang, filename, rt_bc, timeout, cflags + flags)
 
-        rt_c = os.path.join(tempdir, "rt.c")
-        genlayout(self, rellic, rt_bc, rt_c, timeout)
+        # Declarations generated in parallel must compile as well
+        for threads in ["1", "4"]:
+            rt_c = os.path.join(tempdir, "rt.c")
+            genlayout(self, rellic, rt_bc, rt_c, timeout, ["--threads", threads])
 
-        # ensure there is a C output file
-        self.assertTrue(os.path.exists(rt_c))
+            # ensure there is a C output file
+            self.assertTrue(os.path.exists(rt_c))
 
-        # ensure the file has some C
-        self.assertTrue(os.path.getsize(rt_c) > 0)
+            # ensure the file has some C
+            self.assertTrue(os.path.getsize(rt_c) > 0)
 
-        # We should recompile, lets see how this goes
-        out2 = os.path.join(tempdir, "out2")
-        compile(self, clang, rt_c, out2, timeout, cflags + ["-c", "-Wno-everything"])
+            # We should recompile, lets see how this goes
+            out2 = os.path.join(tempdir, "out2")
+            compile(self, clang, rt_c, out2, timeout, cflags + ["-c", "-Wno-everything"])
 
 
 class TestRoundtrip(unittest.TestCase):
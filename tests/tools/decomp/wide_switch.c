@@ -0,0 +1,41 @@
+int printf(const char *, ...);
+
+int classify(unsigned c) {
+  int kind = 0;
+  switch (c) {
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      kind = 1;
+      break;
+    case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g':
+    case 'h': case 'i': case 'j': case 'k': case 'l': case 'm': case 'n':
+    case 'o': case 'p': case 'q': case 'r': case 's': case 't': case 'u':
+    case 'v': case 'w': case 'x': case 'y': case 'z':
+      kind = 2;
+      break;
+    case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G':
+    case 'H': case 'I': case 'J': case 'K': case 'L': case 'M': case 'N':
+    case 'O': case 'P': case 'Q': case 'R': case 'S': case 'T': case 'U':
+    case 'V': case 'W': case 'X': case 'Y': case 'Z':
+      kind = 3;
+      break;
+    case ' ': case '\t': case '\n':
+      kind = 4;
+      break;
+    case '(': case ')': case '[': case ']': case '{': case '}':
+      kind = 5;
+      break;
+  }
+  return kind;
+}
+
+int main(void) {
+  int counts[6] = {0};
+  for (unsigned c = 0; c < 128; ++c) {
+    counts[classify(c)]++;
+  }
+  for (int i = 0; i < 6; ++i) {
+    printf("%d\n", counts[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,866 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "rellic/AST/CPrinter.h"
+#include "rellic/BC/Util.h"
+#include "rellic/Decompiler.h"
+#include "rellic/Version.h"
+
+DEFINE_string(corpus, "",
+              "Directory searched recursively for the .bc and .ll files to "
+              "decompile.");
+DEFINE_uint32(max_files, 0,
+              "Only decompile the first this many files of the corpus, in "
+              "path order (0 means all of them).");
+DEFINE_uint32(jobs, 0,
+              "Number of files decompiled at once (0 means one per hardware "
+              "thread).");
+DEFINE_uint32(slowest, 10, "Number of slowest files listed in the report.");
+DEFINE_string(output, "",
+              "JSON file in which the aggregate report is written, for CI to "
+              "track across commits.");
+DEFINE_string(files_output, "",
+              "JSONL file in which the outcome of each file is recorded.");
+DEFINE_bool(remove_phi_nodes, false,
+            "Remove PHINodes from input bitcode before decompilation.");
+DEFINE_bool(lower_switch, false,
+            "Remove SwitchInst by lowering them to branches.");
+DEFINE_string(pipeline, "full", "Refinement pipeline, as in rellic-decomp.");
+DEFINE_uint64(timeout, 0,
+              "Time budget of each file, in milliseconds. 0 means no limit.");
+DEFINE_uint64(memory_limit, 0,
+              "Memory budget of each file, in megabytes. 0 means no limit.");
+DEFINE_uint32(z3_timeout, 0,
+              "Time limit of each Z3 query, in milliseconds. 0 means no "
+              "limit.");
+DEFINE_string(compare_pipeline, "",
+              "Compares the refinement pipeline given by --pipeline, as the "
+              "baseline, with this one, as the candidate.");
+DEFINE_string(baseline_binary, "",
+              "rellic-decomp binary used as the baseline of a comparison "
+              "with --candidate_binary.");
+DEFINE_string(candidate_binary, "",
+              "Compares the rellic-decomp binary given by --baseline_binary "
+              "with this one, by running both on every file.");
+DEFINE_string(binary_args, "",
+              "Space-separated arguments passed to both binaries, besides "
+              "--input and --output.");
+DEFINE_uint32(runs, 3,
+              "Number of times each side of a comparison decompiles each "
+              "file.");
+
+namespace {
+// The outcome of decompiling a file of the corpus
+struct FileResult {
+  std::string input;
+  // "ok", "partial" if some function definitions could not be decompiled, or
+  // "error"
+  const char* status{"error"};
+  std::string error;
+  size_t num_functions{0};
+  // From loading the module to the end of refinement
+  std::chrono::nanoseconds duration{0};
+  rellic::PassStatistics statistics;
+};
+
+// Time spent in a pass over the whole corpus. Passes that appear in several
+// stages of the pipeline are added together.
+struct PassTotals {
+  size_t num_runs{0};
+  size_t num_changes{0};
+  std::chrono::nanoseconds elapsed{0};
+};
+
+static double ToMs(std::chrono::nanoseconds duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static int64_t ToInt(size_t value) { return static_cast<int64_t>(value); }
+
+// Paths and error messages may come from anywhere, but JSON strings must be
+// valid UTF-8
+static std::string ToJSONString(const std::string& str) {
+  return llvm::json::isUTF8(str) ? str : llvm::json::fixUTF8(str);
+}
+
+static std::vector<std::string> GetCorpus(const std::string& corpus) {
+  std::vector<std::string> inputs;
+  std::error_code ec;
+  for (llvm::sys::fs::recursive_directory_iterator it(corpus, ec), end;
+       !ec && it != end; it.increment(ec)) {
+    auto ext{llvm::sys::path::extension(it->path())};
+    if (ext == ".bc" || ext == ".ll") {
+      inputs.push_back(it->path());
+    }
+  }
+  CHECK(!ec) << "Cannot list " << corpus << ": " << ec.message();
+  std::sort(inputs.begin(), inputs.end());
+  if (FLAGS_max_files && inputs.size() > FLAGS_max_files) {
+    inputs.resize(FLAGS_max_files);
+  }
+  return inputs;
+}
+
+static rellic::DecompilationOptions GetOptions() {
+  rellic::DecompilationOptions opts{};
+  opts.remove_phi_nodes = FLAGS_remove_phi_nodes;
+  opts.lower_switches = FLAGS_lower_switch;
+  opts.pipeline = FLAGS_pipeline;
+  opts.module_timeout = std::chrono::milliseconds(FLAGS_timeout);
+  opts.memory_limit = FLAGS_memory_limit << 20;
+  opts.z3_timeout = FLAGS_z3_timeout;
+  opts.keep_module = false;
+  return opts;
+}
+
+static FileResult DecompileFile(rellic::Decompiler& decompiler,
+                                const std::string& input) {
+  FileResult result;
+  result.input = input;
+  auto start{std::chrono::steady_clock::now()};
+
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module{
+      rellic::LoadModuleFromFile(&llvm_ctx, input, /*allow_failure=*/true)};
+  if (!module) {
+    result.error = "Cannot load module";
+  } else {
+    for (auto& func : *module) {
+      result.num_functions += !func.isDeclaration();
+    }
+    auto decompiled{decompiler.Decompile(std::move(module), GetOptions())};
+    if (!decompiled.Succeeded()) {
+      result.error = decompiled.TakeError().message;
+    } else {
+      auto value{decompiled.TakeValue()};
+      result.status = value.function_errors.empty() ? "ok" : "partial";
+      result.statistics = std::move(value.statistics);
+    }
+  }
+  result.duration = std::chrono::steady_clock::now() - start;
+  return result;
+}
+
+static llvm::json::Object FileToJSON(const FileResult& result) {
+  llvm::json::Object obj{{"input", ToJSONString(result.input)},
+                         {"status", result.status},
+                         {"functions", ToInt(result.num_functions)},
+                         {"duration_ms", ToMs(result.duration)},
+                         {"peak_memory",
+                          ToInt(result.statistics.peak_memory.Total())}};
+  if (!result.error.empty()) {
+    obj["error"] = ToJSONString(result.error);
+  }
+  return obj;
+}
+
+// Latency under which `p` percent of the files were decompiled, by the
+// nearest-rank method. `sorted` must not be empty.
+static std::chrono::nanoseconds Percentile(
+    const std::vector<std::chrono::nanoseconds>& sorted, unsigned p) {
+  auto rank{(sorted.size() * p + 99) / 100};
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+// Highest resident set size of the process so far
+static size_t GetPeakRSS() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  // Linux reports kilobytes
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+static llvm::json::Object Summarize(std::vector<FileResult>& results,
+                                    std::chrono::nanoseconds wall_time) {
+  size_t num_ok{0}, num_partial{0}, num_errors{0}, num_functions{0};
+  size_t peak_memory{0};
+  std::vector<std::chrono::nanoseconds> durations;
+  std::map<std::string, PassTotals> passes;
+  for (auto& result : results) {
+    llvm::StringRef status{result.status};
+    num_ok += status == "ok";
+    num_partial += status == "partial";
+    num_errors += status == "error";
+    num_functions += result.num_functions;
+    durations.push_back(result.duration);
+    peak_memory = std::max(peak_memory, result.statistics.peak_memory.Total());
+    for (auto& stage : result.statistics.stages) {
+      for (auto& pass : stage.passes) {
+        auto& totals{passes[pass.name]};
+        totals.num_runs += pass.stats.num_runs;
+        totals.num_changes += pass.stats.num_changes;
+        totals.elapsed += pass.stats.elapsed;
+      }
+    }
+  }
+  std::sort(durations.begin(), durations.end());
+
+  auto seconds{std::chrono::duration<double>(wall_time).count()};
+  llvm::json::Object latency;
+  if (!durations.empty()) {
+    std::chrono::nanoseconds total{0};
+    for (auto duration : durations) {
+      total += duration;
+    }
+    latency = llvm::json::Object{
+        {"p50_ms", ToMs(Percentile(durations, 50))},
+        {"p95_ms", ToMs(Percentile(durations, 95))},
+        {"p99_ms", ToMs(Percentile(durations, 99))},
+        {"max_ms", ToMs(durations.back())},
+        {"mean_ms", ToMs(total) / durations.size()}};
+  }
+
+  std::vector<std::pair<std::string, PassTotals>> sorted_passes(
+      passes.begin(), passes.end());
+  std::stable_sort(sorted_passes.begin(), sorted_passes.end(),
+                   [](auto& a, auto& b) {
+                     return a.second.elapsed > b.second.elapsed;
+                   });
+  llvm::json::Array pass_times;
+  for (auto& [name, totals] : sorted_passes) {
+    pass_times.push_back(
+        llvm::json::Object{{"name", name},
+                           {"runs", ToInt(totals.num_runs)},
+                           {"changes", ToInt(totals.num_changes)},
+                           {"elapsed_ms", ToMs(totals.elapsed)}});
+  }
+
+  std::stable_sort(results.begin(), results.end(),
+                   [](const FileResult& a, const FileResult& b) {
+                     return a.duration > b.duration;
+                   });
+  llvm::json::Array slowest;
+  for (size_t i{0}; i < results.size() && i < FLAGS_slowest; ++i) {
+    slowest.push_back(FileToJSON(results[i]));
+  }
+
+  return llvm::json::Object{
+      {"commit", rellic::Version::GetCommitHash()},
+      {"jobs", FLAGS_jobs},
+      {"pipeline", FLAGS_pipeline},
+      {"files", ToInt(results.size())},
+      {"ok", ToInt(num_ok)},
+      {"partial", ToInt(num_partial)},
+      {"errors", ToInt(num_errors)},
+      {"functions", ToInt(num_functions)},
+      {"wall_time_s", seconds},
+      {"files_per_second", seconds ? results.size() / seconds : 0.0},
+      {"functions_per_second", seconds ? num_functions / seconds : 0.0},
+      {"latency", std::move(latency)},
+      {"passes", std::move(pass_times)},
+      {"peak_memory",
+       llvm::json::Object{{"rss", ToInt(GetPeakRSS())},
+                          {"context", ToInt(peak_memory)}}},
+      {"slowest", std::move(slowest)}};
+}
+
+static void PrintSummary(const llvm::json::Object& summary) {
+  auto& os{llvm::outs()};
+  auto Get = [&summary](const char* key) {
+    return summary.getNumber(key).getValueOr(0);
+  };
+  os << llvm::format("%.0f files (%.0f ok, %.0f partial, %.0f errors), ",
+                     Get("files"), Get("ok"), Get("partial"), Get("errors"))
+     << llvm::format("%.0f functions in %.2fs\n", Get("functions"),
+                     Get("wall_time_s"));
+  os << llvm::format("Throughput: %.2f functions/s, %.2f files/s\n",
+                     Get("functions_per_second"), Get("files_per_second"));
+
+  auto latency{summary.getObject("latency")};
+  if (latency && !latency->empty()) {
+    auto GetMs = [latency](const char* key) {
+      return latency->getNumber(key).getValueOr(0);
+    };
+    os << llvm::format(
+        "Latency: p50 %.1fms, p95 %.1fms, p99 %.1fms, max %.1fms\n",
+        GetMs("p50_ms"), GetMs("p95_ms"), GetMs("p99_ms"), GetMs("max_ms"));
+  }
+
+  auto memory{summary.getObject("peak_memory")};
+  os << llvm::format("Peak memory: %.1f MiB resident, %.1f MiB per context\n",
+                     memory->getNumber("rss").getValueOr(0) / (1 << 20),
+                     memory->getNumber("context").getValueOr(0) / (1 << 20));
+
+  os << "\nPass                            Time (ms)      Runs   Changes\n";
+  for (auto& value : *summary.getArray("passes")) {
+    auto pass{value.getAsObject()};
+    os << llvm::format("%-30s %10.1f %9.0f %9.0f\n",
+                       pass->getString("name").getValueOr("").str().c_str(),
+                       pass->getNumber("elapsed_ms").getValueOr(0),
+                       pass->getNumber("runs").getValueOr(0),
+                       pass->getNumber("changes").getValueOr(0));
+  }
+
+  os << "\nSlowest files:\n";
+  for (auto& value : *summary.getArray("slowest")) {
+    auto file{value.getAsObject()};
+    os << llvm::format("%10.1fms  %-8s ",
+                       file->getNumber("duration_ms").getValueOr(0),
+                       file->getString("status").getValueOr("").str().c_str())
+       << file->getString("input").getValueOr("") << '\n';
+  }
+}
+
+// One side of a comparison: a refinement pipeline run in this process, or a
+// rellic-decomp binary run on every file
+struct Side {
+  std::string pipeline;
+  std::string binary;
+};
+
+// A comparison between a baseline and a candidate
+struct Comparison {
+  Side baseline;
+  Side candidate;
+  std::vector<std::string> binary_args;
+  // Where the binaries write their outputs
+  std::string directory;
+};
+
+// The outcome of decompiling a file once, for a comparison
+struct Attempt {
+  bool succeeded{false};
+  std::chrono::nanoseconds duration{0};
+  std::string output;
+};
+
+// Mean of a sample along with the half-width of its 95% confidence interval,
+// which is zero for fewer than two values
+struct Interval {
+  size_t num_values{0};
+  double mean{0};
+  double margin{0};
+};
+
+// The outcome of comparing both sides on a file of the corpus
+struct FileComparison {
+  std::string input;
+  // "identical" or "different" if both sides succeeded, or "baseline_only",
+  // "candidate_only" or "both_failed"
+  const char* outputs{"both_failed"};
+  std::vector<Attempt> baseline;
+  std::vector<Attempt> candidate;
+  // Natural logarithm of the ratio of the duration of the baseline to that of
+  // the candidate, over the pairs of runs in which both sides succeeded
+  Interval log_speedup;
+};
+
+// Decompiles `input` with `pipeline`, timing `Decompile` alone so that loading
+// and printing, which both sides share, do not dilute the difference
+static Attempt RunPipeline(rellic::Decompiler& decompiler,
+                           const std::string& input,
+                           const std::string& pipeline) {
+  Attempt attempt;
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module{
+      rellic::LoadModuleFromFile(&llvm_ctx, input, /*allow_failure=*/true)};
+  if (!module) {
+    return attempt;
+  }
+
+  auto opts{GetOptions()};
+  opts.pipeline = pipeline;
+  auto start{std::chrono::steady_clock::now()};
+  auto decompiled{decompiler.Decompile(std::move(module), std::move(opts))};
+  attempt.duration = std::chrono::steady_clock::now() - start;
+  if (!decompiled.Succeeded()) {
+    return attempt;
+  }
+
+  auto value{decompiled.TakeValue()};
+  llvm::raw_string_ostream os(attempt.output);
+  rellic::PrintTranslationUnit(os, value.ast->getASTContext(), {}, 1);
+  os.flush();
+  attempt.succeeded = true;
+  return attempt;
+}
+
+// Runs `binary` on `input`, timing the whole process, and reads what it wrote
+// to `output`
+static Attempt RunBinary(const std::string& binary, const std::string& input,
+                         const std::string& output,
+                         const std::vector<std::string>& args) {
+  Attempt attempt;
+  llvm::sys::fs::remove(output);
+  std::vector<llvm::StringRef> argv{binary, "--input", input, "--output",
+                                    output};
+  argv.insert(argv.end(), args.begin(), args.end());
+  llvm::Optional<llvm::StringRef> redirects[]{llvm::None, llvm::StringRef(),
+                                              llvm::StringRef()};
+  // A limit of zero waits forever
+  auto seconds{FLAGS_timeout ? std::max<uint64_t>(1, (FLAGS_timeout + 999) /
+                                                         1000)
+                             : 0};
+  auto start{std::chrono::steady_clock::now()};
+  auto status{llvm::sys::ExecuteAndWait(binary, argv, llvm::None, redirects,
+                                        static_cast<unsigned>(seconds))};
+  attempt.duration = std::chrono::steady_clock::now() - start;
+  if (status) {
+    return attempt;
+  }
+
+  auto buffer{llvm::MemoryBuffer::getFile(output)};
+  if (!buffer) {
+    return attempt;
+  }
+  attempt.output = (*buffer)->getBuffer().str();
+  attempt.succeeded = true;
+  return attempt;
+}
+
+// Two-sided 95% quantile of Student's t distribution with `df` degrees of
+// freedom. Beyond 20, the quantile of the lowest number of degrees of each
+// range is used, which makes the intervals slightly conservative.
+static double GetTQuantile(size_t df) {
+  static const double quantiles[]{12.706, 4.303, 3.182, 2.776, 2.571,
+                                  2.447,  2.365, 2.306, 2.262, 2.228,
+                                  2.201,  2.179, 2.160, 2.145, 2.131,
+                                  2.120,  2.110, 2.101, 2.093, 2.086};
+  if (df <= 20) {
+    return quantiles[std::max<size_t>(df, 1) - 1];
+  } else if (df <= 30) {
+    return 2.080;
+  } else if (df <= 60) {
+    return 2.042;
+  } else if (df <= 120) {
+    return 2.000;
+  }
+  return 1.960;
+}
+
+static Interval EstimateMean(const std::vector<double>& values) {
+  Interval interval;
+  interval.num_values = values.size();
+  if (values.empty()) {
+    return interval;
+  }
+  for (auto value : values) {
+    interval.mean += value;
+  }
+  interval.mean /= values.size();
+  if (values.size() < 2) {
+    return interval;
+  }
+
+  double squares{0};
+  for (auto value : values) {
+    squares += (value - interval.mean) * (value - interval.mean);
+  }
+  auto stddev{std::sqrt(squares / (values.size() - 1))};
+  interval.margin = GetTQuantile(values.size() - 1) * stddev /
+                    std::sqrt(static_cast<double>(values.size()));
+  return interval;
+}
+
+// Decompiles `input` `FLAGS_runs` times with each side of `comparison`. The
+// sides take turns, and which goes first alternates, so that both are exposed
+// to the same noise from the machine. `worker` tells apart the outputs of the
+// binaries run at the same time.
+static FileComparison CompareFile(rellic::Decompiler& decompiler,
+                                  const Comparison& comparison,
+                                  const std::string& input, size_t index,
+                                  unsigned worker) {
+  FileComparison result;
+  result.input = input;
+  llvm::SmallString<256> output(comparison.directory);
+  llvm::sys::path::append(output, std::to_string(worker) + ".c");
+  auto Run = [&](const Side& side) {
+    if (side.binary.empty()) {
+      return RunPipeline(decompiler, input, side.pipeline);
+    }
+    return RunBinary(side.binary, input, output.str().str(),
+                     comparison.binary_args);
+  };
+
+  for (unsigned i{0}; i < std::max(FLAGS_runs, 1U); ++i) {
+    if ((index + i) % 2) {
+      result.candidate.push_back(Run(comparison.candidate));
+      result.baseline.push_back(Run(comparison.baseline));
+    } else {
+      result.baseline.push_back(Run(comparison.baseline));
+      result.candidate.push_back(Run(comparison.candidate));
+    }
+  }
+
+  std::vector<double> log_ratios;
+  const Attempt* baseline{nullptr};
+  const Attempt* candidate{nullptr};
+  for (size_t i{0}; i < result.baseline.size(); ++i) {
+    auto& b{result.baseline[i]};
+    auto& c{result.candidate[i]};
+    if (b.succeeded && !baseline) {
+      baseline = &b;
+    }
+    if (c.succeeded && !candidate) {
+      candidate = &c;
+    }
+    if (b.succeeded && c.succeeded) {
+      // Durations are clamped so that the ratio is always defined
+      auto b_ns{std::max<int64_t>(b.duration.count(), 1)};
+      auto c_ns{std::max<int64_t>(c.duration.count(), 1)};
+      log_ratios.push_back(std::log(static_cast<double>(b_ns) / c_ns));
+    }
+  }
+  result.log_speedup = EstimateMean(log_ratios);
+
+  if (baseline && candidate) {
+    result.outputs =
+        baseline->output == candidate->output ? "identical" : "different";
+  } else if (baseline) {
+    result.outputs = "baseline_only";
+  } else if (candidate) {
+    result.outputs = "candidate_only";
+  }
+  // Only the first output of each side is compared
+  for (auto attempts : {&result.baseline, &result.candidate}) {
+    for (auto& attempt : *attempts) {
+      attempt.output.clear();
+      attempt.output.shrink_to_fit();
+    }
+  }
+  return result;
+}
+
+static std::string DescribeSide(const Side& side) {
+  return side.binary.empty() ? "pipeline " + side.pipeline
+                             : ToJSONString(side.binary);
+}
+
+// Adds the speedup and its confidence interval to `obj`, as the ratios of the
+// duration of the baseline to that of the candidate
+static void AddSpeedup(llvm::json::Object& obj, const Interval& log_speedup) {
+  if (!log_speedup.num_values) {
+    return;
+  }
+  obj["speedup"] = std::exp(log_speedup.mean);
+  if (log_speedup.margin) {
+    obj["speedup_low"] = std::exp(log_speedup.mean - log_speedup.margin);
+    obj["speedup_high"] = std::exp(log_speedup.mean + log_speedup.margin);
+  }
+}
+
+static llvm::json::Object FileComparisonToJSON(const FileComparison& result) {
+  llvm::json::Array baseline_ms, candidate_ms;
+  for (auto& attempt : result.baseline) {
+    baseline_ms.push_back(ToMs(attempt.duration));
+  }
+  for (auto& attempt : result.candidate) {
+    candidate_ms.push_back(ToMs(attempt.duration));
+  }
+  llvm::json::Object obj{{"input", ToJSONString(result.input)},
+                         {"outputs", result.outputs},
+                         {"baseline_ms", std::move(baseline_ms)},
+                         {"candidate_ms", std::move(candidate_ms)}};
+  AddSpeedup(obj, result.log_speedup);
+  return obj;
+}
+
+static llvm::json::Object SummarizeComparison(
+    const Comparison& comparison, std::vector<FileComparison>& results,
+    std::chrono::nanoseconds wall_time) {
+  std::map<std::string, size_t> outputs{{"identical", 0},
+                                        {"different", 0},
+                                        {"baseline_only", 0},
+                                        {"candidate_only", 0},
+                                        {"both_failed", 0}};
+  std::vector<double> log_speedups;
+  size_t num_faster{0}, num_slower{0};
+  for (auto& result : results) {
+    ++outputs[result.outputs];
+    auto& log_speedup{result.log_speedup};
+    if (!log_speedup.num_values) {
+      continue;
+    }
+    log_speedups.push_back(log_speedup.mean);
+    if (log_speedup.margin) {
+      num_faster += log_speedup.mean - log_speedup.margin > 0;
+      num_slower += log_speedup.mean + log_speedup.margin < 0;
+    }
+  }
+
+  llvm::json::Object output_counts;
+  for (auto& [kind, count] : outputs) {
+    output_counts[kind] = llvm::json::Object{
+        {"files", ToInt(count)},
+        {"fraction", results.empty() ? 0.0
+                                     : static_cast<double>(count) /
+                                           results.size()}};
+  }
+
+  // Files are weighted equally, whatever their size, by averaging the
+  // logarithms of their speedups
+  llvm::json::Object speedup{{"files", ToInt(log_speedups.size())},
+                             {"faster", ToInt(num_faster)},
+                             {"slower", ToInt(num_slower)}};
+  AddSpeedup(speedup, EstimateMean(log_speedups));
+
+  std::vector<FileComparison*> timed;
+  for (auto& result : results) {
+    if (result.log_speedup.num_values) {
+      timed.push_back(&result);
+    }
+  }
+  std::stable_sort(timed.begin(), timed.end(),
+                   [](FileComparison* a, FileComparison* b) {
+                     return a->log_speedup.mean < b->log_speedup.mean;
+                   });
+  llvm::json::Array regressions, improvements;
+  for (size_t i{0}; i < timed.size() && i < FLAGS_slowest; ++i) {
+    if (timed[i]->log_speedup.mean < 0) {
+      regressions.push_back(FileComparisonToJSON(*timed[i]));
+    }
+    auto& last{timed[timed.size() - i - 1]};
+    if (last->log_speedup.mean > 0) {
+      improvements.push_back(FileComparisonToJSON(*last));
+    }
+  }
+
+  return llvm::json::Object{
+      {"commit", rellic::Version::GetCommitHash()},
+      {"jobs", FLAGS_jobs},
+      {"baseline", DescribeSide(comparison.baseline)},
+      {"candidate", DescribeSide(comparison.candidate)},
+      {"runs", std::max(FLAGS_runs, 1U)},
+      {"files", ToInt(results.size())},
+      {"wall_time_s", std::chrono::duration<double>(wall_time).count()},
+      {"outputs", std::move(output_counts)},
+      {"speedup", std::move(speedup)},
+      {"regressions", std::move(regressions)},
+      {"improvements", std::move(improvements)}};
+}
+
+static void PrintSpeedup(llvm::raw_ostream& os,
+                         const llvm::json::Object& obj) {
+  os << llvm::format("%.3fx", obj.getNumber("speedup").getValueOr(0));
+  auto low{obj.getNumber("speedup_low")};
+  auto high{obj.getNumber("speedup_high")};
+  if (low && high) {
+    os << llvm::format(" (95%% CI %.3fx-%.3fx)", *low, *high);
+  }
+}
+
+static void PrintComparison(const llvm::json::Object& summary) {
+  auto& os{llvm::outs()};
+  os << "Baseline:  " << summary.getString("baseline").getValueOr("") << '\n'
+     << "Candidate: " << summary.getString("candidate").getValueOr("")
+     << '\n';
+  os << llvm::format("%.0f files, %.0f interleaved runs of each side in "
+                     "%.2fs\n",
+                     summary.getNumber("files").getValueOr(0),
+                     summary.getNumber("runs").getValueOr(0),
+                     summary.getNumber("wall_time_s").getValueOr(0));
+
+  os << "\nOutputs:\n";
+  auto outputs{summary.getObject("outputs")};
+  for (auto [kind, label] :
+       {std::make_pair("identical", "identical"),
+        std::make_pair("different", "different"),
+        std::make_pair("baseline_only", "only baseline succeeded"),
+        std::make_pair("candidate_only", "only candidate succeeded"),
+        std::make_pair("both_failed", "both failed")}) {
+    auto count{outputs->getObject(kind)};
+    os << llvm::format("%8.0f  %5.1f%%  %s\n",
+                       count->getNumber("files").getValueOr(0),
+                       count->getNumber("fraction").getValueOr(0) * 100,
+                       label);
+  }
+
+  auto speedup{summary.getObject("speedup")};
+  os << "\nSpeedup of the candidate: ";
+  if (speedup->getNumber("speedup")) {
+    PrintSpeedup(os, *speedup);
+    os << llvm::format(
+        " over %.0f files, %.0f significantly faster, %.0f slower\n",
+        speedup->getNumber("files").getValueOr(0),
+        speedup->getNumber("faster").getValueOr(0),
+        speedup->getNumber("slower").getValueOr(0));
+  } else {
+    os << "none of the files succeeded on both sides\n";
+  }
+
+  for (auto [key, title] : {std::make_pair("regressions", "\nRegressions:\n"),
+                            std::make_pair("improvements",
+                                           "\nImprovements:\n")}) {
+    auto files{summary.getArray(key)};
+    if (files->empty()) {
+      continue;
+    }
+    os << title;
+    for (auto& value : *files) {
+      auto file{value.getAsObject()};
+      os << "  ";
+      PrintSpeedup(os, *file);
+      os << "  " << file->getString("input").getValueOr("") << '\n';
+    }
+  }
+}
+
+// Calls `process` with the index of every input and that of the worker
+// processing it, on `num_jobs` threads
+static void ForEachInput(size_t num_inputs, unsigned num_jobs,
+                         const std::function<void(size_t, unsigned)>& process) {
+  std::atomic_size_t next_input{0};
+  std::vector<std::thread> workers;
+  for (unsigned i{0}; i < num_jobs; ++i) {
+    workers.emplace_back([&, i]() {
+      for (auto idx{next_input++}; idx < num_inputs; idx = next_input++) {
+        process(idx, i);
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --corpus CORPUS_DIR \\" << std::endl
+        << "    [--jobs N] [--max_files N] [--slowest N] \\" << std::endl
+        << "    [--output REPORT_JSON_FILE] \\" << std::endl
+        << "    [--files_output FILES_JSONL_FILE] \\" << std::endl
+        << "    [--compare_pipeline PIPELINE | \\" << std::endl
+        << "     --baseline_binary RELLIC_DECOMP \\" << std::endl
+        << "     --candidate_binary RELLIC_DECOMP] [--runs N] \\" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_corpus.empty()) {
+    std::cerr << google::ProgramUsage();
+    return EXIT_FAILURE;
+  }
+
+  Comparison comparison;
+  comparison.baseline.pipeline = FLAGS_pipeline;
+  comparison.candidate.pipeline = FLAGS_compare_pipeline;
+  comparison.baseline.binary = FLAGS_baseline_binary;
+  comparison.candidate.binary = FLAGS_candidate_binary;
+  CHECK(comparison.baseline.binary.empty() ==
+        comparison.candidate.binary.empty())
+      << "--baseline_binary and --candidate_binary go together";
+  CHECK(comparison.candidate.binary.empty() ||
+        FLAGS_compare_pipeline.empty())
+      << "--compare_pipeline cannot be used along with binaries";
+  auto comparing{!FLAGS_compare_pipeline.empty() ||
+                 !comparison.candidate.binary.empty()};
+  llvm::SmallVector<llvm::StringRef, 8> args;
+  llvm::SplitString(FLAGS_binary_args, args, " ");
+  for (auto arg : args) {
+    comparison.binary_args.push_back(arg.str());
+  }
+  if (!comparison.candidate.binary.empty()) {
+    llvm::SmallString<256> dir;
+    auto ec{llvm::sys::fs::createUniqueDirectory("rellic-angha-bench", dir)};
+    CHECK(!ec) << "Cannot create a temporary directory: " << ec.message();
+    comparison.directory = dir.str().str();
+  }
+
+  auto inputs{GetCorpus(FLAGS_corpus)};
+  CHECK(!inputs.empty()) << "No .bc or .ll files in " << FLAGS_corpus;
+
+  std::unique_ptr<llvm::raw_fd_ostream> files_output;
+  if (!FLAGS_files_output.empty()) {
+    std::error_code ec;
+    files_output =
+        std::make_unique<llvm::raw_fd_ostream>(FLAGS_files_output, ec);
+    CHECK(!ec) << "Failed to create " << FLAGS_files_output << ": "
+               << ec.message();
+  }
+
+  if (!FLAGS_jobs) {
+    FLAGS_jobs = std::thread::hardware_concurrency();
+  }
+  auto num_jobs{
+      std::max(1U, std::min<unsigned>(FLAGS_jobs, inputs.size()))};
+  rellic::Decompiler decompiler(num_jobs);
+
+  std::mutex output_mutex;
+  auto Record = [&](llvm::json::Object obj) {
+    if (files_output) {
+      std::lock_guard<std::mutex> lock(output_mutex);
+      *files_output << llvm::json::Value(std::move(obj)) << '\n';
+      files_output->flush();
+    }
+  };
+
+  llvm::json::Object summary;
+  auto start{std::chrono::steady_clock::now()};
+  if (comparing) {
+    std::vector<FileComparison> results(inputs.size());
+    ForEachInput(inputs.size(), num_jobs, [&](size_t idx, unsigned worker) {
+      results[idx] =
+          CompareFile(decompiler, comparison, inputs[idx], idx, worker);
+      Record(FileComparisonToJSON(results[idx]));
+    });
+    auto wall_time{std::chrono::steady_clock::now() - start};
+    summary = SummarizeComparison(comparison, results, wall_time);
+    PrintComparison(summary);
+    if (!comparison.directory.empty()) {
+      llvm::sys::fs::remove_directories(comparison.directory);
+    }
+  } else {
+    std::vector<FileResult> results(inputs.size());
+    ForEachInput(inputs.size(), num_jobs, [&](size_t idx, unsigned) {
+      results[idx] = DecompileFile(decompiler, inputs[idx]);
+      Record(FileToJSON(results[idx]));
+    });
+    auto wall_time{std::chrono::steady_clock::now() - start};
+    summary = Summarize(results, wall_time);
+    PrintSummary(summary);
+  }
+  if (!FLAGS_output.empty()) {
+    std::error_code ec;
+    llvm::raw_fd_ostream os(FLAGS_output, ec);
+    CHECK(!ec) << "Failed to create " << FLAGS_output << ": " << ec.message();
+    os << llvm::formatv("{0:2}", llvm::json::Value(std::move(summary)))
+       << '\n';
+  }
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+
+  return EXIT_SUCCESS;
+}
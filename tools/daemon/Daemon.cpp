@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <clang/AST/ASTContext.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <httplib.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "rellic/BC/Util.h"
+#include "rellic/Decompiler.h"
+#include "rellic/Version.h"
+
+#ifndef LLVM_VERSION_STRING
+#define LLVM_VERSION_STRING LLVM_VERSION_MAJOR << "." << LLVM_VERSION_MINOR
+#endif
+
+DECLARE_bool(version);
+DEFINE_string(address, "127.0.0.1", "Address on which the daemon will listen");
+DEFINE_int32(port, 8080, "Port on which the daemon will listen");
+DEFINE_uint32(prepared_units, 2,
+              "Number of empty translation units kept ready for each target "
+              "triple.");
+
+static void SetVersion(void) {
+  std::stringstream version;
+
+  auto vs = rellic::Version::GetVersionString();
+  if (0 == vs.size()) {
+    vs = "unknown";
+  }
+  version << vs << "\n";
+  if (!rellic::Version::HasVersionData()) {
+    version << "No extended version information found!\n";
+  } else {
+    version << "Commit Hash: " << rellic::Version::GetCommitHash() << "\n";
+    version << "Commit Date: " << rellic::Version::GetCommitDate() << "\n";
+    version << "Last commit by: " << rellic::Version::GetAuthorName() << " ["
+            << rellic::Version::GetAuthorEmail() << "]\n";
+    version << "Commit Subject: [" << rellic::Version::GetCommitSubject()
+            << "]\n";
+    version << "\n";
+    if (rellic::Version::HasUncommittedChanges()) {
+      version << "Uncommitted changes were present during build.\n";
+    } else {
+      version << "All changes were committed prior to building.\n";
+    }
+  }
+  version << "Using LLVM " << LLVM_VERSION_STRING << std::endl;
+
+  google::SetVersionString(version.str());
+}
+
+// The bitcode of a loaded module. Decompilation consumes the module it is
+// given, so every request reads its own copy, lazily and in its own
+// `llvm::LLVMContext`. Only the functions it decompiles are ever parsed.
+struct LoadedModule {
+  std::unique_ptr<llvm::MemoryBuffer> bitcode;
+  size_t num_functions;
+};
+
+static httplib::Server svr;
+static std::unique_ptr<rellic::Decompiler> decompiler;
+static std::unordered_map<std::string, std::shared_ptr<LoadedModule>> modules;
+static std::shared_mutex modules_mutex;
+
+static void SendJSON(httplib::Response& res, llvm::json::Object& obj) {
+  std::string s;
+  llvm::raw_string_ostream os(s);
+  os << llvm::json::Value(std::move(obj));
+  res.set_content(s, "application/json");
+}
+
+// Decompiled code and error messages may contain string literals and names
+// from the module, but JSON strings must be valid UTF-8
+static std::string ToJSONString(llvm::StringRef str) {
+  return llvm::json::isUTF8(str) ? str.str() : llvm::json::fixUTF8(str);
+}
+
+static void SendError(httplib::Response& res, int status,
+                      const std::string& message) {
+  llvm::json::Object msg{{"message", ToJSONString(message)}};
+  res.status = status;
+  SendJSON(res, msg);
+}
+
+static std::shared_ptr<LoadedModule> FindModule(const std::string& name) {
+  std::shared_lock<std::shared_mutex> lock(modules_mutex);
+  auto it{modules.find(name)};
+  return it == modules.end() ? nullptr : it->second;
+}
+
+// Loads the bitcode or textual IR in the request body as module `name`,
+// replacing any module of the same name. Textual IR is converted to bitcode
+// once, so that requests can read it lazily.
+static void LoadModule(const httplib::Request& req, httplib::Response& res) {
+  auto name{req.matches[1].str()};
+  auto loaded{std::make_shared<LoadedModule>()};
+  llvm::LLVMContext llvm_ctx;
+  auto data{reinterpret_cast<const unsigned char*>(req.body.data())};
+  if (llvm::isBitcode(data, data + req.body.size())) {
+    loaded->bitcode = llvm::MemoryBuffer::getMemBufferCopy(req.body, name);
+    std::unique_ptr<llvm::Module> module{rellic::LoadLazyModuleFromMemory(
+        &llvm_ctx, loaded->bitcode->getMemBufferRef(), true)};
+    if (!module) {
+      SendError(res, 400, "Couldn't load LLVM module.");
+      return;
+    }
+    loaded->num_functions = module->size();
+  } else {
+    std::unique_ptr<llvm::Module> module{
+        rellic::LoadModuleFromMemory(&llvm_ctx, req.body, true)};
+    if (!module) {
+      SendError(res, 400, "Couldn't load LLVM module.");
+      return;
+    }
+    loaded->num_functions = module->size();
+
+    llvm::SmallVector<char, 0> bitcode;
+    llvm::raw_svector_ostream os(bitcode);
+    llvm::WriteBitcodeToFile(*module, os);
+    loaded->bitcode = llvm::MemoryBuffer::getMemBufferCopy(
+        llvm::StringRef(bitcode.data(), bitcode.size()), name);
+  }
+
+  llvm::json::Object msg{
+      {"message", "Ok."},
+      {"functions", static_cast<int64_t>(loaded->num_functions)}};
+  {
+    std::unique_lock<std::shared_mutex> lock(modules_mutex);
+    modules[name] = std::move(loaded);
+  }
+  SendJSON(res, msg);
+  res.status = 200;
+}
+
+static void UnloadModule(const httplib::Request& req, httplib::Response& res) {
+  size_t num_erased;
+  {
+    std::unique_lock<std::shared_mutex> lock(modules_mutex);
+    num_erased = modules.erase(req.matches[1].str());
+  }
+  if (!num_erased) {
+    SendError(res, 404, "No such module.");
+    return;
+  }
+
+  llvm::json::Object msg{{"message", "Ok."}};
+  SendJSON(res, msg);
+  res.status = 200;
+}
+
+static void ListModules(const httplib::Request& req, httplib::Response& res) {
+  llvm::json::Array list;
+  {
+    std::shared_lock<std::shared_mutex> lock(modules_mutex);
+    for (auto& [name, loaded] : modules) {
+      list.push_back(llvm::json::Object{
+          {"name", ToJSONString(name)},
+          {"functions", static_cast<int64_t>(loaded->num_functions)},
+          {"size", static_cast<int64_t>(loaded->bitcode->getBufferSize())}});
+    }
+  }
+
+  llvm::json::Object msg{{"modules", std::move(list)}};
+  SendJSON(res, msg);
+  res.status = 200;
+}
+
+static rellic::DecompilationOptions GetOptions(
+    const llvm::json::Object& request) {
+  rellic::DecompilationOptions opts{};
+  if (auto functions = request.getArray("functions")) {
+    for (auto& func : *functions) {
+      if (auto func_name = func.getAsString()) {
+        opts.functions.insert(func_name->str());
+      }
+    }
+  }
+  opts.include_callees =
+      request.getBoolean("include_callees").getValueOr(false);
+  opts.lower_switches = request.getBoolean("lower_switches").getValueOr(false);
+  opts.remove_phi_nodes =
+      request.getBoolean("remove_phi_nodes").getValueOr(false);
+  opts.coalesce_phi_nodes =
+      request.getBoolean("coalesce_phi_nodes").getValueOr(false);
+  if (auto pipeline = request.getString("pipeline")) {
+    opts.pipeline = pipeline->str();
+  }
+  if (auto timeout = request.getInteger("timeout_ms")) {
+    opts.module_timeout = std::chrono::milliseconds(*timeout);
+  }
+  opts.keep_module = false;
+  return opts;
+}
+
+// Decompiles `module` and sends the declarations of the module and the code of
+// each decompiled definition
+static void SendDecompilation(std::unique_ptr<llvm::Module> module,
+                              rellic::DecompilationOptions opts,
+                              std::chrono::steady_clock::time_point start,
+                              httplib::Response& res) {
+  std::string declarations;
+  llvm::json::Object definitions;
+  opts.on_declarations = [&](llvm::StringRef code) {
+    declarations = ToJSONString(code);
+  };
+  opts.on_definition = [&](const llvm::Function& func, llvm::StringRef code) {
+    definitions[ToJSONString(func.getName())] = ToJSONString(code);
+  };
+  // Only the streamed code is sent back
+  opts.release_streamed_definitions = true;
+
+  auto result{decompiler->Decompile(std::move(module), std::move(opts))};
+  if (!result.Succeeded()) {
+    SendError(res, 400, result.TakeError().message);
+    return;
+  }
+
+  auto value{result.TakeValue()};
+  llvm::json::Array function_errors;
+  for (auto& error : value.function_errors) {
+    function_errors.push_back(llvm::json::Object{
+        {"function", ToJSONString(error.name)},
+        {"message", ToJSONString(error.message)}});
+  }
+
+  llvm::json::Object msg{
+      {"declarations", std::move(declarations)},
+      {"definitions", std::move(definitions)},
+      {"function_errors", std::move(function_errors)},
+      {"duration_ms", std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count()}};
+  SendJSON(res, msg);
+  res.status = 200;
+}
+
+// Decompiles functions of a loaded module. The request is a JSON object like
+//
+//   {"module": "a.bc", "functions": ["main"], "include_callees": false}
+//
+// where all fields but "module" are optional, along with "lower_switches",
+// "remove_phi_nodes", "coalesce_phi_nodes", "pipeline" and "timeout_ms".
+static void Decompile(const httplib::Request& req, httplib::Response& res) {
+  auto start{std::chrono::steady_clock::now()};
+  auto json{llvm::json::parse(req.body)};
+  if (!json) {
+    SendError(res, 400, llvm::toString(json.takeError()));
+    return;
+  }
+
+  auto request{json->getAsObject()};
+  auto name{request ? request->getString("module") : llvm::None};
+  if (!name) {
+    SendError(res, 400, "Missing module name.");
+    return;
+  }
+
+  auto loaded{FindModule(name->str())};
+  if (!loaded) {
+    SendError(res, 404, "No such module.");
+    return;
+  }
+
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module{rellic::LoadLazyModuleFromMemory(
+      &llvm_ctx, loaded->bitcode->getMemBufferRef(), true)};
+  if (!module) {
+    SendError(res, 500, "Couldn't load LLVM module.");
+    return;
+  }
+  SendDecompilation(std::move(module), GetOptions(*request), start, res);
+}
+
+// Decompiles functions of the bitcode or textual IR in the request body,
+// without keeping it around, so that clients which regenerate their module
+// every time only need a single request. The fields of `/decompile` but
+// "module" are given as query parameters instead, with the names of the
+// functions separated by commas.
+static void DecompileBody(const httplib::Request& req,
+                          httplib::Response& res) {
+  auto start{std::chrono::steady_clock::now()};
+  llvm::json::Object request;
+  for (auto& [key, value] : req.params) {
+    if (key == "functions") {
+      llvm::SmallVector<llvm::StringRef, 4> names;
+      llvm::StringRef(value).split(names, ',', -1, /*KeepEmpty=*/false);
+      llvm::json::Array functions;
+      for (auto func_name : names) {
+        functions.push_back(func_name.str());
+      }
+      request[key] = std::move(functions);
+    } else if (key == "pipeline") {
+      request[key] = value;
+    } else if (key == "timeout_ms") {
+      int64_t timeout;
+      if (llvm::StringRef(value).getAsInteger(10, timeout)) {
+        SendError(res, 400, "Invalid timeout.");
+        return;
+      }
+      request[key] = timeout;
+    } else {
+      request[key] = value == "true" || value == "1";
+    }
+  }
+
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module{rellic::LoadModuleFromMemory(
+      &llvm_ctx, llvm::MemoryBufferRef(req.body, "module"), true)};
+  if (!module) {
+    SendError(res, 400, "Couldn't load LLVM module.");
+    return;
+  }
+  SendDecompilation(std::move(module), GetOptions(request), start, res);
+}
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    [--address ADDRESS] [--port PORT] \\" << std::endl
+        << std::endl
+
+        // Print the version and exit.
+        << "    [--version]" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  SetVersion();
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  decompiler = std::make_unique<rellic::Decompiler>(FLAGS_prepared_units);
+
+  svr.set_logger([](const httplib::Request& req, const httplib::Response&) {
+    LOG(INFO) << req.method << " " << req.path;
+  });
+  svr.Post(R"(/modules/([^/]+))", LoadModule);
+  svr.Delete(R"(/modules/([^/]+))", UnloadModule);
+  svr.Get("/modules", ListModules);
+  svr.Post("/decompile", Decompile);
+  svr.Post("/decompile/module", DecompileBody);
+
+  LOG(INFO) << "Listening on " << FLAGS_address << ":" << FLAGS_port;
+  svr.listen(FLAGS_address.c_str(), FLAGS_port);
+
+  decompiler.reset();
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+
+  return EXIT_SUCCESS;
+}
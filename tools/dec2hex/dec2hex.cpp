@@ -10,16 +10,60 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
 #include <llvm/Support/raw_ostream.h>
 #include <rellic/Dec2Hex.h>
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <sstream>
+#include <string>
 #include <system_error>
+#include <thread>
+#include <vector>
 
 DEFINE_string(input, "-", "Input C file.");
 DEFINE_string(output, "", "Output C file.");
+DEFINE_string(output_dir, "",
+              "Directory in which the C files given after the flags are "
+              "written, each under its own name, instead of converting "
+              "--input.");
+DEFINE_uint32(threads, 1, "Number of files converted at the same time.");
+
+static bool ShouldConvert(const llvm::APInt &value) { return value.uge(16); }
+
+// Converts the C code in `input` and writes it to `output`, or to stdout if
+// empty. Returns an error message on failure.
+static std::string ConvertFile(const std::string &input,
+                               const std::string &output) {
+  auto input_file = llvm::MemoryBuffer::getFileOrSTDIN(input);
+  if (!input_file) {
+    return input + ": " + input_file.getError().message();
+  }
+  auto ast_unit{clang::tooling::buildASTFromCodeWithArgs(
+      input_file.get()->getBuffer(), {}, input, "rellic-dec2hex")};
+  if (!ast_unit) {
+    return input + ": cannot parse";
+  }
+  auto &ast_ctx{ast_unit->getASTContext()};
+
+  if (output.empty()) {
+    rellic::ConvertIntegerLiteralsToHex(ast_ctx, llvm::outs(), ShouldConvert);
+    return "";
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(output, ec);
+  if (ec) {
+    return output + ": " + ec.message();
+  }
+  rellic::ConvertIntegerLiteralsToHex(ast_ctx, os, ShouldConvert);
+  return "";
+}
 
 int main(int argc, char *argv[]) {
   std::stringstream usage;
@@ -28,6 +72,11 @@ int main(int argc, char *argv[]) {
         << "  " << argv[0] << " \\" << std::endl
         << "    --input INPUT_C_FILE \\" << std::endl
         << "    --output OUTPUT_C_FILE \\" << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --output_dir OUTPUT_DIR \\" << std::endl
+        << "    [--threads N] \\" << std::endl
+        << "    INPUT_C_FILE..." << std::endl
         << std::endl;
 
   google::InitGoogleLogging(argv[0]);
@@ -35,31 +84,50 @@ int main(int argc, char *argv[]) {
   google::SetUsageMessage(usage.str());
   google::ParseCommandLineFlags(&argc, &argv, true);
 
-  auto input_file = llvm::MemoryBuffer::getFileOrSTDIN(FLAGS_input);
-  if (!input_file) {
-    LOG(FATAL) << input_file.getError().message();
+  if (FLAGS_output_dir.empty()) {
+    auto error{ConvertFile(FLAGS_input, FLAGS_output)};
+    if (!error.empty()) {
+      LOG(FATAL) << error;
+    }
+    google::ShutDownCommandLineFlags();
+    google::ShutdownGoogleLogging();
+    return EXIT_SUCCESS;
   }
-  auto ast_unit{clang::tooling::buildASTFromCodeWithArgs(
-      input_file.get()->getBuffer(), {}, FLAGS_input, "rellic-dec2hex")};
-  auto &ast_ctx{ast_unit->getASTContext()};
 
-  auto heuristic = [](const llvm::APInt &value) {
-    return value.getZExtValue() >= 16;
-  };
+  // Each file gets its own AST, so files are converted independently by a
+  // pool of threads that take the next file as soon as they are done
+  std::vector<std::string> inputs(argv + 1, argv + argc);
+  if (auto ec = llvm::sys::fs::create_directories(FLAGS_output_dir)) {
+    LOG(FATAL) << FLAGS_output_dir << ": " << ec.message();
+  }
+  std::vector<std::string> errors(inputs.size());
+  std::atomic_size_t next_input{0};
+  std::vector<std::thread> workers;
+  auto num_threads{std::max<size_t>(
+      1, std::min<size_t>(FLAGS_threads, inputs.size()))};
+  for (size_t i{0}; i < num_threads; ++i) {
+    workers.emplace_back([&]() {
+      for (auto n{next_input++}; n < inputs.size(); n = next_input++) {
+        llvm::SmallString<256> output(FLAGS_output_dir);
+        llvm::sys::path::append(output, llvm::sys::path::filename(inputs[n]));
+        errors[n] = ConvertFile(inputs[n], output.str().str());
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
 
-  if (FLAGS_output.empty()) {
-    rellic::ConvertIntegerLiteralsToHex(ast_ctx, llvm::outs(), heuristic);
-  } else {
-    std::error_code ec;
-    llvm::raw_fd_ostream os(FLAGS_output, ec);
-    if (ec) {
-      LOG(FATAL) << ec.message();
+  auto status{EXIT_SUCCESS};
+  for (auto &error : errors) {
+    if (!error.empty()) {
+      LOG(ERROR) << error;
+      status = EXIT_FAILURE;
     }
-    rellic::ConvertIntegerLiteralsToHex(ast_ctx, os, heuristic);
   }
 
   google::ShutDownCommandLineFlags();
   google::ShutdownGoogleLogging();
 
-  return EXIT_SUCCESS;
+  return status;
 }
@@ -9,45 +9,958 @@
 #include <clang/Tooling/Tooling.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/JSON.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
 #include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include "ProvenanceExport.h"
+#include "SplitOutput.h"
+#include "rellic/AST/CPrinter.h"
 #include "rellic/BC/Util.h"
 #include "rellic/Decompiler.h"
+#include "rellic/EventLog.h"
+#include "rellic/Serialization.h"
+#include "rellic/Trace.h"
 #include "rellic/Version.h"
 
 #ifndef LLVM_VERSION_STRING
 #define LLVM_VERSION_STRING LLVM_VERSION_MAJOR << "." << LLVM_VERSION_MINOR
 #endif
 
-DEFINE_string(input, "", "Input LLVM bitcode file.");
-DEFINE_string(output, "", "Output file.");
+DEFINE_string(input, "",
+              "Input LLVM bitcode file, or - for the standard input.");
+DEFINE_string(output, "", "Output file, or output directory with --batch.");
+DEFINE_string(batch, "",
+              "File listing one input per line, or directory of .bc and .ll "
+              "files, to decompile in a single process. Budgets like "
+              "--timeout and --memory_limit apply to each input.");
+DEFINE_uint32(batch_jobs, 0,
+              "Number of inputs decompiled at once with --batch (0 means one "
+              "per hardware thread).");
+DEFINE_uint32(batch_queue, 0,
+              "Number of inputs --batch loads ahead of the decompiling jobs, "
+              "and holds for writing after them (0 means one per job).");
+DEFINE_string(batch_report, "",
+              "JSONL file in which --batch records the outcome of each input. "
+              "Defaults to report.jsonl in the output directory.");
 DEFINE_bool(disable_z3, false, "Disable Z3 based AST tranformations.");
 DEFINE_bool(remove_phi_nodes, false,
             "Remove PHINodes from input bitcode before decompilation.");
+DEFINE_uint32(pre_opt, 0,
+              "Level of the LLVM cleanup passes run before decompilation: 0 "
+              "for none, 1 for constant folding, CFG simplification, CSE and "
+              "DCE, 2 to also remove redundant loads and dead stores.");
+DEFINE_bool(coalesce_phi_nodes, false,
+            "Merge the variables of PHI nodes that flow into each other when "
+            "their live ranges do not overlap.");
 DEFINE_bool(lower_switch, false,
             "Remove SwitchInst by lowering them to branches.");
+DEFINE_uint32(num_threads, 1,
+              "Number of threads used to decompile function definitions.");
+DEFINE_uint32(simplify_threads, 1,
+              "Number of threads used to simplify conditions.");
+DEFINE_uint32(prove_threads, 1,
+              "Number of threads used by refinement passes to decide the "
+              "proofs of each traversal ahead of it.");
+DEFINE_uint32(generate_threads, 1,
+              "Number of threads used to compute the reaching conditions of "
+              "functions before structuring them.");
+DEFINE_uint32(unit_threads, 1,
+              "Number of threads used to compute the reaching conditions of "
+              "the units of each function, see --region_unit_size.");
+DEFINE_uint32(max_iterations, 0,
+              "Maximum number of iterations of each refinement fixpoint (0 "
+              "means unbounded).");
+DEFINE_uint64(timeout, 0,
+              "Time budget for refining the module, in milliseconds (0 means "
+              "unbounded).");
+DEFINE_uint64(function_timeout, 0,
+              "Time budget for refining each function, in milliseconds (0 "
+              "means unbounded).");
+DEFINE_uint64(memory_limit, 0,
+              "Memory budget for refinement, in MiB (0 means unbounded).");
+DEFINE_uint32(z3_timeout, 0,
+              "Time limit of each Z3 query, in milliseconds (0 means "
+              "unbounded).");
+DEFINE_uint32(z3_rlimit, 0,
+              "Resource limit of each Z3 proof (0 means unbounded).");
+DEFINE_bool(truth_tables, false,
+            "Decide small conditions on their truth tables instead of with "
+            "Z3.");
+DEFINE_string(functions, "",
+              "Comma-separated names or pc metadata addresses of the functions "
+              "to decompile. All other functions are only declared.");
+DEFINE_bool(include_callees, false,
+            "Also decompile the functions called by those in --functions.");
+DEFINE_bool(deduplicate_functions, false,
+            "Decompile structurally identical functions only once, and copy "
+            "the result to the others.");
+DEFINE_bool(compact_ast, false,
+            "Copy the final AST into a fresh translation unit before printing "
+            "it, freeing the nodes discarded by refinement.");
+DEFINE_bool(lazy_load, false,
+            "Only read the bodies of the functions that are decompiled. "
+            "Functions outside of --functions are declared without their "
+            "debug information.");
+DEFINE_bool(stream, false,
+            "Write each function to the output file as soon as it has been "
+            "refined.");
+DEFINE_string(shard, "",
+              "Only decompile shard i/N of the function definitions, and write "
+              "them with the declarations of the module to a manifest that "
+              "rellic-merge combines with the other shards. Implies --stream.");
+DEFINE_string(cache_dir, "",
+              "Directory of a persistent cache of decompiled functions. "
+              "Implies --stream.");
+DEFINE_string(checkpoint_out, "",
+              "Write a checkpoint of the decompilation once the module has "
+              "been structured, to the given file and its .json sidecar.");
+DEFINE_string(resume_from, "",
+              "Resume the decompilation of the same input from a checkpoint "
+              "written by --checkpoint_out, instead of structuring it again.");
+DEFINE_string(query_log, "",
+              "File in which to record every Z3 query, for replaying with "
+              "rellic-z3bench.");
+DEFINE_string(forensics_dir, "",
+              "Directory in which to write a standalone bitcode file, the "
+              "metrics and the slowest Z3 queries of every function over "
+              "--forensics_ms or --forensics_mb, or cut short by a budget.");
+DEFINE_uint64(forensics_ms, 0,
+              "Capture functions that take longer than this many "
+              "milliseconds to decompile. 0 means no limit.");
+DEFINE_uint64(forensics_mb, 0,
+              "Capture functions whose structuring allocates more than this "
+              "many megabytes. 0 means no limit.");
+DEFINE_uint32(forensics_queries, 16,
+              "Number of the slowest Z3 queries kept in each capture.");
+DEFINE_string(event_log, "",
+              "File in which to record the events of the decompilation, such "
+              "as the runs of the refinement passes, as JSON lines.");
+DEFINE_string(event_level, "info",
+              "Lowest level of the events recorded by --event_log: debug, "
+              "info or warning.");
+DEFINE_string(pipeline, "full",
+              "Refinement pipeline, either a preset (full, fast) or a "
+              "description like 'dse;fix(ncp,nsc);mc,ec'.");
+DEFINE_uint32(large_function_blocks, 0,
+              "Decompile functions with more basic blocks than this with less "
+              "effort. 0 means no limit.");
+DEFINE_uint32(large_function_edges, 0,
+              "Decompile functions with more CFG edges than this with less "
+              "effort. 0 means no limit.");
+DEFINE_uint32(large_function_loop_depth, 0,
+              "Decompile functions with loops nested deeper than this with "
+              "less effort. 0 means no limit.");
+DEFINE_uint32(large_function_switch_cases, 0,
+              "Decompile functions with switches of more cases than this with "
+              "less effort. 0 means no limit.");
+DEFINE_string(large_function_pipeline, "fast",
+              "Refinement pipeline for large functions.");
+DEFINE_uint64(blob_initializer_size, 0,
+              "Initialize global arrays of integers or floats of at least "
+              "this many bytes with a string literal of their bytes. 0 means "
+              "never.");
+DEFINE_uint32(cond_var_size, 16,
+              "Assign branch conditions made of more instructions than this "
+              "to variables. 0 means never.");
+DEFINE_uint32(reach_var_size, 0,
+              "Replace reaching conditions of region entries that have more "
+              "nodes than this with variables. 0 means never.");
+DEFINE_uint32(region_unit_size, 0,
+              "Compute the reaching conditions of regions of at least this "
+              "many blocks relative to their own entry. 0 means never.");
+DEFINE_bool(pattern_structuring, false,
+            "Structure control flow made of if-then-else, loop and switch "
+            "patterns without computing reaching conditions.");
+DEFINE_uint32(goto_cond_size, 0,
+              "Structure regions whose reaching conditions have more nodes "
+              "than this with gotos. 0 means no limit.");
+DEFINE_uint64(goto_timeout, 0,
+              "Structure functions whose reaching conditions take longer than "
+              "this many milliseconds to compute with gotos. 0 means no "
+              "limit.");
+DEFINE_bool(rule_timing, false,
+            "Measure the time each inference rule takes to match, for "
+            "--stats. Slows rule matching down.");
+DEFINE_bool(stats, false,
+            "Print per-pass timing and iteration statistics as JSON to "
+            "stderr.");
+DEFINE_bool(line_directives, false,
+            "Emit #line directives from the debug locations of the IR. Not "
+            "available when streaming.");
+DEFINE_bool(provenance_comments, false,
+            "Precede each statement with a comment naming the IR value it was "
+            "generated from. Not available when streaming.");
+DEFINE_bool(hex_literals, false,
+            "Print integer literals of 16 and more in hexadecimal, like "
+            "rellic-dec2hex. Not available with --clang_printer.");
+DEFINE_bool(clang_printer, false,
+            "Print the output with Clang's generic printer rather than "
+            "rellic's own.");
+DEFINE_uint32(print_threads, 1,
+              "Number of threads printing the function definitions of the "
+              "output of each input, when it is not streamed.");
+DEFINE_bool(split_output, false,
+            "Write the output to the directory OUTPUT as a header, a file of "
+            "global variables and one C file per function. Not available "
+            "with --batch, --shard, --clang_printer, --provenance_out, "
+            "--ast_output or when streaming.");
+DEFINE_uint32(split_bucket_size, 1,
+              "Number of function definitions in each C file of "
+              "--split_output.");
+DEFINE_string(provenance_out, "",
+              "JSON Lines file to which the provenance of each printed "
+              "statement, expression and declaration is streamed. Not "
+              "available with --batch, --clang_printer or when streaming.");
+DEFINE_bool(ast_output, false,
+            "Also write the AST as a Clang AST file to OUTPUT.ast, its "
+            "provenance to OUTPUT.prov and the decompiled IR to OUTPUT.bc. Not "
+            "available when streaming.");
+DEFINE_string(trace_out, "",
+              "Chrome Trace Event file in which the spans of the "
+              "decompilation are recorded, for chrome://tracing or Perfetto.");
 
 DECLARE_bool(version);
 
+// Paths and error messages may come from anywhere, but JSON strings must be
+// valid UTF-8
+static std::string ToJSONString(const std::string& str) {
+  return llvm::json::isUTF8(str) ? str : llvm::json::fixUTF8(str);
+}
+
 namespace {
-static llvm::Optional<llvm::APInt> GetPCMetadata(llvm::Value* value) {
-  auto inst{llvm::dyn_cast<llvm::Instruction>(value)};
-  if (!inst) {
-    return llvm::Optional<llvm::APInt>();
+static llvm::json::Object StatisticsToJSON(
+    const rellic::PassStatistics& stats) {
+  auto ToJSON = [](const rellic::ASTPassStatistics& stats) {
+    return llvm::json::Object{
+        {"runs", stats.num_runs},
+        {"changes", stats.num_changes},
+        {"cycles", stats.num_cycles},
+        {"ast_bytes", int64_t(stats.ast_bytes)},
+        {"ast_nodes", int64_t(stats.ast_nodes)},
+        {"z3_exprs", stats.z3_exprs},
+        {"elapsed_ms",
+         std::chrono::duration<double, std::milli>(stats.elapsed).count()}};
+  };
+
+  llvm::json::Array stages;
+  for (auto& stage : stats.stages) {
+    llvm::json::Array passes;
+    for (auto& pass : stage.passes) {
+      auto obj{ToJSON(pass.stats)};
+      obj["name"] = pass.name;
+      passes.push_back(std::move(obj));
+    }
+
+    auto obj{ToJSON(stage.stats)};
+    obj["name"] = stage.name;
+    obj["iterations"] = stage.num_iterations;
+    obj["truncated"] = stage.truncated;
+    obj["passes"] = std::move(passes);
+    stages.push_back(std::move(obj));
+  }
+
+  auto& memory{stats.peak_memory};
+  auto ToInt = [](size_t bytes) { return static_cast<int64_t>(bytes); };
+  llvm::json::Object peak_memory{{"ast", ToInt(memory.ast)},
+                                 {"z3", ToInt(memory.z3)},
+                                 {"tables", ToInt(memory.tables)},
+                                 {"total", ToInt(memory.Total())}};
+
+  auto& prover{stats.prover};
+  llvm::json::Object prover_stats{
+      {"proofs", ToInt(prover.num_proofs)},
+      {"simplifications", ToInt(prover.num_simplifications)},
+      {"cached", ToInt(prover.num_cached)},
+      {"syntactic", ToInt(prover.num_syntactic)},
+      {"truth_tables", ToInt(prover.num_truth_tables)},
+      {"limit_hits", ToInt(prover.num_limit_hits)},
+      {"interrupted", ToInt(prover.num_interrupted)}};
+
+  // Latencies are listed by power of two of microseconds, see
+  // `rellic::QueryStatistics`, without the trailing empty buckets
+  llvm::json::Object sites;
+  for (auto& [name, site] : prover.sites) {
+    llvm::json::Object kinds;
+    for (size_t i{0}; i < site.queries.size(); ++i) {
+      auto& queries{site.queries[i]};
+      if (!queries.num_queries) {
+        continue;
+      }
+
+      auto num_buckets{queries.latency.size()};
+      while (num_buckets && !queries.latency[num_buckets - 1]) {
+        --num_buckets;
+      }
+      llvm::json::Array latency;
+      for (size_t b{0}; b < num_buckets; ++b) {
+        latency.push_back(ToInt(queries.latency[b]));
+      }
+
+      auto kind{static_cast<rellic::QueryKind>(i)};
+      kinds[rellic::GetQueryKindName(kind)] = llvm::json::Object{
+          {"queries", ToInt(queries.num_queries)},
+          {"z3", ToInt(queries.num_z3)},
+          {"elapsed_ms",
+           std::chrono::duration<double, std::milli>(queries.elapsed).count()},
+          {"latency_us", std::move(latency)},
+          {"nodes", ToInt(queries.num_nodes)},
+          {"max_nodes", ToInt(queries.max_nodes)},
+          {"vars", ToInt(queries.num_vars)}};
+    }
+    sites[name] = std::move(kinds);
+  }
+  prover_stats["sites"] = std::move(sites);
+
+  llvm::json::Object rules;
+  for (auto& [name, rule] : stats.rules) {
+    rules[name] = llvm::json::Object{
+        {"attempts", ToInt(rule.num_attempts)},
+        {"matches", ToInt(rule.num_matches)},
+        {"fires", ToInt(rule.num_fires)},
+        {"match_ms",
+         std::chrono::duration<double, std::milli>(rule.match_elapsed).count()},
+        {"fire_ms",
+         std::chrono::duration<double, std::milli>(rule.fire_elapsed).count()}};
+  }
+
+  llvm::json::Array functions;
+  for (auto& func : stats.functions) {
+    auto& size{func.size};
+    functions.push_back(llvm::json::Object{
+        {"name", ToJSONString(func.name)},
+        {"blocks", size.blocks},
+        {"edges", size.edges},
+        {"loop_depth", size.loop_depth},
+        {"switch_cases", size.switch_cases},
+        {"cond_terms", static_cast<int64_t>(size.cond_terms)},
+        {"cost", static_cast<int64_t>(size.Cost())},
+        {"generate_ms",
+         std::chrono::duration<double, std::milli>(func.elapsed).count()},
+        {"generate_bytes", static_cast<int64_t>(func.memory)},
+        {"generate_timed_out", func.timed_out}});
+  }
+
+  return llvm::json::Object{{"stages", std::move(stages)},
+                            {"peak_memory", std::move(peak_memory)},
+                            {"prover", std::move(prover_stats)},
+                            {"rules", std::move(rules)},
+                            {"functions", std::move(functions)}};
+}
+
+static void PrintStatistics(const rellic::PassStatistics& stats) {
+  llvm::errs() << llvm::json::Value(StatisticsToJSON(stats)) << '\n';
+}
+
+// Parses --shard of the form `i/N`
+static bool ParseShard(unsigned& index, unsigned& count) {
+  auto [index_str, count_str]{llvm::StringRef(FLAGS_shard).split('/')};
+  return !index_str.getAsInteger(10, index) &&
+         !count_str.getAsInteger(10, count) && index < count;
+}
+
+static bool IsStreaming() {
+  return FLAGS_stream || !FLAGS_cache_dir.empty() || !FLAGS_shard.empty();
+}
+
+static rellic::DecompilationOptions GetOptions() {
+  rellic::DecompilationOptions opts{};
+  opts.lower_switches = FLAGS_lower_switch;
+  opts.remove_phi_nodes = FLAGS_remove_phi_nodes;
+  opts.pre_opt = FLAGS_pre_opt;
+  opts.coalesce_phi_nodes = FLAGS_coalesce_phi_nodes;
+  opts.num_threads = FLAGS_num_threads;
+  opts.simplify_threads = FLAGS_simplify_threads;
+  opts.prove_threads = FLAGS_prove_threads;
+  opts.generate_threads = FLAGS_generate_threads;
+  opts.unit_threads = FLAGS_unit_threads;
+  opts.max_fixpoint_iterations = FLAGS_max_iterations;
+  opts.module_timeout = std::chrono::milliseconds(FLAGS_timeout);
+  opts.function_timeout = std::chrono::milliseconds(FLAGS_function_timeout);
+  opts.memory_limit = FLAGS_memory_limit << 20;
+  opts.z3_timeout = FLAGS_z3_timeout;
+  opts.z3_rlimit = FLAGS_z3_rlimit;
+  if (FLAGS_truth_tables) {
+    opts.condition_engine = rellic::ConditionEngine::TruthTable;
+  }
+  opts.pipeline = FLAGS_pipeline;
+  opts.large_function_limits.blocks = FLAGS_large_function_blocks;
+  opts.large_function_limits.edges = FLAGS_large_function_edges;
+  opts.large_function_limits.loop_depth = FLAGS_large_function_loop_depth;
+  opts.large_function_limits.switch_cases = FLAGS_large_function_switch_cases;
+  opts.large_function_pipeline = FLAGS_large_function_pipeline;
+  opts.blob_initializer_size = FLAGS_blob_initializer_size;
+  opts.cond_var_size = FLAGS_cond_var_size;
+  opts.reach_var_size = FLAGS_reach_var_size;
+  opts.region_unit_size = FLAGS_region_unit_size;
+  if (FLAGS_pattern_structuring) {
+    opts.structuring = rellic::StructuringEngine::Patterns;
+  }
+  opts.goto_cond_size = FLAGS_goto_cond_size;
+  opts.goto_timeout = std::chrono::milliseconds(FLAGS_goto_timeout);
+  opts.cache_directory = FLAGS_cache_dir;
+  opts.checkpoint_out = FLAGS_checkpoint_out;
+  opts.resume_from = FLAGS_resume_from;
+  opts.rule_timing = FLAGS_rule_timing;
+  opts.forensics_directory = FLAGS_forensics_dir;
+  opts.forensics_time = std::chrono::milliseconds(FLAGS_forensics_ms);
+  opts.forensics_memory = FLAGS_forensics_mb << 20;
+  opts.forensics_queries = FLAGS_forensics_queries;
+  if (FLAGS_hex_literals) {
+    opts.hex_literals_from = 16;
+  }
+  if (!FLAGS_query_log.empty()) {
+    auto query_log{rellic::QueryLog::Create(FLAGS_query_log)};
+    CHECK(query_log.Succeeded()) << query_log.Error();
+    opts.query_log = query_log.TakeValue();
+  }
+  if (!FLAGS_event_log.empty()) {
+    auto level{rellic::ParseEventLevel(FLAGS_event_level)};
+    CHECK(level) << "Invalid event level " << FLAGS_event_level;
+    auto event_log{rellic::EventLog::Create(FLAGS_event_log, *level)};
+    CHECK(event_log.Succeeded()) << event_log.Error();
+    opts.event_log = event_log.TakeValue();
+  }
+  llvm::SmallVector<llvm::StringRef, 8> functions;
+  llvm::StringRef(FLAGS_functions).split(functions, ',', /*MaxSplit=*/-1,
+                                         /*KeepEmpty=*/false);
+  for (auto func : functions) {
+    opts.functions.insert(func.trim().str());
+  }
+  opts.include_callees = FLAGS_include_callees;
+  if (!FLAGS_shard.empty()) {
+    ParseShard(opts.shard_index, opts.num_shards);
+  }
+  opts.deduplicate_functions = FLAGS_deduplicate_functions;
+  opts.compact_ast = FLAGS_compact_ast;
+  // Streamed definitions are never printed again
+  opts.release_streamed_definitions = IsStreaming();
+  opts.provenance_maps = FLAGS_line_directives ||
+                         FLAGS_provenance_comments || FLAGS_ast_output ||
+                         !FLAGS_provenance_out.empty();
+  // The module is only consulted through the provenance maps and for
+  // --ast_output, which needs them
+  opts.keep_module = opts.provenance_maps;
+  return opts;
+}
+
+// Gets the options of the printer of `result`, annotating it with the
+// provenance of its statements if requested
+static rellic::CPrinterOptions GetPrinterOptions(
+    const rellic::DecompilationResult& result) {
+  rellic::CPrinterOptions options;
+  options.line_directives = FLAGS_line_directives;
+  options.provenance_comments = FLAGS_provenance_comments;
+  if (FLAGS_hex_literals) {
+    options.hex_literals = [](const llvm::APInt& value) {
+      return value.uge(16);
+    };
+  }
+  if (result.stmt_provenance.IsAvailable()) {
+    options.stmt_provenance = [&result](const clang::Stmt* stmt) {
+      return result.stmt_provenance.Lookup(stmt);
+    };
+    options.decl_provenance =
+        [&result](const clang::Decl* decl) -> const llvm::Value* {
+      auto vdecl{clang::dyn_cast<clang::ValueDecl>(decl)};
+      return vdecl ? result.value_decls.InverseLookup(vdecl) : nullptr;
+    };
+  }
+  return options;
+}
+
+// Prints the translation unit of `result`. The provenance of the printed nodes
+// is streamed to `exporter` if given.
+static void PrintResult(const rellic::DecompilationResult& result,
+                        llvm::raw_ostream& os,
+                        ProvenanceExporter* exporter = nullptr) {
+  auto& ast_ctx{result.ast->getASTContext()};
+  if (FLAGS_clang_printer) {
+    ast_ctx.getTranslationUnitDecl()->print(os);
+    return;
+  }
+
+  auto options{GetPrinterOptions(result)};
+  if (exporter) {
+    exporter->Install(options);
+  }
+  rellic::PrintTranslationUnit(os, ast_ctx, std::move(options),
+                               FLAGS_print_threads);
+}
+
+// Writes the AST, provenance table and IR of `result` next to `output` for
+// --ast_output. Returns an error message on failure.
+static std::string WriteSerializedAST(rellic::DecompilationResult& result,
+                                      const std::string& output) {
+  // The provenance table numbers the instructions of every definition
+  if (auto err = result.module->materializeAll()) {
+    return "Cannot materialize module: " + llvm::toString(std::move(err));
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream ast_os(output + ".ast", ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    return "Cannot create AST file: " + ec.message();
+  }
+  llvm::raw_fd_ostream table_os(output + ".prov", ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    return "Cannot create provenance file: " + ec.message();
+  }
+  llvm::raw_fd_ostream bc_os(output + ".bc", ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    return "Cannot create bitcode file: " + ec.message();
+  }
+
+  auto stats{rellic::SerializeAST(result, ast_os, table_os)};
+  if (!stats.Succeeded()) {
+    return stats.TakeError();
   }
+  llvm::WriteBitcodeToFile(*result.module, bc_os);
 
-  auto pc{inst->getMetadata("pc")};
-  if (!pc) {
-    return llvm::Optional<llvm::APInt>();
+  for (auto os : {&ast_os, &table_os, &bc_os}) {
+    os->close();
+    if (os->has_error()) {
+      auto message{"Cannot write serialized AST: " + os->error().message()};
+      os->clear_error();
+      return message;
+    }
+  }
+  return "";
+}
+
+// Loads `file`, or the standard input if it is `-`, into `buffer` and parses
+// the module in place. Files are mapped into memory when possible. Modules
+// loaded with --lazy_load refer to `buffer`, which must outlive them.
+static llvm::Module* LoadModule(llvm::LLVMContext& llvm_ctx,
+                                const std::string& file, bool allow_failure,
+                                std::unique_ptr<llvm::MemoryBuffer>& buffer) {
+  auto loaded{file == "-" ? llvm::MemoryBuffer::getSTDIN()
+                          : llvm::MemoryBuffer::getFile(file)};
+  if (!loaded) {
+    LOG_IF(FATAL, !allow_failure) << "Unable to read module file " << file
+                                  << ": " << loaded.getError().message();
+    return nullptr;
   }
+  buffer = std::move(*loaded);
 
-  auto& cop{pc->getOperand(0U)};
-  auto cval{llvm::cast<llvm::ConstantAsMetadata>(cop)->getValue()};
-  return llvm::cast<llvm::ConstantInt>(cval)->getValue();
+  // Textual IR cannot be loaded lazily
+  auto is_bitcode{llvm::isBitcode(
+      reinterpret_cast<const unsigned char*>(buffer->getBufferStart()),
+      reinterpret_cast<const unsigned char*>(buffer->getBufferEnd()))};
+  if (FLAGS_lazy_load && is_bitcode) {
+    return rellic::LoadLazyModuleFromMemory(
+        &llvm_ctx, buffer->getMemBufferRef(), allow_failure);
+  }
+  return rellic::LoadModuleFromMemory(&llvm_ctx, buffer->getMemBufferRef(),
+                                      allow_failure);
+}
+
+// The output of --shard: the declarations of the module, which are the same
+// for every shard, and the definitions of the shard, along with their position
+// among the definitions of the module so that rellic-merge can put them back
+// in module order
+struct ShardManifest {
+  struct Definition {
+    unsigned index;
+    std::string function;
+    std::string code;
+  };
+
+  std::string declarations;
+  std::vector<Definition> definitions;
+  std::unordered_map<const llvm::Function*, unsigned> indices;
+
+  void AddDefinition(const llvm::Function& func, llvm::StringRef code) {
+    // Definitions are only streamed once the module has been preprocessed,
+    // so its functions do not change anymore
+    if (indices.empty()) {
+      unsigned idx{0};
+      for (auto& other : func.getParent()->functions()) {
+        if (!other.isDeclaration()) {
+          indices[&other] = idx++;
+        }
+      }
+    }
+    definitions.push_back(
+        {indices.at(&func), ToJSONString(func.getName().str()), code.str()});
+  }
+
+  // `fingerprint` identifies the input module, so that shards of different
+  // modules are not merged together
+  void Write(llvm::raw_ostream& os, unsigned shard_index, unsigned num_shards,
+             llvm::StringRef fingerprint) const {
+    llvm::json::OStream json(os, /*IndentSize=*/2);
+    json.object([&]() {
+      json.attribute("format", "rellic-shard");
+      json.attribute("version", 1);
+      json.attribute("fingerprint", fingerprint);
+      json.attribute("shard", shard_index);
+      json.attribute("num_shards", num_shards);
+      json.attribute("declarations", ToJSONString(declarations));
+      json.attributeArray("definitions", [&]() {
+        for (auto& defn : definitions) {
+          json.object([&]() {
+            json.attribute("index", defn.index);
+            json.attribute("function", defn.function);
+            json.attribute("code", ToJSONString(defn.code));
+          });
+        }
+      });
+    });
+    os << '\n';
+  }
+};
+
+// Lists the inputs of --batch: the bitcode and textual IR files of a
+// directory, or the lines of a file. Empty lines and lines starting with '#'
+// are ignored.
+static std::vector<std::string> GetBatchInputs(const std::string& batch) {
+  std::vector<std::string> inputs;
+  if (llvm::sys::fs::is_directory(batch)) {
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(batch, ec), end;
+         !ec && it != end; it.increment(ec)) {
+      auto ext{llvm::sys::path::extension(it->path())};
+      if (ext == ".bc" || ext == ".ll") {
+        inputs.push_back(it->path());
+      }
+    }
+    CHECK(!ec) << "Cannot list " << batch << ": " << ec.message();
+    std::sort(inputs.begin(), inputs.end());
+    return inputs;
+  }
+
+  auto buffer{llvm::MemoryBuffer::getFile(batch)};
+  CHECK(buffer) << "Cannot read " << batch << ": "
+                << buffer.getError().message();
+  llvm::SmallVector<llvm::StringRef, 16> lines;
+  (*buffer)->getBuffer().split(lines, '\n');
+  for (auto line : lines) {
+    line = line.trim();
+    if (!line.empty() && !line.startswith("#")) {
+      inputs.push_back(line.str());
+    }
+  }
+  return inputs;
+}
+
+// Names the C file of each input after its stem, adding a number to the names
+// of inputs whose stems collide
+static std::vector<std::string> GetBatchOutputs(
+    const std::vector<std::string>& inputs, const std::string& directory) {
+  std::vector<std::string> outputs;
+  std::set<std::string> names;
+  for (auto& input : inputs) {
+    auto stem{llvm::sys::path::stem(input).str()};
+    auto name{stem + ".c"};
+    for (unsigned i{1}; !names.insert(name).second; ++i) {
+      name = stem + "-" + std::to_string(i) + ".c";
+    }
+
+    llvm::SmallString<256> path(directory);
+    llvm::sys::path::append(path, name);
+    outputs.push_back(path.str().str());
+  }
+  return outputs;
+}
+
+// A queue of at most `capacity` elements between two stages of `RunBatch`.
+// Producers wait while it is full, which bounds the number of modules held in
+// memory, and consumers wait while it is empty until it is closed.
+template <typename T>
+class BoundedQueue {
+  std::mutex mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+  std::deque<T> items;
+  size_t capacity;
+  bool closed{false};
+
+ public:
+  explicit BoundedQueue(size_t capacity)
+      : capacity(std::max<size_t>(capacity, 1)) {}
+
+  void Push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [this]() { return items.size() < capacity; });
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+  }
+
+  // Returns false once the queue is closed and empty
+  bool Pop(T& item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this]() { return !items.empty() || closed; });
+    if (items.empty()) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::unique_lock<std::mutex> lock(mutex);
+    closed = true;
+    not_empty.notify_all();
+  }
+};
+
+// An input of --batch as it goes through the stages of `RunBatch`. Once an
+// input has failed, the later stages only report it.
+struct BatchItem {
+  std::string input;
+  std::string output;
+  // Time spent on the input by the stages, not counting the time it waited
+  // in their queues
+  std::chrono::steady_clock::duration elapsed{0};
+  std::string error;
+  std::unique_ptr<llvm::LLVMContext> llvm_ctx;
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  std::unique_ptr<llvm::Module> module;
+  // Only opened by the decompiling stage when streaming
+  std::unique_ptr<llvm::raw_fd_ostream> os;
+  std::optional<rellic::DecompilationResult> result;
+};
+
+// Adds the time since `start` to `item` when it goes out of scope
+class StageTimer {
+  BatchItem& item;
+  std::chrono::steady_clock::time_point start;
+
+ public:
+  StageTimer(BatchItem& item)
+      : item(item), start(std::chrono::steady_clock::now()) {}
+  ~StageTimer() { item.elapsed += std::chrono::steady_clock::now() - start; }
+};
+
+static bool CreateOutput(BatchItem& item) {
+  std::error_code ec;
+  item.os = std::make_unique<llvm::raw_fd_ostream>(item.output, ec);
+  if (ec) {
+    item.os.reset();
+    item.error = "Cannot create output file: " + ec.message();
+    return false;
+  }
+  return true;
+}
+
+static void LoadBatchItem(BatchItem& item) {
+  StageTimer timer(item);
+  item.llvm_ctx = std::make_unique<llvm::LLVMContext>();
+  item.module.reset(LoadModule(*item.llvm_ctx, item.input,
+                               /*allow_failure=*/true, item.buffer));
+  if (!item.module) {
+    item.error = "Cannot load module";
+  }
+}
+
+static void DecompileBatchItem(rellic::Decompiler& decompiler,
+                               BatchItem& item,
+                               rellic::DecompilationOptions opts) {
+  StageTimer timer(item);
+  if (!item.error.empty()) {
+    return;
+  }
+
+  // Streamed code is written while it is being decompiled
+  if (IsStreaming()) {
+    if (!CreateOutput(item)) {
+      return;
+    }
+    auto& os{*item.os};
+    opts.on_declarations = [&os](llvm::StringRef code) { os << code; };
+    opts.on_definition = [&os](const llvm::Function& func,
+                               llvm::StringRef code) { os << code; };
+  }
+
+  auto result{decompiler.Decompile(std::move(item.module), std::move(opts))};
+  if (!result.Succeeded()) {
+    item.error = result.TakeError().message;
+    return;
+  }
+  item.result = result.TakeValue();
+}
+
+// Writes the output of `item` and describes the outcome. The status is "ok",
+// "partial" if some function definitions could not be decompiled, or
+// "error".
+static llvm::json::Object WriteBatchItem(BatchItem& item) {
+  llvm::json::Object report{{"input", ToJSONString(item.input)},
+                            {"output", ToJSONString(item.output)}};
+  auto Finish = [&](const char* status) {
+    report["status"] = status;
+    report["duration_ms"] =
+        std::chrono::duration<double, std::milli>(item.elapsed).count();
+    return std::move(report);
+  };
+  auto Fail = [&]() {
+    LOG(ERROR) << "Cannot decompile " << item.input << ": " << item.error;
+    report["error"] = ToJSONString(item.error);
+    return Finish("error");
+  };
+
+  {
+    StageTimer timer(item);
+    if (item.error.empty() && !IsStreaming() && CreateOutput(item)) {
+      PrintResult(*item.result, *item.os);
+    }
+    if (item.os) {
+      item.os->close();
+      if (item.error.empty() && item.os->has_error()) {
+        item.error = "Cannot write output file: " + item.os->error().message();
+      }
+      item.os->clear_error();
+    }
+    if (item.error.empty() && FLAGS_ast_output) {
+      item.error = WriteSerializedAST(*item.result, item.output);
+    }
+  }
+  if (!item.error.empty()) {
+    return Fail();
+  }
+
+  auto& value{*item.result};
+  llvm::json::Array function_errors;
+  for (auto& error : value.function_errors) {
+    function_errors.push_back(llvm::json::Object{
+        {"function", ToJSONString(error.name)},
+        {"message", ToJSONString(error.message)}});
+  }
+  bool truncated{false};
+  for (auto& stage : value.statistics.stages) {
+    truncated |= stage.truncated;
+  }
+  report["truncated"] = truncated;
+  report["stats"] = StatisticsToJSON(value.statistics);
+  auto status{function_errors.empty() ? "ok" : "partial"};
+  report["function_errors"] = std::move(function_errors);
+  return Finish(status);
+}
+
+// Starts recording spans on this thread if --trace_out is set
+static void StartTrace() {
+  if (!FLAGS_trace_out.empty()) {
+    llvm::timeTraceProfilerInitialize(/*TimeTraceGranularity=*/0, "rellic");
+  }
+}
+
+// Writes the spans recorded by every thread to --trace_out
+static void WriteTrace() {
+  if (!rellic::IsTracing()) {
+    return;
+  }
+  std::error_code ec;
+  llvm::raw_fd_ostream os(FLAGS_trace_out, ec, llvm::sys::fs::OF_Text);
+  CHECK(!ec) << "Failed to create trace file: " << ec.message();
+  llvm::timeTraceProfilerWrite(os);
+  llvm::timeTraceProfilerCleanup();
+}
+
+// Decompiles every input of --batch into the --output directory. Inputs go
+// through a pipeline of stages connected by bounded queues: a thread loads
+// the modules ahead of a pool of --batch_jobs threads, which share the LLVM,
+// Clang and Z3 initialization of the process to decompile them, and another
+// thread writes their outputs. Each input is reported on its own line of the
+// report as soon as it is written.
+static int RunBatch(const rellic::DecompilationOptions& opts) {
+  auto inputs{GetBatchInputs(FLAGS_batch)};
+  auto ec{llvm::sys::fs::create_directories(FLAGS_output)};
+  CHECK(!ec) << "Failed to create output directory: " << ec.message();
+  auto outputs{GetBatchOutputs(inputs, FLAGS_output)};
+
+  std::string report_path{FLAGS_batch_report};
+  if (report_path.empty()) {
+    llvm::SmallString<256> path(FLAGS_output);
+    llvm::sys::path::append(path, "report.jsonl");
+    report_path = path.str().str();
+  }
+  llvm::raw_fd_ostream report(report_path, ec);
+  CHECK(!ec) << "Failed to create report file: " << ec.message();
+
+  unsigned num_jobs{FLAGS_batch_jobs ? FLAGS_batch_jobs
+                                     : std::thread::hardware_concurrency()};
+  num_jobs = std::max(1U, std::min<unsigned>(num_jobs, inputs.size()));
+  rellic::Decompiler decompiler(num_jobs);
+
+  using Queue = BoundedQueue<std::unique_ptr<BatchItem>>;
+  Queue loaded(FLAGS_batch_queue ? FLAGS_batch_queue : num_jobs);
+  Queue decompiled(FLAGS_batch_queue ? FLAGS_batch_queue : num_jobs);
+  size_t num_failed{0};
+  auto tracing{rellic::IsTracing()};
+
+  std::thread loader([&, tracing]() {
+    rellic::TraceThread trace_thread(tracing);
+    for (size_t idx{0}; idx < inputs.size(); ++idx) {
+      auto item{std::make_unique<BatchItem>()};
+      item->input = inputs[idx];
+      item->output = outputs[idx];
+      LoadBatchItem(*item);
+      loaded.Push(std::move(item));
+    }
+  });
+
+  std::vector<std::thread> workers;
+  for (unsigned i{0}; i < num_jobs; ++i) {
+    workers.emplace_back([&, tracing]() {
+      rellic::TraceThread trace_thread(tracing);
+      std::unique_ptr<BatchItem> item;
+      while (loaded.Pop(item)) {
+        DecompileBatchItem(decompiler, *item, opts);
+        decompiled.Push(std::move(item));
+      }
+    });
+  }
+
+  std::thread writer([&, tracing]() {
+    rellic::TraceThread trace_thread(tracing);
+    std::unique_ptr<BatchItem> item;
+    while (decompiled.Pop(item)) {
+      auto entry{WriteBatchItem(*item)};
+      // The module and AST of the input are freed before the next one is
+      // taken from the queue
+      item.reset();
+      if (*entry.getString("status") == "error") {
+        ++num_failed;
+      }
+      report << llvm::json::Value(std::move(entry)) << '\n';
+      report.flush();
+    }
+  });
+
+  loader.join();
+  loaded.Close();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  decompiled.Close();
+  writer.join();
+
+  LOG(INFO) << "Decompiled " << inputs.size() - num_failed << " of "
+            << inputs.size() << " inputs";
+  return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 }  // namespace
 
@@ -88,6 +1001,31 @@ int main(int argc, char* argv[]) {
         << "    --input INPUT_BC_FILE \\" << std::endl
         << "    --output OUTPUT_C_FILE \\" << std::endl
         << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --batch INPUT_LIST_OR_DIR \\" << std::endl
+        << "    --output OUTPUT_DIR \\" << std::endl
+        << "    [--batch_jobs N] [--batch_queue N] \\" << std::endl
+        << "    [--batch_report REPORT_JSONL_FILE]" << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --input INPUT_BC_FILE \\" << std::endl
+        << "    --shard I/N \\" << std::endl
+        << "    --output OUTPUT_SHARD_JSON_FILE" << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --input INPUT_BC_FILE \\" << std::endl
+        << "    --resume_from CHECKPOINT_FILE \\" << std::endl
+        << "    --output OUTPUT_C_FILE" << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --input INPUT_BC_FILE \\" << std::endl
+        << "    --split_output [--split_bucket_size N] \\" << std::endl
+        << "    --output OUTPUT_DIR" << std::endl
+        << std::endl
+
+        // Record a Chrome trace of the decompilation.
+        << "    [--trace_out TRACE_JSON_FILE]" << std::endl
+        << std::endl
 
         // Print the version and exit.
         << "    [--version]" << std::endl
@@ -99,36 +1037,147 @@ int main(int argc, char* argv[]) {
   SetVersion();
   google::ParseCommandLineFlags(&argc, &argv, true);
 
-  LOG_IF(ERROR, FLAGS_input.empty())
+  auto batch{!FLAGS_batch.empty()};
+  LOG_IF(ERROR, FLAGS_input.empty() && !batch)
       << "Must specify the path to an input LLVM bitcode file.";
 
+  LOG_IF(ERROR, !FLAGS_input.empty() && batch)
+      << "Must not specify an input file with --batch.";
+
   LOG_IF(ERROR, FLAGS_output.empty())
-      << "Must specify the path to an output C file.";
+      << "Must specify the path to an output C file, or directory with "
+         "--batch.";
+
+  LOG_IF(ERROR, IsStreaming() &&
+                    (FLAGS_line_directives || FLAGS_provenance_comments))
+      << "Cannot annotate the output with its provenance when streaming.";
+
+  LOG_IF(ERROR, IsStreaming() && FLAGS_ast_output)
+      << "Cannot write the AST when streaming.";
+
+  auto shard{!FLAGS_shard.empty()};
+  unsigned shard_index{0}, num_shards{1};
+  auto shard_conflict{shard && (batch || !ParseShard(shard_index, num_shards))};
+  LOG_IF(ERROR, shard_conflict)
+      << "Must specify a shard of the form i/N, with i < N, and no --batch.";
+
+  auto checkpoint_conflict{
+      batch && (!FLAGS_checkpoint_out.empty() || !FLAGS_resume_from.empty())};
+  LOG_IF(ERROR, checkpoint_conflict)
+      << "Cannot write or resume from a checkpoint with --batch.";
 
-  if (FLAGS_input.empty() || FLAGS_output.empty()) {
+  auto provenance_out{!FLAGS_provenance_out.empty()};
+  auto provenance_conflict{provenance_out && (batch || IsStreaming() ||
+                                              FLAGS_clang_printer)};
+  LOG_IF(ERROR, provenance_conflict)
+      << "Cannot export the provenance with --batch, --clang_printer or when "
+         "streaming.";
+
+  auto split_conflict{FLAGS_split_output &&
+                      (batch || shard || IsStreaming() || provenance_out ||
+                       FLAGS_clang_printer || FLAGS_ast_output)};
+  LOG_IF(ERROR, split_conflict)
+      << "Cannot split the output with --batch, --shard, --clang_printer, "
+         "--provenance_out, --ast_output or when streaming.";
+
+  if (FLAGS_input.empty() == !batch || FLAGS_output.empty() ||
+      (IsStreaming() && (FLAGS_line_directives || FLAGS_provenance_comments ||
+                         FLAGS_ast_output)) ||
+      provenance_conflict || shard_conflict || checkpoint_conflict ||
+      split_conflict) {
     std::cerr << google::ProgramUsage();
     return EXIT_FAILURE;
   }
 
+  StartTrace();
+  if (batch) {
+    auto status{RunBatch(GetOptions())};
+    WriteTrace();
+    google::ShutDownCommandLineFlags();
+    google::ShutdownGoogleLogging();
+    return status;
+  }
+
   std::unique_ptr<llvm::LLVMContext> llvm_ctx(new llvm::LLVMContext);
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
   auto module{std::unique_ptr<llvm::Module>(
-      rellic::LoadModuleFromFile(llvm_ctx.get(), FLAGS_input))};
+      LoadModule(*llvm_ctx, FLAGS_input, /*allow_failure=*/false, buffer))};
 
+  // Split outputs are written to a directory once the decompilation is done
   std::error_code ec;
-  llvm::raw_fd_ostream output(FLAGS_output, ec);
-  CHECK(!ec) << "Failed to create output file: " << ec.message();
+  std::unique_ptr<llvm::raw_fd_ostream> output_file;
+  if (!FLAGS_split_output) {
+    output_file = std::make_unique<llvm::raw_fd_ostream>(FLAGS_output, ec);
+    CHECK(!ec) << "Failed to create output file: " << ec.message();
+  }
+  llvm::raw_ostream& output{output_file ? *output_file : llvm::nulls()};
 
-  rellic::DecompilationOptions opts{};
-  opts.lower_switches = FLAGS_lower_switch;
-  opts.remove_phi_nodes = FLAGS_remove_phi_nodes;
+  // Shards are written once the decompilation is done
+  std::string fingerprint;
+  ShardManifest manifest;
+  if (shard) {
+    llvm::MD5 md5;
+    md5.update(buffer->getBuffer());
+    llvm::MD5::MD5Result hash;
+    md5.final(hash);
+    fingerprint = hash.digest().str().str();
+  }
+
+  auto opts{GetOptions()};
+  auto stream{IsStreaming()};
+  if (shard) {
+    opts.on_declarations = [&manifest](llvm::StringRef code) {
+      manifest.declarations = code.str();
+    };
+    opts.on_definition = [&manifest](const llvm::Function& func,
+                                     llvm::StringRef code) {
+      manifest.AddDefinition(func, code);
+    };
+  } else if (stream) {
+    opts.on_declarations = [&output](llvm::StringRef code) {
+      output << code;
+      output.flush();
+    };
+    opts.on_definition = [&output](const llvm::Function& func,
+                                   llvm::StringRef code) {
+      output << code;
+      output.flush();
+    };
+  }
 
   auto result{rellic::Decompile(std::move(module), std::move(opts))};
   if (result.Succeeded()) {
     auto value{result.TakeValue()};
-    value.ast->getASTContext().getTranslationUnitDecl()->print(output);
+    if (shard) {
+      manifest.Write(output, shard_index, num_shards, fingerprint);
+    }
+    if (provenance_out) {
+      llvm::raw_fd_ostream provenance(FLAGS_provenance_out, ec,
+                                      llvm::sys::fs::OF_Text);
+      CHECK(!ec) << "Failed to create provenance file: " << ec.message();
+      ProvenanceExporter exporter(value, provenance);
+      PrintResult(value, output, &exporter);
+    } else if (FLAGS_split_output) {
+      SplitOutputOptions split_opts;
+      split_opts.bucket_size = FLAGS_split_bucket_size;
+      split_opts.num_threads = FLAGS_print_threads;
+      split_opts.printer = GetPrinterOptions(value);
+      auto message{WriteSplitOutput(value, FLAGS_output, split_opts)};
+      CHECK(message.empty()) << message;
+    } else if (!stream) {
+      PrintResult(value, output);
+    }
+    if (FLAGS_ast_output) {
+      auto message{WriteSerializedAST(value, FLAGS_output)};
+      CHECK(message.empty()) << message;
+    }
+    if (FLAGS_stats) {
+      PrintStatistics(value.statistics);
+    }
   } else {
     LOG(FATAL) << result.TakeError().message;
   }
+  WriteTrace();
 
   google::ShutDownCommandLineFlags();
   google::ShutdownGoogleLogging();
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "ProvenanceExport.h"
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/Expr.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/JSON.h>
+
+#include "rellic/BC/Util.h"
+
+// IR names may come from anywhere, but JSON strings must be valid UTF-8
+static std::string ToJSONString(std::string str) {
+  return llvm::json::isUTF8(str) ? str : llvm::json::fixUTF8(str);
+}
+
+static const llvm::Function* GetFunction(const llvm::Value* value) {
+  if (auto inst = llvm::dyn_cast<llvm::Instruction>(value)) {
+    return inst->getFunction();
+  }
+  if (auto arg = llvm::dyn_cast<llvm::Argument>(value)) {
+    return arg->getParent();
+  }
+  if (auto block = llvm::dyn_cast<llvm::BasicBlock>(value)) {
+    return block->getParent();
+  }
+  return nullptr;
+}
+
+ProvenanceExporter::ProvenanceExporter(
+    const rellic::DecompilationResult& result, llvm::raw_ostream& os)
+    : result(result),
+      os(os),
+      slots(std::make_unique<llvm::ModuleSlotTracker>(
+          result.module.get(), /*ShouldInitializeAllMetadata=*/false)) {}
+
+void ProvenanceExporter::Install(rellic::CPrinterOptions& options) {
+  options.on_stmt_range = [this](const clang::Stmt* stmt,
+                                 rellic::CPrinterLocation begin,
+                                 rellic::CPrinterLocation end) {
+    OnStmt(stmt, begin, end);
+  };
+  options.on_decl_range = [this](const clang::Decl* decl,
+                                 rellic::CPrinterLocation begin,
+                                 rellic::CPrinterLocation end) {
+    OnDecl(decl, begin, end);
+  };
+}
+
+// Unnamed values are numbered by the slot tracker, which numbers each function
+// once rather than every time one of its values is printed. Records mostly
+// come function by function, in the order they are printed.
+std::string ProvenanceExporter::GetOperand(const llvm::Value* value) {
+  auto func{GetFunction(value)};
+  if (func && func != slots_function) {
+    slots->incorporateFunction(*func);
+    slots_function = func;
+  }
+  std::string operand;
+  llvm::raw_string_ostream operand_os(operand);
+  value->printAsOperand(operand_os, /*PrintType=*/false, *slots);
+  return ToJSONString(operand_os.str());
+}
+
+void ProvenanceExporter::WriteRecord(llvm::StringRef kind,
+                                     llvm::StringRef node,
+                                     rellic::CPrinterLocation begin,
+                                     rellic::CPrinterLocation end,
+                                     const llvm::Value* value,
+                                     const llvm::Use* use,
+                                     const llvm::Type* type) {
+  llvm::json::OStream json(os);
+  json.object([&]() {
+    json.attribute("kind", kind);
+    json.attribute("node", node);
+    json.attributeArray("begin", [&]() {
+      json.value(begin.line);
+      json.value(begin.column);
+    });
+    json.attributeArray("end", [&]() {
+      json.value(end.line);
+      json.value(end.column);
+    });
+    json.attributeArray("offsets", [&]() {
+      json.value(static_cast<int64_t>(begin.offset));
+      json.value(static_cast<int64_t>(end.offset));
+    });
+
+    if (value) {
+      json.attribute("value", GetOperand(value));
+      if (auto func = GetFunction(value)) {
+        json.attribute("function", ToJSONString(func->getName().str()));
+      }
+      if (auto inst = llvm::dyn_cast<llvm::Instruction>(value)) {
+        json.attribute("opcode", inst->getOpcodeName());
+      }
+      if (auto pc = rellic::GetPCMetadata(const_cast<llvm::Value*>(value))) {
+        llvm::SmallString<20> digits;
+        pc->toString(digits, 16, /*Signed=*/false);
+        json.attribute("pc", "0x" + digits.str().str());
+      }
+    }
+
+    if (use) {
+      json.attribute("user", GetOperand(use->getUser()));
+      json.attribute("operand", use->getOperandNo());
+    }
+
+    if (type) {
+      std::string str;
+      llvm::raw_string_ostream str_os(str);
+      type->print(str_os);
+      json.attribute("type", ToJSONString(str_os.str()));
+    }
+  });
+  os << '\n';
+  ++num_records;
+}
+
+void ProvenanceExporter::OnStmt(const clang::Stmt* stmt,
+                                rellic::CPrinterLocation begin,
+                                rellic::CPrinterLocation end) {
+  if (auto value = result.stmt_provenance.Lookup(stmt)) {
+    WriteRecord("stmt", stmt->getStmtClassName(), begin, end, value, nullptr,
+                nullptr);
+  }
+
+  auto expr{clang::dyn_cast<clang::Expr>(stmt)};
+  if (!expr) {
+    return;
+  }
+  if (auto use = result.use_provenance.Lookup(expr)) {
+    WriteRecord("use", stmt->getStmtClassName(), begin, end, use->get(), use,
+                nullptr);
+  }
+}
+
+void ProvenanceExporter::OnDecl(const clang::Decl* decl,
+                                rellic::CPrinterLocation begin,
+                                rellic::CPrinterLocation end) {
+  if (auto vdecl = clang::dyn_cast<clang::ValueDecl>(decl)) {
+    if (auto value = result.value_decls.InverseLookup(vdecl)) {
+      WriteRecord("decl", decl->getDeclKindName(), begin, end, value, nullptr,
+                  nullptr);
+    }
+  } else if (auto tdecl = clang::dyn_cast<clang::TypeDecl>(decl)) {
+    if (auto type = result.type_decls.InverseLookup(tdecl)) {
+      WriteRecord("type", decl->getDeclKindName(), begin, end, nullptr,
+                  nullptr, type);
+    }
+  }
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/IR/ModuleSlotTracker.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <memory>
+#include <string>
+
+#include "rellic/AST/CPrinter.h"
+#include "rellic/Decompiler.h"
+
+/* Streams the provenance of a decompilation as JSON Lines while its C code is
+ * printed, for --provenance_out. Each record describes one mapping of the
+ * provenance maps of the result whose AST node has been printed:
+ *
+ *   kind:      `stmt` for statements and expressions generated from an IR
+ *              value, `use` for expressions generated from an operand, `decl`
+ *              for declarations of IR values and `type` for declarations of IR
+ *              types
+ *   node:      the kind of AST node
+ *   begin/end: the line and column of the node in the C output, where `end`
+ *              is right after its last character, and `offsets` the same
+ *              range in bytes
+ *   value:     the IR value, as an operand, with its `function`, `opcode` and
+ *              `pc` metadata when it has them
+ *   user/operand: the user of the operand of `use` records
+ *   type:      the IR type of `type` records
+ *
+ * Records are written as soon as their node has been printed, and nothing is
+ * kept once they have been written. */
+class ProvenanceExporter {
+  const rellic::DecompilationResult& result;
+  llvm::raw_ostream& os;
+  std::unique_ptr<llvm::ModuleSlotTracker> slots;
+  const llvm::Function* slots_function{nullptr};
+  size_t num_records{0};
+
+  std::string GetOperand(const llvm::Value* value);
+  void WriteRecord(llvm::StringRef kind, llvm::StringRef node,
+                   rellic::CPrinterLocation begin, rellic::CPrinterLocation end,
+                   const llvm::Value* value, const llvm::Use* use,
+                   const llvm::Type* type);
+
+ public:
+  ProvenanceExporter(const rellic::DecompilationResult& result,
+                     llvm::raw_ostream& os);
+
+  // Sets the range callbacks of `options` to write the records
+  void Install(rellic::CPrinterOptions& options);
+
+  void OnStmt(const clang::Stmt* stmt, rellic::CPrinterLocation begin,
+              rellic::CPrinterLocation end);
+  void OnDecl(const clang::Decl* decl, rellic::CPrinterLocation begin,
+              rellic::CPrinterLocation end);
+
+  size_t GetNumRecords() const { return num_records; }
+};
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "SplitOutput.h"
+
+#include <clang/AST/Decl.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+// A top-level declaration of a file, printed either as it is or as an
+// external declaration
+struct Entry {
+  clang::DeclContext::decl_iterator decl;
+  bool external;
+};
+
+struct SplitFile {
+  std::string name;
+  std::string prefix;
+  std::vector<Entry> entries;
+};
+}  // namespace
+
+// Names the source file of a bucket after its first function. Names are
+// compared regardless of case, as file systems may not tell them apart.
+static std::string GetFileName(llvm::StringRef function,
+                               std::unordered_set<std::string>& names) {
+  std::string stem;
+  for (auto c : function.take_front(128)) {
+    auto valid{llvm::isAlnum(c) || c == '_' || c == '-' ||
+               (c == '.' && !stem.empty())};
+    stem.push_back(valid ? c : '_');
+  }
+  if (stem.empty()) {
+    stem = "function";
+  }
+
+  auto name{stem};
+  for (unsigned i{1}; !names.insert(llvm::StringRef(name).lower()).second;
+       ++i) {
+    name = stem + "-" + std::to_string(i);
+  }
+  return name + ".c";
+}
+
+// Writes `contents` to `path`, unless it already holds them. Returns an error
+// message, or an empty string on success.
+static std::string WriteIfChanged(const std::string& path,
+                                  llvm::StringRef contents) {
+  {
+    auto existing{llvm::MemoryBuffer::getFile(path)};
+    if (existing && (*existing)->getBuffer() == contents) {
+      return "";
+    }
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec);
+  if (ec) {
+    return "Cannot create " + path + ": " + ec.message();
+  }
+  os << contents;
+  os.close();
+  if (os.has_error()) {
+    auto message{"Cannot write " + path + ": " + os.error().message()};
+    os.clear_error();
+    return message;
+  }
+  return "";
+}
+
+std::string WriteSplitOutput(const rellic::DecompilationResult& result,
+                             const std::string& directory,
+                             const SplitOutputOptions& options) {
+  auto ec{llvm::sys::fs::create_directories(directory)};
+  if (ec) {
+    return "Cannot create " + directory + ": " + ec.message();
+  }
+
+  auto& ast_ctx{result.ast->getASTContext()};
+  auto tudecl{ast_ctx.getTranslationUnitDecl()};
+  std::string include{"#include \"module.h\"\n\n"};
+  SplitFile header{"module.h", "#pragma once\n\n", {}};
+  SplitFile globals{"globals.c", include, {}};
+  std::vector<SplitFile> sources;
+  std::unordered_set<std::string> names{"globals"};
+  auto bucket_size{std::max(options.bucket_size, 1U)};
+  for (auto it{tudecl->decls_begin()}, end{tudecl->decls_end()}; it != end;
+       ++it) {
+    auto decl{*it};
+    if (decl->isImplicit()) {
+      continue;
+    }
+
+    if (auto fdecl = clang::dyn_cast<clang::FunctionDecl>(decl)) {
+      header.entries.push_back({it, true});
+      if (fdecl->doesThisDeclarationHaveABody()) {
+        if (sources.empty() || sources.back().entries.size() >= bucket_size) {
+          auto name{GetFileName(fdecl->getName(), names)};
+          sources.push_back({name, include, {}});
+        }
+        sources.back().entries.push_back({it, false});
+      }
+    } else if (clang::isa<clang::VarDecl>(decl)) {
+      header.entries.push_back({it, true});
+      globals.entries.push_back({it, false});
+    } else {
+      header.entries.push_back({it, false});
+    }
+  }
+
+  std::vector<SplitFile*> files{&header, &globals};
+  std::string source_list{globals.name + "\n"};
+  for (auto& source : sources) {
+    files.push_back(&source);
+    source_list += source.name + "\n";
+  }
+
+  auto printer_options{options.printer};
+  printer_options.on_stmt_range = nullptr;
+  printer_options.on_decl_range = nullptr;
+  std::vector<std::string> errors(files.size());
+  std::atomic_size_t next_file{0};
+  auto Write{[&]() {
+    for (auto idx{next_file++}; idx < files.size(); idx = next_file++) {
+      auto& file{*files[idx]};
+      std::string code{file.prefix};
+      {
+        // Printers are not shared by files, as they remember the last line
+        // directive they have written
+        llvm::raw_string_ostream os(code);
+        rellic::CPrinter printer(os, ast_ctx, printer_options);
+        for (auto& entry : file.entries) {
+          if (entry.external) {
+            printer.PrintExternalDecl(
+                clang::cast<clang::DeclaratorDecl>(*entry.decl));
+          } else {
+            printer.PrintTopLevelDecls(entry.decl, std::next(entry.decl));
+          }
+        }
+      }
+
+      llvm::SmallString<256> path(directory);
+      llvm::sys::path::append(path, file.name);
+      errors[idx] = WriteIfChanged(path.str().str(), code);
+    }
+  }};
+
+  std::vector<std::thread> workers;
+  auto num_threads{std::min<size_t>(std::max(options.num_threads, 1U),
+                                    files.size())};
+  for (size_t i{1}; i < num_threads; ++i) {
+    workers.emplace_back(Write);
+  }
+  Write();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  for (auto& error : errors) {
+    if (!error.empty()) {
+      return error;
+    }
+  }
+
+  llvm::SmallString<256> path(directory);
+  llvm::sys::path::append(path, "sources.txt");
+  return WriteIfChanged(path.str().str(), source_list);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "rellic/AST/CPrinter.h"
+#include "rellic/Decompiler.h"
+
+struct SplitOutputOptions {
+  // Number of consecutive function definitions in each source file
+  unsigned bucket_size = 1;
+  // Number of threads printing and writing the files
+  unsigned num_threads = 1;
+  // Range callbacks are ignored, as the output spans many files
+  rellic::CPrinterOptions printer;
+};
+
+/* Writes the translation unit of `result` to `directory`, for --split_output,
+ * as the following files:
+ *
+ *   module.h:    the types of the module, `extern` declarations of its global
+ *                variables and prototypes of all of its functions
+ *   globals.c:   the definitions of the global variables
+ *   NAME.c:      the function definitions of each bucket, named after the
+ *                first of them
+ *   sources.txt: the names of the source files, one per line
+ *
+ * Source files include module.h, so they can be compiled on their own. Files
+ * that already hold the same contents are not rewritten, so that their
+ * modification times only change along with them, but the files of earlier
+ * outputs that are not part of this one are not removed.
+ *
+ * Returns an error message, or an empty string on success. */
+std::string WriteSplitOutput(const rellic::DecompilationResult& result,
+                             const std::string& directory,
+                             const SplitOutputOptions& options);
@@ -9,11 +9,26 @@
 #include <clang/Tooling/Tooling.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "TypeCache.h"
 #include "rellic/AST/DebugInfoCollector.h"
 #include "rellic/AST/StructGenerator.h"
 #include "rellic/AST/SubprogramGenerator.h"
@@ -27,6 +42,18 @@
 DEFINE_string(input, "", "Input file.");
 DEFINE_string(output, "", "Output file.");
 DEFINE_bool(generate_prototypes, true, "Generate function prototypes.");
+DEFINE_string(roots, "",
+              "Comma-separated names of functions and global variables. If "
+              "set, only the types they use, directly or not, and the "
+              "prototypes of the functions are generated.");
+DEFINE_string(cache_dir, "",
+              "Directory in which the generated declarations are saved as "
+              "Clang AST files, and reused by later runs on inputs with the "
+              "same debug information.");
+DEFINE_uint32(threads, 1,
+              "Number of threads generating declarations. Types that are "
+              "not related to each other are split into groups, which are "
+              "generated independently and printed one after the other.");
 
 DECLARE_bool(version);
 
@@ -59,6 +86,213 @@ static void SetVersion(void) {
   google::SetVersionString(version.str());
 }
 
+// Adds `root` and all the types it refers to, including through pointers, to
+// `closure`, each once and in the order they are found
+static void CollectTypes(llvm::DIType* root,
+                         std::unordered_set<llvm::DIType*>& seen,
+                         std::vector<llvm::DIType*>& closure) {
+  std::vector<llvm::DIType*> worklist{root};
+  while (!worklist.empty()) {
+    auto type{worklist.back()};
+    worklist.pop_back();
+    if (!type || !seen.insert(type).second) {
+      continue;
+    }
+    closure.push_back(type);
+
+    if (auto comp = llvm::dyn_cast<llvm::DICompositeType>(type)) {
+      worklist.push_back(comp->getBaseType());
+      for (auto elem : comp->getElements()) {
+        if (auto member = llvm::dyn_cast<llvm::DIDerivedType>(elem)) {
+          worklist.push_back(member->getBaseType());
+        }
+      }
+    } else if (auto der = llvm::dyn_cast<llvm::DIDerivedType>(type)) {
+      worklist.push_back(der->getBaseType());
+    } else if (auto sub = llvm::dyn_cast<llvm::DISubroutineType>(type)) {
+      for (auto elem : sub->getTypeArray()) {
+        worklist.push_back(elem);
+      }
+    }
+  }
+}
+
+// Types and prototypes that are generated in a translation unit of their own
+struct TypeGroup {
+  std::vector<llvm::DIType*> types;
+  std::vector<llvm::DISubprogram*> subprograms;
+  // Number of types the group refers to, directly or not
+  size_t size{0};
+};
+
+// Returns the name `StructGenerator` starts from when naming declarations
+// called `name`, that is without the `_N` suffixes that keep names unique.
+// Unnamed declarations are called `anon`.
+static std::string GetNameKey(llvm::StringRef name) {
+  for (;;) {
+    auto pos{name.rfind('_')};
+    if (pos == llvm::StringRef::npos || pos + 1 == name.size() ||
+        !std::all_of(name.begin() + pos + 1, name.end(), llvm::isDigit)) {
+      break;
+    }
+    name = name.take_front(pos);
+  }
+  return name.empty() ? "anon" : name.str();
+}
+
+// Splits `types` and `subprograms` into at most `num_groups` groups that can
+// be generated by separate `StructGenerator`s. Types that refer to each other
+// are in the same group, and so are the declarations that may be given the
+// same name, like the copies of a record emitted by every compilation unit,
+// which `StructGenerator` merges or names apart. The order of the roots is
+// kept within each group.
+static std::vector<TypeGroup> PartitionTypes(
+    const std::vector<llvm::DIType*>& types,
+    const std::vector<llvm::DISubprogram*>& subprograms, unsigned num_groups) {
+  // Types are connected with a union-find forest, in which the types that
+  // declare a name are also connected to the first type that declared it
+  std::unordered_map<llvm::DIType*, llvm::DIType*> parents;
+  std::unordered_map<std::string, llvm::DIType*> names;
+  auto Find = [&](llvm::DIType* type) {
+    parents.try_emplace(type, type);
+    while (parents[type] != type) {
+      auto& parent{parents[type]};
+      parent = parents[parent];
+      type = parent;
+    }
+    return type;
+  };
+  auto Union = [&](llvm::DIType* a, llvm::DIType* b) {
+    a = Find(a);
+    b = Find(b);
+    if (a != b) {
+      parents[b] = a;
+    }
+  };
+  auto Declare = [&](llvm::DIType* type, llvm::StringRef name) {
+    auto [it, inserted] = names.try_emplace(GetNameKey(name), type);
+    Union(it->second, type);
+  };
+
+  std::vector<llvm::DIType*> roots(types);
+  for (auto subp : subprograms) {
+    roots.push_back(subp->getType());
+  }
+  std::unordered_set<llvm::DIType*> seen;
+  std::vector<llvm::DIType*> nodes;
+  for (auto root : roots) {
+    CollectTypes(root, seen, nodes);
+  }
+  for (auto type : nodes) {
+    auto Refer = [&](llvm::Metadata* md) {
+      if (auto target = llvm::dyn_cast_or_null<llvm::DIType>(md)) {
+        Union(type, target);
+      }
+    };
+    if (auto comp = llvm::dyn_cast<llvm::DICompositeType>(type)) {
+      Refer(comp->getBaseType());
+      auto tag{comp->getTag()};
+      auto named{tag == llvm::dwarf::DW_TAG_class_type ||
+                 tag == llvm::dwarf::DW_TAG_structure_type ||
+                 tag == llvm::dwarf::DW_TAG_union_type ||
+                 tag == llvm::dwarf::DW_TAG_enumeration_type};
+      if (named) {
+        Declare(comp, comp->getName());
+      }
+      for (auto elem : comp->getElements()) {
+        if (auto member = llvm::dyn_cast<llvm::DIDerivedType>(elem)) {
+          Refer(member->getBaseType());
+        } else if (auto enumerator = llvm::dyn_cast<llvm::DIEnumerator>(elem)) {
+          // Enumerators are declared in the global scope
+          Declare(comp, enumerator->getName());
+        }
+      }
+    } else if (auto der = llvm::dyn_cast<llvm::DIDerivedType>(type)) {
+      Refer(der->getBaseType());
+      if (der->getTag() == llvm::dwarf::DW_TAG_typedef) {
+        Declare(der, der->getName());
+      }
+    } else if (auto sub = llvm::dyn_cast<llvm::DISubroutineType>(type)) {
+      for (auto elem : sub->getTypeArray()) {
+        Refer(elem);
+      }
+    }
+  }
+
+  // Components are numbered in the order of their first root
+  std::unordered_map<llvm::DIType*, size_t> component_ids;
+  std::vector<TypeGroup> components;
+  auto GetComponent = [&](llvm::DIType* type) -> TypeGroup& {
+    auto [it, inserted] =
+        component_ids.try_emplace(Find(type), components.size());
+    if (inserted) {
+      components.emplace_back();
+    }
+    return components[it->second];
+  };
+  for (auto type : types) {
+    GetComponent(type).types.push_back(type);
+  }
+  for (auto subp : subprograms) {
+    auto type{subp->getType()};
+    if (!type) {
+      // Prototypes without a type only refer to themselves
+      components.emplace_back().subprograms.push_back(subp);
+      continue;
+    }
+    GetComponent(type).subprograms.push_back(subp);
+  }
+  for (auto type : nodes) {
+    ++GetComponent(type).size;
+  }
+
+  // The largest components are handed out first, each to the group that is
+  // the smallest so far. Groups then take their components in order.
+  std::vector<size_t> order(components.size());
+  for (size_t i{0}; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return components[a].size > components[b].size;
+  });
+  std::vector<TypeGroup> groups(
+      std::min<size_t>(num_groups, components.size()));
+  std::vector<size_t> group_ids(components.size());
+  for (auto i : order) {
+    auto smallest{std::min_element(groups.begin(), groups.end(),
+                                   [](auto& a, auto& b) {
+                                     return a.size < b.size;
+                                   })};
+    smallest->size += components[i].size;
+    group_ids[i] = smallest - groups.begin();
+  }
+  for (size_t i{0}; i < components.size(); ++i) {
+    auto& group{groups[group_ids[i]]};
+    auto& component{components[i]};
+    group.types.insert(group.types.end(), component.types.begin(),
+                       component.types.end());
+    group.subprograms.insert(group.subprograms.end(),
+                             component.subprograms.begin(),
+                             component.subprograms.end());
+  }
+  return groups;
+}
+
+// Generates the declarations of `group` in a new translation unit
+static std::unique_ptr<clang::ASTUnit> GenerateGroup(
+    const TypeGroup& group, const std::string& triple) {
+  std::vector<std::string> args{"-Wno-pointer-to-int-cast",
+                                "-Wno-pointer-sign", "-target", triple};
+  auto ast_unit{clang::tooling::buildASTFromCodeWithArgs("", args, "out.c")};
+  rellic::StructGenerator strctgen(*ast_unit);
+  rellic::SubprogramGenerator subgen(*ast_unit, strctgen);
+  strctgen.GenerateDecls(group.types.begin(), group.types.end());
+  for (auto func : group.subprograms) {
+    subgen.VisitSubprogram(func);
+  }
+  return ast_unit;
+}
+
 int main(int argc, char* argv[]) {
   std::stringstream usage;
   usage << std::endl
@@ -66,6 +300,9 @@ int main(int argc, char* argv[]) {
         << "  " << argv[0] << " \\" << std::endl
         << "    --input INPUT_FILE \\" << std::endl
         << "    --output OUTPUT_FILE \\" << std::endl
+        << "    [--roots NAME[,NAME...]] \\" << std::endl
+        << "    [--cache_dir DIRECTORY] \\" << std::endl
+        << "    [--threads N] \\" << std::endl
         << std::endl
 
         // Print the version and exit.
@@ -92,26 +329,101 @@ int main(int argc, char* argv[]) {
   auto llvm_ctx{std::make_unique<llvm::LLVMContext>()};
   auto module{rellic::LoadModuleFromFile(llvm_ctx.get(), FLAGS_input)};
   auto dic{std::make_unique<rellic::DebugInfoCollector>()};
-  dic->visit(module);
-  std::vector<std::string> args{"-Wno-pointer-to-int-cast", "-Wno-pointer-sign",
-                                "-target", module->getTargetTriple()};
-  auto ast_unit{clang::tooling::buildASTFromCodeWithArgs("", args, "out.c")};
-  rellic::StructGenerator strctgen(*ast_unit);
-  rellic::SubprogramGenerator subgen(*ast_unit, strctgen);
-  auto types{dic->GetTypes()};
-  strctgen.GenerateDecls(types.begin(), types.end());
+  dic->visit(*module, FLAGS_threads);
+  std::vector<llvm::DIType*> types;
+  std::vector<llvm::DISubprogram*> subprograms;
+  if (FLAGS_roots.empty()) {
+    auto& all_types{dic->GetTypes()};
+    types.assign(all_types.begin(), all_types.end());
+    subprograms = dic->GetSubprograms();
+  } else {
+    // Only the types reachable from the roots are generated
+    std::unordered_set<llvm::DIType*> seen;
+    llvm::SmallVector<llvm::StringRef, 4> roots;
+    llvm::StringRef(FLAGS_roots).split(roots, ',', -1, /*KeepEmpty=*/false);
+    for (auto root : roots) {
+      if (auto func = module->getFunction(root)) {
+        auto subp{func->getSubprogram()};
+        if (!subp) {
+          LOG(ERROR) << "Function " << root.str() << " has no debug info.";
+          return EXIT_FAILURE;
+        }
+        subprograms.push_back(subp);
+        CollectTypes(subp->getType(), seen, types);
+      } else if (auto gvar = module->getGlobalVariable(root)) {
+        llvm::SmallVector<llvm::DIGlobalVariableExpression*, 1> gves;
+        gvar->getDebugInfo(gves);
+        if (gves.empty()) {
+          LOG(ERROR) << "Global variable " << root.str()
+                     << " has no debug info.";
+          return EXIT_FAILURE;
+        }
+        for (auto gve : gves) {
+          CollectTypes(gve->getVariable()->getType(), seen, types);
+        }
+      } else {
+        LOG(ERROR) << "No function or global variable named " << root.str()
+                   << ".";
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  if (!FLAGS_generate_prototypes) {
+    subprograms.clear();
+  }
+
+  std::vector<TypeGroup> groups;
+  if (FLAGS_threads > 1) {
+    groups = PartitionTypes(types, subprograms, FLAGS_threads);
+  } else {
+    groups.push_back({types, subprograms});
+  }
 
-  if (FLAGS_generate_prototypes) {
-    for (auto func : dic->GetSubprograms()) {
-      subgen.VisitSubprogram(func);
+  // Each group is cached on its own. Keys are computed up front, as walking
+  // the metadata of the module is not thread-safe.
+  std::optional<TypeCache> cache;
+  std::vector<std::string> keys(groups.size());
+  if (!FLAGS_cache_dir.empty()) {
+    cache.emplace(FLAGS_cache_dir);
+    for (size_t i{0}; i < groups.size(); ++i) {
+      keys[i] = TypeCache::GetKey(*module, groups[i].types,
+                                  groups[i].subprograms,
+                                  rellic::Version::GetCommitHash() + " " +
+                                      module->getTargetTriple());
     }
   }
 
+  std::vector<std::unique_ptr<clang::ASTUnit>> ast_units(groups.size());
+  std::atomic_size_t next_group{0};
+  std::vector<std::thread> workers;
+  for (size_t i{0}; i < groups.size(); ++i) {
+    workers.emplace_back([&]() {
+      for (auto n{next_group++}; n < groups.size(); n = next_group++) {
+        if (cache) {
+          ast_units[n] = cache->Load(keys[n]);
+        }
+        if (!ast_units[n]) {
+          ast_units[n] = GenerateGroup(groups[n], module->getTargetTriple());
+          if (cache) {
+            cache->Store(keys[n], *ast_units[n]);
+          }
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
   std::error_code ec;
   // FIXME(surovic): Figure out if the fix below works.
   // llvm::raw_fd_ostream output(FLAGS_output, ec, llvm::sys::fs::F_Text);
   llvm::raw_fd_ostream output(FLAGS_output, ec);
-  ast_unit->getASTContext().getTranslationUnitDecl()->print(output);
+  // Groups do not refer to each other, so their declarations can be printed
+  // in any order
+  for (auto& ast_unit : ast_units) {
+    ast_unit->getASTContext().getTranslationUnitDecl()->print(output);
+  }
   CHECK(!ec) << "Failed to create output file: " << ec.message();
 
   google::ShutDownCommandLineFlags();
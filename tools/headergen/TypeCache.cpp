@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "TypeCache.h"
+
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/Basic/FileSystemOptions.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Serialization/PCHContainerOperations.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/ModuleSlotTracker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+// Drops the numbers of metadata slots, which depend on the rest of the module
+static void PrintWithoutSlots(llvm::StringRef text, llvm::raw_ostream& os) {
+  for (size_t i{0}; i < text.size(); ++i) {
+    os << text[i];
+    if (text[i] == '!') {
+      while (i + 1 < text.size() && llvm::isDigit(text[i + 1])) {
+        ++i;
+      }
+    }
+  }
+  os << '\n';
+}
+
+TypeCache::TypeCache(std::string directory) : directory(std::move(directory)) {}
+
+std::string TypeCache::GetKey(
+    llvm::Module& module, const std::vector<llvm::DIType*>& types,
+    const std::vector<llvm::DISubprogram*>& subprograms,
+    llvm::StringRef salt) {
+  llvm::ModuleSlotTracker slots(&module);
+  auto GetText = [&](llvm::Metadata* md) {
+    std::string str;
+    llvm::raw_string_ostream str_os(str);
+    md->print(str_os, slots, &module);
+    std::string text;
+    llvm::raw_string_ostream text_os(text);
+    PrintWithoutSlots(str_os.str(), text_os);
+    return text_os.str();
+  };
+
+  // Types come from a set, so they are sorted by their own text to visit the
+  // graph in the same order every time
+  std::vector<std::pair<std::string, llvm::Metadata*>> roots;
+  for (auto type : types) {
+    roots.emplace_back(GetText(type), type);
+  }
+  std::stable_sort(roots.begin(), roots.end(),
+                   [](auto& a, auto& b) { return a.first < b.first; });
+  for (auto subp : subprograms) {
+    roots.emplace_back(GetText(subp), subp);
+  }
+
+  // Nodes are numbered in the order they are reached, which stands in for the
+  // slot numbers that were removed. Type graphs can be very deep, so they are
+  // walked with an explicit stack.
+  std::string key;
+  llvm::raw_string_ostream os(key);
+  os << salt << '\n';
+  std::unordered_map<llvm::Metadata*, unsigned> nodes;
+  std::vector<llvm::Metadata*> stack;
+  for (auto& [text, root] : roots) {
+    stack.push_back(root);
+    while (!stack.empty()) {
+      auto md{stack.back()};
+      stack.pop_back();
+      if (!md) {
+        os << "null\n";
+        continue;
+      }
+
+      auto [it, inserted] = nodes.emplace(md, nodes.size());
+      if (!inserted) {
+        os << "!ref" << it->second << '\n';
+        continue;
+      }
+      os << GetText(md);
+
+      // The compilation unit refers to every global of the module, so it is
+      // not followed
+      auto node{llvm::dyn_cast<llvm::MDNode>(md)};
+      if (!node || llvm::isa<llvm::DICompileUnit>(node)) {
+        continue;
+      }
+      for (auto i{node->getNumOperands()}; i > 0; --i) {
+        stack.push_back(node->getOperand(i - 1).get());
+      }
+    }
+  }
+
+  auto hash{llvm::SHA1::hash(llvm::arrayRefFromStringRef(os.str()))};
+  return llvm::toHex(hash, /*LowerCase=*/true);
+}
+
+std::unique_ptr<clang::ASTUnit> TypeCache::Load(const std::string& key) const {
+  llvm::SmallString<256> path(directory);
+  llvm::sys::path::append(path, key + ".ast");
+  if (!llvm::sys::fs::exists(path)) {
+    return nullptr;
+  }
+
+  // The reader is kept by the unit
+  static const clang::RawPCHContainerReader reader;
+  auto diags{clang::CompilerInstance::createDiagnostics(
+      new clang::DiagnosticOptions())};
+  auto unit{clang::ASTUnit::LoadFromASTFile(
+      path.str().str(), reader,
+      clang::ASTUnit::LoadEverything, diags, clang::FileSystemOptions())};
+  LOG_IF(WARNING, !unit) << "Cannot load cached declarations from " << path;
+  return unit;
+}
+
+void TypeCache::Store(const std::string& key, clang::ASTUnit& unit) const {
+  auto ec{llvm::sys::fs::create_directories(directory)};
+  if (ec) {
+    LOG(WARNING) << "Cannot create cache directory " << directory << ": "
+                 << ec.message();
+    return;
+  }
+
+  // The file is written to a temporary file first and then renamed, so that
+  // concurrent readers never observe a partial entry
+  llvm::SmallString<256> path(directory);
+  llvm::sys::path::append(path, key + ".ast");
+  if (unit.Save(path)) {
+    LOG(WARNING) << "Cannot save declarations to " << path;
+  }
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/Frontend/ASTUnit.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Module.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/* A directory of Clang AST files of the declarations generated by
+ * rellic-headergen, for --cache_dir. Entries are addressed by the content of
+ * the debug information the declarations are generated from, so builds that
+ * share their headers share entries even when the rest of their code changes.
+ */
+class TypeCache {
+  std::string directory;
+
+ public:
+  TypeCache(std::string directory);
+
+  // Computes the key of the declarations of `types` and the prototypes of
+  // `subprograms`. It covers the metadata they refer to, without the slot
+  // numbers that depend on the rest of `module`, and `salt`.
+  static std::string GetKey(llvm::Module& module,
+                            const std::vector<llvm::DIType*>& types,
+                            const std::vector<llvm::DISubprogram*>& subprograms,
+                            llvm::StringRef salt);
+
+  // Returns the translation unit stored for `key`, if any. It has no Sema, so
+  // it can be printed but not extended.
+  std::unique_ptr<clang::ASTUnit> Load(const std::string& key) const;
+  // Saves the translation unit of `unit` for `key`
+  void Store(const std::string& key, clang::ASTUnit& unit) const;
+};
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+DEFINE_string(output, "-", "Output C file.");
+
+// A function definition of a shard manifest written by `rellic-decomp --shard`
+struct Definition {
+  int64_t index;
+  std::string function;
+  std::string code;
+  int64_t shard;
+};
+
+// The parts of a shard manifest that must be the same for every shard
+struct ModuleInfo {
+  std::string fingerprint;
+  int64_t num_shards;
+  std::string declarations;
+};
+
+static std::string GetString(const llvm::json::Object& obj,
+                             llvm::StringRef key, const std::string& file) {
+  auto value{obj.getString(key)};
+  CHECK(value) << file << ": missing string `" << key.str() << '`';
+  return value->str();
+}
+
+static int64_t GetInteger(const llvm::json::Object& obj, llvm::StringRef key,
+                          const std::string& file) {
+  auto value{obj.getInteger(key)};
+  CHECK(value) << file << ": missing integer `" << key.str() << '`';
+  return *value;
+}
+
+// Reads the manifest in `file`, adding its definitions to `definitions`.
+// Returns the index of its shard.
+static int64_t ReadManifest(const std::string& file, ModuleInfo& info,
+                            std::vector<Definition>& definitions) {
+  auto buffer{llvm::MemoryBuffer::getFileOrSTDIN(file)};
+  CHECK(buffer) << file << ": " << buffer.getError().message();
+  auto json{llvm::json::parse(buffer.get()->getBuffer())};
+  CHECK(json) << file << ": " << llvm::toString(json.takeError());
+  auto obj{json->getAsObject()};
+  CHECK(obj) << file << ": not a shard manifest";
+  CHECK(GetString(*obj, "format", file) == "rellic-shard")
+      << file << ": not a shard manifest";
+  CHECK_EQ(GetInteger(*obj, "version", file), 1)
+      << file << ": unsupported version";
+
+  ModuleInfo shard_info{GetString(*obj, "fingerprint", file),
+                        GetInteger(*obj, "num_shards", file),
+                        GetString(*obj, "declarations", file)};
+  CHECK_GT(shard_info.num_shards, 0) << file << ": invalid number of shards";
+  if (info.fingerprint.empty()) {
+    info = shard_info;
+  }
+  CHECK(shard_info.fingerprint == info.fingerprint)
+      << file << ": shard of a different module";
+  CHECK_EQ(shard_info.num_shards, info.num_shards)
+      << file << ": different number of shards";
+  CHECK(shard_info.declarations == info.declarations)
+      << file << ": declarations differ from the other shards, which were "
+      << "probably decompiled with different options";
+
+  auto shard{GetInteger(*obj, "shard", file)};
+  auto defns{obj->getArray("definitions")};
+  CHECK(defns) << file << ": missing array `definitions`";
+  for (auto& defn : *defns) {
+    auto defn_obj{defn.getAsObject()};
+    CHECK(defn_obj) << file << ": definitions must be objects";
+    definitions.push_back({GetInteger(*defn_obj, "index", file),
+                           GetString(*defn_obj, "function", file),
+                           GetString(*defn_obj, "code", file), shard});
+  }
+  return shard;
+}
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    [--output OUTPUT_C_FILE] \\" << std::endl
+        << "    SHARD_JSON_FILE..." << std::endl
+        << std::endl
+        << "  Combines the manifests written by rellic-decomp --shard for "
+           "every shard of a module into a single C file."
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc < 2) {
+    std::cerr << google::ProgramUsage();
+    return EXIT_FAILURE;
+  }
+
+  ModuleInfo info;
+  std::vector<Definition> definitions;
+  std::vector<bool> seen;
+  for (int i{1}; i < argc; ++i) {
+    auto shard{ReadManifest(argv[i], info, definitions)};
+    seen.resize(info.num_shards);
+    CHECK(shard >= 0 && shard < info.num_shards)
+        << argv[i] << ": invalid shard " << shard;
+    CHECK(!seen[shard]) << argv[i] << ": shard " << shard
+                        << " was given more than once";
+    seen[shard] = true;
+  }
+  for (int64_t shard{0}; shard < info.num_shards; ++shard) {
+    CHECK(seen[shard]) << "Missing shard " << shard << " of "
+                       << info.num_shards;
+  }
+
+  // Definitions are written in module order, whatever the order of the
+  // manifests
+  std::sort(definitions.begin(), definitions.end(),
+            [](const Definition& a, const Definition& b) {
+              return a.index < b.index;
+            });
+  for (size_t i{1}; i < definitions.size(); ++i) {
+    CHECK_NE(definitions[i - 1].index, definitions[i].index)
+        << "Function " << definitions[i].function
+        << " is defined by shards " << definitions[i - 1].shard << " and "
+        << definitions[i].shard;
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream output(FLAGS_output, ec);
+  CHECK(!ec) << "Failed to create output file: " << ec.message();
+  output << info.declarations;
+  for (auto& defn : definitions) {
+    output << defn.code;
+  }
+  output.close();
+  CHECK(!output.has_error()) << "Failed to write output file: "
+                             << output.error().message();
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+  return EXIT_SUCCESS;
+}
@@ -15,31 +15,33 @@ import os
 import json
 import tempfile
 import subprocess
+import urllib.error
+import urllib.parse
+import urllib.request
 from shutil import which
 
 
 class rellic_decompile_function_t(ida_kernwin.action_handler_t):
     _anvill_decompile_json_path = None
     _rellic_decomp_path = None
-    _opt_path = None
+    _rellic_daemon_url = os.environ.get("RELLIC_DAEMON")
 
     def __init__(self):
         self.locate_external_programs()
 
-        print("rellic: Found `opt` executable:", self._opt_path)
         print("rellic: Found `anvill-decompile-json` executable:",
               self._anvill_decompile_json_path)
 
         print("rellic: Found `rellic-decomp` executable:",
               self._rellic_decomp_path)
 
+        if self._rellic_daemon_url is not None:
+            print("rellic: Using the `rellic-daemon` at:",
+                  self._rellic_daemon_url)
+
         print("rellic: Place the cursor inside a function and use the right-click menu, or press CTRL+Y")
 
     def locate_external_programs(self):
-        opt_path = which("opt")
-        if opt_path is None:
-            return False
-
         llvm_version_list = ["14"]
 
         for llvm_version in llvm_version_list:
@@ -47,6 +49,10 @@ class rellic_decompile_function_t(ida_kernwin.action_handler_t):
                 "anvill-decompile-json-" + llvm_version)
             rellic_decomp_path = which("rellic-decomp")
 
+            # A rellic-daemon can be used instead of rellic-decomp
+            if rellic_decomp_path is None and self._rellic_daemon_url is not None:
+                rellic_decomp_path = ""
+
             if anvill_decompile_json_path is not None and rellic_decomp_path is not None:
                 remill_semantics_path = "/usr/local/share/remill/" + \
                     llvm_version + "/semantics"
@@ -55,13 +61,37 @@ class rellic_decompile_function_t(ida_kernwin.action_handler_t):
                     raise RuntimeError(
                         "rellic: anvill and rellic have been compiled for llvm {}, but the matching remill semantics were not found".format(llvm_version))
 
-                self._opt_path = opt_path
                 self._anvill_decompile_json_path = anvill_decompile_json_path
                 self._rellic_decomp_path = rellic_decomp_path
 
                 return True
 
-        raise RuntimeError("rellic: Failed to locate rellic/anvill/remill/opt")
+        raise RuntimeError("rellic: Failed to locate rellic/anvill/remill")
+
+    def post_to_daemon(self, path, data):
+        request = urllib.request.Request(
+            self._rellic_daemon_url.rstrip("/") + path, data=data, method="POST")
+        try:
+            with urllib.request.urlopen(request) as response:
+                return json.load(response)
+
+        except urllib.error.HTTPError as e:
+            raise RuntimeError(json.load(e)["message"])
+
+    def decompile_with_daemon(self, bitcode):
+        # The module is sent along with the request instead of being loaded
+        # under a name, since anvill regenerates the bitcode each time
+        query = urllib.parse.urlencode({"coalesce_phi_nodes": "true"})
+        response = self.post_to_daemon("/decompile/module?" + query, bitcode)
+        return response["declarations"] + "".join(response["definitions"].values())
+
+    def decompile_with_rellic(self, bitcode):
+        # The bitcode is piped through rellic-decomp, which writes the C code
+        # to its standard output
+        process = subprocess.run([self._rellic_decomp_path, "--input", "-", "--output", "-",
+                                  "--coalesce_phi_nodes"], input=bitcode, stdout=subprocess.PIPE,
+                                 stderr=subprocess.PIPE, check=True)
+        return process.stdout.decode("utf-8", errors="replace")
 
     def display_output(self, window_name, decompiled_function):
         # Make sure we have a newline at the end
@@ -128,35 +158,35 @@ class rellic_decompile_function_t(ida_kernwin.action_handler_t):
 
             return
 
-        # Run the reg2mem pass on the generated bitcode
-        processed_bc_file_path = os.path.join(working_directory, "reg2mem.bc")
+        # PHI nodes are translated out of SSA by rellic itself, which only
+        # creates one variable per web of PHI nodes, instead of demoting every
+        # register to memory with `opt -reg2mem`
+        with open(bc_file_path, "rb") as bc_file:
+            bitcode = bc_file.read()
 
-        try:
-            subprocess.check_output([self._opt_path, "-reg2mem", bc_file_path,
-                                     "-o=" + processed_bc_file_path], text=True, stderr=subprocess.STDOUT)
+        # Finally, ask rellic to decompile the bitcode
+        if self._rellic_daemon_url is not None:
+            try:
+                decompiled_function = self.decompile_with_daemon(bitcode)
 
-        except subprocess.CalledProcessError as e:
-            print(
-                "rellic: Failed to start the opt process. Error details follow:\n{}".format(e.output))
+            except (RuntimeError, urllib.error.URLError) as e:
+                print(
+                    "rellic: The rellic-daemon request failed. Error details follow:\n{}".format(e))
 
-            return
+                return
 
-        # Finally, ask rellic to decompile the bitcode
-        c_file_path = os.path.join(working_directory, 'out.c')
+            self.display_output(function_name, decompiled_function)
+            return
 
         try:
-            subprocess.check_output([self._rellic_decomp_path, "--input", processed_bc_file_path,
-                                     "--output", c_file_path], text=True, stderr=subprocess.STDOUT)
+            decompiled_function = self.decompile_with_rellic(bitcode)
 
         except subprocess.CalledProcessError as e:
             print(
-                "rellic: Failed to start the rellic-decomp process. Error details follow:\n{}".format(e.output))
+                "rellic: Failed to start the rellic-decomp process. Error details follow:\n{}".format(e.stderr.decode("utf-8", errors="replace")))
 
             return
 
-        with open(c_file_path, "r") as rellic_output_file:
-            decompiled_function = rellic_output_file.read()
-
         self.display_output(function_name, decompiled_function)
 
     def update(self, ctx):
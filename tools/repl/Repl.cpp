@@ -20,19 +20,30 @@
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Transforms/Utils/Local.h>
 #include <llvm/Transforms/Utils/LowerSwitch.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <system_error>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "rellic/AST/ChangeLog.h"
 #include "rellic/AST/CondBasedRefine.h"
 #include "rellic/AST/DeadStmtElim.h"
 #include "rellic/AST/DebugInfoCollector.h"
@@ -46,10 +57,12 @@
 #include "rellic/AST/NestedScopeCombine.h"
 #include "rellic/AST/ReachBasedRefine.h"
 #include "rellic/AST/StructFieldRenamer.h"
+#include "rellic/AST/UndoJournal.h"
 #include "rellic/AST/Z3CondSimplify.h"
 #include "rellic/BC/Util.h"
 #include "rellic/Decompiler.h"
 #include "rellic/Exception.h"
+#include "rellic/Serialization.h"
 #include "rellic/Version.h"
 
 #ifndef LLVM_VERSION_STRING
@@ -64,6 +77,33 @@ std::unique_ptr<clang::ASTUnit> ast_unit{nullptr};
 std::unique_ptr<rellic::DecompilationContext> dec_ctx;
 std::unique_ptr<rellic::CompositeASTPass> global_pass{nullptr};
 
+// Set by Ctrl-Z, for commands that run more than one pass
+static volatile std::sig_atomic_t interrupted{0};
+
+// A command that refined the AST, and how
+struct Step {
+  enum Kind { Run, Fixpoint, Profile };
+  Kind kind;
+  std::vector<std::string> passes;
+};
+
+// Copy of the module as it was decompiled, and the steps that led from it to
+// the current AST, so that the AST can be rebuilt by `bench`. The copy is
+// kept so that preprocessing the module afterwards makes no difference. If
+// the AST was resumed from a checkpoint, it is rebuilt from that checkpoint.
+static std::unique_ptr<llvm::Module> decompiled_module{nullptr};
+static std::string checkpoint;
+static std::vector<Step> history;
+// Whether the current AST can be rebuilt, which is not the case after a step
+// is stopped or fails midway
+static bool reproducible{false};
+
+// Snapshots of the current AST taken by `snapshot', along with the history
+// and reproducibility of each of them
+static std::unique_ptr<rellic::UndoJournal> journal;
+static std::unordered_map<std::string, std::pair<std::vector<Step>, bool>>
+    snapshot_steps;
+
 static void SetVersion(void) {
   std::stringstream version;
 
@@ -96,7 +136,10 @@ static void SetVersion(void) {
 static const char* available_passes[] = {"cbr", "dse", "ec",  "lr",
                                          "ncp", "nsc", "rbr", "zcs"};
 
-static bool diff = false;
+// How changes are printed. Structural diffs only print the statements that
+// refinement passes replaced; modules are always diffed as text.
+enum class DiffMode { Off, Text, Structural };
+static DiffMode diff{DiffMode::Off};
 
 template <typename... Ts>
 static void invoke(Ts... args) {
@@ -112,11 +155,11 @@ static void invoke(Ts... args) {
 template <typename Print>
 class Diff {
   std::string before_path;
-  const Print& print;
+  Print print;
 
  public:
-  Diff(const Print& print) : print(print) {
-    if (!diff) {
+  Diff(Print print) : print(print) {
+    if (diff == DiffMode::Off) {
       return;
     }
     char before[] = "/tmp/rellic.before.XXXXXX";
@@ -127,7 +170,7 @@ class Diff {
   }
 
   ~Diff() {
-    if (!diff) {
+    if (before_path.empty()) {
       return;
     }
 
@@ -145,50 +188,228 @@ class Diff {
   }
 };
 
-static std::unique_ptr<rellic::ASTPass> CreatePass(const std::string& name) {
+static void PrintAST(llvm::raw_ostream& os) {
+  ast_unit->getASTContext().getTranslationUnitDecl()->print(os, 0, false);
+}
+
+// Prints the changes made to the AST by refinement passes during its
+// lifetime. Structural diffs do not print the whole translation unit, but the
+// passes that do not replace statements, like ncp and zcs, only report the
+// definitions they changed, if anything.
+class ASTDiff {
+  rellic::DecompilationContext& dec_ctx;
+  rellic::ChangeLog log;
+  std::unique_ptr<Diff<void (*)(llvm::raw_ostream&)>> text;
+
+ public:
+  // Whether the passes reported changes
+  bool changed{false};
+
+  ASTDiff(rellic::DecompilationContext& dec_ctx) : dec_ctx(dec_ctx) {
+    if (diff == DiffMode::Text) {
+      text = std::make_unique<Diff<void (*)(llvm::raw_ostream&)>>(PrintAST);
+    } else if (diff == DiffMode::Structural) {
+      dec_ctx.change_log = &log;
+    }
+  }
+
+  ~ASTDiff() {
+    if (dec_ctx.change_log != &log) {
+      return;
+    }
+
+    dec_ctx.change_log = nullptr;
+    if (log.Empty() && changed) {
+      std::cout << "the changes were made in place and cannot be shown, use "
+                   "`diff text' to see them."
+                << std::endl;
+      return;
+    }
+    log.Print(llvm::outs(), dec_ctx.ast_ctx.getPrintingPolicy());
+    llvm::outs().flush();
+  }
+};
+
+static std::unique_ptr<rellic::ASTPass> CreatePass(
+    const std::string& name, rellic::DecompilationContext& dec_ctx) {
   if (name == "cbr") {
-    return std::make_unique<rellic::CondBasedRefine>(*dec_ctx);
+    return std::make_unique<rellic::CondBasedRefine>(dec_ctx);
   } else if (name == "dse") {
-    return std::make_unique<rellic::DeadStmtElim>(*dec_ctx);
+    return std::make_unique<rellic::DeadStmtElim>(dec_ctx);
   } else if (name == "ec") {
-    return std::make_unique<rellic::ExprCombine>(*dec_ctx);
+    return std::make_unique<rellic::ExprCombine>(dec_ctx);
   } else if (name == "lr") {
-    return std::make_unique<rellic::LoopRefine>(*dec_ctx);
+    return std::make_unique<rellic::LoopRefine>(dec_ctx);
   } else if (name == "mc") {
-    return std::make_unique<rellic::MaterializeConds>(*dec_ctx);
+    return std::make_unique<rellic::MaterializeConds>(dec_ctx);
   } else if (name == "ncp") {
-    return std::make_unique<rellic::NestedCondProp>(*dec_ctx);
+    return std::make_unique<rellic::NestedCondProp>(dec_ctx);
   } else if (name == "nsc") {
-    return std::make_unique<rellic::NestedScopeCombine>(*dec_ctx);
+    return std::make_unique<rellic::NestedScopeCombine>(dec_ctx);
   } else if (name == "rbr") {
-    return std::make_unique<rellic::ReachBasedRefine>(*dec_ctx);
+    return std::make_unique<rellic::ReachBasedRefine>(dec_ctx);
   } else if (name == "zcs") {
-    return std::make_unique<rellic::Z3CondSimplify>(*dec_ctx);
+    return std::make_unique<rellic::Z3CondSimplify>(dec_ctx);
   } else {
     return nullptr;
   }
 }
 
+static std::unique_ptr<rellic::CompositeASTPass> CreatePasses(
+    const std::vector<std::string>& names,
+    rellic::DecompilationContext& dec_ctx) {
+  auto composite{std::make_unique<rellic::CompositeASTPass>(dec_ctx)};
+  for (auto& name : names) {
+    composite->GetPasses().push_back(CreatePass(name, dec_ctx));
+  }
+  return composite;
+}
+
+// Reads the names of passes until the end of the command
+static bool ParsePasses(std::istream& is, std::vector<std::string>& names) {
+  std::string name;
+  while (is >> name) {
+    if (!CreatePass(name, *dec_ctx)) {
+      std::cout << "error: unknown pass `" << name << "'." << std::endl;
+      return false;
+    }
+    names.push_back(name);
+  }
+  return true;
+}
+
+static bool CheckAST() {
+  if (module == nullptr) {
+    std::cout << "error: no module loaded." << std::endl;
+    return false;
+  }
+  if (dec_ctx == nullptr) {
+    std::cout << "error: no AST available, run `decompile' first."
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
 static void handle_stop(int signal) {
+  interrupted = 1;
   if (global_pass) {
     global_pass->Stop();
   }
 }
 
+static std::string FormatMs(std::chrono::nanoseconds elapsed) {
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(3)
+     << std::chrono::duration<double, std::milli>(elapsed).count();
+  return ss.str();
+}
+
+// Cost of running a pass
+struct Profile {
+  std::chrono::nanoseconds elapsed{0};
+  // Queries that were not answered without Z3, see `rellic::Prover`
+  size_t z3_calls{0};
+  // Bytes allocated in the arena of the ASTContext, mostly by new nodes
+  size_t ast_bytes{0};
+  unsigned changes{0};
+
+  void Add(const Profile& other) {
+    elapsed += other.elapsed;
+    z3_calls += other.z3_calls;
+    ast_bytes += other.ast_bytes;
+    changes += other.changes;
+  }
+};
+
+static size_t CountZ3Calls(const rellic::ProverStatistics& stats) {
+  return stats.num_proofs + stats.num_simplifications - stats.num_cached -
+         stats.num_syntactic - stats.num_truth_tables;
+}
+
+static Profile Measure(rellic::ASTPass& pass,
+                       rellic::DecompilationContext& dec_ctx) {
+  auto z3_calls{CountZ3Calls(dec_ctx.prover.GetStatistics())};
+  auto ast_bytes{dec_ctx.ast_ctx.getASTAllocatedMemory()};
+  auto start{std::chrono::steady_clock::now()};
+  Profile profile;
+  profile.changes = pass.Run();
+  profile.elapsed = std::chrono::steady_clock::now() - start;
+  profile.z3_calls = CountZ3Calls(dec_ctx.prover.GetStatistics()) - z3_calls;
+  profile.ast_bytes = dec_ctx.ast_ctx.getASTAllocatedMemory() - ast_bytes;
+  return profile;
+}
+
+// Runs each pass of `composite` on one function definition at a time, and
+// calls `observe` with the index of the pass, the index of the definition in
+// `fdecls` and the cost of the run
+template <typename Observe>
+static void RunPerFunction(rellic::CompositeASTPass& composite,
+                           rellic::DecompilationContext& dec_ctx,
+                           const std::vector<clang::FunctionDecl*>& fdecls,
+                           Observe observe) {
+  struct Restore {
+    rellic::DecompilationContext& dec_ctx;
+    ~Restore() {
+      dec_ctx.track_function_changes = false;
+      dec_ctx.dirty_functions.reset();
+      dec_ctx.changed_functions.clear();
+    }
+  } restore{dec_ctx};
+
+  // Tracking changes makes passes skip everything but the dirty definitions
+  dec_ctx.track_function_changes = true;
+  auto& passes{composite.GetPasses()};
+  for (size_t i{0}; i < passes.size() && !composite.Stopped(); ++i) {
+    for (size_t j{0}; j < fdecls.size() && !composite.Stopped(); ++j) {
+      dec_ctx.dirty_functions =
+          rellic::DecompilationContext::FunctionSet{fdecls[j]};
+      observe(i, j, Measure(*passes[i], dec_ctx));
+    }
+  }
+}
+
+static std::vector<clang::FunctionDecl*> GetFunctionDefinitions(
+    clang::ASTContext& ast_ctx) {
+  std::vector<clang::FunctionDecl*> fdecls;
+  for (auto decl : ast_ctx.getTranslationUnitDecl()->decls()) {
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    if (fdecl && fdecl->doesThisDeclarationHaveABody()) {
+      fdecls.push_back(fdecl);
+    }
+  }
+  return fdecls;
+}
+
 static void do_help() {
   std::cout << "available commands:\n"
             << "  quit               Exits the REPL\n"
             << "  load [path]        Loads an LLVM module\n"
             << "  print module       Prints the LLVM module\n"
             << "  print ast          Prints the C AST\n"
-            << "  diff [on/off]      Enables/disables printing the diff "
-               "between before and after executing a command\n"
+            << "  diff [on/off/text] Enables/disables printing the diff "
+               "between before and after executing a command. `on' only "
+               "prints the statements that changed, `text' compares the "
+               "whole AST\n"
             << "  clear              Clears the screen\n"
             << "  apply [pass]       Applies preprocessing pass\n"
             << "  decompile          Performs initial decompilation\n"
+            << "  save [path]        Writes a checkpoint of the AST\n"
+            << "  resume [path]      Restores the AST of the loaded module "
+               "from a checkpoint\n"
+            << "  snapshot [name]    Names the current AST so that it can be "
+               "restored later, or lists the snapshots if no name is given\n"
+            << "  restore [name]     Brings the AST back to a snapshot\n"
             << "  run [passes]       Applies a sequence of refinement passes\n"
             << "  fixpoint [passes]  Tries to find a fixpoint for a sequence "
-               "of refinement passes\n\n"
+               "of refinement passes\n"
+            << "  profile [passes]   Applies a sequence of refinement passes "
+               "one function at a time, and prints the time, Z3 calls and AST "
+               "allocations of each pass and function\n"
+            << "  bench [pass] [n]   Runs a refinement pass n times, each on a "
+               "fresh copy of the current AST\n"
+            << "  time [command]     Executes a command and prints how long it "
+               "took\n\n"
             << "available preprocessing passes:\n"
             << "  remove-phi-nodes   Replaces Phi nodes with allocas\n"
             << "  lower-switches     Lowers switch instructions\n\n"
@@ -205,6 +426,86 @@ static void do_help() {
             << std::endl;
 }
 
+// Creates an empty translation unit for the target of `mod`
+static std::unique_ptr<clang::ASTUnit> CreateASTUnit(llvm::Module& mod) {
+  std::vector<std::string> args{"-Wno-pointer-to-int-cast", "-Wno-pointer-sign",
+                                "-target", mod.getTargetTriple()};
+  return clang::tooling::buildASTFromCodeWithArgs("", args, "out.c");
+}
+
+// Decompiles `mod` into a new translation unit
+static void Decompile(llvm::Module& mod,
+                      std::unique_ptr<clang::ASTUnit>& ast_unit,
+                      std::unique_ptr<rellic::DecompilationContext>& dec_ctx) {
+  dec_ctx = nullptr;
+  ast_unit = CreateASTUnit(mod);
+  dec_ctx = std::make_unique<rellic::DecompilationContext>(*ast_unit);
+  rellic::DebugInfoCollector dic;
+  dic.visit(mod);
+  rellic::GenerateAST::run(mod, *dec_ctx);
+  rellic::LocalDeclRenamer ldr{*dec_ctx, dic.GetIRToNameMap()};
+  rellic::StructFieldRenamer sfr{*dec_ctx, dic.GetIRTypeToDITypeMap()};
+  ldr.Run();
+  sfr.Run();
+}
+
+// Restores the AST of `mod` from the checkpoint at `path` into a new
+// translation unit
+static void Resume(llvm::Module& mod, const std::string& path,
+                   std::unique_ptr<clang::ASTUnit>& ast_unit,
+                   std::unique_ptr<rellic::DecompilationContext>& dec_ctx) {
+  dec_ctx = nullptr;
+  ast_unit = CreateASTUnit(mod);
+  dec_ctx = std::make_unique<rellic::DecompilationContext>(*ast_unit);
+  rellic::ReadCheckpoint(*dec_ctx, mod, path);
+}
+
+// Starts recording the changes made to the current AST, dropping the
+// snapshots of the previous one
+static void ResetJournal() {
+  snapshot_steps.clear();
+  journal = nullptr;
+  if (dec_ctx) {
+    journal = std::make_unique<rellic::UndoJournal>(*dec_ctx);
+    dec_ctx->journal = journal.get();
+  }
+}
+
+// An AST rebuilt by decompiling `decompiled_module` and repeating `history`,
+// along with the copy of the module it refers to
+struct Snapshot {
+  std::unique_ptr<llvm::Module> module;
+  std::unique_ptr<clang::ASTUnit> ast_unit;
+  std::unique_ptr<rellic::DecompilationContext> dec_ctx;
+};
+
+static Snapshot CreateSnapshot() {
+  Snapshot snapshot;
+  snapshot.module = llvm::CloneModule(*decompiled_module);
+  if (checkpoint.empty()) {
+    Decompile(*snapshot.module, snapshot.ast_unit, snapshot.dec_ctx);
+  } else {
+    Resume(*snapshot.module, checkpoint, snapshot.ast_unit, snapshot.dec_ctx);
+  }
+  auto& ctx{*snapshot.dec_ctx};
+  for (auto& step : history) {
+    auto composite{CreatePasses(step.passes, ctx)};
+    switch (step.kind) {
+      case Step::Run:
+        composite->Run();
+        break;
+      case Step::Fixpoint:
+        composite->Fixpoint();
+        break;
+      case Step::Profile:
+        RunPerFunction(*composite, ctx, GetFunctionDefinitions(ctx.ast_ctx),
+                       [](size_t, size_t, const Profile&) {});
+        break;
+    }
+  }
+  return snapshot;
+}
+
 static void do_load(std::istream& is) {
   std::string file;
   is >> file;
@@ -215,10 +516,14 @@ static void do_load(std::istream& is) {
     return;
   }
 
-  std::vector<std::string> args{"-Wno-pointer-to-int-cast", "-Wno-pointer-sign",
-                                "-target", module->getTargetTriple()};
-  ast_unit = clang::tooling::buildASTFromCodeWithArgs("", args, "out.c");
-  dec_ctx = {};
+  journal = nullptr;
+  snapshot_steps.clear();
+  dec_ctx = nullptr;
+  ast_unit = CreateASTUnit(*module);
+  decompiled_module = nullptr;
+  checkpoint.clear();
+  history.clear();
+  reproducible = false;
 
   std::cout << "ok." << std::endl;
 }
@@ -297,46 +602,132 @@ static void do_apply(std::istream& is) {
 }
 
 static void do_decompile() {
+  if (module == nullptr) {
+    std::cout << "error: no module loaded." << std::endl;
+    return;
+  }
+
+  history.clear();
+  reproducible = false;
+  checkpoint.clear();
+  journal = nullptr;
+  snapshot_steps.clear();
   try {
-    rellic::DebugInfoCollector dic;
-    dic.visit(*module);
-    dec_ctx = {};
-    rellic::GenerateAST::run(*module, *dec_ctx);
-    rellic::LocalDeclRenamer ldr{*dec_ctx, dic.GetIRToNameMap()};
-    rellic::StructFieldRenamer sfr{*dec_ctx, dic.GetIRTypeToDITypeMap()};
-    ldr.Run();
-    sfr.Run();
+    decompiled_module = llvm::CloneModule(*module);
+    Decompile(*module, ast_unit, dec_ctx);
+    reproducible = true;
+    ResetJournal();
     std::cout << "ok." << std::endl;
   } catch (rellic::Exception& ex) {
+    dec_ctx = nullptr;
+    ast_unit = CreateASTUnit(*module);
     std::cout << "error: " << ex.what() << std::endl;
   }
 }
 
-static void do_run(std::istream& is) {
+static void do_save(std::istream& is) {
+  if (!CheckAST()) {
+    return;
+  }
+
+  std::string path;
+  is >> path;
+  try {
+    rellic::WriteCheckpoint(*dec_ctx, *module, path);
+    std::cout << "ok." << std::endl;
+  } catch (rellic::Exception& ex) {
+    std::cout << "error: " << ex.what() << std::endl;
+  }
+}
+
+static void do_resume(std::istream& is) {
   if (module == nullptr) {
     std::cout << "error: no module loaded." << std::endl;
     return;
   }
 
-  global_pass = std::make_unique<rellic::CompositeASTPass>(*dec_ctx);
+  std::string path;
+  is >> path;
+  history.clear();
+  reproducible = false;
+  checkpoint.clear();
+  journal = nullptr;
+  snapshot_steps.clear();
+  try {
+    decompiled_module = llvm::CloneModule(*module);
+    Resume(*module, path, ast_unit, dec_ctx);
+    checkpoint = path;
+    reproducible = true;
+    ResetJournal();
+    std::cout << "ok." << std::endl;
+  } catch (rellic::Exception& ex) {
+    dec_ctx = nullptr;
+    ast_unit = CreateASTUnit(*module);
+    std::cout << "error: " << ex.what() << std::endl;
+  } catch (z3::exception& ex) {
+    dec_ctx = nullptr;
+    ast_unit = CreateASTUnit(*module);
+    std::cout << "error: " << ex.msg() << std::endl;
+  }
+}
+
+static void do_snapshot(std::istream& is) {
+  if (!CheckAST()) {
+    return;
+  }
+
   std::string name;
-  while (is >> name) {
-    auto pass{CreatePass(name)};
-    if (pass) {
-      global_pass->GetPasses().push_back(std::move(pass));
-    } else {
-      std::cout << "error: unknown pass `" << name << "'." << std::endl;
-      return;
+  is >> name;
+  if (name.empty()) {
+    for (auto& snapshot : journal->GetSnapshots()) {
+      std::cout << "  " << snapshot << '\n';
     }
+    std::cout << journal->GetNumChanges() << " changes recorded." << std::endl;
+    return;
   }
+  journal->Take(name);
+  snapshot_steps[name] = {history, reproducible};
+  std::cout << "ok." << std::endl;
+}
 
-  Diff d{[](llvm::raw_ostream& os) {
-    ast_unit->getASTContext().getTranslationUnitDecl()->print(os, 0, false);
-  }};
+static void do_restore(std::istream& is) {
+  if (!CheckAST()) {
+    return;
+  }
+
+  std::string name;
+  is >> name;
+  // The journal does not record which statements were replaced, so the diff
+  // is always computed on the text of the AST
+  Diff d{PrintAST};
+  if (!journal->Restore(name)) {
+    std::cout << "error: unknown snapshot `" << name << "'." << std::endl;
+    return;
+  }
+  std::tie(history, reproducible) = snapshot_steps[name];
+  std::cout << "ok." << std::endl;
+}
+
+static void do_run(std::istream& is) {
+  if (!CheckAST()) {
+    return;
+  }
+
+  std::vector<std::string> names;
+  if (!ParsePasses(is, names)) {
+    return;
+  }
+  global_pass = CreatePasses(names, *dec_ctx);
+
+  ASTDiff d{*dec_ctx};
   try {
     auto res{global_pass->Run()};
+    d.changed = res;
     if (global_pass->Stopped()) {
+      reproducible = false;
       std::cout << "stopped." << std::endl;
+    } else {
+      history.push_back({Step::Run, names});
     }
     if (res) {
       std::cout << "ok: the passes reported changes." << std::endl;
@@ -344,54 +735,206 @@ static void do_run(std::istream& is) {
       std::cout << "ok: the passes did not report any change." << std::endl;
     }
   } catch (rellic::Exception& ex) {
+    reproducible = false;
     std::cout << "error: " << ex.what() << std::endl;
   }
   global_pass = nullptr;
 }
 
 static void do_fixpoint(std::istream& is) {
-  if (module == nullptr) {
-    std::cout << "error: no module loaded." << std::endl;
+  if (!CheckAST()) {
     return;
   }
 
-  global_pass = std::make_unique<rellic::CompositeASTPass>(*dec_ctx);
-  std::string name;
-  while (is >> name) {
-    auto pass{CreatePass(name)};
-    if (pass) {
-      global_pass->GetPasses().push_back(std::move(pass));
-    } else {
-      std::cout << "error: unknown pass `" << name << "'." << std::endl;
-      return;
-    }
+  std::vector<std::string> names;
+  if (!ParsePasses(is, names)) {
+    return;
   }
+  global_pass = CreatePasses(names, *dec_ctx);
 
-  Diff d{[](llvm::raw_ostream& os) {
-    ast_unit->getASTContext().getTranslationUnitDecl()->print(os, 0, false);
-  }};
+  ASTDiff d{*dec_ctx};
   std::cout << "computing fixpoint... press Ctrl-Z to stop" << std::endl;
   try {
     auto iter_count{global_pass->Fixpoint()};
+    d.changed = iter_count > 0;
     if (global_pass->Stopped()) {
+      reproducible = false;
       std::cout << "stopped after " << iter_count << " iterations.";
     } else {
+      history.push_back({Step::Fixpoint, names});
       std::cout << "reached in " << iter_count << " iterations.";
     }
     std::cout << std::endl;
   } catch (rellic::Exception& ex) {
+    reproducible = false;
     std::cout << "error: " << ex.what() << std::endl;
   }
   global_pass = nullptr;
 }
 
+static void PrintProfileHeader(const char* what) {
+  std::cout << "  " << std::left << std::setw(32) << what << std::right
+            << std::setw(12) << "time (ms)" << std::setw(10) << "z3 calls"
+            << std::setw(12) << "ast bytes" << std::setw(9) << "changes"
+            << '\n';
+}
+
+static void PrintProfile(const std::string& name, const Profile& profile) {
+  std::cout << "  " << std::left << std::setw(32) << name << std::right
+            << std::setw(12) << FormatMs(profile.elapsed) << std::setw(10)
+            << profile.z3_calls << std::setw(12) << profile.ast_bytes
+            << std::setw(9) << profile.changes << '\n';
+}
+
+// Number of functions listed by `profile`
+static constexpr size_t profile_functions{10};
+
+static void do_profile(std::istream& is) {
+  if (!CheckAST()) {
+    return;
+  }
+
+  std::vector<std::string> names;
+  if (!ParsePasses(is, names)) {
+    return;
+  }
+  global_pass = CreatePasses(names, *dec_ctx);
+
+  auto fdecls{GetFunctionDefinitions(dec_ctx->ast_ctx)};
+  std::vector<Profile> pass_profiles(names.size());
+  std::vector<Profile> func_profiles(fdecls.size());
+  ASTDiff d{*dec_ctx};
+  try {
+    RunPerFunction(*global_pass, *dec_ctx, fdecls,
+                   [&](size_t pass, size_t func, const Profile& profile) {
+                     pass_profiles[pass].Add(profile);
+                     func_profiles[func].Add(profile);
+                     d.changed |= profile.changes > 0;
+                   });
+  } catch (rellic::Exception& ex) {
+    reproducible = false;
+    std::cout << "error: " << ex.what() << std::endl;
+    global_pass = nullptr;
+    return;
+  }
+  if (global_pass->Stopped()) {
+    reproducible = false;
+    std::cout << "stopped, the profile is incomplete." << std::endl;
+  } else {
+    history.push_back({Step::Profile, names});
+  }
+
+  Profile total;
+  PrintProfileHeader("pass");
+  for (size_t i{0}; i < names.size(); ++i) {
+    PrintProfile(names[i], pass_profiles[i]);
+    total.Add(pass_profiles[i]);
+  }
+  PrintProfile("total", total);
+
+  std::vector<size_t> order(fdecls.size());
+  for (size_t i{0}; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return func_profiles[a].elapsed > func_profiles[b].elapsed;
+  });
+  std::cout << '\n';
+  PrintProfileHeader("function");
+  for (size_t i{0}; i < order.size() && i < profile_functions; ++i) {
+    PrintProfile(fdecls[order[i]]->getNameAsString(), func_profiles[order[i]]);
+  }
+  if (order.size() > profile_functions) {
+    std::cout << "  ... and " << order.size() - profile_functions
+              << " more functions\n";
+  }
+  std::cout << std::endl;
+  global_pass = nullptr;
+}
+
+static void do_bench(std::istream& is) {
+  std::string name;
+  unsigned count{0};
+  is >> name >> count;
+  if (!CheckAST()) {
+    return;
+  }
+  if (!CreatePass(name, *dec_ctx)) {
+    std::cout << "error: unknown pass `" << name << "'." << std::endl;
+    return;
+  }
+  if (count == 0) {
+    std::cout << "error: expected a number of runs." << std::endl;
+    return;
+  }
+  if (!reproducible) {
+    std::cout << "error: the AST cannot be rebuilt, as a command that "
+                 "changed it was stopped or failed."
+              << std::endl;
+    return;
+  }
+
+  std::cout << "benchmarking... press Ctrl-Z to stop" << std::endl;
+  interrupted = 0;
+  std::vector<std::chrono::nanoseconds> times;
+  std::chrono::nanoseconds setup{0};
+  unsigned changes{0};
+  try {
+    while (times.size() < count && !interrupted) {
+      // The pass is run on a fresh copy of the current AST every time
+      auto start{std::chrono::steady_clock::now()};
+      auto snapshot{CreateSnapshot()};
+      setup += std::chrono::steady_clock::now() - start;
+
+      global_pass = std::make_unique<rellic::CompositeASTPass>(
+          *snapshot.dec_ctx);
+      global_pass->GetPasses().push_back(CreatePass(name, *snapshot.dec_ctx));
+      auto profile{Measure(*global_pass, *snapshot.dec_ctx)};
+      auto stopped{global_pass->Stopped()};
+      global_pass = nullptr;
+      if (stopped || interrupted) {
+        break;
+      }
+      times.push_back(profile.elapsed);
+      changes += profile.changes;
+    }
+  } catch (rellic::Exception& ex) {
+    global_pass = nullptr;
+    std::cout << "error: " << ex.what() << std::endl;
+    return;
+  }
+  if (times.empty()) {
+    std::cout << "stopped." << std::endl;
+    return;
+  }
+
+  std::chrono::nanoseconds sum{0};
+  for (auto time : times) {
+    sum += time;
+  }
+  std::sort(times.begin(), times.end());
+  if (times.size() < count) {
+    std::cout << "stopped after " << times.size() << " runs." << std::endl;
+  }
+  std::cout << name << ": " << times.size() << " runs, min "
+            << FormatMs(times.front()) << " ms, median "
+            << FormatMs(times[times.size() / 2]) << " ms, mean "
+            << FormatMs(sum / times.size()) << " ms, max "
+            << FormatMs(times.back()) << " ms\n"
+            << "the pass reported changes on " << changes << " runs; "
+            << "rebuilding the AST took " << FormatMs(setup) << " ms."
+            << std::endl;
+}
+
 static void do_diff(std::istream& is) {
   std::string value;
   is >> value;
   if (value == "on") {
-    diff = true;
+    diff = DiffMode::Structural;
+  } else if (value == "text") {
+    diff = DiffMode::Text;
   } else if (value == "off") {
-    diff = false;
+    diff = DiffMode::Off;
   } else {
     std::cout << "unknown diff value `" << value << "'." << std::endl;
     return;
@@ -405,6 +948,36 @@ void completion(const char* buf, linenoiseCompletions* lc) {
   auto last_fragment{line.substr(last_space + 1)};
   if (std::string("help").find(line) != std::string::npos) {
     linenoiseAddCompletion(lc, "help");
+  } else if (line.find("time ") == 0) {
+    // Completes the timed command
+    completion(buf + 5, lc);
+    for (size_t i{0}; i < lc->len; ++i) {
+      std::string completed{"time "};
+      completed += lc->cvec[i];
+      free(lc->cvec[i]);
+      lc->cvec[i] = strdup(completed.c_str());
+    }
+  } else if (buf[0] == 't') {
+    linenoiseAddCompletion(lc, "time");
+  } else if (buf[0] == 'b') {
+    if (line.find("bench ") == 0 && line.find(' ', 6) == std::string::npos) {
+      for (auto pass : available_passes) {
+        std::string pass_str{pass};
+        if (pass_str.find(last_fragment) == 0) {
+          linenoiseAddCompletion(lc, ("bench " + pass_str).c_str());
+        }
+      }
+    } else if (line.find("bench ") != 0) {
+      linenoiseAddCompletion(lc, "bench");
+    }
+  } else if (line.find("profile ") == 0) {
+    for (auto pass : available_passes) {
+      std::string pass_str{pass};
+      if (pass_str.find(last_fragment) == 0) {
+        linenoiseAddCompletion(
+            lc, (line.substr(0, last_space + 1) + pass_str).c_str());
+      }
+    }
   } else if (buf[0] == 'p') {
     if (line.find("print ") == 0) {
       for (auto option : {"module", "ast"}) {
@@ -416,6 +989,7 @@ void completion(const char* buf, linenoiseCompletions* lc) {
       }
     } else {
       linenoiseAddCompletion(lc, "print");
+      linenoiseAddCompletion(lc, "profile");
     }
   } else if (buf[0] == 'a') {
     if (line.find("apply ") == 0) {
@@ -431,7 +1005,7 @@ void completion(const char* buf, linenoiseCompletions* lc) {
     }
   } else if (buf[0] == 'd') {
     if (line.find("diff ") == 0) {
-      for (auto option : {"on", "off"}) {
+      for (auto option : {"on", "off", "text"}) {
         std::string option_str{option};
         if (option_str.find(last_fragment) == 0) {
           linenoiseAddCompletion(
@@ -448,6 +1022,9 @@ void completion(const char* buf, linenoiseCompletions* lc) {
     linenoiseAddCompletion(lc, "load");
   } else if (buf[0] == 'c') {
     linenoiseAddCompletion(lc, "clear");
+  } else if (buf[0] == 's') {
+    linenoiseAddCompletion(lc, "save");
+    linenoiseAddCompletion(lc, "snapshot");
   } else if (buf[0] == 'r') {
     if (line.find("run ") == 0) {
       for (auto pass : available_passes) {
@@ -458,6 +1035,8 @@ void completion(const char* buf, linenoiseCompletions* lc) {
         }
       }
     } else {
+      linenoiseAddCompletion(lc, "restore");
+      linenoiseAddCompletion(lc, "resume");
       linenoiseAddCompletion(lc, "run");
     }
   } else if (buf[0] == 'f') {
@@ -475,6 +1054,59 @@ void completion(const char* buf, linenoiseCompletions* lc) {
   }
 }
 
+// Executes the command read from `is`, and returns false if the REPL should
+// exit
+static bool dispatch(std::istream& is) {
+  std::string command;
+  is >> command;
+  if (command == "help") {
+    do_help();
+  } else if (command == "load") {
+    do_load(is);
+  } else if (command == "print") {
+    do_print(is);
+  } else if (command == "diff") {
+    do_diff(is);
+  } else if (command == "clear") {
+    linenoiseClearScreen();
+  } else if (command == "apply") {
+    do_apply(is);
+  } else if (command == "decompile") {
+    do_decompile();
+  } else if (command == "save") {
+    do_save(is);
+  } else if (command == "resume") {
+    do_resume(is);
+  } else if (command == "snapshot") {
+    do_snapshot(is);
+  } else if (command == "restore") {
+    do_restore(is);
+  } else if (command == "run") {
+    do_run(is);
+  } else if (command == "fixpoint") {
+    do_fixpoint(is);
+  } else if (command == "profile") {
+    do_profile(is);
+  } else if (command == "bench") {
+    do_bench(is);
+  } else if (command == "time") {
+    auto start{std::chrono::steady_clock::now()};
+    auto cpu_start{std::clock()};
+    auto res{dispatch(is)};
+    auto cpu_ms{1000.0 * (std::clock() - cpu_start) / CLOCKS_PER_SEC};
+    std::cout << "time: " << FormatMs(std::chrono::steady_clock::now() - start)
+              << " ms wall, " << std::fixed << std::setprecision(3) << cpu_ms
+              << std::defaultfloat << " ms cpu." << std::endl;
+    return res;
+  } else if (command == "quit") {
+    std::cout << "goodbye." << std::endl;
+    return false;
+  } else {
+    std::cout << "error: unknown command `" << command << "'." << std::endl;
+  }
+  return true;
+}
+
 int main(int argc, char* argv[]) {
   struct sigaction sa;
 
@@ -501,31 +1133,8 @@ int main(int argc, char* argv[]) {
   while (auto input = linenoise("rellic> ")) {
     std::string line{input};
     std::istringstream iss{line};
-    std::string command;
-    iss >> command;
-    if (command == "help") {
-      do_help();
-    } else if (command == "load") {
-      do_load(iss);
-    } else if (command == "print") {
-      do_print(iss);
-    } else if (command == "diff") {
-      do_diff(iss);
-    } else if (command == "clear") {
-      linenoiseClearScreen();
-    } else if (command == "apply") {
-      do_apply(iss);
-    } else if (command == "decompile") {
-      do_decompile();
-    } else if (command == "run") {
-      do_run(iss);
-    } else if (command == "fixpoint") {
-      do_fixpoint(iss);
-    } else if (command == "quit") {
-      std::cout << "goodbye." << std::endl;
+    if (!dispatch(iss)) {
       break;
-    } else {
-      std::cout << "error: unknown command `" << command << "'." << std::endl;
     }
     linenoiseHistoryAdd(input);
     linenoiseFree(input);
@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/FileManager.h>
+#include <clang/CodeGen/CodeGenAction.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Frontend/TextDiagnosticPrinter.h>
+#include <clang/Tooling/Tooling.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "rellic/Decompiler.h"
+
+DEFINE_string(clang, "clang",
+              "Clang executable, used to link and to find the builtin "
+              "headers. Compilation itself happens in this process.");
+DEFINE_string(variants, ",-O1,-O2,-O3,-g3",
+              "Comma-separated flags with which each test is compiled to "
+              "bitcode, one roundtrip per entry. Empty entries use no flags.");
+DEFINE_string(cflags, "",
+              "Space-separated flags added to every compilation and link.");
+DEFINE_uint32(jobs, 0,
+              "Number of cases run at once (0 means one per hardware "
+              "thread).");
+DEFINE_uint32(timeout, 30, "Time limit of each case, in seconds.");
+DEFINE_bool(translate_only, false,
+            "Only check that the tests decompile, without recompiling and "
+            "running them.");
+DEFINE_string(pipeline, "full", "Refinement pipeline, as in rellic-decomp.");
+DEFINE_uint32(decomp_threads, 1,
+              "Number of threads used to decompile each case.");
+DEFINE_string(report, "", "JSONL file in which every case is recorded.");
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// A test compiled with a set of flags
+struct Case {
+  std::string input;
+  std::string variant;
+};
+
+struct CaseResult {
+  bool passed{false};
+  std::string message;
+  std::chrono::milliseconds duration{0};
+};
+
+// Runs Clang's frontend and LLVM code generation in this process, keeping the
+// module instead of writing it out
+class EmitModuleAction : public clang::tooling::ToolAction {
+  llvm::LLVMContext &llvm_ctx;
+
+ public:
+  std::unique_ptr<llvm::Module> module;
+  std::string diagnostics;
+
+  EmitModuleAction(llvm::LLVMContext &llvm_ctx) : llvm_ctx(llvm_ctx) {}
+
+  bool runInvocation(
+      std::shared_ptr<clang::CompilerInvocation> invocation,
+      clang::FileManager *files,
+      std::shared_ptr<clang::PCHContainerOperations> pch_ops,
+      clang::DiagnosticConsumer *) override {
+    clang::CompilerInstance compiler(std::move(pch_ops));
+    compiler.setInvocation(std::move(invocation));
+    compiler.setFileManager(files);
+
+    llvm::raw_string_ostream os(diagnostics);
+    compiler.createDiagnostics(
+        new clang::TextDiagnosticPrinter(os, &compiler.getDiagnosticOpts()),
+        /*ShouldOwnClient=*/true);
+    compiler.createSourceManager(*files);
+
+    clang::EmitLLVMOnlyAction action(&llvm_ctx);
+    auto ok{compiler.ExecuteAction(action)};
+    os.flush();
+    if (ok) {
+      module = action.takeModule();
+    }
+    return ok && module;
+  }
+};
+
+// Paths and compiler output may come from anywhere, but JSON strings must be
+// valid UTF-8
+static std::string ToJSONString(const std::string &str) {
+  return llvm::json::isUTF8(str) ? str : llvm::json::fixUTF8(str);
+}
+
+static std::vector<std::string> Split(llvm::StringRef str, char separator,
+                                      bool keep_empty) {
+  llvm::SmallVector<llvm::StringRef, 8> parts;
+  str.split(parts, separator, /*MaxSplit=*/-1, keep_empty);
+  std::vector<std::string> result;
+  for (auto part : parts) {
+    result.push_back(part.trim().str());
+  }
+  return result;
+}
+
+static std::vector<std::string> GetFlags(const std::string &variant) {
+  auto flags{Split(FLAGS_cflags, ' ', false)};
+  for (auto &flag : Split(variant, ' ', false)) {
+    flags.push_back(flag);
+  }
+  return flags;
+}
+
+// Compiles `input` to a module. `diagnostics` receives the warnings and
+// errors that were reported.
+static std::unique_ptr<llvm::Module> Compile(
+    llvm::LLVMContext &llvm_ctx, const std::string &input,
+    const std::vector<std::string> &flags, std::string &diagnostics) {
+  // The path of the real executable lets the driver find the builtin headers
+  std::vector<std::string> args{FLAGS_clang, "-fsyntax-only"};
+  args.insert(args.end(), flags.begin(), flags.end());
+  args.push_back(input);
+
+  EmitModuleAction action(llvm_ctx);
+  llvm::IntrusiveRefCntPtr<clang::FileManager> files(
+      new clang::FileManager(clang::FileSystemOptions()));
+  clang::tooling::ToolInvocation invocation(args, &action, files.get());
+  auto ok{invocation.run()};
+  diagnostics = action.diagnostics;
+  return ok ? std::move(action.module) : nullptr;
+}
+
+static std::string ReadFile(const std::string &path) {
+  auto buffer{llvm::MemoryBuffer::getFile(path)};
+  return buffer ? (*buffer)->getBuffer().str() : "";
+}
+
+// Output of a program run by `Execute`
+struct Execution {
+  int status;
+  std::string out;
+  std::string err;
+  std::string message;
+};
+
+static Execution Execute(const std::string &program,
+                         const std::vector<std::string> &args,
+                         const std::string &dir, Clock::time_point deadline) {
+  llvm::SmallString<256> out(dir), err(dir);
+  static std::atomic_uint num_runs{0};
+  auto id{std::to_string(num_runs++)};
+  llvm::sys::path::append(out, "stdout." + id);
+  llvm::sys::path::append(err, "stderr." + id);
+
+  std::vector<llvm::StringRef> argv{program};
+  argv.insert(argv.end(), args.begin(), args.end());
+  llvm::Optional<llvm::StringRef> redirects[]{llvm::None, out.str(),
+                                              err.str()};
+  auto remaining{std::chrono::duration_cast<std::chrono::seconds>(
+      deadline - Clock::now())};
+  // A limit of zero would wait forever
+  auto seconds{std::max<int64_t>(1, remaining.count())};
+  Execution result;
+  result.status =
+      llvm::sys::ExecuteAndWait(program, argv, llvm::None, redirects,
+                                static_cast<unsigned>(seconds), 0,
+                                &result.message);
+  result.out = ReadFile(out.str().str());
+  result.err = ReadFile(err.str().str());
+  return result;
+}
+
+static bool WriteBitcode(llvm::Module &module, const std::string &path) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec);
+  if (ec) {
+    return false;
+  }
+  llvm::WriteBitcodeToFile(module, os);
+  return true;
+}
+
+class CaseRunner {
+  rellic::Decompiler &decompiler;
+  const Case &test_case;
+  std::string dir;
+  Clock::time_point deadline;
+
+  std::string Path(const char *name) {
+    llvm::SmallString<256> path(dir);
+    llvm::sys::path::append(path, name);
+    return path.str().str();
+  }
+
+  bool TimedOut() { return Clock::now() > deadline; }
+
+  // Writes `module` out and links it with the system toolchain
+  bool Link(llvm::Module &module, const char *name, std::string &exe,
+            std::string &message) {
+    auto bitcode{Path((std::string(name) + ".bc").c_str())};
+    exe = Path(name);
+    if (!WriteBitcode(module, bitcode)) {
+      message = "Cannot write " + bitcode;
+      return false;
+    }
+    auto args{Split(FLAGS_cflags, ' ', false)};
+    args.insert(args.end(), {"-Wno-everything", bitcode, "-o", exe});
+    auto link{Execute(FLAGS_clang, args, dir, deadline)};
+    if (link.status != 0) {
+      message = "Cannot link " + std::string(name) + ": " + link.message +
+                link.err;
+      return false;
+    }
+    return true;
+  }
+
+ public:
+  CaseRunner(rellic::Decompiler &decompiler, const Case &test_case,
+             std::string dir)
+      : decompiler(decompiler),
+        test_case(test_case),
+        dir(std::move(dir)),
+        deadline(Clock::now() + std::chrono::seconds(FLAGS_timeout)) {}
+
+  // Returns an empty string if the case passes, and why it fails otherwise
+  std::string Run() {
+    std::string diagnostics;
+    llvm::LLVMContext llvm_ctx;
+
+    // The reference binary is built without the flags of the variant, like
+    // scripts/roundtrip.py does
+    Execution expected;
+    std::string message;
+    if (!FLAGS_translate_only) {
+      auto reference{
+          Compile(llvm_ctx, test_case.input, GetFlags(""), diagnostics)};
+      if (!reference || !diagnostics.empty()) {
+        return "Errors or warnings during compilation: " + diagnostics;
+      }
+      std::string exe;
+      if (!Link(*reference, "out1", exe, message)) {
+        return message;
+      }
+      expected = Execute(exe, {}, dir, deadline);
+    }
+
+    auto module{Compile(llvm_ctx, test_case.input,
+                        GetFlags(test_case.variant), diagnostics)};
+    if (!module || !diagnostics.empty()) {
+      return "Errors or warnings during compilation: " + diagnostics;
+    }
+    if (TimedOut()) {
+      return "Timed out before decompilation";
+    }
+
+    rellic::DecompilationOptions opts;
+    opts.pipeline = FLAGS_pipeline;
+    opts.num_threads = FLAGS_decomp_threads;
+    opts.module_timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Clock::now());
+    auto result{decompiler.Decompile(std::move(module), std::move(opts))};
+    if (!result.Succeeded()) {
+      return "rellic failure: " + result.TakeError().message;
+    }
+    auto value{result.TakeValue()};
+    if (!value.function_errors.empty()) {
+      return "Cannot decompile " +
+             value.function_errors.front().function->getName().str() + ": " +
+             value.function_errors.front().message;
+    }
+
+    auto rt_c{Path("rt.c")};
+    {
+      std::error_code ec;
+      llvm::raw_fd_ostream os(rt_c, ec);
+      if (ec) {
+        return "Cannot write " + rt_c + ": " + ec.message();
+      }
+      value.ast->getASTContext().getTranslationUnitDecl()->print(os);
+      if (os.tell() == 0) {
+        return "No C was emitted";
+      }
+    }
+    if (FLAGS_translate_only) {
+      return "";
+    }
+    if (TimedOut()) {
+      return "Timed out after decompilation";
+    }
+
+    auto flags{GetFlags("")};
+    flags.push_back("-Wno-everything");
+    auto recompiled{Compile(llvm_ctx, rt_c, flags, diagnostics)};
+    if (!recompiled) {
+      return "Cannot recompile the decompiled code: " + diagnostics;
+    }
+    std::string exe;
+    if (!Link(*recompiled, "out2", exe, message)) {
+      return message;
+    }
+    auto actual{Execute(exe, {}, dir, deadline)};
+    if (TimedOut()) {
+      return "Timed out";
+    }
+    if (actual.status != expected.status) {
+      return "Different return code: " + std::to_string(expected.status) +
+             " != " + std::to_string(actual.status) + " " + actual.message;
+    }
+    if (actual.out != expected.out) {
+      return "Different stdout";
+    }
+    if (actual.err != expected.err) {
+      return "Different stderr";
+    }
+    return "";
+  }
+};
+
+static std::vector<Case> GetCases(const std::vector<std::string> &dirs) {
+  std::vector<std::string> inputs;
+  for (auto &dir : dirs) {
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(dir, ec), end;
+         !ec && it != end; it.increment(ec)) {
+      auto ext{llvm::sys::path::extension(it->path())};
+      if (ext == ".c" || ext == ".cpp") {
+        inputs.push_back(it->path());
+      }
+    }
+    CHECK(!ec) << "Cannot list " << dir << ": " << ec.message();
+  }
+  std::sort(inputs.begin(), inputs.end());
+
+  std::vector<Case> cases;
+  for (auto &input : inputs) {
+    for (auto &variant : Split(FLAGS_variants, ',', true)) {
+      cases.push_back({input, variant});
+    }
+  }
+  return cases;
+}
+
+static CaseResult RunCase(rellic::Decompiler &decompiler,
+                          const Case &test_case) {
+  auto start{Clock::now()};
+  CaseResult result;
+  llvm::SmallString<256> dir;
+  auto ec{llvm::sys::fs::createUniqueDirectory("rellic-roundtrip", dir)};
+  if (ec) {
+    result.message = "Cannot create a temporary directory: " + ec.message();
+  } else {
+    result.message = CaseRunner(decompiler, test_case, dir.str().str()).Run();
+    result.passed = result.message.empty();
+    llvm::sys::fs::remove_directories(dir);
+  }
+  result.duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - start);
+  return result;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --clang CLANG_EXE \\" << std::endl
+        << "    [--jobs N] [--timeout SECONDS] [--translate_only] \\"
+        << std::endl
+        << "    TEST_DIR..." << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  // Passes log every run, which would drown the results
+  if (google::GetCommandLineFlagInfoOrDie("minloglevel").is_default) {
+    FLAGS_minloglevel = google::GLOG_WARNING;
+  }
+
+  std::vector<std::string> dirs(argv + 1, argv + argc);
+  if (dirs.empty()) {
+    std::cerr << google::ProgramUsage();
+    return EXIT_FAILURE;
+  }
+  auto clang{llvm::sys::findProgramByName(FLAGS_clang)};
+  CHECK(clang) << "Cannot find " << FLAGS_clang;
+  FLAGS_clang = *clang;
+
+  auto cases{GetCases(dirs)};
+  unsigned num_jobs{FLAGS_jobs ? FLAGS_jobs
+                               : std::thread::hardware_concurrency()};
+  num_jobs = std::max(1U, std::min<unsigned>(num_jobs, cases.size()));
+  rellic::Decompiler decompiler(num_jobs);
+
+  std::unique_ptr<llvm::raw_fd_ostream> report;
+  if (!FLAGS_report.empty()) {
+    std::error_code ec;
+    report = std::make_unique<llvm::raw_fd_ostream>(FLAGS_report, ec);
+    CHECK(!ec) << "Failed to create " << FLAGS_report << ": " << ec.message();
+  }
+
+  std::atomic_size_t next_case{0};
+  std::atomic_size_t num_failed{0};
+  std::mutex output_mutex;
+  std::vector<std::thread> workers;
+  for (unsigned i{0}; i < num_jobs; ++i) {
+    workers.emplace_back([&]() {
+      for (auto idx{next_case++}; idx < cases.size(); idx = next_case++) {
+        auto &test_case{cases[idx]};
+        auto result{RunCase(decompiler, test_case)};
+        num_failed += !result.passed;
+
+        std::lock_guard<std::mutex> lock(output_mutex);
+        auto name{test_case.input + (test_case.variant.empty()
+                                         ? ""
+                                         : " " + test_case.variant)};
+        llvm::outs() << (result.passed ? "PASS " : "FAIL ") << name
+                     << llvm::format(" (%lldms)",
+                                     (long long)result.duration.count());
+        if (!result.passed) {
+          llvm::outs() << ": " << result.message;
+        }
+        llvm::outs() << '\n';
+        llvm::outs().flush();
+        if (report) {
+          *report << llvm::json::Value(llvm::json::Object{
+                         {"input", ToJSONString(test_case.input)},
+                         {"variant", test_case.variant},
+                         {"passed", result.passed},
+                         {"message", ToJSONString(result.message)},
+                         {"duration_ms", result.duration.count()}})
+                  << '\n';
+        }
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  llvm::outs() << cases.size() - num_failed << " of " << cases.size()
+               << " cases passed\n";
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+
+  return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <iostream>
+#include <sstream>
+#include <system_error>
+
+#include "rellic/BC/Synthetic.h"
+#include "rellic/Exception.h"
+
+DEFINE_string(shape, "sequential_ifs",
+              "Shape of the generated functions: sequential_ifs, "
+              "nested_loops, wide_switch, diamond_chain, irreducible or "
+              "expr_dag.");
+DEFINE_uint32(size, 16, "Size parameter of the shape.");
+DEFINE_uint32(functions, 1, "Number of functions to generate.");
+DEFINE_string(fuzz_input, "",
+              "Decode an input of rellic-perf-fuzz instead of generating a "
+              "shape, e.g. to keep it as a benchmark sample.");
+DEFINE_string(output, "",
+              "Output file. Bitcode is written when its extension is .bc, and "
+              "textual IR otherwise, including to stdout when empty.");
+
+int main(int argc, char *argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --shape SHAPE \\" << std::endl
+        << "    --size SIZE \\" << std::endl
+        << "    [--functions NUM_FUNCTIONS] \\" << std::endl
+        << "    [--fuzz_input FUZZ_INPUT_FILE] \\" << std::endl
+        << "    [--output OUTPUT_FILE] \\" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module;
+  try {
+    if (!FLAGS_fuzz_input.empty()) {
+      auto input{llvm::MemoryBuffer::getFile(FLAGS_fuzz_input)};
+      if (!input) {
+        LOG(FATAL) << "Cannot read " << FLAGS_fuzz_input << ": "
+                   << input.getError().message();
+      }
+      auto bytes{(*input)->getBuffer()};
+      module = rellic::CreateFuzzedModule(
+          llvm_ctx, {reinterpret_cast<const uint8_t *>(bytes.data()),
+                     bytes.size()});
+    } else {
+      auto shape{rellic::ParseSyntheticShape(FLAGS_shape)};
+      if (!shape) {
+        LOG(FATAL) << "Unknown shape " << FLAGS_shape;
+      }
+      module = rellic::CreateSyntheticModule(llvm_ctx, *shape, FLAGS_size,
+                                             FLAGS_functions);
+    }
+  } catch (rellic::Exception &ex) {
+    LOG(FATAL) << ex.what();
+  }
+
+  if (FLAGS_output.empty()) {
+    module->print(llvm::outs(), nullptr);
+  } else {
+    std::error_code ec;
+    llvm::raw_fd_ostream os(FLAGS_output, ec);
+    if (ec) {
+      LOG(FATAL) << ec.message();
+    }
+    if (llvm::sys::path::extension(FLAGS_output) == ".bc") {
+      llvm::WriteBitcodeToFile(*module, os);
+    } else {
+      module->print(os, nullptr);
+    }
+  }
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "Catalog.h"
+
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+
+#include <cstring>
+#include <memory>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "rellic/BC/Util.h"
+
+// How long the watcher waits for changes before checking whether to stop
+static constexpr int WatchPollTimeoutMs{1000};
+
+// Files that cannot be loaded as modules are counted as defining no functions
+static unsigned CountFunctions(const std::string& path) {
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module{
+      rellic::LoadLazyModuleFromFile(&context, path, true)};
+  if (!module) {
+    return 0;
+  }
+
+  // Bodies are not read, but functions that have one are not declarations
+  unsigned count{0};
+  for (auto& func : *module) {
+    if (!func.isDeclaration()) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+static std::string JoinPath(const std::string& dir, llvm::StringRef name) {
+  return dir.empty() ? name.str() : dir + "/" + name.str();
+}
+
+Catalog::Catalog(std::string root) : root(std::move(root)) {}
+
+Catalog::~Catalog() { Stop(); }
+
+void Catalog::Start() {
+  watcher = std::thread([this]() { Watch(); });
+  indexer = std::thread([this]() { Index(); });
+}
+
+void Catalog::Stop() {
+  {
+    std::unique_lock<std::mutex> lock(pending_mutex);
+    stopping = true;
+  }
+  pending_changed.notify_all();
+  if (watcher.joinable()) {
+    watcher.join();
+  }
+  if (indexer.joinable()) {
+    indexer.join();
+  }
+}
+
+Catalog::Page Catalog::Find(const std::string& prefix,
+                            const std::string& query, size_t offset,
+                            size_t limit) {
+  Page page{0, {}};
+  std::shared_lock<std::shared_mutex> lock(entries_mutex);
+  for (auto it{entries.lower_bound(prefix)};
+       it != entries.end() && llvm::StringRef(it->first).startswith(prefix);
+       ++it) {
+    if (!query.empty() && it->first.find(query) == std::string::npos) {
+      continue;
+    }
+    if (page.Total >= offset && page.Entries.size() < limit) {
+      page.Entries.push_back(
+          {it->first, it->second.size, it->second.functions});
+    }
+    ++page.Total;
+  }
+  return page;
+}
+
+std::optional<std::string> Catalog::Resolve(const std::string& path) {
+  std::shared_lock<std::shared_mutex> lock(entries_mutex);
+  if (!entries.count(path)) {
+    return std::nullopt;
+  }
+  return FullPath(path);
+}
+
+std::string Catalog::FullPath(const std::string& path) const {
+  llvm::SmallString<256> full(root);
+  llvm::sys::path::append(full, path);
+  return full.str().str();
+}
+
+void Catalog::Add(const std::string& path, uint64_t size) {
+  {
+    std::unique_lock<std::shared_mutex> lock(entries_mutex);
+    entries[path] = {size, std::nullopt};
+  }
+  {
+    std::unique_lock<std::mutex> lock(pending_mutex);
+    pending.push_back(path);
+  }
+  pending_changed.notify_one();
+}
+
+// Removes the file at `path`, or all the files under it if it is a directory
+void Catalog::Remove(const std::string& path) {
+  std::unique_lock<std::shared_mutex> lock(entries_mutex);
+  entries.erase(path);
+  auto dir{path + "/"};
+  auto it{entries.lower_bound(dir)};
+  while (it != entries.end() && llvm::StringRef(it->first).startswith(dir)) {
+    it = entries.erase(it);
+  }
+}
+
+// Adds the files under `dir`, relative to the root, and watches the
+// directories they are in
+void Catalog::Scan(const std::string& dir) {
+  std::vector<std::string> dirs{dir};
+  while (!dirs.empty() && !stopping) {
+    auto current{std::move(dirs.back())};
+    dirs.pop_back();
+    auto full{FullPath(current)};
+#ifdef __linux__
+    if (inotify_fd >= 0) {
+      auto wd{inotify_add_watch(inotify_fd, full.c_str(),
+                                IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                    IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)};
+      if (wd < 0) {
+        LOG(WARNING) << "Cannot watch " << full << ": " << strerror(errno);
+      } else {
+        watches[wd] = current;
+      }
+    }
+#endif
+
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(full, ec, false), end;
+         it != end && !ec; it.increment(ec)) {
+      auto path{JoinPath(current, llvm::sys::path::filename(it->path()))};
+      if (it->type() == llvm::sys::fs::file_type::directory_file) {
+        dirs.push_back(path);
+      } else if (it->type() == llvm::sys::fs::file_type::regular_file) {
+        auto status{it->status()};
+        Add(path, status ? status->getSize() : 0);
+      }
+    }
+  }
+}
+
+void Catalog::Index() {
+  while (true) {
+    std::string path;
+    {
+      std::unique_lock<std::mutex> lock(pending_mutex);
+      pending_changed.wait(lock,
+                           [this]() { return stopping || !pending.empty(); });
+      if (stopping) {
+        return;
+      }
+      path = std::move(pending.front());
+      pending.pop_front();
+    }
+
+    {
+      std::shared_lock<std::shared_mutex> lock(entries_mutex);
+      auto it{entries.find(path)};
+      if (it == entries.end() || it->second.functions) {
+        continue;
+      }
+    }
+
+    auto count{CountFunctions(FullPath(path))};
+    std::unique_lock<std::shared_mutex> lock(entries_mutex);
+    auto it{entries.find(path)};
+    if (it != entries.end()) {
+      it->second.functions = count;
+    }
+  }
+}
+
+void Catalog::Watch() {
+#ifdef __linux__
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0) {
+    LOG(WARNING) << "Cannot watch " << root
+                 << " for changes: " << strerror(errno);
+  }
+#endif
+
+  Scan("");
+  scanned = true;
+  {
+    std::shared_lock<std::shared_mutex> lock(entries_mutex);
+    LOG(INFO) << "Found " << entries.size() << " files in " << root;
+  }
+
+#ifdef __linux__
+  if (inotify_fd < 0) {
+    return;
+  }
+
+  alignas(inotify_event) char buffer[64 * 1024];
+  while (!stopping) {
+    pollfd fd{inotify_fd, POLLIN, 0};
+    if (poll(&fd, 1, WatchPollTimeoutMs) <= 0) {
+      continue;
+    }
+    auto len{read(inotify_fd, buffer, sizeof(buffer))};
+    for (char* ptr{buffer}; len > 0 && ptr < buffer + len;) {
+      auto event{reinterpret_cast<inotify_event*>(ptr)};
+      ptr += sizeof(inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        LOG(WARNING) << "Missed changes to " << root << ", scanning it again";
+        {
+          std::unique_lock<std::shared_mutex> lock(entries_mutex);
+          entries.clear();
+        }
+        watches.clear();
+        Scan("");
+        break;
+      }
+      if (event->mask & IN_IGNORED) {
+        watches.erase(event->wd);
+        continue;
+      }
+
+      auto dir{watches.find(event->wd)};
+      if (dir == watches.end() || !event->len) {
+        continue;
+      }
+      auto path{JoinPath(dir->second, event->name)};
+      if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        Remove(path);
+        if (event->mask & IN_ISDIR) {
+          // Directories moved elsewhere are still watched under their old path
+          for (auto it{watches.begin()}; it != watches.end();) {
+            llvm::StringRef watched(it->second);
+            if (watched == path || watched.startswith(path + "/")) {
+              inotify_rm_watch(inotify_fd, it->first);
+              it = watches.erase(it);
+            } else {
+              ++it;
+            }
+          }
+        }
+      } else if (event->mask & IN_ISDIR) {
+        Scan(path);
+      } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        // Files are only added once they have been written
+        uint64_t size;
+        if (!llvm::sys::fs::file_size(FullPath(path), size)) {
+          Add(path, size);
+        }
+      }
+    }
+  }
+  close(inotify_fd);
+#endif
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Index of the files under a directory, such as a copy of the AnghaBench
+// corpus, so that it can be browsed without listing the directory again. The
+// directory is scanned once in the background, and then kept up to date
+// through inotify where it is available. The functions defined by each file
+// are counted in the background as well.
+class Catalog {
+ public:
+  struct Entry {
+    // Relative to the root of the catalog
+    std::string Path;
+    uint64_t Size;
+    // Missing until the file has been indexed
+    std::optional<unsigned> Functions;
+  };
+
+  struct Page {
+    // Number of entries matching the search
+    size_t Total;
+    std::vector<Entry> Entries;
+  };
+
+  Catalog(std::string root);
+  ~Catalog();
+
+  void Start();
+  void Stop();
+
+  // Returns up to `limit` of the entries whose path starts with `prefix` and
+  // contains `query`, in order of path and after skipping the first `offset`
+  Page Find(const std::string& prefix, const std::string& query,
+            size_t offset, size_t limit);
+
+  // Returns the full path of the file at `path` in the catalog, or nothing if
+  // there is no such file
+  std::optional<std::string> Resolve(const std::string& path);
+
+  // Whether the initial scan is over
+  bool Scanned() const { return scanned; }
+
+ private:
+  struct Info {
+    uint64_t size;
+    std::optional<unsigned> functions;
+  };
+
+  std::string root;
+  std::map<std::string, Info> entries;
+  std::shared_mutex entries_mutex;
+
+  // Files whose functions remain to be counted
+  std::deque<std::string> pending;
+  std::mutex pending_mutex;
+  std::condition_variable pending_changed;
+
+  std::atomic_bool stopping{false};
+  std::atomic_bool scanned{false};
+  std::thread indexer, watcher;
+
+  // Directories being watched, by inotify watch descriptor. Only used by the
+  // watcher thread.
+  int inotify_fd{-1};
+  std::unordered_map<int, std::string> watches;
+
+  std::string FullPath(const std::string& path) const;
+  void Scan(const std::string& dir);
+  void Add(const std::string& path, uint64_t size);
+  void Remove(const std::string& path);
+  void Index();
+  void Watch();
+};
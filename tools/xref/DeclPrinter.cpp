@@ -35,6 +35,8 @@ class DeclPrinter : public DeclVisitor<DeclPrinter> {
   const ASTContext &Context;
   unsigned Indentation;
   bool PrintInstantiation;
+  // Top-level declarations that are printed, all if unset
+  llvm::function_ref<bool(Decl *)> TopLevelFilter;
 
   raw_ostream &Indent() { return Indent(Indentation); }
   raw_ostream &Indent(unsigned Indentation);
@@ -63,6 +65,10 @@ class DeclPrinter : public DeclVisitor<DeclPrinter> {
         Indentation(Indentation),
         PrintInstantiation(PrintInstantiation) {}
 
+  void SetTopLevelFilter(llvm::function_ref<bool(Decl *)> Filter) {
+    TopLevelFilter = Filter;
+  }
+
   void VisitDeclContext(DeclContext *DC, bool Indent = true);
 
   void VisitTranslationUnitDecl(TranslationUnitDecl *D);
@@ -141,6 +147,15 @@ void PrintDecl(clang::Decl *decl, const clang::PrintingPolicy &Policy,
   Printer.Visit(decl);
 }
 
+void PrintTopLevelDecls(clang::TranslationUnitDecl *TU,
+                        llvm::function_ref<bool(clang::Decl *)> Filter,
+                        const clang::PrintingPolicy &Policy,
+                        llvm::raw_ostream &Out) {
+  DeclPrinter Printer(Out, Policy, TU->getASTContext(), 0, false);
+  Printer.SetTopLevelFilter(Filter);
+  Printer.Visit(TU);
+}
+
 static QualType GetBaseType(QualType T) {
   // FIXME: This should be on the Type class!
   QualType BaseType = T;
@@ -354,6 +369,9 @@ void DeclPrinter::VisitDeclContext(DeclContext *DC, bool Indent) {
     // Skip over implicit declarations in pretty-printing mode.
     if (D->isImplicit()) continue;
 
+    if (TopLevelFilter && isa<TranslationUnitDecl>(DC) && !TopLevelFilter(*D))
+      continue;
+
     // Don't print implicit specializations, as they are printed when visiting
     // corresponding templates.
     if (auto FD = dyn_cast<FunctionDecl>(*D))
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "Metrics.h"
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Format.h>
+
+static double ToSeconds(std::chrono::steady_clock::duration elapsed) {
+  return std::chrono::duration<double>(elapsed).count();
+}
+
+void Metrics::Histogram::Observe(double value) {
+  for (size_t i{0}; i < Buckets.size(); ++i) {
+    if (value <= Buckets[i]) {
+      ++buckets[i];
+    }
+  }
+  ++count;
+  sum += value;
+}
+
+void Metrics::Histogram::Write(llvm::raw_ostream& os, const char* name,
+                               const std::string& labels) const {
+  for (size_t i{0}; i < Buckets.size(); ++i) {
+    os << name << "_bucket{" << labels << ",le=\""
+       << llvm::format("%g", Buckets[i]) << "\"} " << buckets[i] << '\n';
+  }
+  os << name << "_bucket{" << labels << ",le=\"+Inf\"} " << count << '\n';
+  os << name << "_sum{" << labels << "} " << sum << '\n';
+  os << name << "_count{" << labels << "} " << count << '\n';
+}
+
+void Metrics::ObserveRequest(const std::string& route, int status,
+                             std::chrono::steady_clock::duration elapsed) {
+  std::unique_lock<std::mutex> lock(mutex);
+  requests[route].Observe(ToSeconds(elapsed));
+  ++responses[{route, status}];
+}
+
+void Metrics::ObserveJob(const std::string& kind,
+                         std::chrono::steady_clock::duration elapsed) {
+  std::unique_lock<std::mutex> lock(mutex);
+  jobs[kind].Observe(ToSeconds(elapsed));
+}
+
+void Metrics::ObservePass(const std::string& name, bool changed,
+                          std::chrono::steady_clock::duration elapsed) {
+  std::unique_lock<std::mutex> lock(mutex);
+  auto& totals{passes[name]};
+  ++totals.runs;
+  totals.changes += changed;
+  totals.seconds += ToSeconds(elapsed);
+}
+
+void Metrics::Write(llvm::raw_ostream& os) {
+  std::unique_lock<std::mutex> lock(mutex);
+  os << "# HELP rellic_xref_request_duration_seconds Time spent serving "
+        "requests.\n"
+     << "# TYPE rellic_xref_request_duration_seconds histogram\n";
+  for (auto& [route, histogram] : requests) {
+    histogram.Write(os, "rellic_xref_request_duration_seconds",
+                    "route=\"" + route + "\"");
+  }
+
+  os << "# HELP rellic_xref_responses_total Responses sent, by status.\n"
+     << "# TYPE rellic_xref_responses_total counter\n";
+  for (auto& [key, count] : responses) {
+    os << "rellic_xref_responses_total{route=\"" << key.first
+       << "\",status=\"" << key.second << "\"} " << count << '\n';
+  }
+
+  os << "# HELP rellic_xref_job_duration_seconds Time spent running "
+        "background jobs.\n"
+     << "# TYPE rellic_xref_job_duration_seconds histogram\n";
+  for (auto& [kind, histogram] : jobs) {
+    histogram.Write(os, "rellic_xref_job_duration_seconds",
+                    "kind=\"" + kind + "\"");
+  }
+
+  os << "# HELP rellic_xref_pass_runs_total Runs of AST passes.\n"
+     << "# TYPE rellic_xref_pass_runs_total counter\n";
+  for (auto& [name, totals] : passes) {
+    os << "rellic_xref_pass_runs_total{pass=\"" << name << "\"} "
+       << totals.runs << '\n';
+  }
+  os << "# HELP rellic_xref_pass_changes_total Runs of AST passes that "
+        "changed the AST.\n"
+     << "# TYPE rellic_xref_pass_changes_total counter\n";
+  for (auto& [name, totals] : passes) {
+    os << "rellic_xref_pass_changes_total{pass=\"" << name << "\"} "
+       << totals.changes << '\n';
+  }
+  os << "# HELP rellic_xref_pass_seconds_total Time spent running AST "
+        "passes.\n"
+     << "# TYPE rellic_xref_pass_seconds_total counter\n";
+  for (auto& [name, totals] : passes) {
+    os << "rellic_xref_pass_seconds_total{pass=\"" << name << "\"} "
+       << totals.seconds << '\n';
+  }
+}
+
+std::string GetRouteLabel(const std::string& path) {
+  llvm::StringRef ref(path);
+  if (!ref.startswith("/action/") && ref != "/metrics") {
+    return "static";
+  }
+
+  llvm::SmallVector<llvm::StringRef, 4> components;
+  ref.split(components, '/');
+  std::string route;
+  for (auto component : components) {
+    if (component.empty()) {
+      continue;
+    }
+    route += '/';
+    route += llvm::all_of(component, llvm::isDigit) ? ":id" : component.str();
+  }
+  return route;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// Counters and histograms describing the activity of the server, exported in
+// the Prometheus text format. Gauges that are read from the state of the
+// server are written by the `/metrics` handler itself.
+class Metrics {
+ public:
+  // Upper bounds of the buckets of latency histograms, in seconds
+  static constexpr std::array<double, 13> Buckets{
+      0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+
+ private:
+  struct Histogram {
+    std::array<uint64_t, Buckets.size()> buckets{};
+    uint64_t count{0};
+    double sum{0};
+
+    void Observe(double value);
+    void Write(llvm::raw_ostream& os, const char* name,
+               const std::string& labels) const;
+  };
+
+  struct PassTotals {
+    uint64_t runs{0};
+    uint64_t changes{0};
+    double seconds{0};
+  };
+
+  std::mutex mutex;
+  std::map<std::string, Histogram> requests;
+  std::map<std::pair<std::string, int>, uint64_t> responses;
+  std::map<std::string, Histogram> jobs;
+  std::map<std::string, PassTotals> passes;
+
+ public:
+  // Records a request to `route` that was answered with `status`
+  void ObserveRequest(const std::string& route, int status,
+                      std::chrono::steady_clock::duration elapsed);
+  // Records a background job of the given kind
+  void ObserveJob(const std::string& kind,
+                  std::chrono::steady_clock::duration elapsed);
+  // Records a run of the AST pass `name`
+  void ObservePass(const std::string& name, bool changed,
+                   std::chrono::steady_clock::duration elapsed);
+
+  void Write(llvm::raw_ostream& os);
+};
+
+// Route of a request as it is labelled in metrics: the path of actions, with
+// numeric components replaced by ":id", or "static" for assets
+std::string GetRouteLabel(const std::string& path);
@@ -13,11 +13,21 @@
 #include <clang/AST/PrettyPrinter.h>
 #include <clang/AST/Stmt.h>
 #include <clang/AST/Type.h>
+#include <llvm/ADT/STLExtras.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <cstdint>
+#include <memory>
+
 void PrintDecl(clang::Decl* Decl, const clang::PrintingPolicy& Policy,
                int Indentation, llvm::raw_ostream& Out);
+// Prints the translation unit like `PrintDecl`, but only with the top-level
+// declarations that satisfy `Filter`
+void PrintTopLevelDecls(clang::TranslationUnitDecl* TU,
+                        llvm::function_ref<bool(clang::Decl*)> Filter,
+                        const clang::PrintingPolicy& Policy,
+                        llvm::raw_ostream& Out);
 void PrintDeclGroup(clang::Decl** Begin, unsigned NumDecls,
                     llvm::raw_ostream& Out, const clang::PrintingPolicy& Policy,
                     unsigned Indentation);
@@ -38,4 +48,31 @@ void PrintQualifiers(const clang::Qualifiers& Qualifiers, llvm::raw_ostream& OS,
                      bool appendSpaceIfNonEmpty = false);
 std::string GetQualifiersAsString(const clang::Qualifiers& Qualifiers);
 std::string GetQualifiersAsString(const clang::Qualifiers& Qualifiers,
-                                  const clang::PrintingPolicy& Policy);
\ No newline at end of file
+                                  const clang::PrintingPolicy& Policy);
+
+// Renderings of the types printed while the cache is installed by a
+// `TypeCacheScope`. Types are told apart by their pointer and qualifiers rather
+// than by their canonical type, as typedefs are printed differently from the
+// types they name. Renderings refer to declarations by name and address, so
+// they are only reused for the version of the AST they were made for.
+class TypeCache {
+ public:
+  struct Impl;
+
+  TypeCache();
+  ~TypeCache();
+
+ private:
+  friend class TypeCacheScope;
+  std::unique_ptr<Impl> impl;
+};
+
+// Installs `Cache` for the printers of the calling thread, after emptying it
+// unless it holds the renderings of `Version`
+class TypeCacheScope {
+  TypeCache::Impl* Previous;
+
+ public:
+  TypeCacheScope(TypeCache& Cache, uint64_t Version);
+  ~TypeCacheScope();
+};
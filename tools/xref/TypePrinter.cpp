@@ -44,7 +44,9 @@
 #include <llvm/Support/raw_ostream.h>
 
 #include <cassert>
+#include <mutex>
 #include <string>
+#include <tuple>
 
 #include "Printer.h"
 
@@ -152,6 +154,73 @@ class TypePrinter {
 
 }  // namespace
 
+// Types, qualifiers, policies and whether the placeholder is empty, for which
+// the same HTML is printed before and after the placeholder
+using TypeCacheKey =
+    std::tuple<const Type *, uint64_t, uint64_t, const PrintingCallbacks *>;
+
+struct TypeCache::Impl {
+  struct Rendering {
+    std::string Before;
+    std::string After;
+  };
+
+  // Renderings are shared by all views of a session, which can be rendered at
+  // the same time
+  std::mutex Mutex;
+  uint64_t Version{0};
+  llvm::DenseMap<TypeCacheKey, std::shared_ptr<const Rendering>> Renderings;
+};
+
+TypeCache::TypeCache() : impl(std::make_unique<Impl>()) {}
+TypeCache::~TypeCache() = default;
+
+static thread_local TypeCache::Impl *CurrentTypeCache{nullptr};
+
+TypeCacheScope::TypeCacheScope(TypeCache &Cache, uint64_t Version)
+    : Previous(CurrentTypeCache) {
+  {
+    std::unique_lock<std::mutex> Lock(Cache.impl->Mutex);
+    if (Cache.impl->Version != Version) {
+      Cache.impl->Renderings.clear();
+      Cache.impl->Version = Version;
+    }
+  }
+  CurrentTypeCache = Cache.impl.get();
+}
+
+TypeCacheScope::~TypeCacheScope() { CurrentTypeCache = Previous; }
+
+// Packs the fields of `Policy` that type printing depends on. Tag definitions
+// are printed with the declaration printer, which reads many more, so types
+// that include them are not cached.
+static uint64_t GetTypeCacheFlags(const PrintingPolicy &Policy,
+                                  bool HasEmptyPlaceHolder) {
+  uint64_t Flags{0};
+  unsigned Bit{0};
+  for (bool Field : {HasEmptyPlaceHolder,
+                     (bool)Policy.SuppressSpecifiers,
+                     (bool)Policy.SuppressTagKeyword,
+                     (bool)Policy.SuppressScope,
+                     (bool)Policy.SuppressUnwrittenScope,
+                     (bool)Policy.SuppressInlineNamespace,
+                     (bool)Policy.SuppressDefaultTemplateArgs,
+                     (bool)Policy.SuppressStrongLifetime,
+                     (bool)Policy.SuppressLifetimeQualifiers,
+                     (bool)Policy.AnonymousTagLocations,
+                     (bool)Policy.CleanUglifiedParameters,
+                     (bool)Policy.MSVCFormatting,
+                     (bool)Policy.PrintCanonicalTypes,
+                     (bool)Policy.PrintInjectedClassNameWithArguments,
+                     (bool)Policy.Restrict,
+                     (bool)Policy.SplitTemplateClosers,
+                     (bool)Policy.UsePreferredNames,
+                     (bool)Policy.UseVoidForZeroParams}) {
+    Flags |= uint64_t(Field) << Bit++;
+  }
+  return Flags;
+}
+
 static void AppendTypeQualList(raw_ostream &OS, unsigned TypeQuals,
                                bool HasRestrictKeyword) {
   bool appendSpace = false;
@@ -198,9 +267,41 @@ void TypePrinter::print(const Type *T, Qualifiers Quals, raw_ostream &OS,
 
   SaveAndRestore PHVal(HasEmptyPlaceHolder, PlaceHolder.empty());
 
-  printBefore(T, Quals, OS);
-  OS << PlaceHolder;
-  printAfter(T, Quals, OS);
+  auto Cache{CurrentTypeCache};
+  if (!Cache || Policy.IncludeTagDefinition || InsideCCAttribute) {
+    printBefore(T, Quals, OS);
+    OS << PlaceHolder;
+    printAfter(T, Quals, OS);
+    return;
+  }
+
+  TypeCacheKey Key{T, Quals.getAsOpaqueValue(),
+                   GetTypeCacheFlags(Policy, HasEmptyPlaceHolder),
+                   Policy.Callbacks};
+  std::shared_ptr<const TypeCache::Impl::Rendering> Rendering;
+  {
+    std::unique_lock<std::mutex> Lock(Cache->Mutex);
+    auto It{Cache->Renderings.find(Key)};
+    if (It != Cache->Renderings.end()) {
+      Rendering = It->second;
+    }
+  }
+
+  // Types are rendered without the lock, so nested types can be looked up
+  if (!Rendering) {
+    auto Rendered{std::make_shared<TypeCache::Impl::Rendering>()};
+    llvm::raw_string_ostream BeforeOS(Rendered->Before);
+    printBefore(T, Quals, BeforeOS);
+    BeforeOS.flush();
+    llvm::raw_string_ostream AfterOS(Rendered->After);
+    printAfter(T, Quals, AfterOS);
+    AfterOS.flush();
+
+    std::unique_lock<std::mutex> Lock(Cache->Mutex);
+    Rendering = Cache->Renderings.try_emplace(Key, Rendered).first->second;
+  }
+
+  OS << Rendering->Before << PlaceHolder << Rendering->After;
 }
 
 bool TypePrinter::canPrefixQualifiers(const Type *T,
@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "Workers.h"
+
+#include <glog/logging.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/JSON.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include <cstring>
+
+extern char** environ;
+
+using namespace std::chrono_literals;
+
+// How often workers are checked for having exited
+static constexpr auto WorkerCheckInterval{1s};
+// How long a worker may take to answer, which bounds renderings and the
+// silence of job event streams
+static constexpr auto ForwardTimeout{600s};
+// Responses larger than this are forwarded but not kept
+static constexpr size_t CachedResponseLimit{16 * 1024 * 1024};
+// Bytes of responses kept for all sessions together
+static constexpr size_t CacheLimit{256 * 1024 * 1024};
+
+static void SendError(httplib::Response& res, int status,
+                      const std::string& message) {
+  std::string s;
+  llvm::raw_string_ostream os(s);
+  os << llvm::json::Value(llvm::json::Object{{"message", message}});
+  res.status = status;
+  res.set_content(os.str(), "application/json");
+}
+
+static std::string EncodeQueryComponent(const std::string& str) {
+  std::string res;
+  for (char c : str) {
+    if (llvm::isAlnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      res.push_back(c);
+    } else {
+      res += "%" + llvm::utohexstr(static_cast<unsigned char>(c) >> 4) +
+             llvm::utohexstr(static_cast<unsigned char>(c) & 0xf);
+    }
+  }
+  return res;
+}
+
+// Path and query of a request, as it is forwarded to a worker
+static std::string GetTarget(const httplib::Request& req) {
+  std::string target{req.path};
+  char separator{'?'};
+  for (auto& [name, value] : req.params) {
+    target += separator;
+    target += EncodeQueryComponent(name) + "=" + EncodeQueryComponent(value);
+    separator = '&';
+  }
+  return target;
+}
+
+// Headers of a request forwarded to a worker on behalf of `session`.
+// Responses are compressed by the main process, if at all.
+static httplib::Headers GetForwardedHeaders(size_t session) {
+  return {{"Cookie", "sessionId=" + std::to_string(session)},
+          {"Accept-Encoding", "identity"}};
+}
+
+WorkerPool::WorkerPool(std::string executable, std::vector<std::string> args,
+                       size_t num_workers, uint16_t first_port,
+                       std::chrono::minutes session_timeout)
+    : executable(std::move(executable)),
+      args(std::move(args)),
+      session_timeout(session_timeout) {
+  for (size_t i{0}; i < num_workers; ++i) {
+    workers.emplace_back();
+    workers.back().port = static_cast<uint16_t>(first_port + i);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  if (monitor.joinable()) {
+    Stop();
+  }
+}
+
+void WorkerPool::Spawn(Worker& worker) {
+  std::vector<std::string> argv{executable};
+  argv.insert(argv.end(), args.begin(), args.end());
+  argv.push_back("--worker_port=" + std::to_string(worker.port));
+  std::vector<char*> c_argv;
+  for (auto& arg : argv) {
+    c_argv.push_back(arg.data());
+  }
+  c_argv.push_back(nullptr);
+
+  pid_t pid;
+  auto err{posix_spawn(&pid, executable.c_str(), nullptr, nullptr,
+                       c_argv.data(), environ)};
+  if (err) {
+    LOG(ERROR) << "Cannot start the worker on port " << worker.port << ": "
+               << std::strerror(err);
+    return;
+  }
+  worker.pid = pid;
+  ++worker.generation;
+  worker.num_sessions = 0;
+  LOG(INFO) << "Started worker " << pid << " on port " << worker.port;
+}
+
+void WorkerPool::Check() {
+  std::unique_lock<std::mutex> lock(mutex);
+  for (auto& worker : workers) {
+    if (worker.pid) {
+      int status{0};
+      auto pid{waitpid(worker.pid, &status, WNOHANG)};
+      if (!pid) {
+        continue;
+      }
+      if (pid > 0 && WIFSIGNALED(status)) {
+        LOG(ERROR) << "Worker " << worker.pid << " was killed by signal "
+                   << WTERMSIG(status) << ", losing " << worker.num_sessions
+                   << " sessions";
+      } else {
+        LOG(ERROR) << "Worker " << worker.pid << " exited with status "
+                   << WEXITSTATUS(status) << ", losing "
+                   << worker.num_sessions << " sessions";
+      }
+      worker.pid = 0;
+      ++num_restarts;
+    }
+    Spawn(worker);
+  }
+
+  auto now{std::chrono::steady_clock::now()};
+  for (auto it{pins.begin()}; it != pins.end();) {
+    if (now - it->second.last_access <= session_timeout) {
+      ++it;
+      continue;
+    }
+    auto& worker{workers[it->second.worker]};
+    if (worker.generation == it->second.generation && worker.num_sessions) {
+      --worker.num_sessions;
+    }
+    it = pins.erase(it);
+  }
+}
+
+bool WorkerPool::GetWorker(size_t session, uint16_t& port,
+                           uint64_t& generation) {
+  auto now{std::chrono::steady_clock::now()};
+  std::unique_lock<std::mutex> lock(mutex);
+  auto it{pins.find(session)};
+  if (it != pins.end()) {
+    auto& worker{workers[it->second.worker]};
+    if (worker.generation != it->second.generation) {
+      pins.erase(it);
+      return false;
+    }
+    it->second.last_access = now;
+    port = worker.port;
+    generation = worker.generation;
+    return true;
+  }
+
+  size_t best{0};
+  for (size_t i{1}; i < workers.size(); ++i) {
+    if (workers[i].num_sessions < workers[best].num_sessions) {
+      best = i;
+    }
+  }
+  auto& worker{workers[best]};
+  ++worker.num_sessions;
+  pins[session] = {best, worker.generation, now};
+  port = worker.port;
+  generation = worker.generation;
+  return true;
+}
+
+std::shared_ptr<const std::string> WorkerPool::FindCached(
+    const std::string& key, std::string& etag, std::string& content_type) {
+  std::unique_lock<std::mutex> lock(cache_mutex);
+  auto it{cache_index.find(key)};
+  if (it == cache_index.end()) {
+    return nullptr;
+  }
+  cache.splice(cache.begin(), cache, it->second);
+  etag = cache.front().etag;
+  content_type = cache.front().content_type;
+  return cache.front().body;
+}
+
+void WorkerPool::AddCached(CachedResponse response) {
+  std::unique_lock<std::mutex> lock(cache_mutex);
+  auto it{cache_index.find(response.key)};
+  if (it != cache_index.end()) {
+    cache_size -= it->second->body->size();
+    cache.erase(it->second);
+    cache_index.erase(it);
+  }
+  cache_size += response.body->size();
+  cache.push_front(std::move(response));
+  cache_index[cache.front().key] = cache.begin();
+  while (cache_size > CacheLimit) {
+    cache_size -= cache.back().body->size();
+    cache_index.erase(cache.back().key);
+    cache.pop_back();
+  }
+}
+
+void WorkerPool::Start() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (auto& worker : workers) {
+      Spawn(worker);
+    }
+  }
+  monitor = std::thread([this]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wakeup.wait_for(lock, WorkerCheckInterval,
+                            [this]() { return stopping; })) {
+      lock.unlock();
+      Check();
+      lock.lock();
+    }
+  });
+}
+
+void WorkerPool::Stop() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wakeup.notify_all();
+  monitor.join();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  for (auto& worker : workers) {
+    if (worker.pid) {
+      kill(worker.pid, SIGTERM);
+      waitpid(worker.pid, nullptr, 0);
+      worker.pid = 0;
+    }
+  }
+}
+
+void WorkerPool::Forward(const httplib::Request& req, httplib::Response& res,
+                         size_t session, const std::string& path,
+                         const std::string& body,
+                         const std::string& content_type) {
+  uint16_t port;
+  uint64_t generation;
+  if (!GetWorker(session, port, generation)) {
+    SendError(res, 503,
+              "The worker holding this session stopped, and the session was "
+              "lost.");
+    return;
+  }
+
+  auto target{path.empty() ? GetTarget(req) : path};
+  auto headers{GetForwardedHeaders(session)};
+  // Renderings are told apart by the worker that made them, as the versions
+  // of the sessions of a worker that has been started again start over
+  auto key{std::to_string(port) + "/" + std::to_string(generation) + "/" +
+           std::to_string(session) + " " + target};
+  auto is_get{req.method == "GET"};
+  std::string cached_etag, cached_type;
+  std::shared_ptr<const std::string> cached;
+  if (is_get) {
+    cached = FindCached(key, cached_etag, cached_type);
+    if (cached) {
+      headers.emplace("If-None-Match", cached_etag);
+    } else if (req.has_header("If-None-Match")) {
+      headers.emplace("If-None-Match", req.get_header_value("If-None-Match"));
+    }
+  }
+
+  httplib::Client client("127.0.0.1", port);
+  client.set_read_timeout(ForwardTimeout.count(), 0);
+  auto result{
+      is_get ? client.Get(target.c_str(), headers)
+             : client.Post(target.c_str(), headers,
+                           path.empty() ? req.body : body,
+                           (path.empty() ? req.get_header_value("Content-Type")
+                                         : content_type)
+                               .c_str())};
+  if (!result) {
+    SendError(res, 502, "The worker of this session is not available.");
+    return;
+  }
+
+  auto& response{*result};
+  if (response.status == 304 && cached) {
+    res.set_header("ETag", cached_etag);
+    res.set_header("Cache-Control", "no-cache");
+    if (req.get_header_value("If-None-Match") == cached_etag) {
+      res.status = 304;
+      return;
+    }
+    res.status = 200;
+    res.set_content_provider(
+        cached->size(), cached_type.c_str(),
+        [cached](size_t offset, size_t length, httplib::DataSink& sink) {
+          sink.write(cached->data() + offset, length);
+          return true;
+        });
+    return;
+  }
+
+  res.status = response.status;
+  for (auto name : {"ETag", "Cache-Control"}) {
+    if (response.has_header(name)) {
+      res.set_header(name, response.get_header_value(name));
+    }
+  }
+  auto type{response.get_header_value("Content-Type")};
+  if (is_get && response.status == 200 && response.has_header("ETag") &&
+      response.body.size() <= CachedResponseLimit) {
+    CachedResponse entry;
+    entry.key = key;
+    entry.etag = response.get_header_value("ETag");
+    entry.content_type = type;
+    entry.body = std::make_shared<const std::string>(response.body);
+    AddCached(std::move(entry));
+  }
+  if (response.status != 304) {
+    res.set_content(response.body, type.c_str());
+  }
+}
+
+void WorkerPool::ForwardEvents(const httplib::Request& req,
+                               httplib::Response& res, size_t session) {
+  uint16_t port;
+  uint64_t generation;
+  if (!GetWorker(session, port, generation)) {
+    SendError(res, 503,
+              "The worker holding this session stopped, and the session was "
+              "lost.");
+    return;
+  }
+
+  auto target{GetTarget(req)};
+  res.set_header("Cache-Control", "no-cache");
+  res.set_chunked_content_provider(
+      "text/event-stream",
+      [port, target, session](size_t, httplib::DataSink& sink) {
+        httplib::Client client("127.0.0.1", port);
+        client.set_read_timeout(ForwardTimeout.count(), 0);
+        // A job that cannot be followed ends the stream, which clients report
+        // as having lost track of it
+        client.Get(
+            target.c_str(), GetForwardedHeaders(session),
+            [](const httplib::Response& response) {
+              return response.status == 200;
+            },
+            [&sink](const char* data, size_t size) {
+              if (!sink.is_writable()) {
+                return false;
+              }
+              sink.write(data, size);
+              return true;
+            });
+        sink.done();
+        return true;
+      });
+}
+
+void WorkerPool::WriteMetrics(llvm::raw_ostream& os) {
+  size_t num_running{0}, num_pinned{0};
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (auto& worker : workers) {
+      num_running += worker.pid != 0;
+    }
+    num_pinned = pins.size();
+  }
+  size_t cached_bytes;
+  {
+    std::unique_lock<std::mutex> lock(cache_mutex);
+    cached_bytes = cache_size;
+  }
+  os << "# HELP rellic_xref_workers Worker processes that are running.\n"
+     << "# TYPE rellic_xref_workers gauge\n"
+     << "rellic_xref_workers " << num_running << '\n'
+     << "# HELP rellic_xref_worker_restarts_total Worker processes that "
+        "exited and were started again.\n"
+     << "# TYPE rellic_xref_worker_restarts_total counter\n"
+     << "rellic_xref_worker_restarts_total " << num_restarts.load() << '\n'
+     << "# HELP rellic_xref_pinned_sessions Sessions pinned to a worker.\n"
+     << "# TYPE rellic_xref_pinned_sessions gauge\n"
+     << "rellic_xref_pinned_sessions " << num_pinned << '\n'
+     << "# HELP rellic_xref_cached_response_bytes Bytes of worker responses "
+        "kept by the main process.\n"
+     << "# TYPE rellic_xref_cached_response_bytes gauge\n"
+     << "rellic_xref_cached_response_bytes " << cached_bytes << '\n';
+}
+
+void ConfigureWorker(uint64_t memory_limit) {
+#ifdef __linux__
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+  if (memory_limit) {
+    rlimit limit{};
+    limit.rlim_cur = memory_limit;
+    limit.rlim_max = memory_limit;
+    if (setrlimit(RLIMIT_AS, &limit)) {
+      PLOG(WARNING) << "Cannot limit the address space of the worker";
+    }
+  }
+}
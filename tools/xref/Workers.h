@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <httplib.h>
+#include <llvm/Support/raw_ostream.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Worker processes that hold the sessions of the server, so that a crash or a
+// runaway pass only loses the sessions of one worker. Each worker runs the
+// same executable with `--worker_port`, serves the actions of its sessions on
+// that port of the loopback interface, and is started again as soon as it
+// exits. Sessions are pinned to the worker that has the fewest of them when
+// they are first seen, and requests are forwarded to it.
+//
+// The main process keeps the last responses of workers that carry an ETag, so
+// that renderings the worker still considers current are sent from there.
+class WorkerPool {
+  struct Worker {
+    uint16_t port;
+    pid_t pid{0};
+    // Incremented whenever the worker is started again, which loses its
+    // sessions
+    uint64_t generation{0};
+    size_t num_sessions{0};
+  };
+
+  struct Pin {
+    size_t worker;
+    uint64_t generation;
+    std::chrono::steady_clock::time_point last_access;
+  };
+
+  // A response of a worker that carries an ETag
+  struct CachedResponse {
+    std::string key;
+    std::string etag;
+    std::string content_type;
+    std::shared_ptr<const std::string> body;
+  };
+
+  std::string executable;
+  std::vector<std::string> args;
+  std::chrono::minutes session_timeout;
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  bool stopping{false};
+  std::vector<Worker> workers;
+  std::unordered_map<size_t, Pin> pins;
+  std::thread monitor;
+  std::atomic_uint64_t num_restarts{0};
+
+  using ResponseList = std::list<CachedResponse>;
+  std::mutex cache_mutex;
+  ResponseList cache;
+  std::unordered_map<std::string, ResponseList::iterator> cache_index;
+  size_t cache_size{0};
+
+  // Starts `worker`, which must be stopped. Requires `mutex`.
+  void Spawn(Worker& worker);
+  // Restarts the workers that have exited and forgets the sessions that have
+  // expired
+  void Check();
+
+  // Finds the worker of `session`, pinning it to one if needed. Returns false
+  // if the worker of the session has been restarted since, which unpins it.
+  bool GetWorker(size_t session, uint16_t& port, uint64_t& generation);
+
+  std::shared_ptr<const std::string> FindCached(const std::string& key,
+                                               std::string& etag,
+                                               std::string& content_type);
+  void AddCached(CachedResponse response);
+
+ public:
+  // Workers are started with the arguments the server was started with,
+  // `args`, followed by `--worker_port`. They listen on consecutive ports
+  // starting at `first_port`.
+  WorkerPool(std::string executable, std::vector<std::string> args,
+             size_t num_workers, uint16_t first_port,
+             std::chrono::minutes session_timeout);
+  ~WorkerPool();
+
+  void Start();
+  void Stop();
+
+  // Forwards a request of `session` to its worker, and sends its response
+  // back. Unless `path` is empty, `path` is requested instead of the target
+  // of `req`, with `body` and `content_type`.
+  void Forward(const httplib::Request& req, httplib::Response& res,
+               size_t session, const std::string& path = "",
+               const std::string& body = "",
+               const std::string& content_type = "");
+  // Forwards a request for a stream of job events, which is relayed as it is
+  // received
+  void ForwardEvents(const httplib::Request& req, httplib::Response& res,
+                     size_t session);
+
+  // Writes the gauges and counters of the pool in the Prometheus text format
+  void WriteMetrics(llvm::raw_ostream& os);
+};
+
+// Applies the settings of a worker process to the calling process: its address
+// space is limited to `memory_limit` bytes unless it is zero, and it is
+// terminated along with the process that started it
+void ConfigureWorker(uint64_t memory_limit);
@@ -6,11 +6,14 @@
  * the LICENSE file found in the root directory of this source tree.
  */
 
+#include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/Frontend/ASTUnit.h>
 #include <clang/Tooling/Tooling.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <httplib.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/IR/AssemblyAnnotationWriter.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/LLVMContext.h>
@@ -22,14 +25,28 @@
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/FormattedStream.h>
 #include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Process.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils.h>
 #include <llvm/Transforms/Utils/Local.h>
 #include <llvm/Transforms/Utils/LowerSwitch.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <list>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <random>
 #include <shared_mutex>
 #include <sstream>
@@ -37,10 +54,17 @@
 #include <system_error>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
+#include "Catalog.h"
+#include "Metrics.h"
 #include "Printer.h"
+#include "Workers.h"
 #include "rellic/AST/ASTPass.h"
+#include "rellic/AST/CPrinter.h"
+#include "rellic/AST/ChangeLog.h"
 #include "rellic/AST/CondBasedRefine.h"
 #include "rellic/AST/DeadStmtElim.h"
 #include "rellic/AST/DebugInfoCollector.h"
@@ -54,6 +78,7 @@
 #include "rellic/AST/NestedScopeCombine.h"
 #include "rellic/AST/ReachBasedRefine.h"
 #include "rellic/AST/StructFieldRenamer.h"
+#include "rellic/AST/UndoJournal.h"
 #include "rellic/AST/Util.h"
 #include "rellic/AST/Z3CondSimplify.h"
 #include "rellic/BC/Util.h"
@@ -70,10 +95,47 @@ DEFINE_string(address, "0.0.0.0", "Address on which the server will listen");
 DEFINE_int32(port, 80, "Port on which the server will listen");
 DEFINE_string(home, "./www", "");
 DEFINE_string(angha, "./anghabench", "Path for anghabench files");
+DEFINE_uint32(session_timeout, 30,
+              "Minutes of inactivity after which a session is discarded.");
+DEFINE_uint64(session_memory_limit, 0,
+              "Approximate number of bytes all sessions may use together. The "
+              "least recently used sessions are discarded beyond it. Zero "
+              "means unbounded.");
+DEFINE_uint32(workers, 0,
+              "Number of worker processes holding the sessions. Zero keeps "
+              "them in the server process.");
+DEFINE_int32(first_worker_port, 0,
+             "First of the consecutive loopback ports on which the workers "
+             "listen. Zero means the port after --port.");
+DEFINE_uint64(worker_memory_limit, 0,
+              "Bytes of address space each worker may use. Zero means "
+              "unbounded.");
+DEFINE_int32(worker_port, 0,
+             "Serves the sessions of the server that started this process "
+             "on this loopback port. Only set for workers.");
+DEFINE_uint32(slowest_queries, 5,
+              "Number of the slowest Z3 queries kept for each function, which "
+              "the performance panel shows. Zero keeps none.");
 
 using namespace std::chrono_literals;
 
-static constexpr auto SessionPersistenceTime{30min};
+// Default and largest number of AnghaBench files listed at once
+static constexpr size_t AnghaPageSize{100};
+static constexpr size_t MaxAnghaPageSize{1000};
+// How often sessions are checked for expiration and memory usage
+static constexpr auto SessionEvictionInterval{10s};
+// Size of the chunks in which renderings are sent
+static constexpr size_t ViewChunkSize{64 * 1024};
+// Renderings larger than this are sent as they are made, but not cached
+static constexpr size_t ViewCacheLimit{16 * 1024 * 1024};
+// How long a stream of job events may stay silent before a comment is sent to
+// find out whether the client is still listening
+static constexpr auto JobKeepAliveInterval{15s};
+// Number of the last runs of passes kept for the timeline of the performance
+// panel, and default and largest number of functions it lists at once
+static constexpr size_t StatsRunLimit{500};
+static constexpr size_t StatsFunctionCount{20};
+static constexpr size_t MaxStatsFunctionCount{1000};
 
 static void SetVersion(void) {
   std::stringstream version;
@@ -104,21 +166,195 @@ static void SetVersion(void) {
   google::SetVersionString(version.str());
 }
 
+// A decompilation or a run of AST passes that executes in the background. Its
+// progress is recorded as a sequence of JSON events, the last of which has type
+// "done" and holds the outcome of the job.
+class Job {
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<std::string> events;
+  bool done{false};
+  bool stop_requested{false};
+  rellic::ASTPass* pass{nullptr};
+
+  void Append(llvm::json::Object event, bool last) {
+    std::string s;
+    llvm::raw_string_ostream os(s);
+    os << llvm::json::Value(std::move(event));
+    os.flush();
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      events.push_back(std::move(s));
+      done = last;
+    }
+    changed.notify_all();
+  }
+
+ public:
+  const size_t Id;
+  // Iteration of the innermost fixpoint being computed
+  std::atomic_uint Iteration{0};
+  // Whether a pass changed the AST without logging where, which keeps the
+  // job from reporting a patch. Only used by the thread running the job.
+  bool UntrackedChanges{false};
+
+  Job(size_t id) : Id(id) {}
+
+  void Report(llvm::json::Object event) { Append(std::move(event), false); }
+
+  void Finish(const std::string& status, const std::string& message) {
+    Append({{"type", "done"}, {"status", status}, {"message", message}}, true);
+  }
+
+  // Moves the events after the first `next` ones to `out`, waiting up to
+  // `timeout` for one to be reported. Returns whether the job is done and all
+  // of its events have been read.
+  template <typename Duration>
+  bool Read(size_t& next, std::vector<std::string>& out, Duration timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait_for(lock, timeout,
+                     [&]() { return done || events.size() > next; });
+    out.insert(out.end(), events.begin() + next, events.end());
+    next = events.size();
+    return done;
+  }
+
+  bool Done() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return done;
+  }
+
+  // Interrupts the pass being run, and keeps the job from running any other
+  void Stop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    stop_requested = true;
+    if (pass) {
+      pass->Stop();
+    }
+  }
+
+  bool StopRequested() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return stop_requested;
+  }
+
+  // Sets the pass that `Stop` interrupts
+  void SetPass(rellic::ASTPass* p) {
+    std::unique_lock<std::mutex> lock(mutex);
+    pass = p;
+  }
+};
+
+// A rendering of a session, valid while the session is at `Version`
+struct CachedView {
+  uint64_t Version{0};
+  std::shared_ptr<const std::string> Content;
+};
+
+// The IR values and AST nodes related by the provenance of a version of a
+// session, as sorted pairs of ids in both directions. Ids are the addresses
+// that the renderings use as element ids.
+struct ProvenanceIndex {
+  uint64_t Version{0};
+  std::vector<std::pair<uint64_t, uint64_t>> Pairs;
+};
+
+// What the work done on the AST of a session has cost, for `/action/stats`.
+// Jobs update it after each step rather than when they are done, so that it
+// can be followed while they run. Guarded by `Mutex`.
+struct SessionStats {
+  struct Pass {
+    uint64_t Runs{0};
+    uint64_t Changes{0};
+    // Largest iteration of a fixpoint that the pass ran in
+    uint64_t Iterations{0};
+    std::chrono::nanoseconds Elapsed{0};
+    // Operations on conditions made by the pass, and those that reached Z3
+    uint64_t Queries{0};
+    uint64_t Z3{0};
+    // Growth of the memory allocated by the ASTContext
+    uint64_t ASTBytes{0};
+  };
+
+  // A run of a pass, relative to the start of the decompilation
+  struct Run {
+    std::string Pass;
+    unsigned Iteration;
+    std::chrono::nanoseconds Start;
+    std::chrono::nanoseconds Elapsed;
+    bool Changed;
+  };
+
+  std::mutex Mutex;
+  std::chrono::steady_clock::time_point Start;
+  std::chrono::nanoseconds DecompileElapsed{0};
+  std::map<std::string, Pass> Passes;
+  // The last `StatsRunLimit` runs
+  std::deque<Run> Runs;
+  // Copied from the decompilation context once GenerateAST is done
+  std::vector<rellic::FunctionMetrics> Functions;
+  // Copied from the decompilation context after each step
+  rellic::ProverStatistics Prover;
+  size_t ASTBytes{0};
+  size_t Z3Exprs{0};
+
+  // Forgets what the previous AST has cost. Requires `Mutex`.
+  void Reset() {
+    Start = std::chrono::steady_clock::now();
+    DecompileElapsed = {};
+    Passes.clear();
+    Runs.clear();
+    Functions.clear();
+    Prover = {};
+    ASTBytes = 0;
+    Z3Exprs = 0;
+  }
+};
+
 struct Session {
   size_t Id;
-  std::chrono::time_point<std::chrono::system_clock> LastAccess;
+  std::chrono::steady_clock::time_point LastAccess;
   std::unique_ptr<llvm::LLVMContext> Context;
   std::unique_ptr<llvm::Module> Module;
   std::unique_ptr<clang::ASTUnit> Unit;
-  std::unique_ptr<rellic::ASTPass> Pass;
   std::unique_ptr<rellic::DecompilationContext> DecompContext;
+  // Records the changes made to `DecompContext` by refinement passes, for
+  // `/action/snapshot` and `/action/restore`
+  std::unique_ptr<rellic::UndoJournal> Journal;
   // Must always be acquired in this order and released all at once
   std::shared_mutex LoadMutex, MutationMutex;
+  // Size of the IR that `Module` was loaded from, guarded by `LoadMutex`
+  size_t ModuleSize{0};
+  // Last estimate of the memory used by the session, see `SessionStore`
+  // Also read by `/metrics`
+  std::atomic_size_t MemoryUsage{0};
+  // Incremented whenever the module or the AST changes, which only happens
+  // while `LoadMutex` or `MutationMutex` is held exclusively
+  std::atomic_uint64_t Version{1};
+  // Renderings of the current version, guarded by `ViewMutex`
+  CachedView ModuleView, ASTView, ProvenanceView, DeclListView;
+  std::mutex ViewMutex;
+  // Renderings of the types of the AST, shared by all views of a version
+  TypeCache Types;
+  // Provenance of the current version, built when it is first queried and
+  // guarded by `ViewMutex`
+  std::shared_ptr<const ProvenanceIndex> Provenance;
+  // Most recently started job, guarded by `JobMutex`
+  std::shared_ptr<Job> CurrentJob;
+  std::mutex JobMutex;
+  SessionStats Stats;
 };
 
 static httplib::Server svr;
-static std::unordered_map<size_t, Session> sessions;
-static std::mutex sessions_mutex;
+static Metrics metrics;
+// When the request being served by the thread was received
+static thread_local std::chrono::steady_clock::time_point request_start;
+// With --workers, the processes holding the sessions, and the session of the
+// request being served by the thread
+static std::unique_ptr<WorkerPool> workers;
+static thread_local size_t request_session;
+// Number of jobs that are running
+static std::atomic_size_t running_jobs{0};
 
 static std::vector<std::string> Split(const std::string& s,
                                       const std::string& delim) {
@@ -155,52 +391,176 @@ static std::unordered_map<std::string, std::string> GetCookies(
   return res;
 }
 
-static void RemoveOldSessions() {
-  auto now{std::chrono::system_clock::now()};
+// Sessions ordered from the most to the least recently used. Looking a session
+// up takes constant time. A background thread discards the sessions that have
+// not been used for `--session_timeout` minutes, and then the least recently
+// used ones while all sessions together use more than
+// `--session_memory_limit` bytes. Handlers keep their session alive, so a
+// session that is discarded while in use is only freed once they are done.
+class SessionStore {
+  using SessionList = std::list<std::shared_ptr<Session>>;
+  SessionList lru;
+  std::unordered_map<size_t, SessionList::iterator> index;
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  bool stopping{false};
+  std::thread evictor;
+
+  void EvictLast(std::vector<std::shared_ptr<Session>>& evicted) {
+    evicted.push_back(std::move(lru.back()));
+    index.erase(evicted.back()->Id);
+    lru.pop_back();
+  }
 
-  bool old_sessions_erased{false};
-  do {
-    old_sessions_erased = false;
-    for (auto it{sessions.begin()}; it != sessions.end(); ++it) {
-      if (now - it->second.LastAccess > SessionPersistenceTime) {
-        sessions.erase(it);
-        old_sessions_erased = true;
-        break;
+  // Sessions that are being modified keep their previous estimate
+  static void Measure(Session& session) {
+    read_lock load_lock(session.LoadMutex, std::try_to_lock);
+    if (!load_lock.owns_lock()) {
+      return;
+    }
+    read_lock mutation_lock(session.MutationMutex, std::try_to_lock);
+    if (!mutation_lock.owns_lock()) {
+      return;
+    }
+
+    size_t usage{session.Module ? session.ModuleSize : 0};
+    if (session.DecompContext) {
+      // Memory allocated by Z3 is shared by all sessions
+      auto ctx_usage{session.DecompContext->GetMemoryUsage()};
+      usage += ctx_usage.ast + ctx_usage.tables;
+    }
+    {
+      std::unique_lock<std::mutex> lock(session.ViewMutex);
+      for (auto view : {&session.ModuleView, &session.ASTView,
+                        &session.ProvenanceView, &session.DeclListView}) {
+        usage += view->Content ? view->Content->size() : 0;
+      }
+      if (session.Provenance) {
+        usage += session.Provenance->Pairs.capacity() *
+                 sizeof(session.Provenance->Pairs[0]);
       }
     }
-  } while (old_sessions_erased);
-}
+    session.MemoryUsage = usage;
+  }
 
-static Session& GetSession(const httplib::Request& req) {
-  std::unique_lock<std::mutex> lock(sessions_mutex);
-  auto now{std::chrono::system_clock::now()};
+  void Evict() {
+    // Sessions are freed once the lock has been released
+    std::vector<std::shared_ptr<Session>> evicted;
+    std::vector<std::shared_ptr<Session>> live;
+    auto now{std::chrono::steady_clock::now()};
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      auto timeout{std::chrono::minutes(FLAGS_session_timeout)};
+      while (!lru.empty() && now - lru.back()->LastAccess > timeout) {
+        EvictLast(evicted);
+      }
+      // Sessions are measured even without a limit, for `/metrics`
+      live.assign(lru.begin(), lru.end());
+    }
 
-  auto cookies{GetCookies(req)};
-  auto sessionId{cookies.find("sessionId")};
-  if (sessionId != cookies.end()) {
-    auto id{std::stoull(sessionId->second)};
-    auto kvp{sessions.find(id)};
-    auto& session{sessions[id]};
-    session.LastAccess = now;
-    if (kvp == sessions.end()) {
-      session.Id = id;
-      session.Context = std::make_unique<llvm::LLVMContext>();
-    }
-
-    RemoveOldSessions();
+    for (auto& session : live) {
+      Measure(*session);
+    }
+    live.clear();
+    if (!FLAGS_session_memory_limit) {
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t total{0};
+    for (auto& session : lru) {
+      total += session->MemoryUsage;
+    }
+    // The most recently used session is always kept
+    while (total > FLAGS_session_memory_limit && lru.size() > 1) {
+      LOG(INFO) << "Discarding session " << lru.back()->Id << " using "
+                << lru.back()->MemoryUsage << " bytes";
+      total -= lru.back()->MemoryUsage;
+      EvictLast(evicted);
+    }
+  }
+
+ public:
+  size_t Size() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return lru.size();
+  }
+
+  // Sum of the last estimates of the memory used by each session
+  size_t MemoryUsage() {
+    std::unique_lock<std::mutex> lock(mutex);
+    size_t total{0};
+    for (auto& session : lru) {
+      total += session->MemoryUsage;
+    }
+    return total;
+  }
+
+  // Returns the session with the given id, or a new session if there is none
+  std::shared_ptr<Session> Get(std::optional<size_t> id) {
+    auto now{std::chrono::steady_clock::now()};
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!id) {
+      std::random_device dev;
+      std::uniform_int_distribution<std::size_t> dist;
+      do {
+        id = dist(dev);
+      } while (index.count(*id));
+    }
+
+    auto it{index.find(*id)};
+    if (it != index.end()) {
+      lru.splice(lru.begin(), lru, it->second);
+      lru.front()->LastAccess = now;
+      return lru.front();
+    }
+
+    auto session{std::make_shared<Session>()};
+    session->Id = *id;
+    session->LastAccess = now;
+    session->Context = std::make_unique<llvm::LLVMContext>();
+    lru.push_front(session);
+    index[*id] = lru.begin();
     return session;
   }
 
-  std::random_device dev;
-  std::uniform_int_distribution<std::size_t> dist;
-  size_t id{dist(dev)};
-  auto& session{sessions[id]};
-  session.Id = id;
-  session.LastAccess = now;
-  session.Context = std::make_unique<llvm::LLVMContext>();
+  void Start() {
+    evictor = std::thread([this]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!wakeup.wait_for(lock, SessionEvictionInterval,
+                              [this]() { return stopping; })) {
+        lock.unlock();
+        Evict();
+        lock.lock();
+      }
+    });
+  }
+
+  void Stop() {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    evictor.join();
+  }
+};
+
+static SessionStore sessions;
+
+static std::optional<size_t> GetSessionId(const httplib::Request& req) {
+  auto cookies{GetCookies(req)};
+  auto cookie{cookies.find("sessionId")};
+  unsigned long long value;
+  if (cookie != cookies.end() &&
+      !llvm::StringRef(cookie->second).getAsInteger(10, value)) {
+    return value;
+  }
+  return std::nullopt;
+}
 
-  RemoveOldSessions();
-  return session;
+static std::shared_ptr<Session> GetSession(const httplib::Request& req) {
+  return sessions.Get(GetSessionId(req));
 }
 
 static void SendJSON(httplib::Response& res, llvm::json::Object& obj) {
@@ -219,17 +579,285 @@ static void SendJSON(httplib::Response& res, llvm::json::Array& arr) {
 
 static httplib::Server::HandlerResponse PreRoutingHandler(
     const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
+  request_start = std::chrono::steady_clock::now();
+  // Scrapers do not keep cookies, and must not create sessions
+  if (req.path == "/metrics") {
+    return httplib::Server::HandlerResponse::Unhandled;
+  }
+
+  auto session{GetSession(req)};
+  std::string header{"sessionId="};
+  header += std::to_string(session->Id);
+  res.set_header("Set-Cookie", header.c_str());
+
+  return httplib::Server::HandlerResponse::Unhandled;
+}
+
+// Like `PreRoutingHandler` when the sessions are held by workers: the session
+// of the request is only given an id, which handlers find in
+// `request_session`
+static httplib::Server::HandlerResponse RouterPreRoutingHandler(
+    const httplib::Request& req, httplib::Response& res) {
+  request_start = std::chrono::steady_clock::now();
+  if (req.path == "/metrics") {
+    return httplib::Server::HandlerResponse::Unhandled;
+  }
+
+  auto id{GetSessionId(req)};
+  if (!id) {
+    std::random_device dev;
+    id = std::uniform_int_distribution<size_t>()(dev);
+  }
+  request_session = *id;
   std::string header{"sessionId="};
-  header += std::to_string(session.Id);
+  header += std::to_string(*id);
   res.set_header("Set-Cookie", header.c_str());
 
   return httplib::Server::HandlerResponse::Unhandled;
 }
 
+// Records that the module or the AST of the session has changed, which makes
+// its cached renderings stale
+static void Invalidate(Session& session) {
+  ++session.Version;
+  std::unique_lock<std::mutex> lock(session.ViewMutex);
+  session.ModuleView = {};
+  session.ASTView = {};
+  session.ProvenanceView = {};
+  session.DeclListView = {};
+  session.Provenance = nullptr;
+}
+
+// Writes to the sink of an httplib content provider, and keeps a copy of what
+// has been written as long as it is at most `copy_limit` bytes long
+class SinkStream : public llvm::raw_ostream {
+  httplib::DataSink& sink;
+  uint64_t pos{0};
+  size_t copy_limit;
+  bool failed{false};
+
+  void write_impl(const char* ptr, size_t size) override {
+    pos += size;
+    if (Copy && Copy->size() + size > copy_limit) {
+      Copy.reset();
+    } else if (Copy) {
+      Copy->append(ptr, size);
+    }
+
+    if (failed || !sink.is_writable()) {
+      failed = true;
+      return;
+    }
+    sink.write(ptr, size);
+  }
+
+  uint64_t current_pos() const override { return pos; }
+
+ public:
+  std::optional<std::string> Copy;
+
+  SinkStream(httplib::DataSink& sink, size_t copy_limit)
+      : sink(sink), copy_limit(copy_limit) {
+    SetBufferSize(ViewChunkSize);
+    if (copy_limit) {
+      Copy.emplace();
+    }
+  }
+  ~SinkStream() override { flush(); }
+
+  // Whether the client has stopped receiving what is written
+  bool Failed() const { return failed; }
+};
+
+using ViewRenderer = std::function<void(llvm::raw_ostream&)>;
+
+// Responds with a rendering of the current version of the session. Unless
+// `view` is null, the rendering is cached in that member of the session if it
+// is small enough, and only made by `render` if the cache is stale. Clients
+// revalidate their copy through its ETag, and get an empty response if it is
+// still current.
+//
+// The rendering is written by `render` directly to the connection, after the
+// handler has returned and released its locks. They are taken again meanwhile,
+// and the response is abandoned if the session has changed in between.
+static void SendView(const httplib::Request& req, httplib::Response& res,
+                     std::shared_ptr<Session> session,
+                     CachedView Session::*view, const char* content_type,
+                     ViewRenderer render) {
+  auto version{session->Version.load()};
+  std::string etag{"\"" + std::to_string(session->Id) + "-" +
+                   std::to_string(version) + "\""};
+  res.set_header("ETag", etag);
+  res.set_header("Cache-Control", "no-cache");
+  if (req.get_header_value("If-None-Match") == etag) {
+    res.status = 304;
+    return;
+  }
+
+  res.status = 200;
+  if (view) {
+    std::shared_ptr<const std::string> content;
+    {
+      std::unique_lock<std::mutex> lock(session->ViewMutex);
+      if (((*session).*view).Version == version) {
+        content = ((*session).*view).Content;
+      }
+    }
+    if (content) {
+      res.set_content_provider(
+          content->size(), content_type,
+          [content](size_t offset, size_t length, httplib::DataSink& sink) {
+            sink.write(content->data() + offset,
+                       std::min(length, ViewChunkSize));
+            return true;
+          });
+      return;
+    }
+  }
+
+  res.set_chunked_content_provider(
+      content_type, [session, view, version, render](
+                        size_t, httplib::DataSink& sink) {
+        read_lock load_mutex(session->LoadMutex);
+        read_lock mutation_mutex(session->MutationMutex);
+        if (session->Version != version) {
+          return false;
+        }
+
+        SinkStream os(sink, view ? ViewCacheLimit : 0);
+        TypeCacheScope types(session->Types, version);
+        render(os);
+        os.flush();
+        if (os.Failed()) {
+          return false;
+        }
+        sink.done();
+
+        if (os.Copy) {
+          std::unique_lock<std::mutex> lock(session->ViewMutex);
+          ((*session).*view).Version = version;
+          ((*session).*view).Content =
+              std::make_shared<const std::string>(std::move(*os.Copy));
+        }
+        return true;
+      });
+}
+
+static std::atomic_size_t next_job_id{1};
+
+// Runs a job that has been prepared, and returns the message it finishes with
+using JobRun = std::function<std::string(Session&, Job&)>;
+// Prepares a job once the locks of its session are held. Returns how to run
+// the job, or nothing and the reason why it cannot run in `error`.
+using JobPrepare =
+    std::function<JobRun(Session&, Job&, std::string& error)>;
+
+// Starts a job of the given kind on its own thread, which holds the locks of
+// `session` until the job is done. Responds with the id of the job once it has
+// been prepared, or with the reason why it could not be.
+static void StartJob(const char* kind, std::shared_ptr<Session> session,
+                     httplib::Response& res, JobPrepare prepare) {
+  auto job{std::make_shared<Job>(next_job_id++)};
+  std::promise<std::string> prepared;
+  auto error{prepared.get_future()};
+  std::thread([kind, session, job, prepare,
+               prepared{std::move(prepared)}]() mutable {
+    read_lock load_mutex(session->LoadMutex);
+    write_lock mutation_mutex(session->MutationMutex, std::try_to_lock);
+    if (!mutation_mutex.owns_lock()) {
+      prepared.set_value(
+          "Cannot execute while other operations are in progress.");
+      return;
+    }
+
+    std::string message;
+    auto run{prepare(*session, *job, message)};
+    if (!run) {
+      prepared.set_value(message);
+      return;
+    }
+    {
+      std::unique_lock<std::mutex> lock(session->JobMutex);
+      session->CurrentJob = job;
+    }
+    prepared.set_value("");
+
+    ++running_jobs;
+    auto start{std::chrono::steady_clock::now()};
+    try {
+      message = run(*session, *job);
+      Invalidate(*session);
+      job->SetPass(nullptr);
+      job->Finish(job->StopRequested() ? "stopped" : "ok", message);
+    } catch (rellic::Exception& e) {
+      Invalidate(*session);
+      job->SetPass(nullptr);
+      job->Finish("error", e.what());
+    }
+    metrics.ObserveJob(kind, std::chrono::steady_clock::now() - start);
+    --running_jobs;
+  }).detach();
+
+  auto message{error.get()};
+  if (!message.empty()) {
+    llvm::json::Object msg{{"message", message}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  llvm::json::Object msg{{"message", "Started."},
+                         {"job", static_cast<int64_t>(job->Id)}};
+  SendJSON(res, msg);
+  res.status = 202;
+}
+
+// Streams the events of a job as server-sent events, until the job is done
+static void JobEvents(const httplib::Request& req, httplib::Response& res) {
+  auto session{GetSession(req)};
+  std::shared_ptr<Job> job;
+  {
+    std::unique_lock<std::mutex> lock(session->JobMutex);
+    job = session->CurrentJob;
+  }
+
+  unsigned long long id;
+  if (!job || llvm::StringRef(req.matches[1].str()).getAsInteger(10, id) ||
+      job->Id != id) {
+    llvm::json::Object msg{{"message", "No such job."}};
+    res.status = 404;
+    SendJSON(res, msg);
+    return;
+  }
+
+  res.set_header("Cache-Control", "no-cache");
+  res.set_chunked_content_provider(
+      "text/event-stream",
+      [job, next{size_t{0}}](size_t, httplib::DataSink& sink) mutable {
+        std::vector<std::string> events;
+        auto done{job->Read(next, events, JobKeepAliveInterval)};
+        std::string chunk;
+        for (auto& event : events) {
+          chunk += "data: " + event + "\n\n";
+        }
+        if (chunk.empty()) {
+          // Comments are ignored by clients, but fail once they have left
+          chunk = ": keep-alive\n\n";
+        }
+        if (!sink.is_writable()) {
+          return false;
+        }
+        sink.write(chunk.data(), chunk.size());
+        if (done) {
+          sink.done();
+        }
+        return true;
+      });
+}
+
 static void LoadModule(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  write_lock lock(session.LoadMutex, std::try_to_lock);
+  auto session{GetSession(req)};
+  write_lock lock(session->LoadMutex, std::try_to_lock);
   if (!lock.owns_lock()) {
     llvm::json::Object msg{
         {"message",
@@ -239,71 +867,118 @@ static void LoadModule(const httplib::Request& req, httplib::Response& res) {
     return;
   }
 
-  auto mod{rellic::LoadModuleFromMemory(session.Context.get(), req.body, true)};
+  auto mod{
+      rellic::LoadModuleFromMemory(session->Context.get(), req.body, true)};
   if (!mod) {
     llvm::json::Object msg{{"message", "Couldn't load LLVM module."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
-  session.Module = std::unique_ptr<llvm::Module>(mod);
+  session->Module = std::unique_ptr<llvm::Module>(mod);
+  Invalidate(*session);
+  session->ModuleSize = req.body.size();
   llvm::json::Object msg{{"message", "Ok."}};
   SendJSON(res, msg);
   res.status = 200;
 }
 
-static void Decompile(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex);
+// Operations on conditions made by a prover from all of its call sites
+struct QueryTotals {
+  uint64_t Queries{0};
+  uint64_t Z3{0};
+  std::chrono::nanoseconds Elapsed{0};
+};
 
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
+static QueryTotals CountQueries(const rellic::ProverStatistics& stats) {
+  QueryTotals totals;
+  for (auto& [name, site] : stats.sites) {
+    for (auto& queries : site.queries) {
+      totals.Queries += queries.num_queries;
+      totals.Z3 += queries.num_z3;
+      totals.Elapsed += queries.elapsed;
+    }
   }
+  return totals;
+}
+
+// Copies the statistics of the decompilation context of `session` to its
+// stats. Requires `session.Stats.Mutex`.
+static void CopyContextStats(Session& session) {
+  auto& dec_ctx{*session.DecompContext};
+  session.Stats.Prover = dec_ctx.prover.GetStatistics();
+  session.Stats.ASTBytes = dec_ctx.ast_ctx.getASTAllocatedMemory();
+  session.Stats.Z3Exprs = dec_ctx.z3_exprs.size();
+}
 
+static std::string DecompileModule(Session& session, Job& job) {
+  {
+    std::unique_lock<std::mutex> lock(session.Stats.Mutex);
+    session.Stats.Reset();
+  }
   try {
+    job.Report({{"type", "stage"}, {"message", "Creating translation unit."}});
     std::vector<std::string> args{"-Wno-pointer-to-int-cast",
                                   "-Wno-pointer-sign", "-target",
                                   session.Module->getTargetTriple()};
+    session.Journal = nullptr;
     session.Unit = clang::tooling::buildASTFromCodeWithArgs("", args, "out.c");
     session.DecompContext =
         std::make_unique<rellic::DecompilationContext>(*session.Unit);
+    session.DecompContext->forensic_queries = FLAGS_slowest_queries;
     rellic::DebugInfoCollector dic;
     dic.visit(*session.Module);
+    job.Report({{"type", "stage"}, {"message", "Generating AST."}});
     rellic::GenerateAST::run(*session.Module, *session.DecompContext);
+    job.Report({{"type", "stage"}, {"message", "Renaming declarations."}});
     rellic::LocalDeclRenamer ldr{*session.DecompContext, dic.GetIRToNameMap()};
     rellic::StructFieldRenamer sfr{*session.DecompContext,
                                    dic.GetIRTypeToDITypeMap()};
     ldr.Run();
     sfr.Run();
-
-    llvm::json::Object msg{{"message", "Ok."}};
-    SendJSON(res, msg);
-    res.status = 200;
-  } catch (rellic::Exception& e) {
-    llvm::json::Object msg{{"message", e.what()}};
-    SendJSON(res, msg);
-    res.status = 400;
+    session.Journal =
+        std::make_unique<rellic::UndoJournal>(*session.DecompContext);
+    session.DecompContext->journal = session.Journal.get();
+    {
+      std::unique_lock<std::mutex> lock(session.Stats.Mutex);
+      session.Stats.DecompileElapsed =
+          std::chrono::steady_clock::now() - session.Stats.Start;
+      session.Stats.Functions = session.DecompContext->function_metrics;
+      CopyContextStats(session);
+    }
+    return "Ok.";
+  } catch (rellic::Exception&) {
     session.Unit = nullptr;
+    throw;
   }
 }
 
+// Builds a new AST for the module of the session, in the background
+static void Decompile(const httplib::Request& req, httplib::Response& res) {
+  StartJob("decompile", GetSession(req), res,
+           [](Session& session, Job&, std::string& error) -> JobRun {
+             if (!session.Module) {
+               error = "No module loaded.";
+               return nullptr;
+             }
+             return DecompileModule;
+           });
+}
+
 static void RemovePhi(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex);
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  write_lock mutation_mutex(session->MutationMutex);
 
-  if (!session.Module) {
+  if (!session->Module) {
     llvm::json::Object msg{{"message", "No module loaded."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  rellic::RemovePHINodes(*session.Module);
+  rellic::RemovePHINodes(*session->Module);
+  Invalidate(*session);
 
   llvm::json::Object msg{{"message", "Ok."}};
   SendJSON(res, msg);
@@ -311,18 +986,19 @@ static void RemovePhi(const httplib::Request& req, httplib::Response& res) {
 }
 
 static void LowerSwitches(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex);
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  write_lock mutation_mutex(session->MutationMutex);
 
-  if (!session.Module) {
+  if (!session->Module) {
     llvm::json::Object msg{{"message", "No module loaded."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  rellic::LowerSwitches(*session.Module);
+  rellic::LowerSwitches(*session->Module);
+  Invalidate(*session);
 
   llvm::json::Object msg{{"message", "Ok."}};
   SendJSON(res, msg);
@@ -331,18 +1007,19 @@ static void LowerSwitches(const httplib::Request& req, httplib::Response& res) {
 
 static void RemoveInsertValue(const httplib::Request& req,
                               httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex);
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  write_lock mutation_mutex(session->MutationMutex);
 
-  if (!session.Module) {
+  if (!session->Module) {
     llvm::json::Object msg{{"message", "No module loaded."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  rellic::RemoveInsertValues(*session.Module);
+  rellic::RemoveInsertValues(*session->Module);
+  Invalidate(*session);
 
   llvm::json::Object msg{{"message", "Ok."}};
   SendJSON(res, msg);
@@ -350,41 +1027,203 @@ static void RemoveInsertValue(const httplib::Request& req,
 
 static void RemoveArrayArguments(const httplib::Request& req,
                                  httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex);
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  write_lock mutation_mutex(session->MutationMutex);
 
-  if (!session.Module) {
+  if (!session->Module) {
     llvm::json::Object msg{{"message", "No module loaded."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  rellic::ConvertArrayArguments(*session.Module);
+  rellic::ConvertArrayArguments(*session->Module);
+  Invalidate(*session);
+
+  llvm::json::Object msg{{"message", "Ok."}};
+  SendJSON(res, msg);
+}
+
+// Reads the name of the snapshot in the body of a request, or answers it with
+// an error and returns nothing
+static std::optional<std::string> GetSnapshotName(Session& session,
+                                                  const httplib::Request& req,
+                                                  httplib::Response& res) {
+  if (!session.Journal) {
+    llvm::json::Object msg{{"message", "No AST available."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return std::nullopt;
+  }
+
+  auto json{llvm::json::parse(req.body)};
+  if (!json) {
+    llvm::consumeError(json.takeError());
+  }
+  auto obj{json ? json->getAsObject() : nullptr};
+  auto name{obj ? obj->getString("name") : llvm::None};
+  if (!name || name->empty()) {
+    llvm::json::Object msg{{"message", "Invalid request: expected a name."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return std::nullopt;
+  }
+  return name->str();
+}
+
+// Names the current state of the AST so that it can be restored later
+static void TakeSnapshot(const httplib::Request& req, httplib::Response& res) {
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  write_lock mutation_mutex(session->MutationMutex);
+
+  auto name{GetSnapshotName(*session, req, res)};
+  if (!name) {
+    return;
+  }
+  session->Journal->Take(*name);
+
+  llvm::json::Object msg{{"message", "Ok."}};
+  SendJSON(res, msg);
+}
+
+static void RestoreSnapshot(const httplib::Request& req,
+                            httplib::Response& res) {
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  write_lock mutation_mutex(session->MutationMutex);
+
+  auto name{GetSnapshotName(*session, req, res)};
+  if (!name) {
+    return;
+  }
+  if (!session->Journal->Restore(*name)) {
+    llvm::json::Object msg{{"message", "No such snapshot."}};
+    res.status = 404;
+    SendJSON(res, msg);
+    return;
+  }
+  Invalidate(*session);
 
   llvm::json::Object msg{{"message", "Ok."}};
   SendJSON(res, msg);
 }
 
+static void ListSnapshots(const httplib::Request& req,
+                          httplib::Response& res) {
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  read_lock mutation_mutex(session->MutationMutex);
+
+  llvm::json::Array names;
+  int64_t num_changes{0};
+  if (session->Journal) {
+    for (auto& name : session->Journal->GetSnapshots()) {
+      names.push_back(name);
+    }
+    num_changes = session->Journal->GetNumChanges();
+  }
+  llvm::json::Object msg{{"snapshots", std::move(names)},
+                         {"changes", num_changes}};
+  SendJSON(res, msg);
+}
+
+// Reports to a job whenever the pass it wraps starts running
+class ReportingPass : public rellic::ASTPass {
+  std::unique_ptr<rellic::ASTPass> pass;
+  Session& session;
+  Job& job;
+
+  void Record(unsigned iteration, std::chrono::steady_clock::time_point start,
+              const QueryTotals& queries, size_t ast_bytes) {
+    auto elapsed{std::chrono::steady_clock::now() - start};
+    metrics.ObservePass(pass->GetName(), changed, elapsed);
+
+    auto after{CountQueries(dec_ctx.prover.GetStatistics())};
+    std::unique_lock<std::mutex> lock(session.Stats.Mutex);
+    auto& stats{session.Stats.Passes[pass->GetName()]};
+    ++stats.Runs;
+    stats.Changes += changed;
+    stats.Iterations = std::max<uint64_t>(stats.Iterations, iteration);
+    stats.Elapsed += elapsed;
+    stats.Queries += after.Queries - queries.Queries;
+    stats.Z3 += after.Z3 - queries.Z3;
+    stats.ASTBytes += dec_ctx.ast_ctx.getASTAllocatedMemory() - ast_bytes;
+    auto& runs{session.Stats.Runs};
+    runs.push_back({pass->GetName(), iteration, start - session.Stats.Start,
+                    elapsed, changed});
+    if (runs.size() > StatsRunLimit) {
+      runs.pop_front();
+    }
+    CopyContextStats(session);
+  }
+
+ protected:
+  void StopImpl() override { pass->Stop(); }
+
+  void RunImpl() override {
+    auto iteration{job.Iteration.load()};
+    std::string message{"Running "};
+    message += pass->GetName();
+    if (iteration) {
+      message += " (iteration " + std::to_string(iteration) + ")";
+    }
+    job.Report({{"type", "pass"},
+                {"pass", pass->GetName()},
+                {"iteration", static_cast<int64_t>(iteration)},
+                {"message", message + "."}});
+    auto log{dec_ctx.change_log};
+    auto num_logged{
+        log ? log->GetChanges().size() + log->GetChangedInPlace().size() : 0};
+    auto queries{CountQueries(dec_ctx.prover.GetStatistics())};
+    auto ast_bytes{dec_ctx.ast_ctx.getASTAllocatedMemory()};
+    auto start{std::chrono::steady_clock::now()};
+    changed = pass->Run();
+    if (changed && log &&
+        log->GetChanges().size() + log->GetChangedInPlace().size() ==
+            num_logged) {
+      job.UntrackedChanges = true;
+    }
+    Record(iteration, start, queries, ast_bytes);
+  }
+
+ public:
+  ReportingPass(rellic::DecompilationContext& dec_ctx,
+                std::unique_ptr<rellic::ASTPass> pass, Session& session,
+                Job& job)
+      : ASTPass(dec_ctx), pass(std::move(pass)), session(session), job(job) {}
+  const char* GetName() const override { return pass->GetName(); }
+};
+
 class FixpointPass : public rellic::ASTPass {
   rellic::CompositeASTPass comp;
+  Job& job;
 
  protected:
   void StopImpl() override { comp.Stop(); }
 
-  void RunImpl() override { comp.Fixpoint(); }
+  // Iterates like `comp.Fixpoint()`, numbering the iterations for the job
+  void RunImpl() override {
+    auto outer{job.Iteration.load()};
+    unsigned iteration{0};
+    do {
+      job.Iteration = ++iteration;
+    } while (comp.Run() && !Stopped());
+    job.Iteration = outer;
+  }
 
  public:
-  FixpointPass(rellic::DecompilationContext& dec_ctx)
-      : ASTPass(dec_ctx), comp(dec_ctx) {}
+  FixpointPass(rellic::DecompilationContext& dec_ctx, Job& job)
+      : ASTPass(dec_ctx), comp(dec_ctx), job(job) {}
+  const char* GetName() const override { return "fixpoint"; }
   std::vector<std::unique_ptr<ASTPass>>& GetPasses() {
     return comp.GetPasses();
   }
 };
 
 static std::unique_ptr<rellic::ASTPass> CreatePass(
-    Session& session, const llvm::json::Value& val) {
+    Session& session, Job& job, const llvm::json::Value& val) {
   if (auto obj = val.getAsObject()) {
     auto name{obj->getString("id")};
     if (!name) {
@@ -393,33 +1232,36 @@ static std::unique_ptr<rellic::ASTPass> CreatePass(
     }
     auto str{name->str()};
 
+    std::unique_ptr<rellic::ASTPass> pass;
     if (str == "cbr") {
-      return std::make_unique<rellic::CondBasedRefine>(*session.DecompContext);
+      pass = std::make_unique<rellic::CondBasedRefine>(*session.DecompContext);
     } else if (str == "dse") {
-      return std::make_unique<rellic::DeadStmtElim>(*session.DecompContext);
+      pass = std::make_unique<rellic::DeadStmtElim>(*session.DecompContext);
     } else if (str == "ec") {
-      return std::make_unique<rellic::ExprCombine>(*session.DecompContext);
+      pass = std::make_unique<rellic::ExprCombine>(*session.DecompContext);
     } else if (str == "lr") {
-      return std::make_unique<rellic::LoopRefine>(*session.DecompContext);
+      pass = std::make_unique<rellic::LoopRefine>(*session.DecompContext);
     } else if (str == "mc") {
-      return std::make_unique<rellic::MaterializeConds>(*session.DecompContext);
+      pass = std::make_unique<rellic::MaterializeConds>(*session.DecompContext);
     } else if (str == "ncp") {
-      return std::make_unique<rellic::NestedCondProp>(*session.DecompContext);
+      pass = std::make_unique<rellic::NestedCondProp>(*session.DecompContext);
     } else if (str == "nsc") {
-      return std::make_unique<rellic::NestedScopeCombine>(
-          *session.DecompContext);
+      pass =
+          std::make_unique<rellic::NestedScopeCombine>(*session.DecompContext);
     } else if (str == "rbr") {
-      return std::make_unique<rellic::ReachBasedRefine>(*session.DecompContext);
+      pass = std::make_unique<rellic::ReachBasedRefine>(*session.DecompContext);
     } else if (str == "zcs") {
-      return std::make_unique<rellic::Z3CondSimplify>(*session.DecompContext);
+      pass = std::make_unique<rellic::Z3CondSimplify>(*session.DecompContext);
     } else {
       LOG(ERROR) << "Request contains invalid pass id";
       return nullptr;
     }
+    return std::make_unique<ReportingPass>(*session.DecompContext,
+                                           std::move(pass), session, job);
   } else if (auto arr = val.getAsArray()) {
-    auto fix{std::make_unique<FixpointPass>(*session.DecompContext)};
+    auto fix{std::make_unique<FixpointPass>(*session.DecompContext, job)};
     for (auto& pass : *arr) {
-      auto p{CreatePass(session, pass)};
+      auto p{CreatePass(session, job, pass)};
       if (!p) {
         return nullptr;
       }
@@ -435,181 +1277,202 @@ static std::unique_ptr<rellic::ASTPass> CreatePass(
   }
 }
 
-static void Stop(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-
+// Creates the passes listed in the body of a request to refine the AST of the
+// session, or returns nothing and the reason why in `error`
+static std::shared_ptr<rellic::CompositeASTPass> CreatePasses(
+    Session& session, Job& job, const std::string& body, std::string& error) {
   if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
+    error = "No module loaded.";
+    return nullptr;
   }
 
   if (!session.Unit) {
-    llvm::json::Object msg{{"message", "No AST available."}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
+    error = "No AST available.";
+    return nullptr;
+  }
+
+  auto json{llvm::json::parse(body)};
+  if (!json) {
+    llvm::consumeError(json.takeError());
+    error = "Invalid request: cannot parse.";
+    return nullptr;
+  }
+
+  auto arr{json->getAsArray()};
+  if (!arr) {
+    error = "Invalid request.";
+    return nullptr;
+  }
+
+  auto composite{
+      std::make_shared<rellic::CompositeASTPass>(*session.DecompContext)};
+  for (auto& obj : *arr) {
+    auto pass{CreatePass(session, job, obj)};
+    if (!pass) {
+      error = "Invalid request.";
+      return nullptr;
+    }
+    composite->GetPasses().push_back(std::move(pass));
+  }
+  return composite;
+}
+
+static void Stop(const httplib::Request& req, httplib::Response& res) {
+  auto session{GetSession(req)};
+  std::shared_ptr<Job> job;
+  {
+    std::unique_lock<std::mutex> lock(session->JobMutex);
+    job = session->CurrentJob;
   }
 
-  if (!session.Pass) {
+  if (!job || job->Done()) {
     llvm::json::Object msg{{"message", "Nothing running."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
+  job->Stop();
   llvm::json::Object msg{{"message", "Ok."}};
   SendJSON(res, msg);
-  session.Pass->Stop();
 }
 
-static void Run(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex, std::try_to_lock);
-
-  if (!mutation_mutex.owns_lock()) {
-    llvm::json::Object msg{{"message", "Server busy."}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
+// Top-level declarations of the AST, in the order they are printed. Ranges of
+// them are identified by their indices in this list.
+static std::vector<clang::Decl*> GetTopLevelDecls(clang::ASTUnit& unit) {
+  std::vector<clang::Decl*> decls;
+  for (auto decl : unit.getASTContext().getTranslationUnitDecl()->decls()) {
+    if (!decl->isImplicit()) {
+      decls.push_back(decl);
+    }
   }
+  return decls;
+}
 
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
-  }
+// Logs the changes made to the AST of the session while it is alive
+class ChangeLogScope {
+  rellic::DecompilationContext& dec_ctx;
 
-  if (!session.Unit) {
-    llvm::json::Object msg{{"message", "No AST available."}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
-  }
-
-  auto json{llvm::json::parse(req.body)};
-  if (!json) {
-    llvm::json::Object msg{{"message", "Invalid request: cannot parse."}};
-    SendJSON(res, msg);
-    res.status = 400;
-    return;
-  }
+ public:
+  rellic::ChangeLog Log;
 
-  auto composite{
-      std::make_unique<rellic::CompositeASTPass>(*session.DecompContext)};
-  for (auto& obj : *json->getAsArray()) {
-    auto pass{CreatePass(session, obj)};
-    if (!pass) {
-      llvm::json::Object msg{{"message", "Invalid request."}};
-      SendJSON(res, msg);
-      res.status = 400;
-      return;
-    }
-    composite->GetPasses().push_back(std::move(pass));
+  ChangeLogScope(rellic::DecompilationContext& dec_ctx) : dec_ctx(dec_ctx) {
+    dec_ctx.change_log = &Log;
   }
+  ~ChangeLogScope() { dec_ctx.change_log = nullptr; }
+};
 
-  session.Pass = std::move(composite);
-
-  try {
-    session.Pass->Run();
-
-    if (session.Pass->Stopped()) {
-      llvm::json::Object msg{{"message", "Stopped."}};
-      SendJSON(res, msg);
+// Reports the top-level declarations changed by the passes of a job, as
+// logged in `log`, along with their new renderings, so that clients can
+// replace the elements with the same ids instead of rendering the AST again.
+// The patch is `full` instead if the changes cannot be attributed to
+// definitions, or if rendering them would cost about as much as rendering
+// the AST.
+static void ReportPatch(Session& session, Job& job,
+                        const rellic::ChangeLog& log) {
+  std::unordered_set<clang::Decl*> changed;
+  auto full{job.UntrackedChanges};
+  for (auto& change : log.GetChanges()) {
+    if (change.function) {
+      changed.insert(change.function);
     } else {
-      llvm::json::Object msg{{"message", "Ok."}};
-      SendJSON(res, msg);
+      full = true;
     }
-    res.status = 200;
-    session.Pass = nullptr;
-  } catch (rellic::Exception& e) {
-    llvm::json::Object msg{{"message", e.what()}};
-    SendJSON(res, msg);
-    res.status = 400;
-    session.Pass = nullptr;
   }
-}
-
-static void Fixpoint(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex, std::try_to_lock);
-
-  if (!mutation_mutex.owns_lock()) {
-    llvm::json::Object msg{
-        {"message", "Cannot execute while other operations are in progress"}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
-  }
-
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded"}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
-  }
-
-  if (!session.Unit) {
-    llvm::json::Object msg{{"message", "No AST available"}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
-  }
-
-  auto json{llvm::json::parse(req.body)};
-  if (!json) {
-    llvm::json::Object msg{{"message", "Invalid request: cannot parse."}};
-    SendJSON(res, msg);
-    res.status = 400;
-    return;
-  }
-
-  auto composite{
-      std::make_unique<rellic::CompositeASTPass>(*session.DecompContext)};
-  for (auto& obj : *json->getAsArray()) {
-    auto pass{CreatePass(session, obj)};
-    if (!pass) {
-      llvm::json::Object msg{{"message", "Invalid request"}};
-      SendJSON(res, msg);
-      res.status = 400;
-      return;
+  changed.insert(log.GetChangedInPlace().begin(),
+                 log.GetChangedInPlace().end());
+
+  llvm::json::Array decls;
+  if (!full && !changed.empty()) {
+    auto& ast_ctx{session.Unit->getASTContext()};
+    // The version of the session is about to change, so the types are not
+    // rendered into its cache
+    TypeCache types;
+    TypeCacheScope scope(types, 0);
+    size_t size{0};
+    for (auto decl : GetTopLevelDecls(*session.Unit)) {
+      if (!changed.count(decl)) {
+        continue;
+      }
+      std::string html;
+      llvm::raw_string_ostream os(html);
+      PrintDecl(decl, ast_ctx.getPrintingPolicy(), 0, os);
+      os.flush();
+      size += html.size();
+      if (size > ViewCacheLimit) {
+        full = true;
+        decls.clear();
+        break;
+      }
+      decls.push_back(llvm::json::Object{
+          {"id", llvm::utohexstr((uint64_t)decl, /*LowerCase=*/true)},
+          {"html", std::move(html)}});
     }
-    composite->GetPasses().push_back(std::move(pass));
   }
+  job.Report({{"type", "patch"}, {"full", full}, {"decls", std::move(decls)}});
+}
 
-  session.Pass = std::move(composite);
+// Runs the passes in the request once, in the background
+static void Run(const httplib::Request& req, httplib::Response& res) {
+  auto body{req.body};
+  StartJob("run", GetSession(req), res,
+           [body](Session& session, Job& job, std::string& error) -> JobRun {
+             auto composite{CreatePasses(session, job, body, error)};
+             if (!composite) {
+               return nullptr;
+             }
+             return [composite](Session& session,
+                                Job& running) -> std::string {
+               running.SetPass(composite.get());
+               ChangeLogScope changes(*session.DecompContext);
+               if (!running.StopRequested()) {
+                 composite->Run();
+               }
+               ReportPatch(session, running, changes.Log);
+               return running.StopRequested() ? "Stopped." : "Ok.";
+             };
+           });
+}
 
-  try {
-    auto t1{std::chrono::system_clock::now()};
-    auto num_iterations{session.Pass->Fixpoint()};
-    auto t2{std::chrono::system_clock::now()};
-    auto elapsed{
-        std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count()};
-
-    if (session.Pass->Stopped()) {
-      llvm::json::Object msg{{"message", "Stopped."}};
-      SendJSON(res, msg);
-    } else {
-      std::string s;
-      llvm::raw_string_ostream os(s);
-      os << "Fixpoint found after " << num_iterations << " iterations ("
-         << elapsed << " ms).";
-      llvm::json::Object msg{{"message", s}};
-      SendJSON(res, msg);
-    }
-    res.status = 200;
-    session.Pass = nullptr;
-  } catch (rellic::Exception& e) {
-    llvm::json::Object msg{{"message", e.what()}};
-    SendJSON(res, msg);
-    res.status = 400;
-    session.Pass = nullptr;
-  }
+// Runs the passes in the request until they no longer change the AST, in the
+// background
+static void Fixpoint(const httplib::Request& req, httplib::Response& res) {
+  auto body{req.body};
+  StartJob(
+      "fixpoint", GetSession(req), res,
+      [body](Session& session, Job& job, std::string& error) -> JobRun {
+        auto composite{CreatePasses(session, job, body, error)};
+        if (!composite) {
+          return nullptr;
+        }
+        return [composite](Session& session, Job& running) -> std::string {
+          running.SetPass(composite.get());
+          ChangeLogScope changes(*session.DecompContext);
+          auto t1{std::chrono::system_clock::now()};
+          unsigned num_iterations{0};
+          while (!running.StopRequested()) {
+            running.Iteration = num_iterations + 1;
+            if (!composite->Run() || running.StopRequested()) {
+              break;
+            }
+            ++num_iterations;
+          }
+          ReportPatch(session, running, changes.Log);
+          auto t2{std::chrono::system_clock::now()};
+          auto elapsed{
+              std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1)
+                  .count()};
+
+          if (running.StopRequested()) {
+            return "Stopped.";
+          }
+          std::string s;
+          llvm::raw_string_ostream os(s);
+          os << "Fixpoint found after " << num_iterations << " iterations ("
+             << elapsed << " ms).";
+          return os.str();
+        };
+      });
 }
 
 class AAW : public llvm::AssemblyAnnotationWriter {
@@ -645,112 +1508,437 @@ class AAW : public llvm::AssemblyAnnotationWriter {
 };
 
 static void PrintModule(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  read_lock mutation_mutex(session.MutationMutex);
-  if (!session.Module) {
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  read_lock mutation_mutex(session->MutationMutex);
+  if (!session->Module) {
     llvm::json::Object msg{{"message", "No module loaded."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  std::string s;
-  llvm::raw_string_ostream os(s);
-  AAW aaw(session);
-  os << "<pre><span>";
-  session.Module->print(os, &aaw);
-  os << "</span></pre>";
-  res.status = 200;
-  res.set_content(s, "text/html");
+  SendView(req, res, session, &Session::ModuleView, "text/html",
+           [session](llvm::raw_ostream& os) {
+             AAW aaw(*session);
+             os << "<pre><span>";
+             session->Module->print(os, &aaw);
+             os << "</span></pre>";
+           });
 }
 
-template <typename TKey, typename TValue>
-static void CopyMap(const std::unordered_map<TKey*, TValue*>& from,
-                    std::unordered_map<const TKey*, const TValue*>& to,
-                    std::unordered_map<const TValue*, const TKey*>& inverse) {
-  for (auto [key, value] : from) {
-    if (value) {
-      to[key] = value;
-      inverse[value] = key;
+// Collects the declarations and statements that are part of the declarations
+// it traverses
+class DeclSlice : public clang::RecursiveASTVisitor<DeclSlice> {
+ public:
+  std::unordered_set<clang::Decl*> Decls;
+  std::unordered_set<clang::Stmt*> Stmts;
+
+  bool VisitDecl(clang::Decl* decl) {
+    Decls.insert(decl);
+    return true;
+  }
+
+  bool VisitStmt(clang::Stmt* stmt) {
+    Stmts.insert(stmt);
+    return true;
+  }
+};
+
+// Whether a request asks for a range of top-level declarations only
+static bool IsSliced(const httplib::Request& req) {
+  return req.has_param("begin") || req.has_param("end");
+}
+
+// Reads the range of top-level declarations that a request asks for from its
+// `begin` and `end` parameters, which default to the whole list. Returns false
+// if they are malformed.
+static bool GetDeclRange(const httplib::Request& req, size_t num_decls,
+                         size_t& begin, size_t& end) {
+  begin = 0;
+  end = num_decls;
+  for (auto [param, value] : {std::make_pair("begin", &begin),
+                              std::make_pair("end", &end)}) {
+    if (!req.has_param(param)) {
+      continue;
     }
+    unsigned long long index;
+    if (llvm::StringRef(req.get_param_value(param)).getAsInteger(10, index)) {
+      return false;
+    }
+    *value = std::min<size_t>(index, num_decls);
   }
+  return begin <= end;
 }
 
+// Renders the whole AST, or the range of top-level declarations from `begin`
+// to `end` if the request has either parameter
 static void PrintAST(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  read_lock mutation_mutex(session.MutationMutex);
-  if (!session.Module) {
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  read_lock mutation_mutex(session->MutationMutex);
+  if (!session->Module) {
     llvm::json::Object msg{{"message", "No module loaded."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  if (!session.Unit) {
+  if (!session->Unit) {
     llvm::json::Object msg{{"message", "No AST available."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  rellic::DecompilationResult::StmtToIRMap stmt_provenance_map;
-  rellic::DecompilationResult::IRToStmtMap value_to_stmt_map;
-  rellic::DecompilationResult::IRToDeclMap value_to_decl_map;
-  rellic::DecompilationResult::DeclToIRMap decl_provenance_map;
-  rellic::DecompilationResult::IRToTypeDeclMap type_to_decl_map;
-  rellic::DecompilationResult::TypeDeclToIRMap type_provenance_map;
+  if (!IsSliced(req)) {
+    SendView(req, res, session, &Session::ASTView, "text/html",
+             [session](llvm::raw_ostream& os) {
+               auto& ast_ctx{session->Unit->getASTContext()};
+               os << "<pre>";
+               PrintDecl(ast_ctx.getTranslationUnitDecl(),
+                         ast_ctx.getPrintingPolicy(), 0, os);
+               os << "</pre>";
+             });
+    return;
+  }
 
-  CopyMap(session.DecompContext->stmt_provenance, stmt_provenance_map,
-          value_to_stmt_map);
-  CopyMap(session.DecompContext->value_decls, value_to_decl_map,
-          decl_provenance_map);
-  CopyMap(session.DecompContext->type_decls, type_to_decl_map,
-          type_provenance_map);
+  auto decls{GetTopLevelDecls(*session->Unit)};
+  size_t begin, end;
+  if (!GetDeclRange(req, decls.size(), begin, end)) {
+    llvm::json::Object msg{{"message", "Invalid range."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
 
-  std::string s;
-  llvm::raw_string_ostream os(s);
-  os << "<pre>";
-  PrintDecl(session.Unit->getASTContext().getTranslationUnitDecl(),
-            session.Unit->getASTContext().getPrintingPolicy(), 0, os);
-  os << "</pre>";
-  res.status = 200;
-  res.set_content(s, "text/html");
+  auto visible{std::make_shared<std::unordered_set<clang::Decl*>>(
+      decls.begin() + begin, decls.begin() + end)};
+  SendView(req, res, session, nullptr, "text/html",
+           [session, visible](llvm::raw_ostream& os) {
+             auto& ast_ctx{session->Unit->getASTContext()};
+             os << "<pre>";
+             PrintTopLevelDecls(
+                 ast_ctx.getTranslationUnitDecl(),
+                 [&](clang::Decl* decl) { return visible->count(decl) != 0; },
+                 ast_ctx.getPrintingPolicy(), os);
+             os << "</pre>";
+           });
+}
+
+// Renders the AST as plain C with the decompiler's printer. With the
+// `provenance` parameter, statements are annotated with the IR they were
+// generated from.
+static void PrintSource(const httplib::Request& req, httplib::Response& res) {
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  read_lock mutation_mutex(session->MutationMutex);
+  if (!session->Module) {
+    llvm::json::Object msg{{"message", "No module loaded."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  if (!session->Unit) {
+    llvm::json::Object msg{{"message", "No AST available."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  auto provenance{req.has_param("provenance") && session->DecompContext};
+  SendView(req, res, session, nullptr, "text/plain",
+           [session, provenance](llvm::raw_ostream& os) {
+             rellic::CPrinterOptions options;
+             if (provenance) {
+               auto& dec_ctx{*session->DecompContext};
+               options.line_directives = true;
+               options.provenance_comments = true;
+               options.stmt_provenance =
+                   [&dec_ctx](const clang::Stmt* stmt) -> const llvm::Value* {
+                 return dec_ctx.stmt_provenance.lookup(
+                     const_cast<clang::Stmt*>(stmt));
+               };
+             }
+             rellic::CPrinter printer(os, session->Unit->getASTContext(),
+                                      std::move(options));
+             printer.PrintTranslationUnit();
+           });
 }
 
-static llvm::json::Array EnumerateEntries(
-    const llvm::sys::fs::directory_entry& entry) {
-  std::error_code ec;
-  llvm::json::Array result;
-  for (llvm::sys::fs::directory_iterator it(entry.path(), ec, false), end;
-       it != end; it.increment(ec)) {
-    auto& entry_path{it->path()};
-    auto entry_name{entry_path.substr(entry_path.find_last_of('/') + 1)};
-    llvm::json::Object obj;
-    obj["name"] = entry_name;
-    if (it->type() == llvm::sys::fs::file_type::regular_file) {
-      obj["path"] = entry_path;
-      result.push_back(std::move(obj));
-    } else if (it->type() == llvm::sys::fs::file_type::directory_file) {
-      obj["entries"] = EnumerateEntries(*it);
-      result.push_back(std::move(obj));
+static void RenderDeclList(Session& session, llvm::raw_ostream& os) {
+  llvm::json::OStream json(os);
+  auto decls{GetTopLevelDecls(*session.Unit)};
+  json.array([&]() {
+    for (size_t i{0}; i < decls.size(); ++i) {
+      DeclSlice slice;
+      slice.TraverseDecl(decls[i]);
+      json.object([&]() {
+        json.attribute("index", static_cast<int64_t>(i));
+        json.attribute("id", (unsigned long long)decls[i]);
+        json.attribute("kind", decls[i]->getDeclKindName());
+        json.attribute("size", static_cast<int64_t>(slice.Stmts.size()));
+        if (auto named = clang::dyn_cast<clang::NamedDecl>(decls[i])) {
+          json.attribute("name", named->getNameAsString());
+        }
+        if (auto func = clang::dyn_cast<clang::FunctionDecl>(decls[i])) {
+          json.attribute("definition", func->doesThisDeclarationHaveABody());
+        }
+      });
     }
+  });
+}
+
+// Lists the top-level declarations of the AST with their sizes, in number of
+// statements, so that clients can render them a few at a time
+static void ListDecls(const httplib::Request& req, httplib::Response& res) {
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  read_lock mutation_mutex(session->MutationMutex);
+  if (!session->Module) {
+    llvm::json::Object msg{{"message", "No module loaded."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  if (!session->Unit) {
+    llvm::json::Object msg{{"message", "No AST available."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
   }
 
-  return result;
+  SendView(req, res, session, &Session::DeclListView, "application/json",
+           [session](llvm::raw_ostream& os) { RenderDeclList(*session, os); });
 }
 
+static double ToSeconds(std::chrono::nanoseconds elapsed) {
+  return std::chrono::duration<double>(elapsed).count();
+}
+
+static llvm::json::Object FunctionToJSON(const rellic::FunctionMetrics& func) {
+  return llvm::json::Object{
+      {"name", func.name},
+      {"seconds", ToSeconds(func.elapsed)},
+      {"memory", static_cast<int64_t>(func.memory)},
+      {"timed_out", func.timed_out},
+      {"blocks", static_cast<int64_t>(func.size.blocks)},
+      {"edges", static_cast<int64_t>(func.size.edges)},
+      {"loop_depth", static_cast<int64_t>(func.size.loop_depth)},
+      {"switch_cases", static_cast<int64_t>(func.size.switch_cases)},
+      {"cond_terms", static_cast<int64_t>(func.size.cond_terms)}};
+}
+
+static llvm::json::Object QueriesToJSON(const rellic::QueryStatistics& stats) {
+  return llvm::json::Object{
+      {"queries", static_cast<int64_t>(stats.num_queries)},
+      {"z3", static_cast<int64_t>(stats.num_z3)},
+      {"seconds", ToSeconds(stats.elapsed)}};
+}
+
+// Sends what the AST of the session has cost so far: the time GenerateAST took
+// and the `limit` functions it took longest on, the runs of each pass, the
+// operations on conditions and the memory of the AST. It is read while jobs
+// run, so it does not wait for the locks of the session.
+static void PrintStats(const httplib::Request& req, httplib::Response& res) {
+  size_t limit{StatsFunctionCount};
+  if (req.has_param("limit")) {
+    unsigned long long n;
+    if (llvm::StringRef(req.get_param_value("limit")).getAsInteger(10, n)) {
+      llvm::json::Object msg{{"message", "Invalid request."}};
+      res.status = 400;
+      SendJSON(res, msg);
+      return;
+    }
+    limit = std::min<size_t>(n, MaxStatsFunctionCount);
+  }
+
+  auto session{GetSession(req)};
+  bool running;
+  {
+    std::unique_lock<std::mutex> lock(session->JobMutex);
+    running = session->CurrentJob && !session->CurrentJob->Done();
+  }
+  auto& stats{session->Stats};
+  std::unique_lock<std::mutex> lock(stats.Mutex);
+
+  std::vector<const rellic::FunctionMetrics*> slowest;
+  std::chrono::nanoseconds functions_elapsed{0};
+  for (auto& func : stats.Functions) {
+    slowest.push_back(&func);
+    functions_elapsed += func.elapsed;
+  }
+  auto num_slowest{std::min(limit, slowest.size())};
+  std::partial_sort(slowest.begin(), slowest.begin() + num_slowest,
+                    slowest.end(), [](auto a, auto b) {
+                      return a->elapsed > b->elapsed ||
+                             (a->elapsed == b->elapsed && a->name < b->name);
+                    });
+  llvm::json::Array functions;
+  for (size_t i{0}; i < num_slowest; ++i) {
+    functions.push_back(FunctionToJSON(*slowest[i]));
+  }
+
+  llvm::json::Array passes;
+  for (auto& [name, pass] : stats.Passes) {
+    passes.push_back(llvm::json::Object{
+        {"name", name},
+        {"runs", static_cast<int64_t>(pass.Runs)},
+        {"changes", static_cast<int64_t>(pass.Changes)},
+        {"iterations", static_cast<int64_t>(pass.Iterations)},
+        {"seconds", ToSeconds(pass.Elapsed)},
+        {"queries", static_cast<int64_t>(pass.Queries)},
+        {"z3", static_cast<int64_t>(pass.Z3)},
+        {"ast_bytes", static_cast<int64_t>(pass.ASTBytes)}});
+  }
+
+  llvm::json::Array runs;
+  for (auto& run : stats.Runs) {
+    runs.push_back(
+        llvm::json::Object{{"pass", run.Pass},
+                           {"iteration", static_cast<int64_t>(run.Iteration)},
+                           {"start", ToSeconds(run.Start)},
+                           {"seconds", ToSeconds(run.Elapsed)},
+                           {"changed", run.Changed}});
+  }
+
+  std::vector<rellic::QueryStatistics> kinds(
+      static_cast<size_t>(rellic::QueryKind::Count));
+  std::vector<std::pair<std::string, rellic::QueryStatistics>> sites;
+  for (auto& [name, site] : stats.Prover.sites) {
+    rellic::QueryStatistics total;
+    for (size_t i{0}; i < kinds.size(); ++i) {
+      kinds[i].Add(site.queries[i]);
+      total.Add(site.queries[i]);
+    }
+    sites.emplace_back(name, total);
+  }
+  std::sort(sites.begin(), sites.end(), [](const auto& a, const auto& b) {
+    return a.second.elapsed > b.second.elapsed ||
+           (a.second.elapsed == b.second.elapsed && a.first < b.first);
+  });
+  llvm::json::Object by_kind;
+  for (size_t i{0}; i < kinds.size(); ++i) {
+    by_kind[rellic::GetQueryKindName(static_cast<rellic::QueryKind>(i))] =
+        QueriesToJSON(kinds[i]);
+  }
+  llvm::json::Array by_site;
+  for (size_t i{0}; i < std::min(limit, sites.size()); ++i) {
+    auto site{QueriesToJSON(sites[i].second)};
+    site["site"] = sites[i].first;
+    by_site.push_back(std::move(site));
+  }
+  auto& prover{stats.Prover};
+  llvm::json::Object queries{
+      {"proofs", static_cast<int64_t>(prover.num_proofs)},
+      {"simplifications", static_cast<int64_t>(prover.num_simplifications)},
+      {"cached", static_cast<int64_t>(prover.num_cached)},
+      {"syntactic", static_cast<int64_t>(prover.num_syntactic)},
+      {"truth_tables", static_cast<int64_t>(prover.num_truth_tables)},
+      {"limit_hits", static_cast<int64_t>(prover.num_limit_hits)},
+      {"interrupted", static_cast<int64_t>(prover.num_interrupted)},
+      {"kinds", std::move(by_kind)},
+      {"sites", std::move(by_site)}};
+
+  llvm::json::Object msg{
+      {"running", running},
+      {"decompile_seconds", ToSeconds(stats.DecompileElapsed)},
+      {"num_functions", static_cast<int64_t>(stats.Functions.size())},
+      {"functions_seconds", ToSeconds(functions_elapsed)},
+      {"functions", std::move(functions)},
+      {"passes", std::move(passes)},
+      {"runs", std::move(runs)},
+      {"queries", std::move(queries)},
+      {"ast_bytes", static_cast<int64_t>(stats.ASTBytes)},
+      {"z3_exprs", static_cast<int64_t>(stats.Z3Exprs)},
+      {"session_bytes", static_cast<int64_t>(session->MemoryUsage.load())}};
+  lock.unlock();
+  SendJSON(res, msg);
+  res.status = 200;
+}
+
+// Sends the metrics of the function named by the `name` parameter, along with
+// the slowest queries GenerateAST made for it, see `--slowest_queries`
+static void PrintFunctionStats(const httplib::Request& req,
+                               httplib::Response& res) {
+  auto session{GetSession(req)};
+  auto name{req.get_param_value("name")};
+  auto& stats{session->Stats};
+  std::unique_lock<std::mutex> lock(stats.Mutex);
+  auto func{std::find_if(stats.Functions.begin(), stats.Functions.end(),
+                         [&](const rellic::FunctionMetrics& candidate) {
+                           return candidate.name == name;
+                         })};
+  if (func == stats.Functions.end()) {
+    lock.unlock();
+    llvm::json::Object msg{{"message", "No such function."}};
+    res.status = 404;
+    SendJSON(res, msg);
+    return;
+  }
+
+  auto msg{FunctionToJSON(*func)};
+  llvm::json::Array queries;
+  for (auto& query : func->slowest_queries) {
+    queries.push_back(llvm::json::Object{
+        {"site", query.site},
+        {"kind", query.kind},
+        {"result", query.result},
+        {"seconds", ToSeconds(query.elapsed)},
+        {"smt2", query.smt2}});
+  }
+  msg["queries"] = std::move(queries);
+  lock.unlock();
+  SendJSON(res, msg);
+  res.status = 200;
+}
+
+static std::unique_ptr<Catalog> angha;
+
+// Lists the AnghaBench files whose path starts with the `prefix` parameter and
+// contains the `query` parameter. Up to `limit` of them are listed, after the
+// first `offset`.
 static void ListAngha(const httplib::Request& req, httplib::Response& res) {
+  size_t offset{0}, limit{AnghaPageSize};
+  for (auto [param, value] : {std::make_pair("offset", &offset),
+                              std::make_pair("limit", &limit)}) {
+    unsigned long long n;
+    if (req.has_param(param)) {
+      if (llvm::StringRef(req.get_param_value(param)).getAsInteger(10, n)) {
+        llvm::json::Object msg{{"message", "Invalid request."}};
+        res.status = 400;
+        SendJSON(res, msg);
+        return;
+      }
+      *value = n;
+    }
+  }
+
+  auto page{angha->Find(req.get_param_value("prefix"),
+                        req.get_param_value("query"), offset,
+                        std::min(limit, MaxAnghaPageSize))};
+  llvm::json::Array entries;
+  for (auto& entry : page.Entries) {
+    llvm::json::Object obj{{"path", entry.Path},
+                           {"size", static_cast<int64_t>(entry.Size)}};
+    if (entry.Functions) {
+      obj["functions"] = static_cast<int64_t>(*entry.Functions);
+    }
+    entries.push_back(std::move(obj));
+  }
+
+  llvm::json::Object msg{{"total", static_cast<int64_t>(page.Total)},
+                         {"complete", angha->Scanned()},
+                         {"entries", std::move(entries)}};
+  SendJSON(res, msg);
   res.status = 200;
-  auto entries{
-      EnumerateEntries(llvm::sys::fs::directory_entry(FLAGS_angha, false))};
-  SendJSON(res, entries);
 }
 
 static void LoadAngha(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  write_lock lock(session.LoadMutex, std::try_to_lock);
+  auto session{GetSession(req)};
+  write_lock lock(session->LoadMutex, std::try_to_lock);
   if (!lock.owns_lock()) {
     llvm::json::Object msg{
         {"message",
@@ -761,75 +1949,324 @@ static void LoadAngha(const httplib::Request& req, httplib::Response& res) {
   }
 
   auto json{llvm::json::parse(req.body)};
-  auto mod{rellic::LoadModuleFromFile(session.Context.get(),
-                                      json->getAsString()->str(), true)};
+  auto name{json ? json->getAsString() : llvm::None};
+  if (!json) {
+    llvm::consumeError(json.takeError());
+  }
+  auto path{name ? angha->Resolve(name->str()) : std::nullopt};
+  if (!path) {
+    llvm::json::Object msg{{"message", "No such file."}};
+    res.status = 404;
+    SendJSON(res, msg);
+    return;
+  }
+
+  auto mod{rellic::LoadModuleFromFile(session->Context.get(), *path, true)};
   if (!mod) {
     llvm::json::Object msg{{"message", "Couldn't load LLVM module."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
-  session.Module = std::unique_ptr<llvm::Module>(mod);
+  session->Module = std::unique_ptr<llvm::Module>(mod);
+  Invalidate(*session);
+  uint64_t size{0};
+  llvm::sys::fs::file_size(*path, size);
+  session->ModuleSize = size;
   llvm::json::Object msg{{"message", "Ok."}};
   SendJSON(res, msg);
   res.status = 200;
 }
 
+// Writes the pairs of `map` for which `keep` holds as an attribute of `json`
+template <typename TMap, typename TKeep>
+static void WritePairs(llvm::json::OStream& json, const char* name,
+                       const TMap& map, TKeep keep) {
+  json.attributeArray(name, [&]() {
+    for (auto elem : map) {
+      if (keep(elem.first, elem.second)) {
+        json.array([&]() {
+          json.value((unsigned long long)elem.first);
+          json.value((unsigned long long)elem.second);
+        });
+      }
+    }
+  });
+}
+
+// Renders the provenance of the whole AST, or only of the nodes in `slice`
+static void RenderProvenance(Session& session, const DeclSlice* slice,
+                             llvm::raw_ostream& os) {
+  auto& dec_ctx{*session.DecompContext};
+  auto has_stmt{[slice](clang::Stmt* stmt, auto) {
+    return !slice || slice->Stmts.count(stmt);
+  }};
+  auto has_decl{[slice](auto, clang::Decl* decl) {
+    return !slice || slice->Decls.count(decl);
+  }};
+
+  llvm::json::OStream json(os);
+  json.object([&]() {
+    WritePairs(json, "stmt_provenance", dec_ctx.stmt_provenance, has_stmt);
+    WritePairs(json, "type_decls", dec_ctx.type_decls, has_decl);
+    WritePairs(json, "value_decls", dec_ctx.value_decls, has_decl);
+    WritePairs(json, "temp_decls", dec_ctx.temp_decls, has_decl);
+    json.attributeArray("use_provenance", [&]() {
+      for (auto elem : dec_ctx.use_provenance) {
+        if (elem.second && has_stmt(elem.first, elem.second)) {
+          json.array([&]() {
+            json.value((unsigned long long)elem.first);
+            json.value((unsigned long long)elem.second->get());
+          });
+        }
+      }
+    });
+  });
+}
+
 static void PrintProvenance(const httplib::Request& req,
                             httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  read_lock mutation_mutex(session.MutationMutex);
-  if (!session.Module) {
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  read_lock mutation_mutex(session->MutationMutex);
+  if (!session->Module) {
     llvm::json::Object msg{{"message", "No module loaded."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  llvm::json::Array stmt_provenance;
-  for (auto elem : session.DecompContext->stmt_provenance) {
-    stmt_provenance.push_back(llvm::json::Array(
-        {(unsigned long long)elem.first, (unsigned long long)elem.second}));
+  if (!IsSliced(req)) {
+    SendView(req, res, session, &Session::ProvenanceView, "application/json",
+             [session](llvm::raw_ostream& os) {
+               RenderProvenance(*session, nullptr, os);
+             });
+    return;
   }
 
-  llvm::json::Array type_decls;
-  for (auto elem : session.DecompContext->type_decls) {
-    type_decls.push_back(llvm::json::Array(
-        {(unsigned long long)elem.first, (unsigned long long)elem.second}));
+  if (!session->Unit) {
+    llvm::json::Object msg{{"message", "No AST available."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
   }
 
-  llvm::json::Array value_decls;
-  for (auto elem : session.DecompContext->value_decls) {
-    value_decls.push_back(llvm::json::Array(
-        {(unsigned long long)elem.first, (unsigned long long)elem.second}));
+  auto decls{GetTopLevelDecls(*session->Unit)};
+  size_t begin, end;
+  if (!GetDeclRange(req, decls.size(), begin, end)) {
+    llvm::json::Object msg{{"message", "Invalid range."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
   }
 
-  llvm::json::Array temp_decls;
-  for (auto elem : session.DecompContext->temp_decls) {
-    temp_decls.push_back(llvm::json::Array(
-        {(unsigned long long)elem.first, (unsigned long long)elem.second}));
+  SendView(req, res, session, nullptr, "application/json",
+           [session, decls, begin, end](llvm::raw_ostream& os) {
+             DeclSlice slice;
+             for (auto i{begin}; i < end; ++i) {
+               slice.TraverseDecl(decls[i]);
+             }
+             RenderProvenance(*session, &slice, os);
+           });
+}
+
+// Gets the provenance index of the current version of the session, which must
+// have a decompilation context and be read-locked
+static std::shared_ptr<const ProvenanceIndex> GetProvenanceIndex(
+    Session& session) {
+  auto version{session.Version.load()};
+  {
+    std::unique_lock<std::mutex> lock(session.ViewMutex);
+    if (session.Provenance && session.Provenance->Version == version) {
+      return session.Provenance;
+    }
   }
 
-  llvm::json::Array use_provenance;
-  for (auto elem : session.DecompContext->use_provenance) {
-    if (!elem.second) {
-      continue;
+  // Concurrent queries may build the same index, but only the first one is
+  // kept
+  auto index{std::make_shared<ProvenanceIndex>()};
+  index->Version = version;
+  auto& pairs{index->Pairs};
+  auto add{[&pairs](const void* a, const void* b) {
+    if (a && b) {
+      pairs.emplace_back((uint64_t)a, (uint64_t)b);
+      pairs.emplace_back((uint64_t)b, (uint64_t)a);
     }
-    use_provenance.push_back(
-        llvm::json::Array({(unsigned long long)elem.first,
-                           (unsigned long long)elem.second->get()}));
+  }};
+  auto& dec_ctx{*session.DecompContext};
+  for (auto elem : dec_ctx.stmt_provenance) {
+    add(elem.first, elem.second);
+  }
+  for (auto elem : dec_ctx.type_decls) {
+    add(elem.first, elem.second);
+  }
+  for (auto elem : dec_ctx.value_decls) {
+    add(elem.first, elem.second);
+  }
+  for (auto elem : dec_ctx.temp_decls) {
+    add(elem.first, elem.second);
   }
+  for (auto elem : dec_ctx.use_provenance) {
+    if (elem.second) {
+      add(elem.first, elem.second->get());
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+  pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+  pairs.shrink_to_fit();
 
-  llvm::json::Object msg{{"stmt_provenance", std::move(stmt_provenance)},
-                         {"type_decls", std::move(type_decls)},
-                         {"value_decls", std::move(value_decls)},
-                         {"temp_decls", std::move(temp_decls)},
-                         {"use_provenance", std::move(use_provenance)}};
-  SendJSON(res, msg);
+  std::unique_lock<std::mutex> lock(session.ViewMutex);
+  if (!session.Provenance || session.Provenance->Version != version) {
+    session.Provenance = index;
+  }
+  return session.Provenance;
+}
+
+// Lists the ids of the elements related to the element whose id is the `id`
+// parameter, in hexadecimal, for highlighting what the element the user points
+// at was generated from or into
+static void PrintRelated(const httplib::Request& req, httplib::Response& res) {
+  auto session{GetSession(req)};
+  read_lock load_mutex(session->LoadMutex);
+  read_lock mutation_mutex(session->MutationMutex);
+  if (!session->DecompContext) {
+    llvm::json::Object msg{{"message", "No AST available."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  unsigned long long id;
+  if (llvm::StringRef(req.get_param_value("id")).getAsInteger(16, id)) {
+    llvm::json::Object msg{{"message", "Invalid id."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  auto index{GetProvenanceIndex(*session)};
+  auto begin{std::lower_bound(index->Pairs.begin(), index->Pairs.end(),
+                              std::make_pair((uint64_t)id, uint64_t{0}))};
+  llvm::json::Array related;
+  for (auto it{begin}; it != index->Pairs.end() && it->first == id; ++it) {
+    related.push_back(llvm::utohexstr(it->second, /*LowerCase=*/true));
+  }
+  SendJSON(res, related);
   res.status = 200;
 }
 
+// Loads an AnghaBench file like `LoadAngha` when the sessions are held by
+// workers, which do not index the corpus, by uploading it to the worker of the
+// session
+static void ForwardLoadAngha(const httplib::Request& req,
+                             httplib::Response& res) {
+  auto json{llvm::json::parse(req.body)};
+  auto name{json ? json->getAsString() : llvm::None};
+  if (!json) {
+    llvm::consumeError(json.takeError());
+  }
+  auto path{name ? angha->Resolve(name->str()) : std::nullopt};
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  if (path) {
+    if (auto file = llvm::MemoryBuffer::getFile(*path)) {
+      buffer = std::move(*file);
+    }
+  }
+  if (!buffer) {
+    llvm::json::Object msg{{"message", "No such file."}};
+    res.status = 404;
+    SendJSON(res, msg);
+    return;
+  }
+  workers->Forward(req, res, request_session, "/action/module",
+                   buffer->getBuffer().str(), "application/octet-stream");
+}
+
+// Resident set size of the server, or 0 where /proc is not available
+static size_t GetResidentMemory() {
+  std::ifstream statm("/proc/self/statm");
+  size_t size, resident;
+  if (!(statm >> size >> resident)) {
+    return 0;
+  }
+  return resident * llvm::sys::Process::getPageSizeEstimate();
+}
+
+static void WriteGauge(llvm::raw_ostream& os, const char* name,
+                       const char* help, size_t value) {
+  os << "# HELP " << name << ' ' << help << '\n'
+     << "# TYPE " << name << " gauge\n"
+     << name << ' ' << value << '\n';
+}
+
+// Exports the metrics of the server in the Prometheus text format
+static void PrintMetrics(const httplib::Request& req, httplib::Response& res) {
+  std::string s;
+  llvm::raw_string_ostream os(s);
+  WriteGauge(os, "rellic_xref_sessions", "Sessions kept in memory.",
+             sessions.Size());
+  WriteGauge(os, "rellic_xref_session_memory_bytes",
+             "Estimated memory used by all sessions.", sessions.MemoryUsage());
+  WriteGauge(os, "rellic_xref_jobs_running",
+             "Background jobs that are running.", running_jobs);
+  WriteGauge(os, "rellic_xref_resident_memory_bytes",
+             "Resident set size of the server.", GetResidentMemory());
+  metrics.Write(os);
+  res.status = 200;
+  res.set_content(os.str(), "text/plain; version=0.0.4");
+}
+
+// Exports the metrics of the server like `PrintMetrics` when the sessions are
+// held by workers, which export theirs on their own ports
+static void PrintRouterMetrics(const httplib::Request& req,
+                               httplib::Response& res) {
+  std::string s;
+  llvm::raw_string_ostream os(s);
+  WriteGauge(os, "rellic_xref_resident_memory_bytes",
+             "Resident set size of the server.", GetResidentMemory());
+  workers->WriteMetrics(os);
+  metrics.Write(os);
+  res.status = 200;
+  res.set_content(os.str(), "text/plain; version=0.0.4");
+}
+
+// Serves the assets and every action of the sessions in this process. Workers
+// do not serve the assets nor the AnghaBench corpus, which the server that
+// started them does.
+static void RegisterActions(bool is_worker) {
+  if (!is_worker) {
+    svr.set_mount_point("/", FLAGS_home);
+  }
+  svr.set_pre_routing_handler(PreRoutingHandler);
+  svr.Post("/action/module", LoadModule);
+  svr.Post("/action/decompile", Decompile);
+  svr.Post("/action/remove-phi-nodes", RemovePhi);
+  svr.Post("/action/lower-switches", LowerSwitches);
+  svr.Post("/action/remove-array-arguments", RemoveArrayArguments);
+  svr.Post("/action/remove-insertvalue", RemoveInsertValue);
+  svr.Post("/action/run", Run);
+  svr.Post("/action/fixpoint", Fixpoint);
+  svr.Post("/action/stop", Stop);
+  svr.Post("/action/snapshot", TakeSnapshot);
+  svr.Post("/action/restore", RestoreSnapshot);
+  svr.Get(R"(/action/jobs/(\d+)/events)", JobEvents);
+
+  svr.Get("/action/module", PrintModule);
+  svr.Get("/action/ast", PrintAST);
+  svr.Get("/action/ast/decls", ListDecls);
+  svr.Get("/action/ast/source", PrintSource);
+  svr.Get("/action/provenance", PrintProvenance);
+  svr.Get("/action/provenance/related", PrintRelated);
+  svr.Get("/action/snapshots", ListSnapshots);
+  svr.Get("/action/stats", PrintStats);
+  svr.Get("/action/stats/function", PrintFunctionStats);
+  svr.Get("/metrics", PrintMetrics);
+  if (!is_worker) {
+    svr.Post("/action/loadAngha", LoadAngha);
+    svr.Get("/action/angha", ListAngha);
+  }
+}
+
 int main(int argc, char* argv[]) {
   std::stringstream usage;
   usage << std::endl
@@ -845,31 +2282,72 @@ int main(int argc, char* argv[]) {
   google::InstallFailureSignalHandler();
   google::SetUsageMessage(usage.str());
   SetVersion();
+  // Workers are started with the same arguments
+  std::vector<std::string> args(argv + 1, argv + argc);
   google::ParseCommandLineFlags(&argc, &argv, true);
 
-  svr.set_logger([](const httplib::Request& req, const httplib::Response&) {
+  auto is_worker{FLAGS_worker_port != 0};
+  auto is_router{FLAGS_workers && !is_worker};
+  if (is_worker) {
+    ConfigureWorker(FLAGS_worker_memory_limit);
+  }
+
+  svr.set_logger([](const httplib::Request& req, const httplib::Response& res) {
     LOG(INFO) << req.method << " " << req.path;
+    // Paths that are not served are not labelled, as any client can make them
+    metrics.ObserveRequest(
+        res.status == 404 ? "unmatched" : GetRouteLabel(req.path), res.status,
+        std::chrono::steady_clock::now() - request_start);
   });
-  svr.set_mount_point("/", FLAGS_home);
-  svr.set_pre_routing_handler(PreRoutingHandler);
-  svr.Post("/action/module", LoadModule);
-  svr.Post("/action/decompile", Decompile);
-  svr.Post("/action/remove-phi-nodes", RemovePhi);
-  svr.Post("/action/lower-switches", LowerSwitches);
-  svr.Post("/action/remove-array-arguments", RemoveArrayArguments);
-  svr.Post("/action/remove-insertvalue", RemoveInsertValue);
-  svr.Post("/action/run", Run);
-  svr.Post("/action/fixpoint", Fixpoint);
-  svr.Post("/action/stop", Stop);
-  svr.Post("/action/loadAngha", LoadAngha);
-
-  svr.Get("/action/module", PrintModule);
-  svr.Get("/action/ast", PrintAST);
-  svr.Get("/action/angha", ListAngha);
-  svr.Get("/action/provenance", PrintProvenance);
+  if (is_router) {
+    auto executable{llvm::sys::fs::getMainExecutable(
+        argv[0], (void*)(intptr_t)&SetVersion)};
+    auto first_port{FLAGS_first_worker_port ? FLAGS_first_worker_port
+                                            : FLAGS_port + 1};
+    workers = std::make_unique<WorkerPool>(
+        executable, args, FLAGS_workers, static_cast<uint16_t>(first_port),
+        std::chrono::minutes(FLAGS_session_timeout));
+    auto Forward = [](const httplib::Request& req, httplib::Response& res) {
+      workers->Forward(req, res, request_session);
+    };
+    svr.set_mount_point("/", FLAGS_home);
+    svr.set_pre_routing_handler(RouterPreRoutingHandler);
+    svr.Get("/action/angha", ListAngha);
+    svr.Post("/action/loadAngha", ForwardLoadAngha);
+    svr.Get(R"(/action/jobs/(\d+)/events)",
+            [](const httplib::Request& req, httplib::Response& res) {
+              workers->ForwardEvents(req, res, request_session);
+            });
+    svr.Get(R"(/action/.+)", Forward);
+    svr.Post(R"(/action/.+)", Forward);
+    svr.Get("/metrics", PrintRouterMetrics);
+  } else {
+    RegisterActions(is_worker);
+  }
 
+  if (!is_worker) {
+    angha = std::make_unique<Catalog>(FLAGS_angha);
+    angha->Start();
+  }
+  if (is_router) {
+    workers->Start();
+  } else {
+    sessions.Start();
+  }
   LOG(INFO) << "Listening";
-  svr.listen(FLAGS_address.c_str(), FLAGS_port);
+  if (is_worker) {
+    svr.listen("127.0.0.1", FLAGS_worker_port);
+  } else {
+    svr.listen(FLAGS_address.c_str(), FLAGS_port);
+  }
+  if (is_router) {
+    workers->Stop();
+  } else {
+    sessions.Stop();
+  }
+  if (angha) {
+    angha->Stop();
+  }
 
   google::ShutDownCommandLineFlags();
   google::ShutdownGoogleLogging();
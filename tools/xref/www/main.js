@@ -1,5 +1,14 @@
 
 const { Splitpanes, Pane } = splitpanes
+// Largest number of top-level declarations, and of statements in them, shown
+// on the same page of the AST
+const maxPageDecls = 200
+const maxPageStmts = 5000
+// Number of the slowest functions and of the last runs of passes shown by the
+// performance panel, and how often it is refreshed while jobs run
+const statsFunctions = 20
+const statsRuns = 20
+const statsInterval = 1000
 const dse = {
     id: "dse",
     label: "Dead statement elimination"
@@ -58,34 +67,6 @@ Vue.component('list-comp', {
     template: "#list-component"
 })
 
-Vue.component('tree-view', {
-    props: ["entries", "name"],
-    methods: {
-        addCommand() {
-            this.items.push(this.selected)
-        },
-        deleteCommand(i) {
-            this.items.splice(i, 1)
-        },
-        addFixpoint() {
-            this.items.push([])
-        }
-    },
-    data() {
-        return {
-            selected: null
-        }
-    },
-    computed: {
-        sortedEntries() {
-            return this.entries.slice().sort((a, b) => {
-                return a.name.toLowerCase() < b.name.toLowerCase() ? -1 : 1
-            })
-        }
-    },
-    template: "#tree-view"
-})
-
 const app = new Vue({
     el: '#app',
     components: { Splitpanes, Pane },
@@ -96,7 +77,15 @@ const app = new Vue({
         status: "Ready.",
         file: null,
         running: false,
-        angha: [],
+        angha: {
+            entries: [],
+            total: 0,
+            complete: true
+        },
+        anghaQuery: "",
+        anghaOffset: 0,
+        // Number of AnghaBench files listed at once
+        anghaPageSize: 100,
         available_commands: [
             dse,
             zcs,
@@ -127,9 +116,42 @@ const app = new Vue({
             }
         ],
         commands: [],
-        provenance: {}
+        provenance: {},
+        decls: [],
+        astPage: 0,
+        // Changes whenever the AST is loaded as a whole, so that the view is
+        // rendered again even if it was patched in place
+        astGeneration: 0,
+        showStats: false,
+        stats: null,
+        // Metrics and slowest queries of the function selected in the
+        // performance panel
+        statsFunction: null,
+        statsTimer: null,
+        // Number of jobs started from this page that are not done yet
+        activeJobs: 0
     },
     computed: {
+        astPages: function () {
+            const pages = []
+            let begin = 0
+            let stmts = 0
+            for (let i = 0; i < this.decls.length; i++) {
+                const size = this.decls[i].size
+                if (i > begin && (i - begin >= maxPageDecls || stmts + size > maxPageStmts)) {
+                    pages.push({ begin, end: i })
+                    begin = i
+                    stmts = 0
+                }
+                stmts += size
+            }
+            pages.push({ begin, end: this.decls.length })
+            return pages
+        },
+        astRange: function () {
+            const page = this.astPages[Math.min(this.astPage, this.astPages.length - 1)]
+            return `begin=${page.begin}&end=${page.end}`
+        },
         astView: function () {
             if (this.ast) {
                 return this.ast
@@ -139,6 +161,15 @@ const app = new Vue({
                 return "No module loaded"
             }
         },
+        statsPasses: function () {
+            return [...this.stats.passes].sort((a, b) => b.seconds - a.seconds)
+        },
+        statsRuns: function () {
+            return this.stats.runs.slice(-statsRuns).reverse()
+        },
+        statsRunMax: function () {
+            return Math.max(0, ...this.statsRuns.map(run => run.seconds))
+        },
         moduleView: function () {
             if (this.module) {
                 return this.module
@@ -152,24 +183,28 @@ const app = new Vue({
             await Promise.all([
                 this.loadModule(),
                 this.loadAST(),
-                this.loadProvenance(),
                 this.loadAngha()])
         })()
     },
     updated: function () {
         const spans = document.querySelectorAll('.clang[id],.llvm[id]')
         for (let span of spans) {
-            span.addEventListener('mouseover', e => {
+            span.addEventListener('mouseover', async e => {
                 e.stopImmediatePropagation()
                 span.classList.add('hover')
-                for (let prov of this.provenance[span.id] ?? []) {
+                const related = await this.loadRelated(span.id)
+                // The pointer may have left while the answer was on its way
+                if (!span.classList.contains('hover')) {
+                    return
+                }
+                for (let prov of related) {
                     const provenanceSpan = document.getElementById(prov)
                     provenanceSpan?.classList?.add('hover')
                 }
             })
-            span.addEventListener('mouseleave', e => {
+            span.addEventListener('mouseleave', async e => {
                 span.classList.remove('hover')
-                for (let prov of this.provenance[span.id] ?? []) {
+                for (let prov of await this.loadRelated(span.id)) {
                     const provenanceSpan = document.getElementById(prov)
                     provenanceSpan?.classList?.remove('hover')
                 }
@@ -188,8 +223,18 @@ const app = new Vue({
             let text = await res.text()
             this.module = text
         },
+        // Loads the list of top-level declarations, and the AST of those on
+        // the current page
         async loadAST() {
-            res = await fetch("/action/ast", {
+            res = await fetch("/action/ast/decls", {
+                credentials: "include",
+                method: "GET"
+            })
+            if (res.status != 200) {
+                throw (await res.json()).message
+            }
+            this.decls = await res.json()
+            res = await fetch(`/action/ast?${this.astRange}`, {
                 credentials: "include",
                 method: "GET"
             })
@@ -198,38 +243,54 @@ const app = new Vue({
             }
             let text = await res.text()
             this.ast = text
+            this.astGeneration++
         },
-        async loadProvenance() {
-            res = await fetch("/action/provenance", {
+        // Replaces the top-level declarations changed by a job with their new
+        // renderings, unless the job asks for the whole AST to be loaded again
+        // or the current page no longer holds the same declarations
+        async applyPatch(patch) {
+            const range = this.astRange
+            let res = await fetch("/action/ast/decls", {
                 credentials: "include",
                 method: "GET"
             })
             if (res.status != 200) {
                 throw (await res.json()).message
             }
-            const prov = await res.json()
-            for (let map in prov) {
-                for (let [from, to] of prov[map]) {
-                    if (!from || !to) {
-                        continue
-                    }
-
-                    const from_hex = from.toString(16)
-                    const to_hex = to.toString(16)
-                    if (!this.provenance[from_hex]) {
-                        this.provenance[from_hex] = []
-                    }
-                    this.provenance[from_hex].push(to_hex)
-
-                    if (!this.provenance[to_hex]) {
-                        this.provenance[to_hex] = []
-                    }
-                    this.provenance[to_hex].push(from_hex)
+            this.decls = await res.json()
+            if (!patch || patch.full || !this.ast || range != this.astRange) {
+                await this.loadAST()
+                return
+            }
+            for (let decl of patch.decls) {
+                const element = document.getElementById(decl.id)
+                if (element) {
+                    element.outerHTML = decl.html
                 }
             }
         },
+        // Gets the ids of the elements related to the element `id` by their
+        // provenance, which are asked to the server once per version of the
+        // AST
+        async loadRelated(id) {
+            if (!this.provenance[id]) {
+                this.provenance[id] = (async () => {
+                    const res = await fetch(`/action/provenance/related?id=${id}`, {
+                        credentials: "include",
+                        method: "GET"
+                    })
+                    return res.status == 200 ? await res.json() : []
+                })()
+            }
+            return await this.provenance[id]
+        },
         async loadAngha() {
-            res = await fetch("/action/angha", {
+            const params = new URLSearchParams({
+                query: this.anghaQuery,
+                offset: this.anghaOffset,
+                limit: this.anghaPageSize
+            })
+            res = await fetch(`/action/angha?${params}`, {
                 credentials: "include",
                 method: "GET"
             })
@@ -239,6 +300,144 @@ const app = new Vue({
             let json = await res.json()
             this.angha = json
         },
+        // Starts a background job and resolves with its final message, showing
+        // its progress in the meantime. Events without a message, like
+        // patches, are passed to `onEvent` instead.
+        async startJob(url, body, onEvent) {
+            let res = await fetch(url, {
+                credentials: "include",
+                body,
+                method: "POST"
+            })
+            if (res.status != 202) {
+                throw (await res.json()).message
+            }
+            const job = (await res.json()).job
+            this.activeJobs++
+            return await new Promise((resolve, reject) => {
+                const events = new EventSource(`/action/jobs/${job}/events`, {
+                    withCredentials: true
+                })
+                events.onmessage = (e) => {
+                    const event = JSON.parse(e.data)
+                    if (event.type == "patch") {
+                        onEvent?.(event)
+                        return
+                    }
+                    if (event.type != "done") {
+                        this.status = event.message
+                        return
+                    }
+                    events.close()
+                    this.jobFinished()
+                    if (event.status == "error") {
+                        reject(event.message)
+                    } else {
+                        resolve(event.message)
+                    }
+                }
+                events.onerror = () => {
+                    events.close()
+                    this.jobFinished()
+                    reject("Lost track of the job.")
+                }
+            })
+        },
+        jobFinished() {
+            this.activeJobs--
+            if (this.showStats) {
+                this.refreshStats()
+            }
+        },
+        async loadStats() {
+            const res = await fetch(`/action/stats?limit=${statsFunctions}`, {
+                credentials: "include",
+                method: "GET"
+            })
+            if (res.status != 200) {
+                throw (await res.json()).message
+            }
+            this.stats = await res.json()
+        },
+        refreshStats() {
+            (async () => {
+                try {
+                    await this.loadStats()
+                } catch (e) {
+                    this.status = e
+                }
+            })()
+        },
+        // Shows the performance panel, which is refreshed while jobs run
+        toggleStats() {
+            this.showStats = !this.showStats
+            clearInterval(this.statsTimer)
+            this.statsTimer = null
+            if (this.showStats) {
+                this.refreshStats()
+                this.statsTimer = setInterval(() => {
+                    if (this.activeJobs > 0 || this.stats?.running) {
+                        this.refreshStats()
+                    }
+                }, statsInterval)
+            }
+        },
+        // Shows the slowest queries of the function `name`, or hides them if
+        // they are already shown
+        selectFunction(name) {
+            if (this.statsFunction?.name == name) {
+                this.statsFunction = null
+                return
+            }
+            (async () => {
+                try {
+                    const params = new URLSearchParams({ name })
+                    const res = await fetch(`/action/stats/function?${params}`, {
+                        credentials: "include",
+                        method: "GET"
+                    })
+                    if (res.status != 200) {
+                        throw (await res.json()).message
+                    }
+                    this.statsFunction = await res.json()
+                } catch (e) {
+                    this.status = e
+                }
+            })()
+        },
+        formatSeconds(seconds) {
+            if (seconds < 1) {
+                return `${(seconds * 1000).toFixed(1)} ms`
+            }
+            return `${seconds.toFixed(2)} s`
+        },
+        formatBytes(bytes) {
+            const units = ["B", "KiB", "MiB", "GiB"]
+            let i = 0
+            while (bytes >= 1024 && i + 1 < units.length) {
+                bytes /= 1024
+                i++
+            }
+            return `${i ? bytes.toFixed(1) : bytes} ${units[i]}`
+        },
+        // Width of the bar of a run that took `seconds`, relative to the
+        // longest one shown
+        barWidth(seconds, max) {
+            return `${max > 0 ? Math.max(1, 100 * seconds / max) : 1}%`
+        },
+        showPage(page) {
+            this.astPage = page;
+            (async () => {
+                try {
+                    this.status = "Loading AST..."
+                    await this.loadAST()
+                    this.provenance = {}
+                    this.status = "Ready."
+                } catch (e) {
+                    this.status = e
+                }
+            })()
+        },
         selectFile(event) {
             this.file = event.target.files[0]
         },
@@ -267,20 +466,13 @@ const app = new Vue({
         },
         decompile() {
             this.status = "Decompiling...";
+            this.astPage = 0;
             (async () => {
                 try {
-                    let res = await fetch("/action/decompile", {
-                        credentials: "include",
-                        method: "POST"
-                    })
-                    if (res.status != 200) {
-                        throw (await res.json()).message
-                    }
+                    await this.startJob("/action/decompile")
                     this.status = "Loading AST..."
                     await this.loadAST()
-                    this.status = "Loading provenance info..."
                     this.provenance = {}
-                    await this.loadProvenance()
                     this.status = "Ready."
                 } catch (e) {
                     this.status = e
@@ -321,6 +513,17 @@ const app = new Vue({
         },
         openAngha() {
             this.$refs.anghaDialog.showModal()
+            this.searchAngha(this.anghaOffset)
+        },
+        searchAngha(offset) {
+            this.anghaOffset = Math.max(offset, 0);
+            (async () => {
+                try {
+                    await this.loadAngha()
+                } catch (e) {
+                    this.status = e
+                }
+            })()
         },
         anghaClosed(event) {
             console.log("anghaClosed", event.returnValue)
@@ -355,18 +558,12 @@ const app = new Vue({
                 try {
                     this.status = "Executing passes..."
                     this.running = true
-                    let res = await fetch("/action/run", {
-                        credentials: "include",
-                        body: JSON.stringify(this.commands),
-                        method: "POST"
-                    })
-                    if (res.status != 200) {
-                        throw (await res.json()).message
-                    }
-                    this.status = (await res.json()).message
-                    await this.loadAST()
+                    let patch = null
+                    const message = await this.startJob("/action/run",
+                        JSON.stringify(this.commands), e => patch = e)
+                    await this.applyPatch(patch)
                     this.provenance = {}
-                    await this.loadProvenance()
+                    this.status = message
                 } catch (e) {
                     this.status = e
                 } finally {
@@ -379,18 +576,12 @@ const app = new Vue({
                 try {
                     this.status = "Searching fixpoint..."
                     this.running = true
-                    let res = await fetch("/action/fixpoint", {
-                        credentials: "include",
-                        body: JSON.stringify(this.commands),
-                        method: "POST"
-                    })
-                    if (res.status != 200) {
-                        throw (await res.json()).message
-                    }
-                    this.status = (await res.json()).message
-                    await this.loadAST()
+                    let patch = null
+                    const message = await this.startJob("/action/fixpoint",
+                        JSON.stringify(this.commands), e => patch = e)
+                    await this.applyPatch(patch)
                     this.provenance = {}
-                    await this.loadProvenance()
+                    this.status = message
                 } catch (e) {
                     this.status = e
                 } finally {
@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <httplib.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "rellic/Version.h"
+
+DEFINE_string(host, "localhost", "Host on which rellic-xref is listening.");
+DEFINE_int32(port, 80, "Port on which rellic-xref is listening.");
+DEFINE_string(corpus, "",
+              "Directory searched recursively for the .bc and .ll files that "
+              "sessions load.");
+DEFINE_uint32(max_files, 0,
+              "Only load the first this many files of the corpus, in path "
+              "order (0 means all of them).");
+DEFINE_uint32(sessions, 8, "Number of concurrent sessions.");
+DEFINE_uint32(duration, 60,
+              "Seconds after which sessions stop starting new rounds.");
+DEFINE_uint32(rounds, 0,
+              "Rounds run by each session, before --duration runs out (0 "
+              "means as many as fit).");
+DEFINE_uint32(think_time, 0,
+              "Milliseconds each session waits between two requests.");
+DEFINE_uint32(timeout, 600,
+              "Seconds after which a request or a job is given up on.");
+DEFINE_uint32(sample_interval, 1000,
+              "Milliseconds between two samples of the metrics of the "
+              "server.");
+DEFINE_string(run_passes, R"([{"id":"dse"},{"id":"zcs"}])",
+              "Body of the requests to /action/run.");
+DEFINE_string(
+    fixpoint_passes,
+    R"([[{"id":"zcs"},{"id":"ncp"},{"id":"nsc"},{"id":"cbr"},{"id":"rbr"}]])",
+    "Body of the requests to /action/fixpoint.");
+DEFINE_string(output, "",
+              "JSON file in which the report is written, for CI to track "
+              "across commits.");
+
+namespace {
+// Requests and jobs of one route, over all sessions
+struct RouteStats {
+  size_t num_errors{0};
+  std::vector<std::chrono::nanoseconds> latencies;
+
+  void Merge(RouteStats& other) {
+    num_errors += other.num_errors;
+    latencies.insert(latencies.end(), other.latencies.begin(),
+                     other.latencies.end());
+  }
+};
+
+using Routes = std::map<std::string, RouteStats>;
+
+// The gauges of `/metrics` at some point of the run
+struct MetricsSample {
+  std::chrono::nanoseconds time{0};
+  double rss{0};
+  double sessions{0};
+  double session_memory{0};
+  double jobs_running{0};
+};
+
+struct CorpusFile {
+  std::string path;
+  std::string contents;
+};
+
+static double ToMs(std::chrono::nanoseconds duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static int64_t ToInt(size_t value) { return static_cast<int64_t>(value); }
+
+static std::vector<CorpusFile> GetCorpus(const std::string& corpus) {
+  std::vector<std::string> paths;
+  std::error_code ec;
+  for (llvm::sys::fs::recursive_directory_iterator it(corpus, ec), end;
+       !ec && it != end; it.increment(ec)) {
+    auto ext{llvm::sys::path::extension(it->path())};
+    if (ext == ".bc" || ext == ".ll") {
+      paths.push_back(it->path());
+    }
+  }
+  CHECK(!ec) << "Cannot list " << corpus << ": " << ec.message();
+  std::sort(paths.begin(), paths.end());
+  if (FLAGS_max_files && paths.size() > FLAGS_max_files) {
+    paths.resize(FLAGS_max_files);
+  }
+
+  // Files are read up front, so that the disk is not part of the latencies
+  std::vector<CorpusFile> files;
+  for (auto& path : paths) {
+    auto buffer{llvm::MemoryBuffer::getFile(path)};
+    CHECK(buffer) << "Cannot read " << path << ": "
+                  << buffer.getError().message();
+    files.push_back({path, (*buffer)->getBuffer().str()});
+  }
+  return files;
+}
+
+// A client that keeps the session cookie rellic-xref gives it, and times each
+// request it makes
+class SessionClient {
+  httplib::Client client;
+  std::string cookie;
+  Routes& routes;
+
+  httplib::Headers GetHeaders() const {
+    httplib::Headers headers;
+    if (!cookie.empty()) {
+      headers.emplace("Cookie", cookie);
+    }
+    return headers;
+  }
+
+  void Think() {
+    if (FLAGS_think_time) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_think_time));
+    }
+  }
+
+  // Records the outcome of a request to `route`. Returns the response if the
+  // server answered with `expected`.
+  const httplib::Response* Record(const std::string& route,
+                                  const httplib::Result& result, int expected,
+                                  std::chrono::steady_clock::time_point start) {
+    auto& stats{routes[route]};
+    stats.latencies.push_back(std::chrono::steady_clock::now() - start);
+    if (!result || result->status != expected) {
+      ++stats.num_errors;
+      return nullptr;
+    }
+    auto set_cookie{result->get_header_value("Set-Cookie")};
+    if (!set_cookie.empty()) {
+      cookie = llvm::StringRef(set_cookie).split(';').first.str();
+    }
+    return &*result;
+  }
+
+ public:
+  SessionClient(Routes& routes)
+      : client(FLAGS_host, FLAGS_port), routes(routes) {
+    client.set_connection_timeout(FLAGS_timeout, 0);
+    client.set_read_timeout(FLAGS_timeout, 0);
+    client.set_write_timeout(FLAGS_timeout, 0);
+  }
+
+  bool Get(const std::string& route, const std::string& path) {
+    Think();
+    auto start{std::chrono::steady_clock::now()};
+    auto result{client.Get(path.c_str(), GetHeaders())};
+    return Record(route, result, 200, start);
+  }
+
+  bool Post(const std::string& route, const std::string& path,
+            const std::string& body, const char* content_type) {
+    Think();
+    auto start{std::chrono::steady_clock::now()};
+    auto result{client.Post(path.c_str(), GetHeaders(), body, content_type)};
+    return Record(route, result, 200, start);
+  }
+
+  // Starts a job and follows its events until it is done. The request and the
+  // whole job are recorded as `route` and `route.job` respectively.
+  bool RunJob(const std::string& route, const std::string& path,
+              const std::string& body) {
+    Think();
+    auto start{std::chrono::steady_clock::now()};
+    auto result{
+        client.Post(path.c_str(), GetHeaders(), body, "application/json")};
+    auto started{Record(route, result, 202, start)};
+    if (!started) {
+      return false;
+    }
+    auto& job_stats{routes[route + ".job"]};
+    std::optional<int64_t> id;
+    auto json{llvm::json::parse(started->body)};
+    if (!json) {
+      llvm::consumeError(json.takeError());
+    } else if (auto obj = json->getAsObject()) {
+      if (auto job = obj->getInteger("job")) {
+        id = *job;
+      }
+    }
+    if (!id) {
+      ++job_stats.num_errors;
+      return false;
+    }
+
+    // The event stream ends with the event of type "done"
+    auto events_path{"/action/jobs/" + std::to_string(*id) + "/events"};
+    auto events{client.Get(events_path.c_str(), GetHeaders())};
+    job_stats.latencies.push_back(std::chrono::steady_clock::now() - start);
+    std::optional<std::string> status;
+    if (events && events->status == 200) {
+      llvm::SmallVector<llvm::StringRef, 16> lines;
+      llvm::StringRef(events->body).split(lines, '\n', -1, false);
+      for (auto line : lines) {
+        if (!line.consume_front("data: ")) {
+          continue;
+        }
+        auto event{llvm::json::parse(line)};
+        if (!event) {
+          llvm::consumeError(event.takeError());
+          continue;
+        }
+        auto obj{event->getAsObject()};
+        if (obj && obj->getString("type") == llvm::StringRef("done")) {
+          status = obj->getString("status").getValueOr("").str();
+        }
+      }
+    }
+    if (status != std::string("ok")) {
+      ++job_stats.num_errors;
+      return false;
+    }
+    return true;
+  }
+};
+
+// Goes through what a user of the web interface does with a module: loading
+// and decompiling it, viewing the AST and its provenance, and refining it
+static void RunRound(SessionClient& client, const CorpusFile& file) {
+  if (!client.Post("/action/module", "/action/module", file.contents,
+                   "application/octet-stream") ||
+      !client.RunJob("/action/decompile", "/action/decompile", "")) {
+    return;
+  }
+  client.Get("/action/ast", "/action/ast");
+  client.Get("/action/provenance", "/action/provenance");
+  if (client.RunJob("/action/run", "/action/run", FLAGS_run_passes)) {
+    client.Get("/action/ast", "/action/ast");
+  }
+  if (client.RunJob("/action/fixpoint", "/action/fixpoint",
+                    FLAGS_fixpoint_passes)) {
+    client.Get("/action/ast", "/action/ast");
+    // Unchanged views are answered from the cache of the session
+    client.Get("/action/ast", "/action/ast");
+    client.Get("/action/provenance", "/action/provenance");
+  }
+}
+
+// Reads the value of the gauge `name` from the Prometheus text format
+static double GetGauge(llvm::StringRef metrics, llvm::StringRef name) {
+  llvm::SmallVector<llvm::StringRef, 64> lines;
+  metrics.split(lines, '\n', -1, false);
+  for (auto line : lines) {
+    auto [key, value] = line.split(' ');
+    double number;
+    if (key == name && !value.trim().getAsDouble(number)) {
+      return number;
+    }
+  }
+  return 0;
+}
+
+// Samples the gauges of the server every `--sample_interval` until `done`
+class MetricsSampler {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done{false};
+  std::vector<MetricsSample> samples;
+  std::thread thread;
+
+  void Sample(httplib::Client& client,
+              std::chrono::steady_clock::time_point start) {
+    auto result{client.Get("/metrics")};
+    if (!result || result->status != 200) {
+      LOG(WARNING) << "Cannot read the metrics of the server";
+      return;
+    }
+    llvm::StringRef body{result->body};
+    samples.push_back({std::chrono::steady_clock::now() - start,
+                       GetGauge(body, "rellic_xref_resident_memory_bytes"),
+                       GetGauge(body, "rellic_xref_sessions"),
+                       GetGauge(body, "rellic_xref_session_memory_bytes"),
+                       GetGauge(body, "rellic_xref_jobs_running")});
+  }
+
+ public:
+  void Start(std::chrono::steady_clock::time_point start) {
+    thread = std::thread([this, start]() {
+      httplib::Client client(FLAGS_host, FLAGS_port);
+      client.set_read_timeout(FLAGS_timeout, 0);
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true) {
+        Sample(client, start);
+        if (cv.wait_for(lock,
+                        std::chrono::milliseconds(FLAGS_sample_interval),
+                        [this]() { return done; })) {
+          break;
+        }
+      }
+      // The state of the server once the load is over
+      Sample(client, start);
+    });
+  }
+
+  std::vector<MetricsSample> Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    cv.notify_all();
+    thread.join();
+    return std::move(samples);
+  }
+};
+
+// Latency under which `p` percent of the requests were answered, by the
+// nearest-rank method. `sorted` must not be empty.
+static std::chrono::nanoseconds Percentile(
+    const std::vector<std::chrono::nanoseconds>& sorted, unsigned p) {
+  auto rank{(sorted.size() * p + 99) / 100};
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+static llvm::json::Object Summarize(Routes& routes,
+                                    const std::vector<MetricsSample>& samples,
+                                    size_t num_rounds,
+                                    std::chrono::nanoseconds wall_time) {
+  llvm::json::Array route_stats;
+  for (auto& [name, stats] : routes) {
+    auto& latencies{stats.latencies};
+    std::sort(latencies.begin(), latencies.end());
+    llvm::json::Object obj{
+        {"route", name},
+        {"requests", ToInt(latencies.size())},
+        {"errors", ToInt(stats.num_errors)},
+        {"error_rate",
+         latencies.empty() ? 0.0
+                           : static_cast<double>(stats.num_errors) /
+                                 latencies.size()}};
+    if (!latencies.empty()) {
+      obj["p50_ms"] = ToMs(Percentile(latencies, 50));
+      obj["p95_ms"] = ToMs(Percentile(latencies, 95));
+      obj["p99_ms"] = ToMs(Percentile(latencies, 99));
+      obj["max_ms"] = ToMs(latencies.back());
+    }
+    route_stats.push_back(std::move(obj));
+  }
+
+  double peak_rss{0};
+  llvm::json::Array timeline;
+  for (auto& sample : samples) {
+    peak_rss = std::max(peak_rss, sample.rss);
+    timeline.push_back(llvm::json::Object{
+        {"time_s", std::chrono::duration<double>(sample.time).count()},
+        {"rss", sample.rss},
+        {"sessions", sample.sessions},
+        {"session_memory", sample.session_memory},
+        {"jobs_running", sample.jobs_running}});
+  }
+
+  return llvm::json::Object{
+      {"commit", rellic::Version::GetCommitHash()},
+      {"sessions", FLAGS_sessions},
+      {"rounds", ToInt(num_rounds)},
+      {"wall_time_s", std::chrono::duration<double>(wall_time).count()},
+      {"routes", std::move(route_stats)},
+      {"peak_rss", peak_rss},
+      {"timeline", std::move(timeline)}};
+}
+
+static void PrintSummary(const llvm::json::Object& summary) {
+  auto& os{llvm::outs()};
+  os << llvm::format("%.0f rounds by %.0f sessions in %.2fs\n",
+                     summary.getNumber("rounds").getValueOr(0),
+                     summary.getNumber("sessions").getValueOr(0),
+                     summary.getNumber("wall_time_s").getValueOr(0));
+
+  os << "\nRoute                      Requests  Errors      p50      p95      "
+        "p99      max (ms)\n";
+  for (auto& value : *summary.getArray("routes")) {
+    auto route{value.getAsObject()};
+    auto Get = [route](const char* key) {
+      return route->getNumber(key).getValueOr(0);
+    };
+    os << llvm::format("%-26s %8.0f %7.0f %8.1f %8.1f %8.1f %8.1f\n",
+                       route->getString("route").getValueOr("").str().c_str(),
+                       Get("requests"), Get("errors"), Get("p50_ms"),
+                       Get("p95_ms"), Get("p99_ms"), Get("max_ms"));
+  }
+
+  // At most 20 evenly spaced samples of the timeline are printed
+  auto& timeline{*summary.getArray("timeline")};
+  os << llvm::format("\nServer memory: %.1f MiB resident at peak\n",
+                     summary.getNumber("peak_rss").getValueOr(0) / (1 << 20));
+  os << "  Time (s)   RSS (MiB)  Sessions  Session memory (MiB)  Jobs\n";
+  auto step{std::max<size_t>(1, (timeline.size() + 19) / 20)};
+  for (size_t i{0}; i < timeline.size(); i += step) {
+    auto sample{timeline[i].getAsObject()};
+    auto Get = [sample](const char* key) {
+      return sample->getNumber(key).getValueOr(0);
+    };
+    os << llvm::format("%10.1f %11.1f %9.0f %21.1f %5.0f\n", Get("time_s"),
+                       Get("rss") / (1 << 20), Get("sessions"),
+                       Get("session_memory") / (1 << 20), Get("jobs_running"));
+  }
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --corpus CORPUS_DIR \\" << std::endl
+        << "    [--host HOST] [--port PORT] \\" << std::endl
+        << "    [--sessions N] [--duration SECONDS] [--rounds N] \\"
+        << std::endl
+        << "    [--output REPORT_JSON_FILE] \\" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_corpus.empty() || !FLAGS_sessions) {
+    std::cerr << google::ProgramUsage();
+    return EXIT_FAILURE;
+  }
+
+  auto files{GetCorpus(FLAGS_corpus)};
+  CHECK(!files.empty()) << "No .bc or .ll files in " << FLAGS_corpus;
+
+  // Each session keeps the latencies it records to itself until the end
+  std::vector<Routes> session_routes(FLAGS_sessions);
+  std::atomic_size_t num_rounds{0};
+  std::vector<std::thread> workers;
+  auto start{std::chrono::steady_clock::now()};
+  auto deadline{start + std::chrono::seconds(FLAGS_duration)};
+  MetricsSampler sampler;
+  sampler.Start(start);
+  for (unsigned i{0}; i < FLAGS_sessions; ++i) {
+    workers.emplace_back([&, i]() {
+      SessionClient client(session_routes[i]);
+      // Sessions start at different files, so that they do not all load the
+      // same module at once
+      for (size_t round{0};
+           (!FLAGS_rounds || round < FLAGS_rounds) &&
+           std::chrono::steady_clock::now() < deadline;
+           ++round) {
+        RunRound(client, files[(i + round * FLAGS_sessions) % files.size()]);
+        ++num_rounds;
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  auto wall_time{std::chrono::steady_clock::now() - start};
+  auto samples{sampler.Stop()};
+
+  Routes routes;
+  for (auto& session : session_routes) {
+    for (auto& [name, stats] : session) {
+      routes[name].Merge(stats);
+    }
+  }
+
+  auto summary{Summarize(routes, samples, num_rounds, wall_time)};
+  PrintSummary(summary);
+  if (!FLAGS_output.empty()) {
+    std::error_code ec;
+    llvm::raw_fd_ostream os(FLAGS_output, ec);
+    CHECK(!ec) << "Failed to create " << FLAGS_output << ": " << ec.message();
+    os << llvm::formatv("{0:2}", llvm::json::Value(std::move(summary)))
+       << '\n';
+  }
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+#include <z3++.h>
+
+#include <chrono>
+#include <climits>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "rellic/AST/Prover.h"
+#include "rellic/AST/QueryLog.h"
+#include "rellic/AST/Util.h"
+
+DEFINE_string(input, "", "Query log recorded with rellic-decomp --query_log.");
+DEFINE_uint32(timeout, 0,
+              "Time limit of each query, in milliseconds (0 means "
+              "unbounded).");
+DEFINE_string(tactic, "",
+              "Comma-separated tactics to chain for simplify queries, instead "
+              "of the ones used by rellic.");
+DEFINE_bool(truth_tables, false,
+            "Decide check queries with the truth table engine before calling "
+            "Z3.");
+
+namespace {
+struct Totals {
+  size_t num_queries{0};
+  // Queries whose replayed result contradicts the recorded one
+  size_t num_mismatches{0};
+  // Queries that ran out of their time limit during the replay
+  size_t num_unknown{0};
+  std::chrono::microseconds recorded{0};
+  std::chrono::microseconds replayed{0};
+};
+
+static z3::tactic GetTactic(z3::context& ctx) {
+  if (FLAGS_tactic.empty()) {
+    return rellic::Prover::GetSimplificationTactic(ctx);
+  }
+
+  llvm::SmallVector<llvm::StringRef, 4> names;
+  llvm::StringRef(FLAGS_tactic).split(names, ',', /*MaxSplit=*/-1,
+                                      /*KeepEmpty=*/false);
+  CHECK(!names.empty()) << "No tactic given";
+  z3::tactic result(ctx, names[0].trim().str().c_str());
+  for (size_t i{1}; i < names.size(); ++i) {
+    result = result & z3::tactic(ctx, names[i].trim().str().c_str());
+  }
+  return result;
+}
+
+static std::string Check(z3::context& ctx, const z3::expr& formula) {
+  if (FLAGS_truth_tables) {
+    // The prover decides validity, and the formula is unsatisfiable iff its
+    // negation is valid. A failed proof does not tell `sat` from `unknown`.
+    rellic::Prover prover(ctx);
+    prover.SetEngine(rellic::ConditionEngine::TruthTable);
+    prover.SetLimits(FLAGS_timeout, 0);
+    return prover.Prove(!formula) ? "unsat" : "sat";
+  }
+
+  z3::solver solver(ctx);
+  z3::params params(ctx);
+  params.set("timeout", FLAGS_timeout ? FLAGS_timeout : UINT_MAX);
+  solver.set(params);
+  solver.add(formula);
+  switch (solver.check()) {
+    case z3::sat:
+      return "sat";
+    case z3::unsat:
+      return "unsat";
+    default:
+      return "unknown";
+  }
+}
+
+static std::string Simplify(z3::context& ctx, const z3::expr& formula) {
+  auto tactic{GetTactic(ctx)};
+  if (FLAGS_timeout) {
+    tactic = z3::try_for(tactic, FLAGS_timeout);
+  }
+
+  try {
+    return rellic::ApplyTactic(tactic, formula).as_expr().to_string();
+  } catch (z3::exception& ex) {
+    return "unknown";
+  }
+}
+
+static bool IsMismatch(const rellic::QueryLog::Query& query,
+                       const std::string& result) {
+  if (query.result == "unknown" || result == "unknown") {
+    return false;
+  }
+
+  if (query.kind == "check") {
+    // With truth tables, `sat` may stand for `unknown`
+    return FLAGS_truth_tables ? query.result == "unsat" && result != "unsat"
+                              : query.result != result;
+  }
+  return query.result != result;
+}
+
+static void PrintTotals(llvm::StringRef name, const Totals& totals) {
+  llvm::outs() << llvm::format("%-48s %8zu %8zu %8zu %12.3f %12.3f\n",
+                               name.str().c_str(), totals.num_queries,
+                               totals.num_mismatches, totals.num_unknown,
+                               totals.recorded.count() / 1000.0,
+                               totals.replayed.count() / 1000.0);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --input QUERY_LOG \\" << std::endl
+        << "    [--timeout MS] \\" << std::endl
+        << "    [--tactic TACTIC,...] \\" << std::endl
+        << "    [--truth_tables]" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_input.empty()) {
+    LOG(ERROR) << "Must specify the path to a query log.";
+    std::cerr << google::ProgramUsage();
+    return EXIT_FAILURE;
+  }
+
+  auto queries{rellic::QueryLog::Read(FLAGS_input)};
+  if (!queries.Succeeded()) {
+    LOG(FATAL) << queries.Error();
+  }
+
+  z3::context ctx;
+  std::map<std::pair<std::string, std::string>, Totals> sites;
+  Totals total;
+  for (auto& query : queries.Value()) {
+    z3::expr formula{ctx};
+    try {
+      formula = z3::mk_and(ctx.parse_string(query.smt2.c_str()));
+    } catch (z3::exception& ex) {
+      LOG(ERROR) << "Cannot parse query from " << query.site << ": "
+                 << ex.msg();
+      continue;
+    }
+
+    auto start{std::chrono::steady_clock::now()};
+    std::string result;
+    if (query.kind == "check") {
+      result = Check(ctx, formula);
+    } else if (query.kind == "simplify") {
+      result = Simplify(ctx, formula);
+    } else {
+      LOG(ERROR) << "Unknown query kind " << query.kind;
+      continue;
+    }
+    auto elapsed{std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start)};
+
+    for (auto totals : {&sites[{query.kind, query.site}], &total}) {
+      ++totals->num_queries;
+      totals->num_mismatches += IsMismatch(query, result);
+      totals->num_unknown += result == "unknown";
+      totals->recorded += query.elapsed;
+      totals->replayed += elapsed;
+    }
+  }
+
+  llvm::outs() << llvm::format("%-48s %8s %8s %8s %12s %12s\n", "site",
+                               "queries", "mismatch", "unknown",
+                               "recorded ms", "replayed ms");
+  for (auto& [key, totals] : sites) {
+    PrintTotals(key.first + " " + key.second, totals);
+  }
+  PrintTotals("total", total);
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+
+  return total.num_mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -33,6 +33,25 @@ static void IsNullPtrExprCheck(clang::ASTContext &ctx, clang::Expr *expr) {
         clang::Expr::NPCK_ZeroLiteral);
 }
 
+// Checks that two expressions have the same shape, types and conversions
+static void IsSameExprCheck(clang::Expr *a, clang::Expr *b) {
+  REQUIRE(a->getStmtClass() == b->getStmtClass());
+  CHECK(a->getType() == b->getType());
+  CHECK(a->getValueKind() == b->getValueKind());
+  CHECK(a->getObjectKind() == b->getObjectKind());
+  if (auto cast = clang::dyn_cast<clang::CastExpr>(a)) {
+    auto other{clang::cast<clang::CastExpr>(b)};
+    CHECK(cast->getCastKind() == other->getCastKind());
+  }
+  std::vector<clang::Stmt *> children_a{a->child_begin(), a->child_end()};
+  std::vector<clang::Stmt *> children_b{b->child_begin(), b->child_end()};
+  REQUIRE(children_a.size() == children_b.size());
+  for (size_t i{0}; i < children_a.size(); ++i) {
+    IsSameExprCheck(clang::cast<clang::Expr>(children_a[i]),
+                    clang::cast<clang::Expr>(children_b[i]));
+  }
+}
+
 }  // namespace
 
 // TODO(surovic): Add test cases for signed llvm::APInt and group
@@ -1356,4 +1375,126 @@ TEST_SUITE("ASTBuilder::CreateSwitchStmt") {
       }
     }
   }
-}
\ No newline at end of file
+}
+
+TEST_SUITE("ASTBuilder::CreateGoto") {
+  SCENARIO("Create a labeled statement and a goto") {
+    GIVEN("Function definition void f(){}") {
+      auto unit{GetASTUnit("void f(){}")};
+      auto &ctx{unit->getASTContext()};
+      rellic::ASTBuilder ast(*unit);
+      auto tudecl{ctx.getTranslationUnitDecl()};
+      auto fdecl{GetDecl<clang::FunctionDecl>(tudecl, "f")};
+      THEN("return my_label: ; and goto my_label;") {
+        auto label{ast.CreateLabelDecl(fdecl, "my_label")};
+        REQUIRE(label != nullptr);
+        CHECK(label->getName() == "my_label");
+        auto label_stmt{ast.CreateLabelStmt(label, ast.CreateNullStmt())};
+        REQUIRE(label_stmt != nullptr);
+        CHECK(label_stmt->getDecl() == label);
+        CHECK(label->getStmt() == label_stmt);
+        auto goto_stmt{ast.CreateGoto(label)};
+        REQUIRE(goto_stmt != nullptr);
+        CHECK(goto_stmt->getLabel() == label);
+      }
+    }
+  }
+}
+
+TEST_SUITE("ASTBuilder::CreateBuiltinCall") {
+  SCENARIO("Create calls to builtins") {
+    GIVEN("Empty translation unit") {
+      auto unit{GetASTUnit("")};
+      rellic::ASTBuilder ast(*unit);
+      THEN("calls to the same builtin share its declaration") {
+        std::vector<clang::Expr *> args;
+        auto inf_a{clang::cast<clang::CallExpr>(
+            ast.CreateBuiltinCall(clang::Builtin::BI__builtin_inf, args))};
+        auto inf_b{clang::cast<clang::CallExpr>(
+            ast.CreateBuiltinCall(clang::Builtin::BI__builtin_inf, args))};
+        auto inff{clang::cast<clang::CallExpr>(
+            ast.CreateBuiltinCall(clang::Builtin::BI__builtin_inff, args))};
+        REQUIRE(inf_a->getDirectCallee() != nullptr);
+        CHECK(inf_a != inf_b);
+        CHECK(inf_a->getDirectCallee() == inf_b->getDirectCallee());
+        CHECK(inf_a->getDirectCallee() != inff->getDirectCallee());
+        CHECK(inff->getDirectCallee()->getBuiltinID() ==
+              clang::Builtin::BI__builtin_inff);
+      }
+    }
+  }
+}
+
+TEST_SUITE("ASTBuilder::ASTBuilder") {
+  SCENARIO("Create expressions without Sema") {
+    GIVEN("Global variables of different types") {
+      auto unit{GetASTUnit(
+          "struct s { int f; unsigned b : 3; }; int a, b; short c;"
+          "unsigned long d; int *p; struct s v; float x;")};
+      auto &ctx{unit->getASTContext()};
+      rellic::ASTBuilder fast(*unit);
+      rellic::ASTBuilder sema(*unit, /*validate=*/true);
+      auto tudecl{ctx.getTranslationUnitDecl()};
+      auto sdecl{GetDecl<clang::RecordDecl>(tudecl, "s")};
+      auto field_f{GetDecl<clang::FieldDecl>(sdecl, "f")};
+      auto field_b{GetDecl<clang::FieldDecl>(sdecl, "b")};
+      // Builds the same expression with both builders
+      auto Check{[&](auto build) {
+        IsSameExprCheck(build(fast), build(sema));
+      }};
+      auto Ref{[&](rellic::ASTBuilder &ast, const char *name) {
+        return ast.CreateDeclRef(GetDecl<clang::VarDecl>(tudecl, name));
+      }};
+      THEN("the expressions are the same as Sema's") {
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateAdd(Ref(ast, "a"), Ref(ast, "b"));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateAdd(Ref(ast, "a"), Ref(ast, "c"));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateShl(Ref(ast, "d"), Ref(ast, "a"));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateLAnd(Ref(ast, "p"), Ref(ast, "d"));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateEQ(Ref(ast, "p"), Ref(ast, "p"));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateAssign(Ref(ast, "a"), Ref(ast, "b"));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateAssign(Ref(ast, "x"), Ref(ast, "a"));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateNot(ast.CreateDeref(Ref(ast, "p")));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateLNot(ast.CreateAddrOf(Ref(ast, "a")));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateUnaryOp(clang::UO_Minus, Ref(ast, "c"));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateCStyleCast(ctx.getPointerType(ctx.CharTy),
+                                      Ref(ast, "d"));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateCStyleCast(ctx.BoolTy, Ref(ast, "p"));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateCStyleCast(ctx.IntTy, Ref(ast, "x"));
+        });
+        Check([&](rellic::ASTBuilder &ast) { return ast.CreateNull(); });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateAdd(ast.CreateDot(Ref(ast, "v"), field_f),
+                               ast.CreateDot(Ref(ast, "v"), field_b));
+        });
+        Check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateArrow(ast.CreateAddrOf(Ref(ast, "v")), field_f);
+        });
+      }
+    }
+  }
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/CPrinter.h"
+
+#include "Util.h"
+
+static std::string PrintWithClang(clang::ASTContext &ctx) {
+  std::string str;
+  llvm::raw_string_ostream os(str);
+  ctx.getTranslationUnitDecl()->print(os, ctx.getPrintingPolicy(), 0);
+  return os.str();
+}
+
+static std::string PrintWithRellic(clang::ASTContext &ctx,
+                                   rellic::CPrinterOptions options = {}) {
+  std::string str;
+  llvm::raw_string_ostream os(str);
+  {
+    rellic::CPrinter printer(os, ctx, std::move(options));
+    printer.PrintTranslationUnit();
+  }
+  return os.str();
+}
+
+TEST_SUITE("CPrinter") {
+  SCENARIO("Print declarations like Clang") {
+    GIVEN("Records, enums, typedefs and globals") {
+      auto unit{GetASTUnit(R"(
+struct point { int x; int y; };
+typedef struct point point_t;
+struct { char c; unsigned long l[4]; } anon;
+union u { float f; unsigned int i; };
+enum color { RED, GREEN = 4, BLUE };
+point_t origin = {0, 0};
+int table[3] = {1, 2, 3};
+const char *name = "rellic";
+static unsigned long long big = 18446744073709551615ULL;
+void (*callback)(int, char *);
+extern int printf(const char *, ...);
+void nothing(void);
+)")};
+      auto &ctx{unit->getASTContext()};
+      THEN("the output is the same") {
+        CHECK(PrintWithRellic(ctx) == PrintWithClang(ctx));
+      }
+    }
+  }
+
+  SCENARIO("Print statements like Clang") {
+    GIVEN("Functions with every kind of control flow") {
+      auto unit{GetASTUnit(R"(
+struct s { int a; struct s *next; };
+int f(int a, struct s *p) {
+  int b = a * 2, c;
+  if (a) {
+    b = 1;
+  } else if (b > 3) {
+    b = 2;
+  } else
+    b = 3;
+  while (a--) {
+    c = p->a + (*p).a;
+    p = p->next;
+  }
+  do {
+    b++;
+  } while (b < 10);
+  switch (a) {
+  case 0:
+    b = -b;
+    break;
+  default:
+    goto end;
+  }
+  for (c = 0; c < 4; ++c)
+    b += (char)c;
+end:
+  return b ? a : ~b;
+}
+unsigned g(unsigned x) { return x << 1U; }
+long h(void) { return f(1L, 0) + sizeof(struct s); }
+)")};
+      auto &ctx{unit->getASTContext()};
+      THEN("the output is the same") {
+        CHECK(PrintWithRellic(ctx) == PrintWithClang(ctx));
+      }
+    }
+  }
+
+  SCENARIO("Print statements without provenance") {
+    GIVEN("A function") {
+      auto unit{GetASTUnit("int f(int a) { return a + 1; }")};
+      auto &ctx{unit->getASTContext()};
+      THEN("annotations without provenance do not change the output") {
+        rellic::CPrinterOptions options;
+        options.line_directives = true;
+        options.provenance_comments = true;
+        options.stmt_provenance = [](const clang::Stmt *) { return nullptr; };
+        CHECK(PrintWithRellic(ctx, std::move(options)) == PrintWithClang(ctx));
+      }
+    }
+  }
+
+  SCENARIO("Print integer literals in hexadecimal") {
+    GIVEN("A function with small and large literals") {
+      auto unit{GetASTUnit(
+          "unsigned long f(int a) { return a * 255 + 3 + 4096UL; }")};
+      auto &ctx{unit->getASTContext()};
+      THEN("only the selected literals are converted") {
+        rellic::CPrinterOptions options;
+        options.hex_literals = [](const llvm::APInt &value) {
+          return value.uge(16);
+        };
+        auto code{PrintWithRellic(ctx, std::move(options))};
+        CHECK(code.find("a * 0xFF + 3 + 0x1000UL") != std::string::npos);
+      }
+    }
+  }
+
+  SCENARIO("Report the output range of printed nodes") {
+    GIVEN("A function") {
+      auto unit{GetASTUnit("int f(int a) {\n  if (a) return a + 1;\n}")};
+      auto &ctx{unit->getASTContext()};
+      std::vector<std::pair<std::string, rellic::CPrinterLocation>> stmts;
+      std::vector<std::pair<uint64_t, uint64_t>> ranges;
+      rellic::CPrinterOptions options;
+      options.buffer_size = 1;
+      options.on_stmt_range = [&](const clang::Stmt *stmt,
+                                  rellic::CPrinterLocation begin,
+                                  rellic::CPrinterLocation end) {
+        stmts.emplace_back(stmt->getStmtClassName(), begin);
+        ranges.emplace_back(begin.offset, end.offset);
+      };
+      std::vector<rellic::CPrinterLocation> decls;
+      options.on_decl_range = [&](const clang::Decl *decl,
+                                  rellic::CPrinterLocation begin,
+                                  rellic::CPrinterLocation end) {
+        decls.push_back(begin);
+        decls.push_back(end);
+      };
+      auto code{PrintWithRellic(ctx, std::move(options))};
+      REQUIRE(code == PrintWithClang(ctx));
+
+      THEN("the ranges cover the text of the nodes") {
+        std::vector<std::string> texts;
+        for (auto [begin, end] : ranges) {
+          texts.push_back(code.substr(begin, end - begin));
+        }
+        std::vector<std::string> expected{"a",
+                                          "a",
+                                          "a",
+                                          "a",
+                                          "1",
+                                          "a + 1",
+                                          "return a + 1;",
+                                          "if (a)\n        return a + 1;"};
+        CHECK(texts == expected);
+      }
+
+      THEN("the ranges start at the right line and column") {
+        REQUIRE(stmts.size() == 8);
+        CHECK(stmts[6].first == "ReturnStmt");
+        CHECK(stmts[6].second.line == 3);
+        CHECK(stmts[6].second.column == 9);
+        CHECK(stmts[7].first == "IfStmt");
+        CHECK(stmts[7].second.line == 2);
+        CHECK(stmts[7].second.column == 5);
+        REQUIRE(decls.size() == 2);
+        CHECK(decls[0].offset == 0);
+        CHECK(decls[1].offset == code.size() - 1);
+        CHECK(decls[1].line == 4);
+      }
+    }
+  }
+
+  SCENARIO("Print function definitions in parallel") {
+    GIVEN("Declarations interleaved with function definitions") {
+      auto unit{GetASTUnit(R"(
+struct s { int a; struct s *next; };
+int f(int a) { return a * 2; }
+struct { char c; } anon;
+int g(struct s *p) {
+  while (p) {
+    p = p->next;
+  }
+  return 0;
+}
+extern int printf(const char *, ...);
+unsigned h(unsigned x) { return x << 1U; }
+)")};
+      auto &ctx{unit->getASTContext()};
+      std::vector<std::pair<uint64_t, unsigned>> ranges;
+      auto Print{[&](unsigned num_threads) {
+        ranges.clear();
+        rellic::CPrinterOptions options;
+        options.on_stmt_range = [&](const clang::Stmt *,
+                                    rellic::CPrinterLocation begin,
+                                    rellic::CPrinterLocation end) {
+          ranges.emplace_back(begin.offset, begin.line);
+          ranges.emplace_back(end.offset, end.column);
+        };
+        options.on_decl_range = [&](const clang::Decl *,
+                                    rellic::CPrinterLocation begin,
+                                    rellic::CPrinterLocation end) {
+          ranges.emplace_back(begin.offset, begin.line);
+          ranges.emplace_back(end.offset, end.line);
+        };
+        std::string str;
+        llvm::raw_string_ostream os(str);
+        rellic::PrintTranslationUnit(os, ctx, std::move(options), num_threads);
+        return os.str();
+      }};
+
+      THEN("the output and ranges are the same as with a single thread") {
+        auto code{Print(1)};
+        auto sequential_ranges{ranges};
+        CHECK(code == PrintWithClang(ctx));
+        CHECK(Print(3) == code);
+        CHECK(ranges == sequential_ranges);
+      }
+    }
+  }
+}
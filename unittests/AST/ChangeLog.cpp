@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/ChangeLog.h"
+
+#include "Util.h"
+
+TEST_SUITE("ChangeLog") {
+  SCENARIO("Record the replacement of a statement") {
+    GIVEN("A function returning a sum") {
+      auto unit{GetASTUnit("int f(int a) { return a + 1; }")};
+      auto &ctx{unit->getASTContext()};
+      auto fdecl{
+          GetDecl<clang::FunctionDecl>(ctx.getTranslationUnitDecl(), "f")};
+      auto body{clang::cast<clang::CompoundStmt>(fdecl->getBody())};
+      auto ret{clang::cast<clang::ReturnStmt>(body->body_front())};
+      auto sum{clang::cast<clang::BinaryOperator>(ret->getRetValue())};
+      auto one{sum->getRHS()};
+
+      WHEN("the returned value is replaced by the literal") {
+        rellic::ChangeLog log;
+        auto &slot{*ret->child_begin()};
+        log.RecordReplacement(fdecl, ret, slot, one);
+        slot = one;
+
+        THEN("the change is recorded") {
+          REQUIRE(log.GetChanges().size() == 1);
+          auto &change{log.GetChanges().front()};
+          CHECK(change.function == fdecl);
+          CHECK(change.parent == ret);
+          CHECK(change.before == sum);
+          CHECK(change.after == one);
+        }
+
+        THEN("undoing and redoing the change swaps the statements") {
+          log.Undo();
+          CHECK(ret->getRetValue() == sum);
+          log.Redo();
+          CHECK(ret->getRetValue() == one);
+        }
+
+        THEN("the hunk only shows the return statement") {
+          auto hunks{log.GetHunks(ctx.getPrintingPolicy())};
+          REQUIRE(hunks.size() == 1);
+          CHECK(hunks[0].root == ret);
+          CHECK(hunks[0].removed == std::vector<std::string>{"return a + 1;"});
+          CHECK(hunks[0].added == std::vector<std::string>{"return 1;"});
+          CHECK(ret->getRetValue() == one);
+        }
+      }
+
+      WHEN("the body and then its return statement are replaced") {
+        rellic::ChangeLog log;
+        auto &slot{*body->child_begin()};
+        log.RecordReplacement(fdecl, body, slot, one);
+        log.RecordBody(fdecl, ret);
+        slot = one;
+        fdecl->setBody(ret);
+
+        THEN("a single hunk shows the whole definition") {
+          auto hunks{log.GetHunks(ctx.getPrintingPolicy())};
+          REQUIRE(hunks.size() == 1);
+          CHECK(hunks[0].function == fdecl);
+          CHECK(hunks[0].root == nullptr);
+          CHECK(fdecl->getBody() == ret);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/DecompilationContext.h"
+
+#include "Util.h"
+
+TEST_SUITE("DecompilationContext") {
+  SCENARIO("Summarize the features of function definitions") {
+    GIVEN("A function with a run of `if` statements and a loop") {
+      auto unit{GetASTUnit(
+          "int f(int a) {"
+          "  if (a) { a = 1; }"
+          "  if (a > 1) { a = 2; } else { a = 3; }"
+          "  if (a > 2) { a = 4; }"
+          "  while (a) { { a = a - 1; } }"
+          "  return a;"
+          "}")};
+      auto &ctx{unit->getASTContext()};
+      auto fdecl{
+          GetDecl<clang::FunctionDecl>(ctx.getTranslationUnitDecl(), "f")};
+      rellic::DecompilationContext dec_ctx{*unit};
+
+      WHEN("function changes are not tracked") {
+        THEN("its features are not known") {
+          CHECK(dec_ctx.GetFunctionFeatures(fdecl) == nullptr);
+        }
+      }
+
+      WHEN("function changes are tracked") {
+        dec_ctx.track_function_changes = true;
+        auto features{dec_ctx.GetFunctionFeatures(fdecl)};
+        REQUIRE(features != nullptr);
+
+        THEN("its statements are counted") {
+          CHECK(features->num_ifs == 3);
+          CHECK(features->num_whiles == 1);
+          CHECK(features->num_nested_compounds == 1);
+          CHECK(features->max_if_run == 3);
+          CHECK(features->max_plain_if_run == 1);
+        }
+
+        THEN("they are forgotten once it changes") {
+          dec_ctx.RecordFunctionChange(fdecl);
+          CHECK(dec_ctx.function_features.count(fdecl) == 0);
+          CHECK(dec_ctx.changed_functions.count(fdecl) == 1);
+        }
+      }
+    }
+  }
+}
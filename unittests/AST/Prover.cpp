@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/Prover.h"
+
+#include <chrono>
+#include <thread>
+
+#include "Util.h"
+
+TEST_SUITE("Prover") {
+  SCENARIO("Interrupt the queries of a prover") {
+    GIVEN("A condition that needs Z3 to be proven") {
+      z3::context ctx;
+      rellic::Prover prover(ctx);
+      auto a{ctx.bv_const("a", 32)};
+      auto b{ctx.bv_const("b", 32)};
+      auto cond{a * 3 + b == b + a + a + a};
+
+      WHEN("the prover is interrupted") {
+        prover.Interrupt();
+        THEN("the proof fails without being memoized") {
+          CHECK(!prover.Prove(cond));
+          CHECK(prover.GetStatistics().num_interrupted == 1);
+          CHECK(prover.GetProofs().empty());
+        }
+        THEN("the condition is not simplified") {
+          CHECK(z3::eq(prover.Simplify(cond), cond));
+          CHECK(prover.GetSimplifications().empty());
+        }
+        THEN("queries are decided again once the interrupt is reset") {
+          prover.Prove(cond);
+          prover.ResetInterrupt();
+          CHECK(prover.Prove(cond));
+        }
+      }
+    }
+
+    GIVEN("A condition that takes Z3 a long time to prove") {
+      z3::context ctx;
+      rellic::Prover prover(ctx);
+      // 2^64 - 59 is prime, so it has no factors other than 1 and itself
+      auto x{z3::zext(ctx.bv_const("x", 64), 64)};
+      auto y{z3::zext(ctx.bv_const("y", 64), 64)};
+      auto prime{ctx.bv_val("18446744073709551557", 128)};
+      auto cond{z3::implies(x * y == prime, x == 1 || y == 1)};
+
+      WHEN("the prover is interrupted from another thread") {
+        std::thread interrupter([&]() {
+          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+          prover.Interrupt();
+        });
+        auto proven{prover.Prove(cond)};
+        interrupter.join();
+        THEN("the running query is cancelled") {
+          CHECK(!proven);
+          CHECK(prover.GetStatistics().num_interrupted == 1);
+        }
+      }
+    }
+  }
+}
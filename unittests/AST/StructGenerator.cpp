@@ -117,6 +117,16 @@ TEST_SUITE("StructGenerator::GetAccessor") {
         auto accessors_invalid{gen.GetAccessor(var, strct, 32, 8)};
         CHECK_EQ(accessors_invalid.size(), 0);
       }
+
+      THEN("return new accessors of the same field on every lookup") {
+        auto first{gen.GetAccessor(var, strct, 64, 8)};
+        auto second{gen.GetAccessor(var, strct, 64, 8)};
+        REQUIRE_EQ(first.size(), 1);
+        REQUIRE_EQ(second.size(), 1);
+        CHECK_NE(first[0], second[0]);
+        auto member{clang::cast<clang::MemberExpr>(second[0])};
+        CHECK_EQ(member->getMemberDecl()->getName(), "c");
+      }
     }
   }
 }
\ No newline at end of file
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/UndoJournal.h"
+
+#include "Util.h"
+#include "rellic/AST/DecompilationContext.h"
+
+TEST_SUITE("UndoJournal") {
+  SCENARIO("Move between snapshots of a function") {
+    GIVEN("A function returning a sum") {
+      auto unit{GetASTUnit("int f(int a) { return a + 1; }")};
+      auto &ctx{unit->getASTContext()};
+      auto fdecl{
+          GetDecl<clang::FunctionDecl>(ctx.getTranslationUnitDecl(), "f")};
+      auto body{clang::cast<clang::CompoundStmt>(fdecl->getBody())};
+      auto ret{clang::cast<clang::ReturnStmt>(body->body_front())};
+      auto sum{clang::cast<clang::BinaryOperator>(ret->getRetValue())};
+      auto one{sum->getRHS()};
+      rellic::DecompilationContext dec_ctx{*unit};
+      rellic::UndoJournal journal{dec_ctx};
+      dec_ctx.journal = &journal;
+
+      WHEN("a change is made before any snapshot is taken") {
+        auto &slot{*ret->child_begin()};
+        journal.RecordSlot(slot);
+        slot = one;
+
+        THEN("it is not recorded") {
+          CHECK(journal.GetNumChanges() == 0);
+          CHECK(!journal.Restore("start"));
+        }
+      }
+
+      WHEN("the returned value and the condition of the body change") {
+        journal.Take("start");
+        auto &slot{*ret->child_begin()};
+        journal.RecordSlot(slot);
+        slot = one;
+        dec_ctx.SetCond(body, 1);
+        journal.Take("one");
+
+        THEN("restoring the first snapshot undoes them") {
+          REQUIRE(journal.Restore("start"));
+          CHECK(ret->getRetValue() == sum);
+          CHECK(dec_ctx.conds.count(body) == 0);
+        }
+
+        THEN("the second snapshot can be restored after the first") {
+          REQUIRE(journal.Restore("start"));
+          REQUIRE(journal.Restore("one"));
+          CHECK(ret->getRetValue() == one);
+          CHECK(dec_ctx.GetCond(body) == 1);
+        }
+
+        THEN("snapshots taken on different branches are kept") {
+          REQUIRE(journal.Restore("start"));
+          journal.RecordBody(fdecl);
+          fdecl->setBody(ret);
+          journal.Take("ret");
+
+          REQUIRE(journal.Restore("one"));
+          CHECK(fdecl->getBody() == body);
+          CHECK(ret->getRetValue() == one);
+          REQUIRE(journal.Restore("ret"));
+          CHECK(fdecl->getBody() == ret);
+          CHECK(ret->getRetValue() == sum);
+          CHECK(journal.GetSnapshots() ==
+                std::vector<std::string>{"one", "ret", "start"});
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/BC/Synthetic.h"
+
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Tooling/Tooling.h>
+#include <doctest/doctest.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rellic/AST/DebugInfoCollector.h"
+#include "rellic/AST/StructGenerator.h"
+#include "rellic/AST/SubprogramGenerator.h"
+#include "rellic/BC/Util.h"
+#include "rellic/Decompiler.h"
+
+TEST_SUITE("Synthetic") {
+  SCENARIO("Generate and decompile synthetic modules") {
+    GIVEN("A module with two small definitions of each shape") {
+      // Subcases cannot be nested in the loop, as they would only be entered
+      // for the first shape
+      THEN("every module is well formed and can be decompiled") {
+        for (auto shape : rellic::GetSyntheticShapes()) {
+          std::string name{rellic::GetSyntheticShapeName(shape)};
+          INFO("Shape: ", name);
+          auto parsed{rellic::ParseSyntheticShape(name)};
+          REQUIRE(parsed);
+          CHECK(*parsed == shape);
+
+          llvm::LLVMContext llvm_ctx;
+          auto module{rellic::CreateSyntheticModule(llvm_ctx, shape, 4, 2)};
+          CHECK(rellic::VerifyModule(module.get()));
+          CHECK(module->getFunction(name + "_0"));
+          CHECK(module->getFunction(name + "_1"));
+
+          rellic::DecompilationOptions options;
+          options.remove_phi_nodes = true;
+          auto result{
+              rellic::Decompile(std::move(module), std::move(options))};
+          REQUIRE(result.Succeeded());
+          CHECK(result.TakeValue().function_errors.empty());
+        }
+      }
+    }
+  }
+
+  SCENARIO("Generate synthetic type graphs") {
+    GIVEN("A module with debug info for each type graph") {
+      THEN("every module is well formed and its declarations are generated") {
+        for (auto graph : rellic::GetSyntheticTypeGraphs()) {
+          std::string name{rellic::GetSyntheticTypeGraphName(graph)};
+          INFO("Graph: ", name);
+          llvm::LLVMContext llvm_ctx;
+          auto module{rellic::CreateSyntheticTypeModule(llvm_ctx, graph, 4)};
+          CHECK(rellic::VerifyModule(module.get()));
+
+          rellic::DebugInfoCollector dic;
+          dic.visit(*module);
+          CHECK(dic.GetTypes().size() >= 4);
+          CHECK(!dic.GetSubprograms().empty());
+
+          std::vector<std::string> args{"-target", module->getTargetTriple()};
+          auto ast_unit{
+              clang::tooling::buildASTFromCodeWithArgs("", args, "out.c")};
+          rellic::StructGenerator strctgen(*ast_unit);
+          rellic::SubprogramGenerator subgen(*ast_unit, strctgen);
+          auto& types{dic.GetTypes()};
+          strctgen.GenerateDecls(types.begin(), types.end());
+          for (auto subprogram : dic.GetSubprograms()) {
+            subgen.VisitSubprogram(subprogram);
+          }
+          auto tudecl{ast_unit->getASTContext().getTranslationUnitDecl()};
+          CHECK(tudecl->decls_begin() != tudecl->decls_end());
+        }
+      }
+    }
+  }
+
+  SCENARIO("Decode fuzzer inputs") {
+    GIVEN("Empty, short and long inputs") {
+      std::vector<std::vector<uint8_t>> inputs{
+          {},
+          {3, 1, 2, 0, 7},
+          std::vector<uint8_t>(512, 0xAB),
+      };
+      auto Print{[](llvm::Module& module) {
+        std::string text;
+        llvm::raw_string_ostream os(text);
+        module.print(os, nullptr);
+        return os.str();
+      }};
+      THEN("each decodes into the same well-formed, decompilable module") {
+        for (auto& input : inputs) {
+          INFO("Input size: ", input.size());
+          llvm::LLVMContext llvm_ctx;
+          auto module{rellic::CreateFuzzedModule(llvm_ctx, input)};
+          CHECK(rellic::VerifyModule(module.get()));
+          REQUIRE(module->getFunction("fuzzed"));
+          CHECK(Print(*module) ==
+                Print(*rellic::CreateFuzzedModule(llvm_ctx, input)));
+
+          auto result{rellic::Decompile(std::move(module))};
+          REQUIRE(result.Succeeded());
+        }
+      }
+    }
+  }
+}
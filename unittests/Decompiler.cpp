@@ -0,0 +1,1476 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Decompiler.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <doctest/doctest.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "rellic/BC/Util.h"
+#include "rellic/EventLog.h"
+#include "rellic/Forensics.h"
+
+static const char *module_text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @sum(i32 %n) {
+entry:
+  %i = alloca i32
+  %acc = alloca i32
+  store i32 0, i32* %i
+  store i32 0, i32* %acc
+  br label %cond
+
+cond:
+  %iv = load i32, i32* %i
+  %cmp = icmp slt i32 %iv, %n
+  br i1 %cmp, label %body, label %exit
+
+body:
+  %av = load i32, i32* %acc
+  %odd = and i32 %iv, 1
+  %skip = icmp eq i32 %odd, 0
+  br i1 %skip, label %next, label %add
+
+add:
+  %new = add i32 %av, %iv
+  store i32 %new, i32* %acc
+  br label %next
+
+next:
+  %inc = add i32 %iv, 1
+  store i32 %inc, i32* %i
+  br label %cond
+
+exit:
+  %res = load i32, i32* %acc
+  ret i32 %res
+}
+)"};
+
+// `atomicrmw` has no C equivalent, so `broken` cannot be decompiled
+static const char *broken_module_text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @broken(i32* %p) {
+entry:
+  %old = atomicrmw add i32* %p, i32 1 seq_cst
+  ret i32 %old
+}
+
+define i32 @twice(i32 %x) {
+entry:
+  %res = mul i32 %x, 2
+  ret i32 %res
+}
+)"};
+
+static const char *edited_module_text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @scale(i32 %x) {
+entry:
+  %res = mul i32 %x, 2
+  ret i32 %res
+}
+
+define i32 @call_scale(i32 %x) {
+entry:
+  %res = call i32 @scale(i32 %x)
+  ret i32 %res
+}
+
+define i32 @negate(i32 %x) {
+entry:
+  %res = sub i32 0, %x
+  ret i32 %res
+}
+)"};
+
+// `chain` only branches unconditionally, so its blocks are emitted in order
+static const char *straight_line_module_text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @chain(i32* %p, i32 %x) {
+entry:
+  store i32 %x, i32* %p
+  br label %middle
+
+middle:
+  %y = load i32, i32* %p
+  %z = add i32 %y, 1
+  store i32 %z, i32* %p
+  br label %exit
+
+exit:
+  %res = load i32, i32* %p
+  ret i32 %res
+}
+)"};
+
+// `fact_copy` only differs from `fact` in its names, and calls itself instead
+static const char *duplicated_module_text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @fact(i32 %n) {
+entry:
+  %cmp = icmp slt i32 %n, 2
+  br i1 %cmp, label %base, label %rec
+
+base:
+  ret i32 1
+
+rec:
+  %m = sub i32 %n, 1
+  %r = call i32 @fact(i32 %m)
+  %res = mul i32 %n, %r
+  ret i32 %res
+}
+
+define i32 @fact_copy(i32 %x) {
+entry:
+  %small = icmp slt i32 %x, 2
+  br i1 %small, label %one, label %more
+
+one:
+  ret i32 1
+
+more:
+  %y = sub i32 %x, 1
+  %z = call i32 @fact_copy(i32 %y)
+  %prod = mul i32 %x, %z
+  ret i32 %prod
+}
+)"};
+
+// `join1` and `join2` are reached whenever their dominator is
+static const char *diamond_module_text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+declare void @f(i32)
+
+define void @diamonds(i32 %a, i32 %b) {
+entry:
+  %c1 = icmp eq i32 %a, 0
+  br i1 %c1, label %then1, label %else1
+
+then1:
+  call void @f(i32 1)
+  br label %join1
+
+else1:
+  call void @f(i32 2)
+  br label %join1
+
+join1:
+  call void @f(i32 3)
+  %c2 = icmp eq i32 %b, 0
+  br i1 %c2, label %then2, label %join2
+
+then2:
+  call void @f(i32 4)
+  br label %join2
+
+join2:
+  call void @f(i32 5)
+  ret void
+}
+)"};
+
+// `acc.next` merges the values of `acc` at the end of the loop body, so both
+// PHI nodes can share a variable
+static const char *phi_module_text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @sum_odd(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %latch ]
+  %cmp = icmp slt i32 %i, %n
+  br i1 %cmp, label %body, label %exit
+
+body:
+  %odd = and i32 %i, 1
+  %skip = icmp eq i32 %odd, 0
+  br i1 %skip, label %latch, label %add
+
+add:
+  %sum = add i32 %acc, %i
+  br label %latch
+
+latch:
+  %acc.next = phi i32 [ %acc, %body ], [ %sum, %add ]
+  %i.next = add i32 %i, 1
+  br label %loop
+
+exit:
+  ret i32 %acc
+}
+)"};
+
+static const char *array_module_text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+define [2 x i32] @swap([2 x i32] %pair) {
+  %a = extractvalue [2 x i32] %pair, 0
+  %b = extractvalue [2 x i32] %pair, 1
+  %r0 = insertvalue [2 x i32] undef, i32 %b, 0
+  %r1 = insertvalue [2 x i32] %r0, i32 %a, 1
+  ret [2 x i32] %r1
+}
+
+define i32 @first(i32 %x) {
+  %p = call [2 x i32] @swap([2 x i32] [i32 1, i32 2])
+  %v = extractvalue [2 x i32] %p, 0
+  %r = add i32 %v, %x
+  ret i32 %r
+}
+)"};
+
+static const char *cleanup_module_text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @cleanup(i32 %x) {
+entry:
+  %slot = alloca i32
+  store i32 %x, i32* %slot
+  store i32 0, i32* %slot
+  %dead = add i32 %x, 1
+  %c = icmp eq i32 1, 1
+  br i1 %c, label %then, label %else
+
+then:
+  %a = mul i32 %x, 3
+  %b = mul i32 %x, 3
+  %r = add i32 %a, %b
+  ret i32 %r
+
+else:
+  ret i32 0
+}
+)"};
+
+// Only made of if-then-else, loop and switch patterns
+static const char *pattern_module_text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+declare void @f(i32)
+
+define i32 @patterns(i32 %n, i32 %k) {
+entry:
+  %neg = icmp slt i32 %n, 0
+  br i1 %neg, label %early, label %loop
+
+early:
+  ret i32 -1
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %inc, %latch ]
+  %cmp = icmp slt i32 %i, %n
+  br i1 %cmp, label %body, label %exit
+
+body:
+  switch i32 %k, label %other [
+    i32 0, label %zero
+    i32 1, label %one
+    i32 2, label %one
+  ]
+
+zero:
+  call void @f(i32 0)
+  br label %latch
+
+one:
+  call void @f(i32 1)
+  br label %latch
+
+other:
+  call void @f(i32 %i)
+  br label %latch
+
+latch:
+  %inc = add i32 %i, 1
+  br label %loop
+
+exit:
+  %odd = and i32 %n, 1
+  %is_odd = icmp eq i32 %odd, 1
+  br i1 %is_odd, label %then, label %else
+
+then:
+  call void @f(i32 2)
+  br label %join
+
+else:
+  call void @f(i32 3)
+  br label %join
+
+join:
+  ret i32 %i
+}
+)"};
+
+static size_t CountOccurrences(const std::string &str,
+                               const std::string &substr) {
+  size_t count{0};
+  for (auto pos{str.find(substr)}; pos != std::string::npos;
+       pos = str.find(substr, pos + substr.size())) {
+    ++count;
+  }
+  return count;
+}
+
+static std::string Print(rellic::DecompilationResult &result) {
+  std::string code;
+  llvm::raw_string_ostream os(code);
+  result.ast->getASTContext().getTranslationUnitDecl()->print(os);
+  return os.str();
+}
+
+// Decompiles `text` in a fresh LLVM context and returns the C code. The names
+// of the functions that could not be decompiled are added to `failed`.
+static std::string DecompileText(
+    std::string &error, const char *text = module_text,
+    std::vector<std::string> *failed = nullptr,
+    rellic::DecompilationOptions options = rellic::DecompilationOptions()) {
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module{
+      rellic::LoadModuleFromMemory(&llvm_ctx, text, true)};
+  if (!module) {
+    error = "Cannot parse module";
+    return "";
+  }
+
+  auto result{rellic::Decompile(std::move(module), std::move(options))};
+  if (!result.Succeeded()) {
+    error = result.TakeError().message;
+    return "";
+  }
+
+  auto value{result.TakeValue()};
+  for (auto &func_error : value.function_errors) {
+    if (failed) {
+      failed->push_back(func_error.function->getName().str());
+    }
+  }
+  return Print(value);
+}
+
+// Records the order in which the decompiler calls a type provider
+class RecordingTypeProvider : public rellic::TypeProvider {
+  std::vector<std::string> &calls;
+
+ public:
+  RecordingTypeProvider(rellic::DecompilationContext &dec_ctx,
+                        std::vector<std::string> &calls)
+      : TypeProvider(dec_ctx), calls(calls) {}
+
+  void Prefetch(llvm::Module &) override { calls.push_back("prefetch"); }
+
+  clang::QualType GetFunctionReturnType(llvm::Function &func) override {
+    calls.push_back("return " + func.getName().str());
+    return {};
+  }
+};
+
+class RecordingTypeProviderFactory : public rellic::TypeProviderFactory {
+  std::vector<std::string> &calls;
+
+ public:
+  RecordingTypeProviderFactory(std::vector<std::string> &calls)
+      : calls(calls) {}
+
+  std::unique_ptr<rellic::TypeProvider> create(
+      rellic::DecompilationContext &dec_ctx) override {
+    return std::make_unique<RecordingTypeProvider>(dec_ctx, calls);
+  }
+};
+
+static void CollectStmts(clang::Stmt *stmt,
+                         std::unordered_set<const clang::Stmt *> &stmts) {
+  if (!stmt || !stmts.insert(stmt).second) {
+    return;
+  }
+  for (auto child : stmt->children()) {
+    CollectStmts(child, stmts);
+  }
+}
+
+TEST_SUITE("Decompile") {
+  SCENARIO("Decompile modules concurrently") {
+    GIVEN("A module decompiled on a single thread") {
+      std::string error;
+      auto expected{DecompileText(error)};
+      REQUIRE(error.empty());
+      REQUIRE(!expected.empty());
+      THEN("concurrent calls in separate contexts produce the same code") {
+        constexpr unsigned num_threads{4};
+        std::vector<std::string> codes(num_threads);
+        std::vector<std::string> errors(num_threads);
+        std::vector<std::thread> threads;
+        for (unsigned i{0}; i < num_threads; ++i) {
+          threads.emplace_back(
+              [&, i]() { codes[i] = DecompileText(errors[i]); });
+        }
+        for (auto &thread : threads) {
+          thread.join();
+        }
+
+        for (unsigned i{0}; i < num_threads; ++i) {
+          CHECK(errors[i].empty());
+          CHECK(codes[i] == expected);
+        }
+      }
+    }
+  }
+
+  SCENARIO("Decompile identical modules to identical code") {
+    GIVEN("Modules decompiled on one thread and on several") {
+      std::hash<std::string> hash;
+      std::vector<const char *> texts{module_text, duplicated_module_text};
+      THEN("decompiling them again produces the same code") {
+        for (auto text : texts) {
+          for (unsigned threads{1}; threads <= 2; ++threads) {
+            auto options{[threads]() {
+              rellic::DecompilationOptions options;
+              options.simplify_threads = threads;
+              options.prove_threads = threads;
+              return options;
+            }};
+            std::string error;
+            auto expected{
+                hash(DecompileText(error, text, nullptr, options()))};
+            REQUIRE(error.empty());
+            // Allocations of different sizes in between move the nodes of the
+            // following decompilations to other addresses, so that iterating
+            // over containers keyed by pointer shows up in the output
+            std::vector<std::vector<char>> padding;
+            for (unsigned i{1}; i <= 3; ++i) {
+              padding.emplace_back(i * 4096 + i * 24);
+              auto code{DecompileText(error, text, nullptr, options())};
+              REQUIRE(error.empty());
+              CHECK(hash(code) == expected);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  SCENARIO("Reuse the Z3 contexts of a decompilation session") {
+    GIVEN("A module decompiled without a session") {
+      std::string error;
+      auto expected{DecompileText(error, duplicated_module_text)};
+      REQUIRE(error.empty());
+      THEN("decompiling it repeatedly in a session produces the same code") {
+        rellic::Decompiler decompiler;
+        for (unsigned i{0}; i < 4; ++i) {
+          llvm::LLVMContext llvm_ctx;
+          std::unique_ptr<llvm::Module> module{
+              rellic::LoadModuleFromMemory(&llvm_ctx, duplicated_module_text,
+                                           true)};
+          REQUIRE(module);
+          rellic::DecompilationOptions options;
+          // Every other call computes reaching conditions on worker threads,
+          // which take contexts of their own from the pool
+          options.generate_threads = 1 + i % 2;
+          auto result{decompiler.Decompile(std::move(module),
+                                           std::move(options))};
+          REQUIRE(result.Succeeded());
+          auto value{result.TakeValue()};
+          CHECK(Print(value) == expected);
+        }
+      }
+    }
+  }
+
+  SCENARIO("Decompile a batch of modules") {
+    GIVEN("Two modules with the same function in separate contexts") {
+      llvm::LLVMContext first_ctx, second_ctx;
+      auto load{[&]() {
+        std::vector<std::unique_ptr<llvm::Module>> modules;
+        for (auto llvm_ctx : {&first_ctx, &second_ctx}) {
+          modules.emplace_back(
+              rellic::LoadModuleFromMemory(llvm_ctx, module_text, true));
+          REQUIRE(modules.back() != nullptr);
+        }
+        return modules;
+      }};
+      std::string error;
+      auto expected{DecompileText(error)};
+      REQUIRE(error.empty());
+      THEN("every module gets a result of its own, in order") {
+        auto results{rellic::DecompileMany(load(), {}, 2)};
+        REQUIRE(results.size() == 2);
+        for (auto &result : results) {
+          REQUIRE(result.Succeeded());
+          auto value{result.TakeValue()};
+          CHECK(Print(value) == expected);
+        }
+      }
+      THEN("a streamed definition is only decompiled once") {
+        std::vector<std::string> definitions;
+        rellic::DecompilationOptions options;
+        options.on_definition = [&](const llvm::Function &func,
+                                    llvm::StringRef code) {
+          definitions.push_back(code.str());
+        };
+        rellic::Decompiler decompiler;
+        auto results{decompiler.DecompileMany(load(), std::move(options))};
+        REQUIRE(results.size() == 2);
+        std::vector<size_t> num_bodies;
+        for (auto &result : results) {
+          REQUIRE(result.Succeeded());
+          auto value{result.TakeValue()};
+          num_bodies.push_back(0);
+          auto &ast_ctx{value.ast->getASTContext()};
+          for (auto decl : ast_ctx.getTranslationUnitDecl()->decls()) {
+            auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+            num_bodies.back() += fdecl && fdecl->doesThisDeclarationHaveABody();
+          }
+        }
+        REQUIRE(definitions.size() == 2);
+        CHECK(definitions[0] == definitions[1]);
+        CHECK(num_bodies == std::vector<size_t>{1, 0});
+      }
+    }
+  }
+
+  SCENARIO("Decompile a module with a function that cannot be decompiled") {
+    GIVEN("A module with an unsupported instruction in one definition") {
+      std::string error;
+      std::vector<std::string> failed;
+      auto code{DecompileText(error, broken_module_text, &failed)};
+      THEN("the rest of the module is decompiled") {
+        REQUIRE(error.empty());
+        CHECK(code.find("twice(") != std::string::npos);
+        CHECK(code.find('{') != std::string::npos);
+      }
+      THEN("the failing definition is reported and only declared") {
+        REQUIRE(failed.size() == 1);
+        CHECK(failed[0] == "broken");
+        CHECK(code.find("broken(") != std::string::npos);
+      }
+    }
+  }
+
+  SCENARIO("Decompile a straight-line function") {
+    GIVEN("A function whose blocks end in unconditional branches") {
+      std::string error;
+      std::vector<std::string> failed;
+      auto code{DecompileText(error, straight_line_module_text, &failed)};
+      REQUIRE(error.empty());
+      REQUIRE(failed.empty());
+      THEN("its blocks are emitted in order without any control flow") {
+        CHECK(code.find("if (") == std::string::npos);
+        CHECK(code.find("goto") == std::string::npos);
+        CHECK(CountOccurrences(code, "return") == 1);
+      }
+      THEN("structuring it on worker threads produces the same code") {
+        rellic::DecompilationOptions options;
+        options.generate_threads = 2;
+        auto parallel{DecompileText(error, straight_line_module_text, &failed,
+                                    std::move(options))};
+        REQUIRE(error.empty());
+        CHECK(parallel == code);
+      }
+    }
+  }
+
+  SCENARIO("Compute reaching conditions on worker threads") {
+    GIVEN("A module with several definitions") {
+      std::string error;
+      auto expected{DecompileText(error, duplicated_module_text)};
+      REQUIRE(error.empty());
+      THEN("structuring them in parallel produces the same code") {
+        rellic::DecompilationOptions options;
+        options.generate_threads = 2;
+        std::vector<std::string> failed;
+        auto code{DecompileText(error, duplicated_module_text, &failed,
+                                std::move(options))};
+        REQUIRE(error.empty());
+        CHECK(failed.empty());
+        CHECK(code == expected);
+      }
+    }
+
+    GIVEN("A module with a definition that cannot be decompiled") {
+      rellic::DecompilationOptions options;
+      options.generate_threads = 2;
+      std::string error;
+      std::vector<std::string> failed;
+      auto code{DecompileText(error, broken_module_text, &failed,
+                              std::move(options))};
+      THEN("only the failing definition is dropped") {
+        REQUIRE(error.empty());
+        REQUIRE(failed.size() == 1);
+        CHECK(failed[0] == "broken");
+        CHECK(code.find("twice(") != std::string::npos);
+      }
+    }
+  }
+
+  SCENARIO("Decide the proofs of refinement passes on worker threads") {
+    GIVEN("A module with several definitions") {
+      std::string error;
+      auto expected{DecompileText(error, duplicated_module_text)};
+      REQUIRE(error.empty());
+      THEN("proving ahead of each traversal produces the same code") {
+        rellic::DecompilationOptions options;
+        options.prove_threads = 2;
+        std::vector<std::string> failed;
+        auto code{DecompileText(error, duplicated_module_text, &failed,
+                                std::move(options))};
+        REQUIRE(error.empty());
+        CHECK(failed.empty());
+        CHECK(code == expected);
+      }
+    }
+  }
+
+  SCENARIO("Coalesce the variables of PHI nodes") {
+    GIVEN("A function with a PHI node whose incoming value is a PHI node") {
+      std::string error;
+      auto expected{DecompileText(error, phi_module_text)};
+      REQUIRE(error.empty());
+      THEN("fewer variables are declared for the PHI nodes") {
+        rellic::DecompilationOptions options;
+        options.coalesce_phi_nodes = true;
+        std::vector<std::string> failed;
+        auto code{DecompileText(error, phi_module_text, &failed,
+                                std::move(options))};
+        REQUIRE(error.empty());
+        CHECK(failed.empty());
+        CHECK(CountOccurrences(code, "int phi") <
+              CountOccurrences(expected, "int phi"));
+      }
+    }
+  }
+
+  SCENARIO("Record the events of a decompilation") {
+    GIVEN("A module with several definitions") {
+      std::vector<rellic::EventLog::Event> events;
+      auto MakeLog = [&events](rellic::EventLevel level) {
+        return std::make_shared<rellic::EventLog>(
+            [&events](const std::vector<rellic::EventLog::Event> &batch) {
+              events.insert(events.end(), batch.begin(), batch.end());
+            },
+            level, 4);
+      };
+
+      THEN("debug events name the passes that ran") {
+        rellic::DecompilationOptions options;
+        auto log{MakeLog(rellic::EventLevel::Debug)};
+        options.event_log = log;
+        std::string error;
+        DecompileText(error, duplicated_module_text, nullptr,
+                      std::move(options));
+        REQUIRE(error.empty());
+        log->Flush();
+        CHECK(std::any_of(events.begin(), events.end(), [](auto &event) {
+          return event.level == rellic::EventLevel::Debug &&
+                 event.name == "mc";
+        }));
+        for (size_t i{1}; i < events.size(); ++i) {
+          CHECK(events[i - 1].time <= events[i].time);
+        }
+      }
+
+      THEN("events below the level are dropped") {
+        rellic::DecompilationOptions options;
+        options.deduplicate_functions = true;
+        auto log{MakeLog(rellic::EventLevel::Info)};
+        options.event_log = log;
+        std::string error;
+        DecompileText(error, duplicated_module_text, nullptr,
+                      std::move(options));
+        REQUIRE(error.empty());
+        log->Flush();
+        REQUIRE(events.size() == 1);
+        CHECK(events[0].name == "deduplicate");
+      }
+    }
+  }
+
+  SCENARIO("Decompile a module with structurally identical functions") {
+    GIVEN("A module with two identical definitions") {
+      std::string error;
+      auto expected{DecompileText(error, duplicated_module_text)};
+      REQUIRE(error.empty());
+      THEN("decompiling them only once produces the same code") {
+        rellic::DecompilationOptions options;
+        options.deduplicate_functions = true;
+        std::vector<std::string> failed;
+        auto code{DecompileText(error, duplicated_module_text, &failed,
+                                std::move(options))};
+        REQUIRE(error.empty());
+        CHECK(failed.empty());
+        CHECK(code == expected);
+      }
+    }
+  }
+
+  SCENARIO("Decompile a module again after editing a function") {
+    GIVEN("A decompiled module") {
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, edited_module_text, true)};
+      REQUIRE(module);
+      rellic::DecompilationOptions options;
+      options.provenance_maps = true;
+      auto result{rellic::Decompile(std::move(module), options)};
+      REQUIRE(result.Succeeded());
+      auto previous{result.TakeValue()};
+      auto negate{previous.module->getFunction("negate")};
+      REQUIRE(previous.value_decls.Lookup(negate));
+
+      WHEN("a function is edited and the module is decompiled again") {
+        auto scale{previous.module->getFunction("scale")};
+        auto &mul{scale->getEntryBlock().front()};
+        mul.setOperand(1, llvm::ConstantInt::get(mul.getType(), 7));
+        auto redecompiled{
+            rellic::Redecompile(std::move(previous), {scale}, options)};
+        REQUIRE(redecompiled.Succeeded());
+        auto value{redecompiled.TakeValue()};
+        auto code{Print(value)};
+        THEN("the edited function is decompiled again") {
+          CHECK(code.find('7') != std::string::npos);
+          CHECK(code.find("call_scale(") != std::string::npos);
+        }
+        THEN("the other definitions are kept") {
+          auto fdefn{llvm::dyn_cast_or_null<clang::FunctionDecl>(
+              value.value_decls.Lookup(negate))};
+          REQUIRE(fdefn);
+          CHECK(fdefn->doesThisDeclarationHaveABody());
+          CHECK(&fdefn->getASTContext() == &value.ast->getASTContext());
+          CHECK(value.function_errors.empty());
+        }
+      }
+    }
+  }
+
+  SCENARIO("Keep the provenance of the final AST only") {
+    GIVEN("A module with loops and conditions") {
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+      REQUIRE(module);
+      rellic::DecompilationOptions options;
+      options.provenance_maps = true;
+      auto result{rellic::Decompile(std::move(module), options)};
+      REQUIRE(result.Succeeded());
+      auto value{result.TakeValue()};
+      THEN("every statement with provenance is part of a definition") {
+        std::unordered_set<const clang::Stmt *> stmts;
+        auto tudecl{value.ast->getASTContext().getTranslationUnitDecl()};
+        for (auto decl : tudecl->decls()) {
+          if (auto fdecl = clang::dyn_cast<clang::FunctionDecl>(decl)) {
+            CollectStmts(fdecl->getBody(), stmts);
+          }
+        }
+        REQUIRE(!value.stmt_provenance.Forward().empty());
+        for (auto [stmt, val] : value.stmt_provenance.Forward()) {
+          CHECK(stmts.count(stmt));
+        }
+        for (auto [expr, use] : value.use_provenance.Forward()) {
+          CHECK(stmts.count(expr));
+        }
+      }
+    }
+  }
+
+  SCENARIO("Compact the final AST") {
+    GIVEN("A module with loops and conditions") {
+      std::string error;
+      auto expected{DecompileText(error)};
+      REQUIRE(error.empty());
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+      REQUIRE(module);
+      rellic::DecompilationOptions options;
+      options.provenance_maps = true;
+      options.compact_ast = true;
+      auto result{rellic::Decompile(std::move(module), options)};
+      REQUIRE(result.Succeeded());
+      auto value{result.TakeValue()};
+      THEN("the compacted AST produces the same code") {
+        CHECK(Print(value) == expected);
+      }
+      THEN("the provenance refers to the compacted AST") {
+        std::unordered_set<const clang::Stmt *> stmts;
+        auto tudecl{value.ast->getASTContext().getTranslationUnitDecl()};
+        for (auto decl : tudecl->decls()) {
+          if (auto fdecl = clang::dyn_cast<clang::FunctionDecl>(decl)) {
+            CollectStmts(fdecl->getBody(), stmts);
+          }
+        }
+        REQUIRE(!value.stmt_provenance.Forward().empty());
+        for (auto [stmt, val] : value.stmt_provenance.Forward()) {
+          CHECK(stmts.count(stmt));
+        }
+        REQUIRE(!value.value_decls.Forward().empty());
+        for (auto [val, decl] : value.value_decls.Forward()) {
+          CHECK(&decl->getASTContext() == &value.ast->getASTContext());
+        }
+      }
+    }
+  }
+
+  SCENARIO("Drop the module of the result") {
+    GIVEN("A module with loops and conditions") {
+      std::string error;
+      auto expected{DecompileText(error)};
+      REQUIRE(error.empty());
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+      REQUIRE(module);
+      rellic::DecompilationOptions options;
+      options.keep_module = false;
+      THEN("the result only holds the AST") {
+        auto result{rellic::Decompile(std::move(module), std::move(options))};
+        REQUIRE(result.Succeeded());
+        auto value{result.TakeValue()};
+        CHECK(!value.module);
+        CHECK(Print(value) == expected);
+      }
+      THEN("provenance maps cannot be requested") {
+        options.provenance_maps = true;
+        auto result{rellic::Decompile(std::move(module), std::move(options))};
+        CHECK(!result.Succeeded());
+      }
+    }
+  }
+
+  SCENARIO("Count the queries of each call site") {
+    GIVEN("A module with loops and conditions") {
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+      REQUIRE(module);
+      auto result{rellic::Decompile(std::move(module))};
+      REQUIRE(result.Succeeded());
+      auto value{result.TakeValue()};
+      THEN("the queries are split by call site") {
+        auto &sites{value.statistics.prover.sites};
+        auto it{sites.find("GenerateAST::GetOrCreateEdgeCond")};
+        REQUIRE(it != sites.end());
+        CHECK(it->second[rellic::QueryKind::Rewrite].num_queries > 0);
+        CHECK(it->second[rellic::QueryKind::Ordering].num_queries > 0);
+
+        size_t num_proofs{0};
+        for (auto &[name, site] : sites) {
+          auto &proofs{site[rellic::QueryKind::Proof]};
+          num_proofs += proofs.num_queries;
+          size_t num_latencies{0};
+          for (auto count : proofs.latency) {
+            num_latencies += count;
+          }
+          CHECK(num_latencies == proofs.num_queries);
+          CHECK(proofs.max_nodes * proofs.num_z3 >= proofs.num_nodes);
+        }
+        CHECK(num_proofs == value.statistics.prover.num_proofs);
+      }
+    }
+  }
+
+  SCENARIO("Count the attempts and fires of each inference rule") {
+    GIVEN("A module with a loop") {
+      auto Decompile{[](bool rule_timing) {
+        llvm::LLVMContext llvm_ctx;
+        std::unique_ptr<llvm::Module> module{
+            rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+        REQUIRE(module);
+        rellic::DecompilationOptions options;
+        options.rule_timing = rule_timing;
+        auto result{rellic::Decompile(std::move(module), std::move(options))};
+        REQUIRE(result.Succeeded());
+        auto value{result.TakeValue()};
+        return std::make_pair(Print(value), value.statistics.rules);
+      }};
+      auto [code, rules]{Decompile(false)};
+      THEN("the loop rules are tried on it") {
+        auto it{rules.find("WhileRule")};
+        REQUIRE(it != rules.end());
+        CHECK(it->second.num_attempts > 0);
+        for (auto &[name, rule] : rules) {
+          CHECK(rule.num_fires <= rule.num_matches);
+          CHECK(rule.num_matches <= rule.num_attempts);
+          CHECK(rule.match_elapsed.count() == 0);
+        }
+      }
+      THEN("timing the rules does not change the code") {
+        auto [timed_code, timed_rules]{Decompile(true)};
+        CHECK(timed_code == code);
+        auto it{timed_rules.find("WhileRule")};
+        REQUIRE(it != timed_rules.end());
+        CHECK(it->second.num_attempts == rules.at("WhileRule").num_attempts);
+        CHECK(it->second.match_elapsed.count() > 0);
+      }
+    }
+  }
+
+  SCENARIO("Attribute the allocations of a decompilation to its passes") {
+    GIVEN("A module with loops and conditions") {
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+      REQUIRE(module);
+      auto result{rellic::Decompile(std::move(module))};
+      REQUIRE(result.Succeeded());
+      auto value{result.TakeValue()};
+      auto &stages{value.statistics.stages};
+      REQUIRE(!stages.empty());
+      THEN("generating the AST allocates nodes and conditions") {
+        auto &generate{stages.front()};
+        REQUIRE(generate.name == "generate");
+        CHECK(generate.stats.ast_bytes > 0);
+        CHECK(generate.stats.ast_nodes > 0);
+        CHECK(generate.stats.z3_exprs > 0);
+      }
+      THEN("stages allocate at least as much as their passes") {
+        for (auto &stage : stages) {
+          uint64_t ast_nodes{0};
+          for (auto &pass : stage.passes) {
+            ast_nodes += pass.stats.ast_nodes;
+          }
+          CHECK(stage.stats.ast_nodes >= ast_nodes);
+        }
+      }
+    }
+  }
+
+  SCENARIO("Take the reaching conditions of joins from their dominator") {
+    GIVEN("A function made of diamonds") {
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, diamond_module_text, true)};
+      REQUIRE(module);
+      auto result{rellic::Decompile(std::move(module))};
+      REQUIRE(result.Succeeded());
+      auto value{result.TakeValue()};
+      THEN("only the branches simplify their reaching conditions") {
+        auto &sites{value.statistics.prover.sites};
+        auto it{sites.find("GenerateAST::CreateReachingCond")};
+        REQUIRE(it != sites.end());
+        // A conjunction and a disjunction for each of `then1`, `else1` and
+        // `then2`
+        CHECK(it->second[rellic::QueryKind::Simplification].num_queries == 6);
+      }
+    }
+  }
+
+  SCENARIO("Abstract the reaching conditions of region entries") {
+    GIVEN("A module with loops and conditions") {
+      THEN("the abstracted conditions are expanded in the output") {
+        rellic::DecompilationOptions options;
+        options.reach_var_size = 1;
+        std::string error;
+        std::vector<std::string> failed;
+        auto code{
+            DecompileText(error, module_text, &failed, std::move(options))};
+        REQUIRE(error.empty());
+        CHECK(failed.empty());
+        CHECK(!code.empty());
+      }
+    }
+  }
+
+  SCENARIO("Structure large regions as units") {
+    GIVEN("Functions whose regions are larger than the unit size") {
+      THEN("structuring them in units produces valid code") {
+        for (auto text : {module_text, diamond_module_text}) {
+          for (unsigned threads : {1U, 2U}) {
+            rellic::DecompilationOptions options;
+            options.region_unit_size = 2;
+            options.generate_threads = threads;
+            std::string error;
+            std::vector<std::string> failed;
+            auto code{DecompileText(error, text, &failed, std::move(options))};
+            REQUIRE(error.empty());
+            CHECK(failed.empty());
+            CHECK(!code.empty());
+          }
+        }
+      }
+      THEN("computing the conditions of units on worker threads produces "
+           "valid code") {
+        for (auto text : {module_text, diamond_module_text}) {
+          rellic::DecompilationOptions options;
+          options.region_unit_size = 2;
+          options.unit_threads = 2;
+          std::string error;
+          std::vector<std::string> failed;
+          auto code{DecompileText(error, text, &failed, std::move(options))};
+          REQUIRE(error.empty());
+          CHECK(failed.empty());
+          CHECK(!code.empty());
+        }
+      }
+    }
+  }
+
+  SCENARIO("Decompile a module in shards") {
+    GIVEN("A module with three definitions") {
+      // Decompiles one shard of the module, returning its declarations and
+      // the names of its definitions
+      auto decompile_shard{[](unsigned index, unsigned count,
+                              std::vector<std::string> &defined) {
+        llvm::LLVMContext llvm_ctx;
+        std::unique_ptr<llvm::Module> module{rellic::LoadModuleFromMemory(
+            &llvm_ctx, edited_module_text, true)};
+        REQUIRE(module != nullptr);
+        std::string declarations;
+        rellic::DecompilationOptions options;
+        options.shard_index = index;
+        options.num_shards = count;
+        options.on_declarations = [&](llvm::StringRef code) {
+          declarations = code.str();
+        };
+        options.on_definition = [&](const llvm::Function &func,
+                                    llvm::StringRef code) {
+          defined.push_back(func.getName().str());
+        };
+        auto result{rellic::Decompile(std::move(module), std::move(options))};
+        REQUIRE(result.Succeeded());
+        return declarations;
+      }};
+
+      std::vector<std::string> all, first, second;
+      auto whole{decompile_shard(0, 1, all)};
+      auto declarations{decompile_shard(0, 2, first)};
+      THEN("definitions are dealt to the shards in module order") {
+        CHECK(all == std::vector<std::string>{"scale", "call_scale", "negate"});
+        CHECK(first == std::vector<std::string>{"scale", "negate"});
+        CHECK(decompile_shard(1, 2, second) == declarations);
+        CHECK(second == std::vector<std::string>{"call_scale"});
+      }
+      THEN("the declarations are those of the whole module") {
+        CHECK(declarations == whole);
+      }
+    }
+  }
+
+  SCENARIO("Release the definitions that have been streamed") {
+    GIVEN("A module with structurally identical functions") {
+      // Streams the definitions of the module and returns their code, along
+      // with the number of definitions left in the resulting AST
+      auto stream{[](bool release, size_t &num_bodies) {
+        llvm::LLVMContext llvm_ctx;
+        std::unique_ptr<llvm::Module> module{rellic::LoadModuleFromMemory(
+            &llvm_ctx, duplicated_module_text, true)};
+        REQUIRE(module != nullptr);
+        std::string code;
+        rellic::DecompilationOptions options;
+        options.deduplicate_functions = true;
+        options.release_streamed_definitions = release;
+        options.on_definition = [&](const llvm::Function &func,
+                                    llvm::StringRef defn) {
+          code += defn.str();
+        };
+        auto result{rellic::Decompile(std::move(module), std::move(options))};
+        REQUIRE(result.Succeeded());
+        auto value{result.TakeValue()};
+        num_bodies = 0;
+        auto &ast_ctx{value.ast->getASTContext()};
+        for (auto decl : ast_ctx.getTranslationUnitDecl()->decls()) {
+          auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+          num_bodies += fdecl && fdecl->doesThisDeclarationHaveABody();
+        }
+        return code;
+      }};
+
+      size_t kept, released;
+      auto expected{stream(false, kept)};
+      auto code{stream(true, released)};
+      THEN("the same code is streamed") { CHECK(code == expected); }
+      THEN("only the representatives of duplicates keep their body") {
+        CHECK(kept == 2);
+        CHECK(released == 1);
+      }
+    }
+  }
+
+  SCENARIO("Name unnamed declarations after their number") {
+    GIVEN("A module with unnamed globals and locals") {
+      std::string error;
+      auto code{DecompileText(error, R"(
+target triple = "x86_64-pc-linux-gnu"
+
+@0 = global i32 1
+@1 = global i32 2
+@2 = global i32 3
+
+define i32 @get() {
+entry:
+  %a = alloca i32
+  %b = alloca i32
+  store i32 4, i32* %a
+  store i32 5, i32* %b
+  %x = load i32, i32* %a
+  %y = load i32, i32* %b
+  %s = add i32 %x, %y
+  ret i32 %s
+}
+)")};
+      REQUIRE(error.empty());
+      THEN("each declaration gets the next number of its context") {
+        CHECK(code.find("gvar0") != std::string::npos);
+        CHECK(code.find("gvar1") != std::string::npos);
+        CHECK(code.find("gvar2") != std::string::npos);
+        CHECK(code.find("int var0") != std::string::npos);
+        CHECK(code.find("int var1") != std::string::npos);
+      }
+    }
+  }
+
+  SCENARIO("Initialize large data tables with a blob") {
+    GIVEN("A module with a large and a small array of integers") {
+      static const char *text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+@table = global [4 x i32] [i32 1, i32 2, i32 258, i32 -1], align 16
+@small = global [2 x i16] [i16 1, i16 2]
+
+define i32 @get() {
+entry:
+  %p = getelementptr [4 x i32], [4 x i32]* @table, i64 0, i64 2
+  %v = load i32, i32* %p
+  ret i32 %v
+}
+)"};
+      rellic::DecompilationOptions options;
+      options.blob_initializer_size = 16;
+      std::string error;
+      auto code{DecompileText(error, text, nullptr, std::move(options))};
+      REQUIRE(error.empty());
+      THEN("only the large array is a string of its bytes") {
+        CHECK(code.find("unsigned char table[16]") != std::string::npos);
+        CHECK(code.find("aligned(16") != std::string::npos);
+        CHECK(code.find("\"\\001\\000\\000\\000\\002\\000\\000\\000"
+                        "\\002\\001\\000\\000\\377\\377\\377\\377\"") !=
+              std::string::npos);
+        CHECK(code.find("small[2] = {") != std::string::npos);
+      }
+      THEN("uses of the array access it with its original type") {
+        CHECK(code.find("(*)[4])&table") != std::string::npos);
+      }
+    }
+  }
+
+  SCENARIO("Prefetch the types of a module") {
+    GIVEN("A type provider that records its calls") {
+      std::vector<std::string> calls;
+      rellic::DecompilationOptions options;
+      options.additional_providers.push_back(
+          std::make_unique<RecordingTypeProviderFactory>(calls));
+      std::string error;
+      DecompileText(error, module_text, nullptr, std::move(options));
+      REQUIRE(error.empty());
+      THEN("the module is prefetched once, before any query") {
+        REQUIRE(calls.size() > 1);
+        CHECK(calls[0] == "prefetch");
+        CHECK(std::count(calls.begin(), calls.end(), "prefetch") == 1);
+      }
+    }
+  }
+
+  SCENARIO("Estimate the cost of function definitions") {
+    GIVEN("A module with a loop") {
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+      REQUIRE(module != nullptr);
+      auto size{rellic::MeasureFunction(*module->getFunction("sum"))};
+      THEN("the control flow graph is measured") {
+        CHECK(size.blocks == 6);
+        CHECK(size.edges == 7);
+        CHECK(size.loop_depth == 1);
+        CHECK(size.switch_cases == 0);
+        // `next` is reached by two paths, the other blocks by one
+        CHECK(size.cond_terms == 7);
+        CHECK(size.Cost() == 27);
+      }
+      THEN("the measures are reported with the time taken by each function") {
+        rellic::DecompilationOptions options;
+        options.num_threads = 2;
+        auto result{rellic::Decompile(std::move(module), std::move(options))};
+        REQUIRE(result.Succeeded());
+        auto functions{result.TakeValue().statistics.functions};
+        REQUIRE(functions.size() == 1);
+        CHECK(functions[0].name == "sum");
+        CHECK(functions[0].size.Cost() == size.Cost());
+        CHECK(functions[0].elapsed.count() > 0);
+      }
+    }
+  }
+
+  SCENARIO("Load a module from a memory buffer") {
+    GIVEN("The text of a module") {
+      std::string text{module_text};
+      THEN("the module does not refer to the buffer once loaded") {
+        llvm::LLVMContext llvm_ctx;
+        std::unique_ptr<llvm::Module> module{rellic::LoadModuleFromMemory(
+            &llvm_ctx, llvm::MemoryBufferRef(text, "buffer"), true)};
+        REQUIRE(module != nullptr);
+        text.assign(text.size(), ' ');
+        CHECK(module->getFunction("sum") != nullptr);
+        auto result{rellic::Decompile(std::move(module))};
+        CHECK(result.Succeeded());
+      }
+    }
+  }
+
+  SCENARIO("Convert the array arguments of functions") {
+    GIVEN("A function taking and returning an array, and one calling it") {
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, array_module_text, true)};
+      REQUIRE(module != nullptr);
+      auto first{module->getFunction("first")};
+      rellic::ConvertArrayArguments(*module);
+      THEN("only the function with arrays in its signature is replaced") {
+        CHECK(module->getFunction("first") == first);
+        auto swap{module->getFunction("swap")};
+        REQUIRE(swap != nullptr);
+        CHECK(!swap->isDeclaration());
+        CHECK(swap->getReturnType()->isStructTy());
+        CHECK(swap->getArg(0)->getType()->isStructTy());
+        CHECK(swap->getArg(0)->getName() == "pair");
+        CHECK(module->size() == 2);
+      }
+      THEN("the module can be decompiled") {
+        auto result{rellic::Decompile(std::move(module))};
+        CHECK(result.Succeeded());
+      }
+    }
+  }
+
+  SCENARIO("Clean up a module before decompiling it") {
+    GIVEN("A function with dead code and a constant branch") {
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, cleanup_module_text, true)};
+      REQUIRE(module != nullptr);
+      auto func{module->getFunction("cleanup")};
+      auto num_insts{func->getInstructionCount()};
+      WHEN("the cleanup passes run") {
+        rellic::PreprocessOptions options;
+        options.pre_opt = 2;
+        rellic::PreprocessModule(*module, options);
+        THEN("the branch is folded and the dead code removed") {
+          CHECK(rellic::VerifyModule(module.get()));
+          CHECK(func->size() == 1);
+          CHECK(func->getInstructionCount() < num_insts);
+        }
+      }
+      WHEN("the module is decompiled with them") {
+        rellic::DecompilationOptions options;
+        options.pre_opt = 2;
+        auto result{rellic::Decompile(std::move(module), std::move(options))};
+        THEN("decompilation succeeds") {
+          REQUIRE(result.Succeeded());
+          CHECK(result.TakeValue().function_errors.empty());
+        }
+      }
+    }
+  }
+
+  SCENARIO("Decompile a module asynchronously") {
+    GIVEN("An executor that queues the jobs it is given") {
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+      REQUIRE(module != nullptr);
+      std::vector<std::function<void()>> queue;
+      auto job{rellic::DecompileAsync(std::move(module), {},
+                                      [&](std::function<void()> task) {
+                                        queue.push_back(std::move(task));
+                                      })};
+      REQUIRE(queue.size() == 1);
+      CHECK(!job.IsReady());
+
+      WHEN("the job is run") {
+        queue[0]();
+        THEN("its result is ready") {
+          REQUIRE(job.IsReady());
+          CHECK(job.GetProgress().stage == "done");
+          auto result{job.Get()};
+          REQUIRE(result.Succeeded());
+          auto value{result.TakeValue()};
+          CHECK(Print(value).find("sum") != std::string::npos);
+        }
+      }
+
+      WHEN("the job is cancelled before it runs") {
+        job.Cancel();
+        queue[0]();
+        THEN("it fails") {
+          auto result{job.Get()};
+          REQUIRE(!result.Succeeded());
+          CHECK(result.TakeError().message == "Decompilation was cancelled");
+          CHECK(job.GetToken()->IsCancelled());
+        }
+      }
+    }
+
+    GIVEN("No executor") {
+      rellic::Decompiler decompiler;
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+      REQUIRE(module != nullptr);
+      THEN("the job runs on a thread of its own") {
+        auto job{decompiler.DecompileAsync(std::move(module))};
+        job.Wait();
+        CHECK(job.Get().Succeeded());
+      }
+    }
+  }
+  SCENARIO("Structure control flow with patterns") {
+    GIVEN("A function made of conditionals, a loop and a switch") {
+      rellic::DecompilationOptions options;
+      options.structuring = rellic::StructuringEngine::Patterns;
+      std::string error;
+      std::vector<std::string> failed;
+      auto code{DecompileText(error, pattern_module_text, &failed,
+                              std::move(options))};
+      REQUIRE(error.empty());
+      REQUIRE(failed.empty());
+      THEN("it is structured without gotos") {
+        CHECK(code.find("goto") == std::string::npos);
+        CHECK(code.find("switch (") != std::string::npos);
+        CHECK(code.find("else") != std::string::npos);
+      }
+    }
+    GIVEN("Functions that go through every kind of region") {
+      THEN("the regions that do not match fall back on reaching conditions") {
+        for (auto text : {module_text, diamond_module_text, phi_module_text}) {
+          rellic::DecompilationOptions options;
+          options.structuring = rellic::StructuringEngine::Patterns;
+          options.generate_threads = 2;
+          std::string error;
+          std::vector<std::string> failed;
+          auto code{DecompileText(error, text, &failed, std::move(options))};
+          REQUIRE(error.empty());
+          CHECK(failed.empty());
+          CHECK(code.find("goto") == std::string::npos);
+        }
+      }
+    }
+  }
+
+  SCENARIO("Capture the functions over a forensics threshold") {
+    GIVEN("A function that calls another one") {
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, edited_module_text, true)};
+      REQUIRE(module != nullptr);
+      THEN("it is extracted with a declaration of its callee only") {
+        auto extracted{rellic::ExtractFunction(
+            *module, *module->getFunction("call_scale"))};
+        auto call_scale{extracted->getFunction("call_scale")};
+        REQUIRE(call_scale != nullptr);
+        CHECK(!call_scale->isDeclaration());
+        auto scale{extracted->getFunction("scale")};
+        REQUIRE(scale != nullptr);
+        CHECK(scale->isDeclaration());
+        CHECK(extracted->getFunction("negate") == nullptr);
+      }
+    }
+
+    GIVEN("A function with a loop") {
+      llvm::SmallString<128> directory;
+      REQUIRE(!llvm::sys::fs::createUniqueDirectory("rellic", directory));
+      auto Capture{[&](llvm::StringRef ext) {
+        llvm::SmallString<128> path(directory);
+        llvm::sys::path::append(path, "sum" + ext);
+        return path.str().str();
+      }};
+
+      WHEN("it is over the memory threshold") {
+        llvm::LLVMContext llvm_ctx;
+        std::unique_ptr<llvm::Module> module{
+            rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+        REQUIRE(module != nullptr);
+        rellic::DecompilationOptions options;
+        options.forensics_directory = directory.str().str();
+        options.forensics_memory = 1;
+        auto result{rellic::Decompile(std::move(module), std::move(options))};
+        REQUIRE(result.Succeeded());
+        THEN("its capture reproduces it on its own") {
+          llvm::LLVMContext capture_ctx;
+          std::unique_ptr<llvm::Module> capture{rellic::LoadModuleFromFile(
+              &capture_ctx, Capture(".bc"), true)};
+          REQUIRE(capture != nullptr);
+          auto sum{capture->getFunction("sum")};
+          REQUIRE(sum != nullptr);
+          CHECK(!sum->isDeclaration());
+        }
+        THEN("the reason for the capture is recorded with its metrics") {
+          auto buffer{llvm::MemoryBuffer::getFile(Capture(".json"))};
+          REQUIRE(buffer);
+          auto json{llvm::json::parse((*buffer)->getBuffer())};
+          REQUIRE(bool(json));
+          auto obj{json->getAsObject()};
+          REQUIRE(obj != nullptr);
+          auto reasons{obj->getArray("reasons")};
+          REQUIRE(reasons != nullptr);
+          REQUIRE(!reasons->empty());
+          CHECK((*reasons)[0].getAsString() == llvm::StringRef("memory"));
+          auto function{obj->getObject("function")};
+          REQUIRE(function != nullptr);
+          CHECK(function->getString("name") == llvm::StringRef("sum"));
+          CHECK(obj->getArray("stages") != nullptr);
+        }
+        THEN("its slowest queries can be replayed") {
+          auto queries{rellic::QueryLog::Read(Capture(".queries.jsonl"))};
+          CHECK(queries.Succeeded());
+        }
+      }
+
+      WHEN("it is under every threshold") {
+        llvm::LLVMContext llvm_ctx;
+        std::unique_ptr<llvm::Module> module{
+            rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+        REQUIRE(module != nullptr);
+        rellic::DecompilationOptions options;
+        options.forensics_directory = directory.str().str();
+        options.forensics_time = std::chrono::hours(1);
+        auto result{rellic::Decompile(std::move(module), std::move(options))};
+        REQUIRE(result.Succeeded());
+        THEN("it is not captured") {
+          CHECK(!llvm::sys::fs::exists(Capture(".bc")));
+        }
+      }
+
+      llvm::sys::fs::remove_directories(directory);
+    }
+  }
+}
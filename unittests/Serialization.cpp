@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Serialization.h"
+
+#include <clang/AST/ASTContext.h>
+#include <doctest/doctest.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <memory>
+#include <string>
+
+#include "rellic/BC/Util.h"
+
+static const char *module_text{R"(
+target triple = "x86_64-pc-linux-gnu"
+
+@counter = global i32 0
+
+define i32 @step(i32 %x) {
+entry:
+  %old = load i32, i32* @counter
+  %new = add i32 %old, %x
+  store i32 %new, i32* @counter
+  %cmp = icmp sgt i32 %new, 10
+  br i1 %cmp, label %big, label %small
+
+big:
+  ret i32 1
+
+small:
+  ret i32 0
+}
+)"};
+
+static std::string Decompile(rellic::DecompilationOptions options) {
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module{
+      rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+  REQUIRE(module != nullptr);
+  auto result{rellic::Decompile(std::move(module), std::move(options))};
+  REQUIRE(result.Succeeded());
+  std::string code;
+  llvm::raw_string_ostream os(code);
+  result.Value().ast->getASTContext().getTranslationUnitDecl()->print(os);
+  return os.str();
+}
+
+static rellic::ProvenanceTable LoadTable(const std::string &data) {
+  auto result{rellic::ProvenanceTable::Load(
+      llvm::MemoryBuffer::getMemBufferCopy(data))};
+  REQUIRE(result.Succeeded());
+  return result.TakeValue();
+}
+
+TEST_SUITE("Serialization") {
+  SCENARIO("Serialize a decompiled module") {
+    GIVEN("A module decompiled with provenance maps") {
+      llvm::LLVMContext llvm_ctx;
+      std::unique_ptr<llvm::Module> module{
+          rellic::LoadModuleFromMemory(&llvm_ctx, module_text, true)};
+      REQUIRE(module != nullptr);
+      rellic::DecompilationOptions options;
+      options.provenance_maps = true;
+      auto result{rellic::Decompile(std::move(module), std::move(options))};
+      REQUIRE(result.Succeeded());
+      auto value{result.TakeValue()};
+
+      std::string ast, table_data;
+      llvm::raw_string_ostream ast_os(ast), table_os(table_data);
+      auto stats{rellic::SerializeAST(value, ast_os, table_os)};
+      REQUIRE(stats.Succeeded());
+      ast_os.flush();
+      table_os.flush();
+
+      THEN("the AST is written as a precompiled AST file") {
+        CHECK(llvm::StringRef(ast).startswith("CPCH"));
+      }
+
+      THEN("the table matches the provenance maps") {
+        auto table{LoadTable(table_data)};
+        rellic::ValueNumbering numbering(*value.module);
+        CHECK(table.GetNumValues() == numbering.GetNumValues());
+        CHECK(table.GetDecls().size() == stats.Value().num_decls);
+        CHECK(table.GetStmts().size() == stats.Value().num_stmts);
+        REQUIRE(!table.GetDecls().empty());
+        REQUIRE(!table.GetStmts().empty());
+
+        auto func{value.module->getFunction("step")};
+        auto fdecl{value.value_decls.Lookup(func)};
+        REQUIRE(fdecl != nullptr);
+        auto stmts{rellic::GetNumberedStmts(
+            const_cast<clang::ValueDecl *>(fdecl))};
+        uint32_t owner{rellic::ValueNumbering::None};
+        for (auto &record : table.GetDecls()) {
+          if (record.value == numbering.GetId(func)) {
+            owner = record.decl;
+          }
+        }
+        REQUIRE(owner != rellic::ValueNumbering::None);
+        CHECK(table.LookupDecl(owner) == numbering.GetId(func));
+        REQUIRE(!table.GetStmts(owner).empty());
+        for (auto &record : table.GetStmts(owner)) {
+          REQUIRE(record.stmt < stmts.size());
+          auto stmt{stmts[record.stmt]};
+          CHECK(numbering.GetValue(record.value) ==
+                value.stmt_provenance.Lookup(stmt));
+          CHECK(table.LookupStmt(owner, record.stmt) == record.value);
+        }
+      }
+    }
+  }
+
+  SCENARIO("Reject malformed provenance tables") {
+    GIVEN("A file that is not a provenance table") {
+      auto result{rellic::ProvenanceTable::Load(
+          llvm::MemoryBuffer::getMemBufferCopy("not a provenance table"))};
+      THEN("it cannot be loaded") { CHECK(!result.Succeeded()); }
+    }
+
+    GIVEN("An empty file") {
+      auto result{rellic::ProvenanceTable::Load(
+          llvm::MemoryBuffer::getMemBufferCopy(""))};
+      THEN("it cannot be loaded") { CHECK(!result.Succeeded()); }
+    }
+  }
+
+  SCENARIO("Resume a decompilation from a checkpoint") {
+    GIVEN("A checkpoint written after structuring the module") {
+      llvm::SmallString<128> path;
+      REQUIRE(!llvm::sys::fs::createTemporaryFile("rellic", "ast", path));
+      std::string checkpoint{path.str().str()};
+      rellic::DecompilationOptions options;
+      options.checkpoint_out = checkpoint;
+      auto expected{Decompile(std::move(options))};
+
+      THEN("resuming from it gives the same code") {
+        rellic::DecompilationOptions options;
+        options.resume_from = checkpoint;
+        CHECK(Decompile(std::move(options)) == expected);
+      }
+
+      THEN("it is rejected by a different module") {
+        llvm::LLVMContext llvm_ctx;
+        std::unique_ptr<llvm::Module> module{rellic::LoadModuleFromMemory(
+            &llvm_ctx, "define void @f() {\n  ret void\n}\n", true)};
+        REQUIRE(module != nullptr);
+        rellic::DecompilationOptions options;
+        options.resume_from = checkpoint;
+        auto result{rellic::Decompile(std::move(module), std::move(options))};
+        CHECK(!result.Succeeded());
+      }
+
+      llvm::sys::fs::remove(checkpoint);
+      llvm::sys::fs::remove(checkpoint + ".json");
+    }
+  }
+}